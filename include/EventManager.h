@@ -1,16 +1,192 @@
 #ifndef EVENT_MANAGER_H
 #define EVENT_MANAGER_H
 
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Event queue and main-loop timers
+//
+// Any thread may post events: input, resizes, and completions of background
+// work. They go into a bounded lock-free ring (one slot per event, each with
+// a sequence number, so producers only contend on one atomic counter). The
+// dispatch thread drains the ring once per frame in processEvents(): mouse
+// moves and resizes for the same target are coalesced to the latest one,
+// then the batch goes to the listeners in order, then due timers fire.
+//
+// Timers live in a hierarchical wheel (4 levels of 64 slots, 1 ms ticks), so
+// adding, cancelling and firing are O(1) and an idle wheel costs nothing per
+// frame. Listeners and timers are dispatch-thread only.
+
+enum class EventType : uint8_t {
+    MouseMove,
+    MouseDown,
+    MouseUp,
+    Scroll,
+    KeyDown,
+    KeyUp,
+    Resize,
+    Completion,
+    Count
+};
+
+struct Event {
+    EventType type;
+    uint32_t target;     // whatever the poster and its listener agree on
+    uint32_t code;       // button or key code
+    uint32_t modifiers;
+    double x, y;         // position, scroll delta or new size
+    uint64_t timestamp;  // EventManager::now() when posted
+    void (*callback)(void *context); // Completion only
+    void *context;
+};
+
+struct EventStats {
+    uint64_t posted;
+    uint64_t dropped;    // ring was full
+    uint64_t coalesced;
+    uint64_t dispatched;
+    uint64_t timers_fired;
+    uint64_t frames;
+};
+
 class EventManager {
 public:
-    EventManager() = default;
-    ~EventManager() = default;
+    using EventHandler = std::function<void(const Event &)>;
+    using TimerId = uint64_t;
+
+    static constexpr size_t kDefaultCapacity = 4096;
+    static constexpr uint32_t kAnyTarget = 0;
+    static constexpr uint64_t kFrameInterval = 16666667; // ns
+
+    explicit EventManager(size_t capacity = kDefaultCapacity);
+    ~EventManager();
 
+    // The process-wide queue the UI runs on, created on first use.
+    static EventManager &shared();
+    // Monotonic nanoseconds, the clock of Event::timestamp.
+    static uint64_t now();
+
+    // Runs processEvents() on the calling thread, at most once per frame,
+    // sleeping while there is nothing to do, until stopEventLoop().
     void startEventLoop();
+    void stopEventLoop();
+    // One frame: dispatch what has been posted, then fire due timers.
     void processEvents();
 
+    // Any thread. Return false, and count a drop, when the ring is full.
+    bool post(const Event &event);
+    bool post(EventType type, uint32_t target, double x = 0, double y = 0,
+              uint32_t code = 0, uint32_t modifiers = 0);
+    bool postCompletion(void (*callback)(void *context), void *context);
+    bool postCompletion(std::function<void()> callback);
+    bool hasPendingEvents() const;
+
+    // Called once when the queue goes from idle to having work, from the
+    // posting thread, so an embedding run loop can schedule a frame. May be
+    // set from any thread at any time; a wake already under way can still
+    // call the handler it replaced.
+    void setWakeHandler(std::function<void()> handler);
+
+    // A fresh target id for a view or object that posts and listens.
+    uint32_t registerTarget() { return next_target.fetch_add(1, std::memory_order_relaxed); }
+    uint32_t addListener(EventType type, uint32_t target, EventHandler handler);
+    void removeListener(uint32_t id);
+
+    // Fires after delay_ms, then every interval_ms if that is not 0.
+    TimerId addTimer(uint32_t delay_ms, uint32_t interval_ms, std::function<void()> callback);
+    bool cancelTimer(TimerId id);
+    // Nanoseconds until the wheel next needs a frame, or -1 if it has no
+    // timers. May be early: far timers are looked at when they cascade.
+    int64_t getTimeUntilNextTimer() const;
+
+    EventStats getStats() const;
+
 private:
-    // Placeholder for event loop internals
+    static constexpr int kWheelLevels = 4;
+    static constexpr int kWheelBits = 6;
+    static constexpr uint32_t kWheelSlots = 1u << kWheelBits;
+    static constexpr uint32_t kNoTimer = UINT32_MAX;
+
+    struct Slot {
+        std::atomic<uint64_t> sequence;
+        Event event;
+    };
+
+    struct Listener {
+        uint32_t id;
+        uint32_t target;
+        EventHandler handler;
+    };
+
+    struct Timer {
+        uint64_t deadline; // tick
+        uint64_t interval; // ticks, 0 for one-shot
+        std::function<void()> callback;
+        uint32_t prev, next;
+        uint32_t generation;
+        uint8_t level;     // kWheelLevels for the overflow list
+        uint8_t slot;
+        bool active;
+        bool firing;       // detached from the wheel while its tick runs
+    };
+
+    bool pop(Event &event);
+    void wake();
+    void coalesce();
+    void dispatch(const Event &event);
+
+    uint64_t currentTick() const;
+    void advanceTimers(uint64_t tick);
+    void insertTimer(uint32_t index);
+    void unlinkTimer(uint32_t index);
+    void cascade(int level);
+    void fireSlot(uint32_t slot);
+    void releaseTimer(uint32_t index);
+
+    // Ring: producers claim positions with tail, the dispatch thread owns head
+    std::unique_ptr<Slot[]> slots;
+    size_t mask;
+    alignas(64) std::atomic<uint64_t> tail;
+    alignas(64) uint64_t head;
+    std::atomic<uint64_t> dropped;
+
+    // Wakeups: set by the first post after a drain
+    alignas(64) std::atomic<bool> wake_pending;
+    std::atomic<bool> running;
+    std::mutex wake_lock;
+    std::condition_variable wake_signal;
+    std::function<void()> wake_handler; // guarded by wake_lock
+
+    // Dispatch
+    std::vector<Event> batch;
+    std::vector<uint8_t> dropped_in_batch;
+    std::vector<Listener> listeners[static_cast<size_t>(EventType::Count)];
+    std::vector<std::pair<EventType, Listener>> added_listeners; // during dispatch
+    uint32_t next_listener_id;
+    std::atomic<uint32_t> next_target;
+    bool in_frame;
+    bool dispatching;
+    bool listeners_removed;
+    uint64_t coalesced;
+    uint64_t dispatched;
+    uint64_t frames;
+
+    // Timer wheel
+    uint64_t epoch;
+    uint64_t wheel_tick;
+    std::vector<Timer> timers;
+    std::vector<uint32_t> free_timers;
+    uint32_t wheel[kWheelLevels + 1][kWheelSlots];
+    uint64_t occupied[kWheelLevels + 1];
+    size_t active_timers;
+    std::vector<uint32_t> firing;
+    uint64_t timers_fired;
 };
 
 #endif // EVENT_MANAGER_H
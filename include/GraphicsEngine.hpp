@@ -4,6 +4,7 @@
 #include <cstdint>
 #include <glm/glm.hpp>
 #include <memory>
+#include <string>
 #include <vector>
 #ifdef __cplusplus
 extern "C" {
@@ -12,6 +13,8 @@ extern "C" {
 #ifdef __cplusplus
 }
 #endif
+#include "RenderTarget.hpp"
+#include "TextureAtlas.hpp"
 
 namespace OS {
 namespace Graphics {
@@ -51,25 +54,6 @@ private:
   uint32_t fragment_shader;
 };
 
-// Render target (framebuffer)
-class RenderTarget {
-public:
-  RenderTarget(uint32_t width, uint32_t height);
-  ~RenderTarget();
-
-  void bind();
-  void unbind();
-  void clear(const glm::vec4 &color);
-
-  uint32_t getColorAttachment() const { return color_texture; }
-
-private:
-  uint32_t framebuffer_id;
-  uint32_t color_texture;
-  uint32_t depth_texture;
-  uint32_t width, height;
-};
-
 // Advanced rendering features
 class AdvancedRenderer {
 public:
@@ -97,20 +81,6 @@ private:
   std::unique_ptr<ShaderProgram> particle_shader;
 };
 
-// Texture management
-class TextureAtlas {
-public:
-  TextureAtlas(uint32_t size);
-  ~TextureAtlas();
-
-  uint32_t addTexture(const std::string &path);
-  void removeTexture(uint32_t texture_id);
-
-private:
-  std::vector<std::pair<uint32_t, std::string>> textures;
-  uint32_t atlas_size;
-};
-
 // Vector graphics rendering
 class VectorGraphics {
 public:
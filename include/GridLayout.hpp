@@ -0,0 +1,121 @@
+#ifndef GRID_LAYOUT_HPP
+#define GRID_LAYOUT_HPP
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+namespace OS {
+namespace Graphics {
+
+// Virtualized grid
+// GridLayout is the arithmetic for a grid of equal cells that fills rows
+// left to right in a top-down (flipped) content area: column count, content
+// height, an item's frame, and which items intersect a vertical span. All
+// of it is O(1), so the item count can be in the millions.
+//
+// GridRecycler sits on top and tracks which items currently have a cell.
+// Each scroll step reports only the items that left the bound range (their
+// slot goes back to the pool) and the items that entered it (they take a
+// pooled slot), so a view keeps roughly one screen of cells alive no matter
+// how many items there are. It also reports the screen ahead in the scroll
+// direction for prefetching content without creating cells for it.
+
+struct GridRect {
+  double x;
+  double y;
+  double width;
+  double height;
+};
+
+struct GridRange {
+  uint64_t first;
+  uint64_t end; // one past the last item
+
+  bool empty() const { return first >= end; }
+  uint64_t size() const { return end > first ? end - first : 0; }
+  bool contains(uint64_t index) const { return index >= first && index < end; }
+};
+
+class GridLayout {
+public:
+  static constexpr uint64_t kNone = UINT64_MAX;
+
+  GridLayout();
+
+  void setItemCount(uint64_t count) { item_count = count; }
+  void setItemSize(double width, double height);
+  void setSpacing(double spacing);
+  void setInset(double inset); // around the whole grid
+  void setViewportWidth(double width);
+
+  uint64_t getItemCount() const { return item_count; }
+  uint32_t getColumns() const { return columns; }
+  uint64_t getRows() const;
+  double getContentHeight() const;
+  double getRowPitch() const { return item_height + spacing; }
+
+  GridRect frame(uint64_t index) const;
+  // Items whose row intersects [top, bottom) in content coordinates.
+  GridRange range(double top, double bottom) const;
+  // The item under a content point, or kNone for gaps and empty space.
+  uint64_t itemAt(double x, double y) const;
+
+private:
+  void updateColumns();
+
+  uint64_t item_count;
+  double item_width;
+  double item_height;
+  double spacing;
+  double inset;
+  double viewport_width;
+  uint32_t columns;
+};
+
+struct GridCell {
+  uint64_t item;
+  uint32_t slot;
+};
+
+struct GridUpdate {
+  std::vector<GridCell> unbound; // slots whose item scrolled away
+  std::vector<GridCell> bound;   // slots that now show a new item
+  GridRange visible;
+  GridRange prefetch; // the next screen in the scroll direction
+};
+
+class GridRecycler {
+public:
+  // overscan_rows are bound on either side of the visible rows so small
+  // scrolls don't rebind at the edge.
+  explicit GridRecycler(uint32_t overscan_rows = 1);
+
+  // Scrolls to [top, top + height). update.bound lists items in ascending
+  // order; slots in unbound are free for reuse by the time bound is read.
+  void update(const GridLayout &layout, double top, double height,
+              GridUpdate &update);
+  // Unbinds everything; call after the layout or the items change and
+  // follow with update().
+  void reset(GridUpdate &update);
+
+  GridRange getBound() const { return bound; }
+  uint32_t getSlotCount() const { return slot_count; }
+  uint32_t slotFor(uint64_t item) const; // UINT32_MAX when not bound
+
+private:
+  uint32_t takeSlot();
+
+  uint32_t overscan_rows;
+  GridRange bound;
+  std::deque<uint32_t> slots; // slots[i] holds bound.first + i
+  std::vector<uint32_t> free_slots;
+  uint32_t slot_count;
+  double last_top;
+  bool scrolling_up;
+};
+
+} // namespace Graphics
+} // namespace OS
+
+#endif // GRID_LAYOUT_HPP
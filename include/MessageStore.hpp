@@ -0,0 +1,136 @@
+#ifndef MESSAGE_STORE_HPP
+#define MESSAGE_STORE_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace OS {
+namespace System {
+
+// Message store
+// Messages are appended as CRC-checked records to the active segment of a
+// log directory; saving one message costs one small write no matter how
+// long the history is. Full segments are sealed and get a sidecar index
+// listing their records, so opening the store reads the sidecars plus the
+// one unsealed segment instead of the whole history. A torn record at the
+// end of the active segment (a crash mid-write) is cut off on open.
+//
+// The in-memory index keeps, per conversation, the location of every
+// message in order, so a page of messages is a handful of preads. Removed
+// conversations leave dead records behind; once they make up half of the
+// sealed data a background thread rewrites the sealed segments without
+// them. Records carry a global sequence number, which keeps ordering (and
+// deduplication after an interrupted compaction) independent of file
+// names.
+
+struct StoredMessage {
+  std::string sender;
+  std::string text;
+  std::string time; // display label
+  int64_t timestamp; // seconds since the epoch
+};
+
+struct MessageStoreStats {
+  uint32_t segments;
+  uint64_t messages;
+  uint64_t live_bytes;
+  uint64_t dead_bytes; // sealed records of removed conversations
+  uint32_t compactions;
+};
+
+class MessageStore {
+public:
+  static constexpr uint32_t kDefaultSegmentBytes = 4u << 20;
+
+  explicit MessageStore(uint32_t segment_bytes = kDefaultSegmentBytes);
+  ~MessageStore(); // waits for a running compaction, then closes
+
+  MessageStore(const MessageStore &) = delete;
+  MessageStore &operator=(const MessageStore &) = delete;
+
+  // Creates the directory if needed and rebuilds the index.
+  bool open(const std::string &directory);
+  void close();
+  bool isOpen() const;
+
+  bool append(const std::string &conversation, const StoredMessage &message);
+  bool removeConversation(const std::string &conversation);
+  bool sync(); // fsync the active segment
+
+  std::vector<std::string> getConversations() const;
+  size_t getMessageCount(const std::string &conversation) const;
+  // Messages [first, first + count) of a conversation, oldest first,
+  // appended to out. Returns how many were read.
+  size_t read(const std::string &conversation, size_t first, size_t count,
+              std::vector<StoredMessage> &out) const;
+
+  // Rewrites the sealed segments now, on the calling thread.
+  bool compact();
+  void setAutoCompact(bool enabled);
+  MessageStoreStats getStats() const;
+
+private:
+  struct Location {
+    uint64_t seq;
+    uint32_t segment;
+    uint32_t offset;
+    uint32_t length; // whole record
+  };
+
+  struct Segment {
+    int fd;
+    uint32_t size;
+    uint32_t live; // bytes of records the index still points at
+    bool sealed;
+  };
+
+  // What a segment's sidecar lists (and what open() rebuilds on a scan)
+  struct IndexEntry {
+    Location location;
+    uint32_t type;
+    std::string conversation;
+  };
+
+  bool readSidecar(uint32_t id, uint32_t size,
+                   std::vector<IndexEntry> &entries) const;
+  bool writeSidecar(uint32_t id, uint32_t size,
+                    const std::vector<IndexEntry> &entries) const;
+  static uint32_t scanSegment(uint32_t id, int fd, uint32_t size,
+                              std::vector<IndexEntry> &entries);
+  bool startSegment();
+  bool sealActive();
+  bool appendRecord(uint32_t type, const std::string &conversation,
+                    const std::string &body);
+  void dropConversation(const std::string &conversation);
+  void maybeCompact();
+  bool compactSealed(std::unique_lock<std::mutex> &guard);
+  std::string segmentPath(uint32_t id, const char *suffix) const;
+  void closeLocked(std::unique_lock<std::mutex> &guard);
+
+  uint32_t segment_bytes;
+  std::string directory;
+
+  mutable std::mutex lock;
+  std::condition_variable compaction_done;
+  std::unordered_map<std::string, std::vector<Location>> conversations;
+  std::unordered_map<uint32_t, Segment> segments;
+  std::vector<IndexEntry> active_entries; // sidecar-to-be of the active one
+  uint32_t active_id;
+  uint32_t next_id;
+  uint64_t next_seq;
+  uint32_t compactions;
+  bool auto_compact;
+  bool compacting;
+  std::thread compactor;
+};
+
+} // namespace System
+} // namespace OS
+
+#endif // MESSAGE_STORE_HPP
@@ -0,0 +1,104 @@
+#ifndef PROCESS_RUNNER_HPP
+#define PROCESS_RUNNER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace OS {
+namespace System {
+
+// Process runner
+// Commands run on their own pseudo-terminal, so they see a real tty (line
+// discipline, job control, colour detection) and Ctrl-C reaches the whole
+// foreground job. One I/O thread multiplexes every session's master side
+// with kqueue (epoll on Linux) and queues output per session. A queue that
+// reaches its limit stops being polled until the consumer drains it; the
+// child then blocks on a full tty instead of growing our memory.
+//
+// Consumers are told through the notify callback, on the I/O thread, when
+// a session's queue goes from empty to non-empty and when it finishes; they
+// should read() until it returns less than they asked for.
+
+struct ProcessOptions {
+  std::string program; // absolute path
+  std::vector<std::string> args; // argv[1...]
+  std::vector<std::string> env;  // "NAME=value"
+  std::string cwd;
+  uint16_t cols = 80;
+  uint16_t rows = 24;
+};
+
+class ProcessRunner {
+public:
+  using Notify = std::function<void(uint32_t session)>;
+
+  static constexpr size_t kDefaultQueueLimit = 256 * 1024;
+
+  explicit ProcessRunner(size_t queue_limit = kDefaultQueueLimit);
+  ~ProcessRunner(); // hangs up on sessions still running
+
+  ProcessRunner(const ProcessRunner &) = delete;
+  ProcessRunner &operator=(const ProcessRunner &) = delete;
+
+  void setNotify(Notify notify);
+
+  // Returns a session id, or 0 when the pty or fork failed.
+  uint32_t spawn(const ProcessOptions &options);
+
+  // Moves up to max bytes of queued output to the end of out.
+  size_t read(uint32_t session, std::string &out, size_t max);
+
+  bool sendInput(uint32_t session, const char *data, size_t length);
+  bool interrupt(uint32_t session); // ^C through the line discipline
+  bool signal(uint32_t session, int signo); // to the whole process group
+  bool resize(uint32_t session, uint16_t cols, uint16_t rows);
+
+  // True once the process has exited and its output has been read.
+  bool finished(uint32_t session, int &exit_status);
+  void release(uint32_t session); // forgets the session, killing it if needed
+
+  size_t getRunningCount();
+
+private:
+  struct Session {
+    int master;
+    int pid;
+    std::string queue;
+    size_t queue_head; // bytes already read from the front of queue
+    bool polling;      // master is registered for reads
+    bool paused;       // reads stopped by backpressure
+    bool resume;       // consumer drained below half the limit
+    bool eof;
+    bool exited;
+    int status;
+  };
+
+  void start();
+  void loop();
+  void drainMaster(uint32_t id, Session &session, bool &notify);
+  void reap(std::vector<uint32_t> &notify);
+  void wake();
+  void closeMaster(Session &session);
+
+  std::mutex lock;
+  std::unordered_map<uint32_t, std::unique_ptr<Session>> sessions;
+  Notify notify_fn;
+  size_t queue_limit;
+  uint32_t next_id;
+  int poll_fd;
+  int wake_fds[2];
+  bool stopping;
+  std::thread io_thread;
+};
+
+} // namespace System
+} // namespace OS
+
+#endif // PROCESS_RUNNER_HPP
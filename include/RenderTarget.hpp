@@ -0,0 +1,91 @@
+#ifndef RENDER_TARGET_HPP
+#define RENDER_TARGET_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "graphics.h"
+#ifdef __cplusplus
+}
+#endif
+
+namespace OS {
+namespace Graphics {
+
+// Render target (offscreen surface)
+// A CPU pixel buffer, 32-bit ARGB with rows top to bottom, sized in pixels
+// for a given backing scale. The C drawing primitives render into it
+// through getContext(), platform 2D APIs through getPixels(), and it blits
+// like any texture through getTexture().
+class RenderTarget {
+public:
+  RenderTarget(uint32_t width, uint32_t height, float scale = 1.0f);
+
+  RenderTarget(const RenderTarget &) = delete;
+  RenderTarget &operator=(const RenderTarget &) = delete;
+
+  void clear(Color color);
+
+  uint32_t *getPixels() { return pixels.data(); }
+  size_t getStride() const { return (size_t)width * sizeof(uint32_t); }
+  uint32_t getWidth() const { return width; }
+  uint32_t getHeight() const { return height; }
+  float getScale() const { return scale; }
+
+  GraphicsContext *getContext() { return &context; }
+  Texture *getTexture() { return &texture; }
+
+private:
+  std::vector<uint32_t> pixels;
+  GraphicsContext context;
+  Texture texture;
+  uint32_t width, height;
+  float scale;
+};
+
+// Layer cache
+// Static content rasterized once into a RenderTarget and reused until the
+// key it was painted for (pixel size and scale) changes, as on a resize or
+// a move to a display with another backing scale, or until invalidate().
+// Whatever changes between frames is drawn over the cached layer by the
+// caller, so a redraw costs one blit plus the changed parts.
+class LayerCache {
+public:
+  using Painter = std::function<void(RenderTarget &target)>;
+
+  struct Stats {
+    uint64_t hits;
+    uint64_t repaints;
+  };
+
+  LayerCache();
+
+  // The layer for this size, painted first if it is missing or stale.
+  RenderTarget &get(uint32_t width, uint32_t height, float scale,
+                    const Painter &paint);
+  // The content changed; the next get() repaints.
+  void invalidate() { valid = false; }
+  // Drops the pixels too, e.g. while the view is offscreen.
+  void release();
+
+  // Changes on every repaint, so platform images made from the pixels
+  // know when to be rebuilt.
+  uint64_t getGeneration() const { return generation; }
+  const Stats &getStats() const { return stats; }
+
+private:
+  std::unique_ptr<RenderTarget> target;
+  bool valid;
+  uint64_t generation;
+  Stats stats;
+};
+
+} // namespace Graphics
+} // namespace OS
+
+#endif // RENDER_TARGET_HPP
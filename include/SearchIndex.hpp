@@ -0,0 +1,123 @@
+#ifndef SEARCH_INDEX_HPP
+#define SEARCH_INDEX_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace OS {
+namespace System {
+
+// Full-text search
+// Text is split into words (runs of letters and digits, UTF-8 aware) and
+// case folded, including the common non-ASCII scripts, so "Straße" matches
+// "STRASSE" and "Ωμέγα" matches "ωμέγα". Each word has a posting list of
+// (document, positions), stored as varint deltas in one byte array with a
+// skip entry every kSkipInterval documents.
+//
+// Updates are incremental: a changed document gets a fresh internal number,
+// its old postings are masked by a liveness bit, and the new ones go into a
+// small sorted in-memory delta. The delta is merged into the compressed
+// base once it outgrows a fraction of it, so indexing stays amortized
+// linear.
+//
+// Queries are conjunctions of words, prefixes (word*) and "quoted
+// phrases", evaluated by leapfrogging the posting cursors from the rarest
+// clause, and ranked with BM25 into a top-k heap. Each skip entry also
+// bounds the scores in its block, so once the heap is full whole blocks
+// that cannot beat its worst hit are skipped undecoded. Not thread-safe.
+
+struct SearchHit {
+  uint32_t document;
+  float score;
+};
+
+class SearchIndex {
+public:
+  static constexpr uint32_t kSkipInterval = 16;
+  static constexpr uint32_t kMaxPrefixTerms = 64; // most common expansions
+
+  SearchIndex();
+
+  // Adds or replaces a document's text.
+  void update(uint32_t document, const std::string &text);
+  void remove(uint32_t document);
+  void clear();
+  // Folds the delta into the base now (update() does it when needed).
+  void merge();
+
+  std::vector<SearchHit> search(const std::string &query, size_t k) const;
+
+  size_t getDocumentCount() const { return live_count; }
+  size_t getTermCount() const { return terms.size(); }
+  size_t getMemoryUsage() const;
+
+  // Folded words of text, in order, for tests and highlighting.
+  static std::vector<std::string> tokenize(const std::string &text);
+  // What a search-as-you-type field should search for: the word still
+  // being typed becomes a prefix, unless it closes a phrase.
+  static std::string prefixQuery(const std::string &typed);
+
+private:
+  struct Term {
+    uint32_t name_offset; // into names
+    uint32_t name_length;
+    uint32_t doc_count;
+    uint64_t offset; // into postings
+    uint32_t skip_offset; // into skips
+    uint32_t skip_count;
+    float max_weight; // of any of its blocks
+  };
+
+  struct Skip {
+    uint32_t last_document; // of the block it ends
+    uint32_t end_offset;    // relative to the term's postings
+    float max_weight;       // BM25 term weight of its best posting
+  };
+
+  struct DeltaList {
+    std::vector<uint8_t> bytes;
+    uint32_t last_document;
+    uint32_t doc_count;
+  };
+
+  struct ListRef;
+  class Cursor;
+  struct Clause;
+
+  std::string termName(const Term &term) const {
+    return std::string(names.data() + term.name_offset, term.name_length);
+  }
+  const Term *findTerm(const std::string &name) const;
+  void termLists(const std::string &name, std::vector<ListRef> &lists) const;
+  bool parseQuery(const std::string &query, std::vector<Clause> &clauses) const;
+  bool isLive(uint32_t document) const {
+    return document < live.size() && live[document];
+  }
+
+  // Base: terms sorted by name
+  std::vector<Term> terms;
+  std::vector<char> names;
+  std::vector<uint8_t> postings;
+  std::vector<Skip> skips;
+  double merge_average_length; // the weights in skips assume it
+
+  std::map<std::string, DeltaList> delta;
+  size_t delta_bytes;
+
+  // Internal numbers only grow; each update of a document takes a new one
+  std::vector<uint32_t> external; // internal -> caller's id
+  std::vector<uint32_t> lengths;  // internal -> words
+  std::vector<bool> live;
+  std::unordered_map<uint32_t, uint32_t> internal; // caller's id -> current
+  size_t live_count;
+  uint64_t live_words;
+};
+
+} // namespace System
+} // namespace OS
+
+#endif // SEARCH_INDEX_HPP
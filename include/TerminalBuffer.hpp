@@ -0,0 +1,122 @@
+#ifndef TERMINAL_BUFFER_HPP
+#define TERMINAL_BUFFER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace OS {
+namespace System {
+
+// Terminal scrollback
+// Output is fed as raw bytes through an incremental escape-sequence parser
+// (SGR colours and styles; other sequences are consumed and ignored) into a
+// fixed ring of lines. Each line holds UTF-8 text plus runs of attributes.
+// Lines are recycled in place, so memory stays bounded by the scrollback
+// limit times the line length limit no matter how much is streamed; longer
+// lines are soft-wrapped.
+//
+// Lines are addressed by a sequence number that only grows. A view keeps
+// its copy in sync with takeUpdate(): drop lines before `first`, replace
+// lines from `changed` on, and append up to `end`. Usually only the open
+// (last) line and new lines have to be redrawn.
+
+// Colours: 0 is the default, otherwise the top byte says which kind.
+constexpr uint32_t kTermColorDefault = 0;
+constexpr uint32_t kTermColorIndexed = 1u << 24; // low byte: 0-255 palette
+constexpr uint32_t kTermColorRGB = 2u << 24;     // low 24 bits: 0xRRGGBB
+
+enum TermStyle : uint16_t {
+  kTermBold = 1 << 0,
+  kTermDim = 1 << 1,
+  kTermItalic = 1 << 2,
+  kTermUnderline = 1 << 3,
+  kTermInverse = 1 << 4,
+  kTermStrike = 1 << 5,
+};
+
+struct TermAttributes {
+  uint32_t fg;
+  uint32_t bg;
+  uint16_t style;
+
+  bool operator==(const TermAttributes &o) const {
+    return fg == o.fg && bg == o.bg && style == o.style;
+  }
+  bool operator!=(const TermAttributes &o) const { return !(*this == o); }
+};
+
+struct TermRun {
+  uint32_t start; // byte offset; the run ends where the next one starts
+  TermAttributes attributes;
+};
+
+struct TermLine {
+  std::string text; // UTF-8
+  std::vector<TermRun> runs;
+  bool wrapped; // continues on the next line (no newline after it)
+};
+
+struct TermUpdate {
+  uint64_t first;   // oldest line still held
+  uint64_t changed; // first line to redraw (may precede first: clamp)
+  uint64_t end;     // one past the open line
+  bool reset;       // everything was cleared
+};
+
+class TerminalBuffer {
+public:
+  static constexpr uint32_t kDefaultScrollback = 10000;
+  static constexpr uint32_t kDefaultMaxLineBytes = 4096;
+
+  explicit TerminalBuffer(uint32_t scrollback = kDefaultScrollback,
+                          uint32_t max_line_bytes = kDefaultMaxLineBytes);
+
+  void write(const char *data, size_t length);
+  void write(const std::string &text) { write(text.data(), text.size()); }
+  void clear();
+  void setScrollback(uint32_t scrollback); // keeps the newest lines
+
+  uint64_t firstLine() const { return first_seq; }
+  uint64_t endLine() const { return end_seq; }
+  const TermLine *line(uint64_t seq) const; // nullptr once evicted
+  const TermAttributes &attributes() const { return current; }
+
+  TermUpdate takeUpdate();
+
+private:
+  enum class State : uint8_t { Ground, Escape, EscapeIntermediate, Csi, Osc,
+                               OscEscape };
+
+  static constexpr uint32_t kMaxParams = 16;
+
+  TermLine &openLine() { return lines[(end_seq - 1) % lines.size()]; }
+  void newLine(bool wrapped);
+  void appendText(const char *data, size_t length);
+  void backspace();
+  void dispatchCsi(uint8_t final_byte);
+  void applySgr();
+  uint32_t groupEnd(uint32_t i) const;
+  bool extendedColor(uint32_t &i, uint32_t &color) const;
+
+  std::vector<TermLine> lines; // ring
+  uint64_t first_seq;
+  uint64_t end_seq;
+  uint64_t dirty_seq;
+  bool dirty_reset;
+  uint32_t max_line_bytes;
+
+  TermAttributes current;
+  State state;
+  bool pending_cr; // a lone CR rewrites the line on the next text
+  bool csi_private;
+  uint32_t param_count;
+  uint32_t params[kMaxParams];
+  uint32_t sub_params; // bit i: params[i] followed a ':' (a subparameter)
+};
+
+} // namespace System
+} // namespace OS
+
+#endif // TERMINAL_BUFFER_HPP
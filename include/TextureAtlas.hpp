@@ -0,0 +1,114 @@
+#ifndef TEXTURE_ATLAS_HPP
+#define TEXTURE_ATLAS_HPP
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "graphics.h"
+#ifdef __cplusplus
+}
+#endif
+
+namespace OS {
+namespace Graphics {
+
+// Texture atlas
+// Small images (icons, glyphs) are packed into a few large pages with a
+// skyline packer, so they share contiguous memory and draws from the same
+// page can be issued together. When every page is full the least recently
+// used page is evicted as a whole; ids that lived on it become stale and
+// lookup() returns nullptr for them.
+
+// Location of a packed texture
+struct AtlasRegion {
+  uint32_t page;
+  OSRect rect; // pixels within the page
+  float u0, v0, u1, v1;
+};
+
+struct AtlasDraw {
+  uint32_t texture_id;
+  int32_t x;
+  int32_t y;
+};
+
+class TextureAtlas {
+public:
+  // Decodes an image file into ARGB pixels; returns false on failure.
+  using Loader = std::function<bool(const std::string &path, uint32_t &width,
+                                    uint32_t &height,
+                                    std::vector<uint32_t> &pixels)>;
+
+  TextureAtlas(uint32_t size, uint32_t max_pages = 4);
+  ~TextureAtlas();
+
+  TextureAtlas(const TextureAtlas &) = delete;
+  TextureAtlas &operator=(const TextureAtlas &) = delete;
+
+  // Return 0 when the image cannot be loaded or is larger than a page.
+  // Adding the same path twice returns the existing id.
+  uint32_t addTexture(const std::string &path);
+  uint32_t addTexture(uint32_t width, uint32_t height, const uint32_t *pixels);
+  void removeTexture(uint32_t texture_id);
+
+  // O(1); marks the page as recently used.
+  const AtlasRegion *lookup(uint32_t texture_id);
+
+  void draw(GraphicsContext *ctx, uint32_t texture_id, int32_t x, int32_t y);
+  // Draws grouped by page, preserving order within a page. Only use when
+  // the draws do not overlap, since cross-page order is not kept.
+  void drawBatch(GraphicsContext *ctx, const std::vector<AtlasDraw> &draws);
+
+  void setLoader(Loader loader) { this->loader = std::move(loader); }
+  Texture *getPage(uint32_t page) const;
+  uint32_t getPageCount() const { return (uint32_t)pages.size(); }
+  float getOccupancy() const; // packed area / allocated page area
+
+private:
+  struct SkylineNode {
+    int32_t x, y, width;
+  };
+
+  struct Page {
+    Texture *texture;
+    std::vector<SkylineNode> skyline;
+    std::vector<uint32_t> slots; // live entries on this page
+    uint64_t last_used;
+    uint64_t used_area;
+  };
+
+  struct Slot {
+    uint32_t generation;
+    bool live;
+    AtlasRegion region;
+    std::string path;
+  };
+
+  bool packInto(Page &page, int32_t width, int32_t height, int32_t &x,
+                int32_t &y);
+  bool allocate(int32_t width, int32_t height, uint32_t &page, int32_t &x,
+                int32_t &y);
+  void resetPage(uint32_t page);
+  void releaseSlot(uint32_t index);
+  Slot *resolve(uint32_t texture_id);
+
+  std::vector<Page> pages;
+  std::vector<Slot> slots;
+  std::vector<uint32_t> free_slots;
+  std::unordered_map<std::string, uint32_t> path_ids;
+  std::vector<uint32_t> batch_order; // scratch for drawBatch
+  Loader loader;
+  uint32_t atlas_size;
+  uint32_t max_pages;
+  uint64_t clock;
+};
+
+} // namespace Graphics
+} // namespace OS
+
+#endif // TEXTURE_ATLAS_HPP
@@ -0,0 +1,143 @@
+#ifndef THUMBNAIL_SERVICE_HPP
+#define THUMBNAIL_SERVICE_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace OS {
+namespace Graphics {
+
+// Thumbnail service
+// Requests are decoded on a pool of worker threads, box-filtered down to
+// fit max_dimension and kept in two caches: a byte-bounded LRU in memory
+// and a directory of raw thumbnails on disk, named by a hash of (path,
+// mtime, size, max_dimension) so an edited file simply misses. The disk
+// cache is trimmed oldest-first (hits refresh a file's mtime) when it
+// outgrows its budget.
+//
+// Pixels are 32-bit ARGB, premultiplied as platform decoders produce them;
+// the resampler averages all four channels, which is exact for
+// premultiplied data.
+
+struct Thumbnail {
+  uint32_t width;
+  uint32_t height;
+  std::vector<uint32_t> pixels;
+};
+
+using ThumbnailRef = std::shared_ptr<const Thumbnail>;
+
+struct ThumbnailStats {
+  uint64_t requests;
+  uint64_t memory_hits;
+  uint64_t disk_hits;
+  uint64_t decoded;
+  uint64_t failed;
+  uint64_t decode_ns;   // inside the decoder
+  uint64_t resample_ns; // inside resample()
+};
+
+class ThumbnailService {
+public:
+  // Decodes path into pixels. size_hint is the smallest dimension worth
+  // decoding at; decoders that can subsample (JPEG DCT scaling, embedded
+  // previews) should stay at or above it and leave the rest to resample().
+  using Decoder = std::function<bool(const std::string &path,
+                                     uint32_t size_hint, uint32_t &width,
+                                     uint32_t &height,
+                                     std::vector<uint32_t> &pixels)>;
+  // Runs on a worker thread; thumbnail is null when decoding failed.
+  using Callback =
+      std::function<void(const std::string &path, ThumbnailRef thumbnail)>;
+
+  static constexpr size_t kDefaultMemoryBudget = 64u << 20;
+  static constexpr uint64_t kDefaultDiskBudget = 256ull << 20;
+
+  // num_workers == 0 uses the online CPU count.
+  ThumbnailService(const std::string &cache_dir, uint32_t max_dimension,
+                   uint32_t num_workers = 0,
+                   size_t memory_budget = kDefaultMemoryBudget,
+                   uint64_t disk_budget = kDefaultDiskBudget);
+  ~ThumbnailService(); // drops queued requests and joins the workers
+
+  ThumbnailService(const ThumbnailService &) = delete;
+  ThumbnailService &operator=(const ThumbnailService &) = delete;
+
+  void setDecoder(Decoder decoder);
+
+  // Memory cache only; never touches the disk. Marks the entry used.
+  ThumbnailRef lookup(const std::string &path);
+
+  // Queues a request; concurrent requests for one path share the work.
+  void request(const std::string &path, Callback callback);
+  void cancel(const std::string &path);
+  void cancelAll();
+
+  ThumbnailStats getStats() const;
+  uint32_t getMaxDimension() const { return max_dimension; }
+
+  // Fit (width, height) inside max x max keeping the aspect ratio; images
+  // that already fit are left alone.
+  static void fitSize(uint32_t width, uint32_t height, uint32_t max,
+                      uint32_t &out_width, uint32_t &out_height);
+
+  // Area-averaging (box) resample of a whole image. src_stride is in
+  // pixels.
+  static void resample(const uint32_t *src, uint32_t src_width,
+                       uint32_t src_height, size_t src_stride, uint32_t *dst,
+                       uint32_t dst_width, uint32_t dst_height);
+
+private:
+  struct MemoryEntry {
+    ThumbnailRef thumbnail;
+    uint64_t key;
+    std::list<std::string>::iterator lru;
+  };
+
+  void workerMain();
+  ThumbnailRef produce(const std::string &path);
+  ThumbnailRef memoryGet(const std::string &path, uint64_t key);
+  void memoryPut(const std::string &path, uint64_t key, ThumbnailRef thumbnail);
+  ThumbnailRef diskGet(uint64_t key);
+  void diskPut(uint64_t key, const Thumbnail &thumbnail);
+  void diskTrim();
+  std::string cachePath(uint64_t key) const;
+
+  std::string cache_dir;
+  uint32_t max_dimension;
+  size_t memory_budget;
+  uint64_t disk_budget;
+
+  mutable std::mutex lock;
+  std::condition_variable ready;
+  std::deque<std::string> queue;
+  std::unordered_map<std::string, std::vector<Callback>> pending;
+  std::unordered_map<std::string, MemoryEntry> memory;
+  std::list<std::string> lru; // most recent first
+  size_t memory_used;
+  Decoder decoder;
+  bool stopping;
+  std::vector<std::thread> workers;
+
+  std::mutex disk_lock;
+  int64_t disk_used; // -1 until the directory has been scanned
+
+  std::atomic<uint64_t> requests, memory_hits, disk_hits, decoded, failed;
+  std::atomic<uint64_t> decode_ns, resample_ns;
+};
+
+} // namespace Graphics
+} // namespace OS
+
+#endif // THUMBNAIL_SERVICE_HPP
@@ -0,0 +1,136 @@
+#ifndef VIRTUAL_FILE_SYSTEM_HPP
+#define VIRTUAL_FILE_SYSTEM_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace OS {
+namespace System {
+
+// Virtual file system
+// Inodes live in a flat table; a hash index keyed by (parent, name) resolves
+// one path component in O(1), so a path resolves in O(depth). Every
+// directory keeps its children sorted folders first, then case-insensitively
+// (ASCII), so listing is a pointer into that array.
+//
+// save() writes a compact image laid out exactly like the in-memory tables.
+// open() maps it read-only and serves lookups and listings straight from the
+// mapping; the first mutation copies it into private memory. Inode numbers
+// are renumbered by save() and only hold within one session.
+
+struct VfsStat {
+  uint32_t inode;
+  uint32_t parent;
+  bool is_directory;
+  uint64_t size;  // bytes
+  int64_t mtime;  // seconds since the epoch
+};
+
+struct VfsListing {
+  const uint32_t *entries; // inode numbers, sorted; valid until next mutation
+  uint32_t count;
+};
+
+class VirtualFileSystem {
+public:
+  static constexpr uint32_t kRoot = 0;
+  static constexpr uint32_t kInvalid = UINT32_MAX;
+
+  VirtualFileSystem(); // just the root directory
+  ~VirtualFileSystem();
+
+  VirtualFileSystem(const VirtualFileSystem &) = delete;
+  VirtualFileSystem &operator=(const VirtualFileSystem &) = delete;
+
+  // Image files. Both return false and leave the tree untouched on failure;
+  // open() checks every offset and inode reference in the image first, so
+  // a truncated or corrupt file is rejected rather than read out of bounds.
+  bool open(const std::string &image_path);
+  bool save(const std::string &image_path);
+
+  // kInvalid when missing. Empty components and "." are skipped, ".."
+  // moves to the parent.
+  uint32_t lookup(const std::string &path) const;
+  uint32_t lookup(uint32_t parent, const char *name, size_t length) const;
+
+  // mtime 0 means now. Fail with kInvalid when the parent is not a
+  // directory, the name is empty or contains '/', or it already exists.
+  uint32_t create(uint32_t parent, const std::string &name, bool directory,
+                  uint64_t size = 0, int64_t mtime = 0);
+  uint32_t makeDirectories(const std::string &path); // like mkdir -p
+  bool remove(uint32_t inode);                         // recursive
+  bool rename(uint32_t inode, uint32_t new_parent, const std::string &name);
+  bool setSize(uint32_t inode, uint64_t size, int64_t mtime = 0);
+
+  bool stat(uint32_t inode, VfsStat &out) const;
+  bool isDirectory(uint32_t inode) const;
+  std::string name(uint32_t inode) const;
+  std::string path(uint32_t inode) const;
+  VfsListing list(uint32_t directory); // empty for files
+
+  uint32_t getCount() const { return live_count; }
+  bool isMapped() const { return mapping != nullptr; }
+
+private:
+  // Shared by memory and image; keep it POD with a stable layout.
+  struct Inode {
+    uint64_t size;
+    int64_t mtime;
+    uint32_t parent;
+    uint32_t hash; // of (parent, name)
+    uint32_t name_offset;
+    uint32_t name_length;
+    uint32_t flags;
+    uint32_t child_offset; // image only
+    uint32_t child_count;  // image only
+    uint32_t reserved;
+  };
+
+  static bool validImage(const void *base, size_t size);
+  bool isLive(uint32_t inode) const;
+  const Inode &node(uint32_t inode) const { return inodes[inode]; }
+  const char *nameOf(const Inode &inode) const {
+    return names + inode.name_offset;
+  }
+  uint32_t homeSlot(uint32_t hash) const { return hash & index_mask; }
+  bool before(uint32_t a, uint32_t b) const; // listing order
+
+  void materialize();
+  void reset();
+  void adopt();
+  uint32_t allocateInode();
+  uint32_t appendName(const char *name, size_t length);
+  void indexInsert(uint32_t inode);
+  void indexErase(uint32_t inode);
+  void growIndex();
+  void linkChild(uint32_t parent, uint32_t inode);
+  void unlinkChild(uint32_t parent, uint32_t inode);
+  void sortChildren(uint32_t directory);
+  void touch(uint32_t inode, int64_t mtime);
+
+  // Views used by every read; they point either into the mapping or into
+  // the owned vectors below.
+  const Inode *inodes;
+  const char *names;
+  const uint32_t *index;
+  const uint32_t *image_children;
+  uint32_t inode_count;
+  uint32_t index_mask;
+  uint32_t live_count;
+
+  void *mapping;
+  size_t mapping_size;
+
+  std::vector<Inode> own_inodes;
+  std::vector<char> own_names;
+  std::vector<uint32_t> own_index;
+  std::vector<std::vector<uint32_t>> children; // per directory inode
+  std::vector<uint32_t> free_inodes;
+};
+
+} // namespace System
+} // namespace OS
+
+#endif // VIRTUAL_FILE_SYSTEM_HPP
@@ -1,6 +1,7 @@
 #ifndef WINDOW_H
 #define WINDOW_H
 
+#include <cstdint>
 #include <string>
 #include <memory>
 
@@ -28,12 +29,16 @@ public:
 
     void focus();
     void blur();
+    // Use WindowManager::setWindowFrame for managed windows, so hit-testing
+    // sees the change.
+    void setFrame(int x, int y, int width, int height);
 
     const std::string& getTitle() const { return title; }
     int getX() const { return x; }
     int getY() const { return y; }
     int getWidth() const { return width; }
     int getHeight() const { return height; }
+    bool isFocused() const { return hasFocus; }
 
 private:
     std::string title;
@@ -1,25 +1,49 @@
 #ifndef WINDOW_MANAGER_H
 #define WINDOW_MANAGER_H
 
-#include <vector>
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 class Window;
+struct SpatialIndex;
 
+// Windows in z-order (bottom first), plus a spatial index over their frames
+// (see spatial_index.h) so hit-testing and rect queries do not scan every
+// window. Frames must change through setWindowFrame to stay indexed.
 class WindowManager {
 public:
-    WindowManager() = default;
-    ~WindowManager() = default;
+    WindowManager();
+    ~WindowManager();
+    WindowManager(const WindowManager&) = delete;
+    WindowManager& operator=(const WindowManager&) = delete;
 
     void registerWindow(std::shared_ptr<Window> window);
     std::shared_ptr<Window> createWindow(const std::string& title, int x, int y, int width, int height);
+    // Also raises the window to the top.
     void setFocused(std::shared_ptr<Window> window);
     void removeWindow(std::shared_ptr<Window> window);
     const std::vector<std::shared_ptr<Window>>& getAllWindows() const;
 
+    void setWindowFrame(const std::shared_ptr<Window>& window, int x, int y, int width, int height);
+    // Topmost window containing the point, or null.
+    std::shared_ptr<Window> windowAt(int x, int y) const;
+    // Windows intersecting the rect, front to back.
+    std::vector<std::shared_ptr<Window>> windowsInRect(int x, int y, int width, int height);
+
 private:
+    uint32_t idOf(const Window* window) const;
+
     std::vector<std::shared_ptr<Window>> windows;
     std::shared_ptr<Window> focusedWindow;
+
+    SpatialIndex* spatialIndex;
+    std::unordered_map<const Window*, uint32_t> ids;
+    std::unordered_map<uint32_t, std::shared_ptr<Window>> windowsById;
+    uint32_t nextId;
+    uint64_t nextZ;
 };
 
 #endif // WINDOW_MANAGER_H
@@ -0,0 +1,44 @@
+// Blur engine - separable three-pass box blur (Gaussian approximation)
+// Cost per pixel is constant in the radius: each pass is a running sum.
+
+#ifndef BLUR_H
+#define BLUR_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Blur a width x height image of `channels` interleaved 8-bit channels
+// (4 for ARGB framebuffers, 1 for alpha masks) in place. `stride` is the
+// row pitch in bytes. Rows and column strips are split across the shared
+// thread pool. `radius` is the visual extent (~3 sigma).
+void blur_image_u8(uint8_t *pixels, uint32_t width, uint32_t height,
+                   uint32_t stride, uint32_t channels, float radius);
+
+// Total reach in pixels of the passes blur_image_u8 runs for `radius`;
+// pixels further than this from a region never influence it.
+uint32_t blur_reach(float radius);
+
+// Cached shadow masks: a blurred rounded-rect coverage mask of
+// (width + 2 * pad) x (height + 2 * pad) bytes, where pad is the blur
+// radius. Masks are keyed by (width, height, blur radius, corner radius) so
+// a window that only moves reuses its mask. Release every acquired mask.
+typedef struct {
+  uint32_t width;
+  uint32_t height;
+  int32_t pad;
+  const uint8_t *coverage;
+} ShadowMask;
+
+const ShadowMask *shadow_mask_acquire(uint32_t width, uint32_t height,
+                                      float blur_radius, int corner_radius);
+void shadow_mask_release(const ShadowMask *mask);
+void shadow_mask_cache_clear(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BLUR_H
@@ -0,0 +1,94 @@
+// Frame arena - bump allocation for data that lives for one frame
+//
+// Transient render and string data (formatted labels, scratch rows, the
+// tile renderer's command list) is carved out of large blocks by bumping a
+// cursor; nothing is freed individually. frame_arena_end_frame throws a
+// frame's allocations away in O(1) by rewinding a cursor. The arena is
+// double buffered: allocations made during frame N stay valid through
+// frame N + 1 (so whatever present still reads survives the swap) and are
+// reused once frame N + 2 begins.
+//
+// Blocks are kept once obtained, so after the first few frames of a
+// workload the arena stops calling malloc. A request larger than the block
+// size gets a block of its own, which is kept and reused the same way.
+//
+// frame_arena_alloc may be called from several threads at once (the tile
+// workers use it); frame_arena_grow and frame_arena_end_frame may not run
+// concurrently with anything else on the same arena.
+
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAME_ARENA_BLOCK_SIZE (256 * 1024)
+#define FRAME_ARENA_ALIGN 16
+
+typedef struct FrameArena FrameArena;
+
+typedef struct {
+  uint64_t frames;        // completed frames
+  uint64_t bytes;         // during the current frame, after alignment
+  uint64_t high_water;    // most bytes any one frame used
+  uint64_t capacity;      // bytes in all blocks, both sides
+  uint64_t system_allocs; // blocks obtained from malloc since creation
+  uint32_t blocks;
+} FrameArenaStats;
+
+// block_size 0 uses FRAME_ARENA_BLOCK_SIZE.
+FrameArena *frame_arena_create(size_t block_size);
+void frame_arena_destroy(FrameArena *arena);
+
+// FRAME_ARENA_ALIGN-aligned; NULL only if the system is out of memory.
+void *frame_arena_alloc(FrameArena *arena, size_t size);
+void *frame_arena_calloc(FrameArena *arena, size_t count, size_t size);
+// Resizes ptr (NULL, or a block from this frame old_size bytes long).
+// Extends in place when ptr is the most recent allocation and there is
+// room; otherwise copies into a new allocation and abandons the old one.
+void *frame_arena_grow(FrameArena *arena, void *ptr, size_t old_size,
+                       size_t new_size);
+
+// Ends the current frame: the frame before it is released and its memory
+// becomes the next frame's.
+void frame_arena_end_frame(FrameArena *arena);
+// Completed frames; changes exactly when frame_arena_end_frame runs, so
+// callers caching arena memory can tell when it went stale.
+uint64_t frame_arena_frame(const FrameArena *arena);
+void frame_arena_get_stats(FrameArena *arena, FrameArenaStats *stats);
+
+// Runs frames through an arena the way a compositor uses it: each frame
+// formats strings with string_format_in, fills vectors made with
+// vector_create_in and takes scratch buffers of random sizes. Frames cycle
+// through `shapes` distinct workloads, so once every shape has run on both
+// sides the arena has all the blocks it needs. steady_system_allocs counts
+// blocks obtained after warmup_frames and must be 0; the function returns
+// false if it is not (or allocation failed).
+typedef struct {
+  uint32_t frames;
+  uint32_t warmup_frames;
+  uint32_t shapes;
+  uint32_t allocs_per_frame;
+  uint32_t max_alloc; // bytes; scratch sizes are uniform in [1, max_alloc]
+  uint64_t seed;
+} FrameArenaSimConfig;
+
+typedef struct {
+  uint64_t steady_system_allocs;
+  double ns_per_alloc;
+  FrameArenaStats after;
+} FrameArenaSimResult;
+
+bool frame_arena_simulate(const FrameArenaSimConfig *config,
+                          FrameArenaSimResult *result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FRAME_ARENA_H
@@ -32,6 +32,9 @@ typedef struct {
   uint32_t height;
   uint32_t bits_per_pixel;
   void *framebuffer;
+  OSRect clip; // all drawing is clipped to this rect
+  struct TileRenderer *recorder; // non-NULL while drawing is deferred
+  struct FrameArena *arena;      // per-frame scratch, NULL: heap
 } GraphicsContext;
 
 // Texture for images/sprites
@@ -42,10 +45,16 @@ typedef struct {
   void *data;
 } Texture;
 
-// Initialization
+// Initialization. With ENABLE_TILED_RENDERING (os_config.h) drawing into
+// the screen context is recorded and rasterized in parallel tiles by
+// graphics_present / graphics_present_rects.
 GraphicsContext *graphics_init(uint32_t width, uint32_t height);
 void graphics_shutdown(void);
 
+// Clipping (the clip is always kept inside the surface)
+void graphics_set_clip(GraphicsContext *ctx, OSRect clip);
+void graphics_reset_clip(GraphicsContext *ctx);
+
 // Drawing primitives
 void draw_rect(GraphicsContext *ctx, OSRect rect, Color color);
 void draw_rounded_rect(GraphicsContext *ctx, OSRect rect, int radius,
@@ -61,16 +70,24 @@ void draw_line(GraphicsContext *ctx, int32_t x1, int32_t y1, int32_t x2,
 Texture *texture_create(uint32_t width, uint32_t height);
 void texture_destroy(Texture *texture);
 void draw_texture(GraphicsContext *ctx, Texture *texture, int32_t x, int32_t y);
+// Draw the src sub-rect of a texture (e.g. an atlas entry) at x, y.
+void draw_texture_region(GraphicsContext *ctx, Texture *texture, OSRect src,
+                         int32_t x, int32_t y);
 
 // Effects and filters
 void apply_blur(GraphicsContext *ctx, OSRect bounds, float radius);
 void apply_shadow(GraphicsContext *ctx, OSRect bounds, Color shadow_color,
                   float blur_radius);
+void apply_rounded_shadow(GraphicsContext *ctx, OSRect bounds,
+                          int corner_radius, Color shadow_color,
+                          float blur_radius);
 void apply_gradient(GraphicsContext *ctx, OSRect bounds, Color start_color,
                     Color end_color, bool horizontal);
 
 // Display update
 void graphics_present(GraphicsContext *ctx);
+void graphics_present_rects(GraphicsContext *ctx, const OSRect *rects,
+                            uint32_t count);
 
 #endif // GRAPHICS_H
 #ifdef __cplusplus
@@ -0,0 +1,100 @@
+// IPC - message channels between processes
+//
+// A channel is a ring of fixed-size message slots living in kernel pages
+// (the simulated shared memory). SPSC channels serve one sender and one
+// receiver with plain loads and stores on separate cache lines; MPMC
+// channels let any number of each claim slots through a per-slot sequence
+// number. Neither takes a lock on the message path.
+//
+// Small messages travel inline in the slot. Larger payloads are written
+// straight into a block of pages from ipc_payload_alloc and only the page
+// handle is sent: the block is recharged to the kernel while in flight and
+// to the receiving process on delivery, so the bytes are never copied.
+//
+// ipc_receive spins briefly, then parks on a futex-style wait word that
+// senders bump only when someone is parked, so an uncontended send never
+// makes a system call.
+
+#ifndef IPC_H
+#define IPC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define IPC_INLINE_SIZE 40
+#define IPC_NAME_MAX 64
+#define IPC_SPIN_LIMIT 2000 // polls before a blocking receive parks
+
+typedef enum { IPC_SPSC, IPC_MPMC } IpcMode;
+
+enum {
+  IPC_MESSAGE_PAGES = 1 << 0, // payload is a page block, not inline bytes
+};
+
+typedef struct {
+  uint32_t sender; // pid, filled in by ipc_send
+  uint32_t type;   // meaning is up to the processes
+  uint32_t length; // payload bytes
+  uint32_t flags;
+  union {
+    uint8_t bytes[IPC_INLINE_SIZE];
+    struct {
+      void *pages;
+      uint32_t order;
+    } block;
+  } payload;
+} IpcMessage;
+
+typedef struct IpcChannel IpcChannel;
+
+typedef struct {
+  uint64_t sent;
+  uint64_t received;
+  uint64_t full; // sends refused because the ring was full
+  uint64_t parks;
+  uint64_t wakes;
+  uint32_t capacity;
+  uint32_t queued;
+} IpcChannelStats;
+
+// Capacity is rounded up to a power of two. Named channels can be found
+// with ipc_channel_open; names are unique. The creator destroys it.
+IpcChannel *ipc_channel_create(const char *name, IpcMode mode,
+                               uint32_t capacity);
+IpcChannel *ipc_channel_open(const char *name);
+// Fails later sends and wakes every parked receiver; queued messages can
+// still be received.
+void ipc_channel_close(IpcChannel *channel);
+// Frees payloads still queued.
+void ipc_channel_destroy(IpcChannel *channel);
+
+// Non-blocking; false when the ring is full or the channel closed. On
+// success a page payload belongs to the channel until it is received.
+bool ipc_send(IpcChannel *channel, IpcMessage *message);
+bool ipc_send_bytes(IpcChannel *channel, uint32_t type, const void *data,
+                    uint32_t length); // length <= IPC_INLINE_SIZE
+
+bool ipc_try_receive(IpcChannel *channel, IpcMessage *message);
+// Waits up to timeout_ns (negative: forever). False on timeout, or when the
+// channel is closed and drained.
+bool ipc_receive(IpcChannel *channel, IpcMessage *message, int64_t timeout_ns);
+
+// Pages for a payload of length bytes, charged to the calling process and
+// described in message; write the payload there, then send it.
+void *ipc_payload_alloc(IpcMessage *message, uint32_t type, size_t length);
+void *ipc_payload_data(IpcMessage *message);
+// Returns a received page payload's block; inline payloads need nothing.
+void ipc_payload_free(IpcMessage *message);
+
+void ipc_channel_get_stats(IpcChannel *channel, IpcChannelStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IPC_H
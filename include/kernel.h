@@ -9,9 +9,9 @@
 typedef struct {
   uint32_t pid;
   char name[256];
-  uint32_t priority;
-  uint32_t state; // 0=ready, 1=running, 2=blocked
-  uint64_t cpu_time;
+  uint32_t priority; // scheduler level, 0 = highest
+  uint32_t state;    // 0=ready, 1=running, 2=blocked
+  uint64_t cpu_time; // scheduler ticks (1 ms)
 } OSProcess;
 
 // Memory Management
@@ -36,12 +36,33 @@ typedef struct {
   bool enabled;
 } OSDevice;
 
+// Per-core scheduling statistics (core 0 also serves kernel_run)
+typedef struct {
+  uint32_t core_id;
+  uint64_t cpu_time; // scheduler ticks
+  uint64_t busy_ns;
+  uint64_t quanta;
+  uint64_t steals; // processes taken from other cores
+} OSCoreInfo;
+
 // Function declarations
 void kernel_init(void);
 void kernel_run(void);
 uint32_t process_create(const char *name, void (*entry_point)(void));
 void process_destroy(uint32_t pid);
+OSProcess *process_find(uint32_t pid); // O(1), NULL if no such process
+uint32_t process_current(void); // pid running on this core, 0 outside one
+// Entry points run one quantum per call; a process runs until it calls
+// process_exit (or is destroyed).
+void process_exit(void);
 OSMemoryInfo *get_memory_info(void);
+uint64_t process_memory_usage(uint32_t pid); // bytes of pages charged to pid
 void schedule_process(void);
 
+// Run every process on num_cores worker threads (0 = online CPUs), each
+// with its own MLFQ, until all processes have exited. Idle cores steal
+// from busy ones and sleep when there is nothing to steal.
+void kernel_run_smp(uint32_t num_cores);
+uint32_t get_core_info(OSCoreInfo *cores, uint32_t max_cores);
+
 #endif // KERNEL_H
@@ -0,0 +1,136 @@
+// Logger - asynchronous logging behind the LOG_* macros
+//
+// A log call stores a call-site id, a tick count and its raw arguments in a
+// byte ring owned by the calling thread; nothing is formatted and no lock
+// or system call is taken. Each LOG_* call site is a static LogSite
+// registered on first use, which also parses the format once to learn the
+// argument types. A background thread drains the rings about every
+// millisecond and either formats them to stderr or, after
+// log_set_output(path), appends them unformatted to a binary log file for
+// log_decode_file to turn into text offline. Strings are copied into the
+// record (up to LOG_STRING_MAX bytes), so they may be freed after the call.
+// A full ring drops the message and counts it rather than blocking.
+//
+// Levels above LOG_LEVEL (os_config.h) compile to nothing. Messages from
+// different threads reach the output in drain order, not strictly in time
+// order; each carries its timestamp.
+
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include "os_config.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LOG_RING_BYTES (256 * 1024) // per thread
+#define LOG_MAX_SITES 4096
+#define LOG_MAX_ARGS 16
+#define LOG_STRING_MAX 256
+#define LOG_LINE_MAX 1024
+
+typedef enum {
+  LOG_ERROR_LEVEL,
+  LOG_WARN_LEVEL,
+  LOG_INFO_LEVEL,
+  LOG_DEBUG_LEVEL
+} LogLevel;
+
+typedef struct {
+  LogLevel level;
+  int line;
+  const char *file;
+  const char *format; // a string literal
+  uint32_t id;        // 0 until registered
+} LogSite;
+
+typedef struct {
+  uint64_t written;
+  uint64_t dropped; // rings were full
+  uint64_t drained;
+  uint32_t sites;
+  uint32_t threads; // rings; exited threads' rings are reused once drained
+} LogStats;
+
+void log_write(LogSite *site, ...);
+// Untracked call sites: formats on the calling thread, writes asynchronously.
+void log_message(LogLevel level, const char *file, int line, const char *format,
+                 ...) __attribute__((format(printf, 4, 5)));
+// Never called; lets the compiler check LOG_* formats against their arguments.
+static inline void log_check_format(const char *format, ...)
+    __attribute__((format(printf, 1, 2)));
+static inline void log_check_format(const char *format, ...) { (void)format; }
+
+// NULL formats to stderr (the default); a path starts a binary log there.
+bool log_set_output(const char *path);
+// Returns once everything logged before the call has been written.
+void log_flush(void);
+void log_get_stats(LogStats *stats);
+
+// Writes a binary log as text, one message per line; false if the file is
+// not a log or is cut short (the lines before that are still written).
+bool log_decode_file(const char *path, FILE *out);
+
+// Threads hammer the logger through one call site with two integer
+// arguments (and a string, if string_args) while the background thread
+// writes to path (NULL: /dev/null). With a burst size each thread logs that
+// many calls, then waits (untimed) for its ring to drain, so the figure is
+// the cost of a call that is kept; without one the rings overflow as soon
+// as the threads outpace the drainer and dropped calls are timed too.
+// Output goes back to stderr afterwards.
+typedef struct {
+  uint32_t threads;
+  uint64_t calls_per_thread;
+  uint64_t burst; // 0: log without pausing
+  bool string_args;
+  const char *path;
+} LogBenchConfig;
+
+typedef struct {
+  double ns_per_call; // calling-thread CPU time, averaged over all threads
+  double ns_per_timestamp; // the tick read every call makes, alone
+  uint64_t written;
+  uint64_t dropped;
+} LogBenchResult;
+
+bool log_benchmark(const LogBenchConfig *config, LogBenchResult *result);
+
+#define LOG_AT_(level, fmt, ...)                                              \
+  do {                                                                        \
+    static LogSite log_site_ = {level, __LINE__, __FILE__, fmt, 0};           \
+    if (0) {                                                                  \
+      log_check_format(fmt, ##__VA_ARGS__);                                   \
+    }                                                                         \
+    log_write(&log_site_, ##__VA_ARGS__);                                     \
+  } while (0)
+
+#if LOG_LEVEL >= 1
+#define LOG_ERROR(fmt, ...) LOG_AT_(LOG_ERROR_LEVEL, fmt, ##__VA_ARGS__)
+#else
+#define LOG_ERROR(fmt, ...) ((void)0)
+#endif
+#if LOG_LEVEL >= 2
+#define LOG_WARN(fmt, ...) LOG_AT_(LOG_WARN_LEVEL, fmt, ##__VA_ARGS__)
+#else
+#define LOG_WARN(fmt, ...) ((void)0)
+#endif
+#if LOG_LEVEL >= 3
+#define LOG_INFO(fmt, ...) LOG_AT_(LOG_INFO_LEVEL, fmt, ##__VA_ARGS__)
+#else
+#define LOG_INFO(fmt, ...) ((void)0)
+#endif
+#if LOG_LEVEL >= 4
+#define LOG_DEBUG(fmt, ...) LOG_AT_(LOG_DEBUG_LEVEL, fmt, ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(fmt, ...) ((void)0)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LOGGER_H
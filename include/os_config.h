@@ -14,6 +14,7 @@
 #define KERNEL_MEMORY_SIZE (512 * 1024 * 1024) // 512 MB
 #define MAX_PROCESSES 1024
 #define MAX_THREADS 4096
+#define KERNEL_MAX_CORES 64 // simulated CPUs for kernel_run_smp
 
 // UI settings
 #define DOCK_HEIGHT 80
@@ -30,6 +31,9 @@
 #define ENABLE_GLASS_MORPHISM 1
 #define ENABLE_PARTICLE_EFFECTS 1
 #define RENDER_TARGET_AA_SAMPLES 4
+#ifndef ENABLE_TILED_RENDERING
+#define ENABLE_TILED_RENDERING 1 // defer screen drawing to the tile renderer
+#endif
 
 // Performance settings
 #define TARGET_FPS 60
@@ -39,5 +43,8 @@
 // Debug settings
 #define DEBUG_MODE 0
 #define LOG_LEVEL 2 // 0=none, 1=error, 2=warning, 3=info, 4=debug
+#ifndef ENABLE_PROFILER
+#define ENABLE_PROFILER 0 // 1 builds in the zones from profiler.h
+#endif
 
 #endif // OS_CONFIG_H
@@ -0,0 +1,130 @@
+// Physical memory manager - buddy pages and slab caches
+//
+// A simulated physical memory of a fixed size, handed out in pages by a
+// binary buddy allocator. Free blocks of 2^order pages sit on one list per
+// order and a bitmap of non-empty orders finds the smallest fit without a
+// scan; a freed block merges with its buddy for as long as the buddy is
+// free too. Page metadata lives in a side table, so memory nobody touched
+// is never committed by the host.
+//
+// Every block belongs to an owner (a pid, or PMM_OWNER_KERNEL) and is
+// linked on that owner's list, so per-process usage is a counter and
+// releasing a process frees everything it held. Used and free page counts
+// move with the blocks, so reading them never walks anything.
+//
+// Slab caches carve fixed-size kernel objects out of kernel-owned blocks.
+// A slab is one buddy block, and buddy blocks are aligned to their size,
+// so an object's slab is found by masking its address.
+
+#ifndef PMM_H
+#define PMM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PMM_PAGE_SHIFT 12
+#define PMM_PAGE_SIZE (1u << PMM_PAGE_SHIFT)
+#define PMM_MAX_ORDER 10 // largest block: 1024 pages (4 MB)
+#define PMM_ORDERS (PMM_MAX_ORDER + 1)
+#define PMM_OWNER_KERNEL 0 // slabs and kernel data; never released
+
+#define SLAB_ALIGN 16
+#define SLAB_MIN_OBJECTS 8 // a slab grows in order until this many fit
+
+typedef struct PhysicalMemory PhysicalMemory;
+typedef struct SlabCache SlabCache;
+
+typedef struct {
+  uint64_t total_pages;
+  uint64_t used_pages;
+  uint64_t free_pages;
+  uint64_t free_blocks[PMM_ORDERS];
+  int32_t largest_free_order; // -1 when nothing is free
+  // Fragmentation: share of free pages sitting in blocks too small for a
+  // request of each order (0 = all usable, 1 = none)
+  double unusable[PMM_ORDERS];
+  uint64_t allocs;
+  uint64_t frees;
+  uint64_t splits;
+  uint64_t merges;
+  uint64_t failures;
+  uint32_t owners;
+} PmmStats;
+
+typedef struct {
+  uint32_t object_size; // after alignment
+  uint32_t objects_per_slab;
+  uint32_t slab_order;
+  uint64_t slabs;
+  uint64_t in_use;
+  uint64_t capacity; // objects in all slabs
+  uint64_t allocs;
+  uint64_t frees;
+} SlabCacheStats;
+
+// Bytes are rounded down to whole pages.
+PhysicalMemory *pmm_create(uint64_t bytes);
+void pmm_destroy(PhysicalMemory *pmm);
+// The kernel's memory (KERNEL_MEMORY_SIZE), created on first use.
+PhysicalMemory *pmm_kernel(void);
+
+// A block of 2^order pages charged to owner; NULL when no block that large
+// is free.
+void *pmm_alloc_pages(PhysicalMemory *pmm, uint32_t order, uint32_t owner);
+void pmm_free_pages(PhysicalMemory *pmm, void *block);
+// Frees every block the owner holds and returns how many pages that was.
+uint64_t pmm_release_owner(PhysicalMemory *pmm, uint32_t owner);
+uint64_t pmm_owner_pages(PhysicalMemory *pmm, uint32_t owner);
+// Recharges a block to another owner without touching its contents.
+bool pmm_transfer_pages(PhysicalMemory *pmm, void *block, uint32_t owner);
+
+// O(1) and lock-free
+uint64_t pmm_total_bytes(const PhysicalMemory *pmm);
+uint64_t pmm_used_bytes(const PhysicalMemory *pmm);
+// Takes the allocator lock for a consistent snapshot of the free lists.
+void pmm_get_stats(PhysicalMemory *pmm, PmmStats *stats);
+
+SlabCache *slab_cache_create(PhysicalMemory *pmm, size_t object_size);
+void slab_cache_destroy(SlabCache *cache); // returns all its slabs
+void *slab_alloc(SlabCache *cache);
+void slab_free(SlabCache *cache, void *object);
+void slab_cache_get_stats(SlabCache *cache, SlabCacheStats *stats);
+
+// Long-running churn on a private memory: page blocks of random orders
+// (small ones likelier) for a set of owners, objects from slab caches sized
+// like OSProcess and OSDevice, and whole owners released now and then.
+// Allocation wins while memory is below the fill target, freeing above it.
+// Used to measure alloc/free rates and the fragmentation left behind.
+typedef struct {
+  uint64_t memory_bytes;
+  uint64_t operations;
+  uint32_t max_order;           // page blocks are order 0..max_order
+  uint32_t slab_percent;        // share of operations on the slab caches
+  uint32_t fill_percent;        // target share of memory in use
+  uint32_t owners;              // simulated processes
+  uint32_t release_per_million; // chance per operation an owner exits
+  uint64_t seed;
+} PmmSimConfig;
+
+typedef struct {
+  uint64_t allocs;
+  uint64_t frees;
+  uint64_t failures; // requests no free memory could satisfy
+  uint64_t releases;
+  double ns_per_op;
+  double slab_utilization; // objects in use / slab capacity at the end
+  PmmStats after;          // fragmentation report at the end
+} PmmSimResult;
+
+bool pmm_simulate(const PmmSimConfig *config, PmmSimResult *result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PMM_H
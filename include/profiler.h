@@ -0,0 +1,134 @@
+// Profiler - scoped timing zones, frame stage histograms and trace export
+//
+// A zone records its name, start and duration in nanoseconds into a ring
+// owned by the calling thread, so recording is two clock reads and a store
+// with no lock. Zones tagged with a frame stage also land in that stage's
+// HDR histogram: log-linear buckets with 32 steps per power of two (about
+// 3% precision) over the whole 64-bit range, so percentiles stay accurate
+// for any number of samples in fixed memory. Input marks the time an event
+// arrived and present the time the screen changed; the gap goes into its
+// own histogram. The rings export to the Chrome trace JSON format.
+//
+// Built with ENABLE_PROFILER 0 (the default in os_config.h) the PROFILE_*
+// macros compile to nothing and the functions are stubs.
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "os_config.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PROFILER_THREAD_EVENTS 65536 // per-thread ring, oldest overwritten
+
+typedef enum {
+  PROFILE_NONE = -1, // plain zone, trace only
+  PROFILE_EVENTS,
+  PROFILE_LAYOUT,
+  PROFILE_RASTER,
+  PROFILE_EFFECTS,
+  PROFILE_PRESENT,
+  PROFILE_FRAME,
+  PROFILE_INPUT_LATENCY, // input to present, from the marks
+  PROFILE_STAGE_COUNT
+} ProfileStage;
+
+typedef struct {
+  const char *name; // must outlive the profiler; string literals are fine
+  ProfileStage stage;
+  uint64_t start;
+} ProfileZone;
+
+typedef struct {
+  uint64_t count;
+  uint64_t min_ns;
+  uint64_t max_ns;
+  double mean_ns;
+  uint64_t p50_ns;
+  uint64_t p90_ns;
+  uint64_t p99_ns;
+  uint64_t p999_ns;
+} ProfileStageStats;
+
+static inline uint64_t profiler_now_ns(void) {
+  struct timespec ts;
+#ifdef CLOCK_MONOTONIC_RAW
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+#else
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline ProfileZone profile_zone_begin(const char *name,
+                                             ProfileStage stage) {
+  ProfileZone zone = {name, stage, profiler_now_ns()};
+  return zone;
+}
+
+void profile_zone_end(ProfileZone *zone);
+const char *profiler_stage_name(ProfileStage stage);
+// Label for this thread in traces.
+void profiler_set_thread_name(const char *name);
+
+// Input arrived at timestamp_ns (profiler_now_ns clock); the next present
+// closes the earliest input still waiting.
+void profiler_mark_input(uint64_t timestamp_ns);
+void profiler_mark_present(void);
+
+void profiler_get_stage_stats(ProfileStage stage, ProfileStageStats *stats);
+// Clears the histograms; traces skip zones that started before the reset.
+void profiler_reset(void);
+bool profiler_write_chrome_trace(const char *path);
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+#if ENABLE_PROFILER
+#ifdef __cplusplus
+} // extern "C"
+
+class ProfileScope {
+public:
+  ProfileScope(const char *name, ProfileStage stage)
+      : zone(profile_zone_begin(name, stage)) {}
+  ~ProfileScope() { profile_zone_end(&zone); }
+  ProfileScope(const ProfileScope &) = delete;
+  ProfileScope &operator=(const ProfileScope &) = delete;
+
+private:
+  ProfileZone zone;
+};
+
+#define PROFILE_SCOPE_(name, stage)                                          \
+  ProfileScope PROFILE_CONCAT(profile_zone_, __COUNTER__)(name, stage)
+
+extern "C" {
+#else
+#define PROFILE_SCOPE_(name, stage)                                          \
+  ProfileZone PROFILE_CONCAT(profile_zone_, __COUNTER__)                     \
+      __attribute__((cleanup(profile_zone_end))) =                           \
+          profile_zone_begin(name, stage)
+#endif
+// Times the rest of the enclosing block
+#define PROFILE_ZONE(name) PROFILE_SCOPE_(name, PROFILE_NONE)
+#define PROFILE_STAGE(stage) PROFILE_SCOPE_(profiler_stage_name(stage), stage)
+#define PROFILE_INPUT() profiler_mark_input(profiler_now_ns())
+#define PROFILE_PRESENTED() profiler_mark_present()
+#else
+#define PROFILE_ZONE(name) ((void)0)
+#define PROFILE_STAGE(stage) ((void)0)
+#define PROFILE_INPUT() ((void)0)
+#define PROFILE_PRESENTED() ((void)0)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PROFILER_H
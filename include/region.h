@@ -0,0 +1,83 @@
+// Rectangle helpers and regions (lists of screen rectangles)
+// Used for damage tracking and clipped redraws.
+
+#ifndef REGION_H
+#define REGION_H
+
+#include "graphics.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define REGION_MAX_RECTS 32 // damage beyond this is coalesced
+
+static inline bool rect_is_empty(OSRect r) {
+  return r.width <= 0 || r.height <= 0;
+}
+
+static inline OSRect rect_intersection(OSRect a, OSRect b) {
+  int32_t x0 = a.x > b.x ? a.x : b.x;
+  int32_t y0 = a.y > b.y ? a.y : b.y;
+  int32_t x1 = a.x + a.width < b.x + b.width ? a.x + a.width : b.x + b.width;
+  int32_t y1 =
+      a.y + a.height < b.y + b.height ? a.y + a.height : b.y + b.height;
+  OSRect r = {x0, y0, x1 > x0 ? x1 - x0 : 0, y1 > y0 ? y1 - y0 : 0};
+  return r;
+}
+
+static inline bool rect_intersects(OSRect a, OSRect b) {
+  return !rect_is_empty(rect_intersection(a, b));
+}
+
+static inline OSRect rect_union(OSRect a, OSRect b) {
+  if (rect_is_empty(a)) {
+    return b;
+  }
+  if (rect_is_empty(b)) {
+    return a;
+  }
+  int32_t x0 = a.x < b.x ? a.x : b.x;
+  int32_t y0 = a.y < b.y ? a.y : b.y;
+  int32_t x1 = a.x + a.width > b.x + b.width ? a.x + a.width : b.x + b.width;
+  int32_t y1 =
+      a.y + a.height > b.y + b.height ? a.y + a.height : b.y + b.height;
+  OSRect r = {x0, y0, x1 - x0, y1 - y0};
+  return r;
+}
+
+static inline int64_t rect_area(OSRect r) {
+  return rect_is_empty(r) ? 0 : (int64_t)r.width * r.height;
+}
+
+typedef struct {
+  OSRect *rects;
+  uint32_t count;
+  uint32_t capacity;
+} OSRegion;
+
+void region_init(OSRegion *region);
+void region_destroy(OSRegion *region);
+void region_clear(OSRegion *region);
+bool region_is_empty(const OSRegion *region);
+OSRect region_bounds(const OSRegion *region);
+int64_t region_area(const OSRegion *region);
+
+// Add a rect, merging it with every rect it overlaps or touches. When the
+// list exceeds REGION_MAX_RECTS the pair whose union wastes the least area
+// is merged, so the list stays short and its rects stay disjoint.
+void region_add_rect(OSRegion *region, OSRect rect);
+
+// Exact set operations for visibility: rects are split, never merged, so
+// they stay disjoint and cover exactly the requested area.
+void region_set_rect(OSRegion *region, OSRect rect);
+void region_intersect_rect(OSRegion *dst, const OSRegion *src, OSRect rect);
+void region_subtract_rect(OSRegion *region, OSRect rect);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // REGION_H
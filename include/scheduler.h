@@ -0,0 +1,96 @@
+// Scheduler - multi-level feedback queue
+// Runnable entities sit in one FIFO per level; a bitmap of non-empty levels
+// makes picking the next entity O(1). An entity starts at level 0 and drops
+// a level each time it uses up its allotment there (allotments double per
+// level). Periodic boosts splice every level back onto level 0 in O(levels);
+// entity fields are brought up to date lazily through an epoch counter.
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "kernel.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SCHED_LEVELS 8
+#define SCHED_BASE_QUANTUM 1 // ticks of allotment at level 0
+#define SCHED_DEFAULT_BOOST_INTERVAL 1000
+
+typedef struct SchedEntity {
+  struct SchedEntity *prev;
+  struct SchedEntity *next;
+  OSProcess *process; // priority mirrors the level; state and cpu_time kept
+  uint32_t level;
+  uint32_t epoch;       // boost epoch the level refers to
+  uint32_t allotment;   // ticks left at this level
+  uint64_t ready_since; // tick the entity last became ready
+  bool queued;
+} SchedEntity;
+
+typedef struct {
+  SchedEntity *head[SCHED_LEVELS];
+  SchedEntity *tail[SCHED_LEVELS];
+  uint32_t nonempty; // bit (31 - level) set when the level has entities
+  uint32_t epoch;
+  uint32_t queued;
+  uint64_t now; // ticks
+  uint64_t next_boost;
+  uint32_t boost_interval;
+
+  // Dispatch latency: ticks from becoming ready to running
+  uint64_t dispatches;
+  uint64_t total_latency;
+  uint64_t max_latency;
+} Scheduler;
+
+void scheduler_init(Scheduler *sched, uint32_t boost_interval);
+void scheduler_entity_init(Scheduler *sched, SchedEntity *entity,
+                           OSProcess *process);
+
+void scheduler_enqueue(Scheduler *sched, SchedEntity *entity); // now ready
+void scheduler_dequeue(Scheduler *sched, SchedEntity *entity); // if queued
+SchedEntity *scheduler_pick_next(Scheduler *sched); // NULL when idle
+
+// Move an entity that is not queued over from another scheduler, keeping
+// its level and remaining allotment.
+void scheduler_adopt(Scheduler *sched, SchedEntity *entity);
+
+// Charge CPU ticks to a running entity. Returns true when its allotment at
+// the current level ran out, in which case it has been demoted and should
+// be preempted.
+bool scheduler_charge(Scheduler *sched, SchedEntity *entity, uint32_t ticks);
+
+// Advance the clock, boosting all levels when the interval has elapsed.
+void scheduler_advance(Scheduler *sched, uint64_t ticks);
+
+// Deterministic simulation on one CPU: interactive processes run short
+// bursts and sleep, the rest are CPU-bound. Used to size process counts
+// well beyond MAX_PROCESSES and to tune the boost interval.
+typedef struct {
+  uint32_t num_processes;
+  uint32_t interactive_percent;
+  uint64_t ticks;
+  uint32_t boost_interval;
+  uint64_t seed;
+} SchedSimConfig;
+
+typedef struct {
+  uint64_t dispatches;
+  double mean_latency; // ticks from ready to running, all processes
+  uint64_t max_latency;
+  double interactive_mean_latency;
+  double fairness; // Jain's index of cpu_time over CPU-bound processes
+  uint64_t min_cpu_time; // 0 means some CPU-bound process starved
+} SchedSimResult;
+
+bool scheduler_simulate(const SchedSimConfig *config, SchedSimResult *result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SCHEDULER_H
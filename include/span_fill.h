@@ -0,0 +1,95 @@
+// Span fill engine for the software framebuffer
+// Fills and alpha-blends horizontal runs of 32bpp ARGB pixels using the
+// widest SIMD backend the host CPU supports.
+
+#ifndef SPAN_FILL_H
+#define SPAN_FILL_H
+
+#include "graphics.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+  SPAN_BACKEND_SCALAR,
+  SPAN_BACKEND_SSE2,
+  SPAN_BACKEND_AVX2
+} SpanBackend;
+
+// Framebuffer pixels are packed as 0xAARRGGBB in native byte order.
+static inline uint32_t color_pack(Color color) {
+  return ((uint32_t)color.alpha << 24) | ((uint32_t)color.red << 16) |
+         ((uint32_t)color.green << 8) | (uint32_t)color.blue;
+}
+
+static inline Color color_unpack(uint32_t argb) {
+  Color color = {(uint8_t)(argb >> 24), (uint8_t)(argb >> 16),
+                 (uint8_t)(argb >> 8), (uint8_t)argb};
+  return color;
+}
+
+// Exact round(x / 255) for x in [0, 255 * 255]; every backend uses this.
+static inline uint32_t span_div255(uint32_t x) {
+  x += 128;
+  return (x + (x >> 8)) >> 8;
+}
+
+// Source-over blend of one pixel. Alpha is blended like the color channels
+// with a source alpha of 255, i.e. a_out = a + a_dst * (1 - a).
+static inline uint32_t span_blend_pixel(uint32_t dst, uint32_t src) {
+  uint32_t a = src >> 24;
+  uint32_t ia = 255 - a;
+  uint32_t out_a = span_div255(255 * a + (dst >> 24) * ia);
+  uint32_t out_r = span_div255(((src >> 16) & 0xFF) * a + ((dst >> 16) & 0xFF) * ia);
+  uint32_t out_g = span_div255(((src >> 8) & 0xFF) * a + ((dst >> 8) & 0xFF) * ia);
+  uint32_t out_b = span_div255((src & 0xFF) * a + (dst & 0xFF) * ia);
+  return (out_a << 24) | (out_r << 16) | (out_g << 8) | out_b;
+}
+
+// floor(sqrt(n)), digit-by-digit; used to turn circles into spans. 64-bit
+// so r * r cannot overflow for any radius a caller passes.
+static inline uint32_t span_isqrt(uint64_t n) {
+  uint64_t root = 0;
+  uint64_t bit = 1ull << 62;
+  while (bit > n) {
+    bit >>= 2;
+  }
+  while (bit != 0) {
+    if (n >= root + bit) {
+      n -= root + bit;
+      root = (root >> 1) + bit;
+    } else {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+  return (uint32_t)root;
+}
+
+// Inset of row `row` (0 = outermost) of a rounded corner with the given
+// radius. Shared by rounded rects and shadow masks so their edges agree.
+static inline int32_t span_corner_inset(int32_t radius, int32_t row) {
+  int64_t dy = radius - row;
+  return radius -
+         (int32_t)span_isqrt((uint64_t)((int64_t)radius * radius - dy * dy));
+}
+
+// Backend selection. span_init() picks the best backend via CPUID and is
+// called from graphics_init(); span_set_backend() forces one (falls back to
+// scalar if the CPU lacks it) so backends can be compared pixel for pixel.
+void span_init(void);
+SpanBackend span_get_backend(void);
+SpanBackend span_set_backend(SpanBackend backend);
+const char *span_backend_name(SpanBackend backend);
+
+// Fill count pixels with a solid color: stores when opaque, blends when
+// translucent, no-op when fully transparent.
+void span_fill(uint32_t *dst, uint32_t count, uint32_t argb);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SPAN_FILL_H
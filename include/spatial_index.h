@@ -0,0 +1,52 @@
+// Spatial index for hit-testing and rect queries in z-order
+//
+// A uniform grid over a world rect. Every item (an id, a rect and a z key)
+// is listed in each cell its rect overlaps, and each cell keeps its list
+// sorted by z, so "topmost item under a point" usually stops at the
+// frontmost entry of one cell. Coordinates outside the world clamp to the
+// edge cells, so nothing is ever lost, only scanned a little more. Items
+// spanning more than SPATIAL_MAX_ITEM_CELLS cells go to one list that every
+// query checks, which bounds the cost of moving a huge window.
+//
+// Moves and resizes update only the cells that the rect entered or left.
+// Raising an item is a new, larger z key. Keys must be unique.
+
+#ifndef SPATIAL_INDEX_H
+#define SPATIAL_INDEX_H
+
+#include "graphics.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SPATIAL_MAX_ITEM_CELLS 64
+
+typedef struct SpatialIndex SpatialIndex;
+
+SpatialIndex *spatial_index_create(OSRect world, int32_t cell_size);
+void spatial_index_destroy(SpatialIndex *index);
+
+// Insert replaces an item that already has the id.
+bool spatial_index_insert(SpatialIndex *index, uint32_t id, OSRect rect,
+                          uint64_t z);
+void spatial_index_remove(SpatialIndex *index, uint32_t id);
+void spatial_index_update(SpatialIndex *index, uint32_t id, OSRect rect);
+void spatial_index_set_z(SpatialIndex *index, uint32_t id, uint64_t z);
+uint32_t spatial_index_count(const SpatialIndex *index);
+
+// Topmost item whose rect contains the point.
+bool spatial_index_top_at(const SpatialIndex *index, int32_t x, int32_t y,
+                          uint32_t *id);
+// Items whose rects intersect rect, front to back. Writes at most max_ids
+// and returns how many there are in total.
+uint32_t spatial_index_query(SpatialIndex *index, OSRect rect, uint32_t *ids,
+                             uint32_t max_ids);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SPATIAL_INDEX_H
@@ -0,0 +1,36 @@
+// Thread pool for data-parallel work (blur passes, tile rendering)
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ThreadPool ThreadPool;
+
+// Processes items [begin, end) of a parallel_for range.
+typedef void (*ThreadPoolRangeFn)(void *arg, uint32_t begin, uint32_t end);
+
+// num_threads == 0 sizes the pool to the online CPU count. The calling
+// thread always participates, so the pool spawns num_threads - 1 workers.
+ThreadPool *thread_pool_create(uint32_t num_threads);
+void thread_pool_destroy(ThreadPool *pool);
+
+// Process-wide pool, created on first use.
+ThreadPool *thread_pool_shared(void);
+uint32_t thread_pool_size(ThreadPool *pool);
+
+// Split [0, count) into chunks of `grain` items and run them across the
+// pool; returns once every chunk has finished. Runs inline when the range
+// fits in one chunk or when called from inside a pool worker.
+void thread_pool_parallel_for(ThreadPool *pool, uint32_t count, uint32_t grain,
+                              ThreadPoolRangeFn fn, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // THREAD_POOL_H
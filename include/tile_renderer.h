@@ -0,0 +1,76 @@
+// Tile renderer - deferred, binned, multithreaded rasterization
+// While a TileRenderer is attached to a GraphicsContext, drawing calls are
+// recorded instead of executed. On flush the commands are binned into
+// TILE_SIZE x TILE_SIZE screen tiles and the tiles are rasterized in
+// parallel, each replaying its commands in order under a tile clip. Blur is
+// a barrier (it reads neighbouring pixels) and runs between tile batches.
+// Output is bit-identical to immediate mode.
+
+#ifndef TILE_RENDERER_H
+#define TILE_RENDERER_H
+
+#include "graphics.h"
+#include "thread_pool.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TILE_SIZE 64
+
+typedef enum {
+  DRAW_CMD_RECT,
+  DRAW_CMD_ROUNDED_RECT,
+  DRAW_CMD_RECT_OUTLINE,
+  DRAW_CMD_CIRCLE,
+  DRAW_CMD_LINE,
+  DRAW_CMD_TEXTURE,
+  DRAW_CMD_GRADIENT,
+  DRAW_CMD_SHADOW,
+  DRAW_CMD_BLUR
+} DrawCommandType;
+
+typedef struct {
+  DrawCommandType type;
+  OSRect rect;   // geometry (line: x, y = start, width, height = end)
+  OSRect clip;   // context clip at record time, filled in by record
+  OSRect extent; // pixels the command may touch, filled in by record
+  OSRect src;    // texture sub-rect
+  Color color;
+  Color color2;     // gradient end color
+  int32_t param;    // corner radius, outline thickness, circle radius (its
+                    // uint32 bits)
+  float radius;     // blur / shadow radius
+  bool horizontal;  // gradient direction
+  Texture *texture; // must stay alive until the next flush
+} DrawCommand;
+
+typedef struct TileRenderer TileRenderer;
+
+TileRenderer *tile_renderer_create(void);
+// Records into memory from the arena instead of a heap buffer it keeps;
+// commands recorded in a frame must be flushed before that frame's
+// frame_arena_end_frame (graphics_present does both in that order).
+TileRenderer *tile_renderer_create_in(struct FrameArena *arena);
+void tile_renderer_destroy(TileRenderer *renderer);
+
+// Tiles are rasterized on thread_pool_shared() unless a pool is set here
+// (NULL restores the shared one).
+void tile_renderer_set_pool(TileRenderer *renderer, ThreadPool *pool);
+
+// Attach/detach. end flushes outstanding commands. graphics_present and
+// graphics_present_rects flush implicitly.
+void tile_renderer_begin(TileRenderer *renderer, GraphicsContext *ctx);
+void tile_renderer_end(TileRenderer *renderer, GraphicsContext *ctx);
+
+void tile_renderer_record(TileRenderer *renderer, const GraphicsContext *ctx,
+                          const DrawCommand *cmd);
+void tile_renderer_flush(TileRenderer *renderer, GraphicsContext *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TILE_RENDERER_H
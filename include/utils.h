@@ -6,76 +6,103 @@
 #include <stddef.h>
 #include <limits.h>
 
-// Logging macros
-#define LOG_ERROR(fmt, ...) log_message(LOG_ERROR_LEVEL, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
-#define LOG_WARN(fmt, ...) log_message(LOG_WARN_LEVEL, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
-#define LOG_INFO(fmt, ...) log_message(LOG_INFO_LEVEL, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
-#define LOG_DEBUG(fmt, ...) log_message(LOG_DEBUG_LEVEL, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
-
-typedef enum {
-    LOG_ERROR_LEVEL,
-    LOG_WARN_LEVEL,
-    LOG_INFO_LEVEL,
-    LOG_DEBUG_LEVEL
-} LogLevel;
-
-// Logging function
-void log_message(LogLevel level, const char* file, int line, const char* format, ...);
-
-// Timer utilities
+// Logging: LOG_ERROR, LOG_WARN, LOG_INFO, LOG_DEBUG
+#include "logger.h"
+#include "frame_arena.h"
+
+// Timer utilities (os_ prefix: POSIX <time.h> already has timer_create)
 typedef struct {
     uint64_t start_time;
     uint64_t end_time;
 } Timer;
 
-Timer* timer_create(void);
-void timer_start(Timer* timer);
-void timer_stop(Timer* timer);
-uint64_t timer_elapsed_ms(Timer* timer);
-void timer_destroy(Timer* timer);
+Timer* os_timer_create(void);
+void os_timer_start(Timer* timer);
+void os_timer_stop(Timer* timer);
+uint64_t os_timer_elapsed_ms(Timer* timer);
+void os_timer_destroy(Timer* timer);
 
 // String utilities
 char* string_duplicate(const char* str);
 int string_compare(const char* str1, const char* str2);
 int string_length(const char* str);
 char* string_format(const char* format, ...);
+// Same, but the string lives in the arena until the frame after next.
+char* string_format_in(FrameArena* arena, const char* format, ...)
+    __attribute__((format(printf, 2, 3)));
 
 // Memory pool for efficient allocation
+// Fixed-size blocks carved from power-of-two aligned chunks. Each chunk
+// tracks free blocks in a two-level bitmap (a summary word over 32 words),
+// so allocate and free are O(1). Threads allocate from and free into a
+// small per-thread magazine and only take the pool lock to exchange half a
+// magazine at a time. The pool grows by whole chunks and returns empty
+// chunks beyond one spare. num_blocks is the number of blocks per chunk
+// (capped at POOL_MAX_CHUNK_BLOCKS).
+#define POOL_MAX_CHUNK_BLOCKS 1024
+#define POOL_MAGAZINE_SIZE 32
+
+typedef struct MemoryPool MemoryPool;
+
 typedef struct {
-    void* pool;
-    size_t block_size;
-    size_t num_blocks;
-    uint8_t* bitmap; // Track allocation
-} MemoryPool;
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t in_use;             // blocks held by callers
+    uint64_t high_water;         // peak blocks taken out of chunks
+    uint64_t capacity;           // blocks in all chunks
+    uint32_t chunks;
+    float fragmentation;         // free blocks stranded in partial chunks / capacity
+} MemoryPoolStats;
 
 MemoryPool* pool_create(size_t block_size, size_t num_blocks);
 void* pool_allocate(MemoryPool* pool);
 void pool_free(MemoryPool* pool, void* ptr);
 void pool_destroy(MemoryPool* pool);
+void pool_get_stats(MemoryPool* pool, MemoryPoolStats* stats);
 
 // Vector data structure
 typedef struct {
     void** elements;
     size_t count;
     size_t capacity;
+    FrameArena* arena;           // NULL: heap
 } Vector;
 
 Vector* vector_create(size_t initial_capacity);
+// A vector for one frame: it and its elements come from the arena, so
+// vector_destroy is optional and the vector is gone two frames later.
+Vector* vector_create_in(FrameArena* arena, size_t initial_capacity);
 void vector_push(Vector* vec, void* element);
 void* vector_pop(Vector* vec);
 void* vector_get(Vector* vec, size_t index);
 void vector_destroy(Vector* vec);
 
 // Hash table
+// Robin Hood open addressing over a power-of-two table with a 64-bit
+// finalizer as the hash. Deletion shifts the following run back instead of
+// leaving tombstones. Growth is incremental: a resize allocates the larger
+// table and every put/remove migrates a few slots of the old one, so no
+// single call rehashes the whole map. Large tables are mapped directly and
+// a drained one is unmapped a slice per call too, since unmapping hundreds
+// of megabytes at once takes tens of milliseconds. NULL values are not
+// stored; putting NULL removes the key.
 typedef struct {
     uint64_t key;
     void* value;
+    uint32_t distance; // probe length + 1; 0 marks an empty slot
 } HashEntry;
 
-typedef struct {
+typedef struct HashMap {
     HashEntry* entries;
     size_t capacity;
-    size_t count;
+    size_t count; // live entries in both tables
+    // Table being drained by an incremental resize (NULL when idle)
+    HashEntry* old_entries;
+    size_t old_capacity;
+    size_t migrate_pos;
+    // Drained large table still being unmapped (NULL when idle)
+    char* retiring;
+    size_t retiring_bytes;
 } HashMap;
 
 HashMap* hashmap_create(size_t capacity);
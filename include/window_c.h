@@ -2,6 +2,7 @@
 #define WINDOW_C_H
 
 #include "graphics.h"
+#include "region.h"
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -24,6 +25,8 @@ typedef enum {
   WINDOW_FLAG_SHADOW = 1 << 5
 } WindowFlags;
 
+struct CWindowManager;
+
 // Window handle
 typedef struct CWindow {
   uint32_t window_id;
@@ -37,14 +40,29 @@ typedef struct CWindow {
   void (*on_resize)(struct CWindow *window, uint32_t width, uint32_t height);
   void (*on_close)(struct CWindow *window);
   void *user_data;
+  struct CWindowManager *manager; // owner, receives this window's damage
+  uint64_t z;                     // stacking key, larger is in front
 } CWindow;
 
 // Window Manager
-typedef struct {
-  CWindow **windows;
+typedef struct CWindowManager {
+  CWindow **windows; // z-order, bottom first
   uint32_t window_count;
   uint32_t max_windows;
   CWindow *focused_window;
+  OSRegion damage;  // screen rects to repaint on the next render_all
+  OSRegion painting; // damage render_all is repainting; on_draw
+                     // invalidations meanwhile land in damage
+  bool full_damage; // repaint everything (first frame)
+  OSRegion *window_visible; // occlusion pass output, indexed like layers
+  OSRegion uncovered;       // occlusion pass scratch
+  CWindow **layers;         // windows near the dirty rect, front to back
+  uint32_t *layer_ids;
+  uint32_t layer_count;
+  struct SlabCache *window_cache;     // CWindow storage
+  struct HashMap *windows_by_id;      // window_id -> CWindow
+  struct SpatialIndex *spatial;       // bounds of visible windows by id
+  uint64_t next_z;
 } CWindowManager;
 
 // Function declarations
@@ -54,6 +72,14 @@ void window_manager_destroy(CWindowManager *manager);
 CWindow *window_create(CWindowManager *manager, const char *title, OSRect bounds,
                       uint32_t flags);
 void window_destroy(CWindowManager *manager, CWindow *window);
+CWindow *window_manager_find(CWindowManager *manager, uint32_t window_id);
+
+// Hit-testing through the spatial index: the topmost visible window whose
+// bounds contain a screen point, and the visible windows meeting a rect,
+// front to back (returns the total, writes at most max_windows).
+CWindow *window_manager_window_at(CWindowManager *manager, int32_t x, int32_t y);
+uint32_t window_manager_windows_in_rect(CWindowManager *manager, OSRect rect,
+                                        CWindow **windows, uint32_t max_windows);
 
 void window_set_title(CWindow *window, const char *title);
 void window_move(CWindow *window, int32_t x, int32_t y);
@@ -61,7 +87,17 @@ void window_resize(CWindow *window, uint32_t width, uint32_t height);
 void window_set_state(CWindow *window, WindowState state);
 void window_focus(CWindowManager *manager, CWindow *window);
 
+// Damage tracking. Geometry, state, focus and title changes invalidate
+// automatically; content changes (on_draw) must be reported explicitly.
+void window_invalidate(CWindow *window);
+void window_invalidate_rect(CWindow *window, OSRect rect); // window-local
+void window_manager_invalidate(CWindowManager *manager, OSRect rect);
+OSRect window_visual_bounds(const CWindow *window); // bounds plus shadow
+
 void window_draw(GraphicsContext *ctx, CWindow *window);
+// Repaints only the damaged rects and presents just those rects. An
+// occlusion pass walks windows front to back so each window is drawn only
+// where no opaque window above it covers it; fully covered ones are skipped.
 void window_manager_render_all(CWindowManager *manager, GraphicsContext *ctx);
 
 #endif // WINDOW_C_H
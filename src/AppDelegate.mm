@@ -14,12 +14,21 @@
 #import "windows/SetupWizardWindow.h"
 #import "windows/ForceQuitWindow.h"
 #import "windows/SecurityWindow.h"
+#include "EventManager.h"
+#include "profiler.h"
 #include <iostream>
 
+@interface AppDelegate () {
+    dispatch_source_t _eventFrameTimer;
+    uint64_t _lastEventFrame;
+}
+@end
+
 @implementation AppDelegate
 
 - (void)applicationDidFinishLaunching:(NSNotification *)notification {
     std::cout << "[macOS-Like OS] Starting up..." << std::endl;
+    profiler_set_thread_name("Main");
     
     NSRect windowRect = NSMakeRect(0, 0, 1440, 900);
     
@@ -55,6 +64,8 @@
     self.dockView.autoresizingMask = NSViewMinXMargin | NSViewMaxXMargin;
     [contentView addSubview:self.dockView];
     
+    [self startEventLoop];
+    
     [self.mainWindow makeKeyAndOrderFront:nil];
     [NSApp activateIgnoringOtherApps:YES];
     
@@ -68,6 +79,70 @@
     }
 }
 
+#pragma mark - Event Loop
+
+// The shared EventManager runs on the main queue: one frame when posted
+// events arrive, at most every kFrameInterval, plus one whenever its next
+// timer is due. Nothing runs while the queue and the wheel are idle.
+- (void)startEventLoop {
+    _eventFrameTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, dispatch_get_main_queue());
+    __weak AppDelegate *weakSelf = self;
+    dispatch_source_set_event_handler(_eventFrameTimer, ^{
+        [weakSelf runEventFrame];
+    });
+    dispatch_source_set_timer(_eventFrameTimer, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+    dispatch_resume(_eventFrameTimer);
+    
+    // Wakes come from any thread; arming happens on the main queue so it
+    // is ordered with the frames
+    EventManager::shared().setWakeHandler([weakSelf] {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [weakSelf armEventFrame:YES];
+        });
+    });
+    // Views made their timers, and maybe posted, before the loop existed
+    [self armEventFrame:EventManager::shared().hasPendingEvents()];
+}
+
+- (void)armEventFrame:(BOOL)eventsPending {
+    int64_t wait = EventManager::shared().getTimeUntilNextTimer();
+    if (eventsPending) {
+        uint64_t nextFrame = _lastEventFrame + EventManager::kFrameInterval;
+        uint64_t now = EventManager::now();
+        int64_t frameWait = nextFrame > now ? (int64_t)(nextFrame - now) : 0;
+        wait = wait < 0 ? frameWait : MIN(wait, frameWait);
+    }
+    dispatch_time_t start = wait < 0 ? DISPATCH_TIME_FOREVER : dispatch_time(DISPATCH_TIME_NOW, wait);
+    dispatch_source_set_timer(_eventFrameTimer, start, DISPATCH_TIME_FOREVER, NSEC_PER_MSEC);
+}
+
+- (void)runEventFrame {
+    PROFILE_STAGE(PROFILE_FRAME);
+    _lastEventFrame = EventManager::now();
+    EventManager::shared().processEvents();
+    // Events posted meanwhile have queued their own armEventFrame:YES
+    [self armEventFrame:NO];
+}
+
+#if ENABLE_PROFILER
+- (void)applicationWillTerminate:(NSNotification *)notification {
+    for (int stage = 0; stage < PROFILE_STAGE_COUNT; stage++) {
+        ProfileStageStats stats;
+        profiler_get_stage_stats((ProfileStage)stage, &stats);
+        if (stats.count > 0) {
+            std::cout << "[Profiler] " << profiler_stage_name((ProfileStage)stage)
+                      << ": " << stats.count << " samples, p50 " << stats.p50_ns / 1000.0
+                      << " us, p99 " << stats.p99_ns / 1000.0 << " us, max "
+                      << stats.max_ns / 1000.0 << " us" << std::endl;
+        }
+    }
+    const char *path = getenv("PROFILER_TRACE");
+    if (path && profiler_write_chrome_trace(path)) {
+        std::cout << "[Profiler] Trace written to " << path << std::endl;
+    }
+}
+#endif
+
 - (BOOL)applicationShouldTerminateAfterLastWindowClosed:(NSApplication *)sender {
     return YES;
 }
@@ -0,0 +1,562 @@
+// Event manager - lock-free event ring, batched dispatch and a timer wheel
+
+#include "EventManager.h"
+#include "profiler.h"
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+namespace {
+
+constexpr uint64_t kNanosPerTick = 1000000; // 1 ms
+
+size_t roundUpToPowerOfTwo(size_t value) {
+    size_t result = 2;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+void runFunction(void *context) {
+    std::unique_ptr<std::function<void()>> callback(static_cast<std::function<void()> *>(context));
+    (*callback)();
+}
+
+bool isCoalesced(EventType type) {
+    return type == EventType::MouseMove || type == EventType::Resize;
+}
+
+} // namespace
+
+// ============================================================================
+// Lifetime
+// ============================================================================
+
+EventManager::EventManager(size_t capacity)
+    : mask(roundUpToPowerOfTwo(capacity) - 1),
+      tail(0),
+      head(0),
+      dropped(0),
+      wake_pending(false),
+      running(false),
+      next_listener_id(1),
+      next_target(kAnyTarget + 1),
+      in_frame(false),
+      dispatching(false),
+      listeners_removed(false),
+      coalesced(0),
+      dispatched(0),
+      frames(0),
+      epoch(now()),
+      wheel_tick(0),
+      active_timers(0),
+      timers_fired(0) {
+    slots.reset(new Slot[mask + 1]);
+    for (size_t i = 0; i <= mask; i++) {
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    for (int level = 0; level <= kWheelLevels; level++) {
+        std::fill(wheel[level], wheel[level] + kWheelSlots, kNoTimer);
+        occupied[level] = 0;
+    }
+}
+
+EventManager::~EventManager() {
+    stopEventLoop();
+}
+
+EventManager &EventManager::shared() {
+    static EventManager instance;
+    return instance;
+}
+
+uint64_t EventManager::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// ============================================================================
+// Ring
+// ============================================================================
+
+bool EventManager::post(const Event &event) {
+    uint64_t position = tail.load(std::memory_order_relaxed);
+    Slot *slot;
+    for (;;) {
+        slot = &slots[position & mask];
+        uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+        int64_t difference = static_cast<int64_t>(sequence - position);
+        if (difference == 0) {
+            if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) {
+            // The consumer has not freed this slot yet: full
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        } else {
+            position = tail.load(std::memory_order_relaxed);
+        }
+    }
+    slot->event = event;
+    slot->event.timestamp = now();
+    // Sequentially consistent so the wake check below cannot pass a drain
+    // that missed this event
+    slot->sequence.store(position + 1, std::memory_order_seq_cst);
+    if (event.type != EventType::Completion && event.type != EventType::Resize) {
+        PROFILE_INPUT();
+    }
+    wake();
+    return true;
+}
+
+bool EventManager::post(EventType type, uint32_t target, double x, double y,
+                        uint32_t code, uint32_t modifiers) {
+    Event event = {};
+    event.type = type;
+    event.target = target;
+    event.code = code;
+    event.modifiers = modifiers;
+    event.x = x;
+    event.y = y;
+    return post(event);
+}
+
+bool EventManager::postCompletion(void (*callback)(void *context), void *context) {
+    Event event = {};
+    event.type = EventType::Completion;
+    event.callback = callback;
+    event.context = context;
+    return post(event);
+}
+
+bool EventManager::postCompletion(std::function<void()> callback) {
+    auto *boxed = new std::function<void()>(std::move(callback));
+    if (!postCompletion(runFunction, boxed)) {
+        delete boxed;
+        return false;
+    }
+    return true;
+}
+
+bool EventManager::pop(Event &event) {
+    Slot &slot = slots[head & mask];
+    if (slot.sequence.load(std::memory_order_acquire) != head + 1) {
+        return false; // empty, or its producer is still writing
+    }
+    event = slot.event;
+    slot.sequence.store(head + mask + 1, std::memory_order_release);
+    head++;
+    return true;
+}
+
+bool EventManager::hasPendingEvents() const {
+    return tail.load(std::memory_order_acquire) != head;
+}
+
+void EventManager::wake() {
+    if (wake_pending.load(std::memory_order_seq_cst) || wake_pending.exchange(true)) {
+        return; // a frame is already coming
+    }
+    // At most once per frame, so copying the handler out is cheap; calling
+    // it unlocked lets it post or replace itself.
+    std::function<void()> handler;
+    {
+        std::lock_guard<std::mutex> guard(wake_lock);
+        handler = wake_handler;
+    }
+    wake_signal.notify_one();
+    if (handler) {
+        handler();
+    }
+}
+
+void EventManager::setWakeHandler(std::function<void()> handler) {
+    std::lock_guard<std::mutex> guard(wake_lock);
+    wake_handler = std::move(handler);
+}
+
+// ============================================================================
+// Dispatch
+// ============================================================================
+
+void EventManager::startEventLoop() {
+    running.store(true);
+    while (running.load()) {
+        uint64_t frame_start = now();
+        processEvents();
+
+        std::unique_lock<std::mutex> guard(wake_lock);
+        auto ready = [this] { return wake_pending.load() || !running.load(); };
+        int64_t timer_wait = getTimeUntilNextTimer();
+        if (timer_wait < 0) {
+            wake_signal.wait(guard, ready);
+        } else {
+            wake_signal.wait_for(guard, std::chrono::nanoseconds(timer_wait), ready);
+        }
+        guard.unlock();
+
+        // Let the rest of the frame's events pile up into one batch
+        uint64_t frame_end = frame_start + kFrameInterval;
+        uint64_t current = now();
+        if (running.load() && current < frame_end) {
+            std::this_thread::sleep_for(std::chrono::nanoseconds(frame_end - current));
+        }
+    }
+}
+
+void EventManager::stopEventLoop() {
+    running.store(false);
+    {
+        std::lock_guard<std::mutex> guard(wake_lock);
+    }
+    wake_signal.notify_all();
+}
+
+void EventManager::processEvents() {
+    if (in_frame) {
+        return; // a handler is running a nested run loop, e.g. a modal alert
+    }
+    in_frame = true;
+    frames++;
+    PROFILE_STAGE(PROFILE_EVENTS);
+    wake_pending.store(false);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    // Take at most one ring's worth, so fast producers cannot stall a frame
+    batch.clear();
+    Event event;
+    while (batch.size() <= mask && pop(event)) {
+        batch.push_back(event);
+    }
+
+    if (!batch.empty()) {
+        coalesce();
+        dispatching = true;
+        for (size_t i = 0; i < batch.size(); i++) {
+            if (!dropped_in_batch[i]) {
+                dispatch(batch[i]);
+            }
+        }
+        dispatching = false;
+
+        if (listeners_removed) {
+            for (auto &list : listeners) {
+                list.erase(std::remove_if(list.begin(), list.end(),
+                                          [](const Listener &listener) { return listener.id == 0; }),
+                           list.end());
+            }
+            listeners_removed = false;
+        }
+        for (auto &added : added_listeners) {
+            listeners[static_cast<size_t>(added.first)].push_back(std::move(added.second));
+        }
+        added_listeners.clear();
+    }
+
+    advanceTimers(currentTick());
+    in_frame = false;
+
+    if (hasPendingEvents()) {
+        // Left over, or posted while dispatching. The flag may already be
+        // set by a post whose frame was swallowed by a nested run loop
+        wake_pending.store(false);
+        wake();
+    }
+}
+
+// A mouse move or resize is dropped when a later one for the same target is
+// in the batch. Other events for the target end a run of moves, so clicks
+// and keys still see the pointer where it was when they happened.
+void EventManager::coalesce() {
+    dropped_in_batch.assign(batch.size(), 0);
+    if (batch.size() < 2) {
+        return;
+    }
+
+    std::vector<uint32_t> moving;   // targets with a later move, no barrier
+    std::vector<uint32_t> resizing; // targets with a later resize
+    for (size_t i = batch.size(); i-- > 0;) {
+        const Event &event = batch[i];
+        if (event.type == EventType::Completion) {
+            continue;
+        }
+        if (!isCoalesced(event.type)) {
+            moving.erase(std::remove(moving.begin(), moving.end(), event.target), moving.end());
+            continue;
+        }
+        std::vector<uint32_t> &later = event.type == EventType::MouseMove ? moving : resizing;
+        if (std::find(later.begin(), later.end(), event.target) != later.end()) {
+            dropped_in_batch[i] = 1;
+            coalesced++;
+        } else {
+            later.push_back(event.target);
+        }
+    }
+}
+
+void EventManager::dispatch(const Event &event) {
+    dispatched++;
+    if (event.type == EventType::Completion && event.callback) {
+        event.callback(event.context);
+    }
+    for (const Listener &listener : listeners[static_cast<size_t>(event.type)]) {
+        if (listener.id != 0 && (listener.target == kAnyTarget || listener.target == event.target)) {
+            listener.handler(event);
+        }
+    }
+}
+
+uint32_t EventManager::addListener(EventType type, uint32_t target, EventHandler handler) {
+    Listener listener = {next_listener_id++, target, std::move(handler)};
+    uint32_t id = listener.id;
+    if (dispatching) {
+        added_listeners.emplace_back(type, std::move(listener));
+    } else {
+        listeners[static_cast<size_t>(type)].push_back(std::move(listener));
+    }
+    return id;
+}
+
+void EventManager::removeListener(uint32_t id) {
+    for (auto &added : added_listeners) {
+        if (added.second.id == id) {
+            added.second.id = 0;
+            listeners_removed = true;
+        }
+    }
+    for (auto &list : listeners) {
+        for (auto it = list.begin(); it != list.end(); ++it) {
+            if (it->id != id) {
+                continue;
+            }
+            if (dispatching) {
+                // It may be the handler that is running
+                it->id = 0;
+                listeners_removed = true;
+            } else {
+                list.erase(it);
+            }
+            return;
+        }
+    }
+}
+
+EventStats EventManager::getStats() const {
+    EventStats stats;
+    stats.posted = tail.load(std::memory_order_relaxed);
+    stats.dropped = dropped.load(std::memory_order_relaxed);
+    stats.coalesced = coalesced;
+    stats.dispatched = dispatched;
+    stats.timers_fired = timers_fired;
+    stats.frames = frames;
+    return stats;
+}
+
+// ============================================================================
+// Timer wheel
+// ============================================================================
+//
+// Level L holds timers due in the current 64^(L+1)-tick block but not the
+// current 64^L one, in the slot of their 64^L sub-block. Entering a block
+// cascades that slot one level down, so every timer reaches level 0 in time
+// to fire on its exact tick. Anything further out waits in an overflow list.
+
+uint64_t EventManager::currentTick() const {
+    return (now() - epoch) / kNanosPerTick;
+}
+
+EventManager::TimerId EventManager::addTimer(uint32_t delay_ms, uint32_t interval_ms,
+                                             std::function<void()> callback) {
+    uint32_t index;
+    if (!free_timers.empty()) {
+        index = free_timers.back();
+        free_timers.pop_back();
+    } else {
+        index = static_cast<uint32_t>(timers.size());
+        timers.emplace_back();
+        timers.back().generation = 0;
+    }
+    Timer &timer = timers[index];
+    // The current tick is partly over, so round up: never fire early
+    timer.deadline = std::max(currentTick(), wheel_tick) + delay_ms + 1;
+    timer.interval = interval_ms;
+    timer.callback = std::move(callback);
+    timer.active = true;
+    timer.firing = false;
+    active_timers++;
+    insertTimer(index);
+    return (static_cast<uint64_t>(timer.generation) << 32) | (index + 1);
+}
+
+bool EventManager::cancelTimer(TimerId id) {
+    uint32_t index = static_cast<uint32_t>(id) - 1;
+    if (id == 0 || index >= timers.size()) {
+        return false;
+    }
+    Timer &timer = timers[index];
+    if (!timer.active || timer.generation != static_cast<uint32_t>(id >> 32)) {
+        return false;
+    }
+    timer.active = false;
+    active_timers--;
+    if (!timer.firing) {
+        unlinkTimer(index);
+        releaseTimer(index);
+    }
+    return true; // a firing one is released when its tick finishes
+}
+
+int64_t EventManager::getTimeUntilNextTimer() const {
+    if (active_timers == 0) {
+        return -1;
+    }
+    uint64_t tick = 0;
+    bool found = false;
+    for (int level = 0; level < kWheelLevels && !found; level++) {
+        if (occupied[level]) {
+            // Occupied slots are all ahead of the current one on their level
+            int shift = kWheelBits * level;
+            uint64_t slot = __builtin_ctzll(occupied[level]);
+            tick = ((wheel_tick >> (shift + kWheelBits)) << (shift + kWheelBits)) | (slot << shift);
+            found = true;
+        }
+    }
+    if (!found) {
+        int shift = kWheelBits * kWheelLevels;
+        tick = ((wheel_tick >> shift) + 1) << shift;
+    }
+    uint64_t due = epoch + tick * kNanosPerTick;
+    uint64_t current = now();
+    return due > current ? static_cast<int64_t>(due - current) : 0;
+}
+
+void EventManager::insertTimer(uint32_t index) {
+    Timer &timer = timers[index];
+    uint64_t deadline = std::max(timer.deadline, wheel_tick);
+    int level = 0;
+    while (level < kWheelLevels &&
+           (deadline >> (kWheelBits * (level + 1))) != (wheel_tick >> (kWheelBits * (level + 1)))) {
+        level++;
+    }
+    uint32_t slot = level < kWheelLevels
+                        ? static_cast<uint32_t>(deadline >> (kWheelBits * level)) & (kWheelSlots - 1)
+                        : 0;
+    timer.level = static_cast<uint8_t>(level);
+    timer.slot = static_cast<uint8_t>(slot);
+    timer.prev = kNoTimer;
+    timer.next = wheel[level][slot];
+    if (timer.next != kNoTimer) {
+        timers[timer.next].prev = index;
+    }
+    wheel[level][slot] = index;
+    occupied[level] |= 1ull << slot;
+}
+
+void EventManager::unlinkTimer(uint32_t index) {
+    Timer &timer = timers[index];
+    if (timer.prev != kNoTimer) {
+        timers[timer.prev].next = timer.next;
+    } else {
+        wheel[timer.level][timer.slot] = timer.next;
+        if (timer.next == kNoTimer) {
+            occupied[timer.level] &= ~(1ull << timer.slot);
+        }
+    }
+    if (timer.next != kNoTimer) {
+        timers[timer.next].prev = timer.prev;
+    }
+}
+
+void EventManager::releaseTimer(uint32_t index) {
+    Timer &timer = timers[index];
+    timer.callback = nullptr;
+    timer.firing = false;
+    timer.generation++;
+    free_timers.push_back(index);
+}
+
+void EventManager::cascade(int level) {
+    uint32_t slot = level < kWheelLevels
+                        ? static_cast<uint32_t>(wheel_tick >> (kWheelBits * level)) & (kWheelSlots - 1)
+                        : 0;
+    uint32_t index = wheel[level][slot];
+    wheel[level][slot] = kNoTimer;
+    occupied[level] &= ~(1ull << slot);
+    while (index != kNoTimer) {
+        uint32_t next = timers[index].next;
+        insertTimer(index);
+        index = next;
+    }
+}
+
+void EventManager::advanceTimers(uint64_t tick) {
+    while (wheel_tick < tick) {
+        if (active_timers == 0) {
+            wheel_tick = tick; // nothing to cascade or fire
+            return;
+        }
+
+        // Jump to the next occupied slot or block boundary, whichever is first
+        uint32_t position = static_cast<uint32_t>(wheel_tick) & (kWheelSlots - 1);
+        uint64_t ahead = position == kWheelSlots - 1 ? 0 : occupied[0] & (~0ull << (position + 1));
+        uint64_t block = wheel_tick & ~static_cast<uint64_t>(kWheelSlots - 1);
+        uint64_t next = ahead ? block + __builtin_ctzll(ahead) : block + kWheelSlots;
+        if (next > tick) {
+            wheel_tick = tick;
+            return;
+        }
+        wheel_tick = next;
+
+        if ((wheel_tick & (kWheelSlots - 1)) == 0) {
+            for (int level = kWheelLevels; level >= 1; level--) {
+                uint64_t span = 1ull << (kWheelBits * level);
+                if ((wheel_tick & (span - 1)) == 0) {
+                    cascade(level);
+                }
+            }
+        }
+        fireSlot(static_cast<uint32_t>(wheel_tick) & (kWheelSlots - 1));
+    }
+}
+
+void EventManager::fireSlot(uint32_t slot) {
+    firing.clear();
+    for (uint32_t index = wheel[0][slot]; index != kNoTimer; index = timers[index].next) {
+        firing.push_back(index);
+        timers[index].firing = true;
+    }
+    wheel[0][slot] = kNoTimer;
+    occupied[0] &= ~(1ull << slot);
+
+    // Callbacks may add or cancel timers, so timers[] is re-indexed after each
+    for (uint32_t index : firing) {
+        if (!timers[index].active) {
+            releaseTimer(index); // cancelled by an earlier callback
+            continue;
+        }
+        std::function<void()> callback = std::move(timers[index].callback);
+        bool periodic = timers[index].interval != 0;
+        if (!periodic) {
+            timers[index].active = false;
+            active_timers--;
+        }
+        timers_fired++;
+        callback();
+
+        Timer &timer = timers[index];
+        if (!periodic || !timer.active) {
+            releaseTimer(index);
+            continue;
+        }
+        // Skip missed periods instead of firing them in a burst
+        timer.deadline += timer.interval;
+        if (timer.deadline <= wheel_tick) {
+            timer.deadline += ((wheel_tick - timer.deadline) / timer.interval + 1) * timer.interval;
+        }
+        timer.callback = std::move(callback);
+        timer.firing = false;
+        insertTimer(index);
+    }
+}
@@ -0,0 +1,33 @@
+// Window - geometry and focus state of one desktop window
+
+#include "Window.h"
+
+Window::Window(const std::string& title, int x, int y, int width, int height)
+    : title(title),
+      x(x),
+      y(y),
+      width(width),
+      height(height),
+      state(WindowState::Normal),
+      flags(static_cast<uint32_t>(WindowFlags::Resizable) |
+            static_cast<uint32_t>(WindowFlags::Closable) |
+            static_cast<uint32_t>(WindowFlags::Minimizable) |
+            static_cast<uint32_t>(WindowFlags::Maximizable) |
+            static_cast<uint32_t>(WindowFlags::Titled) |
+            static_cast<uint32_t>(WindowFlags::Shadow)),
+      hasFocus(false) {}
+
+void Window::focus() {
+    hasFocus = true;
+}
+
+void Window::blur() {
+    hasFocus = false;
+}
+
+void Window::setFrame(int newX, int newY, int newWidth, int newHeight) {
+    x = newX;
+    y = newY;
+    width = newWidth;
+    height = newHeight;
+}
@@ -0,0 +1,119 @@
+// Window manager - z-ordered windows with a spatial index for hit-testing
+
+#include "WindowManager.h"
+#include "Window.h"
+#include "os_config.h"
+#include "spatial_index.h"
+#include <algorithm>
+
+namespace {
+
+constexpr int32_t kIndexCellSize = 128;
+
+OSRect frameOf(const Window& window) {
+    return OSRect{window.getX(), window.getY(), window.getWidth(), window.getHeight()};
+}
+
+} // namespace
+
+WindowManager::WindowManager()
+    : spatialIndex(spatial_index_create(OSRect{0, 0, DISPLAY_WIDTH, DISPLAY_HEIGHT}, kIndexCellSize)),
+      nextId(1),
+      nextZ(0) {}
+
+WindowManager::~WindowManager() {
+    spatial_index_destroy(spatialIndex);
+}
+
+uint32_t WindowManager::idOf(const Window* window) const {
+    auto it = ids.find(window);
+    return it == ids.end() ? 0 : it->second;
+}
+
+void WindowManager::registerWindow(std::shared_ptr<Window> window) {
+    if (!window || idOf(window.get()) != 0) {
+        return;
+    }
+    uint32_t id = nextId++;
+    ids[window.get()] = id;
+    windowsById[id] = window;
+    spatial_index_insert(spatialIndex, id, frameOf(*window), ++nextZ);
+    windows.push_back(std::move(window));
+}
+
+std::shared_ptr<Window> WindowManager::createWindow(const std::string& title, int x, int y, int width, int height) {
+    auto window = std::make_shared<Window>(title, x, y, width, height);
+    registerWindow(window);
+    return window;
+}
+
+void WindowManager::setFocused(std::shared_ptr<Window> window) {
+    if (focusedWindow == window) {
+        return;
+    }
+    if (focusedWindow) {
+        focusedWindow->blur();
+    }
+    focusedWindow = window;
+    if (!window) {
+        return;
+    }
+    window->focus();
+
+    uint32_t id = idOf(window.get());
+    if (id == 0) {
+        return;
+    }
+    spatial_index_set_z(spatialIndex, id, ++nextZ);
+    auto it = std::find(windows.begin(), windows.end(), window);
+    std::rotate(it, it + 1, windows.end());
+}
+
+void WindowManager::removeWindow(std::shared_ptr<Window> window) {
+    uint32_t id = window ? idOf(window.get()) : 0;
+    if (id == 0) {
+        return;
+    }
+    spatial_index_remove(spatialIndex, id);
+    ids.erase(window.get());
+    windowsById.erase(id);
+    windows.erase(std::find(windows.begin(), windows.end(), window));
+    if (focusedWindow == window) {
+        focusedWindow.reset();
+    }
+}
+
+const std::vector<std::shared_ptr<Window>>& WindowManager::getAllWindows() const {
+    return windows;
+}
+
+void WindowManager::setWindowFrame(const std::shared_ptr<Window>& window, int x, int y, int width, int height) {
+    if (!window) {
+        return;
+    }
+    window->setFrame(x, y, width, height);
+    uint32_t id = idOf(window.get());
+    if (id != 0) {
+        spatial_index_update(spatialIndex, id, frameOf(*window));
+    }
+}
+
+std::shared_ptr<Window> WindowManager::windowAt(int x, int y) const {
+    uint32_t id;
+    if (!spatial_index_top_at(spatialIndex, x, y, &id)) {
+        return nullptr;
+    }
+    return windowsById.at(id);
+}
+
+std::vector<std::shared_ptr<Window>> WindowManager::windowsInRect(int x, int y, int width, int height) {
+    std::vector<uint32_t> found(windows.size());
+    uint32_t count = spatial_index_query(spatialIndex, OSRect{x, y, width, height},
+                                         found.data(), static_cast<uint32_t>(found.size()));
+    std::vector<std::shared_ptr<Window>> result;
+    result.reserve(count);
+    for (uint32_t i = 0; i < count; i++) {
+        result.push_back(windowsById.at(found[i]));
+    }
+    return result;
+}
@@ -0,0 +1,201 @@
+// Virtualized grid - O(1) layout math and cell recycling
+
+#include "GridLayout.hpp"
+#include "profiler.h"
+#include <algorithm>
+#include <cmath>
+
+namespace OS {
+namespace Graphics {
+
+// ============================================================================
+// Layout
+// ============================================================================
+
+GridLayout::GridLayout()
+    : item_count(0), item_width(100), item_height(100), spacing(0), inset(0),
+      viewport_width(0), columns(1) {}
+
+void GridLayout::setItemSize(double width, double height) {
+  item_width = std::max(width, 1.0);
+  item_height = std::max(height, 1.0);
+  updateColumns();
+}
+
+void GridLayout::setSpacing(double spacing) {
+  this->spacing = std::max(spacing, 0.0);
+  updateColumns();
+}
+
+void GridLayout::setInset(double inset) {
+  this->inset = std::max(inset, 0.0);
+  updateColumns();
+}
+
+void GridLayout::setViewportWidth(double width) {
+  viewport_width = width;
+  updateColumns();
+}
+
+// As many columns as fit, but always at least one.
+void GridLayout::updateColumns() {
+  double usable = viewport_width - 2 * inset + spacing;
+  double fit = std::floor(usable / (item_width + spacing));
+  columns = fit >= 1 ? (uint32_t)std::min(fit, (double)UINT32_MAX) : 1;
+}
+
+uint64_t GridLayout::getRows() const {
+  return (item_count + columns - 1) / columns;
+}
+
+double GridLayout::getContentHeight() const {
+  uint64_t rows = getRows();
+  if (rows == 0) {
+    return 2 * inset;
+  }
+  return 2 * inset + rows * getRowPitch() - spacing;
+}
+
+GridRect GridLayout::frame(uint64_t index) const {
+  uint64_t row = index / columns;
+  uint64_t column = index % columns;
+  return GridRect{inset + column * (item_width + spacing),
+                  inset + row * getRowPitch(), item_width, item_height};
+}
+
+GridRange GridLayout::range(double top, double bottom) const {
+  uint64_t rows = getRows();
+  if (rows == 0 || bottom <= top) {
+    return GridRange{0, 0};
+  }
+  // Row r covers [inset + r * pitch, inset + r * pitch + item_height)
+  double pitch = getRowPitch();
+  double first = std::floor((top - inset - item_height) / pitch) + 1;
+  double end = std::ceil((bottom - inset) / pitch);
+  uint64_t first_row = first <= 0 ? 0 : (uint64_t)std::min(first, (double)rows);
+  uint64_t end_row = end <= 0 ? 0 : (uint64_t)std::min(end, (double)rows);
+  if (end_row <= first_row) {
+    return GridRange{0, 0};
+  }
+  return GridRange{first_row * columns,
+                   std::min(end_row * columns, item_count)};
+}
+
+uint64_t GridLayout::itemAt(double x, double y) const {
+  x -= inset;
+  y -= inset;
+  if (x < 0 || y < 0) {
+    return kNone;
+  }
+  double column_pitch = item_width + spacing;
+  double row_pitch = getRowPitch();
+  double column = std::floor(x / column_pitch);
+  double row = std::floor(y / row_pitch);
+  if (column >= columns || row >= (double)getRows() ||
+      x - column * column_pitch >= item_width ||
+      y - row * row_pitch >= item_height) {
+    return kNone;
+  }
+  uint64_t index = (uint64_t)row * columns + (uint64_t)column;
+  return index < item_count ? index : kNone;
+}
+
+// ============================================================================
+// Recycling
+// ============================================================================
+
+GridRecycler::GridRecycler(uint32_t overscan_rows)
+    : overscan_rows(overscan_rows), bound{0, 0}, slot_count(0), last_top(0),
+      scrolling_up(false) {}
+
+uint32_t GridRecycler::takeSlot() {
+  if (free_slots.empty()) {
+    return slot_count++;
+  }
+  uint32_t slot = free_slots.back();
+  free_slots.pop_back();
+  return slot;
+}
+
+uint32_t GridRecycler::slotFor(uint64_t item) const {
+  return bound.contains(item) ? slots[item - bound.first] : UINT32_MAX;
+}
+
+void GridRecycler::reset(GridUpdate &update) {
+  update.unbound.clear();
+  update.bound.clear();
+  for (uint64_t i = 0; i < slots.size(); i++) {
+    update.unbound.push_back(GridCell{bound.first + i, slots[i]});
+    free_slots.push_back(slots[i]);
+  }
+  slots.clear();
+  bound = GridRange{0, 0};
+}
+
+void GridRecycler::update(const GridLayout &layout, double top, double height,
+                          GridUpdate &update) {
+  PROFILE_STAGE(PROFILE_LAYOUT);
+  update.unbound.clear();
+  update.bound.clear();
+  if (top != last_top) {
+    scrolling_up = top < last_top;
+    last_top = top;
+  }
+
+  double overscan = overscan_rows * layout.getRowPitch();
+  update.visible = layout.range(top, top + height);
+  GridRange target =
+      layout.range(top - overscan, top + height + overscan);
+
+  // Drop what left the window: everything, or just the two ends.
+  if (target.empty() || target.first >= bound.end ||
+      target.end <= bound.first) {
+    for (uint64_t i = 0; i < slots.size(); i++) {
+      update.unbound.push_back(GridCell{bound.first + i, slots[i]});
+      free_slots.push_back(slots[i]);
+    }
+    slots.clear();
+    bound = GridRange{target.first, target.first};
+  } else {
+    while (bound.first < target.first) {
+      update.unbound.push_back(GridCell{bound.first++, slots.front()});
+      free_slots.push_back(slots.front());
+      slots.pop_front();
+    }
+    while (bound.end > target.end) {
+      update.unbound.push_back(GridCell{--bound.end, slots.back()});
+      free_slots.push_back(slots.back());
+      slots.pop_back();
+    }
+  }
+
+  // Bind what entered, keeping update.bound in ascending item order.
+  size_t front = update.bound.size();
+  while (bound.first > target.first) {
+    uint32_t slot = takeSlot();
+    slots.push_front(slot);
+    update.bound.push_back(GridCell{--bound.first, slot});
+  }
+  std::reverse(update.bound.begin() + front, update.bound.end());
+  while (bound.end < target.end) {
+    uint32_t slot = takeSlot();
+    slots.push_back(slot);
+    update.bound.push_back(GridCell{bound.end++, slot});
+  }
+
+  // One screen past the bound cells, on the side we're heading towards.
+  if (scrolling_up) {
+    update.prefetch = layout.range(top - overscan - height, top - overscan);
+    update.prefetch.end = std::min(update.prefetch.end, bound.first);
+  } else {
+    update.prefetch = layout.range(top + height + overscan,
+                                   top + 2 * height + overscan);
+    update.prefetch.first = std::max(update.prefetch.first, bound.end);
+  }
+  if (update.prefetch.empty()) {
+    update.prefetch = GridRange{0, 0};
+  }
+}
+
+} // namespace Graphics
+} // namespace OS
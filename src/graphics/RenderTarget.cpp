@@ -0,0 +1,71 @@
+// Render targets - offscreen pixel buffers and the static layer cache
+
+#include "RenderTarget.hpp"
+#include <algorithm>
+
+namespace OS {
+namespace Graphics {
+
+// ============================================================================
+// RenderTarget
+// ============================================================================
+
+RenderTarget::RenderTarget(uint32_t width, uint32_t height, float scale)
+    : pixels((size_t)width * height, 0),
+      width(width),
+      height(height),
+      scale(scale) {
+  context.width = width;
+  context.height = height;
+  context.bits_per_pixel = 32;
+  context.framebuffer = pixels.data();
+  context.clip = OSRect{0, 0, (int32_t)width, (int32_t)height};
+  context.recorder = nullptr;
+  context.arena = nullptr; // scratch comes from the heap
+
+  texture.texture_id = 0; // not registered with any atlas
+  texture.width = width;
+  texture.height = height;
+  texture.data = pixels.data();
+}
+
+void RenderTarget::clear(Color color) {
+  uint32_t argb = ((uint32_t)color.alpha << 24) | ((uint32_t)color.red << 16) |
+                  ((uint32_t)color.green << 8) | color.blue;
+  std::fill(pixels.begin(), pixels.end(), argb);
+}
+
+// ============================================================================
+// LayerCache
+// ============================================================================
+
+LayerCache::LayerCache() : valid(false), generation(0), stats{0, 0} {}
+
+RenderTarget &LayerCache::get(uint32_t width, uint32_t height, float scale,
+                              const Painter &paint) {
+  if (valid && target->getWidth() == width && target->getHeight() == height &&
+      target->getScale() == scale) {
+    stats.hits++;
+    return *target;
+  }
+
+  if (!target || target->getWidth() != width || target->getHeight() != height ||
+      target->getScale() != scale) {
+    target.reset(new RenderTarget(width, height, scale));
+  } else {
+    target->clear(Color{0, 0, 0, 0});
+  }
+  paint(*target);
+  valid = true;
+  generation++;
+  stats.repaints++;
+  return *target;
+}
+
+void LayerCache::release() {
+  target.reset();
+  valid = false;
+}
+
+} // namespace Graphics
+} // namespace OS
@@ -0,0 +1,316 @@
+// Texture atlas - skyline-packed pages for icons and other small images
+
+#include "TextureAtlas.hpp"
+#include "region.h"
+#include <algorithm>
+#include <cstring>
+
+namespace OS {
+namespace Graphics {
+
+namespace {
+
+// Ids pack a slot index with a generation so stale ids are detected in O(1).
+constexpr uint32_t kSlotBits = 20;
+constexpr uint32_t kSlotMask = (1u << kSlotBits) - 1;
+constexpr uint32_t kGenerationMask = (1u << (32 - kSlotBits)) - 1;
+constexpr int32_t kPadding = 1; // transparent gutter so filtering never bleeds
+
+uint32_t makeId(uint32_t index, uint32_t generation) {
+  return (generation << kSlotBits) | index;
+}
+
+} // namespace
+
+TextureAtlas::TextureAtlas(uint32_t size, uint32_t max_pages)
+    : atlas_size(size), max_pages(max_pages ? max_pages : 1), clock(0) {}
+
+TextureAtlas::~TextureAtlas() {
+  for (Page &page : pages) {
+    texture_destroy(page.texture);
+  }
+}
+
+// Bottom-left skyline: place the rect at the node where its top edge ends
+// lowest, breaking ties by the narrower node so wide gaps stay usable.
+bool TextureAtlas::packInto(Page &page, int32_t width, int32_t height,
+                            int32_t &x, int32_t &y) {
+  const int32_t size = (int32_t)atlas_size;
+  std::vector<SkylineNode> &sky = page.skyline;
+  size_t best = sky.size();
+  int32_t best_top = size + 1;
+  int32_t best_width = size + 1;
+  int32_t best_y = 0;
+
+  for (size_t i = 0; i < sky.size(); i++) {
+    if (sky[i].x + width > size) {
+      break;
+    }
+    int32_t top = 0;
+    int32_t remaining = width;
+    for (size_t j = i; remaining > 0; j++) {
+      top = std::max(top, sky[j].y);
+      remaining -= sky[j].width;
+    }
+    if (top + height > size) {
+      continue;
+    }
+    if (top + height < best_top ||
+        (top + height == best_top && sky[i].width < best_width)) {
+      best = i;
+      best_top = top + height;
+      best_width = sky[i].width;
+      best_y = top;
+    }
+  }
+  if (best == sky.size()) {
+    return false;
+  }
+
+  x = sky[best].x;
+  y = best_y;
+
+  // Raise the skyline under the new rect, trimming the nodes it covers.
+  SkylineNode node = {x, best_y + height, width};
+  sky.insert(sky.begin() + best, node);
+  size_t i = best + 1;
+  while (i < sky.size()) {
+    int32_t shadow = node.x + node.width - sky[i].x;
+    if (shadow <= 0) {
+      break;
+    }
+    if (shadow < sky[i].width) {
+      sky[i].x += shadow;
+      sky[i].width -= shadow;
+      break;
+    }
+    sky.erase(sky.begin() + i);
+  }
+  // Merge neighbours at the same height.
+  for (size_t k = 0; k + 1 < sky.size();) {
+    if (sky[k].y == sky[k + 1].y) {
+      sky[k].width += sky[k + 1].width;
+      sky.erase(sky.begin() + k + 1);
+    } else {
+      k++;
+    }
+  }
+  return true;
+}
+
+void TextureAtlas::resetPage(uint32_t index) {
+  Page &page = pages[index];
+  for (uint32_t slot : page.slots) {
+    slots[slot].live = false;
+    releaseSlot(slot);
+  }
+  page.slots.clear();
+  page.skyline.assign(1, SkylineNode{0, 0, (int32_t)atlas_size});
+  page.used_area = 0;
+  std::memset(page.texture->data, 0,
+              (size_t)atlas_size * atlas_size * sizeof(uint32_t));
+}
+
+bool TextureAtlas::allocate(int32_t width, int32_t height, uint32_t &page,
+                            int32_t &x, int32_t &y) {
+  for (uint32_t i = 0; i < pages.size(); i++) {
+    if (packInto(pages[i], width, height, x, y)) {
+      page = i;
+      return true;
+    }
+  }
+  if (pages.size() < max_pages) {
+    Texture *texture = texture_create(atlas_size, atlas_size);
+    if (!texture) {
+      return false;
+    }
+    pages.push_back(Page{texture, {}, {}, clock, 0});
+    page = (uint32_t)pages.size() - 1;
+    pages[page].skyline.push_back(SkylineNode{0, 0, (int32_t)atlas_size});
+    return packInto(pages[page], width, height, x, y);
+  }
+
+  // All pages full: recycle the least recently used one.
+  page = 0;
+  for (uint32_t i = 1; i < pages.size(); i++) {
+    if (pages[i].last_used < pages[page].last_used) {
+      page = i;
+    }
+  }
+  resetPage(page);
+  return packInto(pages[page], width, height, x, y);
+}
+
+void TextureAtlas::releaseSlot(uint32_t index) {
+  Slot &slot = slots[index];
+  if (!slot.path.empty()) {
+    path_ids.erase(slot.path);
+    slot.path.clear();
+  }
+  slot.generation = (slot.generation + 1) & kGenerationMask;
+  if (slot.generation == 0) {
+    slot.generation = 1; // id 0 is reserved for failure
+  }
+  free_slots.push_back(index);
+}
+
+TextureAtlas::Slot *TextureAtlas::resolve(uint32_t texture_id) {
+  uint32_t index = texture_id & kSlotMask;
+  if (index >= slots.size()) {
+    return nullptr;
+  }
+  Slot &slot = slots[index];
+  if (!slot.live || makeId(index, slot.generation) != texture_id) {
+    return nullptr;
+  }
+  return &slot;
+}
+
+uint32_t TextureAtlas::addTexture(const std::string &path) {
+  auto it = path_ids.find(path);
+  if (it != path_ids.end()) {
+    return it->second;
+  }
+  uint32_t width = 0;
+  uint32_t height = 0;
+  std::vector<uint32_t> pixels;
+  if (!loader || !loader(path, width, height, pixels) ||
+      pixels.size() < (size_t)width * height) {
+    return 0;
+  }
+  uint32_t id = addTexture(width, height, pixels.data());
+  if (id != 0) {
+    slots[id & kSlotMask].path = path;
+    path_ids[path] = id;
+  }
+  return id;
+}
+
+uint32_t TextureAtlas::addTexture(uint32_t width, uint32_t height,
+                                  const uint32_t *pixels) {
+  if (width == 0 || height == 0 || !pixels ||
+      width + kPadding > atlas_size || height + kPadding > atlas_size) {
+    return 0;
+  }
+  if (free_slots.empty() && slots.size() > kSlotMask) {
+    return 0;
+  }
+
+  uint32_t page = 0;
+  int32_t x = 0;
+  int32_t y = 0;
+  if (!allocate((int32_t)width + kPadding, (int32_t)height + kPadding, page, x,
+                y)) {
+    return 0;
+  }
+
+  // Eviction above may have freed slots, so take one only now.
+  uint32_t index;
+  if (!free_slots.empty()) {
+    index = free_slots.back();
+    free_slots.pop_back();
+  } else {
+    index = (uint32_t)slots.size();
+    slots.push_back(Slot{1, false, {}, {}});
+  }
+
+  Page &target = pages[page];
+  uint32_t *dst = (uint32_t *)target.texture->data;
+  for (uint32_t row = 0; row < height; row++) {
+    std::memcpy(dst + (size_t)(y + row) * atlas_size + x,
+                pixels + (size_t)row * width, width * sizeof(uint32_t));
+  }
+  target.slots.push_back(index);
+  target.used_area += (uint64_t)width * height;
+  target.last_used = ++clock;
+
+  float scale = 1.0f / (float)atlas_size;
+  Slot &slot = slots[index];
+  slot.live = true;
+  slot.region.page = page;
+  slot.region.rect = OSRect{x, y, (int32_t)width, (int32_t)height};
+  slot.region.u0 = (float)x * scale;
+  slot.region.v0 = (float)y * scale;
+  slot.region.u1 = (float)(x + (int32_t)width) * scale;
+  slot.region.v1 = (float)(y + (int32_t)height) * scale;
+  return makeId(index, slot.generation);
+}
+
+void TextureAtlas::removeTexture(uint32_t texture_id) {
+  Slot *slot = resolve(texture_id);
+  if (!slot) {
+    return;
+  }
+  uint32_t index = texture_id & kSlotMask;
+  uint32_t page_index = slot->region.page;
+  Page &page = pages[page_index];
+  page.used_area -= (uint64_t)rect_area(slot->region.rect);
+  page.slots.erase(std::find(page.slots.begin(), page.slots.end(), index));
+  slot->live = false;
+  releaseSlot(index);
+
+  // The skyline cannot reclaim holes; an emptied page starts over.
+  if (page.slots.empty()) {
+    resetPage(page_index);
+  }
+}
+
+const AtlasRegion *TextureAtlas::lookup(uint32_t texture_id) {
+  Slot *slot = resolve(texture_id);
+  if (!slot) {
+    return nullptr;
+  }
+  pages[slot->region.page].last_used = ++clock;
+  return &slot->region;
+}
+
+void TextureAtlas::draw(GraphicsContext *ctx, uint32_t texture_id, int32_t x,
+                        int32_t y) {
+  const AtlasRegion *region = lookup(texture_id);
+  if (region) {
+    draw_texture_region(ctx, pages[region->page].texture, region->rect, x, y);
+  }
+}
+
+void TextureAtlas::drawBatch(GraphicsContext *ctx,
+                             const std::vector<AtlasDraw> &draws) {
+  batch_order.clear();
+  for (uint32_t i = 0; i < draws.size(); i++) {
+    if (resolve(draws[i].texture_id)) {
+      batch_order.push_back(i);
+    }
+  }
+  auto pageOf = [&](uint32_t i) {
+    return slots[draws[i].texture_id & kSlotMask].region.page;
+  };
+  std::stable_sort(batch_order.begin(), batch_order.end(),
+                   [&](uint32_t a, uint32_t b) { return pageOf(a) < pageOf(b); });
+
+  uint64_t now = ++clock;
+  for (uint32_t i : batch_order) {
+    const AtlasRegion &region =
+        slots[draws[i].texture_id & kSlotMask].region;
+    Page &page = pages[region.page];
+    page.last_used = now;
+    draw_texture_region(ctx, page.texture, region.rect, draws[i].x,
+                        draws[i].y);
+  }
+}
+
+Texture *TextureAtlas::getPage(uint32_t page) const {
+  return page < pages.size() ? pages[page].texture : nullptr;
+}
+
+float TextureAtlas::getOccupancy() const {
+  if (pages.empty()) {
+    return 0.0f;
+  }
+  uint64_t used = 0;
+  for (const Page &page : pages) {
+    used += page.used_area;
+  }
+  return (float)used / ((float)pages.size() * atlas_size * atlas_size);
+}
+
+} // namespace Graphics
+} // namespace OS
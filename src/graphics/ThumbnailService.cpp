@@ -0,0 +1,545 @@
+// Thumbnail service - decode workers, box resampler, memory and disk caches
+
+#include "ThumbnailService.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+namespace OS {
+namespace Graphics {
+
+namespace {
+
+constexpr char kThumbMagic[4] = {'O', 'S', 'T', 'H'};
+constexpr uint32_t kThumbVersion = 1;
+constexpr const char *kThumbSuffix = ".thumb";
+
+struct ThumbHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t key;
+  uint32_t width;
+  uint32_t height;
+};
+
+uint64_t fmix64(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDull;
+  h ^= h >> 33;
+  h *= 0xC4CEB9FE1A85EC53ull;
+  h ^= h >> 33;
+  return h;
+}
+
+// FNV-1a over the path, then the stat fields and size folded in.
+uint64_t cacheKey(const std::string &path, const struct stat &st,
+                  uint32_t max_dimension) {
+  uint64_t h = 14695981039346656037ull;
+  for (unsigned char c : path) {
+    h ^= c;
+    h *= 1099511628211ull;
+  }
+#ifdef __APPLE__
+  int64_t mtime_ns = (int64_t)st.st_mtimespec.tv_sec * 1000000000 +
+                     st.st_mtimespec.tv_nsec;
+#else
+  int64_t mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 +
+                     st.st_mtim.tv_nsec;
+#endif
+  h = fmix64(h ^ (uint64_t)mtime_ns);
+  h = fmix64(h ^ (uint64_t)st.st_size);
+  return fmix64(h ^ max_dimension);
+}
+
+uint64_t nowNs() {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+bool readAll(int fd, void *data, size_t size) {
+  char *p = (char *)data;
+  while (size > 0) {
+    ssize_t n = ::read(fd, p, size);
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= (size_t)n;
+  }
+  return true;
+}
+
+bool writeAll(int fd, const void *data, size_t size) {
+  const char *p = (const char *)data;
+  while (size > 0) {
+    ssize_t n = ::write(fd, p, size);
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= (size_t)n;
+  }
+  return true;
+}
+
+// Source pixels covering each destination pixel, with their coverage.
+struct Span {
+  uint32_t first;
+  uint32_t count;
+  uint32_t offset; // into the weight array
+};
+
+void buildSpans(uint32_t src, uint32_t dst, std::vector<Span> &spans,
+                std::vector<float> &weights) {
+  spans.resize(dst);
+  weights.clear();
+  double scale = (double)src / dst;
+  for (uint32_t i = 0; i < dst; i++) {
+    double start = i * scale;
+    double end = std::min((i + 1) * scale, (double)src);
+    uint32_t first = (uint32_t)start;
+    uint32_t last = std::min((uint32_t)std::ceil(end), src) - 1;
+    if (last < first) {
+      last = first;
+    }
+    spans[i] = Span{first, last - first + 1, (uint32_t)weights.size()};
+    float norm = (float)(1.0 / (end - start));
+    for (uint32_t k = first; k <= last; k++) {
+      double cover = std::min(end, (double)k + 1) - std::max(start, (double)k);
+      weights.push_back((float)cover * norm);
+    }
+  }
+}
+
+} // namespace
+
+// ============================================================================
+// Resampling
+// ============================================================================
+
+void ThumbnailService::fitSize(uint32_t width, uint32_t height, uint32_t max,
+                               uint32_t &out_width, uint32_t &out_height) {
+  if (width <= max && height <= max) {
+    out_width = width;
+    out_height = height;
+    return;
+  }
+  double scale = (double)max / std::max(width, height);
+  out_width = std::max<uint32_t>(1, (uint32_t)(width * scale + 0.5));
+  out_height = std::max<uint32_t>(1, (uint32_t)(height * scale + 0.5));
+}
+
+// Separable: each source row is filtered horizontally into a row of float
+// channels once (rows on a boundary are reused), then rows are combined
+// vertically into the output row.
+void ThumbnailService::resample(const uint32_t *src, uint32_t src_width,
+                                uint32_t src_height, size_t src_stride,
+                                uint32_t *dst, uint32_t dst_width,
+                                uint32_t dst_height) {
+  if (!src || !dst || src_width == 0 || src_height == 0 || dst_width == 0 ||
+      dst_height == 0) {
+    return;
+  }
+  std::vector<Span> x_spans, y_spans;
+  std::vector<float> x_weights, y_weights;
+  buildSpans(src_width, dst_width, x_spans, x_weights);
+  buildSpans(src_height, dst_height, y_spans, y_weights);
+
+  std::vector<float> row((size_t)dst_width * 4);
+  std::vector<float> acc((size_t)dst_width * 4);
+  uint32_t row_index = UINT32_MAX;
+
+  auto filterRow = [&](uint32_t y) {
+    const uint32_t *in = src + (size_t)y * src_stride;
+    for (uint32_t x = 0; x < dst_width; x++) {
+      const Span &span = x_spans[x];
+      const float *w = &x_weights[span.offset];
+      float a = 0, r = 0, g = 0, b = 0;
+      for (uint32_t k = 0; k < span.count; k++) {
+        uint32_t p = in[span.first + k];
+        a += w[k] * (float)(p >> 24);
+        r += w[k] * (float)((p >> 16) & 0xFF);
+        g += w[k] * (float)((p >> 8) & 0xFF);
+        b += w[k] * (float)(p & 0xFF);
+      }
+      float *out = &row[(size_t)x * 4];
+      out[0] = a;
+      out[1] = r;
+      out[2] = g;
+      out[3] = b;
+    }
+    row_index = y;
+  };
+
+  for (uint32_t y = 0; y < dst_height; y++) {
+    const Span &span = y_spans[y];
+    std::fill(acc.begin(), acc.end(), 0.0f);
+    for (uint32_t k = 0; k < span.count; k++) {
+      if (row_index != span.first + k) {
+        filterRow(span.first + k);
+      }
+      float w = y_weights[span.offset + k];
+      for (size_t i = 0; i < acc.size(); i++) {
+        acc[i] += w * row[i];
+      }
+    }
+    uint32_t *out = dst + (size_t)y * dst_width;
+    for (uint32_t x = 0; x < dst_width; x++) {
+      uint32_t c[4];
+      for (int i = 0; i < 4; i++) {
+        float v = acc[(size_t)x * 4 + i] + 0.5f;
+        c[i] = v >= 255.0f ? 255u : (v <= 0.0f ? 0u : (uint32_t)v);
+      }
+      out[x] = (c[0] << 24) | (c[1] << 16) | (c[2] << 8) | c[3];
+    }
+  }
+}
+
+// ============================================================================
+// Service
+// ============================================================================
+
+ThumbnailService::ThumbnailService(const std::string &cache_dir,
+                                   uint32_t max_dimension,
+                                   uint32_t num_workers, size_t memory_budget,
+                                   uint64_t disk_budget)
+    : cache_dir(cache_dir), max_dimension(std::max(max_dimension, 1u)),
+      memory_budget(memory_budget), disk_budget(disk_budget), memory_used(0),
+      stopping(false), disk_used(-1), requests(0), memory_hits(0),
+      disk_hits(0), decoded(0), failed(0), decode_ns(0), resample_ns(0) {
+  if (!this->cache_dir.empty()) {
+    mkdir(this->cache_dir.c_str(), 0755);
+  }
+  if (num_workers == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    num_workers = cpus > 0 ? (uint32_t)cpus : 1;
+  }
+  for (uint32_t i = 0; i < num_workers; i++) {
+    workers.emplace_back(&ThumbnailService::workerMain, this);
+  }
+}
+
+ThumbnailService::~ThumbnailService() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stopping = true;
+    queue.clear();
+    pending.clear();
+  }
+  ready.notify_all();
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+}
+
+void ThumbnailService::setDecoder(Decoder decoder) {
+  std::lock_guard<std::mutex> guard(lock);
+  this->decoder = std::move(decoder);
+}
+
+ThumbnailRef ThumbnailService::lookup(const std::string &path) {
+  std::lock_guard<std::mutex> guard(lock);
+  auto it = memory.find(path);
+  if (it == memory.end()) {
+    return nullptr;
+  }
+  lru.splice(lru.begin(), lru, it->second.lru);
+  return it->second.thumbnail;
+}
+
+void ThumbnailService::request(const std::string &path, Callback callback) {
+  requests++;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = pending.find(path);
+    if (it != pending.end()) {
+      it->second.push_back(std::move(callback));
+      return;
+    }
+    pending[path].push_back(std::move(callback));
+    queue.push_back(path);
+  }
+  ready.notify_one();
+}
+
+void ThumbnailService::cancel(const std::string &path) {
+  std::lock_guard<std::mutex> guard(lock);
+  pending.erase(path);
+  queue.erase(std::remove(queue.begin(), queue.end(), path), queue.end());
+}
+
+void ThumbnailService::cancelAll() {
+  std::lock_guard<std::mutex> guard(lock);
+  pending.clear();
+  queue.clear();
+}
+
+ThumbnailStats ThumbnailService::getStats() const {
+  return ThumbnailStats{requests, memory_hits, disk_hits, decoded,
+                        failed,   decode_ns,   resample_ns};
+}
+
+void ThumbnailService::workerMain() {
+  for (;;) {
+    std::string path;
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      ready.wait(guard, [this] { return stopping || !queue.empty(); });
+      if (stopping) {
+        return;
+      }
+      path = std::move(queue.front());
+      queue.pop_front();
+    }
+
+    ThumbnailRef thumbnail = produce(path);
+
+    // A request cancelled meanwhile has no callbacks left, but the result
+    // is still cached.
+    std::vector<Callback> callbacks;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      auto it = pending.find(path);
+      if (it != pending.end()) {
+        callbacks.swap(it->second);
+        pending.erase(it);
+      }
+    }
+    for (Callback &callback : callbacks) {
+      callback(path, thumbnail);
+    }
+  }
+}
+
+ThumbnailRef ThumbnailService::produce(const std::string &path) {
+  struct stat st;
+  if (::stat(path.c_str(), &st) != 0) {
+    failed++;
+    return nullptr;
+  }
+  uint64_t key = cacheKey(path, st, max_dimension);
+
+  ThumbnailRef thumbnail = memoryGet(path, key);
+  if (thumbnail) {
+    memory_hits++;
+    return thumbnail;
+  }
+  thumbnail = diskGet(key);
+  if (thumbnail) {
+    disk_hits++;
+    memoryPut(path, key, thumbnail);
+    return thumbnail;
+  }
+
+  Decoder decode;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    decode = decoder;
+  }
+  uint32_t width = 0;
+  uint32_t height = 0;
+  std::vector<uint32_t> pixels;
+  uint64_t t0 = nowNs();
+  // Twice the target keeps the box filter doing the final, visible step.
+  bool ok = decode && decode(path, max_dimension * 2, width, height, pixels) &&
+            width > 0 && height > 0 && pixels.size() >= (size_t)width * height;
+  uint64_t t1 = nowNs();
+  decode_ns += t1 - t0;
+  if (!ok) {
+    failed++;
+    return nullptr;
+  }
+
+  std::shared_ptr<Thumbnail> result(new Thumbnail{0, 0, {}});
+  fitSize(width, height, max_dimension, result->width, result->height);
+  if (result->width == width && result->height == height) {
+    pixels.resize((size_t)width * height);
+    result->pixels.swap(pixels);
+  } else {
+    result->pixels.resize((size_t)result->width * result->height);
+    resample(pixels.data(), width, height, width, result->pixels.data(),
+             result->width, result->height);
+  }
+  resample_ns += nowNs() - t1;
+  decoded++;
+
+  diskPut(key, *result);
+  memoryPut(path, key, result);
+  return result;
+}
+
+// ============================================================================
+// Memory cache
+// ============================================================================
+
+ThumbnailRef ThumbnailService::memoryGet(const std::string &path,
+                                         uint64_t key) {
+  std::lock_guard<std::mutex> guard(lock);
+  auto it = memory.find(path);
+  if (it == memory.end() || it->second.key != key) {
+    return nullptr;
+  }
+  lru.splice(lru.begin(), lru, it->second.lru);
+  return it->second.thumbnail;
+}
+
+void ThumbnailService::memoryPut(const std::string &path, uint64_t key,
+                                 ThumbnailRef thumbnail) {
+  size_t bytes = thumbnail->pixels.size() * sizeof(uint32_t);
+  std::lock_guard<std::mutex> guard(lock);
+  auto it = memory.find(path);
+  if (it != memory.end()) {
+    memory_used -= it->second.thumbnail->pixels.size() * sizeof(uint32_t);
+    it->second.thumbnail = std::move(thumbnail);
+    it->second.key = key;
+    lru.splice(lru.begin(), lru, it->second.lru);
+  } else {
+    lru.push_front(path);
+    memory[path] = MemoryEntry{std::move(thumbnail), key, lru.begin()};
+  }
+  memory_used += bytes;
+
+  // Callers holding a ThumbnailRef keep evicted pixels alive.
+  while (memory_used > memory_budget && lru.size() > 1) {
+    auto victim = memory.find(lru.back());
+    memory_used -= victim->second.thumbnail->pixels.size() * sizeof(uint32_t);
+    memory.erase(victim);
+    lru.pop_back();
+  }
+}
+
+// ============================================================================
+// Disk cache
+// ============================================================================
+
+std::string ThumbnailService::cachePath(uint64_t key) const {
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx", (unsigned long long)key);
+  return cache_dir + "/" + name + kThumbSuffix;
+}
+
+ThumbnailRef ThumbnailService::diskGet(uint64_t key) {
+  if (cache_dir.empty()) {
+    return nullptr;
+  }
+  std::string file = cachePath(key);
+  int fd = ::open(file.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return nullptr;
+  }
+  ThumbHeader header;
+  std::shared_ptr<Thumbnail> thumbnail;
+  if (readAll(fd, &header, sizeof(header)) &&
+      std::memcmp(header.magic, kThumbMagic, sizeof(header.magic)) == 0 &&
+      header.version == kThumbVersion && header.key == key &&
+      header.width > 0 && header.height > 0 &&
+      header.width <= max_dimension && header.height <= max_dimension) {
+    thumbnail.reset(new Thumbnail{header.width, header.height, {}});
+    thumbnail->pixels.resize((size_t)header.width * header.height);
+    if (!readAll(fd, thumbnail->pixels.data(),
+                 thumbnail->pixels.size() * sizeof(uint32_t))) {
+      thumbnail.reset();
+    }
+  }
+  ::close(fd);
+  if (thumbnail) {
+    utimes(file.c_str(), nullptr); // recently used: trimmed last
+  }
+  return thumbnail;
+}
+
+void ThumbnailService::diskPut(uint64_t key, const Thumbnail &thumbnail) {
+  if (cache_dir.empty()) {
+    return;
+  }
+  ThumbHeader header;
+  std::memcpy(header.magic, kThumbMagic, sizeof(header.magic));
+  header.version = kThumbVersion;
+  header.key = key;
+  header.width = thumbnail.width;
+  header.height = thumbnail.height;
+  size_t bytes = thumbnail.pixels.size() * sizeof(uint32_t);
+
+  // Written aside and renamed so readers never see a partial file.
+  std::string file = cachePath(key);
+  std::string temp = file + ".tmp";
+  int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return;
+  }
+  bool ok = writeAll(fd, &header, sizeof(header)) &&
+            writeAll(fd, thumbnail.pixels.data(), bytes);
+  ok = ::close(fd) == 0 && ok;
+  if (!ok || ::rename(temp.c_str(), file.c_str()) != 0) {
+    ::unlink(temp.c_str());
+    return;
+  }
+
+  std::lock_guard<std::mutex> guard(disk_lock);
+  if (disk_used >= 0) {
+    disk_used += (int64_t)(sizeof(header) + bytes);
+  }
+  if (disk_used < 0 || (uint64_t)disk_used > disk_budget) {
+    diskTrim();
+  }
+}
+
+// Measures the cache and, when over budget, deletes the least recently
+// used files down to three quarters of it. Caller holds disk_lock.
+void ThumbnailService::diskTrim() {
+  struct CacheFile {
+    std::string path;
+    time_t mtime;
+    off_t size;
+  };
+  std::vector<CacheFile> files;
+  int64_t total = 0;
+  DIR *dir = opendir(cache_dir.c_str());
+  if (!dir) {
+    return;
+  }
+  size_t suffix_length = std::strlen(kThumbSuffix);
+  while (struct dirent *entry = readdir(dir)) {
+    size_t length = std::strlen(entry->d_name);
+    if (length <= suffix_length ||
+        std::strcmp(entry->d_name + length - suffix_length, kThumbSuffix) !=
+            0) {
+      continue;
+    }
+    std::string path = cache_dir + "/" + entry->d_name;
+    struct stat st;
+    if (::stat(path.c_str(), &st) == 0) {
+      files.push_back(CacheFile{path, st.st_mtime, st.st_size});
+      total += st.st_size;
+    }
+  }
+  closedir(dir);
+
+  if ((uint64_t)total > disk_budget) {
+    std::sort(files.begin(), files.end(),
+              [](const CacheFile &a, const CacheFile &b) {
+                return a.mtime < b.mtime;
+              });
+    uint64_t target = disk_budget / 4 * 3;
+    for (const CacheFile &file : files) {
+      if ((uint64_t)total <= target) {
+        break;
+      }
+      if (::unlink(file.path.c_str()) == 0) {
+        total -= file.size;
+      }
+    }
+  }
+  disk_used = total;
+}
+
+} // namespace Graphics
+} // namespace OS
@@ -0,0 +1,401 @@
+// Blur engine - running-sum box passes split into row and column tiles
+
+#include "blur.h"
+#include "span_fill.h"
+#include "thread_pool.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BLUR_PASSES 3
+// The sums cannot overflow (sum * inv stays near 255 << 16 at any radius);
+// the cap bounds precision instead. inv = 65536 / window is rounded, and that
+// error is scaled by sums up to 255 * window: through r = 127 a pass stays
+// within half a level of the true mean, past r = 152 it drifts a full level.
+#define BLUR_MAX_BOX_RADIUS 127
+#define BLUR_ROW_GRAIN 8        // rows per task in the horizontal sweep
+#define BLUR_STRIP_BYTES 64     // one cache line of columns per vertical task
+#define SHADOW_CACHE_SIZE 32
+
+// ============================================================================
+// Box kernel
+// ============================================================================
+
+// Box radii for three passes approximating a Gaussian with sigma =
+// radius / 3 ("boxes for Gauss": widths wl and wl + 2 mixed so the summed
+// variance matches).
+static void boxes_for_radius(float radius, uint32_t boxes[BLUR_PASSES]) {
+  float sigma = radius / 3.0f;
+  float ideal_sq = 12.0f * sigma * sigma / BLUR_PASSES + 1.0f;
+  int32_t wl = 1;
+  while ((float)((wl + 1) * (wl + 1)) <= ideal_sq) {
+    wl++;
+  }
+  if (wl % 2 == 0) {
+    wl--;
+  }
+  float m_ideal = (12.0f * sigma * sigma - BLUR_PASSES * wl * wl -
+                   4.0f * BLUR_PASSES * wl - 3.0f * BLUR_PASSES) /
+                  (-4.0f * wl - 4.0f);
+  int32_t m = (int32_t)(m_ideal + 0.5f);
+  for (int32_t i = 0; i < BLUR_PASSES; i++) {
+    int32_t w = i < m ? wl : wl + 2;
+    int32_t r = (w - 1) / 2;
+    boxes[i] = (uint32_t)(r > BLUR_MAX_BOX_RADIUS ? BLUR_MAX_BOX_RADIUS : r);
+  }
+}
+
+static inline uint32_t box_reciprocal(uint32_t box) {
+  uint32_t window = 2 * box + 1;
+  return (65536 + window / 2) / window;
+}
+
+// One horizontal pass over n pixels of `ch` interleaved channels with
+// edge clamping. src and dst must not alias.
+static void box_row(const uint8_t *src, uint8_t *dst, uint32_t n, uint32_t ch,
+                    uint32_t box) {
+  uint32_t inv = box_reciprocal(box);
+  int32_t last = (int32_t)n - 1;
+  for (uint32_t k = 0; k < ch; k++) {
+    uint32_t sum = (box + 1) * src[k];
+    for (int32_t i = 1; i <= (int32_t)box; i++) {
+      sum += src[(i < last ? i : last) * ch + k];
+    }
+    for (int32_t x = 0; x <= last; x++) {
+      dst[x * ch + k] = (uint8_t)((sum * inv + 32768) >> 16);
+      int32_t add = x + (int32_t)box + 1;
+      int32_t sub = x - (int32_t)box;
+      sum += src[(add < last ? add : last) * ch + k];
+      sum -= src[(sub > 0 ? sub : 0) * ch + k];
+    }
+  }
+}
+
+// One vertical pass over a strip `bytes` wide. Channels are independent
+// bytes, so the strip is summed bytewise regardless of pixel layout.
+static void box_cols(const uint8_t *src, uint32_t src_stride, uint8_t *dst,
+                     uint32_t dst_stride, uint32_t rows, uint32_t bytes,
+                     uint32_t box, uint32_t *sums) {
+  uint32_t inv = box_reciprocal(box);
+  int32_t last = (int32_t)rows - 1;
+  for (uint32_t c = 0; c < bytes; c++) {
+    sums[c] = (box + 1) * src[c];
+  }
+  for (int32_t i = 1; i <= (int32_t)box; i++) {
+    const uint8_t *row = src + (size_t)(i < last ? i : last) * src_stride;
+    for (uint32_t c = 0; c < bytes; c++) {
+      sums[c] += row[c];
+    }
+  }
+  for (int32_t y = 0; y <= last; y++) {
+    uint8_t *out = dst + (size_t)y * dst_stride;
+    int32_t add = y + (int32_t)box + 1;
+    int32_t sub = y - (int32_t)box;
+    const uint8_t *add_row = src + (size_t)(add < last ? add : last) * src_stride;
+    const uint8_t *sub_row = src + (size_t)(sub > 0 ? sub : 0) * src_stride;
+    for (uint32_t c = 0; c < bytes; c++) {
+      out[c] = (uint8_t)((sums[c] * inv + 32768) >> 16);
+      sums[c] += add_row[c];
+      sums[c] -= sub_row[c];
+    }
+  }
+}
+
+// ============================================================================
+// Tiled passes
+// ============================================================================
+
+// Per-thread scratch, grown on demand and kept, so blurring the same sizes
+// frame after frame stops allocating. Tasks never nest on a thread. The
+// key's destructor frees it when the thread exits (a pool shutting down).
+static _Thread_local uint8_t *t_scratch;
+static _Thread_local size_t t_scratch_size;
+static pthread_key_t g_scratch_key;
+static pthread_once_t g_scratch_once = PTHREAD_ONCE_INIT;
+
+static void scratch_key_create(void) {
+  pthread_key_create(&g_scratch_key, free);
+}
+
+static uint8_t *thread_scratch(size_t size) {
+  if (size > t_scratch_size) {
+    pthread_once(&g_scratch_once, scratch_key_create);
+    uint8_t *scratch = (uint8_t *)realloc(t_scratch, size);
+    if (!scratch) {
+      return NULL;
+    }
+    pthread_setspecific(g_scratch_key, scratch);
+    t_scratch = scratch;
+    t_scratch_size = size;
+  }
+  return t_scratch;
+}
+
+typedef struct {
+  uint8_t *pixels;
+  uint32_t width;
+  uint32_t height;
+  uint32_t stride;
+  uint32_t channels;
+  uint32_t boxes[BLUR_PASSES];
+} BlurJob;
+
+// All three horizontal passes run back to back on each row while it is
+// hot in L1, ping-ponging between two row-sized scratch buffers.
+static void blur_rows_task(void *arg, uint32_t begin, uint32_t end) {
+  BlurJob *job = (BlurJob *)arg;
+  size_t row_bytes = (size_t)job->width * job->channels;
+  uint8_t *scratch = thread_scratch(row_bytes * 2);
+  if (!scratch) {
+    return;
+  }
+  uint8_t *a = scratch;
+  uint8_t *b = scratch + row_bytes;
+  for (uint32_t y = begin; y < end; y++) {
+    uint8_t *row = job->pixels + (size_t)y * job->stride;
+    box_row(row, a, job->width, job->channels, job->boxes[0]);
+    box_row(a, b, job->width, job->channels, job->boxes[1]);
+    box_row(b, row, job->width, job->channels, job->boxes[2]);
+  }
+}
+
+// Vertical passes work on strips one cache line wide so each row access
+// touches a single line; the strip is staged through two scratch columns.
+static void blur_strips_task(void *arg, uint32_t begin, uint32_t end) {
+  BlurJob *job = (BlurJob *)arg;
+  size_t strip_size = (size_t)job->height * BLUR_STRIP_BYTES;
+  uint8_t *scratch = thread_scratch(
+      BLUR_STRIP_BYTES * sizeof(uint32_t) + strip_size * 2);
+  if (!scratch) {
+    return;
+  }
+  uint32_t *sums = (uint32_t *)scratch;
+  scratch += BLUR_STRIP_BYTES * sizeof(uint32_t);
+  uint8_t *a = scratch;
+  uint8_t *b = scratch + strip_size;
+  uint32_t row_bytes = job->width * job->channels;
+  for (uint32_t s = begin; s < end; s++) {
+    uint32_t x0 = s * BLUR_STRIP_BYTES;
+    uint32_t bytes = row_bytes - x0 < BLUR_STRIP_BYTES ? row_bytes - x0
+                                                       : BLUR_STRIP_BYTES;
+    uint8_t *col = job->pixels + x0;
+    box_cols(col, job->stride, a, BLUR_STRIP_BYTES, job->height, bytes,
+             job->boxes[0], sums);
+    box_cols(a, BLUR_STRIP_BYTES, b, BLUR_STRIP_BYTES, job->height, bytes,
+             job->boxes[1], sums);
+    box_cols(b, BLUR_STRIP_BYTES, col, job->stride, job->height, bytes,
+             job->boxes[2], sums);
+  }
+}
+
+uint32_t blur_reach(float radius) {
+  if (radius < 1.0f) {
+    return 0;
+  }
+  uint32_t boxes[BLUR_PASSES];
+  boxes_for_radius(radius, boxes);
+  return boxes[0] + boxes[1] + boxes[2];
+}
+
+void blur_image_u8(uint8_t *pixels, uint32_t width, uint32_t height,
+                   uint32_t stride, uint32_t channels, float radius) {
+  if (!pixels || width == 0 || height == 0 || channels == 0 ||
+      radius < 1.0f) {
+    return;
+  }
+  BlurJob job = {pixels, width, height, stride, channels, {0, 0, 0}};
+  boxes_for_radius(radius, job.boxes);
+
+  ThreadPool *pool = thread_pool_shared();
+  uint32_t strips = (width * channels + BLUR_STRIP_BYTES - 1) / BLUR_STRIP_BYTES;
+  thread_pool_parallel_for(pool, height, BLUR_ROW_GRAIN, blur_rows_task, &job);
+  thread_pool_parallel_for(pool, strips, 1, blur_strips_task, &job);
+}
+
+// ============================================================================
+// Shadow mask cache
+// ============================================================================
+
+typedef struct {
+  ShadowMask mask; // first member: acquire hands out &entry->mask
+  uint32_t key_width;
+  uint32_t key_height;
+  int32_t key_blur;
+  int32_t key_corner;
+  uint32_t refcount;
+  uint64_t last_used;
+  bool cached;
+  bool building; // mask not filled in yet; wait on g_shadow_built
+} ShadowMaskEntry;
+
+static ShadowMaskEntry *g_shadow_cache[SHADOW_CACHE_SIZE];
+static uint64_t g_shadow_tick = 0;
+static pthread_mutex_t g_shadow_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_shadow_built = PTHREAD_COND_INITIALIZER;
+
+// Fills in entry->mask from its key; false when out of memory.
+static bool shadow_mask_build(ShadowMaskEntry *entry) {
+  uint32_t width = entry->key_width;
+  uint32_t height = entry->key_height;
+  int32_t blur = entry->key_blur;
+  int32_t corner = entry->key_corner;
+  uint32_t mw = width + 2 * (uint32_t)blur;
+  uint32_t mh = height + 2 * (uint32_t)blur;
+  uint8_t *coverage = (uint8_t *)calloc((size_t)mw * mh, 1);
+  if (!coverage) {
+    return false;
+  }
+
+  // Rasterize the caster with the same corner spans as draw_rounded_rect.
+  int32_t max_corner = (int32_t)(width < height ? width : height) / 2;
+  int32_t r = corner < 0 ? 0 : (corner > max_corner ? max_corner : corner);
+  for (uint32_t y = 0; y < height; y++) {
+    int32_t band = (int32_t)(y < height - 1 - y ? y : height - 1 - y);
+    int32_t inset = band < r ? span_corner_inset(r, band) : 0;
+    if ((int32_t)width - 2 * inset > 0) {
+      memset(coverage + (size_t)(y + blur) * mw + blur + inset, 255,
+             width - 2 * (uint32_t)inset);
+    }
+  }
+  blur_image_u8(coverage, mw, mh, mw, 1, (float)blur);
+
+  entry->mask.width = mw;
+  entry->mask.height = mh;
+  entry->mask.pad = blur;
+  entry->mask.coverage = coverage;
+  return true;
+}
+
+static void shadow_mask_free(ShadowMaskEntry *entry) {
+  free((void *)entry->mask.coverage);
+  free(entry);
+}
+
+// Drops one reference under g_shadow_lock; true when the caller must free
+// the entry (it was already out of the cache).
+static bool shadow_mask_unref(ShadowMaskEntry *entry) {
+  entry->refcount--;
+  return !entry->cached && entry->refcount == 0;
+}
+
+const ShadowMask *shadow_mask_acquire(uint32_t width, uint32_t height,
+                                      float blur_radius, int corner_radius) {
+  int32_t blur = (int32_t)(blur_radius + 0.5f);
+  if (width == 0 || height == 0 || blur < 0) {
+    return NULL;
+  }
+
+  pthread_mutex_lock(&g_shadow_lock);
+  for (int i = 0; i < SHADOW_CACHE_SIZE; i++) {
+    ShadowMaskEntry *e = g_shadow_cache[i];
+    if (e && e->key_width == width && e->key_height == height &&
+        e->key_blur == blur && e->key_corner == corner_radius) {
+      // Tile workers replaying one shadow all land here; the first one
+      // builds the mask and the rest wait for it rather than each blurring
+      // a copy into its own slot.
+      e->refcount++;
+      e->last_used = ++g_shadow_tick;
+      while (e->building) {
+        pthread_cond_wait(&g_shadow_built, &g_shadow_lock);
+      }
+      bool failed = !e->mask.coverage;
+      bool orphan = failed && shadow_mask_unref(e);
+      pthread_mutex_unlock(&g_shadow_lock);
+      if (orphan) {
+        shadow_mask_free(e);
+      }
+      return failed ? NULL : &e->mask;
+    }
+  }
+
+  ShadowMaskEntry *entry =
+      (ShadowMaskEntry *)calloc(1, sizeof(ShadowMaskEntry));
+  if (!entry) {
+    pthread_mutex_unlock(&g_shadow_lock);
+    return NULL;
+  }
+  entry->key_width = width;
+  entry->key_height = height;
+  entry->key_blur = blur;
+  entry->key_corner = corner_radius;
+  entry->refcount = 1;
+  entry->building = true;
+
+  // Publish the entry before building so later callers find it. With every
+  // slot in use it stays private and a racing builder makes its own.
+  int victim = -1;
+  for (int i = 0; i < SHADOW_CACHE_SIZE; i++) {
+    ShadowMaskEntry *e = g_shadow_cache[i];
+    if (!e) {
+      victim = i;
+      break;
+    }
+    if (e->refcount == 0 &&
+        (victim < 0 || e->last_used < g_shadow_cache[victim]->last_used)) {
+      victim = i;
+    }
+  }
+  if (victim >= 0) {
+    if (g_shadow_cache[victim]) {
+      shadow_mask_free(g_shadow_cache[victim]);
+    }
+    entry->cached = true;
+    entry->last_used = ++g_shadow_tick;
+    g_shadow_cache[victim] = entry;
+  }
+  pthread_mutex_unlock(&g_shadow_lock);
+
+  bool built = shadow_mask_build(entry);
+
+  pthread_mutex_lock(&g_shadow_lock);
+  entry->building = false;
+  bool orphan = false;
+  if (!built) {
+    // Out of the cache so the next caller retries; waiters see the empty
+    // mask and drop their references.
+    for (int i = 0; i < SHADOW_CACHE_SIZE; i++) {
+      if (g_shadow_cache[i] == entry) {
+        g_shadow_cache[i] = NULL;
+      }
+    }
+    entry->cached = false;
+    orphan = shadow_mask_unref(entry);
+  }
+  pthread_cond_broadcast(&g_shadow_built);
+  pthread_mutex_unlock(&g_shadow_lock);
+  if (orphan) {
+    shadow_mask_free(entry);
+  }
+  return built ? &entry->mask : NULL;
+}
+
+void shadow_mask_release(const ShadowMask *mask) {
+  if (!mask) {
+    return;
+  }
+  ShadowMaskEntry *entry = (ShadowMaskEntry *)mask;
+  pthread_mutex_lock(&g_shadow_lock);
+  bool orphan = shadow_mask_unref(entry);
+  pthread_mutex_unlock(&g_shadow_lock);
+  if (orphan) {
+    shadow_mask_free(entry);
+  }
+}
+
+void shadow_mask_cache_clear(void) {
+  pthread_mutex_lock(&g_shadow_lock);
+  for (int i = 0; i < SHADOW_CACHE_SIZE; i++) {
+    ShadowMaskEntry *e = g_shadow_cache[i];
+    if (!e) {
+      continue;
+    }
+    if (e->refcount == 0) {
+      shadow_mask_free(e);
+    } else {
+      e->cached = false; // freed by its last release
+    }
+    g_shadow_cache[i] = NULL;
+  }
+  pthread_mutex_unlock(&g_shadow_lock);
+}
@@ -0,0 +1,670 @@
+// Graphics primitives - software framebuffer implementation
+
+#include "graphics.h"
+#include "blur.h"
+#include "frame_arena.h"
+#include "os_config.h"
+#include "profiler.h"
+#include "region.h"
+#include "span_fill.h"
+#include "tile_renderer.h"
+#include "utils.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+static GraphicsContext *g_context = NULL;
+static TileRenderer *g_renderer = NULL; // records g_context's drawing
+static uint32_t *g_display = NULL; // scanout buffer filled by graphics_present
+static _Atomic uint32_t g_next_texture_id = 1; // textures load off-thread
+
+// Texture headers come from a pool; pixel storage varies in size and stays
+// on the heap.
+static MemoryPool *g_texture_pool = NULL;
+static pthread_once_t g_texture_pool_once = PTHREAD_ONCE_INIT;
+
+static void create_texture_pool(void) {
+  g_texture_pool = pool_create(sizeof(Texture), 256);
+}
+
+// ============================================================================
+// Helpers
+// ============================================================================
+
+// Scratch that only lives for one draw call. With an arena it costs a bump
+// and is reclaimed when the frame after next starts.
+static void *scratch_alloc(const GraphicsContext *ctx, size_t size) {
+  return ctx->arena ? frame_arena_alloc(ctx->arena, size) : malloc(size);
+}
+
+static void scratch_free(const GraphicsContext *ctx, void *ptr) {
+  if (!ctx->arena) {
+    free(ptr);
+  }
+}
+
+static inline int32_t clamp_i32(int32_t v, int32_t lo, int32_t hi) {
+  return v < lo ? lo : (v > hi ? hi : v);
+}
+
+static inline int64_t clamp_i64(int64_t v, int64_t lo, int64_t hi) {
+  return v < lo ? lo : (v > hi ? hi : v);
+}
+
+// floor(a * b / c) and its remainder, for non-negative a, b below 2^35 and
+// positive c below 2^35; a * b can pass 64 bits, so b goes in 16-bit halves.
+static int64_t mul_div(int64_t a, int64_t b, int64_t c, int64_t *rem) {
+  int64_t hi = a * (b >> 16);
+  int64_t lo = (hi % c) * 65536 + a * (b & 0xffff);
+  *rem = lo % c;
+  return hi / c * 65536 + lo / c;
+}
+
+// Minor-axis offset of step t on a line of n major steps and d minor ones
+// (d <= n, n > 0): round(t * d / n) halves up, with the remainder of
+// (2td + n) / 2n for stepping on.
+static int64_t line_offset(int64_t t, int64_t d, int64_t n, int64_t *rem) {
+  int64_t k = mul_div(2 * t, d, 2 * n, rem);
+  *rem += n;
+  if (*rem >= 2 * n) {
+    *rem -= 2 * n;
+    k++;
+  }
+  return k;
+}
+
+// First step whose offset reaches k (0 < k <= d): ceil(n * (2k - 1) / 2d).
+static int64_t line_first_step(int64_t k, int64_t d, int64_t n) {
+  int64_t rem;
+  int64_t t = mul_div(n, 2 * k - 1, 2 * d, &rem);
+  return rem ? t + 1 : t;
+}
+
+static inline uint32_t *pixel_row(GraphicsContext *ctx, int32_t y) {
+  return (uint32_t *)ctx->framebuffer + (size_t)y * ctx->width;
+}
+
+// Fill pixels [x0, x1) of row y, clipped to the context clip rect.
+static void fill_span(GraphicsContext *ctx, int32_t y, int32_t x0, int32_t x1,
+                      uint32_t argb) {
+  if (y < ctx->clip.y || y >= ctx->clip.y + ctx->clip.height) {
+    return;
+  }
+  x0 = clamp_i32(x0, ctx->clip.x, ctx->clip.x + ctx->clip.width);
+  x1 = clamp_i32(x1, ctx->clip.x, ctx->clip.x + ctx->clip.width);
+  if (x1 <= x0) {
+    return;
+  }
+  span_fill(pixel_row(ctx, y) + x0, (uint32_t)(x1 - x0), argb);
+}
+
+static void fill_rect_spans(GraphicsContext *ctx, int32_t x, int32_t y,
+                            int32_t width, int32_t height, uint32_t argb) {
+  if (width <= 0 || height <= 0) {
+    return;
+  }
+  int32_t y0 = clamp_i32(y, ctx->clip.y, ctx->clip.y + ctx->clip.height);
+  int32_t y1 =
+      clamp_i32(y + height, ctx->clip.y, ctx->clip.y + ctx->clip.height);
+  for (int32_t row = y0; row < y1; row++) {
+    fill_span(ctx, row, x, x + width, argb);
+  }
+}
+
+// ============================================================================
+// Initialization
+// ============================================================================
+
+GraphicsContext *graphics_init(uint32_t width, uint32_t height) {
+  if (g_context) {
+    return g_context;
+  }
+
+  span_init();
+
+  GraphicsContext *ctx = (GraphicsContext *)calloc(1, sizeof(GraphicsContext));
+  if (!ctx) {
+    return NULL;
+  }
+  size_t bytes = (size_t)width * height * sizeof(uint32_t);
+  ctx->width = width;
+  ctx->height = height;
+  ctx->bits_per_pixel = DISPLAY_COLOR_DEPTH;
+  ctx->framebuffer = calloc(1, bytes);
+  ctx->arena = frame_arena_create(0);
+  g_display = (uint32_t *)calloc(1, bytes);
+  if (!ctx->framebuffer || !ctx->arena || !g_display) {
+    free(ctx->framebuffer);
+    frame_arena_destroy(ctx->arena);
+    free(g_display);
+    free(ctx);
+    g_display = NULL;
+    return NULL;
+  }
+
+  graphics_reset_clip(ctx);
+#if ENABLE_TILED_RENDERING
+  // Screen drawing is recorded and rasterized in parallel tiles when
+  // present flushes; without a renderer it simply stays immediate.
+  g_renderer = tile_renderer_create_in(ctx->arena);
+  if (g_renderer) {
+    tile_renderer_begin(g_renderer, ctx);
+  }
+#endif
+  g_context = ctx;
+  return ctx;
+}
+
+void graphics_shutdown(void) {
+  if (!g_context) {
+    return;
+  }
+  if (g_renderer) {
+    tile_renderer_end(g_renderer, g_context);
+    tile_renderer_destroy(g_renderer);
+    g_renderer = NULL;
+  }
+  free(g_context->framebuffer);
+  frame_arena_destroy(g_context->arena);
+  free(g_context);
+  free(g_display);
+  g_context = NULL;
+  g_display = NULL;
+}
+
+void graphics_set_clip(GraphicsContext *ctx, OSRect clip) {
+  OSRect surface = {0, 0, (int32_t)ctx->width, (int32_t)ctx->height};
+  ctx->clip = rect_intersection(clip, surface);
+}
+
+void graphics_reset_clip(GraphicsContext *ctx) {
+  OSRect surface = {0, 0, (int32_t)ctx->width, (int32_t)ctx->height};
+  ctx->clip = surface;
+}
+
+// ============================================================================
+// Drawing primitives
+// ============================================================================
+
+void draw_rect(GraphicsContext *ctx, OSRect rect, Color color) {
+  if (ctx->recorder) {
+    DrawCommand cmd = {.type = DRAW_CMD_RECT, .rect = rect, .color = color};
+    tile_renderer_record(ctx->recorder, ctx, &cmd);
+    return;
+  }
+  fill_rect_spans(ctx, rect.x, rect.y, rect.width, rect.height,
+                  color_pack(color));
+}
+
+void draw_rounded_rect(GraphicsContext *ctx, OSRect rect, int radius,
+                       Color color) {
+  if (ctx->recorder) {
+    DrawCommand cmd = {.type = DRAW_CMD_ROUNDED_RECT,
+                       .rect = rect,
+                       .color = color,
+                       .param = radius};
+    tile_renderer_record(ctx->recorder, ctx, &cmd);
+    return;
+  }
+  if (rect.width <= 0 || rect.height <= 0) {
+    return;
+  }
+  int32_t max_radius =
+      (rect.width < rect.height ? rect.width : rect.height) / 2;
+  int32_t r = clamp_i32(radius, 0, max_radius);
+  uint32_t argb = color_pack(color);
+
+  // Corner rows are inset by the horizontal distance to the corner circle,
+  // whose centers sit r pixels in from each edge.
+  for (int32_t i = 0; i < r; i++) {
+    int32_t inset = span_corner_inset(r, i);
+    fill_span(ctx, rect.y + i, rect.x + inset, rect.x + rect.width - inset,
+              argb);
+    fill_span(ctx, rect.y + rect.height - 1 - i, rect.x + inset,
+              rect.x + rect.width - inset, argb);
+  }
+  fill_rect_spans(ctx, rect.x, rect.y + r, rect.width, rect.height - 2 * r,
+                  argb);
+}
+
+void draw_rect_outline(GraphicsContext *ctx, OSRect rect, int thickness,
+                       Color color) {
+  if (ctx->recorder) {
+    DrawCommand cmd = {.type = DRAW_CMD_RECT_OUTLINE,
+                       .rect = rect,
+                       .color = color,
+                       .param = thickness};
+    tile_renderer_record(ctx->recorder, ctx, &cmd);
+    return;
+  }
+  if (rect.width <= 0 || rect.height <= 0 || thickness <= 0) {
+    return;
+  }
+  uint32_t argb = color_pack(color);
+  int32_t t = thickness;
+  if (2 * t >= rect.height || 2 * t >= rect.width) {
+    fill_rect_spans(ctx, rect.x, rect.y, rect.width, rect.height, argb);
+    return;
+  }
+  // Four non-overlapping bands so translucent outlines blend exactly once.
+  fill_rect_spans(ctx, rect.x, rect.y, rect.width, t, argb);
+  fill_rect_spans(ctx, rect.x, rect.y + rect.height - t, rect.width, t, argb);
+  fill_rect_spans(ctx, rect.x, rect.y + t, t, rect.height - 2 * t, argb);
+  fill_rect_spans(ctx, rect.x + rect.width - t, rect.y + t, t,
+                  rect.height - 2 * t, argb);
+}
+
+void draw_circle(GraphicsContext *ctx, int32_t x, int32_t y, uint32_t radius,
+                 Color color) {
+  if (ctx->recorder) {
+    DrawCommand cmd = {.type = DRAW_CMD_CIRCLE,
+                       .rect = {x, y, 0, 0},
+                       .color = color,
+                       .param = (int32_t)radius};
+    tile_renderer_record(ctx->recorder, ctx, &cmd);
+    return;
+  }
+  // Wide arithmetic throughout: r * r and x +- half overflow int32 for
+  // large radii.
+  int64_t r = radius;
+  uint32_t argb = color_pack(color);
+  int64_t clip_x0 = ctx->clip.x;
+  int64_t clip_x1 = (int64_t)ctx->clip.x + ctx->clip.width;
+  int64_t y0 = clamp_i64(y - r, ctx->clip.y,
+                         (int64_t)ctx->clip.y + ctx->clip.height);
+  int64_t y1 = clamp_i64(y + r + 1, ctx->clip.y,
+                         (int64_t)ctx->clip.y + ctx->clip.height);
+  for (int64_t row = y0; row < y1; row++) {
+    uint64_t dy = (uint64_t)(row < y ? y - row : row - y);
+    int64_t half = span_isqrt((uint64_t)r * (uint64_t)r - dy * dy);
+    fill_span(ctx, (int32_t)row, (int32_t)clamp_i64(x - half, clip_x0, clip_x1),
+              (int32_t)clamp_i64(x + half + 1, clip_x0, clip_x1), argb);
+  }
+}
+
+void draw_line(GraphicsContext *ctx, int32_t x1, int32_t y1, int32_t x2,
+               int32_t y2, Color color) {
+  if (ctx->recorder) {
+    DrawCommand cmd = {.type = DRAW_CMD_LINE,
+                       .rect = {x1, y1, x2, y2},
+                       .color = color};
+    tile_renderer_record(ctx->recorder, ctx, &cmd);
+    return;
+  }
+  // Step t of n along the major axis lands on minor offset
+  // round(t * d / n), halves up. That depends on t alone, so walking only
+  // the steps inside the clip draws exactly the whole line's pixels there,
+  // and the work is bounded by the clip rather than by the line's length.
+  int64_t dx = (int64_t)x2 - x1;
+  int64_t dy = (int64_t)y2 - y1;
+  bool steep = (dy < 0 ? -dy : dy) > (dx < 0 ? -dx : dx);
+  int64_t major = steep ? y1 : x1, minor = steep ? x1 : y1;
+  int64_t dmajor = steep ? dy : dx, dminor = steep ? dx : dy;
+  int64_t smajor = dmajor < 0 ? -1 : 1, sminor = dminor < 0 ? -1 : 1;
+  int64_t n = dmajor * smajor, d = dminor * sminor;
+  int64_t major_lo = steep ? ctx->clip.y : ctx->clip.x;
+  int64_t major_hi = major_lo + (steep ? ctx->clip.height : ctx->clip.width);
+  int64_t minor_lo = steep ? ctx->clip.x : ctx->clip.y;
+  int64_t minor_hi = minor_lo + (steep ? ctx->clip.width : ctx->clip.height);
+
+  // Steps whose major coordinate is inside the clip...
+  int64_t t0 = smajor > 0 ? major_lo - major : major - (major_hi - 1);
+  int64_t t1 = smajor > 0 ? major_hi - 1 - major : major - major_lo;
+  // ...narrowed to those whose minor offset k is too.
+  int64_t k0 = sminor > 0 ? minor_lo - minor : minor - (minor_hi - 1);
+  int64_t k1 = sminor > 0 ? minor_hi - 1 - minor : minor - minor_lo;
+  t0 = t0 < 0 ? 0 : t0;
+  t1 = t1 > n ? n : t1;
+  if (t0 > t1 || k1 < 0 || k0 > d) {
+    return;
+  }
+  if (k0 > 0) {
+    int64_t t = line_first_step(k0, d, n);
+    t0 = t > t0 ? t : t0;
+  }
+  if (k1 < d) {
+    int64_t t = line_first_step(k1 + 1, d, n) - 1;
+    t1 = t < t1 ? t : t1;
+  }
+
+  uint32_t argb = color_pack(color);
+  int64_t rem = 0;
+  int64_t k = d ? line_offset(t0, d, n, &rem) : 0; // d == 0 covers n == 0
+  int64_t run = t0; // first step of the current row's run (shallow lines)
+  for (int64_t t = t0; t <= t1; t++) {
+    int64_t next = k;
+    rem += 2 * d;
+    if (d && rem >= 2 * n) {
+      rem -= 2 * n;
+      next++;
+    }
+    int32_t m = (int32_t)(minor + sminor * k);
+    if (steep) {
+      int32_t row = (int32_t)(major + smajor * t);
+      fill_span(ctx, row, m, m + 1, argb);
+    } else if (next != k || t == t1) {
+      // A shallow line's steps on one row form a single span.
+      int64_t a = major + smajor * run, b = major + smajor * t;
+      fill_span(ctx, m, (int32_t)(a < b ? a : b), (int32_t)(a < b ? b : a) + 1,
+                argb);
+      run = t + 1;
+    }
+    k = next;
+  }
+}
+
+// ============================================================================
+// Texture operations
+// ============================================================================
+
+Texture *texture_create(uint32_t width, uint32_t height) {
+  pthread_once(&g_texture_pool_once, create_texture_pool);
+  Texture *texture = (Texture *)pool_allocate(g_texture_pool);
+  if (!texture) {
+    return NULL;
+  }
+  texture->data = calloc((size_t)width * height, sizeof(uint32_t));
+  if (!texture->data) {
+    pool_free(g_texture_pool, texture);
+    return NULL;
+  }
+  texture->texture_id =
+      atomic_fetch_add_explicit(&g_next_texture_id, 1, memory_order_relaxed);
+  texture->width = width;
+  texture->height = height;
+  return texture;
+}
+
+void texture_destroy(Texture *texture) {
+  if (!texture) {
+    return;
+  }
+  free(texture->data);
+  pool_free(g_texture_pool, texture);
+}
+
+void draw_texture(GraphicsContext *ctx, Texture *texture, int32_t x,
+                  int32_t y) {
+  if (!texture) {
+    return;
+  }
+  OSRect src = {0, 0, (int32_t)texture->width, (int32_t)texture->height};
+  draw_texture_region(ctx, texture, src, x, y);
+}
+
+void draw_texture_region(GraphicsContext *ctx, Texture *texture, OSRect src,
+                         int32_t x, int32_t y) {
+  if (ctx->recorder) {
+    DrawCommand cmd = {.type = DRAW_CMD_TEXTURE,
+                       .rect = {x, y, 0, 0},
+                       .src = src,
+                       .texture = texture};
+    tile_renderer_record(ctx->recorder, ctx, &cmd);
+    return;
+  }
+  if (!texture || !texture->data) {
+    return;
+  }
+  OSRect bounds = {0, 0, (int32_t)texture->width, (int32_t)texture->height};
+  OSRect clamped = rect_intersection(src, bounds);
+  x += clamped.x - src.x;
+  y += clamped.y - src.y;
+  src = clamped;
+  OSRect area = {x, y, src.width, src.height};
+  area = rect_intersection(area, ctx->clip);
+  int32_t x0 = area.x;
+  int32_t x1 = area.x + area.width;
+  int32_t y0 = area.y;
+  int32_t y1 = area.y + area.height;
+  const uint32_t *pixels = (const uint32_t *)texture->data;
+  for (int32_t row = y0; row < y1; row++) {
+    const uint32_t *s = pixels + (size_t)(src.y + row - y) * texture->width +
+                        (src.x + x0 - x);
+    uint32_t *dst = pixel_row(ctx, row) + x0;
+    // Opaque rows, e.g. a cached layer, are a straight copy
+    uint32_t opaque = 0xff000000u;
+    for (int32_t i = 0; i < x1 - x0; i++) {
+      opaque &= s[i];
+    }
+    if (opaque == 0xff000000u) {
+      memcpy(dst, s, (size_t)(x1 - x0) * sizeof(uint32_t));
+      continue;
+    }
+    for (int32_t i = 0; i < x1 - x0; i++) {
+      uint32_t alpha = s[i] >> 24;
+      if (alpha == 255) {
+        dst[i] = s[i];
+      } else if (alpha != 0) {
+        dst[i] = span_blend_pixel(dst[i], s[i]);
+      }
+    }
+  }
+}
+
+// ============================================================================
+// Effects and filters
+// ============================================================================
+
+// Clip bounds to the context clip rect; returns false when nothing is left.
+static bool clip_to_context(GraphicsContext *ctx, OSRect *r) {
+  *r = rect_intersection(*r, ctx->clip);
+  return !rect_is_empty(*r);
+}
+
+void apply_blur(GraphicsContext *ctx, OSRect bounds, float radius) {
+  if (ctx->recorder) {
+    DrawCommand cmd = {.type = DRAW_CMD_BLUR, .rect = bounds, .radius = radius};
+    tile_renderer_record(ctx->recorder, ctx, &cmd);
+    return;
+  }
+#if ENABLE_BLUR_EFFECTS
+  PROFILE_STAGE(PROFILE_EFFECTS);
+  OSRect surface = {0, 0, (int32_t)ctx->width, (int32_t)ctx->height};
+  bounds = rect_intersection(bounds, surface);
+  OSRect visible = rect_intersection(bounds, ctx->clip);
+  if (radius < 1.0f || rect_is_empty(visible)) {
+    return;
+  }
+  size_t stride = ctx->width * sizeof(uint32_t);
+  if (visible.width == bounds.width && visible.height == bounds.height) {
+    uint8_t *origin = (uint8_t *)(pixel_row(ctx, bounds.y) + bounds.x);
+    blur_image_u8(origin, (uint32_t)bounds.width, (uint32_t)bounds.height,
+                  (uint32_t)stride, 4, radius);
+    return;
+  }
+
+  // Partial redraw: blur the clipped part plus an apron as wide as the
+  // kernel's reach (read, never written) so the visible pixels come out the
+  // same as they would from blurring the whole bounds.
+  int32_t reach = (int32_t)blur_reach(radius);
+  OSRect work = rect_intersection(
+      (OSRect){visible.x - reach, visible.y - reach,
+               visible.width + 2 * reach, visible.height + 2 * reach},
+      bounds);
+  size_t work_stride = (size_t)work.width * sizeof(uint32_t);
+  uint8_t *tmp = (uint8_t *)scratch_alloc(ctx, work_stride * work.height);
+  if (!tmp) {
+    return;
+  }
+  for (int32_t y = 0; y < work.height; y++) {
+    memcpy(tmp + y * work_stride, pixel_row(ctx, work.y + y) + work.x,
+           work_stride);
+  }
+  blur_image_u8(tmp, (uint32_t)work.width, (uint32_t)work.height,
+                (uint32_t)work_stride, 4, radius);
+  for (int32_t y = 0; y < visible.height; y++) {
+    const uint8_t *src = tmp + (size_t)(visible.y - work.y + y) * work_stride +
+                         (size_t)(visible.x - work.x) * sizeof(uint32_t);
+    memcpy(pixel_row(ctx, visible.y + y) + visible.x, src,
+           (size_t)visible.width * sizeof(uint32_t));
+  }
+  scratch_free(ctx, tmp);
+#else
+  (void)ctx;
+  (void)bounds;
+  (void)radius;
+#endif
+}
+
+void apply_shadow(GraphicsContext *ctx, OSRect bounds, Color shadow_color,
+                  float blur_radius) {
+  apply_rounded_shadow(ctx, bounds, 0, shadow_color, blur_radius);
+}
+
+void apply_rounded_shadow(GraphicsContext *ctx, OSRect bounds,
+                          int corner_radius, Color shadow_color,
+                          float blur_radius) {
+  if (ctx->recorder) {
+    DrawCommand cmd = {.type = DRAW_CMD_SHADOW,
+                       .rect = bounds,
+                       .color = shadow_color,
+                       .param = corner_radius,
+                       .radius = blur_radius};
+    tile_renderer_record(ctx->recorder, ctx, &cmd);
+    return;
+  }
+#if ENABLE_SHADOW_EFFECTS
+  PROFILE_STAGE(PROFILE_EFFECTS);
+  if (bounds.width <= 0 || bounds.height <= 0 || shadow_color.alpha == 0) {
+    return;
+  }
+  const ShadowMask *mask =
+      shadow_mask_acquire((uint32_t)bounds.width, (uint32_t)bounds.height,
+                          blur_radius, corner_radius);
+  if (!mask) {
+    return;
+  }
+  OSRect area = {bounds.x - mask->pad, bounds.y - mask->pad,
+                 (int32_t)mask->width, (int32_t)mask->height};
+  if (clip_to_context(ctx, &area)) {
+    int32_t mx = area.x - (bounds.x - mask->pad);
+    int32_t my = area.y - (bounds.y - mask->pad);
+    uint32_t rgb = color_pack(shadow_color) & 0x00FFFFFF;
+    for (int32_t y = 0; y < area.height; y++) {
+      const uint8_t *cov =
+          mask->coverage + (size_t)(my + y) * mask->width + mx;
+      uint32_t *dst = pixel_row(ctx, area.y + y) + area.x;
+      for (int32_t x = 0; x < area.width; x++) {
+        if (cov[x] == 0) {
+          continue;
+        }
+        uint32_t alpha = span_div255((uint32_t)shadow_color.alpha * cov[x]);
+        dst[x] = span_blend_pixel(dst[x], (alpha << 24) | rgb);
+      }
+    }
+  }
+  shadow_mask_release(mask);
+#else
+  (void)ctx;
+  (void)bounds;
+  (void)corner_radius;
+  (void)shadow_color;
+  (void)blur_radius;
+#endif
+}
+
+static inline uint8_t lerp_u8(uint8_t a, uint8_t b, int32_t num, int32_t den) {
+  return (uint8_t)((int32_t)a + ((int32_t)b - (int32_t)a) * num / den);
+}
+
+static inline uint32_t lerp_color(Color a, Color b, int32_t num, int32_t den) {
+  Color c = {lerp_u8(a.alpha, b.alpha, num, den),
+             lerp_u8(a.red, b.red, num, den),
+             lerp_u8(a.green, b.green, num, den),
+             lerp_u8(a.blue, b.blue, num, den)};
+  return color_pack(c);
+}
+
+void apply_gradient(GraphicsContext *ctx, OSRect bounds, Color start_color,
+                    Color end_color, bool horizontal) {
+  if (ctx->recorder) {
+    DrawCommand cmd = {.type = DRAW_CMD_GRADIENT,
+                       .rect = bounds,
+                       .color = start_color,
+                       .color2 = end_color,
+                       .horizontal = horizontal};
+    tile_renderer_record(ctx->recorder, ctx, &cmd);
+    return;
+  }
+  OSRect area = bounds;
+  if (!clip_to_context(ctx, &area)) {
+    return;
+  }
+  int32_t steps = (horizontal ? bounds.width : bounds.height) - 1;
+  if (steps <= 0) {
+    steps = 1;
+  }
+
+  if (!horizontal) {
+    // One color per row: a single span fill each.
+    for (int32_t y = area.y; y < area.y + area.height; y++) {
+      uint32_t argb = lerp_color(start_color, end_color, y - bounds.y, steps);
+      fill_span(ctx, y, area.x, area.x + area.width, argb);
+    }
+    return;
+  }
+
+  uint32_t *line =
+      (uint32_t *)scratch_alloc(ctx, (size_t)area.width * sizeof(uint32_t));
+  if (!line) {
+    return;
+  }
+  for (int32_t i = 0; i < area.width; i++) {
+    line[i] = lerp_color(start_color, end_color, area.x + i - bounds.x, steps);
+  }
+  bool opaque = start_color.alpha == 255 && end_color.alpha == 255;
+  for (int32_t y = area.y; y < area.y + area.height; y++) {
+    uint32_t *dst = pixel_row(ctx, y) + area.x;
+    if (opaque) {
+      memcpy(dst, line, (size_t)area.width * sizeof(uint32_t));
+      continue;
+    }
+    for (int32_t i = 0; i < area.width; i++) {
+      dst[i] = span_blend_pixel(dst[i], line[i]);
+    }
+  }
+  scratch_free(ctx, line);
+}
+
+// ============================================================================
+// Display update
+// ============================================================================
+
+void graphics_present(GraphicsContext *ctx) {
+  if (!ctx || ctx != g_context || !g_display) {
+    return;
+  }
+  {
+    PROFILE_STAGE(PROFILE_RASTER); // commands the tiles deferred
+    tile_renderer_flush(ctx->recorder, ctx);
+  }
+  PROFILE_STAGE(PROFILE_PRESENT);
+  memcpy(g_display, ctx->framebuffer,
+         (size_t)ctx->width * ctx->height * sizeof(uint32_t));
+  PROFILE_PRESENTED();
+  frame_arena_end_frame(ctx->arena);
+}
+
+void graphics_present_rects(GraphicsContext *ctx, const OSRect *rects,
+                            uint32_t count) {
+  if (!ctx || ctx != g_context || !g_display) {
+    return;
+  }
+  {
+    PROFILE_STAGE(PROFILE_RASTER);
+    tile_renderer_flush(ctx->recorder, ctx);
+  }
+  PROFILE_STAGE(PROFILE_PRESENT);
+  OSRect surface = {0, 0, (int32_t)ctx->width, (int32_t)ctx->height};
+  for (uint32_t i = 0; i < count; i++) {
+    OSRect r = rect_intersection(rects[i], surface);
+    for (int32_t y = r.y; y < r.y + r.height; y++) {
+      size_t offset = (size_t)y * ctx->width + r.x;
+      memcpy(g_display + offset, pixel_row(ctx, y) + r.x,
+             (size_t)r.width * sizeof(uint32_t));
+    }
+  }
+  PROFILE_PRESENTED();
+  frame_arena_end_frame(ctx->arena);
+}
@@ -0,0 +1,154 @@
+// Regions - merged rectangle lists for damage tracking
+
+#include "region.h"
+#include <stdlib.h>
+
+static bool region_reserve(OSRegion *region, uint32_t capacity) {
+  if (capacity <= region->capacity) {
+    return true;
+  }
+  uint32_t new_capacity = region->capacity ? region->capacity * 2 : 8;
+  while (new_capacity < capacity) {
+    new_capacity *= 2;
+  }
+  OSRect *rects =
+      (OSRect *)realloc(region->rects, new_capacity * sizeof(OSRect));
+  if (!rects) {
+    return false;
+  }
+  region->rects = rects;
+  region->capacity = new_capacity;
+  return true;
+}
+
+static void region_append(OSRegion *region, OSRect rect) {
+  if (!rect_is_empty(rect) && region_reserve(region, region->count + 1)) {
+    region->rects[region->count++] = rect;
+  }
+}
+
+static void region_remove_at(OSRegion *region, uint32_t index) {
+  region->rects[index] = region->rects[--region->count];
+}
+
+// Touching rects merge too: the union of two abutting rects wastes nothing.
+static bool rects_touch(OSRect a, OSRect b) {
+  return a.x <= b.x + b.width && b.x <= a.x + a.width &&
+         a.y <= b.y + b.height && b.y <= a.y + a.height &&
+         rect_area(rect_union(a, b)) == rect_area(a) + rect_area(b) -
+                                            rect_area(rect_intersection(a, b));
+}
+
+void region_init(OSRegion *region) {
+  region->rects = NULL;
+  region->count = 0;
+  region->capacity = 0;
+}
+
+void region_destroy(OSRegion *region) {
+  free(region->rects);
+  region_init(region);
+}
+
+void region_clear(OSRegion *region) { region->count = 0; }
+
+bool region_is_empty(const OSRegion *region) { return region->count == 0; }
+
+OSRect region_bounds(const OSRegion *region) {
+  OSRect bounds = {0, 0, 0, 0};
+  for (uint32_t i = 0; i < region->count; i++) {
+    bounds = rect_union(bounds, region->rects[i]);
+  }
+  return bounds;
+}
+
+int64_t region_area(const OSRegion *region) {
+  int64_t area = 0;
+  for (uint32_t i = 0; i < region->count; i++) {
+    area += rect_area(region->rects[i]);
+  }
+  return area;
+}
+
+void region_add_rect(OSRegion *region, OSRect rect) {
+  if (rect_is_empty(rect)) {
+    return;
+  }
+
+  // Absorb every rect the new one overlaps; a grown rect can reach new
+  // neighbours, so rescan until nothing merges.
+  bool merged = true;
+  while (merged) {
+    merged = false;
+    for (uint32_t i = 0; i < region->count; i++) {
+      OSRect other = region->rects[i];
+      if (rect_intersects(rect, other) || rects_touch(rect, other)) {
+        rect = rect_union(rect, other);
+        region_remove_at(region, i);
+        merged = true;
+        break;
+      }
+    }
+  }
+
+  if (region->count < REGION_MAX_RECTS) {
+    if (region_reserve(region, region->count + 1)) {
+      region->rects[region->count++] = rect;
+    }
+    return;
+  }
+
+  // Full: fold the new rect into whichever existing rect grows the least,
+  // then re-add so the union is merged with anything it now overlaps.
+  uint32_t best = 0;
+  int64_t best_waste = INT64_MAX;
+  for (uint32_t i = 0; i < region->count; i++) {
+    OSRect u = rect_union(rect, region->rects[i]);
+    int64_t waste = rect_area(u) - rect_area(rect) - rect_area(region->rects[i]);
+    if (waste < best_waste) {
+      best_waste = waste;
+      best = i;
+    }
+  }
+  OSRect u = rect_union(rect, region->rects[best]);
+  region_remove_at(region, best);
+  region_add_rect(region, u);
+}
+
+void region_set_rect(OSRegion *region, OSRect rect) {
+  region->count = 0;
+  region_append(region, rect);
+}
+
+void region_intersect_rect(OSRegion *dst, const OSRegion *src, OSRect rect) {
+  dst->count = 0;
+  for (uint32_t i = 0; i < src->count; i++) {
+    region_append(dst, rect_intersection(src->rects[i], rect));
+  }
+}
+
+void region_subtract_rect(OSRegion *region, OSRect rect) {
+  uint32_t count = region->count;
+  uint32_t i = 0;
+  while (i < count) {
+    OSRect r = region->rects[i];
+    OSRect hole = rect_intersection(r, rect);
+    if (rect_is_empty(hole)) {
+      i++;
+      continue;
+    }
+    // Replace r by the bands above and below the hole and the pieces to
+    // its left and right. New pieces go to the tail and are not revisited.
+    // [0, count) holds unvisited originals and the tail holds pieces:
+    // fill slot i from the last original, then that slot from the tail.
+    region->rects[i] = region->rects[--count];
+    region->rects[count] = region->rects[--region->count];
+    region_append(region, (OSRect){r.x, r.y, r.width, hole.y - r.y});
+    region_append(region, (OSRect){r.x, hole.y + hole.height, r.width,
+                                   r.y + r.height - hole.y - hole.height});
+    region_append(region, (OSRect){r.x, hole.y, hole.x - r.x, hole.height});
+    region_append(region, (OSRect){hole.x + hole.width, hole.y,
+                                   r.x + r.width - hole.x - hole.width,
+                                   hole.height});
+  }
+}
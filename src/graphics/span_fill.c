@@ -0,0 +1,251 @@
+// Span fill engine - scalar, SSE2 and AVX2 backends
+
+#include "span_fill.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SPAN_HAVE_X86 1
+#include <immintrin.h>
+#else
+#define SPAN_HAVE_X86 0
+#endif
+
+typedef struct {
+  SpanBackend backend;
+  void (*fill)(uint32_t *dst, uint32_t count, uint32_t argb);
+  void (*blend)(uint32_t *dst, uint32_t count, uint32_t argb);
+} SpanOps;
+
+// ============================================================================
+// Scalar backend
+// ============================================================================
+
+static void fill_scalar(uint32_t *dst, uint32_t count, uint32_t argb) {
+  for (uint32_t i = 0; i < count; i++) {
+    dst[i] = argb;
+  }
+}
+
+static void blend_scalar(uint32_t *dst, uint32_t count, uint32_t argb) {
+  for (uint32_t i = 0; i < count; i++) {
+    dst[i] = span_blend_pixel(dst[i], argb);
+  }
+}
+
+#if SPAN_HAVE_X86
+
+// ============================================================================
+// SSE2 backend (4 pixels per iteration)
+// ============================================================================
+
+// The source term (src * a, with the alpha lane forced to 255 * a) and the
+// inverse alpha are constant across a span, so they are splatted once and
+// each iteration costs two multiplies, two adds and the div255 shifts.
+__attribute__((target("sse2"))) static inline __m128i
+blend4_sse2(__m128i dst, __m128i src_term, __m128i inv_alpha) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i bias = _mm_set1_epi16(128);
+  __m128i lo = _mm_unpacklo_epi8(dst, zero);
+  __m128i hi = _mm_unpackhi_epi8(dst, zero);
+  lo = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(lo, inv_alpha), src_term),
+                     bias);
+  hi = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(hi, inv_alpha), src_term),
+                     bias);
+  lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+  hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+  return _mm_packus_epi16(lo, hi);
+}
+
+__attribute__((target("sse2"))) static void
+fill_sse2(uint32_t *dst, uint32_t count, uint32_t argb) {
+  uint32_t i = 0;
+  // Align the destination so the main loop uses aligned stores.
+  while (i < count && ((uintptr_t)(dst + i) & 15) != 0) {
+    dst[i++] = argb;
+  }
+  const __m128i v = _mm_set1_epi32((int)argb);
+  for (; i + 16 <= count; i += 16) {
+    _mm_store_si128((__m128i *)(dst + i), v);
+    _mm_store_si128((__m128i *)(dst + i + 4), v);
+    _mm_store_si128((__m128i *)(dst + i + 8), v);
+    _mm_store_si128((__m128i *)(dst + i + 12), v);
+  }
+  for (; i + 4 <= count; i += 4) {
+    _mm_store_si128((__m128i *)(dst + i), v);
+  }
+  for (; i < count; i++) {
+    dst[i] = argb;
+  }
+}
+
+__attribute__((target("sse2"))) static void
+blend_sse2(uint32_t *dst, uint32_t count, uint32_t argb) {
+  uint32_t a = argb >> 24;
+  uint32_t ia = 255 - a;
+  short sb = (short)((argb & 0xFF) * a);
+  short sg = (short)(((argb >> 8) & 0xFF) * a);
+  short sr = (short)(((argb >> 16) & 0xFF) * a);
+  short sa = (short)(255 * a);
+  // Little-endian lane order within a pixel is B, G, R, A.
+  const __m128i src_term = _mm_set_epi16(sa, sr, sg, sb, sa, sr, sg, sb);
+  const __m128i inv_alpha = _mm_set1_epi16((short)ia);
+
+  uint32_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+    _mm_storeu_si128((__m128i *)(dst + i), blend4_sse2(d, src_term, inv_alpha));
+  }
+  for (; i < count; i++) {
+    dst[i] = span_blend_pixel(dst[i], argb);
+  }
+}
+
+// ============================================================================
+// AVX2 backend (8 pixels per iteration)
+// ============================================================================
+
+__attribute__((target("avx2"))) static void
+fill_avx2(uint32_t *dst, uint32_t count, uint32_t argb) {
+  uint32_t i = 0;
+  while (i < count && ((uintptr_t)(dst + i) & 31) != 0) {
+    dst[i++] = argb;
+  }
+  const __m256i v = _mm256_set1_epi32((int)argb);
+  for (; i + 32 <= count; i += 32) {
+    _mm256_store_si256((__m256i *)(dst + i), v);
+    _mm256_store_si256((__m256i *)(dst + i + 8), v);
+    _mm256_store_si256((__m256i *)(dst + i + 16), v);
+    _mm256_store_si256((__m256i *)(dst + i + 24), v);
+  }
+  for (; i + 8 <= count; i += 8) {
+    _mm256_store_si256((__m256i *)(dst + i), v);
+  }
+  for (; i < count; i++) {
+    dst[i] = argb;
+  }
+}
+
+__attribute__((target("avx2"))) static void
+blend_avx2(uint32_t *dst, uint32_t count, uint32_t argb) {
+  uint32_t a = argb >> 24;
+  uint32_t ia = 255 - a;
+  short sb = (short)((argb & 0xFF) * a);
+  short sg = (short)(((argb >> 8) & 0xFF) * a);
+  short sr = (short)(((argb >> 16) & 0xFF) * a);
+  short sa = (short)(255 * a);
+  const __m256i src_term = _mm256_set_epi16(sa, sr, sg, sb, sa, sr, sg, sb,
+                                            sa, sr, sg, sb, sa, sr, sg, sb);
+  const __m256i inv_alpha = _mm256_set1_epi16((short)ia);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i bias = _mm256_set1_epi16(128);
+
+  uint32_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+    // unpack/pack operate per 128-bit lane, so pixel order is preserved.
+    __m256i lo = _mm256_unpacklo_epi8(d, zero);
+    __m256i hi = _mm256_unpackhi_epi8(d, zero);
+    lo = _mm256_add_epi16(
+        _mm256_add_epi16(_mm256_mullo_epi16(lo, inv_alpha), src_term), bias);
+    hi = _mm256_add_epi16(
+        _mm256_add_epi16(_mm256_mullo_epi16(hi, inv_alpha), src_term), bias);
+    lo = _mm256_srli_epi16(_mm256_add_epi16(lo, _mm256_srli_epi16(lo, 8)), 8);
+    hi = _mm256_srli_epi16(_mm256_add_epi16(hi, _mm256_srli_epi16(hi, 8)), 8);
+    _mm256_storeu_si256((__m256i *)(dst + i), _mm256_packus_epi16(lo, hi));
+  }
+  if (i + 4 <= count) {
+    __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+    _mm_storeu_si128((__m128i *)(dst + i),
+                     blend4_sse2(d, _mm256_castsi256_si128(src_term),
+                                 _mm256_castsi256_si128(inv_alpha)));
+    i += 4;
+  }
+  for (; i < count; i++) {
+    dst[i] = span_blend_pixel(dst[i], argb);
+  }
+}
+
+#endif // SPAN_HAVE_X86
+
+// ============================================================================
+// Dispatch
+// ============================================================================
+
+static const SpanOps span_scalar_ops = {SPAN_BACKEND_SCALAR, fill_scalar,
+                                        blend_scalar};
+#if SPAN_HAVE_X86
+static const SpanOps span_sse2_ops = {SPAN_BACKEND_SSE2, fill_sse2, blend_sse2};
+static const SpanOps span_avx2_ops = {SPAN_BACKEND_AVX2, fill_avx2, blend_avx2};
+#endif
+
+static const SpanOps *span_ops = &span_scalar_ops;
+
+static int span_backend_supported(SpanBackend backend) {
+#if SPAN_HAVE_X86
+  __builtin_cpu_init();
+  switch (backend) {
+  case SPAN_BACKEND_AVX2:
+    return __builtin_cpu_supports("avx2");
+  case SPAN_BACKEND_SSE2:
+    return __builtin_cpu_supports("sse2");
+  default:
+    return 1;
+  }
+#else
+  return backend == SPAN_BACKEND_SCALAR;
+#endif
+}
+
+SpanBackend span_set_backend(SpanBackend backend) {
+  if (!span_backend_supported(backend)) {
+    backend = SPAN_BACKEND_SCALAR;
+  }
+  switch (backend) {
+#if SPAN_HAVE_X86
+  case SPAN_BACKEND_AVX2:
+    span_ops = &span_avx2_ops;
+    break;
+  case SPAN_BACKEND_SSE2:
+    span_ops = &span_sse2_ops;
+    break;
+#endif
+  default:
+    span_ops = &span_scalar_ops;
+    break;
+  }
+  return span_ops->backend;
+}
+
+void span_init(void) {
+  if (span_backend_supported(SPAN_BACKEND_AVX2)) {
+    span_set_backend(SPAN_BACKEND_AVX2);
+  } else if (span_backend_supported(SPAN_BACKEND_SSE2)) {
+    span_set_backend(SPAN_BACKEND_SSE2);
+  } else {
+    span_set_backend(SPAN_BACKEND_SCALAR);
+  }
+}
+
+SpanBackend span_get_backend(void) { return span_ops->backend; }
+
+const char *span_backend_name(SpanBackend backend) {
+  switch (backend) {
+  case SPAN_BACKEND_AVX2:
+    return "avx2";
+  case SPAN_BACKEND_SSE2:
+    return "sse2";
+  default:
+    return "scalar";
+  }
+}
+
+void span_fill(uint32_t *dst, uint32_t count, uint32_t argb) {
+  uint32_t alpha = argb >> 24;
+  if (count == 0 || alpha == 0) {
+    return;
+  }
+  if (alpha == 255) {
+    span_ops->fill(dst, count, argb);
+  } else {
+    span_ops->blend(dst, count, argb);
+  }
+}
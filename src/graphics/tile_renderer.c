@@ -0,0 +1,370 @@
+// Tile renderer - command recording, binning and parallel tile replay
+
+#include "tile_renderer.h"
+#include "frame_arena.h"
+#include "region.h"
+#include "thread_pool.h"
+#include <stdlib.h>
+
+typedef struct {
+  uint32_t *commands; // indices into TileRenderer::commands, in order
+  uint32_t count;
+  uint32_t capacity; // 0 when commands points into the arena
+} TileBin;
+
+struct TileRenderer {
+  DrawCommand *commands;
+  uint32_t count;
+  uint32_t capacity;
+  FrameArena *arena;    // NULL: commands is a heap buffer kept across frames
+  uint64_t arena_frame; // frame the commands buffer was taken in
+  ThreadPool *pool;     // NULL: thread_pool_shared()
+
+  TileBin *bins;
+  uint32_t tiles_x;
+  uint32_t tiles_y;
+
+  // Current flush
+  GraphicsContext *target;
+};
+
+static bool bin_push(TileBin *bin, uint32_t index) {
+  if (bin->count == bin->capacity) {
+    uint32_t capacity = bin->capacity ? bin->capacity * 2 : 16;
+    uint32_t *commands =
+        (uint32_t *)realloc(bin->commands, capacity * sizeof(uint32_t));
+    if (!commands) {
+      return false;
+    }
+    bin->commands = commands;
+    bin->capacity = capacity;
+  }
+  bin->commands[bin->count++] = index;
+  return true;
+}
+
+static bool ensure_bins(TileRenderer *renderer, const GraphicsContext *ctx) {
+  uint32_t tiles_x = (ctx->width + TILE_SIZE - 1) / TILE_SIZE;
+  uint32_t tiles_y = (ctx->height + TILE_SIZE - 1) / TILE_SIZE;
+  if (renderer->bins && tiles_x == renderer->tiles_x &&
+      tiles_y == renderer->tiles_y) {
+    return true;
+  }
+  for (uint32_t i = 0; i < renderer->tiles_x * renderer->tiles_y; i++) {
+    if (renderer->bins[i].capacity) {
+      free(renderer->bins[i].commands);
+    }
+  }
+  free(renderer->bins);
+  renderer->bins = (TileBin *)calloc((size_t)tiles_x * tiles_y, sizeof(TileBin));
+  renderer->tiles_x = renderer->bins ? tiles_x : 0;
+  renderer->tiles_y = renderer->bins ? tiles_y : 0;
+  return renderer->bins != NULL;
+}
+
+// ============================================================================
+// Lifecycle
+// ============================================================================
+
+TileRenderer *tile_renderer_create(void) {
+  return (TileRenderer *)calloc(1, sizeof(TileRenderer));
+}
+
+TileRenderer *tile_renderer_create_in(FrameArena *arena) {
+  TileRenderer *renderer = tile_renderer_create();
+  if (renderer) {
+    renderer->arena = arena;
+  }
+  return renderer;
+}
+
+void tile_renderer_destroy(TileRenderer *renderer) {
+  if (!renderer) {
+    return;
+  }
+  for (uint32_t i = 0; i < renderer->tiles_x * renderer->tiles_y; i++) {
+    if (renderer->bins[i].capacity) {
+      free(renderer->bins[i].commands);
+    }
+  }
+  free(renderer->bins);
+  if (!renderer->arena) {
+    free(renderer->commands);
+  }
+  free(renderer);
+}
+
+void tile_renderer_set_pool(TileRenderer *renderer, ThreadPool *pool) {
+  renderer->pool = pool;
+}
+
+void tile_renderer_begin(TileRenderer *renderer, GraphicsContext *ctx) {
+  ctx->recorder = renderer;
+}
+
+void tile_renderer_end(TileRenderer *renderer, GraphicsContext *ctx) {
+  tile_renderer_flush(renderer, ctx);
+  ctx->recorder = NULL;
+}
+
+// ============================================================================
+// Recording
+// ============================================================================
+
+// Bounds [x0, x1) x [y0, y1) in 64 bits, saturated so the rect's far edge
+// still fits in int32 for the clip intersection.
+static OSRect saturated_extent(int64_t x0, int64_t y0, int64_t x1,
+                               int64_t y1) {
+  const int64_t limit = INT32_MAX / 2;
+  x0 = x0 < -limit ? -limit : x0;
+  y0 = y0 < -limit ? -limit : y0;
+  x1 = x1 > limit ? limit : x1;
+  y1 = y1 > limit ? limit : y1;
+  return (OSRect){(int32_t)x0, (int32_t)y0, (int32_t)(x1 - x0),
+                  (int32_t)(y1 - y0)};
+}
+
+static OSRect circle_extent(int32_t x, int32_t y, uint32_t radius) {
+  return saturated_extent((int64_t)x - radius, (int64_t)y - radius,
+                          (int64_t)x + radius + 1, (int64_t)y + radius + 1);
+}
+
+static OSRect command_extent(const DrawCommand *cmd) {
+  OSRect r = cmd->rect;
+  switch (cmd->type) {
+  case DRAW_CMD_CIRCLE:
+    return circle_extent(r.x, r.y, (uint32_t)cmd->param);
+  case DRAW_CMD_LINE: {
+    int64_t x0 = r.x < r.width ? r.x : r.width;
+    int64_t x1 = r.x < r.width ? r.width : r.x;
+    int64_t y0 = r.y < r.height ? r.y : r.height;
+    int64_t y1 = r.y < r.height ? r.height : r.y;
+    return saturated_extent(x0, y0, x1 + 1, y1 + 1);
+  }
+  case DRAW_CMD_TEXTURE:
+    return cmd->texture ? (OSRect){r.x, r.y, cmd->src.width, cmd->src.height}
+                        : (OSRect){0, 0, 0, 0};
+  case DRAW_CMD_SHADOW: {
+    int32_t pad = (int32_t)(cmd->radius + 0.5f);
+    return (OSRect){r.x - pad, r.y - pad, r.width + 2 * pad,
+                    r.height + 2 * pad};
+  }
+  default:
+    return r;
+  }
+}
+
+void tile_renderer_record(TileRenderer *renderer, const GraphicsContext *ctx,
+                          const DrawCommand *cmd) {
+  if (renderer->arena && renderer->count == 0 &&
+      renderer->arena_frame != frame_arena_frame(renderer->arena)) {
+    // The old buffer belongs to a finished frame.
+    renderer->commands = NULL;
+    renderer->capacity = 0;
+    renderer->arena_frame = frame_arena_frame(renderer->arena);
+  }
+  if (renderer->count == renderer->capacity) {
+    uint32_t capacity = renderer->capacity ? renderer->capacity * 2 : 256;
+    DrawCommand *commands =
+        renderer->arena
+            ? (DrawCommand *)frame_arena_grow(
+                  renderer->arena, renderer->commands,
+                  renderer->capacity * sizeof(DrawCommand),
+                  capacity * sizeof(DrawCommand))
+            : (DrawCommand *)realloc(renderer->commands,
+                                     capacity * sizeof(DrawCommand));
+    if (!commands) {
+      return;
+    }
+    renderer->commands = commands;
+    renderer->capacity = capacity;
+  }
+  DrawCommand *slot = &renderer->commands[renderer->count++];
+  *slot = *cmd;
+  slot->clip = ctx->clip;
+  slot->extent = rect_intersection(command_extent(cmd), ctx->clip);
+}
+
+// ============================================================================
+// Replay
+// ============================================================================
+
+static void execute(GraphicsContext *ctx, const DrawCommand *cmd) {
+  OSRect r = cmd->rect;
+  switch (cmd->type) {
+  case DRAW_CMD_RECT:
+    draw_rect(ctx, r, cmd->color);
+    break;
+  case DRAW_CMD_ROUNDED_RECT:
+    draw_rounded_rect(ctx, r, cmd->param, cmd->color);
+    break;
+  case DRAW_CMD_RECT_OUTLINE:
+    draw_rect_outline(ctx, r, cmd->param, cmd->color);
+    break;
+  case DRAW_CMD_CIRCLE:
+    draw_circle(ctx, r.x, r.y, (uint32_t)cmd->param, cmd->color);
+    break;
+  case DRAW_CMD_LINE:
+    draw_line(ctx, r.x, r.y, r.width, r.height, cmd->color);
+    break;
+  case DRAW_CMD_TEXTURE:
+    draw_texture_region(ctx, cmd->texture, cmd->src, r.x, r.y);
+    break;
+  case DRAW_CMD_GRADIENT:
+    apply_gradient(ctx, r, cmd->color, cmd->color2, cmd->horizontal);
+    break;
+  case DRAW_CMD_SHADOW:
+    apply_rounded_shadow(ctx, r, cmd->param, cmd->color, cmd->radius);
+    break;
+  case DRAW_CMD_BLUR:
+    apply_blur(ctx, r, cmd->radius);
+    break;
+  }
+}
+
+// Each tile replays its bin on a private copy of the context whose clip is
+// the command's clip narrowed to the tile, so tiles never touch each
+// other's pixels and need no synchronization.
+static void rasterize_tiles_task(void *arg, uint32_t begin, uint32_t end) {
+  TileRenderer *renderer = (TileRenderer *)arg;
+  GraphicsContext local = *renderer->target;
+  local.recorder = NULL;
+  for (uint32_t t = begin; t < end; t++) {
+    const TileBin *bin = &renderer->bins[t];
+    if (bin->count == 0) {
+      continue;
+    }
+    OSRect tile = {(int32_t)((t % renderer->tiles_x) * TILE_SIZE),
+                   (int32_t)((t / renderer->tiles_x) * TILE_SIZE), TILE_SIZE,
+                   TILE_SIZE};
+    for (uint32_t i = 0; i < bin->count; i++) {
+      const DrawCommand *cmd = &renderer->commands[bin->commands[i]];
+      local.clip = rect_intersection(cmd->clip, tile);
+      execute(&local, cmd);
+    }
+  }
+}
+
+// Tiles covered by command i; false if it draws nothing.
+static bool command_tiles(const TileRenderer *renderer, uint32_t i,
+                          OSRect *tiles) {
+  OSRect e = renderer->commands[i].extent;
+  if (rect_is_empty(e)) {
+    return false;
+  }
+  tiles->x = e.x / TILE_SIZE;
+  tiles->y = e.y / TILE_SIZE;
+  tiles->width = (e.x + e.width - 1) / TILE_SIZE - tiles->x + 1;
+  tiles->height = (e.y + e.height - 1) / TILE_SIZE - tiles->y + 1;
+  return true;
+}
+
+// With an arena the bins are sized exactly: count per tile, then carve all
+// of them out of one allocation and fill them.
+static bool bin_in_arena(TileRenderer *renderer, uint32_t begin,
+                         uint32_t end) {
+  uint32_t tile_count = renderer->tiles_x * renderer->tiles_y;
+  OSRect tiles;
+  size_t total = 0;
+  for (uint32_t i = begin; i < end; i++) {
+    if (!command_tiles(renderer, i, &tiles)) {
+      continue;
+    }
+    for (int32_t ty = tiles.y; ty < tiles.y + tiles.height; ty++) {
+      for (int32_t tx = tiles.x; tx < tiles.x + tiles.width; tx++) {
+        renderer->bins[ty * renderer->tiles_x + tx].count++;
+      }
+    }
+    total += (size_t)tiles.width * tiles.height;
+  }
+  if (total == 0) {
+    return false;
+  }
+  uint32_t *indices =
+      (uint32_t *)frame_arena_alloc(renderer->arena, total * sizeof(uint32_t));
+  if (!indices) {
+    return false;
+  }
+  for (uint32_t t = 0; t < tile_count; t++) {
+    renderer->bins[t].commands = indices;
+    indices += renderer->bins[t].count;
+    renderer->bins[t].count = 0;
+  }
+  for (uint32_t i = begin; i < end; i++) {
+    if (!command_tiles(renderer, i, &tiles)) {
+      continue;
+    }
+    for (int32_t ty = tiles.y; ty < tiles.y + tiles.height; ty++) {
+      for (int32_t tx = tiles.x; tx < tiles.x + tiles.width; tx++) {
+        TileBin *bin = &renderer->bins[ty * renderer->tiles_x + tx];
+        bin->commands[bin->count++] = i;
+      }
+    }
+  }
+  return true;
+}
+
+static void rasterize_segment(TileRenderer *renderer, uint32_t begin,
+                              uint32_t end) {
+  uint32_t tile_count = renderer->tiles_x * renderer->tiles_y;
+  for (uint32_t t = 0; t < tile_count; t++) {
+    renderer->bins[t].count = 0;
+  }
+
+  bool any = false;
+  if (renderer->arena) {
+    any = bin_in_arena(renderer, begin, end);
+  } else {
+    OSRect tiles;
+    for (uint32_t i = begin; i < end; i++) {
+      if (!command_tiles(renderer, i, &tiles)) {
+        continue;
+      }
+      for (int32_t ty = tiles.y; ty < tiles.y + tiles.height; ty++) {
+        for (int32_t tx = tiles.x; tx < tiles.x + tiles.width; tx++) {
+          bin_push(&renderer->bins[ty * renderer->tiles_x + tx], i);
+        }
+      }
+      any = true;
+    }
+  }
+  if (any) {
+    ThreadPool *pool = renderer->pool ? renderer->pool : thread_pool_shared();
+    thread_pool_parallel_for(pool, tile_count, 1, rasterize_tiles_task,
+                             renderer);
+  }
+}
+
+void tile_renderer_flush(TileRenderer *renderer, GraphicsContext *ctx) {
+  if (!renderer || renderer->count == 0) {
+    return;
+  }
+  if (!ensure_bins(renderer, ctx)) {
+    renderer->count = 0;
+    return;
+  }
+
+  // Replay in immediate mode: detach so the draw calls execute.
+  TileRenderer *attached = ctx->recorder;
+  OSRect saved_clip = ctx->clip;
+  ctx->recorder = NULL;
+  renderer->target = ctx;
+
+  uint32_t segment = 0;
+  for (uint32_t i = 0; i < renderer->count; i++) {
+    const DrawCommand *cmd = &renderer->commands[i];
+    if (cmd->type != DRAW_CMD_BLUR) {
+      continue;
+    }
+    rasterize_segment(renderer, segment, i);
+    ctx->clip = cmd->clip;
+    execute(ctx, cmd); // internally parallel over rows and strips
+    segment = i + 1;
+  }
+  rasterize_segment(renderer, segment, renderer->count);
+
+  ctx->clip = saved_clip;
+  ctx->recorder = attached;
+  renderer->target = NULL;
+  renderer->count = 0;
+}
@@ -0,0 +1,21 @@
+#import <Cocoa/Cocoa.h>
+
+// Icons painted once into a shared TextureAtlas and drawn from its pages,
+// so the dock and desktop blit from a few page images instead of keeping
+// an image per icon. An icon is identified by a key plus its size and
+// backing scale; it is painted on first use and again if its page was
+// evicted.
+@interface IconAtlas : NSObject
+
++ (instancetype)shared;
+
+// Draws the icon for key into rect (points), painting it with drawing at
+// size points first if the atlas does not hold it.
+- (void)drawIcon:(NSString *)key
+            size:(NSSize)size
+           scale:(CGFloat)scale
+          inRect:(NSRect)rect
+         context:(CGContextRef)context
+         drawing:(void (^)(NSRect bounds))drawing;
+
+@end
@@ -0,0 +1,112 @@
+#import "IconAtlas.h"
+#import "LayerHelper.h"
+#include "TextureAtlas.hpp"
+#include <cmath>
+#include <memory>
+#include <vector>
+
+// One page holds a few hundred dock-sized icons at 2x
+static const uint32_t kIconPageSize = 1024;
+static const uint32_t kIconMaxPages = 4;
+
+@implementation IconAtlas {
+    std::unique_ptr<OS::Graphics::TextureAtlas> _atlas;
+    NSMutableDictionary<NSString *, NSNumber *> *_ids;
+    // Images of the atlas pages, rebuilt after something is packed onto one
+    NSMutableArray *_pageImages;
+    std::vector<bool> _pageDirty;
+}
+
++ (instancetype)shared {
+    static IconAtlas *shared = nil;
+    static dispatch_once_t once;
+    dispatch_once(&once, ^{
+        shared = [[IconAtlas alloc] init];
+    });
+    return shared;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _atlas.reset(new OS::Graphics::TextureAtlas(kIconPageSize, kIconMaxPages));
+        _ids = [NSMutableDictionary dictionary];
+        _pageImages = [NSMutableArray array];
+    }
+    return self;
+}
+
+- (const OS::Graphics::AtlasRegion *)regionForKey:(NSString *)key
+                                             size:(NSSize)size
+                                            scale:(CGFloat)scale
+                                          drawing:(void (^)(NSRect bounds))drawing {
+    NSString *entry = [NSString stringWithFormat:@"%@@%gx%g@%g", key, size.width, size.height, scale];
+    NSNumber *known = _ids[entry];
+    const OS::Graphics::AtlasRegion *region = known ? _atlas->lookup(known.unsignedIntValue) : nullptr;
+    if (region) {
+        return region;
+    }
+    
+    // Missing or evicted: paint it and pack the pixels
+    uint32_t width = (uint32_t)std::ceil(size.width * scale);
+    uint32_t height = (uint32_t)std::ceil(size.height * scale);
+    OS::Graphics::RenderTarget target(width, height, (float)scale);
+    [LayerHelper paintTarget:target drawing:drawing];
+    uint32_t iconId = _atlas->addTexture(width, height, target.getPixels());
+    region = iconId ? _atlas->lookup(iconId) : nullptr;
+    if (!region) {
+        [_ids removeObjectForKey:entry];
+        return nullptr;
+    }
+    _ids[entry] = @(iconId);
+    if (_pageDirty.size() < _atlas->getPageCount()) {
+        _pageDirty.resize(_atlas->getPageCount(), true);
+    }
+    _pageDirty[region->page] = true;
+    return region;
+}
+
+- (CGImageRef)imageForPage:(uint32_t)page {
+    while (_pageImages.count <= page) {
+        [_pageImages addObject:[NSNull null]];
+    }
+    if (_pageDirty[page] || _pageImages[page] == [NSNull null]) {
+        CGImageRef image = [LayerHelper createImageFromTexture:_atlas->getPage(page)];
+        _pageImages[page] = image ? (__bridge_transfer id)image : (id)[NSNull null];
+        _pageDirty[page] = false;
+    }
+    id image = _pageImages[page];
+    return image == [NSNull null] ? NULL : (__bridge CGImageRef)image;
+}
+
+- (void)drawIcon:(NSString *)key
+            size:(NSSize)size
+           scale:(CGFloat)scale
+          inRect:(NSRect)rect
+         context:(CGContextRef)context
+         drawing:(void (^)(NSRect bounds))drawing {
+    const OS::Graphics::AtlasRegion *region = [self regionForKey:key size:size scale:scale drawing:drawing];
+    if (!region) {
+        return;
+    }
+    CGImageRef page = [self imageForPage:region->page];
+    if (!page) {
+        return;
+    }
+    
+    // Draw the whole page scaled so the icon's pixels land on rect, clipped
+    // to rect; no per-icon image is made
+    CGFloat sx = rect.size.width / region->rect.width;
+    CGFloat sy = rect.size.height / region->rect.height;
+    CGFloat pageWidth = CGImageGetWidth(page) * sx;
+    CGFloat pageHeight = CGImageGetHeight(page) * sy;
+    CGRect pageRect = CGRectMake(rect.origin.x - region->rect.x * sx,
+                                 rect.origin.y + rect.size.height - pageHeight + region->rect.y * sy,
+                                 pageWidth, pageHeight);
+    CGContextSaveGState(context);
+    CGContextClipToRect(context, NSRectToCGRect(rect));
+    CGContextDrawImage(context, pageRect, page);
+    CGContextRestoreGState(context);
+}
+
+@end
@@ -0,0 +1,18 @@
+#import <Cocoa/Cocoa.h>
+#include "RenderTarget.hpp"
+
+// Bridges RenderTarget pixels and AppKit drawing. Targets painted here hold
+// premultiplied alpha, which is what CoreGraphics reads back.
+@interface LayerHelper : NSObject
+
+// Runs drawing with the target as the current graphics context, scaled so
+// the block works in points with the origin at the bottom left.
++ (void)paintTarget:(OS::Graphics::RenderTarget &)target drawing:(void (^)(NSRect bounds))drawing;
+// A copy of the pixels as an image; make a new one after each repaint.
++ (CGImageRef)createImageFromTarget:(OS::Graphics::RenderTarget &)target CF_RETURNS_RETAINED;
+// The same for a texture holding premultiplied pixels, e.g. an atlas page.
++ (CGImageRef)createImageFromTexture:(Texture *)texture CF_RETURNS_RETAINED;
+// Backing scale of the screen the view is on, 1 when there is none.
++ (CGFloat)backingScaleForView:(NSView *)view;
+
+@end
@@ -0,0 +1,55 @@
+#import "LayerHelper.h"
+
+static const CGBitmapInfo kLayerBitmapInfo = kCGBitmapByteOrder32Little | kCGImageAlphaPremultipliedFirst;
+
+@implementation LayerHelper
+
++ (void)paintTarget:(OS::Graphics::RenderTarget &)target drawing:(void (^)(NSRect bounds))drawing {
+    CGColorSpaceRef colorSpace = CGColorSpaceCreateWithName(kCGColorSpaceSRGB);
+    CGContextRef context = CGBitmapContextCreate(target.getPixels(), target.getWidth(), target.getHeight(),
+                                                 8, target.getStride(), colorSpace, kLayerBitmapInfo);
+    CGColorSpaceRelease(colorSpace);
+    if (!context) {
+        return;
+    }
+    
+    CGFloat scale = target.getScale();
+    CGContextScaleCTM(context, scale, scale);
+    
+    [NSGraphicsContext saveGraphicsState];
+    [NSGraphicsContext setCurrentContext:[NSGraphicsContext graphicsContextWithCGContext:context flipped:NO]];
+    drawing(NSMakeRect(0, 0, target.getWidth() / scale, target.getHeight() / scale));
+    [NSGraphicsContext restoreGraphicsState];
+    
+    CGContextRelease(context);
+}
+
++ (CGImageRef)createImageFromTarget:(OS::Graphics::RenderTarget &)target {
+    return [self createImageFromTexture:target.getTexture()];
+}
+
++ (CGImageRef)createImageFromTexture:(Texture *)texture {
+    if (!texture || !texture->data) {
+        return NULL;
+    }
+    // Copied so the image stays valid after the pixels are repainted or freed
+    size_t stride = (size_t)texture->width * sizeof(uint32_t);
+    CFDataRef data = CFDataCreate(NULL, (const UInt8 *)texture->data, stride * texture->height);
+    CGDataProviderRef provider = CGDataProviderCreateWithCFData(data);
+    CGColorSpaceRef colorSpace = CGColorSpaceCreateWithName(kCGColorSpaceSRGB);
+    
+    CGImageRef image = CGImageCreate(texture->width, texture->height, 8, 32, stride, colorSpace,
+                                     kLayerBitmapInfo, provider, NULL, false, kCGRenderingIntentDefault);
+    
+    CGColorSpaceRelease(colorSpace);
+    CGDataProviderRelease(provider);
+    CFRelease(data);
+    return image;
+}
+
++ (CGFloat)backingScaleForView:(NSView *)view {
+    CGFloat scale = view.window ? view.window.backingScaleFactor : [NSScreen mainScreen].backingScaleFactor;
+    return scale > 0 ? scale : 1.0;
+}
+
+@end
@@ -0,0 +1,445 @@
+// IPC - lock-free message rings in kernel pages, page-handle payloads and
+// futex-style parking
+
+#include "ipc.h"
+#include "kernel.h"
+#include "pmm.h"
+#include "utils.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define IPC_CACHE_LINE 64
+#define IPC_YIELD_INTERVAL 128 // spins between yields, for busy single cores
+#define IPC_UNIPROCESSOR_SPINS 64 // yields before parking on one CPU
+
+typedef struct {
+  _Atomic uint64_t sequence; // MPMC: which lap the slot is ready for
+  IpcMessage message;
+} IpcSlot;
+
+_Static_assert(sizeof(IpcSlot) == IPC_CACHE_LINE, "one slot per cache line");
+
+// Lives at the start of its own page block, slots right after. Each side's
+// index shares a line only with that side's cached copy of the other index.
+struct IpcChannel {
+  _Alignas(IPC_CACHE_LINE) _Atomic uint64_t tail;
+  uint64_t head_cache; // SPSC sender's last view of head
+
+  _Alignas(IPC_CACHE_LINE) _Atomic uint64_t head;
+  uint64_t tail_cache; // SPSC receiver's last view of tail
+
+  // Wait word: receivers park until it changes; senders bump it only
+  // when waiters is non-zero
+  _Alignas(IPC_CACHE_LINE) _Atomic uint32_t wake_word;
+  _Atomic uint32_t waiters;
+  _Atomic bool closed;
+  pthread_mutex_t park_lock;
+  pthread_cond_t park_cond;
+
+  _Alignas(IPC_CACHE_LINE) IpcMode mode;
+  uint32_t mask;
+  IpcSlot *slots;
+  uint64_t key;
+  char name[IPC_NAME_MAX];
+  _Atomic uint64_t full;
+  _Atomic uint64_t parks;
+  _Atomic uint64_t wakes;
+};
+
+static pthread_mutex_t g_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static HashMap *g_channel_by_key = NULL;
+
+static uint64_t name_key(const char *name) {
+  uint64_t hash = 0xcbf29ce484222325ull; // FNV-1a
+  for (; *name; name++) {
+    hash = (hash ^ (uint8_t)*name) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+// On one CPU the sender cannot run while the receiver spins, so every
+// poll yields instead of pausing.
+static pthread_once_t g_spin_once = PTHREAD_ONCE_INIT;
+static bool g_uniprocessor;
+
+static void spin_policy_init(void) {
+  g_uniprocessor = sysconf(_SC_NPROCESSORS_ONLN) <= 1;
+}
+
+static inline void spin_pause(uint32_t spins) {
+  if (g_uniprocessor ||
+      spins % IPC_YIELD_INTERVAL == IPC_YIELD_INTERVAL - 1) {
+    sched_yield();
+    return;
+  }
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ volatile("yield");
+#endif
+}
+
+// ============================================================================
+// Channels
+// ============================================================================
+
+IpcChannel *ipc_channel_create(const char *name, IpcMode mode,
+                               uint32_t capacity) {
+  uint32_t slots = 2;
+  while (slots < capacity && slots < (1u << 30)) {
+    slots <<= 1;
+  }
+  size_t header = (sizeof(IpcChannel) + IPC_CACHE_LINE - 1) &
+                  ~(size_t)(IPC_CACHE_LINE - 1);
+  size_t bytes = header + (size_t)slots * sizeof(IpcSlot);
+  uint32_t order = 0;
+  while (((size_t)PMM_PAGE_SIZE << order) < bytes) {
+    if (++order > PMM_MAX_ORDER) {
+      return NULL;
+    }
+  }
+
+  uint64_t key = name ? name_key(name) : 0;
+  pthread_mutex_lock(&g_registry_lock);
+  if (name && !g_channel_by_key) {
+    g_channel_by_key = hashmap_create(64);
+  }
+  if (name && (!g_channel_by_key || hashmap_get(g_channel_by_key, key))) {
+    pthread_mutex_unlock(&g_registry_lock);
+    return NULL;
+  }
+  IpcChannel *channel =
+      (IpcChannel *)pmm_alloc_pages(pmm_kernel(), order, PMM_OWNER_KERNEL);
+  if (!channel) {
+    pthread_mutex_unlock(&g_registry_lock);
+    return NULL;
+  }
+  memset(channel, 0, sizeof(*channel));
+  channel->mode = mode;
+  channel->mask = slots - 1;
+  channel->slots = (IpcSlot *)((uint8_t *)channel + header);
+  channel->key = key;
+  for (uint32_t i = 0; i < slots; i++) {
+    atomic_init(&channel->slots[i].sequence, i);
+  }
+  pthread_mutex_init(&channel->park_lock, NULL);
+  pthread_cond_init(&channel->park_cond, NULL);
+  if (name) {
+    strncpy(channel->name, name, sizeof(channel->name) - 1);
+    hashmap_put(g_channel_by_key, key, channel);
+  }
+  pthread_mutex_unlock(&g_registry_lock);
+  return channel;
+}
+
+IpcChannel *ipc_channel_open(const char *name) {
+  if (!name) {
+    return NULL;
+  }
+  pthread_mutex_lock(&g_registry_lock);
+  IpcChannel *channel =
+      g_channel_by_key
+          ? (IpcChannel *)hashmap_get(g_channel_by_key, name_key(name))
+          : NULL;
+  if (channel && strncmp(channel->name, name, sizeof(channel->name)) != 0) {
+    channel = NULL;
+  }
+  pthread_mutex_unlock(&g_registry_lock);
+  return channel;
+}
+
+void ipc_channel_close(IpcChannel *channel) {
+  if (!channel) {
+    return;
+  }
+  pthread_mutex_lock(&channel->park_lock);
+  atomic_store(&channel->closed, true);
+  atomic_fetch_add(&channel->wake_word, 1);
+  pthread_cond_broadcast(&channel->park_cond);
+  pthread_mutex_unlock(&channel->park_lock);
+}
+
+void ipc_channel_destroy(IpcChannel *channel) {
+  if (!channel) {
+    return;
+  }
+  if (channel->name[0]) {
+    pthread_mutex_lock(&g_registry_lock);
+    hashmap_remove(g_channel_by_key, channel->key);
+    pthread_mutex_unlock(&g_registry_lock);
+  }
+  ipc_channel_close(channel);
+  IpcMessage message;
+  while (ipc_try_receive(channel, &message)) {
+    ipc_payload_free(&message);
+  }
+  pthread_cond_destroy(&channel->park_cond);
+  pthread_mutex_destroy(&channel->park_lock);
+  pmm_free_pages(pmm_kernel(), channel);
+}
+
+// ============================================================================
+// Rings
+// ============================================================================
+
+static bool spsc_push(IpcChannel *channel, const IpcMessage *message) {
+  uint64_t tail = atomic_load_explicit(&channel->tail, memory_order_relaxed);
+  if (tail - channel->head_cache > channel->mask) {
+    channel->head_cache =
+        atomic_load_explicit(&channel->head, memory_order_acquire);
+    if (tail - channel->head_cache > channel->mask) {
+      return false;
+    }
+  }
+  channel->slots[tail & channel->mask].message = *message;
+  atomic_store_explicit(&channel->tail, tail + 1, memory_order_release);
+  return true;
+}
+
+static bool spsc_pop(IpcChannel *channel, IpcMessage *message) {
+  uint64_t head = atomic_load_explicit(&channel->head, memory_order_relaxed);
+  if (head == channel->tail_cache) {
+    channel->tail_cache =
+        atomic_load_explicit(&channel->tail, memory_order_acquire);
+    if (head == channel->tail_cache) {
+      return false;
+    }
+  }
+  *message = channel->slots[head & channel->mask].message;
+  atomic_store_explicit(&channel->head, head + 1, memory_order_release);
+  return true;
+}
+
+static bool mpmc_push(IpcChannel *channel, const IpcMessage *message) {
+  uint64_t pos = atomic_load_explicit(&channel->tail, memory_order_relaxed);
+  IpcSlot *slot;
+  for (;;) {
+    slot = &channel->slots[pos & channel->mask];
+    uint64_t seq = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+    int64_t diff = (int64_t)(seq - pos);
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&channel->tail, &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      return false; // a lap behind: full
+    } else {
+      pos = atomic_load_explicit(&channel->tail, memory_order_relaxed);
+    }
+  }
+  slot->message = *message;
+  atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+  return true;
+}
+
+static bool mpmc_pop(IpcChannel *channel, IpcMessage *message) {
+  uint64_t pos = atomic_load_explicit(&channel->head, memory_order_relaxed);
+  IpcSlot *slot;
+  for (;;) {
+    slot = &channel->slots[pos & channel->mask];
+    uint64_t seq = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+    int64_t diff = (int64_t)(seq - (pos + 1));
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&channel->head, &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      return false; // empty
+    } else {
+      pos = atomic_load_explicit(&channel->head, memory_order_relaxed);
+    }
+  }
+  *message = slot->message;
+  atomic_store_explicit(&slot->sequence, pos + channel->mask + 1,
+                        memory_order_release);
+  return true;
+}
+
+// ============================================================================
+// Send and receive
+// ============================================================================
+
+static void wake_receivers(IpcChannel *channel) {
+  // Pairs with the fence in ipc_receive: either the receiver sees the
+  // message or this sees the receiver
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&channel->waiters, memory_order_relaxed) == 0) {
+    return;
+  }
+  pthread_mutex_lock(&channel->park_lock);
+  atomic_fetch_add_explicit(&channel->wake_word, 1, memory_order_release);
+  // Every parked receiver re-checks the ring, as after a futex wake-all;
+  // parking is the slow path, so the herd is small
+  pthread_cond_broadcast(&channel->park_cond);
+  pthread_mutex_unlock(&channel->park_lock);
+  atomic_fetch_add_explicit(&channel->wakes, 1, memory_order_relaxed);
+}
+
+bool ipc_send(IpcChannel *channel, IpcMessage *message) {
+  if (!channel || !message ||
+      atomic_load_explicit(&channel->closed, memory_order_relaxed)) {
+    return false;
+  }
+  message->sender = process_current();
+  bool pages = (message->flags & IPC_MESSAGE_PAGES) != 0;
+  // In flight the block is the channel's, so the sender exiting cannot
+  // free it under the receiver
+  if (pages && !pmm_transfer_pages(pmm_kernel(), message->payload.block.pages,
+                                   PMM_OWNER_KERNEL)) {
+    return false;
+  }
+  bool sent = channel->mode == IPC_SPSC ? spsc_push(channel, message)
+                                        : mpmc_push(channel, message);
+  if (!sent) {
+    if (pages) {
+      pmm_transfer_pages(pmm_kernel(), message->payload.block.pages,
+                         message->sender);
+    }
+    atomic_fetch_add_explicit(&channel->full, 1, memory_order_relaxed);
+    return false;
+  }
+  wake_receivers(channel);
+  return true;
+}
+
+bool ipc_send_bytes(IpcChannel *channel, uint32_t type, const void *data,
+                    uint32_t length) {
+  if (length > IPC_INLINE_SIZE) {
+    return false;
+  }
+  IpcMessage message;
+  message.type = type;
+  message.length = length;
+  message.flags = 0;
+  if (length > 0) { // data may be NULL for an empty message
+    memcpy(message.payload.bytes, data, length);
+  }
+  return ipc_send(channel, &message);
+}
+
+bool ipc_try_receive(IpcChannel *channel, IpcMessage *message) {
+  if (!channel || !message) {
+    return false;
+  }
+  bool received = channel->mode == IPC_SPSC ? spsc_pop(channel, message)
+                                            : mpmc_pop(channel, message);
+  if (received && (message->flags & IPC_MESSAGE_PAGES)) {
+    pmm_transfer_pages(pmm_kernel(), message->payload.block.pages,
+                       process_current());
+  }
+  return received;
+}
+
+bool ipc_receive(IpcChannel *channel, IpcMessage *message, int64_t timeout_ns) {
+  if (!channel || !message) {
+    return false;
+  }
+  pthread_once(&g_spin_once, spin_policy_init);
+  uint32_t spin_limit = g_uniprocessor ? IPC_UNIPROCESSOR_SPINS : IPC_SPIN_LIMIT;
+  for (uint32_t spins = 0; spins < spin_limit; spins++) {
+    if (ipc_try_receive(channel, message)) {
+      return true;
+    }
+    if (atomic_load_explicit(&channel->closed, memory_order_relaxed)) {
+      return ipc_try_receive(channel, message);
+    }
+    spin_pause(spins);
+  }
+
+  struct timespec deadline;
+  if (timeout_ns >= 0) {
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    uint64_t ns = (uint64_t)deadline.tv_nsec + (uint64_t)timeout_ns;
+    deadline.tv_sec += (time_t)(ns / 1000000000ull);
+    deadline.tv_nsec = (long)(ns % 1000000000ull);
+  }
+  for (;;) {
+    uint32_t word = atomic_load_explicit(&channel->wake_word, memory_order_acquire);
+    atomic_fetch_add_explicit(&channel->waiters, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (ipc_try_receive(channel, message)) {
+      atomic_fetch_sub_explicit(&channel->waiters, 1, memory_order_relaxed);
+      return true;
+    }
+
+    bool timed_out = false;
+    pthread_mutex_lock(&channel->park_lock);
+    atomic_fetch_add_explicit(&channel->parks, 1, memory_order_relaxed);
+    while (atomic_load_explicit(&channel->wake_word, memory_order_relaxed) == word &&
+           !atomic_load(&channel->closed) && !timed_out) {
+      if (timeout_ns < 0) {
+        pthread_cond_wait(&channel->park_cond, &channel->park_lock);
+      } else {
+        timed_out = pthread_cond_timedwait(&channel->park_cond, &channel->park_lock,
+                                           &deadline) == ETIMEDOUT;
+      }
+    }
+    pthread_mutex_unlock(&channel->park_lock);
+    atomic_fetch_sub_explicit(&channel->waiters, 1, memory_order_relaxed);
+
+    if (timed_out || atomic_load(&channel->closed)) {
+      return ipc_try_receive(channel, message);
+    }
+  }
+}
+
+// ============================================================================
+// Page payloads
+// ============================================================================
+
+void *ipc_payload_alloc(IpcMessage *message, uint32_t type, size_t length) {
+  uint32_t order = 0;
+  while (((size_t)PMM_PAGE_SIZE << order) < length) {
+    if (++order > PMM_MAX_ORDER) {
+      return NULL;
+    }
+  }
+  void *pages = pmm_alloc_pages(pmm_kernel(), order, process_current());
+  if (!pages) {
+    return NULL;
+  }
+  memset(message, 0, sizeof(*message));
+  message->type = type;
+  message->length = (uint32_t)length;
+  message->flags = IPC_MESSAGE_PAGES;
+  message->payload.block.pages = pages;
+  message->payload.block.order = order;
+  return pages;
+}
+
+void *ipc_payload_data(IpcMessage *message) {
+  return (message->flags & IPC_MESSAGE_PAGES) ? message->payload.block.pages
+                                              : message->payload.bytes;
+}
+
+void ipc_payload_free(IpcMessage *message) {
+  if (message->flags & IPC_MESSAGE_PAGES) {
+    pmm_free_pages(pmm_kernel(), message->payload.block.pages);
+    message->flags &= ~(uint32_t)IPC_MESSAGE_PAGES;
+    message->payload.block.pages = NULL;
+  }
+}
+
+void ipc_channel_get_stats(IpcChannel *channel, IpcChannelStats *stats) {
+  memset(stats, 0, sizeof(*stats));
+  if (!channel) {
+    return;
+  }
+  // Head first, so a concurrent receive cannot make it pass tail
+  stats->received = atomic_load_explicit(&channel->head, memory_order_acquire);
+  stats->sent = atomic_load_explicit(&channel->tail, memory_order_acquire);
+  stats->full = atomic_load_explicit(&channel->full, memory_order_relaxed);
+  stats->parks = atomic_load_explicit(&channel->parks, memory_order_relaxed);
+  stats->wakes = atomic_load_explicit(&channel->wakes, memory_order_relaxed);
+  stats->capacity = channel->mask + 1;
+  stats->queued = (uint32_t)(stats->sent - stats->received);
+}
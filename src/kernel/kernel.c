@@ -0,0 +1,464 @@
+// Kernel - process management, memory info and scheduling
+
+#include "kernel.h"
+#include "os_config.h"
+#include "pmm.h"
+#include "scheduler.h"
+#include "utils.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define KERNEL_TICK_NS 1000000ull // 1 ms scheduler tick
+
+// pcb->flags. RUNNING is set by the core that takes the process off a run
+// queue and cleared when it hands it back; while it is set only that core
+// may reap the process. EXITING asks for the process to be reaped.
+enum { PCB_RUNNING = 1u, PCB_EXITING = 2u };
+
+// Process control block: the public process record plus kernel-private
+// state. PCBs come from a slab cache on the kernel's physical memory, so
+// process churn never reaches malloc.
+typedef struct {
+  OSProcess info;
+  void (*entry_point)(void);
+  SchedEntity sched;
+  _Atomic uint32_t core;  // core whose run queue holds the process
+  _Atomic uint32_t flags; // PCB_RUNNING | PCB_EXITING
+} ProcessControlBlock;
+
+// A simulated CPU with its own MLFQ. Core 0 serves kernel_run and is the
+// thread that calls kernel_run_smp.
+typedef struct {
+  pthread_mutex_t lock; // sched and the entities queued on it
+  Scheduler sched;
+  _Atomic uint32_t ready; // sched.queued, readable unlocked
+  pthread_t thread;
+  uint32_t id;
+  _Atomic uint64_t cpu_time; // ticks
+  _Atomic uint64_t busy_ns;
+  _Atomic uint64_t quanta;
+  _Atomic uint64_t steals;
+} KernelCore;
+
+// g_kernel_lock guards the pid map and pid allocation and is taken before
+// any core lock; entry points always run with both released.
+static pthread_mutex_t g_kernel_lock = PTHREAD_MUTEX_INITIALIZER;
+static SlabCache *g_pcb_cache = NULL;
+static HashMap *g_process_by_pid = NULL;
+static _Atomic uint32_t g_process_count = 0;
+static uint32_t g_next_pid = 1;
+static OSMemoryInfo g_memory_info;
+
+static KernelCore g_cores[KERNEL_MAX_CORES];
+static _Atomic uint32_t g_core_count = 1;
+static _Thread_local ProcessControlBlock *g_running = NULL;
+static _Thread_local KernelCore *g_this_core = NULL;
+
+// Cores with nothing to run or steal sleep on g_idle_cond.
+static pthread_mutex_t g_idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_idle_cond = PTHREAD_COND_INITIALIZER;
+static _Atomic uint32_t g_idle_cores = 0;
+
+static ProcessControlBlock *find_process(uint32_t pid) {
+  return g_process_by_pid
+             ? (ProcessControlBlock *)hashmap_get(g_process_by_pid, pid)
+             : NULL;
+}
+
+static inline ProcessControlBlock *pcb_of(SchedEntity *entity) {
+  return (ProcessControlBlock *)((char *)entity -
+                                 offsetof(ProcessControlBlock, sched));
+}
+
+static uint64_t kernel_clock_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline void counter_add(_Atomic uint64_t *counter, uint64_t value) {
+  atomic_fetch_add_explicit(counter, value, memory_order_relaxed);
+}
+
+// Wake one parked core. Publishing ready (seq_cst) before reading
+// g_idle_cores pairs with core_park counting itself idle before it
+// re-reads ready, so a wakeup is never lost.
+static void wake_idle(bool all) {
+  if (atomic_load(&g_idle_cores) == 0) {
+    return;
+  }
+  pthread_mutex_lock(&g_idle_lock);
+  if (all) {
+    pthread_cond_broadcast(&g_idle_cond);
+  } else {
+    pthread_cond_signal(&g_idle_cond);
+  }
+  pthread_mutex_unlock(&g_idle_lock);
+}
+
+// Caller holds core->lock. Returns the number of ready processes.
+static uint32_t enqueue_locked(KernelCore *core, ProcessControlBlock *pcb) {
+  if (atomic_load_explicit(&pcb->core, memory_order_relaxed) != core->id) {
+    scheduler_adopt(&core->sched, &pcb->sched);
+    atomic_store_explicit(&pcb->core, core->id, memory_order_relaxed);
+  }
+  scheduler_enqueue(&core->sched, &pcb->sched);
+  atomic_store(&core->ready, core->sched.queued);
+  return core->sched.queued;
+}
+
+// Caller holds core->lock. Takes the highest-priority process off the
+// queue and marks it running; processes that process_destroy has claimed
+// are left to it.
+static ProcessControlBlock *claim_locked(KernelCore *core) {
+  SchedEntity *entity;
+  ProcessControlBlock *pcb = NULL;
+  while (!pcb && (entity = scheduler_pick_next(&core->sched)) != NULL) {
+    pcb = pcb_of(entity);
+    if (atomic_fetch_or(&pcb->flags, PCB_RUNNING) & PCB_EXITING) {
+      pcb = NULL;
+    }
+  }
+  atomic_store(&core->ready, core->sched.queued);
+  return pcb;
+}
+
+static void reap(ProcessControlBlock *pcb) {
+  pthread_mutex_lock(&g_kernel_lock);
+  hashmap_remove(g_process_by_pid, pcb->info.pid);
+  pthread_mutex_unlock(&g_kernel_lock);
+  pmm_release_owner(pmm_kernel(), pcb->info.pid);
+  slab_free(g_pcb_cache, pcb);
+  if (atomic_fetch_sub(&g_process_count, 1) == 1) {
+    wake_idle(true); // parked cores exit
+  }
+}
+
+// Run one quantum of pcb on core; returns the ticks it used.
+static uint64_t run_quantum(ProcessControlBlock *pcb, KernelCore *core) {
+  if (atomic_load(&pcb->flags) & PCB_EXITING) {
+    return 0;
+  }
+  g_running = pcb;
+  uint64_t start = kernel_clock_ns();
+  if (pcb->entry_point) {
+    pcb->entry_point();
+  } else {
+    atomic_fetch_or(&pcb->flags, PCB_EXITING);
+  }
+  uint64_t elapsed = kernel_clock_ns() - start;
+  g_running = NULL;
+
+  uint64_t ticks = elapsed / KERNEL_TICK_NS;
+  ticks = ticks ? ticks : 1;
+  counter_add(&core->cpu_time, ticks);
+  counter_add(&core->busy_ns, elapsed);
+  counter_add(&core->quanta, 1);
+  return ticks;
+}
+
+// Charge a quantum that pcb ran on core and hand it back: onto core's
+// queue, or to reap() if it is exiting.
+static void finish_quantum(KernelCore *core, ProcessControlBlock *pcb,
+                           uint64_t ticks) {
+  pthread_mutex_lock(&core->lock);
+  if (atomic_load_explicit(&pcb->core, memory_order_relaxed) != core->id) {
+    scheduler_adopt(&core->sched, &pcb->sched); // stolen
+    atomic_store_explicit(&pcb->core, core->id, memory_order_relaxed);
+  }
+  scheduler_charge(&core->sched, &pcb->sched,
+                   ticks > UINT32_MAX ? UINT32_MAX : (uint32_t)ticks);
+  scheduler_advance(&core->sched, ticks);
+  bool exiting = atomic_load(&pcb->flags) & PCB_EXITING;
+  uint32_t ready = exiting ? 0 : enqueue_locked(core, pcb);
+  // From here process_destroy may claim the process, unless it already
+  // asked for the exit while the process was running.
+  if (!exiting &&
+      (atomic_fetch_and(&pcb->flags, ~PCB_RUNNING) & PCB_EXITING)) {
+    scheduler_dequeue(&core->sched, &pcb->sched);
+    atomic_store(&core->ready, core->sched.queued);
+    exiting = true;
+  }
+  pthread_mutex_unlock(&core->lock);
+  if (exiting) {
+    reap(pcb);
+  } else if (ready > 1) {
+    wake_idle(false); // more here than this core runs next
+  }
+}
+
+// ============================================================================
+// Lifecycle
+// ============================================================================
+
+void kernel_init(void) {
+  pthread_mutex_lock(&g_kernel_lock);
+  if (!g_pcb_cache) {
+    g_pcb_cache = slab_cache_create(pmm_kernel(), sizeof(ProcessControlBlock));
+    g_process_by_pid = hashmap_create(MAX_PROCESSES);
+    for (uint32_t i = 0; i < KERNEL_MAX_CORES; i++) {
+      pthread_mutex_init(&g_cores[i].lock, NULL);
+      scheduler_init(&g_cores[i].sched, SCHED_DEFAULT_BOOST_INTERVAL);
+      g_cores[i].id = i;
+    }
+  }
+  g_memory_info.total_memory = KERNEL_MEMORY_SIZE;
+  pthread_mutex_unlock(&g_kernel_lock);
+}
+
+// Run until no process is ready.
+void kernel_run(void) {
+  while (atomic_load(&g_cores[0].ready) > 0) {
+    schedule_process();
+  }
+}
+
+// ============================================================================
+// Processes
+// ============================================================================
+
+uint32_t process_create(const char *name, void (*entry_point)(void)) {
+  if (!g_pcb_cache) {
+    kernel_init();
+  }
+  ProcessControlBlock *pcb = (ProcessControlBlock *)slab_alloc(g_pcb_cache);
+  if (!pcb) {
+    return 0;
+  }
+  memset(pcb, 0, sizeof(*pcb));
+  strncpy(pcb->info.name, name ? name : "", sizeof(pcb->info.name) - 1);
+  pcb->entry_point = entry_point;
+
+  pthread_mutex_lock(&g_kernel_lock);
+  if (atomic_load(&g_process_count) >= MAX_PROCESSES) {
+    pthread_mutex_unlock(&g_kernel_lock);
+    slab_free(g_pcb_cache, pcb);
+    return 0;
+  }
+  uint32_t pid = pcb->info.pid = g_next_pid++;
+  hashmap_put(g_process_by_pid, pid, pcb);
+  atomic_fetch_add(&g_process_count, 1);
+  // A core spawning a process keeps it local; it will be stolen if the
+  // core stays busy.
+  KernelCore *core = g_this_core ? g_this_core : &g_cores[0];
+  pthread_mutex_lock(&core->lock);
+  scheduler_entity_init(&core->sched, &pcb->sched, &pcb->info);
+  atomic_store_explicit(&pcb->core, core->id, memory_order_relaxed);
+  enqueue_locked(core, pcb);
+  pthread_mutex_unlock(&core->lock);
+  pthread_mutex_unlock(&g_kernel_lock);
+  // From outside the cores the process lands on core 0, which may be
+  // parked while a signal would wake some other core that will not take
+  // a lone process: wake them all.
+  wake_idle(!g_this_core);
+  return pid;
+}
+
+void process_destroy(uint32_t pid) {
+  pthread_mutex_lock(&g_kernel_lock);
+  ProcessControlBlock *pcb = find_process(pid);
+  uint32_t flags = pcb ? atomic_fetch_or(&pcb->flags, PCB_EXITING) : 0;
+  if (!pcb || flags != 0) {
+    // Gone, already exiting, or running on some core, which reaps it when
+    // its quantum ends.
+    pthread_mutex_unlock(&g_kernel_lock);
+    return;
+  }
+  // Queued: the core cannot change until the process runs again, and no
+  // core will run it now that it is exiting.
+  KernelCore *core = &g_cores[atomic_load_explicit(&pcb->core,
+                                                    memory_order_relaxed)];
+  pthread_mutex_lock(&core->lock);
+  scheduler_dequeue(&core->sched, &pcb->sched);
+  atomic_store(&core->ready, core->sched.queued);
+  pthread_mutex_unlock(&core->lock);
+  pthread_mutex_unlock(&g_kernel_lock);
+  reap(pcb);
+}
+
+void process_exit(void) {
+  if (g_running) {
+    atomic_fetch_or(&g_running->flags, PCB_EXITING);
+  }
+}
+
+uint32_t process_current(void) {
+  return g_running ? g_running->info.pid : 0;
+}
+
+OSProcess *process_find(uint32_t pid) {
+  pthread_mutex_lock(&g_kernel_lock);
+  ProcessControlBlock *pcb = find_process(pid);
+  pthread_mutex_unlock(&g_kernel_lock);
+  return pcb ? &pcb->info : NULL;
+}
+
+// ============================================================================
+// Memory
+// ============================================================================
+
+// Counters kept by the physical memory manager; nothing is walked.
+OSMemoryInfo *get_memory_info(void) {
+  PhysicalMemory *pmm = pmm_kernel();
+  g_memory_info.total_memory = pmm_total_bytes(pmm);
+  g_memory_info.used_memory = pmm_used_bytes(pmm);
+  g_memory_info.free_memory =
+      g_memory_info.total_memory - g_memory_info.used_memory;
+  return &g_memory_info;
+}
+
+uint64_t process_memory_usage(uint32_t pid) {
+  return pmm_owner_pages(pmm_kernel(), pid) * PMM_PAGE_SIZE;
+}
+
+// ============================================================================
+// Scheduling
+// ============================================================================
+
+// Next process for a core: the top of its own MLFQ, else the top of the
+// first other core that has a process waiting.
+static ProcessControlBlock *core_next(KernelCore *core, uint32_t num_cores) {
+  pthread_mutex_lock(&core->lock);
+  ProcessControlBlock *pcb = claim_locked(core);
+  pthread_mutex_unlock(&core->lock);
+  for (uint32_t k = 1; !pcb && k < num_cores; k++) {
+    KernelCore *victim = &g_cores[(core->id + k) % num_cores];
+    if (atomic_load(&victim->ready) == 0) {
+      continue;
+    }
+    pthread_mutex_lock(&victim->lock);
+    pcb = claim_locked(victim);
+    pthread_mutex_unlock(&victim->lock);
+    if (pcb) {
+      counter_add(&core->steals, 1);
+    }
+  }
+  return pcb;
+}
+
+// Run one quantum of the next process for core; false when it found none.
+static bool core_dispatch(KernelCore *core, uint32_t num_cores) {
+  ProcessControlBlock *pcb = core_next(core, num_cores);
+  if (!pcb) {
+    return false;
+  }
+  finish_quantum(core, pcb, run_quantum(pcb, core));
+  return true;
+}
+
+// Run the highest-priority ready process for one quantum (one call to its
+// entry point) on core 0 and charge the elapsed ticks to it.
+void schedule_process(void) {
+  if (g_pcb_cache) {
+    core_dispatch(&g_cores[0], 1);
+  }
+}
+
+// ============================================================================
+// SMP
+// ============================================================================
+
+// Worth waking for: a process on this core, one another core is not about
+// to run itself (its queue holds more than one), or every process gone.
+static bool core_has_work(KernelCore *core, uint32_t num_cores) {
+  if (atomic_load(&g_process_count) == 0 || atomic_load(&core->ready) > 0) {
+    return true;
+  }
+  for (uint32_t i = 0; i < num_cores; i++) {
+    if (atomic_load(&g_cores[i].ready) > 1) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void core_park(KernelCore *core, uint32_t num_cores) {
+  pthread_mutex_lock(&g_idle_lock);
+  atomic_fetch_add(&g_idle_cores, 1);
+  while (!core_has_work(core, num_cores)) {
+    pthread_cond_wait(&g_idle_cond, &g_idle_lock);
+  }
+  atomic_fetch_sub(&g_idle_cores, 1);
+  pthread_mutex_unlock(&g_idle_lock);
+}
+
+static void *core_main(void *opaque) {
+  KernelCore *core = (KernelCore *)opaque;
+  uint32_t num_cores = atomic_load(&g_core_count);
+  g_this_core = core;
+  while (atomic_load(&g_process_count) > 0) {
+    if (!core_dispatch(core, num_cores)) {
+      core_park(core, num_cores);
+    }
+  }
+  g_this_core = NULL;
+  return NULL;
+}
+
+void kernel_run_smp(uint32_t num_cores) {
+  if (num_cores == 0) {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    num_cores = online > 0 ? (uint32_t)online : 1;
+  }
+  if (num_cores > KERNEL_MAX_CORES) {
+    num_cores = KERNEL_MAX_CORES;
+  }
+  if (num_cores == 1) {
+    kernel_run();
+    return;
+  }
+  if (!g_pcb_cache) {
+    kernel_init();
+  }
+
+  // Deal the ready processes out round-robin before the cores start.
+  // g_kernel_lock keeps process_destroy out while they change cores.
+  pthread_mutex_lock(&g_kernel_lock);
+  KernelCore *boot = &g_cores[0];
+  pthread_mutex_lock(&boot->lock);
+  uint32_t next = 0;
+  SchedEntity *entity;
+  while ((entity = scheduler_pick_next(&boot->sched)) != NULL) {
+    KernelCore *core = &g_cores[next];
+    if (core != boot) {
+      pthread_mutex_lock(&core->lock);
+    }
+    enqueue_locked(core, pcb_of(entity));
+    if (core != boot) {
+      pthread_mutex_unlock(&core->lock);
+    }
+    next = (next + 1) % num_cores;
+  }
+  atomic_store(&boot->ready, boot->sched.queued);
+  pthread_mutex_unlock(&boot->lock);
+  atomic_store(&g_core_count, num_cores);
+  pthread_mutex_unlock(&g_kernel_lock);
+
+  uint32_t started = 1;
+  for (; started < num_cores; started++) {
+    if (pthread_create(&g_cores[started].thread, NULL, core_main,
+                       &g_cores[started]) != 0) {
+      break;
+    }
+  }
+  core_main(&g_cores[0]);
+  for (uint32_t i = 1; i < started; i++) {
+    pthread_join(g_cores[i].thread, NULL);
+  }
+}
+
+uint32_t get_core_info(OSCoreInfo *cores, uint32_t max_cores) {
+  uint32_t count = atomic_load(&g_core_count);
+  count = count < max_cores ? count : max_cores;
+  for (uint32_t i = 0; i < count; i++) {
+    cores[i].core_id = i;
+    cores[i].cpu_time = atomic_load_explicit(&g_cores[i].cpu_time, memory_order_relaxed);
+    cores[i].busy_ns = atomic_load_explicit(&g_cores[i].busy_ns, memory_order_relaxed);
+    cores[i].quanta = atomic_load_explicit(&g_cores[i].quanta, memory_order_relaxed);
+    cores[i].steals = atomic_load_explicit(&g_cores[i].steals, memory_order_relaxed);
+  }
+  return count;
+}
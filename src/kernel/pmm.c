@@ -0,0 +1,708 @@
+// Physical memory manager - buddy allocator, slab caches and churn simulation
+
+#include "pmm.h"
+#include "kernel.h"
+#include "os_config.h"
+#include "utils.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#define PMM_NONE UINT32_MAX
+
+enum { PAGE_TAIL = 0, PAGE_FREE = 1, PAGE_USED = 2 };
+
+// One entry per page; only the first page of a block (its head) is live.
+// Free blocks are linked on their order's free list, used blocks on their
+// owner's list.
+typedef struct {
+  uint32_t next;
+  uint32_t prev;
+  uint32_t owner;
+  uint8_t order;
+  uint8_t state;
+} PmmPage;
+
+typedef struct PmmOwner {
+  uint32_t id;
+  uint32_t blocks; // head of the owner's block list
+  uint64_t pages;
+  struct PmmOwner *prev;
+  struct PmmOwner *next;
+} PmmOwner;
+
+struct PhysicalMemory {
+  pthread_mutex_t lock; // free lists, page table, owners
+  uint8_t *base;
+  uint32_t total_pages;
+  PmmPage *pages;
+  uint32_t free_head[PMM_ORDERS];
+  uint64_t free_blocks[PMM_ORDERS];
+  uint32_t nonempty; // bit order set when free_head[order] is a block
+  HashMap *owner_by_id;
+  PmmOwner *owners;
+  uint32_t owner_count;
+  _Atomic uint64_t used_pages;
+
+  uint64_t allocs;
+  uint64_t frees;
+  uint64_t splits;
+  uint64_t merges;
+  uint64_t failures;
+};
+
+// ============================================================================
+// Page lists
+// ============================================================================
+
+static void list_push(PhysicalMemory *pmm, uint32_t *head, uint32_t index) {
+  PmmPage *page = &pmm->pages[index];
+  page->prev = PMM_NONE;
+  page->next = *head;
+  if (*head != PMM_NONE) {
+    pmm->pages[*head].prev = index;
+  }
+  *head = index;
+}
+
+static void list_remove(PhysicalMemory *pmm, uint32_t *head, uint32_t index) {
+  PmmPage *page = &pmm->pages[index];
+  if (page->prev != PMM_NONE) {
+    pmm->pages[page->prev].next = page->next;
+  } else {
+    *head = page->next;
+  }
+  if (page->next != PMM_NONE) {
+    pmm->pages[page->next].prev = page->prev;
+  }
+}
+
+static void free_push(PhysicalMemory *pmm, uint32_t index, uint32_t order) {
+  pmm->pages[index].state = PAGE_FREE;
+  pmm->pages[index].order = (uint8_t)order;
+  list_push(pmm, &pmm->free_head[order], index);
+  pmm->free_blocks[order]++;
+  pmm->nonempty |= 1u << order;
+}
+
+static void free_remove(PhysicalMemory *pmm, uint32_t index, uint32_t order) {
+  list_remove(pmm, &pmm->free_head[order], index);
+  pmm->pages[index].state = PAGE_TAIL;
+  if (--pmm->free_blocks[order] == 0) {
+    pmm->nonempty &= ~(1u << order);
+  }
+}
+
+// Caller holds the lock. Merges upward while the buddy is a free block of
+// the same order.
+static void free_block_locked(PhysicalMemory *pmm, uint32_t index,
+                              uint32_t order) {
+  while (order < PMM_MAX_ORDER) {
+    uint32_t buddy = index ^ (1u << order);
+    if (buddy >= pmm->total_pages || pmm->pages[buddy].state != PAGE_FREE ||
+        pmm->pages[buddy].order != order) {
+      break;
+    }
+    free_remove(pmm, buddy, order);
+    pmm->pages[index].state = PAGE_TAIL;
+    index &= buddy;
+    order++;
+    pmm->merges++;
+  }
+  free_push(pmm, index, order);
+}
+
+// ============================================================================
+// Owners
+// ============================================================================
+
+static PmmOwner *owner_get(PhysicalMemory *pmm, uint32_t id, bool create) {
+  PmmOwner *owner = (PmmOwner *)hashmap_get(pmm->owner_by_id, id);
+  if (owner || !create) {
+    return owner;
+  }
+  owner = (PmmOwner *)calloc(1, sizeof(PmmOwner));
+  if (!owner) {
+    return NULL;
+  }
+  owner->id = id;
+  owner->blocks = PMM_NONE;
+  owner->next = pmm->owners;
+  if (pmm->owners) {
+    pmm->owners->prev = owner;
+  }
+  pmm->owners = owner;
+  pmm->owner_count++;
+  hashmap_put(pmm->owner_by_id, id, owner);
+  return owner;
+}
+
+static void owner_drop(PhysicalMemory *pmm, PmmOwner *owner) {
+  hashmap_remove(pmm->owner_by_id, owner->id);
+  if (owner->prev) {
+    owner->prev->next = owner->next;
+  } else {
+    pmm->owners = owner->next;
+  }
+  if (owner->next) {
+    owner->next->prev = owner->prev;
+  }
+  pmm->owner_count--;
+  free(owner);
+}
+
+// ============================================================================
+// Buddy allocator
+// ============================================================================
+
+static bool pmm_contains(const PhysicalMemory *pmm, const void *address) {
+  const uint8_t *p = (const uint8_t *)address;
+  return p >= pmm->base &&
+         p < pmm->base + ((size_t)pmm->total_pages << PMM_PAGE_SHIFT);
+}
+
+PhysicalMemory *pmm_create(uint64_t bytes) {
+  uint64_t total = bytes >> PMM_PAGE_SHIFT;
+  if (total == 0 || total >= PMM_NONE) {
+    return NULL;
+  }
+  PhysicalMemory *pmm = (PhysicalMemory *)calloc(1, sizeof(PhysicalMemory));
+  if (!pmm) {
+    return NULL;
+  }
+  pthread_mutex_init(&pmm->lock, NULL);
+  pmm->total_pages = (uint32_t)total;
+  pmm->pages = (PmmPage *)calloc(total, sizeof(PmmPage));
+  pmm->owner_by_id = hashmap_create(MAX_PROCESSES);
+  // Reserved, not committed: the host backs pages as they are touched
+  void *base = mmap(NULL, total << PMM_PAGE_SHIFT, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANON, -1, 0);
+  pmm->base = base == MAP_FAILED ? NULL : (uint8_t *)base;
+  if (!pmm->pages || !pmm->owner_by_id || !pmm->base) {
+    pmm_destroy(pmm);
+    return NULL;
+  }
+
+  // Carve the pages into the largest aligned blocks that fit
+  for (uint32_t order = 0; order < PMM_ORDERS; order++) {
+    pmm->free_head[order] = PMM_NONE;
+  }
+  uint32_t index = 0;
+  while (index < pmm->total_pages) {
+    uint32_t order = PMM_MAX_ORDER;
+    while (order > 0 && ((index & ((1u << order) - 1)) != 0 ||
+                         (uint64_t)index + (1u << order) > pmm->total_pages)) {
+      order--;
+    }
+    free_push(pmm, index, order);
+    index += 1u << order;
+  }
+  return pmm;
+}
+
+void pmm_destroy(PhysicalMemory *pmm) {
+  if (!pmm) {
+    return;
+  }
+  while (pmm->owners) {
+    owner_drop(pmm, pmm->owners);
+  }
+  if (pmm->base) {
+    munmap(pmm->base, (size_t)pmm->total_pages << PMM_PAGE_SHIFT);
+  }
+  if (pmm->owner_by_id) {
+    hashmap_destroy(pmm->owner_by_id);
+  }
+  pthread_mutex_destroy(&pmm->lock);
+  free(pmm->pages);
+  free(pmm);
+}
+
+static PhysicalMemory *g_kernel_memory = NULL;
+static pthread_once_t g_kernel_memory_once = PTHREAD_ONCE_INIT;
+
+static void kernel_memory_create(void) {
+  g_kernel_memory = pmm_create(KERNEL_MEMORY_SIZE);
+}
+
+PhysicalMemory *pmm_kernel(void) {
+  pthread_once(&g_kernel_memory_once, kernel_memory_create);
+  return g_kernel_memory;
+}
+
+void *pmm_alloc_pages(PhysicalMemory *pmm, uint32_t order, uint32_t owner_id) {
+  if (!pmm || order > PMM_MAX_ORDER) {
+    return NULL;
+  }
+  pthread_mutex_lock(&pmm->lock);
+  uint32_t fits = pmm->nonempty & ~((1u << order) - 1);
+  PmmOwner *owner = fits ? owner_get(pmm, owner_id, true) : NULL;
+  if (!owner) {
+    pmm->failures++;
+    pthread_mutex_unlock(&pmm->lock);
+    return NULL;
+  }
+
+  uint32_t found = (uint32_t)__builtin_ctz(fits);
+  uint32_t index = pmm->free_head[found];
+  free_remove(pmm, index, found);
+  while (found > order) {
+    found--;
+    free_push(pmm, index + (1u << found), found);
+    pmm->splits++;
+  }
+
+  PmmPage *page = &pmm->pages[index];
+  page->state = PAGE_USED;
+  page->order = (uint8_t)order;
+  page->owner = owner_id;
+  list_push(pmm, &owner->blocks, index);
+  owner->pages += 1u << order;
+  pmm->allocs++;
+  atomic_fetch_add_explicit(&pmm->used_pages, 1u << order,
+                            memory_order_relaxed);
+  pthread_mutex_unlock(&pmm->lock);
+  return pmm->base + ((size_t)index << PMM_PAGE_SHIFT);
+}
+
+// Caller holds the lock.
+static void release_block_locked(PhysicalMemory *pmm, PmmOwner *owner,
+                                 uint32_t index) {
+  uint32_t order = pmm->pages[index].order;
+  list_remove(pmm, &owner->blocks, index);
+  owner->pages -= 1u << order;
+  pmm->frees++;
+  atomic_fetch_sub_explicit(&pmm->used_pages, 1u << order,
+                            memory_order_relaxed);
+  free_block_locked(pmm, index, order);
+}
+
+void pmm_free_pages(PhysicalMemory *pmm, void *block) {
+  if (!pmm || !pmm_contains(pmm, block)) {
+    return;
+  }
+  size_t offset = (size_t)((uint8_t *)block - pmm->base);
+  if ((offset & (PMM_PAGE_SIZE - 1)) != 0) {
+    return;
+  }
+  uint32_t index = (uint32_t)(offset >> PMM_PAGE_SHIFT);
+  pthread_mutex_lock(&pmm->lock);
+  if (pmm->pages[index].state == PAGE_USED) {
+    PmmOwner *owner = owner_get(pmm, pmm->pages[index].owner, false);
+    release_block_locked(pmm, owner, index);
+  }
+  pthread_mutex_unlock(&pmm->lock);
+}
+
+uint64_t pmm_release_owner(PhysicalMemory *pmm, uint32_t owner_id) {
+  if (!pmm || owner_id == PMM_OWNER_KERNEL) {
+    return 0;
+  }
+  pthread_mutex_lock(&pmm->lock);
+  PmmOwner *owner = owner_get(pmm, owner_id, false);
+  uint64_t released = owner ? owner->pages : 0;
+  if (owner) {
+    while (owner->blocks != PMM_NONE) {
+      release_block_locked(pmm, owner, owner->blocks);
+    }
+    owner_drop(pmm, owner);
+  }
+  pthread_mutex_unlock(&pmm->lock);
+  return released;
+}
+
+bool pmm_transfer_pages(PhysicalMemory *pmm, void *block, uint32_t owner_id) {
+  if (!pmm || !pmm_contains(pmm, block)) {
+    return false;
+  }
+  uint32_t index =
+      (uint32_t)((size_t)((uint8_t *)block - pmm->base) >> PMM_PAGE_SHIFT);
+  pthread_mutex_lock(&pmm->lock);
+  PmmPage *page = &pmm->pages[index];
+  PmmOwner *to = page->state == PAGE_USED ? owner_get(pmm, owner_id, true) : NULL;
+  if (!to) {
+    pthread_mutex_unlock(&pmm->lock);
+    return false;
+  }
+  PmmOwner *from = owner_get(pmm, page->owner, false);
+  list_remove(pmm, &from->blocks, index);
+  from->pages -= 1u << page->order;
+  page->owner = owner_id;
+  list_push(pmm, &to->blocks, index);
+  to->pages += 1u << page->order;
+  pthread_mutex_unlock(&pmm->lock);
+  return true;
+}
+
+uint64_t pmm_owner_pages(PhysicalMemory *pmm, uint32_t owner_id) {
+  if (!pmm) {
+    return 0;
+  }
+  pthread_mutex_lock(&pmm->lock);
+  PmmOwner *owner = owner_get(pmm, owner_id, false);
+  uint64_t pages = owner ? owner->pages : 0;
+  pthread_mutex_unlock(&pmm->lock);
+  return pages;
+}
+
+uint64_t pmm_total_bytes(const PhysicalMemory *pmm) {
+  return pmm ? (uint64_t)pmm->total_pages << PMM_PAGE_SHIFT : 0;
+}
+
+uint64_t pmm_used_bytes(const PhysicalMemory *pmm) {
+  if (!pmm) {
+    return 0;
+  }
+  uint64_t used = atomic_load_explicit(
+      &((PhysicalMemory *)pmm)->used_pages, memory_order_relaxed);
+  return used << PMM_PAGE_SHIFT;
+}
+
+void pmm_get_stats(PhysicalMemory *pmm, PmmStats *stats) {
+  memset(stats, 0, sizeof(*stats));
+  stats->largest_free_order = -1;
+  if (!pmm) {
+    return;
+  }
+  pthread_mutex_lock(&pmm->lock);
+  stats->total_pages = pmm->total_pages;
+  stats->used_pages = atomic_load(&pmm->used_pages);
+  stats->free_pages = stats->total_pages - stats->used_pages;
+  uint64_t below = 0; // free pages in blocks smaller than the order
+  for (uint32_t order = 0; order < PMM_ORDERS; order++) {
+    stats->free_blocks[order] = pmm->free_blocks[order];
+    if (pmm->free_blocks[order]) {
+      stats->largest_free_order = (int32_t)order;
+    }
+    stats->unusable[order] =
+        stats->free_pages ? (double)below / stats->free_pages : 0.0;
+    below += pmm->free_blocks[order] << order;
+  }
+  stats->allocs = pmm->allocs;
+  stats->frees = pmm->frees;
+  stats->splits = pmm->splits;
+  stats->merges = pmm->merges;
+  stats->failures = pmm->failures;
+  stats->owners = pmm->owner_count;
+  pthread_mutex_unlock(&pmm->lock);
+}
+
+// ============================================================================
+// Slab caches
+// ============================================================================
+
+// Header at the start of each slab. Objects never handed out are carved
+// lazily past `carved`, so a new slab touches only the pages it uses.
+typedef struct Slab {
+  struct Slab *prev;
+  struct Slab *next;
+  SlabCache *cache;
+  void *free_list; // freed objects, linked through their first word
+  uint32_t in_use;
+  uint32_t carved;
+} Slab;
+
+struct SlabCache {
+  PhysicalMemory *pmm;
+  pthread_mutex_t lock;
+  uint32_t object_size;
+  uint32_t objects_per_slab;
+  uint32_t slab_order;
+  uint32_t first_offset; // header, rounded up to SLAB_ALIGN
+  Slab *partial;
+  Slab *full;
+  Slab *empty; // kept for reuse, at most one
+  uint64_t slabs;
+  uint64_t in_use;
+  uint64_t allocs;
+  uint64_t frees;
+};
+
+static void slab_link(Slab **head, Slab *slab) {
+  slab->prev = NULL;
+  slab->next = *head;
+  if (*head) {
+    (*head)->prev = slab;
+  }
+  *head = slab;
+}
+
+static void slab_unlink(Slab **head, Slab *slab) {
+  if (slab->prev) {
+    slab->prev->next = slab->next;
+  } else {
+    *head = slab->next;
+  }
+  if (slab->next) {
+    slab->next->prev = slab->prev;
+  }
+}
+
+static Slab **slab_list(SlabCache *cache, const Slab *slab) {
+  if (slab->in_use == 0) {
+    return &cache->empty;
+  }
+  return slab->in_use == cache->objects_per_slab ? &cache->full
+                                                 : &cache->partial;
+}
+
+SlabCache *slab_cache_create(PhysicalMemory *pmm, size_t object_size) {
+  if (!pmm || object_size == 0) {
+    return NULL;
+  }
+  size_t size = (object_size + SLAB_ALIGN - 1) & ~(size_t)(SLAB_ALIGN - 1);
+  size_t header = (sizeof(Slab) + SLAB_ALIGN - 1) & ~(size_t)(SLAB_ALIGN - 1);
+  uint32_t order = 0;
+  while (order < PMM_MAX_ORDER &&
+         (((size_t)PMM_PAGE_SIZE << order) - header) / size < SLAB_MIN_OBJECTS) {
+    order++;
+  }
+  size_t fit = (((size_t)PMM_PAGE_SIZE << order) - header) / size;
+  if (fit == 0) {
+    return NULL;
+  }
+
+  SlabCache *cache = (SlabCache *)calloc(1, sizeof(SlabCache));
+  if (!cache) {
+    return NULL;
+  }
+  cache->pmm = pmm;
+  cache->object_size = (uint32_t)size;
+  cache->objects_per_slab = (uint32_t)fit;
+  cache->slab_order = order;
+  cache->first_offset = (uint32_t)header;
+  pthread_mutex_init(&cache->lock, NULL);
+  return cache;
+}
+
+static void slab_release_list(SlabCache *cache, Slab *slab) {
+  while (slab) {
+    Slab *next = slab->next;
+    pmm_free_pages(cache->pmm, slab);
+    slab = next;
+  }
+}
+
+void slab_cache_destroy(SlabCache *cache) {
+  if (!cache) {
+    return;
+  }
+  slab_release_list(cache, cache->partial);
+  slab_release_list(cache, cache->full);
+  slab_release_list(cache, cache->empty);
+  pthread_mutex_destroy(&cache->lock);
+  free(cache);
+}
+
+void *slab_alloc(SlabCache *cache) {
+  if (!cache) {
+    return NULL;
+  }
+  pthread_mutex_lock(&cache->lock);
+  Slab *slab = cache->partial ? cache->partial : cache->empty;
+  if (!slab) {
+    slab = (Slab *)pmm_alloc_pages(cache->pmm, cache->slab_order,
+                                   PMM_OWNER_KERNEL);
+    if (!slab) {
+      pthread_mutex_unlock(&cache->lock);
+      return NULL;
+    }
+    memset(slab, 0, sizeof(*slab));
+    slab->cache = cache;
+    slab_link(&cache->empty, slab);
+    cache->slabs++;
+  }
+
+  void *object;
+  if (slab->free_list) {
+    object = slab->free_list;
+    slab->free_list = *(void **)object;
+  } else {
+    object = (uint8_t *)slab + cache->first_offset +
+             (size_t)slab->carved * cache->object_size;
+    slab->carved++;
+  }
+  slab_unlink(slab_list(cache, slab), slab);
+  slab->in_use++;
+  slab_link(slab_list(cache, slab), slab);
+  cache->in_use++;
+  cache->allocs++;
+  pthread_mutex_unlock(&cache->lock);
+  return object;
+}
+
+void slab_free(SlabCache *cache, void *object) {
+  if (!cache || !object || !pmm_contains(cache->pmm, object)) {
+    return;
+  }
+  size_t slab_bytes = (size_t)PMM_PAGE_SIZE << cache->slab_order;
+  uint8_t *base = cache->pmm->base;
+  Slab *slab = (Slab *)(base + (((uint8_t *)object - base) & ~(slab_bytes - 1)));
+  if (slab->cache != cache) {
+    return;
+  }
+
+  pthread_mutex_lock(&cache->lock);
+  slab_unlink(slab_list(cache, slab), slab);
+  *(void **)object = slab->free_list;
+  slab->free_list = object;
+  slab->in_use--;
+  cache->in_use--;
+  cache->frees++;
+  // One empty slab absorbs alloc/free ping-pong; more go back as pages
+  if (slab->in_use == 0 && cache->empty) {
+    cache->slabs--;
+    pthread_mutex_unlock(&cache->lock);
+    pmm_free_pages(cache->pmm, slab);
+    return;
+  }
+  slab_link(slab_list(cache, slab), slab);
+  pthread_mutex_unlock(&cache->lock);
+}
+
+void slab_cache_get_stats(SlabCache *cache, SlabCacheStats *stats) {
+  memset(stats, 0, sizeof(*stats));
+  if (!cache) {
+    return;
+  }
+  pthread_mutex_lock(&cache->lock);
+  stats->object_size = cache->object_size;
+  stats->objects_per_slab = cache->objects_per_slab;
+  stats->slab_order = cache->slab_order;
+  stats->slabs = cache->slabs;
+  stats->in_use = cache->in_use;
+  stats->capacity = cache->slabs * cache->objects_per_slab;
+  stats->allocs = cache->allocs;
+  stats->frees = cache->frees;
+  pthread_mutex_unlock(&cache->lock);
+}
+
+// ============================================================================
+// Simulation
+// ============================================================================
+
+#define SIM_CACHES 2
+
+typedef struct {
+  void *address;
+  uint32_t owner;
+  int32_t cache; // -1 for a page block
+} SimAllocation;
+
+static inline uint64_t sim_random(uint64_t *state) {
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return *state = x;
+}
+
+static uint64_t sim_clock_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+bool pmm_simulate(const PmmSimConfig *config, PmmSimResult *result) {
+  memset(result, 0, sizeof(*result));
+  PhysicalMemory *pmm = pmm_create(config->memory_bytes);
+  if (!pmm) {
+    return false;
+  }
+  SlabCache *caches[SIM_CACHES] = {
+      slab_cache_create(pmm, sizeof(OSProcess)),
+      slab_cache_create(pmm, sizeof(OSDevice)),
+  };
+  // Every live allocation is at least one page or one object
+  uint64_t max_live = pmm->total_pages * 16ull + 1;
+  SimAllocation *live = (SimAllocation *)malloc(max_live * sizeof(SimAllocation));
+  if (!live || !caches[0] || !caches[1]) {
+    free(live);
+    slab_cache_destroy(caches[0]);
+    slab_cache_destroy(caches[1]);
+    pmm_destroy(pmm);
+    return false;
+  }
+
+  uint64_t rng = config->seed ? config->seed : 0x9E3779B97F4A7C15ull;
+  uint32_t owners = config->owners ? config->owners : 1;
+  uint32_t max_order =
+      config->max_order < PMM_MAX_ORDER ? config->max_order : PMM_MAX_ORDER;
+  uint64_t target = pmm->total_pages * config->fill_percent / 100;
+  uint64_t count = 0;
+
+  uint64_t start = sim_clock_ns();
+  for (uint64_t op = 0; op < config->operations; op++) {
+    if (sim_random(&rng) % 1000000 < config->release_per_million) {
+      // An owner exits: its page blocks go back in one call
+      uint32_t owner = 1 + (uint32_t)(sim_random(&rng) % owners);
+      if (pmm_release_owner(pmm, owner)) {
+        result->releases++;
+        for (uint64_t i = 0; i < count;) {
+          if (live[i].cache < 0 && live[i].owner == owner) {
+            live[i] = live[--count];
+          } else {
+            i++;
+          }
+        }
+      }
+      continue;
+    }
+
+    uint64_t used = atomic_load_explicit(&pmm->used_pages, memory_order_relaxed);
+    bool allocate = count == 0 || (count < max_live &&
+                                   sim_random(&rng) % 100 < (used < target ? 75u : 25u));
+    if (!allocate) {
+      uint64_t i = sim_random(&rng) % count;
+      if (live[i].cache < 0) {
+        pmm_free_pages(pmm, live[i].address);
+      } else {
+        slab_free(caches[live[i].cache], live[i].address);
+      }
+      live[i] = live[--count];
+      result->frees++;
+      continue;
+    }
+
+    SimAllocation allocation;
+    if (sim_random(&rng) % 100 < config->slab_percent) {
+      allocation.cache = (int32_t)(sim_random(&rng) % SIM_CACHES);
+      allocation.owner = PMM_OWNER_KERNEL;
+      allocation.address = slab_alloc(caches[allocation.cache]);
+    } else {
+      // Order k with probability about 2^-(k+1), the rest at order 0
+      uint32_t order = (uint32_t)__builtin_ctzll(sim_random(&rng) | (1ull << 63));
+      order = order <= max_order ? order : 0;
+      allocation.cache = -1;
+      allocation.owner = 1 + (uint32_t)(sim_random(&rng) % owners);
+      allocation.address = pmm_alloc_pages(pmm, order, allocation.owner);
+    }
+    if (!allocation.address) {
+      result->failures++;
+      continue;
+    }
+    live[count++] = allocation;
+    result->allocs++;
+  }
+  uint64_t elapsed = sim_clock_ns() - start;
+  result->ns_per_op = config->operations ? (double)elapsed / config->operations : 0.0;
+
+  uint64_t in_use = 0, capacity = 0;
+  for (uint32_t i = 0; i < SIM_CACHES; i++) {
+    SlabCacheStats stats;
+    slab_cache_get_stats(caches[i], &stats);
+    in_use += stats.in_use;
+    capacity += stats.capacity;
+  }
+  result->slab_utilization = capacity ? (double)in_use / capacity : 0.0;
+  pmm_get_stats(pmm, &result->after);
+
+  free(live);
+  slab_cache_destroy(caches[0]);
+  slab_cache_destroy(caches[1]);
+  pmm_destroy(pmm);
+  return true;
+}
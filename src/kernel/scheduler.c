@@ -0,0 +1,285 @@
+// Scheduler - multi-level feedback queue and simulation harness
+
+#include "scheduler.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+
+enum { PROCESS_READY = 0, PROCESS_RUNNING = 1, PROCESS_BLOCKED = 2 };
+
+static inline uint32_t level_bit(uint32_t level) {
+  return 0x80000000u >> level;
+}
+
+static inline uint32_t level_allotment(uint32_t level) {
+  return (uint32_t)SCHED_BASE_QUANTUM << level;
+}
+
+// Entities that missed a boost are on level 0 (their list was spliced
+// there) even though their fields still say otherwise.
+static uint32_t entity_level(Scheduler *sched, SchedEntity *entity) {
+  if (entity->epoch != sched->epoch) {
+    entity->epoch = sched->epoch;
+    entity->level = 0;
+    entity->allotment = level_allotment(0);
+    if (entity->process) {
+      entity->process->priority = 0;
+    }
+  }
+  return entity->level;
+}
+
+// ============================================================================
+// Run queues
+// ============================================================================
+
+void scheduler_init(Scheduler *sched, uint32_t boost_interval) {
+  memset(sched, 0, sizeof(*sched));
+  sched->boost_interval =
+      boost_interval ? boost_interval : SCHED_DEFAULT_BOOST_INTERVAL;
+  sched->next_boost = sched->boost_interval;
+}
+
+void scheduler_entity_init(Scheduler *sched, SchedEntity *entity,
+                           OSProcess *process) {
+  memset(entity, 0, sizeof(*entity));
+  entity->process = process;
+  entity->epoch = sched->epoch;
+  entity->allotment = level_allotment(0);
+  if (process) {
+    process->priority = 0;
+  }
+}
+
+void scheduler_enqueue(Scheduler *sched, SchedEntity *entity) {
+  if (entity->queued) {
+    return;
+  }
+  uint32_t level = entity_level(sched, entity);
+  entity->next = NULL;
+  entity->prev = sched->tail[level];
+  if (sched->tail[level]) {
+    sched->tail[level]->next = entity;
+  } else {
+    sched->head[level] = entity;
+  }
+  sched->tail[level] = entity;
+  sched->nonempty |= level_bit(level);
+  sched->queued++;
+  entity->queued = true;
+  entity->ready_since = sched->now;
+  if (entity->process) {
+    entity->process->state = PROCESS_READY;
+  }
+}
+
+void scheduler_dequeue(Scheduler *sched, SchedEntity *entity) {
+  if (!entity->queued) {
+    return;
+  }
+  uint32_t level = entity_level(sched, entity);
+  if (entity->prev) {
+    entity->prev->next = entity->next;
+  } else {
+    sched->head[level] = entity->next;
+  }
+  if (entity->next) {
+    entity->next->prev = entity->prev;
+  } else {
+    sched->tail[level] = entity->prev;
+  }
+  if (!sched->head[level]) {
+    sched->nonempty &= ~level_bit(level);
+  }
+  entity->prev = entity->next = NULL;
+  entity->queued = false;
+  sched->queued--;
+}
+
+SchedEntity *scheduler_pick_next(Scheduler *sched) {
+  if (!sched->nonempty) {
+    return NULL;
+  }
+  uint32_t level = (uint32_t)count_leading_zeros_u32(sched->nonempty);
+  SchedEntity *entity = sched->head[level];
+  scheduler_dequeue(sched, entity);
+
+  uint64_t latency = sched->now - entity->ready_since;
+  sched->dispatches++;
+  sched->total_latency += latency;
+  if (latency > sched->max_latency) {
+    sched->max_latency = latency;
+  }
+  if (entity->process) {
+    entity->process->state = PROCESS_RUNNING;
+  }
+  return entity;
+}
+
+void scheduler_adopt(Scheduler *sched, SchedEntity *entity) {
+  entity->epoch = sched->epoch;
+  entity->ready_since = sched->now;
+}
+
+bool scheduler_charge(Scheduler *sched, SchedEntity *entity, uint32_t ticks) {
+  uint32_t level = entity_level(sched, entity);
+  if (entity->process) {
+    entity->process->cpu_time += ticks;
+  }
+  if (ticks < entity->allotment) {
+    entity->allotment -= ticks;
+    return false;
+  }
+  if (level + 1 < SCHED_LEVELS) {
+    level++;
+  }
+  entity->level = level;
+  entity->allotment = level_allotment(level);
+  if (entity->process) {
+    entity->process->priority = level;
+  }
+  return true;
+}
+
+// Append every lower level to level 0, keeping FIFO order.
+static void scheduler_boost(Scheduler *sched) {
+  for (uint32_t level = 1; level < SCHED_LEVELS; level++) {
+    SchedEntity *head = sched->head[level];
+    if (!head) {
+      continue;
+    }
+    if (sched->tail[0]) {
+      sched->tail[0]->next = head;
+      head->prev = sched->tail[0];
+    } else {
+      sched->head[0] = head;
+    }
+    sched->tail[0] = sched->tail[level];
+    sched->head[level] = sched->tail[level] = NULL;
+  }
+  sched->nonempty = sched->head[0] ? level_bit(0) : 0;
+  sched->epoch++;
+}
+
+void scheduler_advance(Scheduler *sched, uint64_t ticks) {
+  sched->now += ticks;
+  if (sched->now >= sched->next_boost) {
+    scheduler_boost(sched);
+    sched->next_boost = sched->now + sched->boost_interval;
+  }
+}
+
+// ============================================================================
+// Simulation
+// ============================================================================
+
+#define SIM_WHEEL_SIZE 64 // longer than the longest sleep
+
+typedef struct SimProcess {
+  SchedEntity entity;
+  OSProcess process;
+  struct SimProcess *next_sleeper;
+  bool interactive;
+  uint32_t burst_left;
+} SimProcess;
+
+static inline uint64_t sim_random(uint64_t *state) {
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return *state = x;
+}
+
+bool scheduler_simulate(const SchedSimConfig *config, SchedSimResult *result) {
+  memset(result, 0, sizeof(*result));
+  uint32_t n = config->num_processes;
+  SimProcess *procs = (SimProcess *)calloc(n ? n : 1, sizeof(SimProcess));
+  if (!procs) {
+    return false;
+  }
+  SimProcess *wheel[SIM_WHEEL_SIZE] = {0};
+  uint64_t rng = config->seed ? config->seed : 0x9E3779B97F4A7C15ull;
+  Scheduler sched;
+  scheduler_init(&sched, config->boost_interval);
+
+  for (uint32_t i = 0; i < n; i++) {
+    SimProcess *p = &procs[i];
+    p->process.pid = i + 1;
+    p->interactive = sim_random(&rng) % 100 < config->interactive_percent;
+    p->burst_left = 1 + (uint32_t)(sim_random(&rng) % 3);
+    scheduler_entity_init(&sched, &p->entity, &p->process);
+    scheduler_enqueue(&sched, &p->entity);
+  }
+
+  uint64_t interactive_dispatches = 0;
+  uint64_t interactive_latency = 0;
+  SimProcess *running = NULL;
+  for (uint64_t t = 0; t < config->ticks; t++) {
+    // Wake sleepers due this tick.
+    SimProcess **slot = &wheel[sched.now % SIM_WHEEL_SIZE];
+    while (*slot) {
+      SimProcess *p = *slot;
+      *slot = p->next_sleeper;
+      p->burst_left = 1 + (uint32_t)(sim_random(&rng) % 3);
+      scheduler_enqueue(&sched, &p->entity);
+    }
+
+    if (!running) {
+      uint64_t before = sched.total_latency;
+      running = (SimProcess *)scheduler_pick_next(&sched);
+      if (running && running->interactive) {
+        interactive_dispatches++;
+        interactive_latency += sched.total_latency - before;
+      }
+    }
+    if (running) {
+      bool expired = scheduler_charge(&sched, &running->entity, 1);
+      if (running->interactive && --running->burst_left == 0) {
+        // Block until a wakeup 4..59 ticks out.
+        uint64_t sleep = 4 + sim_random(&rng) % (SIM_WHEEL_SIZE - 4);
+        SimProcess **wake = &wheel[(sched.now + sleep) % SIM_WHEEL_SIZE];
+        running->process.state = PROCESS_BLOCKED;
+        running->next_sleeper = *wake;
+        *wake = running;
+        running = NULL;
+      } else if (expired) {
+        scheduler_enqueue(&sched, &running->entity);
+        running = NULL;
+      }
+    }
+    scheduler_advance(&sched, 1);
+  }
+
+  result->dispatches = sched.dispatches;
+  result->max_latency = sched.max_latency;
+  result->mean_latency =
+      sched.dispatches ? (double)sched.total_latency / sched.dispatches : 0.0;
+  result->interactive_mean_latency =
+      interactive_dispatches
+          ? (double)interactive_latency / interactive_dispatches
+          : 0.0;
+
+  double sum = 0.0;
+  double sum_sq = 0.0;
+  uint32_t cpu_bound = 0;
+  result->min_cpu_time = UINT64_MAX;
+  for (uint32_t i = 0; i < n; i++) {
+    if (procs[i].interactive) {
+      continue;
+    }
+    double c = (double)procs[i].process.cpu_time;
+    sum += c;
+    sum_sq += c * c;
+    cpu_bound++;
+    if (procs[i].process.cpu_time < result->min_cpu_time) {
+      result->min_cpu_time = procs[i].process.cpu_time;
+    }
+  }
+  if (cpu_bound == 0) {
+    result->min_cpu_time = 0;
+  }
+  result->fairness = sum_sq > 0.0 ? (sum * sum) / (cpu_bound * sum_sq) : 1.0;
+  free(procs);
+  return true;
+}
@@ -0,0 +1,810 @@
+// Message store - segmented append-only log with a per-conversation index
+
+#include "MessageStore.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace OS {
+namespace System {
+
+namespace {
+
+constexpr uint32_t kRecordMessage = 1;
+constexpr uint32_t kRecordRemove = 2; // tombstone for a whole conversation
+constexpr uint32_t kMaxRecordBytes = 16u << 20;
+
+constexpr char kSidecarMagic[4] = {'O', 'S', 'M', 'I'};
+constexpr uint32_t kSidecarVersion = 1;
+
+struct RecordHeader {
+  uint32_t crc;    // CRC-32 of everything after this field
+  uint32_t length; // whole record
+  uint64_t seq;
+  uint32_t type;
+  uint32_t conversation_length;
+  // conversation bytes, then the body
+};
+
+struct MessageHeader {
+  int64_t timestamp;
+  uint32_t sender_length;
+  uint32_t text_length;
+  uint32_t time_length;
+  uint32_t reserved;
+  // sender, text and time bytes
+};
+
+struct SidecarHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t segment_size; // the log it describes must still be this long
+  uint32_t count;
+  uint32_t crc; // of the entries
+  uint32_t reserved;
+};
+
+struct SidecarEntry {
+  uint64_t seq;
+  uint32_t offset;
+  uint32_t length;
+  uint32_t type;
+  uint32_t conversation_length;
+  // conversation bytes
+};
+
+uint32_t crc32(const void *data, size_t length) {
+  static const struct Table {
+    uint32_t entries[256];
+    Table() {
+      for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+          c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        entries[i] = c;
+      }
+    }
+  } table;
+  const uint8_t *p = (const uint8_t *)data;
+  uint32_t crc = 0xFFFFFFFFu;
+  for (size_t i = 0; i < length; i++) {
+    crc = table.entries[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return crc ^ 0xFFFFFFFFu;
+}
+
+bool preadAll(int fd, void *data, size_t size, off_t offset) {
+  char *p = (char *)data;
+  while (size > 0) {
+    ssize_t n = ::pread(fd, p, size, offset);
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= (size_t)n;
+    offset += n;
+  }
+  return true;
+}
+
+bool pwriteAll(int fd, const void *data, size_t size, off_t offset) {
+  const char *p = (const char *)data;
+  while (size > 0) {
+    ssize_t n = ::pwrite(fd, p, size, offset);
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= (size_t)n;
+    offset += n;
+  }
+  return true;
+}
+
+// Checks a record in place; available is how many bytes follow it.
+bool validRecord(const char *data, size_t available) {
+  if (available < sizeof(RecordHeader)) {
+    return false;
+  }
+  RecordHeader header;
+  std::memcpy(&header, data, sizeof(header));
+  return header.length >= sizeof(header) + header.conversation_length &&
+         header.length <= available && header.length <= kMaxRecordBytes &&
+         crc32(data + sizeof(header.crc), header.length - sizeof(header.crc)) ==
+             header.crc;
+}
+
+bool decodeMessage(const char *data, StoredMessage &message) {
+  RecordHeader header;
+  std::memcpy(&header, data, sizeof(header));
+  const char *body = data + sizeof(header) + header.conversation_length;
+  size_t body_length =
+      header.length - sizeof(header) - header.conversation_length;
+  MessageHeader fields;
+  if (header.type != kRecordMessage || body_length < sizeof(fields)) {
+    return false;
+  }
+  std::memcpy(&fields, body, sizeof(fields));
+  if ((uint64_t)fields.sender_length + fields.text_length +
+          fields.time_length >
+      body_length - sizeof(fields)) {
+    return false;
+  }
+  const char *p = body + sizeof(fields);
+  message.sender.assign(p, fields.sender_length);
+  p += fields.sender_length;
+  message.text.assign(p, fields.text_length);
+  p += fields.text_length;
+  message.time.assign(p, fields.time_length);
+  message.timestamp = fields.timestamp;
+  return true;
+}
+
+// "0000002a.log" -> 42
+bool parseSegmentName(const char *name, uint32_t &id) {
+  if (std::strlen(name) != 12 || std::strcmp(name + 8, ".log") != 0) {
+    return false;
+  }
+  char *end = nullptr;
+  unsigned long value = std::strtoul(name, &end, 16);
+  if (end != name + 8) {
+    return false;
+  }
+  id = (uint32_t)value;
+  return true;
+}
+
+} // namespace
+
+// ============================================================================
+// Lifecycle
+// ============================================================================
+
+MessageStore::MessageStore(uint32_t segment_bytes)
+    : segment_bytes(std::max<uint32_t>(segment_bytes, 4096)), active_id(0),
+      next_id(0), next_seq(1), compactions(0), auto_compact(true),
+      compacting(false) {}
+
+MessageStore::~MessageStore() { close(); }
+
+std::string MessageStore::segmentPath(uint32_t id, const char *suffix) const {
+  char name[32];
+  snprintf(name, sizeof(name), "/%08x%s", id, suffix);
+  return directory + name;
+}
+
+bool MessageStore::open(const std::string &path) {
+  std::unique_lock<std::mutex> guard(lock);
+  closeLocked(guard);
+  mkdir(path.c_str(), 0755);
+  DIR *dir = opendir(path.c_str());
+  if (!dir) {
+    return false;
+  }
+  directory = path;
+
+  std::vector<uint32_t> ids;
+  while (struct dirent *entry = readdir(dir)) {
+    uint32_t id;
+    size_t length = std::strlen(entry->d_name);
+    if (parseSegmentName(entry->d_name, id)) {
+      ids.push_back(id);
+    } else if (length > 4 &&
+               std::strcmp(entry->d_name + length - 4, ".tmp") == 0) {
+      // Left by a compaction or sidecar write that never finished
+      unlink((directory + "/" + entry->d_name).c_str());
+    }
+  }
+  closedir(dir);
+  std::sort(ids.begin(), ids.end());
+
+  // Sealed segments come back from their sidecars; the rest are scanned,
+  // losing any torn record at the end.
+  std::vector<IndexEntry> all;
+  for (size_t i = 0; i < ids.size(); i++) {
+    uint32_t id = ids[i];
+    int fd = ::open(segmentPath(id, ".log").c_str(), O_RDWR);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+      if (fd >= 0) {
+        ::close(fd);
+      }
+      continue;
+    }
+    uint32_t size = (uint32_t)st.st_size;
+    std::vector<IndexEntry> entries;
+    bool sealed = readSidecar(id, size, entries);
+    if (!sealed) {
+      entries.clear();
+      uint32_t valid = scanSegment(id, fd, size, entries);
+      if (valid < size && ftruncate(fd, valid) == 0) {
+        size = valid;
+      }
+      if (i + 1 < ids.size()) {
+        writeSidecar(id, size, entries); // only the newest stays open
+        sealed = true;
+      }
+    }
+    segments[id] = Segment{fd, size, 0, sealed};
+    if (!sealed) {
+      active_id = id;
+      active_entries = entries;
+    }
+    next_id = std::max(next_id, id + 1);
+    all.insert(all.end(), entries.begin(), entries.end());
+  }
+
+  // Replay in sequence order. A record copied by a compaction that was
+  // interrupted before deleting its inputs shows up twice; the copy is
+  // dead weight until the next compaction.
+  std::sort(all.begin(), all.end(),
+            [](const IndexEntry &a, const IndexEntry &b) {
+              return a.location.seq < b.location.seq;
+            });
+  for (const IndexEntry &entry : all) {
+    const Location &location = entry.location;
+    next_seq = std::max(next_seq, location.seq + 1);
+    if (entry.type == kRecordRemove) {
+      dropConversation(entry.conversation);
+    } else if (entry.type == kRecordMessage) {
+      std::vector<Location> &messages = conversations[entry.conversation];
+      if (!messages.empty() && messages.back().seq == location.seq) {
+        continue;
+      }
+      messages.push_back(location);
+      segments[location.segment].live += location.length;
+    }
+  }
+
+  auto active = segments.find(active_id);
+  if ((active == segments.end() || active->second.sealed) &&
+      !startSegment()) {
+    closeLocked(guard);
+    return false;
+  }
+  maybeCompact();
+  return true;
+}
+
+void MessageStore::close() {
+  std::unique_lock<std::mutex> guard(lock);
+  closeLocked(guard);
+}
+
+void MessageStore::closeLocked(std::unique_lock<std::mutex> &guard) {
+  compaction_done.wait(guard, [this] { return !compacting; });
+  if (compactor.joinable()) {
+    compactor.join(); // already past its last use of the lock
+  }
+  auto active = segments.find(active_id);
+  if (active != segments.end() && !active->second.sealed) {
+    fsync(active->second.fd);
+  }
+  for (auto &kv : segments) {
+    ::close(kv.second.fd);
+  }
+  segments.clear();
+  conversations.clear();
+  active_entries.clear();
+  directory.clear();
+  active_id = 0;
+  next_id = 0;
+  next_seq = 1;
+}
+
+bool MessageStore::isOpen() const {
+  std::lock_guard<std::mutex> guard(lock);
+  return !directory.empty();
+}
+
+// ============================================================================
+// Segments and sidecars
+// ============================================================================
+
+uint32_t MessageStore::scanSegment(uint32_t id, int fd, uint32_t size,
+                                   std::vector<IndexEntry> &entries) {
+  std::string data(size, '\0');
+  if (size > 0 && !preadAll(fd, &data[0], size, 0)) {
+    return 0;
+  }
+  uint32_t offset = 0;
+  while (offset < size && validRecord(data.data() + offset, size - offset)) {
+    RecordHeader header;
+    std::memcpy(&header, data.data() + offset, sizeof(header));
+    entries.push_back(IndexEntry{
+        Location{header.seq, id, offset, header.length}, header.type,
+        data.substr(offset + sizeof(header), header.conversation_length)});
+    offset += header.length;
+  }
+  return offset;
+}
+
+bool MessageStore::readSidecar(uint32_t id, uint32_t size,
+                               std::vector<IndexEntry> &entries) const {
+  int fd = ::open(segmentPath(id, ".idx").c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  std::string data;
+  if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(SidecarHeader)) {
+    data.resize((size_t)st.st_size);
+    if (!preadAll(fd, &data[0], data.size(), 0)) {
+      data.clear();
+    }
+  }
+  ::close(fd);
+
+  SidecarHeader header;
+  if (data.size() < sizeof(header)) {
+    return false;
+  }
+  std::memcpy(&header, data.data(), sizeof(header));
+  const char *p = data.data() + sizeof(header);
+  size_t remaining = data.size() - sizeof(header);
+  if (std::memcmp(header.magic, kSidecarMagic, sizeof(header.magic)) != 0 ||
+      header.version != kSidecarVersion || header.segment_size != size ||
+      crc32(p, remaining) != header.crc) {
+    return false;
+  }
+  for (uint32_t i = 0; i < header.count; i++) {
+    SidecarEntry entry;
+    if (remaining < sizeof(entry)) {
+      return false;
+    }
+    std::memcpy(&entry, p, sizeof(entry));
+    p += sizeof(entry);
+    remaining -= sizeof(entry);
+    if (remaining < entry.conversation_length ||
+        (uint64_t)entry.offset + entry.length > size) {
+      return false;
+    }
+    entries.push_back(IndexEntry{
+        Location{entry.seq, id, entry.offset, entry.length}, entry.type,
+        std::string(p, entry.conversation_length)});
+    p += entry.conversation_length;
+    remaining -= entry.conversation_length;
+  }
+  return true;
+}
+
+bool MessageStore::writeSidecar(uint32_t id, uint32_t size,
+                                const std::vector<IndexEntry> &entries) const {
+  std::string data(sizeof(SidecarHeader), '\0');
+  for (const IndexEntry &entry : entries) {
+    SidecarEntry out{entry.location.seq, entry.location.offset,
+                     entry.location.length, entry.type,
+                     (uint32_t)entry.conversation.size()};
+    data.append((const char *)&out, sizeof(out));
+    data += entry.conversation;
+  }
+  SidecarHeader header;
+  std::memcpy(header.magic, kSidecarMagic, sizeof(header.magic));
+  header.version = kSidecarVersion;
+  header.segment_size = size;
+  header.count = (uint32_t)entries.size();
+  header.crc = crc32(data.data() + sizeof(header), data.size() - sizeof(header));
+  header.reserved = 0;
+  std::memcpy(&data[0], &header, sizeof(header));
+
+  std::string path = segmentPath(id, ".idx");
+  std::string temp = path + ".tmp";
+  int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  bool ok = pwriteAll(fd, data.data(), data.size(), 0);
+  ok = ::close(fd) == 0 && ok;
+  if (!ok || rename(temp.c_str(), path.c_str()) != 0) {
+    unlink(temp.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool MessageStore::startSegment() {
+  uint32_t id = next_id++;
+  int fd = ::open(segmentPath(id, ".log").c_str(), O_RDWR | O_CREAT | O_TRUNC,
+                  0644);
+  if (fd < 0) {
+    return false;
+  }
+  segments[id] = Segment{fd, 0, 0, false};
+  active_id = id;
+  active_entries.clear();
+  return true;
+}
+
+// A missing sidecar only costs a scan on the next open, so sealing
+// doesn't fail because of it.
+bool MessageStore::sealActive() {
+  Segment &active = segments[active_id];
+  if (fsync(active.fd) != 0) {
+    return false;
+  }
+  writeSidecar(active_id, active.size, active_entries);
+  active.sealed = true;
+  active_entries.clear();
+  return true;
+}
+
+// ============================================================================
+// Writing
+// ============================================================================
+
+bool MessageStore::appendRecord(uint32_t type, const std::string &conversation,
+                                const std::string &body) {
+  size_t length = sizeof(RecordHeader) + conversation.size() + body.size();
+  auto found = segments.find(active_id);
+  if (found == segments.end() || length > kMaxRecordBytes) {
+    return false;
+  }
+  Segment *active = &found->second;
+  if (active->sealed || (active->size > 0 &&
+                         (uint64_t)active->size + length > segment_bytes)) {
+    if ((!active->sealed && !sealActive()) || !startSegment()) {
+      return false;
+    }
+    active = &segments[active_id];
+    maybeCompact();
+  }
+
+  RecordHeader header;
+  header.length = (uint32_t)length;
+  header.seq = next_seq;
+  header.type = type;
+  header.conversation_length = (uint32_t)conversation.size();
+  std::string record((const char *)&header, sizeof(header));
+  record += conversation;
+  record += body;
+  header.crc = crc32(record.data() + sizeof(header.crc),
+                     record.size() - sizeof(header.crc));
+  std::memcpy(&record[0], &header.crc, sizeof(header.crc));
+
+  if (!pwriteAll(active->fd, record.data(), record.size(), active->size)) {
+    ftruncate(active->fd, active->size);
+    return false;
+  }
+  Location location{next_seq++, active_id, active->size, (uint32_t)length};
+  active->size += (uint32_t)length;
+  active_entries.push_back(IndexEntry{location, type, conversation});
+  if (type == kRecordMessage) {
+    conversations[conversation].push_back(location);
+    active->live += (uint32_t)length;
+  }
+  return true;
+}
+
+bool MessageStore::append(const std::string &conversation,
+                          const StoredMessage &message) {
+  MessageHeader fields;
+  fields.timestamp = message.timestamp;
+  fields.sender_length = (uint32_t)message.sender.size();
+  fields.text_length = (uint32_t)message.text.size();
+  fields.time_length = (uint32_t)message.time.size();
+  fields.reserved = 0;
+  std::string body((const char *)&fields, sizeof(fields));
+  body += message.sender;
+  body += message.text;
+  body += message.time;
+
+  std::lock_guard<std::mutex> guard(lock);
+  return appendRecord(kRecordMessage, conversation, body);
+}
+
+void MessageStore::dropConversation(const std::string &conversation) {
+  auto it = conversations.find(conversation);
+  if (it == conversations.end()) {
+    return;
+  }
+  for (const Location &location : it->second) {
+    segments[location.segment].live -= location.length;
+  }
+  conversations.erase(it);
+}
+
+bool MessageStore::removeConversation(const std::string &conversation) {
+  std::lock_guard<std::mutex> guard(lock);
+  if (conversations.find(conversation) == conversations.end() ||
+      !appendRecord(kRecordRemove, conversation, std::string())) {
+    return false;
+  }
+  dropConversation(conversation);
+  maybeCompact();
+  return true;
+}
+
+bool MessageStore::sync() {
+  std::lock_guard<std::mutex> guard(lock);
+  auto active = segments.find(active_id);
+  return active != segments.end() && fsync(active->second.fd) == 0;
+}
+
+// ============================================================================
+// Reading
+// ============================================================================
+
+std::vector<std::string> MessageStore::getConversations() const {
+  std::lock_guard<std::mutex> guard(lock);
+  std::vector<std::string> names;
+  names.reserve(conversations.size());
+  for (const auto &kv : conversations) {
+    names.push_back(kv.first);
+  }
+  return names;
+}
+
+size_t MessageStore::getMessageCount(const std::string &conversation) const {
+  std::lock_guard<std::mutex> guard(lock);
+  auto it = conversations.find(conversation);
+  return it == conversations.end() ? 0 : it->second.size();
+}
+
+// Records that sit back to back in one segment (the common case for a
+// conversation, and always after compaction) are fetched with one pread.
+size_t MessageStore::read(const std::string &conversation, size_t first,
+                          size_t count, std::vector<StoredMessage> &out) const {
+  std::lock_guard<std::mutex> guard(lock);
+  auto it = conversations.find(conversation);
+  if (it == conversations.end() || first >= it->second.size()) {
+    return 0;
+  }
+  const std::vector<Location> &messages = it->second;
+  size_t end = first + std::min(count, messages.size() - first);
+  size_t read_count = 0;
+  std::string buffer;
+  for (size_t i = first; i < end;) {
+    size_t run_end = i + 1;
+    while (run_end < end &&
+           messages[run_end].segment == messages[i].segment &&
+           messages[run_end].offset == messages[run_end - 1].offset +
+                                           messages[run_end - 1].length) {
+      run_end++;
+    }
+    const Location &start = messages[i];
+    const Location &last = messages[run_end - 1];
+    size_t bytes = last.offset + last.length - start.offset;
+    buffer.resize(bytes);
+    if (preadAll(segments.at(start.segment).fd, &buffer[0], bytes,
+                 start.offset)) {
+      for (size_t k = i; k < run_end; k++) {
+        const char *record = buffer.data() + (messages[k].offset - start.offset);
+        StoredMessage message;
+        if (validRecord(record, messages[k].length) &&
+            decodeMessage(record, message)) {
+          out.push_back(std::move(message));
+          read_count++;
+        }
+      }
+    }
+    i = run_end;
+  }
+  return read_count;
+}
+
+MessageStoreStats MessageStore::getStats() const {
+  std::lock_guard<std::mutex> guard(lock);
+  MessageStoreStats stats = {};
+  stats.segments = (uint32_t)segments.size();
+  for (const auto &kv : conversations) {
+    stats.messages += kv.second.size();
+  }
+  for (const auto &kv : segments) {
+    stats.live_bytes += kv.second.live;
+    if (kv.second.sealed) {
+      stats.dead_bytes += kv.second.size - kv.second.live;
+    }
+  }
+  stats.compactions = compactions;
+  return stats;
+}
+
+// ============================================================================
+// Compaction
+// ============================================================================
+
+void MessageStore::setAutoCompact(bool enabled) {
+  std::lock_guard<std::mutex> guard(lock);
+  auto_compact = enabled;
+  maybeCompact();
+}
+
+// Caller holds the lock.
+void MessageStore::maybeCompact() {
+  if (!auto_compact || compacting || directory.empty()) {
+    return;
+  }
+  uint64_t sealed = 0;
+  uint64_t dead = 0;
+  for (const auto &kv : segments) {
+    if (kv.second.sealed) {
+      sealed += kv.second.size;
+      dead += kv.second.size - kv.second.live;
+    }
+  }
+  if (dead == 0 || dead * 2 < sealed) {
+    return;
+  }
+  if (compactor.joinable()) {
+    compactor.join(); // finished; compacting is already false
+  }
+  compacting = true;
+  compactor = std::thread([this] {
+    std::unique_lock<std::mutex> guard(lock);
+    compactSealed(guard);
+    compacting = false;
+    compaction_done.notify_all();
+  });
+}
+
+bool MessageStore::compact() {
+  std::unique_lock<std::mutex> guard(lock);
+  compaction_done.wait(guard, [this] { return !compacting; });
+  auto active = segments.find(active_id);
+  if (active == segments.end()) {
+    return false;
+  }
+  if (active->second.size > 0 && (!sealActive() || !startSegment())) {
+    return false;
+  }
+  compacting = true;
+  bool ok = compactSealed(guard);
+  compacting = false;
+  compaction_done.notify_all();
+  return ok;
+}
+
+// Copies the live records of every sealed segment into fresh segments,
+// grouped by conversation, then swaps the index over and deletes the
+// inputs. The copying runs unlocked: sealed segments never change and the
+// active one isn't touched, so appends and reads carry on meanwhile.
+bool MessageStore::compactSealed(std::unique_lock<std::mutex> &guard) {
+  struct Move {
+    std::string name;
+    Location from;
+    Location to;
+  };
+
+  std::vector<uint32_t> inputs;
+  for (const auto &kv : segments) {
+    if (kv.second.sealed) {
+      inputs.push_back(kv.first);
+    }
+  }
+  if (inputs.empty()) {
+    return true;
+  }
+  std::sort(inputs.begin(), inputs.end());
+  auto isInput = [&inputs](uint32_t id) {
+    return std::binary_search(inputs.begin(), inputs.end(), id);
+  };
+
+  // Plan the output layout up front so the ids can be reserved now.
+  std::vector<Move> moves;
+  std::vector<uint32_t> output_sizes;
+  for (const auto &kv : conversations) {
+    for (const Location &location : kv.second) {
+      if (!isInput(location.segment)) {
+        continue;
+      }
+      if (output_sizes.empty() ||
+          (output_sizes.back() > 0 &&
+           (uint64_t)output_sizes.back() + location.length > segment_bytes)) {
+        output_sizes.push_back(0);
+      }
+      Location to{location.seq, (uint32_t)output_sizes.size() - 1,
+                  output_sizes.back(), location.length};
+      output_sizes.back() += location.length;
+      moves.push_back(Move{kv.first, location, to});
+    }
+  }
+  uint32_t first_output = next_id;
+  next_id += (uint32_t)output_sizes.size();
+  for (Move &move : moves) {
+    move.to.segment += first_output;
+  }
+  std::vector<int> input_fds;
+  for (uint32_t id : inputs) {
+    input_fds.push_back(dup(segments[id].fd));
+  }
+  guard.unlock();
+
+  bool ok = true;
+  std::vector<int> output_fds;
+  size_t next_move = 0;
+  for (size_t n = 0; n < output_sizes.size() && ok; n++) {
+    uint32_t id = first_output + (uint32_t)n;
+    std::string data;
+    data.reserve(output_sizes[n]);
+    std::vector<IndexEntry> entries;
+    for (; next_move < moves.size() && moves[next_move].to.segment == id;
+         next_move++) {
+      Move &move = moves[next_move];
+      size_t input = std::lower_bound(inputs.begin(), inputs.end(),
+                                      move.from.segment) -
+                     inputs.begin();
+      size_t offset = data.size();
+      data.resize(offset + move.from.length);
+      if (!preadAll(input_fds[input], &data[offset], move.from.length,
+                    move.from.offset) ||
+          !validRecord(data.data() + offset, move.from.length)) {
+        ok = false;
+        break;
+      }
+      entries.push_back(IndexEntry{move.to, kRecordMessage, move.name});
+    }
+    if (!ok) {
+      break;
+    }
+    std::string path = segmentPath(id, ".log");
+    std::string temp = path + ".tmp";
+    int fd = ::open(temp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    ok = fd >= 0 && pwriteAll(fd, data.data(), data.size(), 0) &&
+         fsync(fd) == 0 && writeSidecar(id, (uint32_t)data.size(), entries) &&
+         rename(temp.c_str(), path.c_str()) == 0;
+    if (!ok) {
+      if (fd >= 0) {
+        ::close(fd);
+      }
+      unlink(temp.c_str());
+      break;
+    }
+    output_fds.push_back(fd);
+  }
+  for (int fd : input_fds) {
+    ::close(fd);
+  }
+
+  guard.lock();
+  if (!ok) {
+    for (size_t n = 0; n < output_sizes.size(); n++) {
+      uint32_t id = first_output + (uint32_t)n;
+      if (n < output_fds.size()) {
+        ::close(output_fds[n]);
+        unlink(segmentPath(id, ".log").c_str());
+      }
+      unlink(segmentPath(id, ".idx").c_str());
+    }
+    return false;
+  }
+
+  // Point the index at the copies. A conversation removed meanwhile just
+  // leaves its copies dead in the new segments.
+  std::vector<uint32_t> live(output_sizes.size(), 0);
+  for (const Move &move : moves) {
+    auto it = conversations.find(move.name);
+    if (it == conversations.end()) {
+      continue;
+    }
+    std::vector<Location> &messages = it->second;
+    auto found = std::lower_bound(
+        messages.begin(), messages.end(), move.from.seq,
+        [](const Location &a, uint64_t seq) { return a.seq < seq; });
+    if (found != messages.end() && found->seq == move.from.seq &&
+        found->segment == move.from.segment) {
+      *found = move.to;
+      live[move.to.segment - first_output] += move.to.length;
+    }
+  }
+  for (uint32_t id : inputs) {
+    ::close(segments[id].fd);
+    unlink(segmentPath(id, ".log").c_str());
+    unlink(segmentPath(id, ".idx").c_str());
+    segments.erase(id);
+  }
+  for (size_t n = 0; n < output_sizes.size(); n++) {
+    segments[first_output + (uint32_t)n] =
+        Segment{output_fds[n], output_sizes[n], live[n], true};
+  }
+  compactions++;
+  return true;
+}
+
+} // namespace System
+} // namespace OS
@@ -0,0 +1,547 @@
+// Process runner - commands on pseudo-terminals, one multiplexed I/O thread
+
+#include "ProcessRunner.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+
+#ifdef __APPLE__
+#include <sys/event.h>
+#else
+#include <sys/epoll.h>
+#endif
+
+namespace OS {
+namespace System {
+
+namespace {
+
+constexpr uint32_t kWakeToken = 0;
+constexpr size_t kReadChunk = 64 * 1024;
+constexpr int kReapIntervalMs = 50; // waitpid polling while commands run
+constexpr int kMaxEvents = 64;
+
+std::mutex g_ptsname_lock; // ptsname() returns a static buffer
+
+void setFlags(int fd) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+// Thin layer over kqueue / epoll: level-triggered read interest per fd,
+// identified by a 32-bit token.
+int pollerCreate() {
+#ifdef __APPLE__
+  int fd = kqueue();
+#else
+  int fd = epoll_create1(0);
+#endif
+  if (fd >= 0) {
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+  }
+  return fd;
+}
+
+void pollerWatch(int poll_fd, int fd, uint32_t token, bool enable) {
+#ifdef __APPLE__
+  struct kevent change;
+  EV_SET(&change, fd, EVFILT_READ, EV_ADD | (enable ? EV_ENABLE : EV_DISABLE),
+         0, 0, (void *)(uintptr_t)token);
+  kevent(poll_fd, &change, 1, nullptr, 0, nullptr);
+#else
+  struct epoll_event event;
+  std::memset(&event, 0, sizeof(event));
+  event.events = enable ? (uint32_t)EPOLLIN : 0u;
+  event.data.u32 = token;
+  if (epoll_ctl(poll_fd, EPOLL_CTL_MOD, fd, &event) != 0) {
+    epoll_ctl(poll_fd, EPOLL_CTL_ADD, fd, &event);
+  }
+#endif
+}
+
+void pollerForget(int poll_fd, int fd) {
+#ifdef __APPLE__
+  struct kevent change;
+  EV_SET(&change, fd, EVFILT_READ, EV_DELETE, 0, 0, nullptr);
+  kevent(poll_fd, &change, 1, nullptr, 0, nullptr);
+#else
+  epoll_ctl(poll_fd, EPOLL_CTL_DEL, fd, nullptr);
+#endif
+}
+
+int pollerWait(int poll_fd, uint32_t *tokens, int max, int timeout_ms) {
+#ifdef __APPLE__
+  struct kevent events[kMaxEvents];
+  struct timespec timeout = {timeout_ms / 1000,
+                             (long)(timeout_ms % 1000) * 1000000};
+  int n = kevent(poll_fd, nullptr, 0, events, std::min(max, kMaxEvents),
+                 timeout_ms < 0 ? nullptr : &timeout);
+  for (int i = 0; i < n; i++) {
+    tokens[i] = (uint32_t)(uintptr_t)events[i].udata;
+  }
+#else
+  struct epoll_event events[kMaxEvents];
+  int n = epoll_wait(poll_fd, events, std::min(max, kMaxEvents), timeout_ms);
+  for (int i = 0; i < n; i++) {
+    tokens[i] = events[i].data.u32;
+  }
+#endif
+  return n;
+}
+
+} // namespace
+
+ProcessRunner::ProcessRunner(size_t queue_limit)
+    : queue_limit(std::max<size_t>(queue_limit, kReadChunk)), next_id(1),
+      poll_fd(-1), wake_fds{-1, -1}, stopping(false) {}
+
+ProcessRunner::~ProcessRunner() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stopping = true;
+  }
+  if (io_thread.joinable()) {
+    wake();
+    io_thread.join();
+  }
+  for (auto &entry : sessions) {
+    Session &session = *entry.second;
+    if (!session.exited) {
+      kill(-session.pid, SIGHUP);
+      if (waitpid(session.pid, &session.status, WNOHANG) == 0) {
+        kill(-session.pid, SIGKILL);
+        waitpid(session.pid, &session.status, 0);
+      }
+    }
+    if (session.master >= 0) {
+      close(session.master);
+    }
+  }
+  for (int fd : {poll_fd, wake_fds[0], wake_fds[1]}) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+}
+
+void ProcessRunner::setNotify(Notify notify) {
+  std::lock_guard<std::mutex> guard(lock);
+  notify_fn = std::move(notify);
+}
+
+// The I/O thread starts with the first command. Caller holds the lock.
+void ProcessRunner::start() {
+  if (io_thread.joinable()) {
+    return;
+  }
+  poll_fd = pollerCreate();
+  if (poll_fd < 0 || pipe(wake_fds) != 0) {
+    return;
+  }
+  setFlags(wake_fds[0]);
+  setFlags(wake_fds[1]);
+  pollerWatch(poll_fd, wake_fds[0], kWakeToken, true);
+  io_thread = std::thread(&ProcessRunner::loop, this);
+}
+
+void ProcessRunner::wake() {
+  char byte = 0;
+  ssize_t ignored = ::write(wake_fds[1], &byte, 1); // full pipe: already woken
+  (void)ignored;
+}
+
+void ProcessRunner::closeMaster(Session &session) {
+  if (session.master >= 0) {
+    if (session.polling) {
+      pollerForget(poll_fd, session.master);
+    }
+    close(session.master);
+    session.master = -1;
+    session.polling = false;
+  }
+}
+
+// ============================================================================
+// Spawning
+// ============================================================================
+
+uint32_t ProcessRunner::spawn(const ProcessOptions &options) {
+  std::lock_guard<std::mutex> guard(lock);
+  start();
+  if (!io_thread.joinable()) {
+    return 0;
+  }
+
+  // Both ends are close-on-exec, so commands that other threads spawn
+  // meanwhile do not inherit them. glibc and musl pass O_CLOEXEC through to
+  // the open of /dev/ptmx. macOS's posix_openpt rejects it, so there the
+  // master is inheritable until the fcntl below, and a fork/exec on another
+  // thread in that window keeps a copy.
+#ifdef __APPLE__
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+#else
+  int master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+#endif
+  if (master < 0) {
+    return 0;
+  }
+  fcntl(master, F_SETFD, FD_CLOEXEC); // already set, except on macOS
+  int slave = -1;
+  if (grantpt(master) == 0 && unlockpt(master) == 0) {
+    std::lock_guard<std::mutex> name_guard(g_ptsname_lock);
+    const char *name = ptsname(master);
+    if (name) {
+      slave = ::open(name, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    }
+  }
+  if (slave < 0) {
+    close(master);
+    return 0;
+  }
+  struct winsize size;
+  std::memset(&size, 0, sizeof(size));
+  size.ws_col = options.cols;
+  size.ws_row = options.rows;
+  ioctl(slave, TIOCSWINSZ, &size);
+
+  // Everything the child needs is built before fork; after it only
+  // async-signal-safe calls are allowed.
+  std::vector<char *> argv;
+  argv.push_back(const_cast<char *>(options.program.c_str()));
+  for (const std::string &arg : options.args) {
+    argv.push_back(const_cast<char *>(arg.c_str()));
+  }
+  argv.push_back(nullptr);
+  std::vector<char *> envp;
+  for (const std::string &var : options.env) {
+    envp.push_back(const_cast<char *>(var.c_str()));
+  }
+  envp.push_back(nullptr);
+  const char *cwd = options.cwd.empty() ? nullptr : options.cwd.c_str();
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, nullptr);
+    for (int signo : {SIGINT, SIGQUIT, SIGPIPE, SIGCHLD, SIGTSTP}) {
+      ::signal(signo, SIG_DFL);
+    }
+    setsid();
+    ioctl(slave, TIOCSCTTY, 0);
+    dup2(slave, STDIN_FILENO);
+    dup2(slave, STDOUT_FILENO);
+    dup2(slave, STDERR_FILENO);
+    if (slave > STDERR_FILENO) {
+      close(slave);
+    } else {
+      fcntl(slave, F_SETFD, 0); // dup2 onto itself keeps close-on-exec
+    }
+    close(master);
+    if (cwd && chdir(cwd) != 0) {
+      _exit(126);
+    }
+    execve(argv[0], argv.data(), envp.data());
+    _exit(127);
+  }
+  close(slave);
+  if (pid < 0) {
+    close(master);
+    return 0;
+  }
+
+  setFlags(master);
+  uint32_t id = next_id++;
+  if (next_id == kWakeToken) {
+    next_id = 1;
+  }
+  std::unique_ptr<Session> session(new Session{
+      master, (int)pid, std::string(), 0, true, false, false, false, false,
+      0});
+  pollerWatch(poll_fd, master, id, true);
+  sessions[id] = std::move(session);
+  return id;
+}
+
+// ============================================================================
+// I/O thread
+// ============================================================================
+
+// Read until the pty is empty or the queue is full. Caller holds the lock.
+void ProcessRunner::drainMaster(uint32_t id, Session &session, bool &notify) {
+  bool was_empty = session.queue.size() == session.queue_head;
+  char buffer[kReadChunk];
+  while (session.master >= 0) {
+    size_t queued = session.queue.size() - session.queue_head;
+    if (queued >= queue_limit) {
+      if (!session.paused) {
+        pollerWatch(poll_fd, session.master, id, false);
+        session.paused = true;
+      }
+      break;
+    }
+    ssize_t n = ::read(session.master, buffer,
+                       std::min(sizeof(buffer), queue_limit - queued));
+    if (n > 0) {
+      // Compact the consumed front before growing.
+      if (session.queue_head > 0 && session.queue_head * 2 >= session.queue.size()) {
+        session.queue.erase(0, session.queue_head);
+        session.queue_head = 0;
+      }
+      session.queue.append(buffer, (size_t)n);
+      continue;
+    }
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    // 0 or EIO: every slave descriptor is closed.
+    session.eof = true;
+    closeMaster(session);
+  }
+  if (was_empty && session.queue.size() > session.queue_head) {
+    notify = true;
+  }
+}
+
+void ProcessRunner::reap(std::vector<uint32_t> &notify) {
+  for (auto &entry : sessions) {
+    Session &session = *entry.second;
+    if (!session.exited) {
+      int status = 0;
+      if (waitpid(session.pid, &status, WNOHANG) == session.pid) {
+        session.exited = true;
+        session.status = WIFEXITED(status) ? WEXITSTATUS(status)
+                                           : 128 + WTERMSIG(status);
+        notify.push_back(entry.first);
+      }
+    }
+    if (session.exited && !session.eof && !session.paused) {
+      // Background jobs may hold the slave open after the command exits;
+      // take what is already there and stop listening.
+      bool more = false;
+      drainMaster(entry.first, session, more);
+      if (!session.paused && !session.eof) {
+        session.eof = true;
+        closeMaster(session);
+      }
+      notify.push_back(entry.first);
+    } else if (session.exited && session.eof && session.master >= 0) {
+      closeMaster(session);
+    }
+  }
+}
+
+void ProcessRunner::loop() {
+  uint32_t tokens[kMaxEvents];
+  std::vector<uint32_t> notify;
+  for (;;) {
+    int timeout = -1;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      if (stopping) {
+        return;
+      }
+      for (auto &entry : sessions) {
+        if (!entry.second->exited) {
+          timeout = kReapIntervalMs;
+          break;
+        }
+      }
+    }
+
+    int n = pollerWait(poll_fd, tokens, kMaxEvents, timeout);
+    notify.clear();
+    Notify callback;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      for (int i = 0; i < n; i++) {
+        if (tokens[i] == kWakeToken) {
+          char scratch[64];
+          while (::read(wake_fds[0], scratch, sizeof(scratch)) > 0) {
+          }
+          continue;
+        }
+        auto it = sessions.find(tokens[i]);
+        if (it == sessions.end() || it->second->master < 0) {
+          continue;
+        }
+        bool more = false;
+        drainMaster(it->first, *it->second, more);
+        if (more || it->second->eof) {
+          notify.push_back(it->first);
+        }
+      }
+      // Consumers that drained below half the limit.
+      for (auto &entry : sessions) {
+        Session &session = *entry.second;
+        if (session.resume) {
+          session.resume = false;
+          if (session.paused && session.master >= 0) {
+            session.paused = false;
+            pollerWatch(poll_fd, session.master, entry.first, true);
+          } else if (session.paused) {
+            session.paused = false;
+          }
+        }
+      }
+      reap(notify);
+      callback = notify_fn;
+    }
+
+    if (callback) {
+      std::sort(notify.begin(), notify.end());
+      notify.erase(std::unique(notify.begin(), notify.end()), notify.end());
+      for (uint32_t id : notify) {
+        callback(id);
+      }
+    }
+  }
+}
+
+// ============================================================================
+// Consumer side
+// ============================================================================
+
+size_t ProcessRunner::read(uint32_t id, std::string &out, size_t max) {
+  std::lock_guard<std::mutex> guard(lock);
+  auto it = sessions.find(id);
+  if (it == sessions.end()) {
+    return 0;
+  }
+  Session &session = *it->second;
+  size_t take = std::min(max, session.queue.size() - session.queue_head);
+  out.append(session.queue, session.queue_head, take);
+  session.queue_head += take;
+  if (session.queue_head == session.queue.size()) {
+    session.queue.clear();
+    session.queue_head = 0;
+  }
+  if (session.paused && !session.resume &&
+      session.queue.size() - session.queue_head <= queue_limit / 2) {
+    session.resume = true;
+    wake();
+  }
+  return take;
+}
+
+bool ProcessRunner::sendInput(uint32_t id, const char *data, size_t length) {
+  std::lock_guard<std::mutex> guard(lock);
+  auto it = sessions.find(id);
+  if (it == sessions.end() || it->second->master < 0) {
+    return false;
+  }
+  // Input is small (keystrokes, pasted lines); a full tty drops the rest.
+  while (length > 0) {
+    ssize_t n = ::write(it->second->master, data, length);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    length -= (size_t)n;
+  }
+  return true;
+}
+
+bool ProcessRunner::interrupt(uint32_t id) {
+  int pid;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = sessions.find(id);
+    if (it == sessions.end() || it->second->exited) {
+      return false;
+    }
+    Session &session = *it->second;
+    struct termios mode;
+    if (session.master >= 0 && tcgetattr(session.master, &mode) == 0 &&
+        (mode.c_lflag & ISIG)) {
+      char intr = (char)mode.c_cc[VINTR];
+      if (::write(session.master, &intr, 1) == 1) {
+        return true;
+      }
+    }
+    pid = session.pid;
+  }
+  // Raw-mode programs read ^C as a byte; fall back to a signal.
+  return kill(-pid, SIGINT) == 0;
+}
+
+bool ProcessRunner::signal(uint32_t id, int signo) {
+  std::lock_guard<std::mutex> guard(lock);
+  auto it = sessions.find(id);
+  if (it == sessions.end() || it->second->exited) {
+    return false;
+  }
+  return kill(-it->second->pid, signo) == 0;
+}
+
+bool ProcessRunner::resize(uint32_t id, uint16_t cols, uint16_t rows) {
+  std::lock_guard<std::mutex> guard(lock);
+  auto it = sessions.find(id);
+  if (it == sessions.end() || it->second->master < 0) {
+    return false;
+  }
+  struct winsize size;
+  std::memset(&size, 0, sizeof(size));
+  size.ws_col = cols;
+  size.ws_row = rows;
+  return ioctl(it->second->master, TIOCSWINSZ, &size) == 0;
+}
+
+bool ProcessRunner::finished(uint32_t id, int &exit_status) {
+  std::lock_guard<std::mutex> guard(lock);
+  auto it = sessions.find(id);
+  if (it == sessions.end()) {
+    return false;
+  }
+  Session &session = *it->second;
+  if (!session.exited || !session.eof ||
+      session.queue.size() != session.queue_head) {
+    return false;
+  }
+  exit_status = session.status;
+  return true;
+}
+
+void ProcessRunner::release(uint32_t id) {
+  std::lock_guard<std::mutex> guard(lock);
+  auto it = sessions.find(id);
+  if (it == sessions.end()) {
+    return;
+  }
+  Session &session = *it->second;
+  closeMaster(session);
+  if (!session.exited) {
+    // The reaper forgets it too, so wait here; SIGKILL cannot be ignored.
+    kill(-session.pid, SIGKILL);
+    kill(session.pid, SIGKILL); // in case setsid() has not run yet
+    waitpid(session.pid, &session.status, 0);
+  }
+  sessions.erase(it);
+}
+
+size_t ProcessRunner::getRunningCount() {
+  std::lock_guard<std::mutex> guard(lock);
+  size_t count = 0;
+  for (auto &entry : sessions) {
+    if (!entry.second->exited) {
+      count++;
+    }
+  }
+  return count;
+}
+
+} // namespace System
+} // namespace OS
@@ -0,0 +1,1032 @@
+// Full-text search - folded tokenizer, compressed postings, BM25 top-k
+
+#include "SearchIndex.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <queue>
+#include <unordered_map>
+
+namespace OS {
+namespace System {
+
+namespace {
+
+constexpr size_t kMaxTokenBytes = 64;
+constexpr size_t kMinMergeBytes = 1u << 20;
+constexpr float kBm25K1 = 1.2f;
+constexpr float kBm25B = 0.75f;
+// Headroom for float rounding when comparing a bound with a real score
+constexpr float kBoundSlack = 1.0001f;
+
+// ============================================================================
+// Tokenizer
+// ============================================================================
+
+// Decodes one UTF-8 sequence; malformed bytes come back as U+FFFD.
+uint32_t decodeUtf8(const unsigned char *&p, const unsigned char *end) {
+  uint32_t c = *p++;
+  if (c < 0x80) {
+    return c;
+  }
+  int extra = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : c >= 0xC0 ? 1 : -1;
+  if (extra < 0 || end - p < extra) {
+    return 0xFFFD;
+  }
+  c &= 0x3F >> extra;
+  for (int i = 0; i < extra; i++) {
+    if ((p[i] & 0xC0) != 0x80) {
+      return 0xFFFD;
+    }
+    c = (c << 6) | (p[i] & 0x3F);
+  }
+  p += extra;
+  return c;
+}
+
+void encodeUtf8(uint32_t c, std::string &out) {
+  if (c < 0x80) {
+    out += (char)c;
+  } else if (c < 0x800) {
+    out += (char)(0xC0 | (c >> 6));
+    out += (char)(0x80 | (c & 0x3F));
+  } else if (c < 0x10000) {
+    out += (char)(0xE0 | (c >> 12));
+    out += (char)(0x80 | ((c >> 6) & 0x3F));
+    out += (char)(0x80 | (c & 0x3F));
+  } else {
+    out += (char)(0xF0 | (c >> 18));
+    out += (char)(0x80 | ((c >> 12) & 0x3F));
+    out += (char)(0x80 | ((c >> 6) & 0x3F));
+    out += (char)(0x80 | (c & 0x3F));
+  }
+}
+
+enum class CharClass { Separator, Word, Ideograph };
+
+CharClass classify(uint32_t c) {
+  if (c < 0x80) {
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+                   (c >= 'A' && c <= 'Z')
+               ? CharClass::Word
+               : CharClass::Separator;
+  }
+  if (c < 0xC0) {
+    return c == 0xAA || c == 0xB5 || c == 0xBA ? CharClass::Word
+                                               : CharClass::Separator;
+  }
+  if (c == 0xD7 || c == 0xF7 || c == 0xFFFD ||
+      (c >= 0x2000 && c <= 0x2BFF) ||  // punctuation, symbols, arrows
+      (c >= 0x3000 && c <= 0x303F) ||  // CJK punctuation
+      (c >= 0xE000 && c <= 0xF8FF) ||  // private use
+      (c >= 0xFE00 && c <= 0xFE0F) ||  // variation selectors
+      (c >= 0xFE30 && c <= 0xFE4F) ||  // CJK compatibility forms
+      (c >= 0xFF00 && c <= 0xFF0F) || (c >= 0xFF1A && c <= 0xFF20) ||
+      (c >= 0xFF3B && c <= 0xFF40) || (c >= 0xFF5B && c <= 0xFF65) ||
+      (c >= 0x1F000 && c <= 0x1FAFF)) { // emoji
+    return CharClass::Separator;
+  }
+  // Scripts written without spaces index one character per word, so a
+  // phrase query finds any run of them.
+  if ((c >= 0x3040 && c <= 0x30FF) || (c >= 0x3400 && c <= 0x4DBF) ||
+      (c >= 0x4E00 && c <= 0x9FFF) || (c >= 0xF900 && c <= 0xFAFF) ||
+      (c >= 0x20000 && c <= 0x2FFFF)) {
+    return CharClass::Ideograph;
+  }
+  return CharClass::Word;
+}
+
+// Simple case folding for Latin, Greek, Cyrillic, Armenian and full-width
+// forms, plus the full folding of sharp s. Appends the folded text.
+void foldCase(uint32_t c, std::string &out) {
+  if (c < 0x80) {
+    out += (char)(c >= 'A' && c <= 'Z' ? c + 32 : c);
+    return;
+  }
+  if (c == 0xDF || c == 0x1E9E) { // ß, ẞ
+    out += "ss";
+    return;
+  }
+  if ((c >= 0xC0 && c <= 0xDE && c != 0xD7) ||
+      (c >= 0x391 && c <= 0x3AB && c != 0x3A2) ||
+      (c >= 0x410 && c <= 0x42F) || (c >= 0xFF21 && c <= 0xFF3A)) {
+    c += 32;
+  } else if ((c >= 0x100 && c <= 0x137) || (c >= 0x14A && c <= 0x177) ||
+             (c >= 0x460 && c <= 0x481) || (c >= 0x48A && c <= 0x4BF) ||
+             (c >= 0x1E00 && c <= 0x1E95) || (c >= 0x1EA0 && c <= 0x1EFF)) {
+    c |= 1;
+  } else if ((c >= 0x139 && c <= 0x148) || (c >= 0x179 && c <= 0x17E)) {
+    c += c & 1;
+  } else if (c == 0x178) {
+    c = 0xFF;
+  } else if (c == 0x17F) {
+    c = 's';
+  } else if (c == 0x386) {
+    c = 0x3AC;
+  } else if (c >= 0x388 && c <= 0x38A) {
+    c += 37;
+  } else if (c == 0x38C) {
+    c = 0x3CC;
+  } else if (c == 0x38E || c == 0x38F) {
+    c += 63;
+  } else if (c == 0x3C2) { // final sigma
+    c = 0x3C3;
+  } else if (c >= 0x400 && c <= 0x40F) {
+    c += 80;
+  } else if (c >= 0x531 && c <= 0x556) {
+    c += 48;
+  }
+  encodeUtf8(c, out);
+}
+
+// Calls emit(word) for each folded word of text.
+template <typename Emit>
+void forEachToken(const char *text, size_t length, Emit emit) {
+  const unsigned char *p = (const unsigned char *)text;
+  const unsigned char *end = p + length;
+  std::string word;
+  while (p < end) {
+    uint32_t c = decodeUtf8(p, end);
+    CharClass kind = classify(c);
+    if (kind == CharClass::Word) {
+      if (word.size() < kMaxTokenBytes) {
+        foldCase(c, word);
+      }
+      continue;
+    }
+    if (!word.empty()) {
+      emit(word);
+      word.clear();
+    }
+    if (kind == CharClass::Ideograph) {
+      encodeUtf8(c, word);
+      emit(word);
+      word.clear();
+    }
+  }
+  if (!word.empty()) {
+    emit(word);
+  }
+}
+
+// ============================================================================
+// Varints
+// ============================================================================
+
+void putVarint(std::vector<uint8_t> &out, uint32_t value) {
+  while (value >= 0x80) {
+    out.push_back((uint8_t)(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back((uint8_t)value);
+}
+
+inline uint32_t getVarint(const uint8_t *&p) {
+  uint32_t value = *p & 0x7F;
+  if (*p++ < 0x80) {
+    return value;
+  }
+  for (int shift = 7; shift < 35; shift += 7) {
+    uint32_t byte = *p++;
+    value |= (byte & 0x7F) << shift;
+    if (byte < 0x80) {
+      break;
+    }
+  }
+  return value;
+}
+
+size_t varintSize(uint32_t value) {
+  size_t size = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    size++;
+  }
+  return size;
+}
+
+// One posting: document delta, term frequency, then the word positions as
+// deltas behind their byte length so cursors can step over them.
+void putPosting(std::vector<uint8_t> &out, uint32_t document_delta,
+                const uint32_t *positions, uint32_t count) {
+  uint32_t size = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    size += (uint32_t)varintSize(positions[i] - (i ? positions[i - 1] : 0));
+  }
+  putVarint(out, document_delta);
+  putVarint(out, count);
+  putVarint(out, size);
+  for (uint32_t i = 0; i < count; i++) {
+    putVarint(out, positions[i] - (i ? positions[i - 1] : 0));
+  }
+}
+
+// The BM25 weight of a term in a document, before multiplying by its
+// inverse document frequency. Never more than k1 + 1.
+inline float termWeight(uint32_t frequency, uint32_t length,
+                        double average_length) {
+  float tf = (float)frequency;
+  float norm =
+      (float)(kBm25K1 * (1 - kBm25B + kBm25B * length / average_length));
+  return tf * (kBm25K1 + 1) / (tf + norm);
+}
+
+int compareName(const char *a, size_t a_length, const char *b,
+                size_t b_length) {
+  int order = std::memcmp(a, b, std::min(a_length, b_length));
+  if (order != 0) {
+    return order;
+  }
+  return a_length < b_length ? -1 : a_length > b_length ? 1 : 0;
+}
+
+} // namespace
+
+// ============================================================================
+// Cursors
+// ============================================================================
+
+// A posting list in the base or the delta
+struct SearchIndex::ListRef {
+  const uint8_t *data;
+  size_t size;
+  const Skip *skips;
+  uint32_t skip_count;
+  uint32_t doc_count;
+  float max_weight;
+};
+
+// Walks a term's lists in document order (the delta only holds documents
+// numbered after everything in the base), using the skips to jump ahead.
+class SearchIndex::Cursor {
+public:
+  static constexpr uint32_t kEnd = UINT32_MAX;
+
+  explicit Cursor(const std::vector<ListRef> &refs) : lists(refs) {
+    doc_count = 0;
+    max_weight = 0;
+    for (const ListRef &ref : lists) {
+      doc_count += ref.doc_count;
+      max_weight = std::max(max_weight, ref.max_weight);
+    }
+    open(0);
+    decode();
+  }
+
+  uint32_t document() const { return current; }
+
+  void next() { decode(); }
+
+  void advance(uint32_t target) {
+    while (current < target) {
+      const ListRef &ref = lists[list];
+      uint32_t skip = skip_index;
+      while (skip < ref.skip_count && ref.skips[skip].last_document < target) {
+        skip++;
+      }
+      if (skip > skip_index) {
+        if (skip == ref.skip_count) {
+          p = end;
+        } else {
+          p = ref.data + ref.skips[skip - 1].end_offset;
+          previous = ref.skips[skip - 1].last_document;
+        }
+        skip_index = skip;
+      }
+      decode();
+    }
+  }
+
+  // Re-encodes the current posting against a new document delta.
+  void copyPosting(std::vector<uint8_t> &out, uint32_t document_delta) const {
+    putVarint(out, document_delta);
+    putVarint(out, frequency);
+    putVarint(out, position_bytes);
+    out.insert(out.end(), positions, positions + position_bytes);
+  }
+
+  // The best weight of the block that would hold target, read from the
+  // skips without decoding, and where that block ends. Delta lists have no
+  // skips, so they only get the general bound.
+  float blockWeight(uint32_t target, uint32_t *block_end) const {
+    *block_end = kEnd - 1;
+    if (current == kEnd) {
+      return 0;
+    }
+    const ListRef &ref = lists[list];
+    if (ref.skip_count == 0) {
+      return kBm25K1 + 1;
+    }
+    peek_index = std::max(peek_index, skip_index);
+    while (peek_index < ref.skip_count &&
+           ref.skips[peek_index].last_document < target) {
+      peek_index++;
+    }
+    if (peek_index == ref.skip_count) {
+      return list + 1 < lists.size() ? kBm25K1 + 1 : 0;
+    }
+    *block_end = ref.skips[peek_index].last_document;
+    return ref.skips[peek_index].max_weight;
+  }
+
+  void positionList(std::vector<uint32_t> &out) const {
+    out.clear();
+    const uint8_t *q = positions;
+    const uint8_t *q_end = positions + position_bytes;
+    uint32_t position = 0;
+    while (q < q_end) {
+      position += getVarint(q);
+      out.push_back(position);
+    }
+  }
+
+  uint32_t frequency = 0;
+  uint32_t doc_count;
+  float max_weight;
+  float idf = 0;
+
+private:
+  void open(size_t index) {
+    list = index;
+    if (list < lists.size()) {
+      p = lists[list].data;
+      end = p + lists[list].size;
+    }
+    previous = 0;
+    skip_index = 0;
+    peek_index = 0;
+  }
+
+  void decode() {
+    while (list >= lists.size() || p >= end) {
+      if (list + 1 >= lists.size()) {
+        current = kEnd;
+        list = lists.empty() ? 0 : lists.size() - 1;
+        p = end;
+        return;
+      }
+      open(list + 1);
+    }
+    current = previous + getVarint(p);
+    previous = current;
+    frequency = getVarint(p);
+    position_bytes = getVarint(p);
+    positions = p;
+    p += position_bytes;
+    const ListRef &ref = lists[list];
+    while (skip_index < ref.skip_count &&
+           ref.skips[skip_index].last_document < current) {
+      skip_index++;
+    }
+  }
+
+  std::vector<ListRef> lists;
+  size_t list = 0;
+  const uint8_t *p = nullptr;
+  const uint8_t *end = nullptr;
+  const uint8_t *positions = nullptr;
+  uint32_t position_bytes = 0;
+  uint32_t previous = 0;
+  uint32_t current = kEnd;
+  uint32_t skip_index = 0;
+  mutable uint32_t peek_index = 0;
+};
+
+struct SearchIndex::Clause {
+  enum Kind { Word, Prefix, Phrase } kind;
+  std::vector<std::string> words;
+};
+
+// ============================================================================
+// Index
+// ============================================================================
+
+SearchIndex::SearchIndex()
+    : merge_average_length(1), delta_bytes(0), live_count(0), live_words(0) {}
+
+std::vector<std::string> SearchIndex::tokenize(const std::string &text) {
+  std::vector<std::string> words;
+  forEachToken(text.data(), text.size(),
+               [&words](const std::string &word) { words.push_back(word); });
+  return words;
+}
+
+std::string SearchIndex::prefixQuery(const std::string &typed) {
+  std::string query = typed;
+  bool in_phrase = std::count(query.begin(), query.end(), '"') % 2 != 0;
+  char last = query.empty() ? ' ' : query.back();
+  if (!in_phrase && last != ' ' && last != '\t' && last != '\n' &&
+      last != '"' && last != '*') {
+    query += '*';
+  }
+  return query.find_first_not_of(" \t\n") == std::string::npos
+             ? std::string()
+             : query;
+}
+
+void SearchIndex::clear() {
+  terms.clear();
+  names.clear();
+  postings.clear();
+  skips.clear();
+  merge_average_length = 1;
+  delta.clear();
+  delta_bytes = 0;
+  external.clear();
+  lengths.clear();
+  live.clear();
+  internal.clear();
+  live_count = 0;
+  live_words = 0;
+}
+
+size_t SearchIndex::getMemoryUsage() const {
+  size_t bytes = terms.capacity() * sizeof(Term) + names.capacity() +
+                 postings.capacity() + skips.capacity() * sizeof(Skip) +
+                 external.capacity() * 4 + lengths.capacity() * 4 +
+                 live.capacity() / 8 + internal.size() * 16;
+  for (const auto &kv : delta) {
+    bytes += kv.first.capacity() + kv.second.bytes.capacity() + 64;
+  }
+  return bytes;
+}
+
+void SearchIndex::remove(uint32_t document) {
+  auto it = internal.find(document);
+  if (it == internal.end()) {
+    return;
+  }
+  live[it->second] = false;
+  live_count--;
+  live_words -= lengths[it->second];
+  internal.erase(it);
+}
+
+void SearchIndex::update(uint32_t document, const std::string &text) {
+  remove(document);
+  uint32_t id = (uint32_t)external.size();
+
+  // Word -> positions, in first-occurrence order
+  std::unordered_map<std::string, std::vector<uint32_t>> words;
+  uint32_t position = 0;
+  forEachToken(text.data(), text.size(), [&](const std::string &word) {
+    words[word].push_back(position++);
+  });
+
+  external.push_back(document);
+  lengths.push_back(position);
+  live.push_back(true);
+  internal[document] = id;
+  live_count++;
+  live_words += position;
+
+  for (const auto &kv : words) {
+    DeltaList &list = delta[kv.first];
+    size_t before = list.bytes.size();
+    putPosting(list.bytes, list.doc_count ? id - list.last_document : id,
+               kv.second.data(), (uint32_t)kv.second.size());
+    list.last_document = id;
+    list.doc_count++;
+    delta_bytes += list.bytes.size() - before;
+  }
+  if (delta_bytes > std::max(kMinMergeBytes, postings.size() / 4)) {
+    merge();
+  }
+}
+
+// Rebuilds the base from the live postings of the base and the delta.
+void SearchIndex::merge() {
+  std::vector<Term> merged_terms;
+  std::vector<char> merged_names;
+  std::vector<uint8_t> merged_postings;
+  std::vector<Skip> merged_skips;
+  merged_terms.reserve(terms.size() + delta.size());
+  merged_postings.reserve(postings.size() + delta_bytes);
+  double average_length = live_count ? (double)live_words / live_count : 1.0;
+
+  size_t base = 0;
+  auto next_delta = delta.begin();
+  std::vector<ListRef> refs;
+  while (base < terms.size() || next_delta != delta.end()) {
+    int order;
+    if (base == terms.size()) {
+      order = 1;
+    } else if (next_delta == delta.end()) {
+      order = -1;
+    } else {
+      const Term &term = terms[base];
+      order = compareName(names.data() + term.name_offset, term.name_length,
+                          next_delta->first.data(), next_delta->first.size());
+    }
+    std::string name;
+    refs.clear();
+    if (order <= 0) {
+      const Term &term = terms[base++];
+      name = termName(term);
+      refs.push_back(ListRef{postings.data() + term.offset,
+                             (size_t)((base < terms.size() ? terms[base].offset
+                                                           : postings.size()) -
+                                      term.offset),
+                             skips.data() + term.skip_offset, term.skip_count,
+                             term.doc_count, term.max_weight});
+    }
+    if (order >= 0) {
+      name = next_delta->first;
+      const DeltaList &list = next_delta->second;
+      refs.push_back(ListRef{list.bytes.data(), list.bytes.size(), nullptr, 0,
+                             list.doc_count, kBm25K1 + 1});
+      ++next_delta;
+    }
+
+    Term out;
+    out.offset = merged_postings.size();
+    out.skip_offset = (uint32_t)merged_skips.size();
+    out.doc_count = 0;
+    out.max_weight = 0;
+    uint32_t previous = 0;
+    Skip block{0, 0, 0};
+    for (Cursor cursor(refs); cursor.document() != Cursor::kEnd;
+         cursor.next()) {
+      uint32_t document = cursor.document();
+      if (!isLive(document)) {
+        continue;
+      }
+      cursor.copyPosting(merged_postings,
+                         out.doc_count ? document - previous : document);
+      previous = document;
+      block.max_weight =
+          std::max(block.max_weight, termWeight(cursor.frequency,
+                                                lengths[document],
+                                                average_length));
+      if (++out.doc_count % kSkipInterval == 0) {
+        block.last_document = document;
+        block.end_offset = (uint32_t)(merged_postings.size() - out.offset);
+        merged_skips.push_back(block);
+        out.max_weight = std::max(out.max_weight, block.max_weight);
+        block = Skip{0, 0, 0};
+      }
+    }
+    if (out.doc_count == 0) {
+      continue;
+    }
+    if (out.doc_count % kSkipInterval != 0) {
+      block.last_document = previous;
+      block.end_offset = (uint32_t)(merged_postings.size() - out.offset);
+      merged_skips.push_back(block);
+      out.max_weight = std::max(out.max_weight, block.max_weight);
+    }
+    out.skip_count = (uint32_t)merged_skips.size() - out.skip_offset;
+    out.name_offset = (uint32_t)merged_names.size();
+    out.name_length = (uint32_t)name.size();
+    merged_names.insert(merged_names.end(), name.begin(), name.end());
+    merged_terms.push_back(out);
+  }
+
+  terms.swap(merged_terms);
+  names.swap(merged_names);
+  postings.swap(merged_postings);
+  skips.swap(merged_skips);
+  merge_average_length = average_length;
+  delta.clear();
+  delta_bytes = 0;
+}
+
+const SearchIndex::Term *SearchIndex::findTerm(const std::string &name) const {
+  auto it = std::lower_bound(
+      terms.begin(), terms.end(), name,
+      [this](const Term &term, const std::string &key) {
+        return compareName(names.data() + term.name_offset, term.name_length,
+                           key.data(), key.size()) < 0;
+      });
+  if (it == terms.end() || compareName(names.data() + it->name_offset,
+                                       it->name_length, name.data(),
+                                       name.size()) != 0) {
+    return nullptr;
+  }
+  return &*it;
+}
+
+void SearchIndex::termLists(const std::string &name,
+                            std::vector<ListRef> &lists) const {
+  lists.clear();
+  if (const Term *term = findTerm(name)) {
+    size_t index = term - terms.data();
+    uint64_t end =
+        index + 1 < terms.size() ? terms[index + 1].offset : postings.size();
+    lists.push_back(ListRef{postings.data() + term->offset,
+                            (size_t)(end - term->offset),
+                            skips.data() + term->skip_offset, term->skip_count,
+                            term->doc_count, term->max_weight});
+  }
+  auto it = delta.find(name);
+  if (it != delta.end()) {
+    lists.push_back(ListRef{it->second.bytes.data(), it->second.bytes.size(),
+                            nullptr, 0, it->second.doc_count, kBm25K1 + 1});
+  }
+}
+
+// ============================================================================
+// Queries
+// ============================================================================
+
+// Words are ANDed; "quoted text" is a phrase and a trailing * makes a
+// prefix. Text that splits into several words (e-mail, 東京) is a phrase.
+bool SearchIndex::parseQuery(const std::string &query,
+                             std::vector<Clause> &clauses) const {
+  size_t i = 0;
+  while (i < query.size()) {
+    char c = query[i];
+    if (c == ' ' || c == '\t' || c == '\n') {
+      i++;
+      continue;
+    }
+    size_t start;
+    size_t end;
+    bool quoted = c == '"';
+    if (quoted) {
+      start = ++i;
+      end = query.find('"', start);
+      if (end == std::string::npos) {
+        end = query.size();
+      }
+      i = end + 1;
+    } else {
+      start = i;
+      while (i < query.size() && query[i] != ' ' && query[i] != '\t' &&
+             query[i] != '\n' && query[i] != '"') {
+        i++;
+      }
+      end = i;
+    }
+    Clause clause;
+    forEachToken(query.data() + start, end - start,
+                 [&clause](const std::string &word) {
+                   clause.words.push_back(word);
+                 });
+    if (clause.words.empty()) {
+      continue;
+    }
+    // In "macos-li*" only the last word is a prefix
+    Clause prefix{Clause::Prefix, {}};
+    if (!quoted && query[end - 1] == '*') {
+      prefix.words.push_back(clause.words.back());
+      clause.words.pop_back();
+    }
+    if (!clause.words.empty()) {
+      clause.kind = clause.words.size() == 1 ? Clause::Word : Clause::Phrase;
+      clauses.push_back(std::move(clause));
+    }
+    if (!prefix.words.empty()) {
+      clauses.push_back(std::move(prefix));
+    }
+  }
+  return !clauses.empty();
+}
+
+std::vector<SearchHit> SearchIndex::search(const std::string &query,
+                                           size_t k) const {
+  std::vector<SearchHit> hits;
+  std::vector<Clause> clauses;
+  if (k == 0 || live_count == 0 || !parseQuery(query, clauses)) {
+    return hits;
+  }
+
+  // One group of cursors per clause: a word has one, a phrase one per word
+  // (all must match) and a prefix one per expansion (any may match, the
+  // best one scores).
+  struct Group {
+    Clause::Kind kind;
+    std::vector<Cursor> cursors;
+    uint64_t estimate;
+    uint32_t current;
+    std::vector<uint32_t> nearest; // prefix cursors, a min-heap on document
+  };
+  std::vector<Group> groups;
+  std::vector<ListRef> lists;
+  double n = (double)live_count;
+  auto idf = [n](uint32_t doc_count) {
+    // Postings of replaced documents linger until a merge
+    double df = std::min((double)doc_count, n);
+    return (float)std::log(1.0 + (n - df + 0.5) / (df + 0.5));
+  };
+  for (const Clause &clause : clauses) {
+    Group group{clause.kind, {}, 0, 0, {}};
+    std::vector<std::string> words = clause.words;
+    if (clause.kind == Clause::Prefix) {
+      // Expand to the most common words that start with the prefix
+      const std::string &prefix = clause.words[0];
+      std::unordered_map<std::string, uint32_t> counts;
+      auto it = std::lower_bound(
+          terms.begin(), terms.end(), prefix,
+          [this](const Term &term, const std::string &key) {
+            return compareName(names.data() + term.name_offset,
+                               term.name_length, key.data(), key.size()) < 0;
+          });
+      for (; it != terms.end() && it->name_length >= prefix.size() &&
+             std::memcmp(names.data() + it->name_offset, prefix.data(),
+                         prefix.size()) == 0;
+           ++it) {
+        counts[termName(*it)] += it->doc_count;
+      }
+      for (auto d = delta.lower_bound(prefix);
+           d != delta.end() && d->first.compare(0, prefix.size(), prefix) == 0;
+           ++d) {
+        counts[d->first] += d->second.doc_count;
+      }
+      std::vector<std::pair<uint32_t, std::string>> ranked;
+      for (auto &kv : counts) {
+        ranked.emplace_back(kv.second, kv.first);
+      }
+      size_t keep = std::min<size_t>(ranked.size(), kMaxPrefixTerms);
+      std::partial_sort(ranked.begin(), ranked.begin() + keep, ranked.end(),
+                        [](const std::pair<uint32_t, std::string> &a,
+                           const std::pair<uint32_t, std::string> &b) {
+                          return a.first > b.first;
+                        });
+      words.clear();
+      for (size_t r = 0; r < keep; r++) {
+        words.push_back(ranked[r].second);
+      }
+      if (words.empty()) {
+        return hits;
+      }
+    }
+    for (const std::string &word : words) {
+      termLists(word, lists);
+      if (lists.empty() && clause.kind != Clause::Prefix) {
+        return hits; // a required word occurs nowhere
+      }
+      group.cursors.emplace_back(lists);
+      Cursor &cursor = group.cursors.back();
+      cursor.idf = idf(cursor.doc_count);
+      group.estimate = clause.kind == Clause::Prefix
+                           ? group.estimate + cursor.doc_count
+                           : (group.estimate == 0
+                                  ? cursor.doc_count
+                                  : std::min<uint64_t>(group.estimate,
+                                                       cursor.doc_count));
+    }
+    groups.push_back(std::move(group));
+  }
+  // The rarest clause leads
+  std::sort(groups.begin(), groups.end(), [](const Group &a, const Group &b) {
+    return a.estimate < b.estimate;
+  });
+
+  // A prefix group's expansions sit in a heap on their documents, so a
+  // step moves only the expansions behind the target rather than looking
+  // at all of them.
+  auto heapOrder = [](const Group &group) {
+    return [&group](uint32_t a, uint32_t b) {
+      return group.cursors[a].document() > group.cursors[b].document();
+    };
+  };
+  auto rebuildHeap = [&heapOrder](Group &group) {
+    group.nearest.resize(group.cursors.size());
+    for (uint32_t c = 0; c < group.nearest.size(); c++) {
+      group.nearest[c] = c;
+    }
+    std::make_heap(group.nearest.begin(), group.nearest.end(),
+                   heapOrder(group));
+    group.current = group.cursors[group.nearest[0]].document();
+  };
+  for (Group &group : groups) {
+    if (group.kind == Clause::Prefix) {
+      rebuildHeap(group);
+    }
+  }
+
+  // Moves a group to its first candidate at or after target: any
+  // expansion of a prefix, or a document holding every word of a phrase
+  // (whose positions are checked later).
+  auto advance = [&heapOrder](Group &group, uint32_t target) {
+    if (group.kind == Clause::Prefix) {
+      auto order = heapOrder(group);
+      while (group.cursors[group.nearest[0]].document() < target) {
+        std::pop_heap(group.nearest.begin(), group.nearest.end(), order);
+        group.cursors[group.nearest.back()].advance(target);
+        std::push_heap(group.nearest.begin(), group.nearest.end(), order);
+      }
+      group.current = group.cursors[group.nearest[0]].document();
+      return;
+    }
+    for (;;) {
+      uint32_t highest = target;
+      bool aligned = true;
+      for (Cursor &cursor : group.cursors) {
+        cursor.advance(highest);
+        if (cursor.document() != highest) {
+          aligned = false;
+          highest = cursor.document();
+        }
+      }
+      if (aligned || highest == Cursor::kEnd) {
+        group.current = highest;
+        return;
+      }
+      target = highest;
+    }
+  };
+
+  std::vector<uint32_t> first_positions;
+  std::vector<uint32_t> other_positions;
+  auto phraseMatches = [&](const Group &group) {
+    group.cursors[0].positionList(first_positions);
+    for (size_t w = 1; w < group.cursors.size() && !first_positions.empty();
+         w++) {
+      group.cursors[w].positionList(other_positions);
+      size_t keep = 0;
+      for (uint32_t position : first_positions) {
+        if (std::binary_search(other_positions.begin(), other_positions.end(),
+                               position + (uint32_t)w)) {
+          first_positions[keep++] = position;
+        }
+      }
+      first_positions.resize(keep);
+    }
+    return !first_positions.empty();
+  };
+
+  double average_length = (double)live_words / live_count;
+  auto score = [&](uint32_t document) {
+    float total = 0;
+    for (const Group &group : groups) {
+      float best = 0;
+      for (const Cursor &cursor : group.cursors) {
+        if (cursor.document() != document) {
+          continue;
+        }
+        float weight = cursor.idf * termWeight(cursor.frequency,
+                                               lengths[document],
+                                               average_length);
+        if (group.kind == Clause::Prefix) {
+          best = std::max(best, weight);
+        } else {
+          total += weight;
+        }
+      }
+      total += best;
+    }
+    return total;
+  };
+
+  // The weights in the skips assume the average length at the last merge;
+  // a longer average since raises a weight by at most the ratio.
+  float scale = (float)std::max(1.0, average_length / merge_average_length);
+  auto cap = [scale](float term_idf, float weight) {
+    return term_idf * std::min(weight * scale, kBm25K1 + 1);
+  };
+
+  // Bounds the score of every document from target to *block_end by the
+  // blocks the cursors would be in there. The interval follows the words
+  // and phrases; a prefix expansion whose block ends sooner counts with
+  // its best block anywhere rather than cutting the interval short.
+  bool has_words = std::any_of(groups.begin(), groups.end(),
+                               [](const Group &group) {
+                                 return group.kind != Clause::Prefix;
+                               });
+  auto bound = [&](uint32_t target, uint32_t *block_end) {
+    *block_end = Cursor::kEnd - 1;
+    for (const Group &group : groups) {
+      if (has_words && group.kind == Clause::Prefix) {
+        continue;
+      }
+      for (const Cursor &cursor : group.cursors) {
+        uint32_t end;
+        cursor.blockWeight(target, &end);
+        *block_end = std::min(*block_end, end);
+      }
+    }
+    float total = 0;
+    for (const Group &group : groups) {
+      float best = 0;
+      for (const Cursor &cursor : group.cursors) {
+        uint32_t end;
+        float weight = cursor.blockWeight(target, &end);
+        if (end < *block_end) {
+          weight = cursor.max_weight;
+        }
+        if (group.kind == Clause::Prefix) {
+          best = std::max(best, cap(cursor.idf, weight));
+        } else {
+          total += cap(cursor.idf, weight);
+        }
+      }
+      total += best;
+    }
+    return total;
+  };
+
+  // Drops the prefix expansions that cannot lift a document past
+  // threshold even with every other clause at its best. False once a
+  // prefix has nothing left.
+  auto prunePrefixes = [&](float threshold) {
+    std::vector<float> group_bounds;
+    float total = 0;
+    for (const Group &group : groups) {
+      float group_bound = 0;
+      for (const Cursor &cursor : group.cursors) {
+        float list_bound = cap(cursor.idf, cursor.max_weight);
+        group_bound = group.kind == Clause::Prefix
+                          ? std::max(group_bound, list_bound)
+                          : group_bound + list_bound;
+      }
+      group_bounds.push_back(group_bound);
+      total += group_bound;
+    }
+    for (size_t g = 0; g < groups.size(); g++) {
+      if (groups[g].kind != Clause::Prefix) {
+        continue;
+      }
+      float others = total - group_bounds[g];
+      std::vector<Cursor> &cursors = groups[g].cursors;
+      size_t before = cursors.size();
+      cursors.erase(std::remove_if(cursors.begin(), cursors.end(),
+                                   [&](const Cursor &cursor) {
+                                     return (others + cap(cursor.idf,
+                                                          cursor.max_weight)) *
+                                                kBoundSlack <
+                                            threshold;
+                                   }),
+                    cursors.end());
+      if (cursors.empty()) {
+        return false;
+      }
+      if (cursors.size() < before) {
+        rebuildHeap(groups[g]);
+      }
+    }
+    return true;
+  };
+
+  // Min-heap of the best k; ties go to the newer document
+  auto worse = [](const SearchHit &a, const SearchHit &b) {
+    return a.score > b.score || (a.score == b.score && a.document > b.document);
+  };
+  std::priority_queue<SearchHit, std::vector<SearchHit>, decltype(worse)> best(
+      worse);
+
+  // A bound holds until its block end, whatever the heap does meanwhile
+  uint32_t checked_end = 0;
+  bool checked = false;
+  uint32_t target = 0;
+  for (;;) {
+    if (best.size() == k && (!checked || target > checked_end)) {
+      // Step over blocks that cannot beat the worst hit without decoding
+      float threshold = best.top().score;
+      while (target != Cursor::kEnd &&
+             bound(target, &checked_end) * kBoundSlack < threshold) {
+        target = checked_end + 1;
+      }
+      checked = true;
+    }
+    // Leapfrog the clauses to a document they all hold
+    uint32_t document = target;
+    for (size_t g = 0; g < groups.size() && document != Cursor::kEnd;) {
+      advance(groups[g], document);
+      if (groups[g].current == document) {
+        g++;
+      } else {
+        document = groups[g].current;
+        g = 0;
+      }
+    }
+    if (document == Cursor::kEnd) {
+      break;
+    }
+    if (checked && document > checked_end) {
+      target = document; // landed past the checked blocks
+      continue;
+    }
+    bool matches = isLive(document);
+    for (const Group &group : groups) {
+      if (matches && group.kind == Clause::Phrase) {
+        matches = phraseMatches(group);
+      }
+    }
+    if (matches) {
+      SearchHit hit{document, score(document)};
+      if (best.size() < k) {
+        best.push(hit);
+      } else if (worse(hit, best.top())) {
+        best.pop();
+        best.push(hit);
+      }
+      if (best.size() == k && !prunePrefixes(best.top().score)) {
+        break;
+      }
+    }
+    target = document + 1;
+  }
+
+  hits.resize(best.size());
+  for (size_t i = hits.size(); i-- > 0;) {
+    hits[i] = best.top();
+    hits[i].document = external[hits[i].document];
+    best.pop();
+  }
+  return hits;
+}
+
+} // namespace System
+} // namespace OS
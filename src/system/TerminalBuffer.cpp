@@ -0,0 +1,359 @@
+// Terminal buffer - scrollback ring and escape-sequence parser
+
+#include "TerminalBuffer.hpp"
+#include <algorithm>
+
+namespace OS {
+namespace System {
+
+TerminalBuffer::TerminalBuffer(uint32_t scrollback, uint32_t max_line_bytes)
+    : lines(std::max(scrollback, 1u)), first_seq(0), end_seq(1), dirty_seq(0),
+      dirty_reset(false), max_line_bytes(std::max(max_line_bytes, 4u)),
+      current{kTermColorDefault, kTermColorDefault, 0}, state(State::Ground),
+      pending_cr(false), csi_private(false), param_count(0), params{},
+      sub_params(0) {}
+
+const TermLine *TerminalBuffer::line(uint64_t seq) const {
+  if (seq < first_seq || seq >= end_seq) {
+    return nullptr;
+  }
+  return &lines[seq % lines.size()];
+}
+
+TermUpdate TerminalBuffer::takeUpdate() {
+  TermUpdate update = {first_seq, dirty_seq, end_seq, dirty_reset};
+  dirty_seq = end_seq - 1;
+  dirty_reset = false;
+  return update;
+}
+
+void TerminalBuffer::clear() {
+  first_seq = end_seq;
+  end_seq++;
+  TermLine &line = openLine();
+  line.text.clear();
+  line.runs.clear();
+  line.wrapped = false;
+  dirty_seq = first_seq;
+  dirty_reset = true;
+  pending_cr = false;
+}
+
+void TerminalBuffer::setScrollback(uint32_t scrollback) {
+  scrollback = std::max(scrollback, 1u);
+  if (scrollback == lines.size()) {
+    return;
+  }
+  std::vector<TermLine> resized(scrollback);
+  uint64_t keep = std::min<uint64_t>(end_seq - first_seq, scrollback);
+  for (uint64_t seq = end_seq - keep; seq < end_seq; seq++) {
+    resized[seq % scrollback] = std::move(lines[seq % lines.size()]);
+  }
+  lines.swap(resized);
+  first_seq = end_seq - keep;
+}
+
+// ============================================================================
+// Lines
+// ============================================================================
+
+// The slot taken over is the oldest line's; its buffers are reused, which is
+// what keeps memory flat while streaming.
+void TerminalBuffer::newLine(bool wrapped) {
+  openLine().wrapped = wrapped;
+  if (end_seq - first_seq == lines.size()) {
+    first_seq++;
+  }
+  end_seq++;
+  TermLine &line = openLine();
+  line.text.clear();
+  line.runs.clear();
+  line.wrapped = false;
+}
+
+void TerminalBuffer::appendText(const char *data, size_t length) {
+  if (pending_cr) {
+    openLine().text.clear();
+    openLine().runs.clear();
+    pending_cr = false;
+  }
+  while (length > 0) {
+    TermLine *line = &openLine();
+    size_t room = max_line_bytes - line->text.size();
+    if (room == 0) {
+      newLine(true);
+      continue;
+    }
+    size_t take = std::min(length, room);
+    if (take < length) {
+      // Wrap on a character boundary.
+      while (take > 0 && ((uint8_t)data[take] & 0xC0) == 0x80) {
+        take--;
+      }
+      if (take == 0) {
+        if (!line->text.empty()) {
+          newLine(true);
+          continue;
+        }
+        take = std::min(length, room);
+      }
+    }
+
+    uint32_t start = (uint32_t)line->text.size();
+    if (line->runs.empty() || line->runs.back().attributes != current) {
+      if (!line->runs.empty() && line->runs.back().start == start) {
+        line->runs.back().attributes = current;
+      } else {
+        line->runs.push_back(TermRun{start, current});
+      }
+    }
+    line->text.append(data, take);
+    data += take;
+    length -= take;
+  }
+}
+
+void TerminalBuffer::backspace() {
+  TermLine &line = openLine();
+  std::string &text = line.text;
+  while (!text.empty() && ((uint8_t)text.back() & 0xC0) == 0x80) {
+    text.pop_back();
+  }
+  if (!text.empty()) {
+    text.pop_back();
+  }
+  while (!line.runs.empty() && line.runs.back().start >= text.size()) {
+    line.runs.pop_back();
+  }
+}
+
+// ============================================================================
+// Parser
+// ============================================================================
+
+void TerminalBuffer::write(const char *data, size_t length) {
+  const uint8_t *p = (const uint8_t *)data;
+  const uint8_t *end = p + length;
+  while (p < end) {
+    if (state == State::Ground) {
+      // Fast path: hand whole printable spans to appendText.
+      const uint8_t *q = p;
+      while (q < end && *q >= 0x20 && *q != 0x7F) {
+        q++;
+      }
+      if (q > p) {
+        appendText((const char *)p, (size_t)(q - p));
+        p = q;
+        continue;
+      }
+      uint8_t c = *p++;
+      switch (c) {
+      case '\n':
+        pending_cr = false;
+        newLine(false);
+        break;
+      case '\r':
+        pending_cr = true;
+        break;
+      case '\b':
+        backspace();
+        break;
+      case '\t':
+        appendText("\t", 1);
+        break;
+      case 0x1B:
+        state = State::Escape;
+        break;
+      default:
+        break; // BEL and the rest of C0
+      }
+      continue;
+    }
+
+    uint8_t c = *p++;
+    switch (state) {
+    case State::Escape:
+      if (c == '[') {
+        state = State::Csi;
+        csi_private = false;
+        param_count = 0;
+        params[0] = 0;
+        sub_params = 0;
+      } else if (c == ']') {
+        state = State::Osc;
+      } else if (c >= 0x20 && c <= 0x2F) {
+        state = State::EscapeIntermediate;
+      } else {
+        state = State::Ground;
+      }
+      break;
+    case State::EscapeIntermediate:
+      if (c == 0x1B) {
+        state = State::Escape;
+      } else if (c >= 0x30 && c <= 0x7E) {
+        state = State::Ground;
+      }
+      break;
+    case State::Csi:
+      if (c >= '0' && c <= '9') {
+        params[param_count] = std::min(params[param_count] * 10 + (c - '0'),
+                                       65535u);
+      } else if (c == ';' || c == ':') {
+        if (param_count + 1 < kMaxParams) {
+          params[++param_count] = 0;
+          sub_params |= (c == ':') << param_count;
+        }
+      } else if (c >= '<' && c <= '?') {
+        csi_private = true;
+      } else if (c >= 0x40 && c <= 0x7E) {
+        param_count++;
+        dispatchCsi(c);
+        state = State::Ground;
+      } else if (c == 0x1B) {
+        state = State::Escape;
+      }
+      break;
+    case State::Osc:
+      if (c == 0x07) {
+        state = State::Ground;
+      } else if (c == 0x1B) {
+        state = State::OscEscape;
+      }
+      break;
+    case State::OscEscape:
+      state = c == 0x1B ? State::Escape : State::Ground;
+      break;
+    case State::Ground:
+      break;
+    }
+  }
+}
+
+// param_count holds the number of parameters here.
+void TerminalBuffer::dispatchCsi(uint8_t final_byte) {
+  if (csi_private) {
+    return;
+  }
+  switch (final_byte) {
+  case 'm':
+    applySgr();
+    break;
+  case 'K':
+    // "\r\033[K" erases the line even when nothing is written after it.
+    if (pending_cr && params[0] != 1) {
+      openLine().text.clear();
+      openLine().runs.clear();
+    }
+    break;
+  case 'J':
+    if (params[0] == 3) {
+      clear();
+    }
+    break;
+  default:
+    break; // cursor movement has no meaning in a scrollback model
+  }
+}
+
+// One past the last subparameter of params[i].
+uint32_t TerminalBuffer::groupEnd(uint32_t i) const {
+  uint32_t end = i + 1;
+  while (end < param_count && (sub_params >> end & 1)) {
+    end++;
+  }
+  return end;
+}
+
+bool TerminalBuffer::extendedColor(uint32_t &i, uint32_t &color) const {
+  uint32_t end = groupEnd(i);
+  if (end - i > 1) {
+    // Colon form: 38:5:n, 38:2:cs:r:g:b with a (usually empty) colorspace
+    // id, or 38:2:r:g:b as some programs write it without one. The group
+    // is self-contained, so a bad one leaves the rest of the SGR intact.
+    const uint32_t *sub = params + i + 1;
+    uint32_t count = end - i - 1;
+    i = end - 1;
+    if (count >= 2 && sub[0] == 5) {
+      color = kTermColorIndexed | (sub[1] & 0xFF);
+      return true;
+    }
+    if (count >= 4 && sub[0] == 2) {
+      const uint32_t *rgb = sub + (count >= 5 ? 2 : 1);
+      color = kTermColorRGB | (rgb[0] & 0xFF) << 16 | (rgb[1] & 0xFF) << 8 |
+              (rgb[2] & 0xFF);
+      return true;
+    }
+    return false;
+  }
+  if (i + 2 < param_count && params[i + 1] == 5) {
+    color = kTermColorIndexed | (params[i + 2] & 0xFF);
+    i += 2;
+    return true;
+  }
+  if (i + 4 < param_count && params[i + 1] == 2) {
+    color = kTermColorRGB | (params[i + 2] & 0xFF) << 16 |
+            (params[i + 3] & 0xFF) << 8 | (params[i + 4] & 0xFF);
+    i += 4;
+    return true;
+  }
+  i = param_count; // malformed: the rest cannot be interpreted
+  return false;
+}
+
+void TerminalBuffer::applySgr() {
+  for (uint32_t i = 0; i < param_count; i++) {
+    uint32_t p = params[i];
+    if (p != 38 && p != 48 && groupEnd(i) - i > 1) {
+      // Subparameters of anything else (4:3, a curly underline) only
+      // refine it; 4:0 is the one that turns it off.
+      if (p == 4 && params[i + 1] == 0) {
+        p = 24;
+      }
+      i = groupEnd(i) - 1;
+    }
+    if (p == 0) {
+      current = TermAttributes{kTermColorDefault, kTermColorDefault, 0};
+    } else if (p == 1) {
+      current.style |= kTermBold;
+    } else if (p == 2) {
+      current.style |= kTermDim;
+    } else if (p == 3) {
+      current.style |= kTermItalic;
+    } else if (p == 4) {
+      current.style |= kTermUnderline;
+    } else if (p == 7) {
+      current.style |= kTermInverse;
+    } else if (p == 9) {
+      current.style |= kTermStrike;
+    } else if (p == 21 || p == 22) {
+      current.style &= ~(kTermBold | kTermDim);
+    } else if (p == 23) {
+      current.style &= ~kTermItalic;
+    } else if (p == 24) {
+      current.style &= ~kTermUnderline;
+    } else if (p == 27) {
+      current.style &= ~kTermInverse;
+    } else if (p == 29) {
+      current.style &= ~kTermStrike;
+    } else if (p >= 30 && p <= 37) {
+      current.fg = kTermColorIndexed | (p - 30);
+    } else if (p == 38) {
+      extendedColor(i, current.fg);
+    } else if (p == 39) {
+      current.fg = kTermColorDefault;
+    } else if (p >= 40 && p <= 47) {
+      current.bg = kTermColorIndexed | (p - 40);
+    } else if (p == 48) {
+      extendedColor(i, current.bg);
+    } else if (p == 49) {
+      current.bg = kTermColorDefault;
+    } else if (p >= 90 && p <= 97) {
+      current.fg = kTermColorIndexed | (p - 90 + 8);
+    } else if (p >= 100 && p <= 107) {
+      current.bg = kTermColorIndexed | (p - 100 + 8);
+    }
+  }
+}
+
+} // namespace System
+} // namespace OS
@@ -0,0 +1,734 @@
+// Virtual file system - indexed inode table with a mappable image
+
+#include "VirtualFileSystem.hpp"
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace OS {
+namespace System {
+
+namespace {
+
+constexpr uint32_t kDirectory = 1u << 0;
+constexpr uint32_t kFree = 1u << 1;
+constexpr uint32_t kUnsorted = 1u << 2; // children need sorting before list()
+
+constexpr uint32_t kMinIndexCapacity = 16;
+constexpr uint32_t kImageVersion = 1;
+constexpr char kImageMagic[4] = {'O', 'S', 'V', 'F'};
+
+// Native byte order; images are not meant to move between machines.
+struct ImageHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t inode_count;
+  uint32_t index_capacity;
+  uint32_t child_count;
+  uint32_t names_size;
+  uint32_t inode_size;
+  uint32_t reserved;
+};
+
+// FNV-1a over the name, mixed with the parent and finished with fmix32.
+uint32_t hashName(uint32_t parent, const char *name, size_t length) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < length; i++) {
+    h ^= (uint8_t)name[i];
+    h *= 16777619u;
+  }
+  h ^= parent * 0x9E3779B9u;
+  h ^= h >> 16;
+  h *= 0x85EBCA6Bu;
+  h ^= h >> 13;
+  h *= 0xC2B2AE35u;
+  h ^= h >> 16;
+  return h;
+}
+
+int compareFolded(const char *a, uint32_t a_len, const char *b,
+                  uint32_t b_len) {
+  uint32_t n = std::min(a_len, b_len);
+  for (uint32_t i = 0; i < n; i++) {
+    int ca = (uint8_t)a[i];
+    int cb = (uint8_t)b[i];
+    if (ca >= 'A' && ca <= 'Z') {
+      ca += 'a' - 'A';
+    }
+    if (cb >= 'A' && cb <= 'Z') {
+      cb += 'a' - 'A';
+    }
+    if (ca != cb) {
+      return ca - cb;
+    }
+  }
+  return (int)a_len - (int)b_len;
+}
+
+uint32_t indexCapacityFor(uint32_t count) {
+  uint32_t capacity = kMinIndexCapacity;
+  while (capacity / 4 * 3 < count + 1) {
+    capacity <<= 1;
+  }
+  return capacity;
+}
+
+int64_t now() { return (int64_t)std::time(nullptr); }
+
+bool validName(const std::string &name) {
+  return !name.empty() && name != "." && name != ".." &&
+         name.find('/') == std::string::npos && name.size() < UINT32_MAX;
+}
+
+} // namespace
+
+VirtualFileSystem::VirtualFileSystem()
+    : inodes(nullptr), names(nullptr), index(nullptr),
+      image_children(nullptr), inode_count(0), index_mask(0), live_count(0),
+      mapping(nullptr), mapping_size(0) {
+  reset();
+}
+
+VirtualFileSystem::~VirtualFileSystem() {
+  if (mapping) {
+    munmap(mapping, mapping_size);
+  }
+}
+
+// Drop everything and start over with a bare root.
+void VirtualFileSystem::reset() {
+  if (mapping) {
+    munmap(mapping, mapping_size);
+    mapping = nullptr;
+    mapping_size = 0;
+  }
+  own_inodes.assign(1, Inode{0, now(), kRoot, 0, 0, 0, kDirectory, 0, 0, 0});
+  own_names.assign(1, '\0');
+  own_index.assign(kMinIndexCapacity, kInvalid);
+  children.assign(1, {});
+  free_inodes.clear();
+  live_count = 1;
+  adopt();
+}
+
+// Point the read views at the owned vectors again.
+void VirtualFileSystem::adopt() {
+  inodes = own_inodes.data();
+  names = own_names.data();
+  index = own_index.data();
+  image_children = nullptr;
+  inode_count = (uint32_t)own_inodes.size();
+  index_mask = (uint32_t)own_index.size() - 1;
+}
+
+// Copy a mapped image into private memory before the first write.
+void VirtualFileSystem::materialize() {
+  if (!mapping) {
+    return;
+  }
+  const ImageHeader *header = (const ImageHeader *)mapping;
+  own_inodes.assign(inodes, inodes + inode_count);
+  own_names.assign(names, names + header->names_size);
+  own_index.assign(index, index + header->index_capacity);
+  children.assign(inode_count, {});
+  for (uint32_t i = 0; i < inode_count; i++) {
+    Inode &inode = own_inodes[i];
+    if (inode.flags & kDirectory) {
+      const uint32_t *first = image_children + inode.child_offset;
+      children[i].assign(first, first + inode.child_count);
+    }
+    inode.child_offset = inode.child_count = 0;
+  }
+  free_inodes.clear();
+  munmap(mapping, mapping_size);
+  mapping = nullptr;
+  mapping_size = 0;
+  adopt();
+}
+
+bool VirtualFileSystem::isLive(uint32_t inode) const {
+  return inode < inode_count && !(node(inode).flags & kFree);
+}
+
+bool VirtualFileSystem::before(uint32_t a, uint32_t b) const {
+  const Inode &x = node(a);
+  const Inode &y = node(b);
+  bool x_dir = (x.flags & kDirectory) != 0;
+  bool y_dir = (y.flags & kDirectory) != 0;
+  if (x_dir != y_dir) {
+    return x_dir;
+  }
+  int c = compareFolded(nameOf(x), x.name_length, nameOf(y), y.name_length);
+  if (c != 0) {
+    return c < 0;
+  }
+  // Names differing only in case: fall back to bytes for a total order.
+  c = std::memcmp(nameOf(x), nameOf(y), x.name_length);
+  return c < 0;
+}
+
+// ============================================================================
+// Name index
+// ============================================================================
+
+void VirtualFileSystem::indexInsert(uint32_t inode) {
+  uint32_t slot = homeSlot(own_inodes[inode].hash);
+  while (own_index[slot] != kInvalid) {
+    slot = (slot + 1) & index_mask;
+  }
+  own_index[slot] = inode;
+}
+
+// Linear probing with backward-shift deletion, so no tombstones build up.
+void VirtualFileSystem::indexErase(uint32_t inode) {
+  uint32_t slot = homeSlot(own_inodes[inode].hash);
+  while (own_index[slot] != inode) {
+    slot = (slot + 1) & index_mask;
+  }
+  uint32_t hole = slot;
+  for (uint32_t next = (hole + 1) & index_mask; own_index[next] != kInvalid;
+       next = (next + 1) & index_mask) {
+    uint32_t home = homeSlot(own_inodes[own_index[next]].hash);
+    // Move the entry back unless its home lies cyclically in (hole, next].
+    bool stays = hole <= next ? (home > hole && home <= next)
+                              : (home > hole || home <= next);
+    if (!stays) {
+      own_index[hole] = own_index[next];
+      hole = next;
+    }
+  }
+  own_index[hole] = kInvalid;
+}
+
+void VirtualFileSystem::growIndex() {
+  if ((live_count + 1) <= (index_mask + 1) / 4 * 3) {
+    return;
+  }
+  own_index.assign((size_t)(index_mask + 1) * 2, kInvalid);
+  index_mask = (uint32_t)own_index.size() - 1;
+  for (uint32_t i = 1; i < own_inodes.size(); i++) {
+    if (!(own_inodes[i].flags & kFree)) {
+      indexInsert(i);
+    }
+  }
+}
+
+uint32_t VirtualFileSystem::lookup(uint32_t parent, const char *name,
+                                   size_t length) const {
+  if (!isDirectory(parent)) {
+    return kInvalid;
+  }
+  uint32_t hash = hashName(parent, name, length);
+  for (uint32_t slot = homeSlot(hash);; slot = (slot + 1) & index_mask) {
+    uint32_t candidate = index[slot];
+    if (candidate == kInvalid) {
+      return kInvalid;
+    }
+    const Inode &inode = node(candidate);
+    if (inode.hash == hash && inode.parent == parent &&
+        inode.name_length == length &&
+        std::memcmp(nameOf(inode), name, length) == 0) {
+      return candidate;
+    }
+  }
+}
+
+uint32_t VirtualFileSystem::lookup(const std::string &path) const {
+  uint32_t current = kRoot;
+  size_t pos = 0;
+  while (pos < path.size() && current != kInvalid) {
+    size_t end = path.find('/', pos);
+    if (end == std::string::npos) {
+      end = path.size();
+    }
+    size_t length = end - pos;
+    if (length == 0 || (length == 1 && path[pos] == '.')) {
+      // skip
+    } else if (length == 2 && path[pos] == '.' && path[pos + 1] == '.') {
+      current = node(current).parent;
+    } else {
+      current = lookup(current, path.data() + pos, length);
+    }
+    pos = end + 1;
+  }
+  return current;
+}
+
+// ============================================================================
+// Mutation
+// ============================================================================
+
+uint32_t VirtualFileSystem::allocateInode() {
+  if (!free_inodes.empty()) {
+    uint32_t inode = free_inodes.back();
+    free_inodes.pop_back();
+    return inode;
+  }
+  own_inodes.push_back(Inode{});
+  children.emplace_back();
+  return (uint32_t)own_inodes.size() - 1;
+}
+
+// Replaced names stay in the pool until save() compacts it.
+uint32_t VirtualFileSystem::appendName(const char *name, size_t length) {
+  uint32_t offset = (uint32_t)own_names.size();
+  own_names.insert(own_names.end(), name, name + length);
+  return offset;
+}
+
+void VirtualFileSystem::linkChild(uint32_t parent, uint32_t inode) {
+  std::vector<uint32_t> &list = children[parent];
+  list.push_back(inode);
+  // Appending in order (as bulk loads usually do) keeps the list sorted;
+  // anything else is sorted once, on the next list().
+  if (list.size() > 1 && !before(list[list.size() - 2], inode)) {
+    own_inodes[parent].flags |= kUnsorted;
+  }
+}
+
+void VirtualFileSystem::unlinkChild(uint32_t parent, uint32_t inode) {
+  std::vector<uint32_t> &list = children[parent];
+  auto it = list.end();
+  if (!(own_inodes[parent].flags & kUnsorted)) {
+    it = std::lower_bound(
+        list.begin(), list.end(), inode,
+        [this](uint32_t a, uint32_t b) { return before(a, b); });
+  }
+  if (it == list.end() || *it != inode) {
+    it = std::find(list.begin(), list.end(), inode);
+  }
+  list.erase(it);
+}
+
+void VirtualFileSystem::sortChildren(uint32_t directory) {
+  std::vector<uint32_t> &list = children[directory];
+  std::sort(list.begin(), list.end(),
+            [this](uint32_t a, uint32_t b) { return before(a, b); });
+  own_inodes[directory].flags &= ~kUnsorted;
+}
+
+void VirtualFileSystem::touch(uint32_t inode, int64_t mtime) {
+  own_inodes[inode].mtime = mtime ? mtime : now();
+}
+
+uint32_t VirtualFileSystem::create(uint32_t parent, const std::string &name,
+                                   bool directory, uint64_t size,
+                                   int64_t mtime) {
+  if (!isDirectory(parent) || !validName(name) ||
+      lookup(parent, name.data(), name.size()) != kInvalid) {
+    return kInvalid;
+  }
+  materialize();
+  growIndex();
+
+  uint32_t inode = allocateInode();
+  Inode &entry = own_inodes[inode];
+  entry = Inode{};
+  entry.size = size;
+  entry.mtime = mtime ? mtime : now();
+  entry.parent = parent;
+  entry.hash = hashName(parent, name.data(), name.size());
+  entry.name_length = (uint32_t)name.size();
+  entry.flags = directory ? kDirectory : 0;
+  own_inodes[inode].name_offset = appendName(name.data(), name.size());
+  adopt();
+
+  indexInsert(inode);
+  linkChild(parent, inode);
+  touch(parent, 0);
+  live_count++;
+  return inode;
+}
+
+uint32_t VirtualFileSystem::makeDirectories(const std::string &path) {
+  uint32_t current = kRoot;
+  size_t pos = 0;
+  while (pos < path.size()) {
+    size_t end = path.find('/', pos);
+    if (end == std::string::npos) {
+      end = path.size();
+    }
+    if (end > pos) {
+      uint32_t next = lookup(current, path.data() + pos, end - pos);
+      if (next == kInvalid) {
+        next = create(current, path.substr(pos, end - pos), true);
+      }
+      if (!isDirectory(next)) {
+        return kInvalid;
+      }
+      current = next;
+    }
+    pos = end + 1;
+  }
+  return current;
+}
+
+bool VirtualFileSystem::remove(uint32_t inode) {
+  if (inode == kRoot || !isLive(inode)) {
+    return false;
+  }
+  materialize();
+  uint32_t parent = own_inodes[inode].parent;
+  unlinkChild(parent, inode);
+  touch(parent, 0);
+
+  std::vector<uint32_t> pending(1, inode);
+  while (!pending.empty()) {
+    uint32_t current = pending.back();
+    pending.pop_back();
+    pending.insert(pending.end(), children[current].begin(),
+                   children[current].end());
+    children[current].clear();
+    children[current].shrink_to_fit();
+    indexErase(current);
+    own_inodes[current].flags = kFree;
+    free_inodes.push_back(current);
+    live_count--;
+  }
+  return true;
+}
+
+bool VirtualFileSystem::rename(uint32_t inode, uint32_t new_parent,
+                               const std::string &name) {
+  if (inode == kRoot || !isLive(inode) || !isDirectory(new_parent) ||
+      !validName(name)) {
+    return false;
+  }
+  uint32_t existing = lookup(new_parent, name.data(), name.size());
+  if (existing == inode) {
+    return true;
+  }
+  if (existing != kInvalid) {
+    return false;
+  }
+  // A directory cannot move into its own subtree.
+  for (uint32_t up = new_parent; up != kRoot; up = node(up).parent) {
+    if (up == inode) {
+      return false;
+    }
+  }
+  materialize();
+
+  uint32_t old_parent = own_inodes[inode].parent;
+  indexErase(inode);
+  unlinkChild(old_parent, inode);
+  touch(old_parent, 0);
+
+  const Inode &current = own_inodes[inode];
+  if (current.name_length != name.size() ||
+      std::memcmp(nameOf(current), name.data(), name.size()) != 0) {
+    uint32_t offset = appendName(name.data(), name.size());
+    adopt();
+    own_inodes[inode].name_offset = offset;
+    own_inodes[inode].name_length = (uint32_t)name.size();
+  }
+  own_inodes[inode].parent = new_parent;
+  own_inodes[inode].hash = hashName(new_parent, name.data(), name.size());
+  indexInsert(inode);
+  linkChild(new_parent, inode);
+  touch(new_parent, 0);
+  return true;
+}
+
+bool VirtualFileSystem::setSize(uint32_t inode, uint64_t size, int64_t mtime) {
+  if (!isLive(inode)) {
+    return false;
+  }
+  materialize();
+  own_inodes[inode].size = size;
+  touch(inode, mtime);
+  return true;
+}
+
+// ============================================================================
+// Queries
+// ============================================================================
+
+bool VirtualFileSystem::stat(uint32_t inode, VfsStat &out) const {
+  if (!isLive(inode)) {
+    return false;
+  }
+  const Inode &entry = node(inode);
+  out.inode = inode;
+  out.parent = entry.parent;
+  out.is_directory = (entry.flags & kDirectory) != 0;
+  out.size = entry.size;
+  out.mtime = entry.mtime;
+  return true;
+}
+
+bool VirtualFileSystem::isDirectory(uint32_t inode) const {
+  return isLive(inode) && (node(inode).flags & kDirectory);
+}
+
+std::string VirtualFileSystem::name(uint32_t inode) const {
+  if (!isLive(inode)) {
+    return std::string();
+  }
+  const Inode &entry = node(inode);
+  return std::string(nameOf(entry), entry.name_length);
+}
+
+std::string VirtualFileSystem::path(uint32_t inode) const {
+  if (!isLive(inode)) {
+    return std::string();
+  }
+  if (inode == kRoot) {
+    return "/";
+  }
+  std::vector<uint32_t> chain;
+  for (uint32_t up = inode; up != kRoot; up = node(up).parent) {
+    chain.push_back(up);
+  }
+  std::string result;
+  for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+    const Inode &entry = node(*it);
+    result += '/';
+    result.append(nameOf(entry), entry.name_length);
+  }
+  return result;
+}
+
+VfsListing VirtualFileSystem::list(uint32_t directory) {
+  if (!isDirectory(directory)) {
+    return VfsListing{nullptr, 0};
+  }
+  if (mapping) {
+    const Inode &entry = node(directory);
+    return VfsListing{image_children + entry.child_offset, entry.child_count};
+  }
+  if (own_inodes[directory].flags & kUnsorted) {
+    sortChildren(directory);
+  }
+  const std::vector<uint32_t> &list = children[directory];
+  return VfsListing{list.data(), (uint32_t)list.size()};
+}
+
+// ============================================================================
+// Image files
+// ============================================================================
+// Layout: header, inodes, index, children, names. Inodes are renumbered
+// breadth-first so each directory's children are adjacent and in listing
+// order; the index is rebuilt at the smallest capacity that fits.
+
+bool VirtualFileSystem::save(const std::string &image_path) {
+  std::vector<uint32_t> order(1, kRoot);
+  std::vector<uint32_t> renumber(inode_count, kInvalid);
+  renumber[kRoot] = 0;
+  for (size_t i = 0; i < order.size(); i++) {
+    VfsListing listing = list(order[i]);
+    for (uint32_t k = 0; k < listing.count; k++) {
+      renumber[listing.entries[k]] = (uint32_t)order.size();
+      order.push_back(listing.entries[k]);
+    }
+  }
+
+  uint32_t count = (uint32_t)order.size();
+  std::vector<Inode> out_inodes(count);
+  std::vector<uint32_t> out_children;
+  std::vector<char> out_names(1, '\0');
+  out_children.reserve(count - 1);
+  uint32_t next_child = 1;
+  for (uint32_t n = 0; n < count; n++) {
+    const Inode &src = node(order[n]);
+    Inode &dst = out_inodes[n];
+    dst = src;
+    dst.parent = renumber[src.parent];
+    dst.flags &= kDirectory;
+    dst.name_offset = n == 0 ? 0 : (uint32_t)out_names.size();
+    if (n != 0) {
+      out_names.insert(out_names.end(), nameOf(src),
+                       nameOf(src) + src.name_length);
+    }
+    dst.hash = hashName(dst.parent, nameOf(src), src.name_length);
+    dst.child_offset = (uint32_t)out_children.size();
+    dst.child_count = 0;
+    if (src.flags & kDirectory) {
+      dst.child_count = list(order[n]).count;
+      for (uint32_t k = 0; k < dst.child_count; k++) {
+        out_children.push_back(next_child++);
+      }
+    }
+    dst.reserved = 0;
+  }
+  out_inodes[0].hash = 0;
+
+  uint32_t capacity = indexCapacityFor(count);
+  std::vector<uint32_t> out_index(capacity, kInvalid);
+  for (uint32_t n = 1; n < count; n++) {
+    uint32_t slot = out_inodes[n].hash & (capacity - 1);
+    while (out_index[slot] != kInvalid) {
+      slot = (slot + 1) & (capacity - 1);
+    }
+    out_index[slot] = n;
+  }
+
+  ImageHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, kImageMagic, sizeof(header.magic));
+  header.version = kImageVersion;
+  header.inode_count = count;
+  header.index_capacity = capacity;
+  header.child_count = (uint32_t)out_children.size();
+  header.names_size = (uint32_t)out_names.size();
+  header.inode_size = sizeof(Inode);
+
+  // Write beside the target and rename, so a crash never leaves a torn
+  // image and an existing mapping of the old file stays valid.
+  std::string temp_path = image_path + ".tmp";
+  int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  struct Chunk {
+    const void *data;
+    size_t size;
+  } chunks[] = {
+      {&header, sizeof(header)},
+      {out_inodes.data(), out_inodes.size() * sizeof(Inode)},
+      {out_index.data(), out_index.size() * sizeof(uint32_t)},
+      {out_children.data(), out_children.size() * sizeof(uint32_t)},
+      {out_names.data(), out_names.size()},
+  };
+  bool ok = true;
+  for (const Chunk &chunk : chunks) {
+    const char *data = (const char *)chunk.data;
+    size_t left = chunk.size;
+    while (ok && left > 0) {
+      ssize_t written = ::write(fd, data, left);
+      if (written <= 0) {
+        ok = false;
+      } else {
+        data += written;
+        left -= (size_t)written;
+      }
+    }
+  }
+  ok = ::fsync(fd) == 0 && ok;
+  ok = ::close(fd) == 0 && ok;
+  if (!ok || ::rename(temp_path.c_str(), image_path.c_str()) != 0) {
+    ::unlink(temp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+// One pass over the tables: every offset and count stays inside its
+// section, parents come before their children (so walking up terminates),
+// child lists and parents agree, and the index leaves an empty slot.
+bool VirtualFileSystem::validImage(const void *base, size_t size) {
+  if (size < sizeof(ImageHeader)) {
+    return false;
+  }
+  const ImageHeader *header = (const ImageHeader *)base;
+  uint64_t expected = sizeof(ImageHeader) +
+                      (uint64_t)header->inode_count * sizeof(Inode) +
+                      (uint64_t)header->index_capacity * sizeof(uint32_t) +
+                      (uint64_t)header->child_count * sizeof(uint32_t) +
+                      header->names_size;
+  uint32_t count = header->inode_count;
+  uint32_t capacity = header->index_capacity;
+  if (std::memcmp(header->magic, kImageMagic, sizeof(header->magic)) != 0 ||
+      header->version != kImageVersion ||
+      header->inode_size != sizeof(Inode) || count == 0 ||
+      capacity < kMinIndexCapacity || (capacity & (capacity - 1)) != 0 ||
+      capacity <= count || header->names_size == 0 || expected != size) {
+    return false;
+  }
+
+  const char *cursor = (const char *)base + sizeof(ImageHeader);
+  const Inode *table = (const Inode *)cursor;
+  cursor += (size_t)count * sizeof(Inode);
+  const uint32_t *slots = (const uint32_t *)cursor;
+  cursor += (size_t)capacity * sizeof(uint32_t);
+  const uint32_t *kids = (const uint32_t *)cursor;
+
+  if (!(table[kRoot].flags & kDirectory) || table[kRoot].parent != kRoot) {
+    return false;
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    const Inode &inode = table[i];
+    if ((inode.flags & ~kDirectory) != 0 ||
+        (uint64_t)inode.name_offset + inode.name_length > header->names_size ||
+        (uint64_t)inode.child_offset + inode.child_count >
+            header->child_count) {
+      return false;
+    }
+    if (i != kRoot && (inode.parent >= i || inode.name_length == 0 ||
+                       !(table[inode.parent].flags & kDirectory))) {
+      return false;
+    }
+    if (!(inode.flags & kDirectory) && inode.child_count != 0) {
+      return false;
+    }
+    for (uint32_t k = 0; k < inode.child_count; k++) {
+      uint32_t child = kids[inode.child_offset + k];
+      if (child == kRoot || child >= count || table[child].parent != i) {
+        return false;
+      }
+    }
+  }
+  uint32_t used = 0;
+  for (uint32_t slot = 0; slot < capacity; slot++) {
+    if (slots[slot] == kInvalid) {
+      continue;
+    }
+    if (slots[slot] == kRoot || slots[slot] >= count) {
+      return false;
+    }
+    used++;
+  }
+  return used < count;
+}
+
+bool VirtualFileSystem::open(const std::string &image_path) {
+  int fd = ::open(image_path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  void *base = MAP_FAILED;
+  if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+    base = ::mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  ::close(fd);
+  if (base == MAP_FAILED) {
+    return false;
+  }
+
+  size_t size = (size_t)st.st_size;
+  if (!validImage(base, size)) {
+    ::munmap(base, size);
+    return false;
+  }
+
+  const ImageHeader *header = (const ImageHeader *)base;
+  uint32_t capacity = header->index_capacity;
+  reset();
+  own_inodes.clear();
+  own_names.clear();
+  own_index.clear();
+  children.clear();
+
+  const char *cursor = (const char *)base + sizeof(ImageHeader);
+  inodes = (const Inode *)cursor;
+  cursor += (size_t)header->inode_count * sizeof(Inode);
+  index = (const uint32_t *)cursor;
+  cursor += (size_t)capacity * sizeof(uint32_t);
+  image_children = (const uint32_t *)cursor;
+  cursor += (size_t)header->child_count * sizeof(uint32_t);
+  names = cursor;
+  inode_count = header->inode_count;
+  index_mask = capacity - 1;
+  live_count = header->inode_count;
+  mapping = base;
+  mapping_size = size;
+  return true;
+}
+
+} // namespace System
+} // namespace OS
@@ -0,0 +1,334 @@
+// Frame arena - double-buffered bump allocator and steady-state simulation
+
+#include "frame_arena.h"
+#include "utils.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct ArenaBlock {
+  struct ArenaBlock *next;
+  size_t size;         // usable bytes in data
+  _Atomic size_t used; // bump cursor
+  _Alignas(FRAME_ARENA_ALIGN) uint8_t data[];
+} ArenaBlock;
+
+// One side per frame parity. Blocks before current are full for this
+// frame, blocks after it are spare.
+typedef struct {
+  ArenaBlock *first;
+  _Atomic(ArenaBlock *) current;
+} ArenaSide;
+
+struct FrameArena {
+  size_t block_size;
+  ArenaSide sides[2];
+  uint32_t active;
+  uint64_t frames;
+  uint64_t high_water;
+
+  pthread_mutex_t lock; // block chains and the counters below
+  uint64_t capacity;
+  uint64_t system_allocs;
+  uint32_t blocks;
+};
+
+// Larger requests would wrap align_size or the block header; no system
+// could satisfy them anyway.
+#define ARENA_MAX_REQUEST (SIZE_MAX / 2)
+
+static inline size_t align_size(size_t size) {
+  return (size + FRAME_ARENA_ALIGN - 1) & ~(size_t)(FRAME_ARENA_ALIGN - 1);
+}
+
+// ============================================================================
+// Lifecycle
+// ============================================================================
+
+FrameArena *frame_arena_create(size_t block_size) {
+  FrameArena *arena = (FrameArena *)calloc(1, sizeof(FrameArena));
+  if (!arena) {
+    return NULL;
+  }
+  arena->block_size = align_size(block_size ? block_size
+                                            : FRAME_ARENA_BLOCK_SIZE);
+  pthread_mutex_init(&arena->lock, NULL);
+  return arena;
+}
+
+void frame_arena_destroy(FrameArena *arena) {
+  if (!arena) {
+    return;
+  }
+  for (int s = 0; s < 2; s++) {
+    ArenaBlock *block = arena->sides[s].first;
+    while (block) {
+      ArenaBlock *next = block->next;
+      free(block);
+      block = next;
+    }
+  }
+  pthread_mutex_destroy(&arena->lock);
+  free(arena);
+}
+
+// ============================================================================
+// Allocation
+// ============================================================================
+
+// The current block (seen) cannot fit size more bytes: move current on to a
+// spare block that can, pulling it forward in the chain, or link in a new
+// block. Another thread may have moved current already, in which case the
+// caller just retries.
+static bool advance(FrameArena *arena, ArenaSide *side, ArenaBlock *seen,
+                    size_t size) {
+  pthread_mutex_lock(&arena->lock);
+  if (atomic_load_explicit(&side->current, memory_order_relaxed) != seen) {
+    pthread_mutex_unlock(&arena->lock);
+    return true;
+  }
+  // Best fit among the spare blocks, so ordinary requests leave the
+  // oversized blocks to the requests they were made for.
+  ArenaBlock **link = seen ? &seen->next : &side->first;
+  ArenaBlock **fit = NULL;
+  for (ArenaBlock **b = link; *b; b = &(*b)->next) {
+    if ((*b)->size >= size && (!fit || (*b)->size < (*fit)->size)) {
+      fit = b;
+      if ((*b)->size == arena->block_size) {
+        break;
+      }
+    }
+  }
+  ArenaBlock *block = fit ? *fit : NULL;
+  if (block) {
+    *fit = block->next; // unlink, relinked below
+  } else {
+    size_t usable = size > arena->block_size ? size : arena->block_size;
+    block = (ArenaBlock *)malloc(sizeof(ArenaBlock) + usable);
+    if (!block) {
+      pthread_mutex_unlock(&arena->lock);
+      return false;
+    }
+    block->size = usable;
+    arena->capacity += usable;
+    arena->system_allocs++;
+    arena->blocks++;
+  }
+  block->next = *link;
+  *link = block;
+  atomic_store_explicit(&block->used, 0, memory_order_relaxed);
+  atomic_store_explicit(&side->current, block, memory_order_release);
+  pthread_mutex_unlock(&arena->lock);
+  return true;
+}
+
+void *frame_arena_alloc(FrameArena *arena, size_t size) {
+  if (size > ARENA_MAX_REQUEST) {
+    return NULL;
+  }
+  size = align_size(size ? size : 1);
+  ArenaSide *side = &arena->sides[arena->active];
+  for (;;) {
+    ArenaBlock *block =
+        atomic_load_explicit(&side->current, memory_order_acquire);
+    if (block) {
+      size_t used = atomic_load_explicit(&block->used, memory_order_relaxed);
+      while (used + size <= block->size) {
+        if (atomic_compare_exchange_weak_explicit(&block->used, &used,
+                                                  used + size,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+          return block->data + used;
+        }
+      }
+    }
+    if (!advance(arena, side, block, size)) {
+      return NULL;
+    }
+  }
+}
+
+void *frame_arena_calloc(FrameArena *arena, size_t count, size_t size) {
+  if (size && count > SIZE_MAX / size) {
+    return NULL;
+  }
+  void *ptr = frame_arena_alloc(arena, count * size);
+  if (ptr) {
+    memset(ptr, 0, count * size);
+  }
+  return ptr;
+}
+
+void *frame_arena_grow(FrameArena *arena, void *ptr, size_t old_size,
+                       size_t new_size) {
+  if (!ptr) {
+    return frame_arena_alloc(arena, new_size);
+  }
+  if (new_size <= old_size) {
+    return ptr;
+  }
+  if (new_size > ARENA_MAX_REQUEST) {
+    return NULL;
+  }
+  ArenaSide *side = &arena->sides[arena->active];
+  ArenaBlock *block =
+      atomic_load_explicit(&side->current, memory_order_relaxed);
+  size_t old_aligned = align_size(old_size);
+  size_t new_aligned = align_size(new_size);
+  if (block) {
+    size_t used = atomic_load_explicit(&block->used, memory_order_relaxed);
+    if ((uint8_t *)ptr + old_aligned == block->data + used &&
+        used - old_aligned + new_aligned <= block->size) {
+      atomic_store_explicit(&block->used, used - old_aligned + new_aligned,
+                            memory_order_relaxed);
+      return ptr;
+    }
+  }
+  void *moved = frame_arena_alloc(arena, new_size);
+  if (moved) {
+    memcpy(moved, ptr, old_size);
+  }
+  return moved;
+}
+
+// ============================================================================
+// Frames
+// ============================================================================
+
+// Bytes handed out on a side this frame (blocks up to and including current;
+// the cursors never pass their block's size).
+static uint64_t side_bytes(ArenaSide *side) {
+  ArenaBlock *current =
+      atomic_load_explicit(&side->current, memory_order_relaxed);
+  uint64_t bytes = 0;
+  for (ArenaBlock *block = side->first; current && block; block = block->next) {
+    bytes += atomic_load_explicit(&block->used, memory_order_relaxed);
+    if (block == current) {
+      break;
+    }
+  }
+  return bytes;
+}
+
+void frame_arena_end_frame(FrameArena *arena) {
+  uint64_t bytes = side_bytes(&arena->sides[arena->active]);
+  if (bytes > arena->high_water) {
+    arena->high_water = bytes;
+  }
+  arena->frames++;
+  arena->active ^= 1;
+
+  // Rewind the side two frames old; its spare blocks are reset as current
+  // reaches them.
+  ArenaSide *side = &arena->sides[arena->active];
+  if (side->first) {
+    atomic_store_explicit(&side->first->used, 0, memory_order_relaxed);
+  }
+  atomic_store_explicit(&side->current, side->first, memory_order_release);
+}
+
+uint64_t frame_arena_frame(const FrameArena *arena) { return arena->frames; }
+
+void frame_arena_get_stats(FrameArena *arena, FrameArenaStats *stats) {
+  memset(stats, 0, sizeof(*stats));
+  stats->frames = arena->frames;
+  stats->high_water = arena->high_water;
+  pthread_mutex_lock(&arena->lock);
+  stats->bytes = side_bytes(&arena->sides[arena->active]);
+  stats->capacity = arena->capacity;
+  stats->system_allocs = arena->system_allocs;
+  stats->blocks = arena->blocks;
+  pthread_mutex_unlock(&arena->lock);
+}
+
+// ============================================================================
+// Simulation
+// ============================================================================
+
+static uint64_t sim_random(uint64_t *state) {
+  // xorshift64*
+  uint64_t x = *state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *state = x;
+  return x * 0x2545f4914f6cdd1dull;
+}
+
+static uint64_t sim_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+bool frame_arena_simulate(const FrameArenaSimConfig *config,
+                          FrameArenaSimResult *result) {
+  if (!config || !result || config->shapes == 0 || config->max_alloc == 0) {
+    return false;
+  }
+  memset(result, 0, sizeof(*result));
+  FrameArena *arena = frame_arena_create(0);
+  if (!arena) {
+    return false;
+  }
+
+  bool ok = true;
+  uint64_t allocs = 0;
+  uint64_t warm_system_allocs = 0;
+  uint64_t start = sim_now_ns();
+  for (uint32_t frame = 0; frame < config->frames && ok; frame++) {
+    if (frame == config->warmup_frames) {
+      FrameArenaStats stats;
+      frame_arena_get_stats(arena, &stats);
+      warm_system_allocs = stats.system_allocs;
+    }
+    uint64_t state = (config->seed ^ ((uint64_t)(frame % config->shapes) *
+                                      0x9e3779b97f4a7c15ull)) | 1;
+    for (uint32_t i = 0; i < config->allocs_per_frame && ok; i++) {
+      uint64_t r = sim_random(&state);
+      switch (r & 7) {
+      case 0: { // window title
+        char *title = string_format_in(arena, "Window %u - %ux%u",
+                                       (unsigned)(r >> 8 & 0xff),
+                                       (unsigned)(r >> 16 & 0xfff),
+                                       (unsigned)(r >> 28 & 0xfff));
+        ok = title != NULL;
+        break;
+      }
+      case 1: { // visible layer list
+        Vector *vec = vector_create_in(arena, 0);
+        ok = vec != NULL;
+        for (uint64_t n = (r >> 8) & 31; ok && n > 0; n--) {
+          vector_push(vec, vec);
+        }
+        ok = ok && vec->count == ((r >> 8) & 31);
+        vector_destroy(vec);
+        break;
+      }
+      default: { // scratch row or command buffer
+        size_t size = 1 + (size_t)((r >> 8) % config->max_alloc);
+        uint8_t *scratch = (uint8_t *)frame_arena_alloc(arena, size);
+        ok = scratch != NULL;
+        if (ok) {
+          scratch[0] = scratch[size - 1] = (uint8_t)r;
+        }
+        break;
+      }
+      }
+      allocs++;
+    }
+    frame_arena_end_frame(arena);
+  }
+  uint64_t elapsed = sim_now_ns() - start;
+
+  frame_arena_get_stats(arena, &result->after);
+  if (config->frames > config->warmup_frames) {
+    result->steady_system_allocs =
+        result->after.system_allocs - warm_system_allocs;
+  }
+  result->ns_per_alloc = allocs ? (double)elapsed / (double)allocs : 0.0;
+  frame_arena_destroy(arena);
+  return ok && result->steady_system_allocs == 0;
+}
@@ -0,0 +1,1277 @@
+// Logger - per-thread record rings, a draining thread and the binary log
+
+#include "logger.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define LOG_CACHE_LINE 64
+#define LOG_RING_MASK ((uint64_t)LOG_RING_BYTES - 1)
+#define LOG_SITE_TEXT 0              // preformatted: level, line, file, text
+#define LOG_SITE_OVERFLOW UINT32_MAX // registry full; formats on the caller
+#define LOG_RECORD_PAD UINT32_MAX    // skips the end of the ring
+#define LOG_DRAIN_INTERVAL_NS 1000000
+#define LOG_COPY_SLACK 8 // copy_string may store this far past a string
+#define LOG_RECORD_MAX                                                         \
+  (sizeof(LogRecord) + LOG_MAX_ARGS * (8 + LOG_STRING_MAX) + LOG_COPY_SLACK)
+
+static const char *const LOG_LEVEL_NAMES[] = {"ERROR", "WARN", "INFO", "DEBUG"};
+
+static uint64_t monotonic_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Cheapest monotonic counter there is; converted to nanoseconds when the
+// records are drained, never on the logging thread.
+static inline uint64_t log_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#elif defined(__aarch64__)
+  uint64_t ticks;
+  __asm__ volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+  return ticks;
+#else
+  return monotonic_ns();
+#endif
+}
+
+// ============================================================================
+// Format parsing
+// ============================================================================
+
+// How each conversion's argument is read from the va_list; every kind is
+// stored in one 8-byte slot, strings followed by their bytes.
+typedef enum {
+  ARG_NONE, // %% or an unknown conversion: no argument
+  ARG_INT,
+  ARG_LONG,
+  ARG_LLONG,
+  ARG_INTMAX,
+  ARG_SIZE,
+  ARG_PTRDIFF,
+  ARG_DOUBLE,
+  ARG_LDOUBLE, // stored and printed as a double
+  ARG_STRING,
+  ARG_POINTER,
+  ARG_UNSUPPORTED // %n, wide strings
+} LogArgKind;
+
+#define LOG_PRECISION_NONE (-1)
+#define LOG_PRECISION_STAR (-2) // the int argument just before the value
+
+typedef struct {
+  uint32_t stars; // '*' width and precision, each an int argument first
+  int precision;  // a number, LOG_PRECISION_NONE or LOG_PRECISION_STAR
+  LogArgKind kind;
+  const char *end; // one past the conversion character
+} LogSpec;
+
+// p points just past a '%'.
+static void parse_spec(const char *p, LogSpec *spec) {
+  spec->stars = 0;
+  spec->precision = LOG_PRECISION_NONE;
+  while (*p && strchr("-+ #0'", *p)) {
+    p++;
+  }
+  if (*p == '*') {
+    spec->stars++;
+    p++;
+  }
+  while (*p >= '0' && *p <= '9') {
+    p++;
+  }
+  if (*p == '.') {
+    p++;
+    if (*p == '*') {
+      spec->stars++;
+      spec->precision = LOG_PRECISION_STAR;
+      p++;
+    } else {
+      spec->precision = 0;
+    }
+    for (; *p >= '0' && *p <= '9'; p++) {
+      if (spec->precision < LOG_STRING_MAX) {
+        spec->precision = spec->precision * 10 + (*p - '0');
+      }
+    }
+  }
+
+  int longs = 0;
+  char size = 0;
+  for (;; p++) {
+    if (*p == 'l') {
+      longs++;
+    } else if (*p == 'h') {
+    } else if (*p == 'L' || *p == 'j' || *p == 'z' || *p == 't' ||
+               *p == 'q') {
+      size = *p;
+    } else {
+      break;
+    }
+  }
+
+  char conversion = *p;
+  spec->end = conversion ? p + 1 : p;
+  switch (conversion) {
+  case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+    spec->kind = size == 'j'                 ? ARG_INTMAX
+                 : size == 'z'               ? ARG_SIZE
+                 : size == 't'               ? ARG_PTRDIFF
+                 : size == 'q' || longs >= 2 ? ARG_LLONG
+                 : longs == 1                ? ARG_LONG
+                                             : ARG_INT;
+    break;
+  case 'c':
+    spec->kind = longs ? ARG_UNSUPPORTED : ARG_INT;
+    break;
+  case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a':
+  case 'A':
+    spec->kind = size == 'L' ? ARG_LDOUBLE : ARG_DOUBLE;
+    break;
+  case 's':
+    spec->kind = longs ? ARG_UNSUPPORTED : ARG_STRING;
+    break;
+  case 'p':
+    spec->kind = ARG_POINTER;
+    break;
+  case 'n':
+    spec->kind = ARG_UNSUPPORTED;
+    break;
+  default:
+    spec->kind = ARG_NONE; // "%%", or printed as written
+    break;
+  }
+}
+
+// Argument kinds in order; -1 when the format cannot be captured. With
+// limits, each string argument also gets its precision: "%.4s" may be
+// passed an array that is not NUL-terminated, so capture reads no further.
+static int parse_format(const char *format, uint8_t kinds[LOG_MAX_ARGS],
+                        int16_t limits[LOG_MAX_ARGS]) {
+  int count = 0;
+  for (const char *p = format; *p;) {
+    if (*p++ != '%') {
+      continue;
+    }
+    LogSpec spec;
+    parse_spec(p, &spec);
+    p = spec.end;
+    if (spec.kind == ARG_UNSUPPORTED ||
+        count + (int)spec.stars + 1 > LOG_MAX_ARGS) {
+      return -1;
+    }
+    for (uint32_t s = 0; s < spec.stars; s++) {
+      kinds[count++] = ARG_INT;
+    }
+    if (spec.kind != ARG_NONE) {
+      if (limits) {
+        limits[count] = (int16_t)(spec.precision < LOG_STRING_MAX
+                                      ? spec.precision
+                                      : LOG_STRING_MAX);
+      }
+      kinds[count++] = (uint8_t)spec.kind;
+    }
+  }
+  return count;
+}
+
+// ============================================================================
+// Record payloads
+// ============================================================================
+
+// [header][one slot per argument][string bytes, each padded to 8], all
+// padded to 16 so a pad header always fits at the end of the ring.
+typedef struct {
+  uint32_t site;
+  uint32_t size; // whole record
+  uint64_t ticks;
+} LogRecord;
+
+static inline size_t align8(size_t n) { return (n + 7) & ~(size_t)7; }
+static inline size_t align16(size_t n) { return (n + 15) & ~(size_t)15; }
+
+typedef struct {
+  const uint8_t *data;
+  size_t size;
+  size_t slot;   // next argument slot
+  size_t string; // next string bytes
+} PayloadReader;
+
+static bool payload_next(PayloadReader *reader, uint64_t *value) {
+  if (reader->slot + 8 > reader->string || reader->slot + 8 > reader->size) {
+    return false;
+  }
+  memcpy(value, reader->data + reader->slot, 8);
+  reader->slot += 8;
+  return true;
+}
+
+static bool payload_string(PayloadReader *reader, uint64_t length,
+                           const char **text) {
+  if (length > LOG_STRING_MAX || reader->string + length > reader->size) {
+    return false;
+  }
+  *text = (const char *)reader->data + reader->string;
+  reader->string += align8((size_t)length);
+  return true;
+}
+
+static size_t append(char *out, size_t size, size_t used, const char *text,
+                     size_t length) {
+  if (used + 1 < size) {
+    size_t room = size - used - 1;
+    memcpy(out + used, text, length < room ? length : room);
+    out[used + (length < room ? length : room)] = '\0';
+  }
+  return used + length;
+}
+
+// Formats one conversion at a time, rebuilding each spec with its '*'
+// arguments written out so a single value can be passed to snprintf.
+static void format_payload(const char *format, uint32_t count,
+                           const uint8_t *data, size_t size, char *out,
+                           size_t out_size) {
+  PayloadReader reader = {data, size, 0, (size_t)count * 8};
+  size_t used = 0;
+  out[0] = '\0';
+  for (const char *p = format; *p;) {
+    const char *percent = strchr(p, '%');
+    if (!percent) {
+      used = append(out, out_size, used, p, strlen(p));
+      break;
+    }
+    used = append(out, out_size, used, p, (size_t)(percent - p));
+    LogSpec spec;
+    parse_spec(percent + 1, &spec);
+    p = spec.end;
+    if (spec.kind == ARG_NONE) {
+      bool escaped = percent[1] == '%';
+      used = append(out, out_size, used, escaped ? "%" : percent,
+                    escaped ? 1 : (size_t)(spec.end - percent));
+      continue;
+    }
+
+    char text[64];
+    size_t length = 0;
+    for (const char *c = percent; c < spec.end && length < sizeof(text) - 24;
+         c++) {
+      if (*c == '*') {
+        uint64_t star = 0;
+        if (!payload_next(&reader, &star)) {
+          return;
+        }
+        length += (size_t)snprintf(text + length, sizeof(text) - length, "%d",
+                                   (int)star);
+      } else if (!(*c == 'L' && spec.kind == ARG_LDOUBLE)) {
+        text[length++] = *c;
+      }
+    }
+    text[length] = '\0';
+
+    uint64_t value = 0;
+    if (!payload_next(&reader, &value)) {
+      return;
+    }
+    char *dst = used + 1 < out_size ? out + used : NULL;
+    size_t room = dst ? out_size - used : 0;
+    int written = 0;
+    double real;
+    switch (spec.kind) {
+    case ARG_INT:
+      written = snprintf(dst, room, text, (int)value);
+      break;
+    case ARG_LONG:
+      written = snprintf(dst, room, text, (long)value);
+      break;
+    case ARG_LLONG:
+      written = snprintf(dst, room, text, (long long)value);
+      break;
+    case ARG_INTMAX:
+      written = snprintf(dst, room, text, (intmax_t)value);
+      break;
+    case ARG_SIZE:
+      written = snprintf(dst, room, text, (size_t)value);
+      break;
+    case ARG_PTRDIFF:
+      written = snprintf(dst, room, text, (ptrdiff_t)value);
+      break;
+    case ARG_DOUBLE:
+    case ARG_LDOUBLE:
+      memcpy(&real, &value, sizeof(real));
+      written = snprintf(dst, room, text, real);
+      break;
+    case ARG_POINTER:
+      written = snprintf(dst, room, text, (void *)(uintptr_t)value);
+      break;
+    case ARG_STRING: {
+      const char *bytes;
+      if (!payload_string(&reader, value, &bytes)) {
+        return;
+      }
+      char copy[LOG_STRING_MAX + 1];
+      memcpy(copy, bytes, (size_t)value);
+      copy[value] = '\0';
+      written = snprintf(dst, room, text, copy);
+      break;
+    }
+    default:
+      break;
+    }
+    used += written > 0 ? (size_t)written : 0;
+  }
+}
+
+// A LOG_SITE_TEXT payload: level, line, file, message
+static bool read_text(const uint8_t *data, size_t size, uint64_t *level,
+                      uint64_t *line, char file[LOG_STRING_MAX + 1],
+                      char message[LOG_STRING_MAX + 1]) {
+  PayloadReader reader = {data, size, 0, 4 * 8};
+  uint64_t length = 0;
+  const char *text = NULL;
+  if (!payload_next(&reader, level) || !payload_next(&reader, line) ||
+      *level > LOG_DEBUG_LEVEL || !payload_next(&reader, &length) ||
+      !payload_string(&reader, length, &text)) {
+    return false;
+  }
+  memcpy(file, text, (size_t)length);
+  file[length] = '\0';
+  if (!payload_next(&reader, &length) ||
+      !payload_string(&reader, length, &text)) {
+    return false;
+  }
+  memcpy(message, text, (size_t)length);
+  message[length] = '\0';
+  return true;
+}
+
+// ============================================================================
+// Call sites
+// ============================================================================
+
+typedef struct {
+  const LogSite *site;
+  bool preformat; // format not capturable; the caller formats it
+  bool strings;   // records vary in size
+  uint8_t count;
+  uint8_t kinds[LOG_MAX_ARGS];
+  int16_t limits[LOG_MAX_ARGS]; // string precisions, from parse_format
+  uint32_t max_size;            // largest record a call can make
+} SiteInfo;
+
+static pthread_mutex_t g_sites_lock = PTHREAD_MUTEX_INITIALIZER;
+static SiteInfo g_sites[LOG_MAX_SITES]; // by id; 0 is LOG_SITE_TEXT
+static uint32_t g_site_count = 1;
+
+static uint32_t register_site(LogSite *site) {
+  pthread_mutex_lock(&g_sites_lock);
+  uint32_t id = site->id; // another thread may have won
+  if (id == 0) {
+    if (g_site_count < LOG_MAX_SITES) {
+      id = g_site_count++;
+      SiteInfo *info = &g_sites[id];
+      int count = parse_format(site->format, info->kinds, info->limits);
+      info->site = site;
+      info->preformat = count < 0;
+      info->count = count < 0 ? 0 : (uint8_t)count;
+      info->strings = memchr(info->kinds, ARG_STRING, info->count) != NULL;
+      size_t max_size = sizeof(LogRecord) + (size_t)info->count * 8 +
+                        (info->strings ? LOG_COPY_SLACK : 0);
+      for (uint32_t i = 0; i < info->count; i++) {
+        if (info->kinds[i] == ARG_STRING) {
+          max_size += info->limits[i] >= 0 ? align8((size_t)info->limits[i])
+                                           : LOG_STRING_MAX;
+        }
+      }
+      info->max_size = (uint32_t)align16(max_size);
+    } else {
+      id = LOG_SITE_OVERFLOW;
+    }
+    __atomic_store_n(&site->id, id, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&g_sites_lock);
+  return id;
+}
+
+// ============================================================================
+// Thread rings
+// ============================================================================
+
+// A ring outlives its thread until the drainer has emptied it; then the
+// next thread to start logging takes it over.
+enum { LOG_RING_LIVE, LOG_RING_RETIRED, LOG_RING_FREE };
+
+typedef struct LogThread {
+  struct LogThread *next;
+  _Atomic uint32_t id;    // changes when a new thread takes the ring
+  _Atomic uint32_t state; // LOG_RING_*
+  _Alignas(LOG_CACHE_LINE) _Atomic uint64_t head; // bytes written
+  uint64_t cached_tail;                           // the owner's last look
+  _Atomic uint64_t written;
+  _Atomic uint64_t dropped;
+  _Alignas(LOG_CACHE_LINE) _Atomic uint64_t tail; // bytes drained
+  uint64_t dropped_reported;                      // drainer only
+  _Alignas(LOG_CACHE_LINE) uint8_t buffer[LOG_RING_BYTES];
+} LogThread;
+
+static _Atomic(LogThread *) g_threads;
+static _Atomic uint32_t g_thread_count;
+static _Thread_local LogThread *t_ring;
+static pthread_key_t g_ring_key; // destructor retires the exiting thread's ring
+
+// The drainer: whoever holds g_drain_lock, normally the background thread.
+static pthread_mutex_t g_drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_drain_wake = PTHREAD_COND_INITIALIZER;
+static pthread_once_t g_drain_once = PTHREAD_ONCE_INIT;
+static pthread_t g_drain_thread;
+static _Atomic bool g_running;
+static _Atomic bool g_stopping;
+static _Atomic bool g_wake_pending;
+static _Atomic uint64_t g_drained;
+
+static void log_shutdown(void);
+static void *drain_main(void *arg);
+
+// The owner has exited; its last records are already published.
+static void retire_ring(void *ring) {
+  t_ring = NULL; // a later destructor that logs takes another ring
+  atomic_store_explicit(&((LogThread *)ring)->state, LOG_RING_RETIRED,
+                        memory_order_release);
+}
+
+static void start_draining(void) {
+  pthread_key_create(&g_ring_key, retire_ring);
+  atomic_store(&g_running, true);
+  if (pthread_create(&g_drain_thread, NULL, drain_main, NULL) != 0) {
+    atomic_store(&g_running, false);
+    return;
+  }
+  atexit(log_shutdown);
+}
+
+static LogThread *log_thread(void) {
+  if (t_ring) {
+    return t_ring;
+  }
+  pthread_once(&g_drain_once, start_draining);
+  uint32_t id = atomic_fetch_add(&g_thread_count, 1) + 1;
+  // Rings stay on the list for good (the drainer walks it without a lock),
+  // so the list doubles as the free list: take a drained ring if any.
+  for (LogThread *ring = atomic_load_explicit(&g_threads, memory_order_acquire);
+       ring; ring = ring->next) {
+    uint32_t expected = LOG_RING_FREE;
+    if (atomic_compare_exchange_strong_explicit(
+            &ring->state, &expected, LOG_RING_LIVE, memory_order_acquire,
+            memory_order_relaxed)) {
+      ring->cached_tail =
+          atomic_load_explicit(&ring->tail, memory_order_relaxed);
+      atomic_store_explicit(&ring->id, id, memory_order_relaxed);
+      pthread_setspecific(g_ring_key, ring);
+      t_ring = ring;
+      return ring;
+    }
+  }
+
+  void *memory = NULL;
+  if (posix_memalign(&memory, LOG_CACHE_LINE, sizeof(LogThread)) != 0) {
+    return NULL;
+  }
+  LogThread *ring = (LogThread *)memory;
+  memset(ring, 0, offsetof(LogThread, buffer));
+  atomic_store_explicit(&ring->id, id, memory_order_relaxed);
+  LogThread *head = atomic_load_explicit(&g_threads, memory_order_relaxed);
+  do {
+    ring->next = head;
+  } while (!atomic_compare_exchange_weak_explicit(
+      &g_threads, &head, ring, memory_order_release, memory_order_relaxed));
+  pthread_setspecific(g_ring_key, ring);
+  t_ring = ring;
+  return ring;
+}
+
+// Contiguous room for size bytes, or NULL when the ring is full.
+static uint8_t *ring_reserve(LogThread *ring, size_t size) {
+  uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  size_t offset = (size_t)(head & LOG_RING_MASK);
+  size_t pad = LOG_RING_BYTES - offset < size ? LOG_RING_BYTES - offset : 0;
+  if (head + pad + size - ring->cached_tail > LOG_RING_BYTES) {
+    ring->cached_tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head + pad + size - ring->cached_tail > LOG_RING_BYTES) {
+      return NULL;
+    }
+  }
+  // Past half full: wake the drainer early instead of waiting for its tick
+  if (head + pad + size - ring->cached_tail > LOG_RING_BYTES / 2 &&
+      !atomic_load_explicit(&g_wake_pending, memory_order_relaxed) &&
+      !atomic_exchange_explicit(&g_wake_pending, true, memory_order_relaxed)) {
+    pthread_cond_signal(&g_drain_wake);
+  }
+  if (pad) {
+    LogRecord *skip = (LogRecord *)(ring->buffer + offset);
+    skip->site = LOG_RECORD_PAD;
+    skip->size = (uint32_t)pad;
+    atomic_store_explicit(&ring->head, head + pad, memory_order_release);
+    offset = 0;
+  }
+  return ring->buffer + offset;
+}
+
+static void ring_commit(LogThread *ring, size_t size) {
+  uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  atomic_store_explicit(&ring->head, head + size, memory_order_release);
+  atomic_store_explicit(
+      &ring->written,
+      atomic_load_explicit(&ring->written, memory_order_relaxed) + 1,
+      memory_order_relaxed);
+}
+
+// ============================================================================
+// Writing
+// ============================================================================
+
+static void emit_text(LogLevel level, const char *file, int line,
+                      const char *message);
+
+// Strings come back as their pointer.
+static inline uint64_t read_arg(uint8_t kind, va_list *args) {
+  switch ((LogArgKind)kind) {
+  case ARG_INT:
+    return (uint64_t)(int64_t)va_arg(*args, int);
+  case ARG_LONG:
+    return (uint64_t)va_arg(*args, long);
+  case ARG_LLONG:
+    return (uint64_t)va_arg(*args, long long);
+  case ARG_INTMAX:
+    return (uint64_t)va_arg(*args, intmax_t);
+  case ARG_SIZE:
+    return (uint64_t)va_arg(*args, size_t);
+  case ARG_PTRDIFF:
+    return (uint64_t)va_arg(*args, ptrdiff_t);
+  case ARG_DOUBLE:
+  case ARG_LDOUBLE: {
+    double real = kind == ARG_DOUBLE ? va_arg(*args, double)
+                                     : (double)va_arg(*args, long double);
+    uint64_t value;
+    memcpy(&value, &real, sizeof(value));
+    return value;
+  }
+  case ARG_POINTER:
+  case ARG_STRING:
+    return (uint64_t)(uintptr_t)va_arg(*args, void *);
+  default:
+    return 0;
+  }
+}
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+// Copies src up to its terminator or max bytes and returns the length, a
+// word at a time in one pass. The loads are aligned, so they never touch a
+// page the string does not (bytes outside it are masked off, which is why
+// ASan is told to look away); the stores are whole words and may run
+// LOG_COPY_SLACK bytes past the copy.
+__attribute__((no_sanitize_address)) static inline size_t
+copy_string(uint8_t *dst, const char *src, size_t max) {
+  const uint64_t ones = 0x0101010101010101ull;
+  const uint64_t highs = 0x8080808080808080ull;
+  const uint8_t *word = (const uint8_t *)((uintptr_t)src & ~(uintptr_t)7);
+  size_t skip = (uintptr_t)src & 7;
+  size_t length = 0;
+  for (;;) {
+    uint64_t bytes;
+    memcpy(&bytes, word, 8);
+    uint64_t chunk = bytes >> (skip * 8);
+    memcpy(dst + length, &chunk, 8);
+    uint64_t probe = bytes | ((1ull << (skip * 8)) - 1); // bytes before src
+    uint64_t zeros = (probe - ones) & ~probe & highs;
+    if (zeros) {
+      length += (size_t)__builtin_ctzll(zeros) / 8 - skip;
+      return length < max ? length : max;
+    }
+    length += 8 - skip;
+    if (length >= max) {
+      return max;
+    }
+    word += 8;
+    skip = 0;
+  }
+}
+#else
+static inline size_t copy_string(uint8_t *dst, const char *src, size_t max) {
+  size_t length = 0;
+  for (; length < max && src[length]; length++) {
+    dst[length] = (uint8_t)src[length];
+  }
+  return length;
+}
+#endif
+
+// Writes a call's record into dst, which has room for info->max_size
+// bytes, and returns its size. Each string is read once, copied as its
+// terminator is searched for.
+static size_t store_args(uint8_t *dst, uint32_t site, const SiteInfo *info,
+                         va_list *args) {
+  LogRecord *record = (LogRecord *)dst;
+  record->site = site;
+  record->ticks = log_ticks();
+  uint64_t *slots = (uint64_t *)(record + 1);
+  if (!info->strings) {
+    for (uint32_t i = 0; i < info->count; i++) {
+      slots[i] = read_arg(info->kinds[i], args);
+    }
+    record->size = info->max_size;
+    return info->max_size;
+  }
+  uint8_t *strings = (uint8_t *)(slots + info->count);
+  for (uint32_t i = 0; i < info->count; i++) {
+    uint64_t value = read_arg(info->kinds[i], args);
+    if (info->kinds[i] == ARG_STRING) {
+      const char *text = (const char *)(uintptr_t)value;
+      int64_t limit = info->limits[i];
+      if (limit == LOG_PRECISION_STAR) {
+        limit = (int64_t)slots[i - 1]; // negative: no precision
+      }
+      size_t max = limit >= 0 && limit < LOG_STRING_MAX ? (size_t)limit
+                                                        : LOG_STRING_MAX;
+      value = copy_string(strings, text ? text : "(null)", max);
+      strings += align8((size_t)value);
+    }
+    slots[i] = value;
+  }
+  size_t size = align16((size_t)(strings - dst));
+  record->size = (uint32_t)size;
+  return size;
+}
+
+static void count_drop(LogThread *ring) {
+  atomic_store_explicit(
+      &ring->dropped,
+      atomic_load_explicit(&ring->dropped, memory_order_relaxed) + 1,
+      memory_order_relaxed);
+}
+
+// A record built elsewhere, copied in at its real size.
+static void queue_record(LogThread *ring, const uint8_t *record, size_t size) {
+  uint8_t *dst = ring_reserve(ring, size);
+  if (!dst) {
+    count_drop(ring);
+    return;
+  }
+  memcpy(dst, record, size);
+  ring_commit(ring, size);
+}
+
+// False when there is no drainer to queue for (it failed to start or has
+// shut down); the caller writes the message itself and the arguments are
+// still unread. Records are built in the ring: the worst case is reserved
+// and only the real size committed.
+static bool queue_args(uint32_t site, const SiteInfo *info, va_list *args) {
+  if (!atomic_load_explicit(&g_running, memory_order_relaxed)) {
+    return false;
+  }
+  LogThread *ring = log_thread();
+  if (!ring) {
+    return false;
+  }
+  if (!info->strings) {
+    // The common case: the size is known, so no staging either way.
+    uint8_t *dst = ring_reserve(ring, info->max_size);
+    if (!dst) {
+      count_drop(ring);
+      return true;
+    }
+    LogRecord *record = (LogRecord *)dst;
+    record->site = site;
+    record->size = info->max_size;
+    record->ticks = log_ticks();
+    uint64_t *slots = (uint64_t *)(record + 1);
+    for (uint32_t i = 0; i < info->count; i++) {
+      slots[i] = read_arg(info->kinds[i], args);
+    }
+    ring_commit(ring, info->max_size);
+    return true;
+  }
+  // Without the worst case free and contiguous, the record is staged on
+  // the stack and takes only its real size, so it neither pads the ring's
+  // end early nor drops while it would still fit.
+  uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  if (LOG_RING_BYTES - (size_t)(head & LOG_RING_MASK) >= info->max_size) {
+    uint8_t *dst = ring_reserve(ring, info->max_size);
+    if (dst) {
+      ring_commit(ring, store_args(dst, site, info, args));
+      return true;
+    }
+  }
+  uint8_t record[LOG_RECORD_MAX] __attribute__((aligned(16)));
+  queue_record(ring, record, store_args(record, site, info, args));
+  return true;
+}
+
+// The text site's arguments go through a va_list like any other site's.
+static bool queue_text(const SiteInfo *info, ...) {
+  if (!atomic_load_explicit(&g_running, memory_order_relaxed)) {
+    return false;
+  }
+  LogThread *ring = log_thread();
+  if (!ring) {
+    return false;
+  }
+  uint8_t record[LOG_RECORD_MAX] __attribute__((aligned(16)));
+  va_list args;
+  va_start(args, info);
+  queue_record(ring, record, store_args(record, LOG_SITE_TEXT, info, &args));
+  va_end(args);
+  return true;
+}
+
+static void write_text(LogLevel level, const char *file, int line,
+                       const char *message) {
+  static const SiteInfo text_info = {
+      NULL,
+      false,
+      true,
+      4,
+      {ARG_INT, ARG_INT, ARG_STRING, ARG_STRING},
+      {LOG_PRECISION_NONE, LOG_PRECISION_NONE, LOG_PRECISION_NONE,
+       LOG_PRECISION_NONE},
+      (sizeof(LogRecord) + 4 * 8 + 2 * LOG_STRING_MAX + LOG_COPY_SLACK + 15) &
+          ~(size_t)15};
+  if (!queue_text(&text_info, (int)level, line, file, message)) {
+    emit_text(level, file, line, message);
+  }
+}
+
+void log_write(LogSite *site, ...) {
+  uint32_t id = __atomic_load_n(&site->id, __ATOMIC_ACQUIRE);
+  if (id == 0) {
+    pthread_once(&g_drain_once, start_draining);
+    id = register_site(site);
+  }
+  va_list args;
+  va_start(args, site);
+  if (id == LOG_SITE_OVERFLOW || g_sites[id].preformat) {
+    char message[LOG_LINE_MAX];
+    vsnprintf(message, sizeof(message), site->format, args);
+    write_text(site->level, site->file, site->line, message);
+  } else {
+    const SiteInfo *info = &g_sites[id];
+    if (!queue_args(id, info, &args)) {
+      uint8_t record[LOG_RECORD_MAX] __attribute__((aligned(16)));
+      char message[LOG_LINE_MAX];
+      size_t size = store_args(record, id, info, &args);
+      format_payload(site->format, info->count, record + sizeof(LogRecord),
+                     size - sizeof(LogRecord), message, sizeof(message));
+      emit_text(site->level, site->file, site->line, message);
+    }
+  }
+  va_end(args);
+}
+
+void log_message(LogLevel level, const char *file, int line, const char *format,
+                 ...) {
+  if ((int)level >= LOG_LEVEL) {
+    return;
+  }
+  pthread_once(&g_drain_once, start_draining);
+  char message[LOG_LINE_MAX];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(message, sizeof(message), format, args);
+  va_end(args);
+  write_text(level, file, line, message);
+}
+
+// ============================================================================
+// Binary log file
+// ============================================================================
+
+// Host byte order. After the header, each record is a LogFileRecord and
+// size bytes of body.
+#define LOG_FILE_MAGIC "OSLOG\0\1\0"
+
+typedef struct {
+  char magic[8];
+  uint64_t start_realtime_ns; // wall clock at time 0
+} LogFileHeader;
+
+enum {
+  LOG_FILE_SITE = 1,    // id, level, line, file, format
+  LOG_FILE_MESSAGE = 2, // site, thread, ns, then the ring payload
+  LOG_FILE_DROPPED = 3, // thread, count
+};
+
+typedef struct {
+  uint32_t tag;
+  uint32_t size;
+} LogFileRecord;
+
+typedef struct {
+  uint32_t id;
+  uint32_t level;
+  int32_t line;
+  uint16_t file_length;
+  uint16_t format_length;
+} LogFileSite;
+
+typedef struct {
+  uint32_t site;
+  uint32_t thread;
+  uint64_t ns;
+} LogFileMessage;
+
+typedef struct {
+  uint32_t thread;
+  uint32_t reserved;
+  uint64_t count;
+} LogFileDropped;
+
+// Sink state, owned by the drainer
+static FILE *g_file;
+static uint64_t g_file_start_ns;
+static uint8_t g_file_sites[LOG_MAX_SITES / 8]; // already written
+
+// Ticks to nanoseconds: a line through the first sample and the newest
+static struct {
+  uint64_t ticks0, ns0;
+  uint64_t ticks1, ns1;
+  double ns_per_tick;
+} g_clock;
+
+static void clock_update(void) {
+  uint64_t ticks = log_ticks();
+  uint64_t ns = monotonic_ns();
+  if (g_clock.ns_per_tick == 0.0) {
+    g_clock.ticks0 = ticks;
+    g_clock.ns0 = ns;
+    // A first estimate over a short spin, refined as time passes
+    while (monotonic_ns() - ns < 200000) {
+    }
+    ticks = log_ticks();
+    ns = monotonic_ns();
+  } else if (ns - g_clock.ns1 < 100000000ull) {
+    return;
+  }
+  g_clock.ticks1 = ticks;
+  g_clock.ns1 = ns;
+  if (ticks > g_clock.ticks0) {
+    g_clock.ns_per_tick =
+        (double)(ns - g_clock.ns0) / (double)(ticks - g_clock.ticks0);
+  } else {
+    g_clock.ns_per_tick = 1.0;
+  }
+}
+
+static uint64_t ticks_to_ns(uint64_t ticks) {
+  double delta = ((double)ticks - (double)g_clock.ticks0) * g_clock.ns_per_tick;
+  double ns = (double)g_clock.ns0 + delta;
+  return ns > 0.0 ? (uint64_t)ns : 0;
+}
+
+static void file_write(uint32_t tag, const void *head, size_t head_size,
+                       const void *a, size_t a_size, const void *b,
+                       size_t b_size) {
+  LogFileRecord record = {tag, (uint32_t)(head_size + a_size + b_size)};
+  fwrite(&record, sizeof(record), 1, g_file);
+  fwrite(head, head_size, 1, g_file);
+  if (a_size) {
+    fwrite(a, a_size, 1, g_file);
+  }
+  if (b_size) {
+    fwrite(b, b_size, 1, g_file);
+  }
+}
+
+static void file_write_site(uint32_t id) {
+  if (g_file_sites[id / 8] & (1u << (id % 8))) {
+    return;
+  }
+  g_file_sites[id / 8] |= (uint8_t)(1u << (id % 8));
+  const LogSite *site = g_sites[id].site;
+  size_t file_length = strlen(site->file);
+  size_t format_length = strlen(site->format);
+  LogFileSite body = {id, (uint32_t)site->level, site->line,
+                      (uint16_t)(file_length < UINT16_MAX ? file_length
+                                                          : UINT16_MAX),
+                      (uint16_t)(format_length < UINT16_MAX ? format_length
+                                                            : UINT16_MAX)};
+  file_write(LOG_FILE_SITE, &body, sizeof(body), site->file, body.file_length,
+             site->format, body.format_length);
+}
+
+// ============================================================================
+// Draining
+// ============================================================================
+
+static void emit_text(LogLevel level, const char *file, int line,
+                      const char *message) {
+  fprintf(stderr, "[%s] %s:%d: %s\n", LOG_LEVEL_NAMES[level], file, line,
+          message);
+}
+
+static void emit_payload(const LogRecord *record, uint32_t thread) {
+  const uint8_t *payload = (const uint8_t *)(record + 1);
+  size_t size = record->size - sizeof(LogRecord);
+  if (g_file) {
+    if (record->site != LOG_SITE_TEXT) {
+      file_write_site(record->site);
+    }
+    uint64_t ns = ticks_to_ns(record->ticks);
+    LogFileMessage head = {record->site, thread,
+                           ns > g_file_start_ns ? ns - g_file_start_ns : 0};
+    file_write(LOG_FILE_MESSAGE, &head, sizeof(head), payload, size, NULL, 0);
+    return;
+  }
+
+  char message[LOG_LINE_MAX];
+  if (record->site == LOG_SITE_TEXT) {
+    uint64_t level, line;
+    char file[LOG_STRING_MAX + 1];
+    if (read_text(payload, size, &level, &line, file, message)) {
+      emit_text((LogLevel)level, file, (int)line, message);
+    }
+    return;
+  }
+  const SiteInfo *info = &g_sites[record->site];
+  format_payload(info->site->format, info->count, payload, size, message,
+                 sizeof(message));
+  emit_text(info->site->level, info->site->file, info->site->line, message);
+}
+
+static void drain_thread(LogThread *ring) {
+  uint32_t id = atomic_load_explicit(&ring->id, memory_order_relaxed);
+  uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+  while (tail < head) {
+    const LogRecord *record =
+        (const LogRecord *)(ring->buffer + (tail & LOG_RING_MASK));
+    if (record->site != LOG_RECORD_PAD) {
+      emit_payload(record, id);
+      atomic_fetch_add_explicit(&g_drained, 1, memory_order_relaxed);
+    }
+    tail += record->size;
+  }
+  atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+  uint64_t dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+  if (dropped != ring->dropped_reported) {
+    uint64_t count = dropped - ring->dropped_reported;
+    ring->dropped_reported = dropped;
+    if (g_file) {
+      LogFileDropped body = {id, 0, count};
+      file_write(LOG_FILE_DROPPED, &body, sizeof(body), NULL, 0, NULL, 0);
+    } else {
+      fprintf(stderr, "[WARN] logger: thread %u dropped %llu messages\n",
+              id, (unsigned long long)count);
+    }
+  }
+}
+
+// Caller holds g_drain_lock.
+static void drain_all(void) {
+  clock_update();
+  for (LogThread *ring = atomic_load_explicit(&g_threads, memory_order_acquire);
+       ring; ring = ring->next) {
+    // Checked before draining: a retired ring gets no more records, so
+    // once this pass empties it the ring can go to a new thread.
+    bool retired = atomic_load_explicit(&ring->state, memory_order_acquire) ==
+                   LOG_RING_RETIRED;
+    drain_thread(ring);
+    if (retired) {
+      atomic_store_explicit(&ring->state, LOG_RING_FREE, memory_order_release);
+    }
+  }
+  fflush(g_file ? g_file : stderr);
+}
+
+static void *drain_main(void *arg) {
+  (void)arg;
+  pthread_mutex_lock(&g_drain_lock);
+  while (!atomic_load(&g_stopping)) {
+    atomic_store_explicit(&g_wake_pending, false, memory_order_relaxed);
+    drain_all();
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    uint64_t ns = (uint64_t)deadline.tv_nsec + LOG_DRAIN_INTERVAL_NS;
+    deadline.tv_sec += (time_t)(ns / 1000000000ull);
+    deadline.tv_nsec = (long)(ns % 1000000000ull);
+    if (!atomic_load_explicit(&g_wake_pending, memory_order_relaxed)) {
+      pthread_cond_timedwait(&g_drain_wake, &g_drain_lock, &deadline);
+    }
+  }
+  drain_all();
+  pthread_mutex_unlock(&g_drain_lock);
+  return NULL;
+}
+
+// Later messages are written on the thread that logs them.
+static void log_shutdown(void) {
+  pthread_mutex_lock(&g_drain_lock);
+  atomic_store(&g_stopping, true);
+  pthread_cond_signal(&g_drain_wake);
+  pthread_mutex_unlock(&g_drain_lock);
+  pthread_join(g_drain_thread, NULL);
+  atomic_store(&g_running, false);
+  if (g_file) {
+    fclose(g_file);
+    g_file = NULL;
+  }
+}
+
+void log_flush(void) {
+  pthread_mutex_lock(&g_drain_lock);
+  drain_all();
+  pthread_mutex_unlock(&g_drain_lock);
+}
+
+bool log_set_output(const char *path) {
+  pthread_once(&g_drain_once, start_draining);
+  pthread_mutex_lock(&g_drain_lock);
+  drain_all();
+  if (g_file) {
+    fclose(g_file);
+    g_file = NULL;
+  }
+  bool ok = true;
+  if (path) {
+    g_file = fopen(path, "wb");
+    ok = g_file != NULL;
+    if (ok) {
+      struct timespec now;
+      clock_gettime(CLOCK_REALTIME, &now);
+      LogFileHeader header = {LOG_FILE_MAGIC,
+                              (uint64_t)now.tv_sec * 1000000000ull +
+                                  (uint64_t)now.tv_nsec};
+      fwrite(&header, sizeof(header), 1, g_file);
+      g_file_start_ns = monotonic_ns();
+      memset(g_file_sites, 0, sizeof(g_file_sites));
+    }
+  }
+  pthread_mutex_unlock(&g_drain_lock);
+  return ok;
+}
+
+void log_get_stats(LogStats *stats) {
+  memset(stats, 0, sizeof(*stats));
+  for (LogThread *ring = atomic_load_explicit(&g_threads, memory_order_acquire);
+       ring; ring = ring->next) {
+    stats->written += atomic_load_explicit(&ring->written, memory_order_relaxed);
+    stats->dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+    stats->threads++;
+  }
+  stats->drained = atomic_load_explicit(&g_drained, memory_order_relaxed);
+  pthread_mutex_lock(&g_sites_lock);
+  stats->sites = g_site_count - 1;
+  pthread_mutex_unlock(&g_sites_lock);
+}
+
+// ============================================================================
+// Offline decoding
+// ============================================================================
+
+typedef struct {
+  char *file;
+  char *format;
+  LogLevel level;
+  int line;
+  uint8_t count;
+  bool known;
+  uint8_t kinds[LOG_MAX_ARGS];
+} DecodedSite;
+
+bool log_decode_file(const char *path, FILE *out) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    return false;
+  }
+  LogFileHeader header;
+  bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+            memcmp(header.magic, LOG_FILE_MAGIC, sizeof(header.magic)) == 0;
+  DecodedSite *sites =
+      ok ? (DecodedSite *)calloc(LOG_MAX_SITES, sizeof(DecodedSite)) : NULL;
+  uint8_t *body = ok ? (uint8_t *)malloc(UINT16_MAX * 2 + 4096) : NULL;
+  ok = sites && body;
+
+  LogFileRecord record;
+  while (ok && fread(&record, sizeof(record), 1, file) == 1) {
+    if (record.size > UINT16_MAX * 2 + 4096 ||
+        fread(body, 1, record.size, file) != record.size) {
+      ok = false;
+      break;
+    }
+    if (record.tag == LOG_FILE_SITE && record.size >= sizeof(LogFileSite)) {
+      LogFileSite site;
+      memcpy(&site, body, sizeof(site));
+      if (site.id == 0 || site.id >= LOG_MAX_SITES || site.level > 3 ||
+          sizeof(site) + site.file_length + site.format_length > record.size) {
+        ok = false;
+        break;
+      }
+      DecodedSite *decoded = &sites[site.id];
+      free(decoded->file);
+      free(decoded->format);
+      decoded->file = strndup((const char *)body + sizeof(site),
+                              site.file_length);
+      decoded->format = strndup(
+          (const char *)body + sizeof(site) + site.file_length,
+          site.format_length);
+      decoded->level = (LogLevel)site.level;
+      decoded->line = site.line;
+      int count = parse_format(decoded->format, decoded->kinds, NULL);
+      decoded->count = count < 0 ? 0 : (uint8_t)count;
+      decoded->known = decoded->file && decoded->format && count >= 0;
+    } else if (record.tag == LOG_FILE_MESSAGE &&
+               record.size >= sizeof(LogFileMessage)) {
+      LogFileMessage head;
+      memcpy(&head, body, sizeof(head));
+      const uint8_t *payload = body + sizeof(head);
+      size_t size = record.size - sizeof(head);
+      double seconds = (double)head.ns / 1e9;
+      char message[LOG_LINE_MAX];
+      if (head.site == LOG_SITE_TEXT) {
+        uint64_t level, line;
+        char text_file[LOG_STRING_MAX + 1];
+        if (!read_text(payload, size, &level, &line, text_file, message)) {
+          ok = false;
+          break;
+        }
+        fprintf(out, "%12.6f [%u] [%s] %s:%d: %s\n", seconds, head.thread,
+                LOG_LEVEL_NAMES[level], text_file, (int)line, message);
+      } else if (head.site < LOG_MAX_SITES && sites[head.site].known) {
+        DecodedSite *site = &sites[head.site];
+        format_payload(site->format, site->count, payload, size, message,
+                       sizeof(message));
+        fprintf(out, "%12.6f [%u] [%s] %s:%d: %s\n", seconds, head.thread,
+                LOG_LEVEL_NAMES[site->level], site->file, site->line,
+                message);
+      } else {
+        ok = false;
+      }
+    } else if (record.tag == LOG_FILE_DROPPED &&
+               record.size >= sizeof(LogFileDropped)) {
+      LogFileDropped dropped;
+      memcpy(&dropped, body, sizeof(dropped));
+      fprintf(out, "%12s [%u] [WARN] logger: dropped %llu messages\n", "",
+              dropped.thread, (unsigned long long)dropped.count);
+    }
+    // Unknown tags are skipped, so newer writers stay readable
+  }
+
+  if (sites) {
+    for (uint32_t i = 0; i < LOG_MAX_SITES; i++) {
+      free(sites[i].file);
+      free(sites[i].format);
+    }
+  }
+  free(sites);
+  free(body);
+  ok = ok && !ferror(file);
+  fclose(file);
+  return ok;
+}
+
+// ============================================================================
+// Benchmark
+// ============================================================================
+
+typedef struct {
+  const LogBenchConfig *config;
+  uint64_t elapsed_ns;
+} BenchThread;
+
+// Untimed: lets the drainer empty this thread's ring between bursts
+static void bench_wait_drained(void) {
+  LogThread *ring = t_ring;
+  while (ring && atomic_load_explicit(&ring->tail, memory_order_acquire) <
+                     atomic_load_explicit(&ring->head, memory_order_relaxed)) {
+    atomic_store_explicit(&g_wake_pending, true, memory_order_relaxed);
+    pthread_cond_signal(&g_drain_wake);
+    struct timespec pause = {0, 50000};
+    nanosleep(&pause, NULL);
+  }
+}
+
+// CPU time, so the drainer running on the same CPU mid-burst is not
+// charged to the calls.
+static uint64_t thread_cpu_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void *bench_main(void *arg) {
+  BenchThread *bench = (BenchThread *)arg;
+  const LogBenchConfig *config = bench->config;
+  uint64_t burst = config->burst ? config->burst : config->calls_per_thread;
+  for (uint64_t i = 0; i < config->calls_per_thread;) {
+    uint64_t end = i + burst < config->calls_per_thread
+                       ? i + burst
+                       : config->calls_per_thread;
+    uint64_t start = thread_cpu_ns();
+    if (config->string_args) {
+      for (; i < end; i++) {
+        LOG_AT_(LOG_INFO_LEVEL, "frame %llu: %s took %d us",
+                (unsigned long long)i, "compositor", (int)(i & 1023));
+      }
+    } else {
+      for (; i < end; i++) {
+        LOG_AT_(LOG_INFO_LEVEL, "frame %llu took %d us", (unsigned long long)i,
+                (int)(i & 1023));
+      }
+    }
+    bench->elapsed_ns += thread_cpu_ns() - start;
+    if (config->burst) {
+      bench_wait_drained();
+    }
+  }
+  return NULL;
+}
+
+bool log_benchmark(const LogBenchConfig *config, LogBenchResult *result) {
+  memset(result, 0, sizeof(*result));
+  uint32_t threads = config->threads ? config->threads : 1;
+  BenchThread *benches = (BenchThread *)calloc(threads, sizeof(BenchThread));
+  pthread_t *handles = (pthread_t *)calloc(threads, sizeof(pthread_t));
+  bool ok = benches && handles &&
+            log_set_output(config->path ? config->path : "/dev/null");
+
+  LogStats before;
+  log_get_stats(&before);
+  uint32_t started = 0;
+  while (ok && started < threads) {
+    benches[started].config = config;
+    ok = pthread_create(&handles[started], NULL, bench_main,
+                        &benches[started]) == 0;
+    started += ok; // a failed create leaves no thread to join
+  }
+  uint64_t elapsed = 0;
+  for (uint32_t i = 0; i < started; i++) {
+    pthread_join(handles[i], NULL);
+    elapsed += benches[i].elapsed_ns;
+  }
+  log_flush();
+
+  LogStats after;
+  log_get_stats(&after);
+  uint64_t calls = (uint64_t)started * config->calls_per_thread;
+  result->ns_per_call = calls ? (double)elapsed / (double)calls : 0.0;
+  const uint32_t reads = 1000000;
+  volatile uint64_t ticks = 0;
+  uint64_t start = thread_cpu_ns();
+  for (uint32_t i = 0; i < reads; i++) {
+    ticks += log_ticks();
+  }
+  result->ns_per_timestamp = (double)(thread_cpu_ns() - start) / reads;
+  result->written = after.written - before.written;
+  result->dropped = after.dropped - before.dropped;
+  log_set_output(NULL);
+  free(benches);
+  free(handles);
+  return ok;
+}
@@ -0,0 +1,442 @@
+// Profiler - per-thread zone rings, stage histograms and Chrome trace export
+
+#include "profiler.h"
+#include <string.h>
+
+static const char *const g_stage_names[PROFILE_STAGE_COUNT] = {
+    "Events", "Layout", "Raster", "Effects",
+    "Present", "Frame", "Input to present",
+};
+
+const char *profiler_stage_name(ProfileStage stage) {
+  if (stage < 0 || stage >= PROFILE_STAGE_COUNT) {
+    return "Zone";
+  }
+  return g_stage_names[stage];
+}
+
+#if ENABLE_PROFILER
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// ============================================================================
+// Histograms
+// ============================================================================
+
+// Values below 2 * HIST_SUB land in their own bucket; above that each power
+// of two splits into HIST_SUB buckets, so a bucket is at most 1/HIST_SUB
+// wide relative to its value.
+#define HIST_SUB_BITS 5
+#define HIST_SUB (1u << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct {
+  _Atomic uint64_t sum;
+  _Atomic uint64_t min_plus_one; // 0 while empty
+  _Atomic uint64_t max;
+  _Atomic uint64_t buckets[HIST_BUCKETS];
+} StageHistogram;
+
+static StageHistogram g_histograms[PROFILE_STAGE_COUNT];
+
+static inline uint32_t hist_bucket(uint64_t value) {
+  if (value < HIST_SUB) {
+    return (uint32_t)value;
+  }
+  uint32_t shift = 63 - (uint32_t)__builtin_clzll(value) - HIST_SUB_BITS;
+  return shift * HIST_SUB + (uint32_t)(value >> shift);
+}
+
+// Highest value that falls in the bucket
+static uint64_t hist_bucket_value(uint32_t bucket) {
+  if (bucket < 2 * HIST_SUB) {
+    return bucket;
+  }
+  uint32_t shift = bucket / HIST_SUB - 1;
+  uint64_t mantissa = bucket % HIST_SUB + HIST_SUB;
+  return ((mantissa + 1) << shift) - 1;
+}
+
+static void hist_record(StageHistogram *hist, uint64_t value) {
+  atomic_fetch_add_explicit(&hist->buckets[hist_bucket(value)], 1,
+                            memory_order_relaxed);
+  atomic_fetch_add_explicit(&hist->sum, value, memory_order_relaxed);
+
+  uint64_t current = atomic_load_explicit(&hist->min_plus_one,
+                                          memory_order_relaxed);
+  while ((current == 0 || value + 1 < current) &&
+         !atomic_compare_exchange_weak_explicit(&hist->min_plus_one, &current,
+                                                value + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed)) {
+  }
+  current = atomic_load_explicit(&hist->max, memory_order_relaxed);
+  while (value > current &&
+         !atomic_compare_exchange_weak_explicit(&hist->max, &current, value,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed)) {
+  }
+}
+
+// ============================================================================
+// Thread rings
+// ============================================================================
+
+#define RING_MASK (PROFILER_THREAD_EVENTS - 1)
+#define THREAD_NAME_MAX 32
+
+// Fields are relaxed atomics only so a concurrent export is well defined;
+// on every target they compile to plain loads and stores.
+typedef struct {
+  _Atomic(const char *) name;
+  _Atomic uint64_t start;
+  _Atomic uint64_t duration;
+  _Atomic int64_t stage;
+} ProfileEvent;
+
+typedef struct ProfileThread {
+  struct ProfileThread *next;
+  uint32_t tid;
+  char name[THREAD_NAME_MAX]; // under g_threads_lock
+  _Atomic uint64_t written;   // events ever recorded; only the owner writes
+  ProfileEvent events[PROFILER_THREAD_EVENTS];
+} ProfileThread;
+
+static pthread_mutex_t g_threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static ProfileThread *g_threads;
+static uint32_t g_next_tid = 1;
+static _Thread_local ProfileThread *t_thread;
+
+static _Atomic uint64_t g_pending_input; // earliest unpresented input, or 0
+static _Atomic uint64_t g_reset_ns;
+
+// Rings are never freed: a thread that exited still belongs in the trace.
+static ProfileThread *profile_thread(void) {
+  if (t_thread) {
+    return t_thread;
+  }
+  ProfileThread *thread = (ProfileThread *)calloc(1, sizeof(ProfileThread));
+  if (!thread) {
+    return NULL;
+  }
+  pthread_mutex_lock(&g_threads_lock);
+  thread->tid = g_next_tid++;
+  snprintf(thread->name, sizeof(thread->name), "Thread %u", thread->tid);
+  thread->next = g_threads;
+  g_threads = thread;
+  pthread_mutex_unlock(&g_threads_lock);
+  t_thread = thread;
+  return thread;
+}
+
+static void profile_record(const char *name, ProfileStage stage,
+                           uint64_t start, uint64_t duration) {
+  ProfileThread *thread = profile_thread();
+  if (thread) {
+    uint64_t index = atomic_load_explicit(&thread->written,
+                                          memory_order_relaxed);
+    ProfileEvent *event = &thread->events[index & RING_MASK];
+    // The slot's new contents must not become visible before the count
+    // that retires its old ones; see trace_copy_thread
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&event->name, name, memory_order_relaxed);
+    atomic_store_explicit(&event->start, start, memory_order_relaxed);
+    atomic_store_explicit(&event->duration, duration, memory_order_relaxed);
+    atomic_store_explicit(&event->stage, stage, memory_order_relaxed);
+    atomic_store_explicit(&thread->written, index + 1, memory_order_release);
+  }
+  if (stage != PROFILE_NONE) {
+    hist_record(&g_histograms[stage], duration);
+  }
+}
+
+// ============================================================================
+// Zones and marks
+// ============================================================================
+
+void profile_zone_end(ProfileZone *zone) {
+  uint64_t end = profiler_now_ns();
+  profile_record(zone->name, zone->stage, zone->start, end - zone->start);
+}
+
+void profiler_set_thread_name(const char *name) {
+  ProfileThread *thread = profile_thread();
+  if (!thread || !name) {
+    return;
+  }
+  pthread_mutex_lock(&g_threads_lock);
+  snprintf(thread->name, sizeof(thread->name), "%s", name);
+  pthread_mutex_unlock(&g_threads_lock);
+}
+
+void profiler_mark_input(uint64_t timestamp_ns) {
+  if (timestamp_ns == 0) {
+    timestamp_ns = 1;
+  }
+  uint64_t pending = atomic_load_explicit(&g_pending_input,
+                                          memory_order_relaxed);
+  while ((pending == 0 || timestamp_ns < pending) &&
+         !atomic_compare_exchange_weak_explicit(&g_pending_input, &pending,
+                                                timestamp_ns,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed)) {
+  }
+}
+
+void profiler_mark_present(void) {
+  uint64_t input = atomic_exchange_explicit(&g_pending_input, 0,
+                                            memory_order_relaxed);
+  if (input == 0) {
+    return;
+  }
+  uint64_t now = profiler_now_ns();
+  uint64_t latency = now > input ? now - input : 0;
+  profile_record(g_stage_names[PROFILE_INPUT_LATENCY], PROFILE_INPUT_LATENCY,
+                 input, latency);
+}
+
+// ============================================================================
+// Statistics
+// ============================================================================
+
+void profiler_get_stage_stats(ProfileStage stage, ProfileStageStats *stats) {
+  memset(stats, 0, sizeof(*stats));
+  if (stage < 0 || stage >= PROFILE_STAGE_COUNT) {
+    return;
+  }
+  StageHistogram *hist = &g_histograms[stage];
+
+  // Percentiles come from a snapshot of the buckets, so they agree with
+  // each other even while other threads keep recording.
+  static _Thread_local uint64_t counts[HIST_BUCKETS];
+  uint64_t total = 0;
+  for (uint32_t i = 0; i < HIST_BUCKETS; i++) {
+    counts[i] = atomic_load_explicit(&hist->buckets[i], memory_order_relaxed);
+    total += counts[i];
+  }
+  if (total == 0) {
+    return;
+  }
+
+  uint64_t sum = atomic_load_explicit(&hist->sum, memory_order_relaxed);
+  stats->count = total;
+  // Zero only if a reset raced the snapshot
+  uint64_t min_plus_one =
+      atomic_load_explicit(&hist->min_plus_one, memory_order_relaxed);
+  stats->min_ns = min_plus_one ? min_plus_one - 1 : 0;
+  stats->max_ns = atomic_load_explicit(&hist->max, memory_order_relaxed);
+  stats->mean_ns = (double)sum / (double)total;
+
+  const double quantiles[4] = {0.5, 0.9, 0.99, 0.999};
+  uint64_t *outputs[4] = {&stats->p50_ns, &stats->p90_ns, &stats->p99_ns,
+                          &stats->p999_ns};
+  uint64_t seen = 0;
+  uint32_t q = 0;
+  for (uint32_t i = 0; i < HIST_BUCKETS && q < 4; i++) {
+    seen += counts[i];
+    while (q < 4 && (double)seen >= quantiles[q] * (double)total) {
+      uint64_t value = hist_bucket_value(i);
+      *outputs[q++] = value < stats->max_ns ? value : stats->max_ns;
+    }
+  }
+}
+
+void profiler_reset(void) {
+  for (int s = 0; s < PROFILE_STAGE_COUNT; s++) {
+    StageHistogram *hist = &g_histograms[s];
+    for (uint32_t i = 0; i < HIST_BUCKETS; i++) {
+      atomic_store_explicit(&hist->buckets[i], 0, memory_order_relaxed);
+    }
+    atomic_store_explicit(&hist->sum, 0, memory_order_relaxed);
+    atomic_store_explicit(&hist->min_plus_one, 0, memory_order_relaxed);
+    atomic_store_explicit(&hist->max, 0, memory_order_relaxed);
+  }
+  atomic_store_explicit(&g_pending_input, 0, memory_order_relaxed);
+  atomic_store_explicit(&g_reset_ns, profiler_now_ns(), memory_order_relaxed);
+}
+
+// ============================================================================
+// Chrome trace export
+// ============================================================================
+
+typedef struct {
+  const char *name;
+  uint64_t start;
+  uint64_t duration;
+  int64_t stage;
+} TraceEvent;
+
+typedef struct {
+  uint32_t tid;
+  char name[THREAD_NAME_MAX];
+  TraceEvent *events;
+  uint64_t count;
+} TraceThread;
+
+// Copies the events still in the ring. Slots the owner may have reused
+// while they were copied are dropped rather than written half-updated:
+// while written is n the owner may already be overwriting event
+// n - PROFILER_THREAD_EVENTS, so only the newest PROFILER_THREAD_EVENTS - 1
+// are certain to be whole.
+static bool trace_copy_thread(ProfileThread *thread, TraceThread *out,
+                              uint64_t since) {
+  uint64_t end = atomic_load_explicit(&thread->written, memory_order_acquire);
+  uint64_t begin = end > PROFILER_THREAD_EVENTS ? end - PROFILER_THREAD_EVENTS
+                                                : 0;
+  out->tid = thread->tid;
+  memcpy(out->name, thread->name, sizeof(out->name));
+  out->count = 0;
+  out->events = (TraceEvent *)malloc((size_t)(end - begin + 1) *
+                                     sizeof(TraceEvent));
+  if (!out->events) {
+    return false;
+  }
+  for (uint64_t i = begin; i < end; i++) {
+    ProfileEvent *event = &thread->events[i & RING_MASK];
+    TraceEvent *copy = &out->events[i - begin];
+    copy->name = atomic_load_explicit(&event->name, memory_order_relaxed);
+    copy->start = atomic_load_explicit(&event->start, memory_order_relaxed);
+    copy->duration =
+        atomic_load_explicit(&event->duration, memory_order_relaxed);
+    copy->stage = atomic_load_explicit(&event->stage, memory_order_relaxed);
+  }
+  atomic_thread_fence(memory_order_acquire);
+  uint64_t now = atomic_load_explicit(&thread->written, memory_order_relaxed);
+  uint64_t valid = now >= PROFILER_THREAD_EVENTS
+                       ? now - PROFILER_THREAD_EVENTS + 1
+                       : 0;
+  for (uint64_t i = begin < valid ? valid : begin; i < end; i++) {
+    TraceEvent *event = &out->events[i - begin];
+    if (event->start >= since) {
+      out->events[out->count++] = *event;
+    }
+  }
+  return true;
+}
+
+static void trace_write_string(FILE *file, const char *text) {
+  fputc('"', file);
+  const char *run = text;
+  for (const unsigned char *c = (const unsigned char *)text; *c; c++) {
+    if (*c != '"' && *c != '\\' && *c >= 0x20) {
+      continue;
+    }
+    fwrite(run, 1, (size_t)((const char *)c - run), file);
+    if (*c < 0x20) {
+      fprintf(file, "\\u%04x", *c);
+    } else {
+      fputc('\\', file);
+      fputc(*c, file);
+    }
+    run = (const char *)c + 1;
+  }
+  fputs(run, file);
+  fputc('"', file);
+}
+
+// Microseconds with three decimals, from integer nanoseconds: printf's
+// floating-point path was most of the export time.
+static void trace_write_us(FILE *file, const char *key, uint64_t ns) {
+  fprintf(file, ",\"%s\":%llu.%03u", key, (unsigned long long)(ns / 1000),
+          (unsigned)(ns % 1000));
+}
+
+static void trace_write_thread_name(FILE *file, bool *first, uint32_t tid,
+                                    const char *name) {
+  fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                "\"tid\":%u,\"args\":{\"name\":",
+          *first ? "" : ",", tid);
+  trace_write_string(file, name);
+  fputs("}}", file);
+  *first = false;
+}
+
+// Input-to-present spans overlap the zones of the thread that presented,
+// so they get a track of their own (tid 0).
+bool profiler_write_chrome_trace(const char *path) {
+  pthread_mutex_lock(&g_threads_lock);
+  uint32_t thread_count = 0;
+  for (ProfileThread *t = g_threads; t; t = t->next) {
+    thread_count++;
+  }
+  TraceThread *threads =
+      (TraceThread *)calloc(thread_count ? thread_count : 1,
+                            sizeof(TraceThread));
+  bool ok = threads != NULL;
+  uint64_t since = atomic_load_explicit(&g_reset_ns, memory_order_relaxed);
+  uint32_t copied = 0;
+  for (ProfileThread *t = g_threads; t && ok; t = t->next) {
+    ok = trace_copy_thread(t, &threads[copied], since);
+    copied += ok;
+  }
+  pthread_mutex_unlock(&g_threads_lock);
+
+  FILE *file = ok ? fopen(path, "w") : NULL;
+  if (file) {
+    uint64_t epoch = UINT64_MAX;
+    for (uint32_t i = 0; i < copied; i++) {
+      for (uint64_t e = 0; e < threads[i].count; e++) {
+        if (threads[i].events[e].start < epoch) {
+          epoch = threads[i].events[e].start;
+        }
+      }
+    }
+
+    bool first = true;
+    fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", file);
+    trace_write_thread_name(file, &first, 0,
+                            g_stage_names[PROFILE_INPUT_LATENCY]);
+    for (uint32_t i = 0; i < copied; i++) {
+      TraceThread *thread = &threads[i];
+      trace_write_thread_name(file, &first, thread->tid, thread->name);
+      for (uint64_t e = 0; e < thread->count; e++) {
+        TraceEvent *event = &thread->events[e];
+        uint32_t tid =
+            event->stage == PROFILE_INPUT_LATENCY ? 0 : thread->tid;
+        fputs(",\n{\"name\":", file);
+        trace_write_string(file, event->name ? event->name : "?");
+        fputs(event->stage == PROFILE_NONE ? ",\"cat\":\"zone\",\"ph\":\"X\""
+                                           : ",\"cat\":\"stage\",\"ph\":\"X\"",
+              file);
+        trace_write_us(file, "ts", event->start - epoch);
+        trace_write_us(file, "dur", event->duration);
+        fprintf(file, ",\"pid\":1,\"tid\":%u}", tid);
+      }
+    }
+    fputs("\n]}\n", file);
+    ok = fclose(file) == 0;
+  } else {
+    ok = false;
+  }
+
+  for (uint32_t i = 0; i < copied; i++) {
+    free(threads[i].events);
+  }
+  free(threads);
+  return ok;
+}
+
+#else // !ENABLE_PROFILER
+
+void profile_zone_end(ProfileZone *zone) { (void)zone; }
+
+void profiler_set_thread_name(const char *name) { (void)name; }
+void profiler_mark_input(uint64_t timestamp_ns) { (void)timestamp_ns; }
+void profiler_mark_present(void) {}
+
+void profiler_get_stage_stats(ProfileStage stage, ProfileStageStats *stats) {
+  (void)stage;
+  memset(stats, 0, sizeof(*stats));
+}
+
+void profiler_reset(void) {}
+
+bool profiler_write_chrome_trace(const char *path) {
+  (void)path;
+  return false;
+}
+
+#endif // ENABLE_PROFILER
@@ -0,0 +1,251 @@
+// Thread pool - pthread workers with per-thread ranges and work stealing
+
+#include "thread_pool.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Each participant owns a contiguous run of chunks packed as
+// (front << 32 | back). The owner takes chunks from the front, so it walks
+// neighbouring items (adjacent tiles, rows) in order; idle participants
+// steal from the back of other runs.
+typedef struct {
+  _Alignas(64) _Atomic uint64_t span;
+} PoolSlot;
+
+typedef struct {
+  struct ThreadPool *pool;
+  uint32_t slot;
+} PoolWorker;
+
+struct ThreadPool {
+  pthread_t *threads;
+  PoolWorker *workers;
+  uint32_t num_workers;
+  PoolSlot *slots; // num_workers + 1; slot 0 is the submitting thread
+
+  pthread_mutex_t submit_lock; // one parallel_for in flight at a time
+  pthread_mutex_t lock;
+  pthread_cond_t work_ready;
+  pthread_cond_t work_done;
+  uint64_t generation;
+  uint32_t busy_workers;
+  bool shutting_down;
+
+  // Current job
+  ThreadPoolRangeFn fn;
+  void *arg;
+  uint32_t count;
+  uint32_t grain;
+};
+
+static _Thread_local bool tls_in_pool = false;
+
+static inline uint64_t span_pack(uint32_t front, uint32_t back) {
+  return ((uint64_t)front << 32) | back;
+}
+
+// Take one chunk index from the front (owner) or back (thief) of a slot.
+static bool slot_take(PoolSlot *slot, bool from_front, uint32_t *chunk) {
+  uint64_t span = atomic_load_explicit(&slot->span, memory_order_relaxed);
+  for (;;) {
+    uint32_t front = (uint32_t)(span >> 32);
+    uint32_t back = (uint32_t)span;
+    if (front >= back) {
+      return false;
+    }
+    uint64_t next = from_front ? span_pack(front + 1, back)
+                               : span_pack(front, back - 1);
+    if (atomic_compare_exchange_weak_explicit(&slot->span, &span, next,
+                                              memory_order_acq_rel,
+                                              memory_order_relaxed)) {
+      *chunk = from_front ? front : back - 1;
+      return true;
+    }
+  }
+}
+
+static void run_chunk(ThreadPool *pool, uint32_t chunk) {
+  uint32_t begin = chunk * pool->grain;
+  uint32_t end = begin + pool->grain;
+  if (end > pool->count || end < begin) {
+    end = pool->count;
+  }
+  pool->fn(pool->arg, begin, end);
+}
+
+static void run_chunks(ThreadPool *pool, uint32_t self) {
+  uint32_t slots = pool->num_workers + 1;
+  uint32_t chunk;
+  while (slot_take(&pool->slots[self], true, &chunk)) {
+    run_chunk(pool, chunk);
+  }
+  // Own run exhausted: steal, starting with the next neighbour so thieves
+  // spread out instead of all hitting slot 0.
+  for (uint32_t k = 1; k < slots; k++) {
+    PoolSlot *victim = &pool->slots[(self + k) % slots];
+    while (slot_take(victim, false, &chunk)) {
+      run_chunk(pool, chunk);
+    }
+  }
+}
+
+static void *worker_main(void *opaque) {
+  PoolWorker *worker = (PoolWorker *)opaque;
+  ThreadPool *pool = worker->pool;
+  uint64_t seen = 0;
+  tls_in_pool = true;
+
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (!pool->shutting_down && pool->generation == seen) {
+      pthread_cond_wait(&pool->work_ready, &pool->lock);
+    }
+    if (pool->shutting_down) {
+      break;
+    }
+    seen = pool->generation;
+    pthread_mutex_unlock(&pool->lock);
+
+    run_chunks(pool, worker->slot);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->busy_workers == 0) {
+      pthread_cond_signal(&pool->work_done);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+static uint32_t online_cpus(void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (uint32_t)n : 1;
+}
+
+ThreadPool *thread_pool_create(uint32_t num_threads) {
+  if (num_threads == 0) {
+    num_threads = online_cpus();
+  }
+  ThreadPool *pool = (ThreadPool *)calloc(1, sizeof(ThreadPool));
+  if (!pool) {
+    return NULL;
+  }
+  uint32_t workers = num_threads - 1;
+  void *slots = NULL;
+  if (posix_memalign(&slots, _Alignof(PoolSlot),
+                     (workers + 1) * sizeof(PoolSlot)) == 0) {
+    pool->slots = (PoolSlot *)slots;
+  }
+  pool->threads = workers ? (pthread_t *)calloc(workers, sizeof(pthread_t)) : NULL;
+  pool->workers =
+      workers ? (PoolWorker *)calloc(workers, sizeof(PoolWorker)) : NULL;
+  if (!pool->slots || (workers && (!pool->threads || !pool->workers))) {
+    free(pool->slots);
+    free(pool->threads);
+    free(pool->workers);
+    free(pool);
+    return NULL;
+  }
+  for (uint32_t i = 0; i <= workers; i++) {
+    atomic_init(&pool->slots[i].span, 0);
+  }
+  pthread_mutex_init(&pool->submit_lock, NULL);
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work_ready, NULL);
+  pthread_cond_init(&pool->work_done, NULL);
+
+  for (uint32_t i = 0; i < workers; i++) {
+    pool->workers[i].pool = pool;
+    pool->workers[i].slot = i + 1;
+    if (pthread_create(&pool->threads[i], NULL, worker_main,
+                       &pool->workers[i]) != 0) {
+      break;
+    }
+    pool->num_workers++;
+  }
+  return pool;
+}
+
+void thread_pool_destroy(ThreadPool *pool) {
+  if (!pool) {
+    return;
+  }
+  pthread_mutex_lock(&pool->lock);
+  pool->shutting_down = true;
+  pthread_cond_broadcast(&pool->work_ready);
+  pthread_mutex_unlock(&pool->lock);
+  for (uint32_t i = 0; i < pool->num_workers; i++) {
+    pthread_join(pool->threads[i], NULL);
+  }
+  free(pool->threads);
+  free(pool->workers);
+  free(pool->slots);
+  pthread_cond_destroy(&pool->work_done);
+  pthread_cond_destroy(&pool->work_ready);
+  pthread_mutex_destroy(&pool->lock);
+  pthread_mutex_destroy(&pool->submit_lock);
+  free(pool);
+}
+
+static ThreadPool *g_shared_pool = NULL;
+static pthread_once_t g_shared_once = PTHREAD_ONCE_INIT;
+
+static void create_shared_pool(void) { g_shared_pool = thread_pool_create(0); }
+
+ThreadPool *thread_pool_shared(void) {
+  pthread_once(&g_shared_once, create_shared_pool);
+  return g_shared_pool;
+}
+
+uint32_t thread_pool_size(ThreadPool *pool) {
+  return pool ? pool->num_workers + 1 : 1;
+}
+
+void thread_pool_parallel_for(ThreadPool *pool, uint32_t count, uint32_t grain,
+                              ThreadPoolRangeFn fn, void *arg) {
+  if (count == 0) {
+    return;
+  }
+  if (grain == 0) {
+    grain = 1;
+  }
+  if (!pool || pool->num_workers == 0 || count <= grain || tls_in_pool) {
+    fn(arg, 0, count);
+    return;
+  }
+
+  pthread_mutex_lock(&pool->submit_lock);
+  pthread_mutex_lock(&pool->lock);
+  pool->fn = fn;
+  pool->arg = arg;
+  pool->count = count;
+  pool->grain = grain;
+
+  // Deal the chunks out as contiguous runs, one per participant.
+  uint32_t chunks = count / grain + (count % grain != 0);
+  uint32_t slots = pool->num_workers + 1;
+  for (uint32_t i = 0; i < slots; i++) {
+    uint32_t front = (uint32_t)((uint64_t)chunks * i / slots);
+    uint32_t back = (uint32_t)((uint64_t)chunks * (i + 1) / slots);
+    atomic_store_explicit(&pool->slots[i].span, span_pack(front, back),
+                          memory_order_relaxed);
+  }
+  pool->busy_workers = pool->num_workers;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->work_ready);
+  pthread_mutex_unlock(&pool->lock);
+
+  tls_in_pool = true;
+  run_chunks(pool, 0);
+  tls_in_pool = false;
+
+  pthread_mutex_lock(&pool->lock);
+  while (pool->busy_workers != 0) {
+    pthread_cond_wait(&pool->work_done, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  pthread_mutex_unlock(&pool->submit_lock);
+}
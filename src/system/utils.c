@@ -0,0 +1,759 @@
+// Utility functions and data structures
+
+#include "utils.h"
+#include "os_config.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+// ============================================================================
+// Timer
+// ============================================================================
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+Timer* os_timer_create(void) {
+    return (Timer*)calloc(1, sizeof(Timer));
+}
+
+void os_timer_start(Timer* timer) {
+    timer->start_time = monotonic_ns();
+    timer->end_time = 0;
+}
+
+void os_timer_stop(Timer* timer) {
+    timer->end_time = monotonic_ns();
+}
+
+uint64_t os_timer_elapsed_ms(Timer* timer) {
+    uint64_t end = timer->end_time ? timer->end_time : monotonic_ns();
+    return (end - timer->start_time) / 1000000ull;
+}
+
+void os_timer_destroy(Timer* timer) {
+    free(timer);
+}
+
+// ============================================================================
+// Strings
+// ============================================================================
+
+char* string_duplicate(const char* str) {
+    if (!str) {
+        return NULL;
+    }
+    size_t length = strlen(str) + 1;
+    char* copy = (char*)malloc(length);
+    if (copy) {
+        memcpy(copy, str, length);
+    }
+    return copy;
+}
+
+int string_compare(const char* str1, const char* str2) {
+    return strcmp(str1 ? str1 : "", str2 ? str2 : "");
+}
+
+int string_length(const char* str) {
+    return str ? (int)strlen(str) : 0;
+}
+
+char* string_format(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    va_list copy;
+    va_copy(copy, args);
+    int length = vsnprintf(NULL, 0, format, copy);
+    va_end(copy);
+    char* result = length >= 0 ? (char*)malloc((size_t)length + 1) : NULL;
+    if (result) {
+        vsnprintf(result, (size_t)length + 1, format, args);
+    }
+    va_end(args);
+    return result;
+}
+
+char* string_format_in(FrameArena* arena, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    va_list copy;
+    va_copy(copy, args);
+    int length = vsnprintf(NULL, 0, format, copy);
+    va_end(copy);
+    char* result =
+        length >= 0 ? (char*)frame_arena_alloc(arena, (size_t)length + 1) : NULL;
+    if (result) {
+        vsnprintf(result, (size_t)length + 1, format, args);
+    }
+    va_end(args);
+    return result;
+}
+
+// ============================================================================
+// Memory pool
+// ============================================================================
+
+// Free bitmaps are MSB-first: bit 31 of words[w] is block w * 32, so
+// count_leading_zeros_u32 yields the lowest free block and allocation
+// stays packed at the front of a chunk.
+typedef struct PoolChunk {
+    struct PoolChunk* prev; // all chunks
+    struct PoolChunk* next;
+    struct PoolChunk* prev_partial; // chunks with free blocks
+    struct PoolChunk* next_partial;
+    bool in_partial;
+    uint32_t free_count;
+    uint32_t summary; // bit set when the matching word has a free block
+    uint32_t words[POOL_MAX_CHUNK_BLOCKS / 32];
+} PoolChunk;
+
+typedef struct PoolMagazine {
+    struct MemoryPool* pool;
+    struct PoolMagazine* prev;
+    struct PoolMagazine* next;
+    uint32_t count;
+    void* blocks[POOL_MAGAZINE_SIZE];
+    // Written only by the owning thread; read by pool_get_stats.
+    _Atomic uint64_t allocs;
+    _Atomic uint64_t frees;
+} PoolMagazine;
+
+struct MemoryPool {
+    size_t block_size;
+    size_t chunk_bytes; // power of two; chunks are aligned to it
+    size_t header_bytes;
+    uint32_t chunk_blocks;
+
+    pthread_mutex_t lock;
+    PoolChunk* chunks;
+    PoolChunk* partial;
+    uint32_t chunk_count;
+    uint32_t empty_chunks;
+    uint64_t taken; // blocks out of chunks (callers plus magazines)
+    uint64_t high_water;
+
+    pthread_key_t key;
+    bool has_key;
+    PoolMagazine* magazines;
+    uint64_t retired_allocs; // counters of magazines whose thread exited
+    uint64_t retired_frees;
+};
+
+static inline uint32_t pool_bit(uint32_t index) {
+    return 0x80000000u >> (index & 31);
+}
+
+static inline PoolChunk* pool_chunk_of(const MemoryPool* pool, const void* ptr) {
+    return (PoolChunk*)((uintptr_t)ptr & ~(uintptr_t)(pool->chunk_bytes - 1));
+}
+
+static inline char* pool_chunk_blocks(const MemoryPool* pool, PoolChunk* chunk) {
+    return (char*)chunk + pool->header_bytes;
+}
+
+static void partial_push(MemoryPool* pool, PoolChunk* chunk) {
+    chunk->prev_partial = NULL;
+    chunk->next_partial = pool->partial;
+    if (pool->partial) {
+        pool->partial->prev_partial = chunk;
+    }
+    pool->partial = chunk;
+    chunk->in_partial = true;
+}
+
+static void partial_remove(MemoryPool* pool, PoolChunk* chunk) {
+    if (chunk->prev_partial) {
+        chunk->prev_partial->next_partial = chunk->next_partial;
+    } else {
+        pool->partial = chunk->next_partial;
+    }
+    if (chunk->next_partial) {
+        chunk->next_partial->prev_partial = chunk->prev_partial;
+    }
+    chunk->in_partial = false;
+}
+
+static PoolChunk* chunk_create(MemoryPool* pool) {
+    void* memory = NULL;
+    if (posix_memalign(&memory, pool->chunk_bytes, pool->chunk_bytes) != 0) {
+        return NULL;
+    }
+    PoolChunk* chunk = (PoolChunk*)memory;
+    memset(chunk, 0, sizeof(PoolChunk));
+    for (uint32_t i = 0; i < pool->chunk_blocks / 32; i++) {
+        chunk->words[i] = 0xFFFFFFFFu;
+    }
+    if (pool->chunk_blocks % 32) {
+        chunk->words[pool->chunk_blocks / 32] = ~(0xFFFFFFFFu >> (pool->chunk_blocks % 32));
+    }
+    uint32_t words = (pool->chunk_blocks + 31) / 32;
+    chunk->summary = words == 32 ? 0xFFFFFFFFu : ~(0xFFFFFFFFu >> words);
+    chunk->free_count = pool->chunk_blocks;
+
+    chunk->next = pool->chunks;
+    if (pool->chunks) {
+        pool->chunks->prev = chunk;
+    }
+    pool->chunks = chunk;
+    pool->chunk_count++;
+    pool->empty_chunks++;
+    partial_push(pool, chunk);
+    return chunk;
+}
+
+static void chunk_release(MemoryPool* pool, PoolChunk* chunk) {
+    if (chunk->in_partial) {
+        partial_remove(pool, chunk);
+    }
+    if (chunk->prev) {
+        chunk->prev->next = chunk->next;
+    } else {
+        pool->chunks = chunk->next;
+    }
+    if (chunk->next) {
+        chunk->next->prev = chunk->prev;
+    }
+    pool->chunk_count--;
+    pool->empty_chunks--;
+    free(chunk);
+}
+
+// Caller holds pool->lock.
+static void* pool_take_locked(MemoryPool* pool) {
+    PoolChunk* chunk = pool->partial;
+    if (!chunk && !(chunk = chunk_create(pool))) {
+        return NULL;
+    }
+    uint32_t w = (uint32_t)count_leading_zeros_u32(chunk->summary);
+    uint32_t b = (uint32_t)count_leading_zeros_u32(chunk->words[w]);
+    chunk->words[w] &= ~pool_bit(b);
+    if (chunk->words[w] == 0) {
+        chunk->summary &= ~pool_bit(w);
+    }
+    if (chunk->free_count-- == pool->chunk_blocks) {
+        pool->empty_chunks--;
+    }
+    if (chunk->free_count == 0) {
+        partial_remove(pool, chunk);
+    }
+    if (++pool->taken > pool->high_water) {
+        pool->high_water = pool->taken;
+    }
+    return pool_chunk_blocks(pool, chunk) + (size_t)(w * 32 + b) * pool->block_size;
+}
+
+// Caller holds pool->lock.
+static void pool_return_locked(MemoryPool* pool, void* ptr) {
+    PoolChunk* chunk = pool_chunk_of(pool, ptr);
+    uint32_t index = (uint32_t)(((char*)ptr - pool_chunk_blocks(pool, chunk)) / pool->block_size);
+    uint32_t w = index / 32;
+    chunk->words[w] |= pool_bit(index);
+    chunk->summary |= pool_bit(w);
+    if (chunk->free_count++ == 0) {
+        partial_push(pool, chunk);
+    }
+    pool->taken--;
+    if (chunk->free_count == pool->chunk_blocks) {
+        // Keep one empty chunk around so a steady alloc/free pattern at a
+        // chunk boundary does not thrash the system allocator.
+        if (++pool->empty_chunks > 1) {
+            chunk_release(pool, chunk);
+        }
+    }
+}
+
+static void magazine_retire(void* opaque) {
+    PoolMagazine* mag = (PoolMagazine*)opaque;
+    MemoryPool* pool = mag->pool;
+    pthread_mutex_lock(&pool->lock);
+    for (uint32_t i = 0; i < mag->count; i++) {
+        pool_return_locked(pool, mag->blocks[i]);
+    }
+    pool->retired_allocs += atomic_load_explicit(&mag->allocs, memory_order_relaxed);
+    pool->retired_frees += atomic_load_explicit(&mag->frees, memory_order_relaxed);
+    if (mag->prev) {
+        mag->prev->next = mag->next;
+    } else {
+        pool->magazines = mag->next;
+    }
+    if (mag->next) {
+        mag->next->prev = mag->prev;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    free(mag);
+}
+
+static PoolMagazine* magazine_get(MemoryPool* pool) {
+    if (!pool->has_key) {
+        return NULL;
+    }
+    PoolMagazine* mag = (PoolMagazine*)pthread_getspecific(pool->key);
+    if (mag) {
+        return mag;
+    }
+    mag = (PoolMagazine*)calloc(1, sizeof(PoolMagazine));
+    if (!mag) {
+        return NULL;
+    }
+    mag->pool = pool;
+    if (pthread_setspecific(pool->key, mag) != 0) {
+        free(mag);
+        return NULL;
+    }
+    pthread_mutex_lock(&pool->lock);
+    mag->next = pool->magazines;
+    if (pool->magazines) {
+        pool->magazines->prev = mag;
+    }
+    pool->magazines = mag;
+    pthread_mutex_unlock(&pool->lock);
+    return mag;
+}
+
+static inline void counter_bump(_Atomic uint64_t* counter) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+}
+
+MemoryPool* pool_create(size_t block_size, size_t num_blocks) {
+    if (block_size == 0) {
+        return NULL;
+    }
+    if (num_blocks == 0) {
+        num_blocks = 1;
+    }
+    if (num_blocks > POOL_MAX_CHUNK_BLOCKS) {
+        num_blocks = POOL_MAX_CHUNK_BLOCKS;
+    }
+    MemoryPool* pool = (MemoryPool*)calloc(1, sizeof(MemoryPool));
+    if (!pool) {
+        return NULL;
+    }
+    pool->block_size = (block_size + 15) & ~(size_t)15;
+    pool->header_bytes = (sizeof(PoolChunk) + 63) & ~(size_t)63;
+
+    size_t bytes = pool->header_bytes + pool->block_size * num_blocks;
+    pool->chunk_bytes = 4096;
+    while (pool->chunk_bytes < bytes) {
+        pool->chunk_bytes <<= 1;
+    }
+    // Use the rounding slack for extra blocks.
+    size_t fit = (pool->chunk_bytes - pool->header_bytes) / pool->block_size;
+    pool->chunk_blocks = (uint32_t)(fit > POOL_MAX_CHUNK_BLOCKS ? POOL_MAX_CHUNK_BLOCKS : fit);
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->has_key = pthread_key_create(&pool->key, magazine_retire) == 0;
+    return pool;
+}
+
+void* pool_allocate(MemoryPool* pool) {
+    if (!pool) {
+        return NULL;
+    }
+    PoolMagazine* mag = magazine_get(pool);
+    if (!mag) {
+        pthread_mutex_lock(&pool->lock);
+        void* ptr = pool_take_locked(pool);
+        if (ptr) {
+            pool->retired_allocs++;
+        }
+        pthread_mutex_unlock(&pool->lock);
+        return ptr;
+    }
+    if (mag->count == 0) {
+        pthread_mutex_lock(&pool->lock);
+        while (mag->count < POOL_MAGAZINE_SIZE / 2) {
+            void* ptr = pool_take_locked(pool);
+            if (!ptr) {
+                break;
+            }
+            mag->blocks[mag->count++] = ptr;
+        }
+        pthread_mutex_unlock(&pool->lock);
+        if (mag->count == 0) {
+            return NULL;
+        }
+    }
+    counter_bump(&mag->allocs);
+    return mag->blocks[--mag->count];
+}
+
+void pool_free(MemoryPool* pool, void* ptr) {
+    if (!pool || !ptr) {
+        return;
+    }
+    PoolMagazine* mag = magazine_get(pool);
+    if (!mag) {
+        pthread_mutex_lock(&pool->lock);
+        pool_return_locked(pool, ptr);
+        pool->retired_frees++;
+        pthread_mutex_unlock(&pool->lock);
+        return;
+    }
+    if (mag->count == POOL_MAGAZINE_SIZE) {
+        pthread_mutex_lock(&pool->lock);
+        while (mag->count > POOL_MAGAZINE_SIZE / 2) {
+            pool_return_locked(pool, mag->blocks[--mag->count]);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+    counter_bump(&mag->frees);
+    mag->blocks[mag->count++] = ptr;
+}
+
+void pool_destroy(MemoryPool* pool) {
+    if (!pool) {
+        return;
+    }
+    // Deleting the key stops exit destructors; every magazine is freed here.
+    if (pool->has_key) {
+        pthread_key_delete(pool->key);
+    }
+    while (pool->magazines) {
+        PoolMagazine* next = pool->magazines->next;
+        free(pool->magazines);
+        pool->magazines = next;
+    }
+    while (pool->chunks) {
+        PoolChunk* next = pool->chunks->next;
+        free(pool->chunks);
+        pool->chunks = next;
+    }
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+void pool_get_stats(MemoryPool* pool, MemoryPoolStats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (!pool) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    stats->allocs = pool->retired_allocs;
+    stats->frees = pool->retired_frees;
+    for (PoolMagazine* mag = pool->magazines; mag; mag = mag->next) {
+        stats->allocs += atomic_load_explicit(&mag->allocs, memory_order_relaxed);
+        stats->frees += atomic_load_explicit(&mag->frees, memory_order_relaxed);
+    }
+    stats->in_use = stats->allocs - stats->frees;
+    stats->high_water = pool->high_water;
+    stats->chunks = pool->chunk_count;
+    stats->capacity = (uint64_t)pool->chunk_count * pool->chunk_blocks;
+    uint64_t stranded = 0;
+    for (PoolChunk* chunk = pool->partial; chunk; chunk = chunk->next_partial) {
+        if (chunk->free_count != pool->chunk_blocks) {
+            stranded += chunk->free_count;
+        }
+    }
+    stats->fragmentation = stats->capacity ? (float)stranded / (float)stats->capacity : 0.0f;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// ============================================================================
+// Vector
+// ============================================================================
+
+Vector* vector_create(size_t initial_capacity) {
+    Vector* vec = (Vector*)calloc(1, sizeof(Vector));
+    if (!vec) {
+        return NULL;
+    }
+    if (initial_capacity) {
+        vec->elements = (void**)malloc(initial_capacity * sizeof(void*));
+        vec->capacity = vec->elements ? initial_capacity : 0;
+    }
+    return vec;
+}
+
+Vector* vector_create_in(FrameArena* arena, size_t initial_capacity) {
+    Vector* vec = (Vector*)frame_arena_calloc(arena, 1, sizeof(Vector));
+    if (!vec) {
+        return NULL;
+    }
+    vec->arena = arena;
+    if (initial_capacity) {
+        vec->elements =
+            (void**)frame_arena_alloc(arena, initial_capacity * sizeof(void*));
+        vec->capacity = vec->elements ? initial_capacity : 0;
+    }
+    return vec;
+}
+
+void vector_push(Vector* vec, void* element) {
+    if (vec->count == vec->capacity) {
+        size_t capacity = vec->capacity ? vec->capacity * 2 : 8;
+        void** elements =
+            vec->arena ? (void**)frame_arena_grow(vec->arena, vec->elements,
+                                                   vec->capacity * sizeof(void*),
+                                                   capacity * sizeof(void*))
+                       : (void**)realloc(vec->elements, capacity * sizeof(void*));
+        if (!elements) {
+            return;
+        }
+        vec->elements = elements;
+        vec->capacity = capacity;
+    }
+    vec->elements[vec->count++] = element;
+}
+
+void* vector_pop(Vector* vec) {
+    return vec->count ? vec->elements[--vec->count] : NULL;
+}
+
+void* vector_get(Vector* vec, size_t index) {
+    return index < vec->count ? vec->elements[index] : NULL;
+}
+
+void vector_destroy(Vector* vec) {
+    if (vec && !vec->arena) {
+        free(vec->elements);
+        free(vec);
+    }
+}
+
+// ============================================================================
+// Hash table
+// ============================================================================
+
+#define HASHMAP_MIN_CAPACITY 16
+#define HASHMAP_MIGRATE_STEP 32 // old slots moved per put/remove
+#define HASHMAP_MAP_BYTES (1u << 20) // tables this large are mmapped
+#define HASHMAP_UNMAP_STEP (256u << 10) // retired bytes unmapped per put/remove
+
+// MurmurHash3 finalizer: full avalanche, so sequential ids spread evenly.
+static inline uint64_t hash_mix(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdull;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ull;
+    key ^= key >> 33;
+    return key;
+}
+
+// Index of key in a table, or -1. In the old table a migrated or removed
+// entry keeps its key and distance but has a NULL value, so the probe
+// chains of its neighbours stay intact while the table drains.
+static ptrdiff_t table_find(const HashEntry* entries, size_t capacity, uint64_t key) {
+    size_t mask = capacity - 1;
+    size_t i = (size_t)hash_mix(key) & mask;
+    for (uint32_t d = 1; entries[i].distance >= d; d++) {
+        if (entries[i].key == key) {
+            return (ptrdiff_t)i;
+        }
+        i = (i + 1) & mask;
+    }
+    return -1;
+}
+
+// Insert a key known to be absent, displacing richer entries.
+static void table_insert(HashEntry* entries, size_t capacity, uint64_t key, void* value) {
+    size_t mask = capacity - 1;
+    size_t i = (size_t)hash_mix(key) & mask;
+    HashEntry entry = {key, value, 1};
+    for (;;) {
+        if (entries[i].distance == 0) {
+            entries[i] = entry;
+            return;
+        }
+        if (entries[i].distance < entry.distance) {
+            HashEntry displaced = entries[i];
+            entries[i] = entry;
+            entry = displaced;
+        }
+        entry.distance++;
+        i = (i + 1) & mask;
+    }
+}
+
+// Zeroed table; large ones are mapped so they can be released in slices.
+static HashEntry* table_alloc(size_t capacity) {
+    size_t bytes = capacity * sizeof(HashEntry);
+    if (bytes < HASHMAP_MAP_BYTES) {
+        return (HashEntry*)calloc(capacity, sizeof(HashEntry));
+    }
+    void* memory = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return memory == MAP_FAILED ? NULL : (HashEntry*)memory;
+}
+
+static void table_free(HashEntry* entries, size_t capacity) {
+    size_t bytes = capacity * sizeof(HashEntry);
+    if (bytes < HASHMAP_MAP_BYTES) {
+        free(entries);
+    } else if (entries) {
+        munmap(entries, bytes);
+    }
+}
+
+// Unmaps the next slice of a drained table; the mapping is page aligned
+// and every slice but the last is a whole number of pages.
+static void hashmap_release(HashMap* map, size_t bytes) {
+    if (!map->retiring) {
+        return;
+    }
+    if (bytes >= map->retiring_bytes) {
+        munmap(map->retiring, map->retiring_bytes);
+        map->retiring = NULL;
+        map->retiring_bytes = 0;
+        return;
+    }
+    munmap(map->retiring, bytes);
+    map->retiring += bytes;
+    map->retiring_bytes -= bytes;
+}
+
+static void hashmap_migrate(HashMap* map, size_t steps) {
+    if (!map->old_entries) {
+        hashmap_release(map, steps == SIZE_MAX ? SIZE_MAX : HASHMAP_UNMAP_STEP);
+        return;
+    }
+    while (steps-- > 0 && map->migrate_pos < map->old_capacity) {
+        HashEntry* entry = &map->old_entries[map->migrate_pos++];
+        if (entry->distance && entry->value) {
+            table_insert(map->entries, map->capacity, entry->key, entry->value);
+            entry->value = NULL;
+        }
+    }
+    if (map->migrate_pos == map->old_capacity) {
+        size_t bytes = map->old_capacity * sizeof(HashEntry);
+        if (bytes < HASHMAP_MAP_BYTES) {
+            free(map->old_entries);
+        } else {
+            hashmap_release(map, SIZE_MAX); // a previous table, if any
+            map->retiring = (char*)map->old_entries;
+            map->retiring_bytes = bytes;
+        }
+        map->old_entries = NULL;
+        map->old_capacity = 0;
+        map->migrate_pos = 0;
+    }
+}
+
+static bool hashmap_grow(HashMap* map) {
+    hashmap_migrate(map, SIZE_MAX); // finish any resize still in flight
+    HashEntry* entries = table_alloc(map->capacity * 2);
+    if (!entries) {
+        return false;
+    }
+    map->old_entries = map->entries;
+    map->old_capacity = map->capacity;
+    map->migrate_pos = 0;
+    map->entries = entries;
+    map->capacity *= 2;
+    return true;
+}
+
+HashMap* hashmap_create(size_t capacity) {
+    HashMap* map = (HashMap*)calloc(1, sizeof(HashMap));
+    if (!map) {
+        return NULL;
+    }
+    map->capacity = HASHMAP_MIN_CAPACITY;
+    while (map->capacity * 7 / 8 < capacity) {
+        map->capacity <<= 1;
+    }
+    map->entries = table_alloc(map->capacity);
+    if (!map->entries) {
+        free(map);
+        return NULL;
+    }
+    return map;
+}
+
+void hashmap_put(HashMap* map, uint64_t key, void* value) {
+    if (!value) {
+        hashmap_remove(map, key);
+        return;
+    }
+    hashmap_migrate(map, HASHMAP_MIGRATE_STEP);
+    ptrdiff_t i = table_find(map->entries, map->capacity, key);
+    if (i >= 0) {
+        map->entries[i].value = value;
+        return;
+    }
+    if (map->old_entries) {
+        i = table_find(map->old_entries, map->old_capacity, key);
+        if (i >= 0 && map->old_entries[i].value) {
+            map->old_entries[i].value = NULL; // moves to the new table below
+            map->count--;
+        }
+    }
+    if ((map->count + 1) * 8 > map->capacity * 7 && !hashmap_grow(map)) {
+        return;
+    }
+    table_insert(map->entries, map->capacity, key, value);
+    map->count++;
+}
+
+void* hashmap_get(HashMap* map, uint64_t key) {
+    ptrdiff_t i = table_find(map->entries, map->capacity, key);
+    if (i >= 0) {
+        return map->entries[i].value;
+    }
+    if (map->old_entries) {
+        i = table_find(map->old_entries, map->old_capacity, key);
+        if (i >= 0) {
+            return map->old_entries[i].value;
+        }
+    }
+    return NULL;
+}
+
+void hashmap_remove(HashMap* map, uint64_t key) {
+    hashmap_migrate(map, HASHMAP_MIGRATE_STEP);
+    if (map->old_entries) {
+        ptrdiff_t i = table_find(map->old_entries, map->old_capacity, key);
+        if (i >= 0 && map->old_entries[i].value) {
+            map->old_entries[i].value = NULL;
+            map->count--;
+            return;
+        }
+    }
+    ptrdiff_t i = table_find(map->entries, map->capacity, key);
+    if (i < 0) {
+        return;
+    }
+    // Backward shift: pull the rest of the run one slot closer to home.
+    size_t mask = map->capacity - 1;
+    size_t hole = (size_t)i;
+    size_t next = (hole + 1) & mask;
+    while (map->entries[next].distance > 1) {
+        map->entries[hole] = map->entries[next];
+        map->entries[hole].distance--;
+        hole = next;
+        next = (next + 1) & mask;
+    }
+    map->entries[hole].distance = 0;
+    map->entries[hole].value = NULL;
+    map->count--;
+}
+
+void hashmap_destroy(HashMap* map) {
+    if (map) {
+        hashmap_release(map, SIZE_MAX);
+        table_free(map->old_entries, map->old_capacity);
+        table_free(map->entries, map->capacity);
+        free(map);
+    }
+}
+
+// ============================================================================
+// Bit utilities
+// ============================================================================
+
+int count_leading_zeros_u32(uint32_t value) {
+    return value ? __builtin_clz(value) : 32;
+}
+
+int find_msb_u32(uint32_t value) {
+    return value ? 31 - __builtin_clz(value) : -1;
+}
@@ -0,0 +1,524 @@
+// Spatial index - uniform grid of z-sorted cell lists for hit-testing
+
+#include "spatial_index.h"
+#include "region.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+  OSRect rect;
+  uint64_t z;
+  uint32_t item;
+  uint32_t id; // copied from the item, so queries stay in the cell list
+} SpatialEntry;
+
+// Entries sorted by z, back to front, so raising an item (a new largest
+// key) appends instead of shifting the whole list
+typedef struct {
+  SpatialEntry *entries;
+  uint32_t count;
+  uint32_t capacity;
+} SpatialCell;
+
+typedef struct {
+  uint32_t id;
+  OSRect rect;
+  uint64_t z;
+  int32_t x0, y0, x1, y1; // covered cells, inclusive
+  bool large;             // listed in index->large instead
+} SpatialItem;
+
+typedef struct {
+  uint64_t z;
+  uint32_t id;
+} SpatialHit;
+
+struct SpatialIndex {
+  OSRect world;
+  int32_t cell_size;
+  int32_t columns;
+  int32_t rows;
+  SpatialCell *cells;
+  SpatialCell large;
+
+  SpatialItem *items;
+  uint32_t item_count; // slots ever used
+  uint32_t item_capacity;
+  uint32_t *free_items;
+  uint32_t free_count;
+  uint32_t live_count;
+  HashMap *slots; // id -> slot + 1
+
+  SpatialHit *hits;
+  SpatialHit *merged; // merge scratch, hit_capacity long
+  uint32_t hit_capacity;
+  uint32_t *runs; // start of each cell's run of hits
+  uint32_t run_capacity;
+};
+
+// ============================================================================
+// Cells
+// ============================================================================
+
+static bool cell_reserve(SpatialCell *cell, uint32_t capacity) {
+  if (capacity <= cell->capacity) {
+    return true;
+  }
+  uint32_t new_capacity = cell->capacity ? cell->capacity * 2 : 8;
+  while (new_capacity < capacity) {
+    new_capacity *= 2;
+  }
+  SpatialEntry *entries = (SpatialEntry *)realloc(
+      cell->entries, new_capacity * sizeof(SpatialEntry));
+  if (!entries) {
+    return false;
+  }
+  cell->entries = entries;
+  cell->capacity = new_capacity;
+  return true;
+}
+
+// First position whose z is not less than z.
+static uint32_t cell_lower_bound(const SpatialCell *cell, uint64_t z) {
+  uint32_t low = 0;
+  uint32_t high = cell->count;
+  while (low < high) {
+    uint32_t mid = low + (high - low) / 2;
+    if (cell->entries[mid].z < z) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+static SpatialEntry *cell_find(SpatialCell *cell, uint64_t z, uint32_t item) {
+  for (uint32_t i = cell_lower_bound(cell, z);
+       i < cell->count && cell->entries[i].z == z; i++) {
+    if (cell->entries[i].item == item) {
+      return &cell->entries[i];
+    }
+  }
+  return NULL;
+}
+
+static void cell_insert(SpatialCell *cell, OSRect rect, uint64_t z,
+                        uint32_t item, uint32_t id) {
+  if (!cell_reserve(cell, cell->count + 1)) {
+    return;
+  }
+  uint32_t at = cell_lower_bound(cell, z);
+  memmove(&cell->entries[at + 1], &cell->entries[at],
+          (cell->count - at) * sizeof(SpatialEntry));
+  cell->entries[at] = (SpatialEntry){rect, z, item, id};
+  cell->count++;
+}
+
+static void cell_remove(SpatialCell *cell, uint64_t z, uint32_t item) {
+  SpatialEntry *entry = cell_find(cell, z, item);
+  if (!entry) {
+    return;
+  }
+  uint32_t at = (uint32_t)(entry - cell->entries);
+  memmove(&cell->entries[at], &cell->entries[at + 1],
+          (cell->count - at - 1) * sizeof(SpatialEntry));
+  cell->count--;
+}
+
+static int32_t clamp_cell(int32_t offset, int32_t cell_size, int32_t limit) {
+  if (offset < 0) {
+    return 0;
+  }
+  int32_t cell = offset / cell_size;
+  return cell < limit ? cell : limit - 1;
+}
+
+static void cell_span(const SpatialIndex *index, OSRect rect, SpatialItem *out) {
+  int32_t width = rect.width > 0 ? rect.width : 1;
+  int32_t height = rect.height > 0 ? rect.height : 1;
+  out->x0 = clamp_cell(rect.x - index->world.x, index->cell_size, index->columns);
+  out->y0 = clamp_cell(rect.y - index->world.y, index->cell_size, index->rows);
+  out->x1 = clamp_cell(rect.x + width - 1 - index->world.x, index->cell_size,
+                       index->columns);
+  out->y1 = clamp_cell(rect.y + height - 1 - index->world.y, index->cell_size,
+                       index->rows);
+  int64_t cells = (int64_t)(out->x1 - out->x0 + 1) * (out->y1 - out->y0 + 1);
+  out->large = cells > SPATIAL_MAX_ITEM_CELLS;
+}
+
+static SpatialCell *index_cell(const SpatialIndex *index, int32_t x, int32_t y) {
+  return &index->cells[y * index->columns + x];
+}
+
+static bool span_contains(const SpatialItem *span, int32_t x, int32_t y) {
+  return x >= span->x0 && x <= span->x1 && y >= span->y0 && y <= span->y1;
+}
+
+// Adds or removes an item in every list of its current span.
+static void item_link(SpatialIndex *index, uint32_t slot) {
+  SpatialItem *item = &index->items[slot];
+  if (item->large) {
+    cell_insert(&index->large, item->rect, item->z, slot, item->id);
+    return;
+  }
+  for (int32_t y = item->y0; y <= item->y1; y++) {
+    for (int32_t x = item->x0; x <= item->x1; x++) {
+      cell_insert(index_cell(index, x, y), item->rect, item->z, slot,
+                  item->id);
+    }
+  }
+}
+
+static void item_unlink(SpatialIndex *index, uint32_t slot) {
+  SpatialItem *item = &index->items[slot];
+  if (item->large) {
+    cell_remove(&index->large, item->z, slot);
+    return;
+  }
+  for (int32_t y = item->y0; y <= item->y1; y++) {
+    for (int32_t x = item->x0; x <= item->x1; x++) {
+      cell_remove(index_cell(index, x, y), item->z, slot);
+    }
+  }
+}
+
+static bool item_lookup(const SpatialIndex *index, uint32_t id,
+                        uint32_t *slot) {
+  uintptr_t value = (uintptr_t)hashmap_get(index->slots, id);
+  if (!value) {
+    return false;
+  }
+  *slot = (uint32_t)(value - 1);
+  return true;
+}
+
+// ============================================================================
+// Lifecycle
+// ============================================================================
+
+SpatialIndex *spatial_index_create(OSRect world, int32_t cell_size) {
+  if (rect_is_empty(world) || cell_size <= 0) {
+    return NULL;
+  }
+  SpatialIndex *index = (SpatialIndex *)calloc(1, sizeof(SpatialIndex));
+  if (!index) {
+    return NULL;
+  }
+  index->world = world;
+  index->cell_size = cell_size;
+  index->columns = (world.width + cell_size - 1) / cell_size;
+  index->rows = (world.height + cell_size - 1) / cell_size;
+  index->cells = (SpatialCell *)calloc((size_t)index->columns * index->rows,
+                                       sizeof(SpatialCell));
+  index->slots = hashmap_create(64);
+  if (!index->cells || !index->slots) {
+    spatial_index_destroy(index);
+    return NULL;
+  }
+  return index;
+}
+
+void spatial_index_destroy(SpatialIndex *index) {
+  if (!index) {
+    return;
+  }
+  if (index->cells) {
+    for (int32_t i = 0; i < index->columns * index->rows; i++) {
+      free(index->cells[i].entries);
+    }
+  }
+  free(index->cells);
+  free(index->large.entries);
+  free(index->items);
+  free(index->free_items);
+  free(index->hits);
+  free(index->merged);
+  free(index->runs);
+  if (index->slots) {
+    hashmap_destroy(index->slots);
+  }
+  free(index);
+}
+
+uint32_t spatial_index_count(const SpatialIndex *index) {
+  return index ? index->live_count : 0;
+}
+
+// ============================================================================
+// Updates
+// ============================================================================
+
+bool spatial_index_insert(SpatialIndex *index, uint32_t id, OSRect rect,
+                          uint64_t z) {
+  if (!index) {
+    return false;
+  }
+  spatial_index_remove(index, id);
+
+  uint32_t slot;
+  if (index->free_count > 0) {
+    slot = index->free_items[--index->free_count];
+  } else {
+    if (index->item_count == index->item_capacity) {
+      uint32_t capacity = index->item_capacity ? index->item_capacity * 2 : 64;
+      SpatialItem *items =
+          (SpatialItem *)realloc(index->items, capacity * sizeof(SpatialItem));
+      if (!items) {
+        return false;
+      }
+      index->items = items;
+      uint32_t *free_items =
+          (uint32_t *)realloc(index->free_items, capacity * sizeof(uint32_t));
+      if (!free_items) {
+        return false;
+      }
+      index->free_items = free_items;
+      index->item_capacity = capacity;
+    }
+    slot = index->item_count++;
+  }
+
+  SpatialItem *item = &index->items[slot];
+  item->id = id;
+  item->rect = rect;
+  item->z = z;
+  cell_span(index, rect, item);
+  item_link(index, slot);
+  hashmap_put(index->slots, id, (void *)(uintptr_t)(slot + 1));
+  index->live_count++;
+  return true;
+}
+
+void spatial_index_remove(SpatialIndex *index, uint32_t id) {
+  uint32_t slot;
+  if (!index || !item_lookup(index, id, &slot)) {
+    return;
+  }
+  item_unlink(index, slot);
+  hashmap_remove(index->slots, id);
+  index->free_items[index->free_count++] = slot;
+  index->live_count--;
+}
+
+void spatial_index_update(SpatialIndex *index, uint32_t id, OSRect rect) {
+  uint32_t slot;
+  if (!index || !item_lookup(index, id, &slot)) {
+    return;
+  }
+  SpatialItem *item = &index->items[slot];
+  SpatialItem span;
+  cell_span(index, rect, &span);
+
+  if (item->large || span.large) {
+    item_unlink(index, slot);
+    item->rect = rect;
+    item->x0 = span.x0;
+    item->y0 = span.y0;
+    item->x1 = span.x1;
+    item->y1 = span.y1;
+    item->large = span.large;
+    item_link(index, slot);
+    return;
+  }
+
+  // Only the cells the rect left or entered change membership; the rest
+  // just get the new rect
+  for (int32_t y = item->y0; y <= item->y1; y++) {
+    for (int32_t x = item->x0; x <= item->x1; x++) {
+      SpatialCell *cell = index_cell(index, x, y);
+      if (span_contains(&span, x, y)) {
+        SpatialEntry *entry = cell_find(cell, item->z, slot);
+        if (entry) {
+          entry->rect = rect;
+        }
+      } else {
+        cell_remove(cell, item->z, slot);
+      }
+    }
+  }
+  for (int32_t y = span.y0; y <= span.y1; y++) {
+    for (int32_t x = span.x0; x <= span.x1; x++) {
+      if (!span_contains(item, x, y)) {
+        cell_insert(index_cell(index, x, y), rect, item->z, slot, item->id);
+      }
+    }
+  }
+  item->rect = rect;
+  item->x0 = span.x0;
+  item->y0 = span.y0;
+  item->x1 = span.x1;
+  item->y1 = span.y1;
+}
+
+void spatial_index_set_z(SpatialIndex *index, uint32_t id, uint64_t z) {
+  uint32_t slot;
+  if (!index || !item_lookup(index, id, &slot) || index->items[slot].z == z) {
+    return;
+  }
+  item_unlink(index, slot);
+  index->items[slot].z = z;
+  item_link(index, slot);
+}
+
+// ============================================================================
+// Queries
+// ============================================================================
+
+static bool rect_contains_point(OSRect rect, int32_t x, int32_t y) {
+  return x >= rect.x && x < rect.x + rect.width && y >= rect.y &&
+         y < rect.y + rect.height;
+}
+
+// Frontmost entry of a cell containing the point.
+static const SpatialEntry *cell_top_at(const SpatialCell *cell, int32_t x,
+                                       int32_t y) {
+  for (uint32_t i = cell->count; i-- > 0;) {
+    if (rect_contains_point(cell->entries[i].rect, x, y)) {
+      return &cell->entries[i];
+    }
+  }
+  return NULL;
+}
+
+bool spatial_index_top_at(const SpatialIndex *index, int32_t x, int32_t y,
+                          uint32_t *id) {
+  if (!index || index->live_count == 0) {
+    return false;
+  }
+  int32_t cx = clamp_cell(x - index->world.x, index->cell_size, index->columns);
+  int32_t cy = clamp_cell(y - index->world.y, index->cell_size, index->rows);
+  const SpatialEntry *top = cell_top_at(index_cell(index, cx, cy), x, y);
+  const SpatialEntry *large = cell_top_at(&index->large, x, y);
+  if (large && (!top || large->z > top->z)) {
+    top = large;
+  }
+  if (!top) {
+    return false;
+  }
+  if (id) {
+    *id = top->id;
+  }
+  return true;
+}
+
+static bool hits_reserve(SpatialIndex *index, uint32_t count) {
+  if (count <= index->hit_capacity) {
+    return true;
+  }
+  uint32_t capacity = index->hit_capacity ? index->hit_capacity * 2 : 64;
+  SpatialHit *hits =
+      (SpatialHit *)realloc(index->hits, capacity * sizeof(SpatialHit));
+  if (!hits) {
+    return false;
+  }
+  index->hits = hits;
+  SpatialHit *merged =
+      (SpatialHit *)realloc(index->merged, capacity * sizeof(SpatialHit));
+  if (!merged) {
+    return false;
+  }
+  index->merged = merged;
+  index->hit_capacity = capacity;
+  return true;
+}
+
+// Appends the cell's hits as one run, back to front. An item spanning
+// several of the queried cells is reported only from the first of them, the
+// one at the top left of where its span and the query's overlap.
+static void collect_hits(SpatialIndex *index, const SpatialCell *cell,
+                         const SpatialItem *query, int32_t x, int32_t y,
+                         OSRect rect, uint32_t *count, uint32_t *run_count) {
+  if (*run_count == index->run_capacity) {
+    uint32_t capacity = index->run_capacity ? index->run_capacity * 2 : 16;
+    uint32_t *runs =
+        (uint32_t *)realloc(index->runs, capacity * sizeof(uint32_t));
+    if (!runs) {
+      return;
+    }
+    index->runs = runs;
+    index->run_capacity = capacity;
+  }
+  // An item also listed in the cell to the left (or above) starts left of
+  // this cell's edge; clamping keeps that true at the world's border
+  bool first_column = !query || x == query->x0;
+  bool first_row = !query || y == query->y0;
+  int32_t left = index->world.x + x * index->cell_size;
+  int32_t top = index->world.y + y * index->cell_size;
+  uint32_t first = *count;
+  for (uint32_t i = 0; i < cell->count; i++) {
+    const SpatialEntry *entry = &cell->entries[i];
+    if ((!first_column && entry->rect.x < left) ||
+        (!first_row && entry->rect.y < top) ||
+        !rect_intersects(entry->rect, rect)) {
+      continue;
+    }
+    if (!hits_reserve(index, *count + 1)) {
+      break;
+    }
+    index->hits[(*count)++] = (SpatialHit){entry->z, entry->id};
+  }
+  if (*count > first) {
+    index->runs[(*run_count)++] = first;
+  }
+}
+
+// Merges the sorted runs pairwise, linear per pass, instead of sorting the
+// hits from scratch. Returns the buffer that ends up holding them.
+static SpatialHit *merge_runs(SpatialIndex *index, uint32_t count,
+                              uint32_t run_count) {
+  SpatialHit *from = index->hits;
+  SpatialHit *to = index->merged;
+  while (run_count > 1) {
+    uint32_t merged_runs = 0;
+    for (uint32_t r = 0; r < run_count; r += 2) {
+      uint32_t a = index->runs[r];
+      uint32_t a_end = r + 1 < run_count ? index->runs[r + 1] : count;
+      uint32_t b = a_end;
+      uint32_t b_end = r + 2 < run_count ? index->runs[r + 2] : count;
+      uint32_t out = a;
+      while (a < a_end && b < b_end) {
+        to[out++] = from[a].z <= from[b].z ? from[a++] : from[b++];
+      }
+      while (a < a_end) {
+        to[out++] = from[a++];
+      }
+      while (b < b_end) {
+        to[out++] = from[b++];
+      }
+      index->runs[merged_runs++] = index->runs[r];
+    }
+    run_count = merged_runs;
+    SpatialHit *swap = from;
+    from = to;
+    to = swap;
+  }
+  return from;
+}
+
+uint32_t spatial_index_query(SpatialIndex *index, OSRect rect, uint32_t *ids,
+                             uint32_t max_ids) {
+  if (!index || rect_is_empty(rect) || index->live_count == 0) {
+    return 0;
+  }
+  SpatialItem span;
+  cell_span(index, rect, &span);
+  uint32_t count = 0;
+  uint32_t run_count = 0;
+  for (int32_t y = span.y0; y <= span.y1; y++) {
+    for (int32_t x = span.x0; x <= span.x1; x++) {
+      collect_hits(index, index_cell(index, x, y), &span, x, y, rect, &count,
+                   &run_count);
+    }
+  }
+  collect_hits(index, &index->large, NULL, 0, 0, rect, &count, &run_count);
+
+  // Back to front in the runs, front to back for the caller
+  const SpatialHit *hits = merge_runs(index, count, run_count);
+  uint32_t written = count < max_ids ? count : max_ids;
+  for (uint32_t i = 0; i < written; i++) {
+    ids[i] = hits[count - 1 - i].id;
+  }
+  return count;
+}
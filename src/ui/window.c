@@ -0,0 +1,457 @@
+// Window manager - window lifecycle, damage tracking and rendering
+
+#include "window_c.h"
+#include "os_config.h"
+#include "pmm.h"
+#include "profiler.h"
+#include "spatial_index.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define WINDOW_TITLEBAR_HEIGHT 28
+#define WINDOW_SHADOW_OFFSET_Y 6
+#define WINDOW_BUTTON_RADIUS 6
+#define WINDOW_INDEX_CELL_SIZE 128
+// How far outside its bounds a window's shadow can paint
+#define WINDOW_SHADOW_REACH ((int32_t)(WINDOW_SHADOW_BLUR + 0.5f) + WINDOW_SHADOW_OFFSET_Y)
+
+static const Color DESKTOP_BACKGROUND = {255, 30, 30, 36};
+static const Color TITLEBAR_COLOR = {255, 236, 236, 236};
+static const Color SHADOW_COLOR = {90, 0, 0, 0};
+static const Color BUTTON_INACTIVE = {255, 200, 200, 200};
+static const Color BUTTON_COLORS[3] = {
+    {255, 255, 95, 87}, {255, 254, 188, 46}, {255, 40, 200, 64}};
+
+static uint32_t g_next_window_id = 1;
+
+static bool window_is_visible(const CWindow *window) {
+  return window->state != WINDOW_STATE_HIDDEN &&
+         window->state != WINDOW_STATE_MINIMIZED;
+}
+
+// Only visible windows are indexed, so hidden ones cost queries nothing.
+static void window_update_index(CWindow *window) {
+  if (!window->manager) {
+    return;
+  }
+  if (window_is_visible(window)) {
+    spatial_index_insert(window->manager->spatial, window->window_id,
+                         window->bounds, window->z);
+  } else {
+    spatial_index_remove(window->manager->spatial, window->window_id);
+  }
+}
+
+// ============================================================================
+// Damage tracking
+// ============================================================================
+
+OSRect window_visual_bounds(const CWindow *window) {
+  OSRect r = window->bounds;
+  if (window->flags & WINDOW_FLAG_SHADOW) {
+    int32_t pad = (int32_t)(WINDOW_SHADOW_BLUR + 0.5f);
+    OSRect shadow = {r.x - pad, r.y - pad + WINDOW_SHADOW_OFFSET_Y,
+                     r.width + 2 * pad, r.height + 2 * pad};
+    r = rect_union(r, shadow);
+  }
+  return r;
+}
+
+void window_manager_invalidate(CWindowManager *manager, OSRect rect) {
+  if (manager) {
+    region_add_rect(&manager->damage, rect);
+  }
+}
+
+void window_invalidate(CWindow *window) {
+  if (window && window_is_visible(window)) {
+    window_manager_invalidate(window->manager, window_visual_bounds(window));
+  }
+}
+
+void window_invalidate_rect(CWindow *window, OSRect rect) {
+  if (!window || !window_is_visible(window)) {
+    return;
+  }
+  rect.x += window->bounds.x;
+  rect.y += window->bounds.y;
+  window_manager_invalidate(window->manager,
+                            rect_intersection(rect, window->bounds));
+}
+
+// ============================================================================
+// Manager lifecycle
+// ============================================================================
+
+CWindowManager *window_manager_create(uint32_t max_windows) {
+  CWindowManager *manager = (CWindowManager *)calloc(1, sizeof(CWindowManager));
+  if (!manager) {
+    return NULL;
+  }
+  manager->windows = (CWindow **)calloc(max_windows, sizeof(CWindow *));
+  manager->window_visible = (OSRegion *)calloc(max_windows, sizeof(OSRegion));
+  manager->layers = (CWindow **)calloc(max_windows, sizeof(CWindow *));
+  manager->layer_ids = (uint32_t *)calloc(max_windows, sizeof(uint32_t));
+  manager->window_cache = slab_cache_create(pmm_kernel(), sizeof(CWindow));
+  manager->windows_by_id = hashmap_create(max_windows);
+  OSRect world = {0, 0, DISPLAY_WIDTH, DISPLAY_HEIGHT};
+  manager->spatial = spatial_index_create(world, WINDOW_INDEX_CELL_SIZE);
+  if (!manager->windows || !manager->window_visible || !manager->layers ||
+      !manager->layer_ids || !manager->window_cache ||
+      !manager->windows_by_id || !manager->spatial) {
+    free(manager->windows);
+    free(manager->window_visible);
+    free(manager->layers);
+    free(manager->layer_ids);
+    slab_cache_destroy(manager->window_cache);
+    hashmap_destroy(manager->windows_by_id);
+    spatial_index_destroy(manager->spatial);
+    free(manager);
+    return NULL;
+  }
+  manager->max_windows = max_windows;
+  for (uint32_t i = 0; i < max_windows; i++) {
+    region_init(&manager->window_visible[i]);
+  }
+  region_init(&manager->uncovered);
+  region_init(&manager->damage);
+  region_init(&manager->painting);
+  manager->full_damage = true;
+  return manager;
+}
+
+void window_manager_destroy(CWindowManager *manager) {
+  if (!manager) {
+    return;
+  }
+  slab_cache_destroy(manager->window_cache); // frees every CWindow
+  hashmap_destroy(manager->windows_by_id);
+  spatial_index_destroy(manager->spatial);
+  free(manager->layers);
+  free(manager->layer_ids);
+  for (uint32_t i = 0; i < manager->max_windows; i++) {
+    region_destroy(&manager->window_visible[i]);
+  }
+  free(manager->window_visible);
+  region_destroy(&manager->uncovered);
+  region_destroy(&manager->damage);
+  region_destroy(&manager->painting);
+  free(manager->windows);
+  free(manager);
+}
+
+// ============================================================================
+// Window lifecycle
+// ============================================================================
+
+CWindow *window_create(CWindowManager *manager, const char *title, OSRect bounds,
+                       uint32_t flags) {
+  if (!manager || manager->window_count >= manager->max_windows) {
+    return NULL;
+  }
+  CWindow *window = (CWindow *)slab_alloc(manager->window_cache);
+  if (!window) {
+    return NULL;
+  }
+  memset(window, 0, sizeof(CWindow));
+  window->window_id = g_next_window_id++;
+  window->bounds = bounds;
+  window->state = WINDOW_STATE_NORMAL;
+  window->flags = flags;
+  window->background_color = (Color){255, 255, 255, 255};
+  window->manager = manager;
+  window->z = ++manager->next_z;
+  window_set_title(window, title);
+
+  manager->windows[manager->window_count++] = window;
+  hashmap_put(manager->windows_by_id, window->window_id, window);
+  window_update_index(window);
+  window_invalidate(window);
+  return window;
+}
+
+void window_destroy(CWindowManager *manager, CWindow *window) {
+  if (!manager || !window) {
+    return;
+  }
+  for (uint32_t i = 0; i < manager->window_count; i++) {
+    if (manager->windows[i] != window) {
+      continue;
+    }
+    window_invalidate(window);
+    memmove(&manager->windows[i], &manager->windows[i + 1],
+            (manager->window_count - i - 1) * sizeof(CWindow *));
+    manager->window_count--;
+    hashmap_remove(manager->windows_by_id, window->window_id);
+    spatial_index_remove(manager->spatial, window->window_id);
+    if (manager->focused_window == window) {
+      manager->focused_window = NULL;
+    }
+    if (window->on_close) {
+      window->on_close(window);
+    }
+    slab_free(manager->window_cache, window);
+    return;
+  }
+}
+
+CWindow *window_manager_find(CWindowManager *manager, uint32_t window_id) {
+  return manager ? (CWindow *)hashmap_get(manager->windows_by_id, window_id)
+                 : NULL;
+}
+
+CWindow *window_manager_window_at(CWindowManager *manager, int32_t x, int32_t y) {
+  uint32_t window_id;
+  if (!manager || !spatial_index_top_at(manager->spatial, x, y, &window_id)) {
+    return NULL;
+  }
+  return window_manager_find(manager, window_id);
+}
+
+uint32_t window_manager_windows_in_rect(CWindowManager *manager, OSRect rect,
+                                        CWindow **windows, uint32_t max_windows) {
+  if (!manager) {
+    return 0;
+  }
+  uint32_t count = spatial_index_query(manager->spatial, rect,
+                                       manager->layer_ids, manager->max_windows);
+  uint32_t written = count < max_windows ? count : max_windows;
+  for (uint32_t i = 0; i < written; i++) {
+    windows[i] = window_manager_find(manager, manager->layer_ids[i]);
+  }
+  return count;
+}
+
+// ============================================================================
+// Window properties
+// ============================================================================
+
+void window_set_title(CWindow *window, const char *title) {
+  if (!window) {
+    return;
+  }
+  strncpy(window->title, title ? title : "", sizeof(window->title) - 1);
+  window->title[sizeof(window->title) - 1] = '\0';
+  if (window->flags & WINDOW_FLAG_TITLED) {
+    OSRect titlebar = {0, 0, window->bounds.width, WINDOW_TITLEBAR_HEIGHT};
+    window_invalidate_rect(window, titlebar);
+  }
+}
+
+void window_move(CWindow *window, int32_t x, int32_t y) {
+  if (!window || (window->bounds.x == x && window->bounds.y == y)) {
+    return;
+  }
+  window_invalidate(window);
+  window->bounds.x = x;
+  window->bounds.y = y;
+  window_invalidate(window);
+  if (window->manager) {
+    spatial_index_update(window->manager->spatial, window->window_id,
+                         window->bounds);
+  }
+}
+
+void window_resize(CWindow *window, uint32_t width, uint32_t height) {
+  if (!window) {
+    return;
+  }
+  if (width < WINDOW_MIN_WIDTH) {
+    width = WINDOW_MIN_WIDTH;
+  }
+  if (height < WINDOW_MIN_HEIGHT) {
+    height = WINDOW_MIN_HEIGHT;
+  }
+  if ((uint32_t)window->bounds.width == width &&
+      (uint32_t)window->bounds.height == height) {
+    return;
+  }
+  window_invalidate(window);
+  window->bounds.width = (int32_t)width;
+  window->bounds.height = (int32_t)height;
+  window_invalidate(window);
+  if (window->manager) {
+    spatial_index_update(window->manager->spatial, window->window_id,
+                         window->bounds);
+  }
+  if (window->on_resize) {
+    window->on_resize(window, width, height);
+  }
+}
+
+void window_set_state(CWindow *window, WindowState state) {
+  if (!window || window->state == state) {
+    return;
+  }
+  window_invalidate(window);
+  window->state = state;
+  window_invalidate(window);
+  window_update_index(window);
+}
+
+void window_focus(CWindowManager *manager, CWindow *window) {
+  if (!manager || manager->focused_window == window) {
+    return;
+  }
+  if (manager->focused_window) {
+    manager->focused_window->has_focus = false;
+    window_invalidate(manager->focused_window);
+  }
+  manager->focused_window = window;
+  if (!window) {
+    return;
+  }
+  window->has_focus = true;
+  window->z = ++manager->next_z;
+  spatial_index_set_z(manager->spatial, window->window_id, window->z);
+
+  // Raise to the top of the z-order.
+  for (uint32_t i = 0; i < manager->window_count; i++) {
+    if (manager->windows[i] == window) {
+      memmove(&manager->windows[i], &manager->windows[i + 1],
+              (manager->window_count - i - 1) * sizeof(CWindow *));
+      manager->windows[manager->window_count - 1] = window;
+      break;
+    }
+  }
+  window_invalidate(window);
+}
+
+// ============================================================================
+// Rendering
+// ============================================================================
+
+void window_draw(GraphicsContext *ctx, CWindow *window) {
+  if (!window || !window_is_visible(window)) {
+    return;
+  }
+  OSRect b = window->bounds;
+  int corner = (int)WINDOW_CORNER_RADIUS;
+
+  if (window->flags & WINDOW_FLAG_SHADOW) {
+    OSRect caster = {b.x, b.y + WINDOW_SHADOW_OFFSET_Y, b.width, b.height};
+    apply_rounded_shadow(ctx, caster, corner, SHADOW_COLOR, WINDOW_SHADOW_BLUR);
+  }
+  draw_rounded_rect(ctx, b, corner, window->background_color);
+
+  if (window->flags & WINDOW_FLAG_TITLED) {
+    // Titlebar: the window's rounded shape restricted to its top band.
+    OSRect saved = ctx->clip;
+    OSRect titlebar = {b.x, b.y, b.width, WINDOW_TITLEBAR_HEIGHT};
+    graphics_set_clip(ctx, rect_intersection(saved, titlebar));
+    draw_rounded_rect(ctx, b, corner, TITLEBAR_COLOR);
+    ctx->clip = saved;
+
+    for (int i = 0; i < 3; i++) {
+      Color c = window->has_focus ? BUTTON_COLORS[i] : BUTTON_INACTIVE;
+      draw_circle(ctx, b.x + 20 + i * 20, b.y + WINDOW_TITLEBAR_HEIGHT / 2,
+                  WINDOW_BUTTON_RADIUS, c);
+    }
+  }
+
+  if (window->on_draw) {
+    window->on_draw(window);
+  }
+}
+
+// Pixels a window is guaranteed to paint opaquely: its body minus the
+// rounded corners, as one horizontal and one vertical band.
+static uint32_t window_occluders(const CWindow *window, OSRect out[2]) {
+  if (!window_is_visible(window) || window->background_color.alpha != 255) {
+    return 0;
+  }
+  OSRect b = window->bounds;
+  int32_t max_corner = (b.width < b.height ? b.width : b.height) / 2;
+  int32_t r = (int32_t)WINDOW_CORNER_RADIUS;
+  r = r > max_corner ? max_corner : r;
+  out[0] = (OSRect){b.x, b.y + r, b.width, b.height - 2 * r};
+  out[1] = (OSRect){b.x + r, b.y, b.width - 2 * r, b.height};
+  return 2;
+}
+
+// Front-to-back visibility for one dirty rect: each window receives the
+// part of the still-uncovered area inside its visual bounds, then removes
+// its opaque body from it. Whatever stays uncovered shows the desktop.
+// Only windows whose shadows can reach the rect are visited.
+static void compute_visibility(CWindowManager *manager, OSRect dirty) {
+  PROFILE_STAGE(PROFILE_LAYOUT);
+  region_set_rect(&manager->uncovered, dirty);
+  OSRect reach = {dirty.x - WINDOW_SHADOW_REACH, dirty.y - WINDOW_SHADOW_REACH,
+                  dirty.width + 2 * WINDOW_SHADOW_REACH,
+                  dirty.height + 2 * WINDOW_SHADOW_REACH};
+  manager->layer_count = window_manager_windows_in_rect(
+      manager, reach, manager->layers, manager->max_windows);
+  for (uint32_t i = 0; i < manager->layer_count; i++) {
+    CWindow *window = manager->layers[i];
+    OSRegion *visible = &manager->window_visible[i];
+    region_clear(visible);
+    if (region_is_empty(&manager->uncovered)) {
+      continue;
+    }
+    region_intersect_rect(visible, &manager->uncovered,
+                          window_visual_bounds(window));
+    if (region_is_empty(visible)) {
+      continue;
+    }
+    OSRect occluders[2];
+    uint32_t n = window_occluders(window, occluders);
+    for (uint32_t k = 0; k < n; k++) {
+      region_subtract_rect(&manager->uncovered, occluders[k]);
+    }
+  }
+}
+
+void window_manager_render_all(CWindowManager *manager, GraphicsContext *ctx) {
+  if (!manager || !ctx) {
+    return;
+  }
+  OSRect screen = {0, 0, (int32_t)ctx->width, (int32_t)ctx->height};
+  if (manager->full_damage) {
+    region_clear(&manager->damage);
+    region_add_rect(&manager->damage, screen);
+    manager->full_damage = false;
+  }
+  if (region_is_empty(&manager->damage)) {
+    return;
+  }
+  PROFILE_STAGE(PROFILE_FRAME);
+
+  // Take this frame's damage so on_draw handlers that invalidate add to a
+  // fresh list for the next frame instead of reshaping the one being walked.
+  OSRegion *painting = &manager->painting;
+  OSRegion taken = manager->damage;
+  manager->damage = *painting;
+  *painting = taken;
+  region_clear(&manager->damage);
+
+  OSRect saved = ctx->clip;
+  for (uint32_t d = 0; d < painting->count; d++) {
+    OSRect dirty = rect_intersection(painting->rects[d], screen);
+    painting->rects[d] = dirty;
+    if (rect_is_empty(dirty)) {
+      continue;
+    }
+    compute_visibility(manager, dirty);
+
+    // Paint back to front, each layer clipped to its visible rects.
+    PROFILE_STAGE(PROFILE_RASTER);
+    const OSRegion *desktop = &manager->uncovered;
+    for (uint32_t k = 0; k < desktop->count; k++) {
+      graphics_set_clip(ctx, desktop->rects[k]);
+      draw_rect(ctx, desktop->rects[k], DESKTOP_BACKGROUND);
+    }
+    uint32_t i = manager->layer_count;
+    while (i-- > 0) {
+      const OSRegion *visible = &manager->window_visible[i];
+      for (uint32_t k = 0; k < visible->count; k++) {
+        graphics_set_clip(ctx, visible->rects[k]);
+        window_draw(ctx, manager->layers[i]);
+      }
+    }
+  }
+  ctx->clip = saved;
+
+  graphics_present_rects(ctx, painting->rects, painting->count);
+  region_clear(painting);
+}
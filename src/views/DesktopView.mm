@@ -1,7 +1,15 @@
 #import "DesktopView.h"
+#import "../helpers/IconAtlas.h"
+#import "../helpers/LayerHelper.h"
 #include <cmath>
 
-@interface DesktopView ()
+@interface DesktopView () {
+    // The wallpaper never changes between frames, so it is painted once per
+    // size and scale and blitted under the icons
+    OS::Graphics::LayerCache _wallpaperLayer;
+    uint64_t _wallpaperGeneration;
+    id _wallpaperImage;
+}
 @property (nonatomic, strong) NSArray *desktopIcons;
 @end
 
@@ -27,7 +35,7 @@
     ];
 }
 
-- (void)drawRect:(NSRect)dirtyRect {
+- (void)drawWallpaperInRect:(NSRect)bounds {
     // macOS Sonoma-style gradient wallpaper
     NSGradient *wallpaperGradient = [[NSGradient alloc] initWithColorsAndLocations:
         [NSColor colorWithRed:0.05 green:0.10 blue:0.20 alpha:1.0], 0.0,
@@ -37,27 +45,49 @@
         [NSColor colorWithRed:0.85 green:0.55 blue:0.45 alpha:1.0], 0.8,
         [NSColor colorWithRed:0.95 green:0.75 blue:0.55 alpha:1.0], 1.0,
         nil];
-    [wallpaperGradient drawInRect:self.bounds angle:135];
+    [wallpaperGradient drawInRect:bounds angle:135];
     
     // Smooth wave overlay for depth
     for (int wave = 0; wave < 3; wave++) {
         NSBezierPath *wavePath = [NSBezierPath bezierPath];
-        CGFloat waveY = self.bounds.size.height * (0.25 + wave * 0.12);
+        CGFloat waveY = bounds.size.height * (0.25 + wave * 0.12);
         CGFloat amplitude = 40 + wave * 20;
         CGFloat frequency = 0.008 + wave * 0.003;
         
         [wavePath moveToPoint:NSMakePoint(0, waveY)];
-        for (CGFloat x = 0; x <= self.bounds.size.width; x += 4) {
+        for (CGFloat x = 0; x <= bounds.size.width; x += 4) {
             CGFloat y = waveY + std::sin(x * frequency + wave) * amplitude;
             [wavePath lineToPoint:NSMakePoint(x, y)];
         }
-        [wavePath lineToPoint:NSMakePoint(self.bounds.size.width, 0)];
+        [wavePath lineToPoint:NSMakePoint(bounds.size.width, 0)];
         [wavePath lineToPoint:NSMakePoint(0, 0)];
         [wavePath closePath];
         
         [[NSColor colorWithRed:0.1 + wave * 0.05 green:0.15 + wave * 0.05 blue:0.25 + wave * 0.05 alpha:0.15 - wave * 0.03] setFill];
         [wavePath fill];
     }
+}
+
+- (void)drawRect:(NSRect)dirtyRect {
+    CGFloat scale = [LayerHelper backingScaleForView:self];
+    uint32_t width = (uint32_t)std::ceil(self.bounds.size.width * scale);
+    uint32_t height = (uint32_t)std::ceil(self.bounds.size.height * scale);
+    
+    // A resize or a move to another display changes the key and repaints
+    OS::Graphics::RenderTarget &wallpaper = _wallpaperLayer.get(width, height, scale, [self](OS::Graphics::RenderTarget &target) {
+        [LayerHelper paintTarget:target drawing:^(NSRect bounds) {
+            [self drawWallpaperInRect:bounds];
+        }];
+    });
+    if (_wallpaperGeneration != _wallpaperLayer.getGeneration()) {
+        _wallpaperImage = (__bridge_transfer id)[LayerHelper createImageFromTarget:wallpaper];
+        _wallpaperGeneration = _wallpaperLayer.getGeneration();
+    }
+    if (_wallpaperImage) {
+        CGContextDrawImage([NSGraphicsContext currentContext].CGContext,
+                           CGRectMake(0, 0, width / scale, height / scale),
+                           (__bridge CGImageRef)_wallpaperImage);
+    }
     
     // Desktop icons - macOS style folder icons
     CGFloat iconX = self.bounds.size.width - 90;
@@ -65,6 +95,8 @@
     CGFloat iconSpacing = 90;
     
     NSArray *iconImages = @[@"💻", @"📁", @"⬇️", @"📦", @"🗑️"];
+    NSDictionary *iconAttrs = @{NSFontAttributeName: [NSFont systemFontOfSize:48]};
+    CGContextRef context = [NSGraphicsContext currentContext].CGContext;
     
     for (NSInteger i = 0; i < (NSInteger)self.desktopIcons.count; i++) {
         NSDictionary *iconData = self.desktopIcons[i];
@@ -89,13 +121,15 @@
             [selPath stroke];
         }
         
-        // Draw icon
+        // Draw icon, painted once into the icon atlas
         NSString *emoji = iconImages[i];
-        NSDictionary *iconAttrs = @{NSFontAttributeName: [NSFont systemFontOfSize:48]};
         NSSize emojiSize = [emoji sizeWithAttributes:iconAttrs];
-        CGFloat emojiX = iconX + (76 - emojiSize.width) / 2;
-        CGFloat emojiY = iconY + 30;
-        [emoji drawAtPoint:NSMakePoint(emojiX, emojiY) withAttributes:iconAttrs];
+        NSSize cellSize = NSMakeSize(76, std::ceil(emojiSize.height));
+        [[IconAtlas shared] drawIcon:[@"desktop:" stringByAppendingString:emoji] size:cellSize scale:scale
+                              inRect:NSMakeRect(iconX, iconY + 30, cellSize.width, cellSize.height) context:context
+                             drawing:^(NSRect bounds) {
+            [emoji drawAtPoint:NSMakePoint((bounds.size.width - emojiSize.width) / 2, 0) withAttributes:iconAttrs];
+        }];
         
         // Label with macOS-style text shadow
         NSMutableParagraphStyle *style = [[NSMutableParagraphStyle alloc] init];
@@ -1,6 +1,34 @@
 #import "DockView.h"
+#import "../helpers/IconAtlas.h"
+#import "../helpers/LayerHelper.h"
+#include "EventManager.h"
+#include <cmath>
 
-@interface DockView ()
+// Icons are blitted from the shared icon atlas at two sizes: the resting
+// size, which looks the same as drawing them directly, and full
+// magnification, which is scaled down for the sizes in between
+static const CGFloat kDockItemSize = 52;
+static const CGFloat kDockMagnifiedItemSize = 76; // ceil(52 * 1.45)
+
+namespace {
+
+// A cached layer and the images last cut from it
+struct LayerImages {
+    OS::Graphics::LayerCache layer;
+    uint64_t generation = 0;
+    NSArray *images = @[];
+};
+
+} // namespace
+
+@interface DockView () {
+    uint32_t _eventTarget;
+    uint32_t _mouseMoveListener;
+    
+    // Repainted only when the view size or backing scale changes; hover
+    // frames blit it and the atlas icons and draw the running dots
+    LayerImages _chrome;
+}
 @property (nonatomic, strong) NSMutableSet *runningApps;
 @end
 
@@ -12,6 +40,14 @@
         self.hoveredItem = -1;
         self.runningApps = [NSMutableSet setWithObjects:@"Finder", nil];
         
+        // Hover hit tests run once per frame on the latest mouse position
+        EventManager &events = EventManager::shared();
+        __weak DockView *weakSelf = self;
+        _eventTarget = events.registerTarget();
+        _mouseMoveListener = events.addListener(EventType::MouseMove, _eventTarget, [weakSelf](const Event &event) {
+            [weakSelf hoverAtPoint:NSMakePoint(event.x, event.y)];
+        });
+        
         // macOS-style dock icons with colors
         self.dockItems = @[
             @{@"name": @"Finder", @"icon": @"📁", @"color": [NSColor colorWithRed:0.2 green:0.5 blue:0.95 alpha:1.0]},
@@ -36,9 +72,14 @@
     return self;
 }
 
-- (void)drawRect:(NSRect)dirtyRect {
+- (void)setDockItems:(NSArray *)dockItems {
+    _dockItems = dockItems;
+    [self setNeedsDisplay:YES];
+}
+
+- (void)drawChromeInRect:(NSRect)bounds {
     // macOS-style frosted glass dock background
-    NSRect dockRect = NSInsetRect(self.bounds, 3, 6);
+    NSRect dockRect = NSInsetRect(bounds, 3, 6);
     dockRect.origin.y += 4;
     dockRect.size.height -= 4;
     
@@ -59,13 +100,81 @@
     [[NSColor colorWithWhite:0.3 alpha:0.35] setStroke];
     [dockPath setLineWidth:0.5];
     [dockPath stroke];
+}
+
+- (void)drawItem:(NSDictionary *)item inRect:(NSRect)iconRect {
+    CGFloat x = iconRect.origin.x;
+    CGFloat y = iconRect.origin.y;
+    CGFloat size = iconRect.size.width;
+    
+    // Icon background with app color
+    CGFloat cornerRadius = size * 0.22;
+    NSBezierPath *iconBg = [NSBezierPath bezierPathWithRoundedRect:iconRect xRadius:cornerRadius yRadius:cornerRadius];
+    
+    // Gradient background matching app color
+    NSColor *appColor = item[@"color"];
+    NSColor *lighterColor = [appColor blendedColorWithFraction:0.3 ofColor:[NSColor whiteColor]];
+    NSColor *darkerColor = [appColor blendedColorWithFraction:0.2 ofColor:[NSColor blackColor]];
+    
+    NSGradient *iconGradient = [[NSGradient alloc] initWithStartingColor:lighterColor endingColor:darkerColor];
+    [iconGradient drawInBezierPath:iconBg angle:90];
+    
+    // Subtle inner shadow at top for depth
+    [[NSColor colorWithWhite:1.0 alpha:0.25] setStroke];
+    NSRect topHighlight = NSMakeRect(x + 2, y + size - 4, size - 4, 2);
+    NSBezierPath *highlightPath = [NSBezierPath bezierPathWithRoundedRect:topHighlight xRadius:1 yRadius:1];
+    [highlightPath setLineWidth:1];
+    [highlightPath stroke];
+    
+    // Icon emoji
+    CGFloat emojiSize = size * 0.55;
+    NSDictionary *iconAttrs = @{NSFontAttributeName: [NSFont systemFontOfSize:emojiSize]};
+    NSString *icon = item[@"icon"];
+    NSSize iconSize = [icon sizeWithAttributes:iconAttrs];
+    CGFloat emojiX = x + (size - iconSize.width) / 2;
+    CGFloat emojiY = y + (size - iconSize.height) / 2;
+    [icon drawAtPoint:NSMakePoint(emojiX, emojiY) withAttributes:iconAttrs];
+}
+
+// The chrome layer, painted at the view size
+- (CGImageRef)chromeImageAtScale:(CGFloat)scale {
+    uint32_t width = (uint32_t)std::ceil(self.bounds.size.width * scale);
+    uint32_t height = (uint32_t)std::ceil(self.bounds.size.height * scale);
+    
+    OS::Graphics::RenderTarget &target = _chrome.layer.get(width, height, scale, [self](OS::Graphics::RenderTarget &target) {
+        [LayerHelper paintTarget:target drawing:^(NSRect bounds) {
+            [self drawChromeInRect:bounds];
+        }];
+    });
+    if (_chrome.generation != _chrome.layer.getGeneration()) {
+        CGImageRef image = [LayerHelper createImageFromTarget:target];
+        _chrome.images = image ? @[(__bridge_transfer id)image] : @[];
+        _chrome.generation = _chrome.layer.getGeneration();
+    }
+    return _chrome.images.count ? (__bridge CGImageRef)_chrome.images[0] : NULL;
+}
+
+- (void)drawRect:(NSRect)dirtyRect {
+    CGContextRef context = [NSGraphicsContext currentContext].CGContext;
+    CGFloat scale = [LayerHelper backingScaleForView:self];
+    
+    CGImageRef chrome = [self chromeImageAtScale:scale];
+    if (chrome) {
+        CGContextDrawImage(context, CGRectMake(0, 0, CGImageGetWidth(chrome) / scale, CGImageGetHeight(chrome) / scale), chrome);
+    }
     
     // Draw dock items
-    CGFloat baseItemSize = 52;
+    CGFloat baseItemSize = kDockItemSize;
     CGFloat spacing = 4;
     CGFloat totalWidth = self.dockItems.count * (baseItemSize + spacing) - spacing;
     CGFloat startX = (self.bounds.size.width - totalWidth) / 2;
     
+    // Cell sizes are whole pixels, slightly over the point size
+    CGFloat restingCell = std::ceil(kDockItemSize * scale) / scale;
+    CGFloat magnifiedCell = std::ceil(kDockMagnifiedItemSize * scale) / scale;
+    IconAtlas *atlas = [IconAtlas shared];
+    CGContextSetInterpolationQuality(context, kCGInterpolationHigh);
+    
     for (NSInteger i = 0; i < (NSInteger)self.dockItems.count; i++) {
         NSDictionary *item = self.dockItems[i];
         CGFloat size = baseItemSize;
@@ -84,34 +193,15 @@
         CGFloat x = startX + i * (baseItemSize + spacing) + (baseItemSize - size) / 2;
         CGFloat y = 14 + yOffset;
         
-        // Icon background with app color
-        NSRect iconRect = NSMakeRect(x, y, size, size);
-        CGFloat cornerRadius = size * 0.22;
-        NSBezierPath *iconBg = [NSBezierPath bezierPathWithRoundedRect:iconRect xRadius:cornerRadius yRadius:cornerRadius];
-        
-        // Gradient background matching app color
-        NSColor *appColor = item[@"color"];
-        NSColor *lighterColor = [appColor blendedColorWithFraction:0.3 ofColor:[NSColor whiteColor]];
-        NSColor *darkerColor = [appColor blendedColorWithFraction:0.2 ofColor:[NSColor blackColor]];
-        
-        NSGradient *iconGradient = [[NSGradient alloc] initWithStartingColor:lighterColor endingColor:darkerColor];
-        [iconGradient drawInBezierPath:iconBg angle:90];
-        
-        // Subtle inner shadow at top for depth
-        [[NSColor colorWithWhite:1.0 alpha:0.25] setStroke];
-        NSRect topHighlight = NSMakeRect(x + 2, y + size - 4, size - 4, 2);
-        NSBezierPath *highlightPath = [NSBezierPath bezierPathWithRoundedRect:topHighlight xRadius:1 yRadius:1];
-        [highlightPath setLineWidth:1];
-        [highlightPath stroke];
-        
-        // Icon emoji
-        CGFloat emojiSize = size * 0.55;
-        NSDictionary *iconAttrs = @{NSFontAttributeName: [NSFont systemFontOfSize:emojiSize]};
-        NSString *icon = item[@"icon"];
-        NSSize iconSize = [icon sizeWithAttributes:iconAttrs];
-        CGFloat emojiX = x + (size - iconSize.width) / 2;
-        CGFloat emojiY = y + (size - iconSize.height) / 2;
-        [icon drawAtPoint:NSMakePoint(emojiX, emojiY) withAttributes:iconAttrs];
+        // Each sprite was painted at its nominal size in a whole-pixel cell,
+        // so it is scaled by size / nominal and the cell overhang follows
+        BOOL magnified = size > baseItemSize;
+        CGFloat nominal = magnified ? kDockMagnifiedItemSize : kDockItemSize;
+        CGFloat cell = (magnified ? magnifiedCell : restingCell) * size / nominal;
+        NSString *key = [NSString stringWithFormat:@"dock:%@:%@", item[@"name"], item[@"icon"]];
+        [atlas drawIcon:key size:NSMakeSize(nominal, nominal) scale:scale inRect:NSMakeRect(x, y, cell, cell) context:context drawing:^(NSRect bounds) {
+            [self drawItem:item inRect:NSMakeRect(0, 0, nominal, nominal)];
+        }];
         
         // Running indicator dot (only for running apps)
         NSString *appName = item[@"name"];
@@ -125,23 +215,33 @@
     }
 }
 
+- (void)dealloc {
+    EventManager::shared().removeListener(_mouseMoveListener);
+}
+
 - (void)mouseMoved:(NSEvent *)event {
     NSPoint location = [self convertPoint:[event locationInWindow] fromView:nil];
+    EventManager::shared().post(EventType::MouseMove, _eventTarget, location.x, location.y);
+}
+
+// Items sit in one row at a fixed pitch, so the hit test is a division
+- (NSInteger)itemIndexAtPoint:(NSPoint)location {
     CGFloat itemSize = 52;
     CGFloat spacing = 4;
     CGFloat totalWidth = self.dockItems.count * (itemSize + spacing) - spacing;
     CGFloat startX = (self.bounds.size.width - totalWidth) / 2;
     
-    NSInteger oldHovered = self.hoveredItem;
-    self.hoveredItem = -1;
-    
-    for (NSInteger i = 0; i < (NSInteger)self.dockItems.count; i++) {
-        CGFloat x = startX + i * (itemSize + spacing);
-        if (location.x >= x && location.x < x + itemSize + spacing) {
-            self.hoveredItem = i;
-            break;
-        }
+    CGFloat offset = location.x - startX;
+    if (offset < 0) {
+        return -1;
     }
+    NSInteger index = (NSInteger)(offset / (itemSize + spacing));
+    return index < (NSInteger)self.dockItems.count ? index : -1;
+}
+
+- (void)hoverAtPoint:(NSPoint)location {
+    NSInteger oldHovered = self.hoveredItem;
+    self.hoveredItem = [self itemIndexAtPoint:location];
     
     if (oldHovered != self.hoveredItem) {
         [self setNeedsDisplay:YES];
@@ -149,11 +249,13 @@
 }
 
 - (void)mouseExited:(NSEvent *)event {
-    self.hoveredItem = -1;
-    [self setNeedsDisplay:YES];
+    // Queued behind any pending move, so a stale one cannot re-hover
+    EventManager::shared().post(EventType::MouseMove, _eventTarget, -1, -1);
 }
 
 - (void)mouseDown:(NSEvent *)event {
+    // The queued hover may be a frame behind; clicks hit test right away
+    [self hoverAtPoint:[self convertPoint:[event locationInWindow] fromView:nil]];
     if (self.hoveredItem >= 0 && self.hoveredItem < (NSInteger)self.dockItems.count) {
         NSDictionary *item = self.dockItems[self.hoveredItem];
         NSString *appName = item[@"name"];
@@ -170,19 +272,7 @@
 
 - (void)rightMouseDown:(NSEvent *)event {
     NSPoint location = [self convertPoint:[event locationInWindow] fromView:nil];
-    CGFloat itemSize = 52;
-    CGFloat spacing = 4;
-    CGFloat totalWidth = self.dockItems.count * (itemSize + spacing) - spacing;
-    CGFloat startX = (self.bounds.size.width - totalWidth) / 2;
-    
-    NSInteger clickedItem = -1;
-    for (NSInteger i = 0; i < (NSInteger)self.dockItems.count; i++) {
-        CGFloat x = startX + i * (itemSize + spacing);
-        if (location.x >= x && location.x < x + itemSize + spacing) {
-            clickedItem = i;
-            break;
-        }
-    }
+    NSInteger clickedItem = [self itemIndexAtPoint:location];
     
     if (clickedItem >= 0 && clickedItem < (NSInteger)self.dockItems.count) {
         NSDictionary *item = self.dockItems[clickedItem];
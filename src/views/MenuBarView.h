@@ -10,7 +10,6 @@
 @interface MenuBarView : NSView
 
 @property (nonatomic, strong) NSDateFormatter *timeFormatter;
-@property (nonatomic, strong) NSTimer *clockTimer;
 @property (nonatomic, strong) NSString *currentTime;
 @property (nonatomic, weak) id<MenuBarViewDelegate> delegate;
 @property (nonatomic, strong) NSString *activeApp;
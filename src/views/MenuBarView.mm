@@ -1,6 +1,11 @@
 #import "MenuBarView.h"
+#include "EventManager.h"
 
-@interface MenuBarView ()
+@interface MenuBarView () {
+    EventManager::TimerId _clockTimer;
+    uint32_t _eventTarget;
+    uint32_t _mouseMoveListener;
+}
 @property (nonatomic, strong) NSMutableArray *menuItemRects;
 @property (nonatomic, assign) NSInteger hoveredItem;
 @property (nonatomic, assign) NSRect appleLogoRect;
@@ -19,11 +24,17 @@
         self.hoveredItem = -1;
         self.menuItemRects = [NSMutableArray array];
         
-        self.clockTimer = [NSTimer scheduledTimerWithTimeInterval:1.0
-                                                           target:self
-                                                         selector:@selector(updateClock)
-                                                         userInfo:nil
-                                                          repeats:YES];
+        // Clock ticks and hover tracking run on the shared event loop;
+        // mouse moves are coalesced to one hit test per frame
+        EventManager &events = EventManager::shared();
+        __weak MenuBarView *weakSelf = self;
+        _clockTimer = events.addTimer(1000, 1000, [weakSelf] {
+            [weakSelf updateClock];
+        });
+        _eventTarget = events.registerTarget();
+        _mouseMoveListener = events.addListener(EventType::MouseMove, _eventTarget, [weakSelf](const Event &event) {
+            [weakSelf hoverAtPoint:NSMakePoint(event.x, event.y)];
+        });
         
         // Enable mouse tracking
         NSTrackingArea *trackingArea = [[NSTrackingArea alloc] initWithRect:self.bounds
@@ -35,6 +46,12 @@
     return self;
 }
 
+- (void)dealloc {
+    EventManager &events = EventManager::shared();
+    events.cancelTimer(_clockTimer);
+    events.removeListener(_mouseMoveListener);
+}
+
 - (void)updateClock {
     self.currentTime = [self.timeFormatter stringFromDate:[NSDate date]];
     [self setNeedsDisplay:YES];
@@ -144,6 +161,10 @@
 
 - (void)mouseMoved:(NSEvent *)event {
     NSPoint location = [self convertPoint:[event locationInWindow] fromView:nil];
+    EventManager::shared().post(EventType::MouseMove, _eventTarget, location.x, location.y);
+}
+
+- (void)hoverAtPoint:(NSPoint)location {
     NSInteger oldHovered = self.hoveredItem;
     self.hoveredItem = -1;
     
@@ -168,8 +189,8 @@
 }
 
 - (void)mouseExited:(NSEvent *)event {
-    self.hoveredItem = -1;
-    [self setNeedsDisplay:YES];
+    // Queued behind any pending move, so a stale one cannot re-hover
+    EventManager::shared().post(EventType::MouseMove, _eventTarget, -1, -1);
 }
 
 - (void)mouseDown:(NSEvent *)event {
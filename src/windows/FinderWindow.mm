@@ -1,10 +1,24 @@
 #import "FinderWindow.h"
 #import <UniformTypeIdentifiers/UniformTypeIdentifiers.h>
+#include "EventManager.h"
+#include "VirtualFileSystem.hpp"
+#include <vector>
 
-@interface FinderWindow ()
+// Background work reports back through the shared event queue, so its
+// completions land in the same per-frame batch as input
+static void runOnEventLoop(dispatch_block_t block) {
+    if (!EventManager::shared().postCompletion([block] { block(); })) {
+        dispatch_async(dispatch_get_main_queue(), block); // queue full
+    }
+}
+
+@interface FinderWindow () {
+    OS::System::VirtualFileSystem _fileSystem;
+    std::vector<uint32_t> _listing; // inodes of the rows, in display order
+}
 @property (nonatomic, strong) NSWindow *finderWindow;
 @property (nonatomic, strong) NSTableView *tableView;
-@property (nonatomic, strong) NSMutableArray *fileList;
+@property (nonatomic, strong) NSDateFormatter *dateFormatter;
 @property (nonatomic, strong) NSString *currentPath;
 @property (nonatomic, strong) NSTextField *pathField;
 @end
@@ -23,8 +37,11 @@
 - (instancetype)init {
     self = [super init];
     if (self) {
-        self.fileList = [NSMutableArray array];
+        self.dateFormatter = [[NSDateFormatter alloc] init];
+        self.dateFormatter.dateStyle = NSDateFormatterMediumStyle;
+        self.dateFormatter.timeStyle = NSDateFormatterShortStyle;
         self.currentPath = NSHomeDirectory();
+        [self loadFileSystem];
     }
     return self;
 }
@@ -208,57 +225,64 @@
     [self.finderWindow makeKeyAndOrderFront:nil];
 }
 
-- (NSDictionary *)virtualFileSystem {
+#pragma mark - Virtual File System
+
+- (NSString *)fileSystemImagePath {
+    NSString *appSupport = [NSSearchPathForDirectoriesInDomains(NSApplicationSupportDirectory, NSUserDomainMask, YES) firstObject];
+    NSString *appFolder = [appSupport stringByAppendingPathComponent:@"macOSDesktop"];
+    [[NSFileManager defaultManager] createDirectoryAtPath:appFolder withIntermediateDirectories:YES attributes:nil error:nil];
+    return [appFolder stringByAppendingPathComponent:@"finder.vfs"];
+}
+
+- (void)loadFileSystem {
+    // The image is mapped, not parsed; only a first launch builds the tree
+    if (_fileSystem.open(self.fileSystemImagePath.UTF8String)) {
+        return;
+    }
+    [self seedFileSystem];
+    [self saveFileSystem];
+}
+
+- (void)saveFileSystem {
+    _fileSystem.save(self.fileSystemImagePath.UTF8String);
+}
+
+- (void)seedFileSystem {
     // Virtual file system - completely isolated from real system (empty folders)
-    return @{
-        @"/": @[
-            @{@"name": @"Applications", @"isDirectory": @YES},
-            @{@"name": @"System", @"isDirectory": @YES},
-            @{@"name": @"Users", @"isDirectory": @YES},
-            @{@"name": @"Library", @"isDirectory": @YES}
-        ],
-        @"/Applications": @[
-            @{@"name": @"Safari.app", @"isDirectory": @YES, @"size": @(52428800)},
-            @{@"name": @"Messages.app", @"isDirectory": @YES, @"size": @(31457280)},
-            @{@"name": @"Notes.app", @"isDirectory": @YES, @"size": @(15728640)},
-            @{@"name": @"Calendar.app", @"isDirectory": @YES, @"size": @(20971520)},
-            @{@"name": @"Terminal.app", @"isDirectory": @YES, @"size": @(8388608)},
-            @{@"name": @"Settings.app", @"isDirectory": @YES, @"size": @(10485760)},
-            @{@"name": @"Mail.app", @"isDirectory": @YES, @"size": @(41943040)},
-            @{@"name": @"Photos.app", @"isDirectory": @YES, @"size": @(62914560)},
-            @{@"name": @"Music.app", @"isDirectory": @YES, @"size": @(73400320)}
-        ],
-        @"/System": @[
-            @{@"name": @"Library", @"isDirectory": @YES},
-            @{@"name": @"Kernel", @"isDirectory": @NO, @"size": @(15728640)},
-            @{@"name": @"Drivers", @"isDirectory": @YES}
-        ],
-        @"/System/Library": @[
-            @{@"name": @"CoreServices", @"isDirectory": @YES},
-            @{@"name": @"Frameworks", @"isDirectory": @YES},
-            @{@"name": @"Extensions", @"isDirectory": @YES}
-        ],
-        @"/Users": @[
-            @{@"name": @"Guest", @"isDirectory": @YES},
-            @{@"name": @"Shared", @"isDirectory": @YES}
-        ],
-        @"/Users/Guest": @[
-            @{@"name": @"Desktop", @"isDirectory": @YES},
-            @{@"name": @"Documents", @"isDirectory": @YES},
-            @{@"name": @"Downloads", @"isDirectory": @YES},
-            @{@"name": @"Pictures", @"isDirectory": @YES},
-            @{@"name": @"Music", @"isDirectory": @YES}
-        ],
-        @"/Users/Guest/Desktop": @[],
-        @"/Users/Guest/Documents": @[],
-        @"/Users/Guest/Downloads": @[],
-        @"/Users/Guest/Pictures": @[],
-        @"/Users/Guest/Music": @[],
-        @"/Library": @[
-            @{@"name": @"Preferences", @"isDirectory": @YES},
-            @{@"name": @"Application Support", @"isDirectory": @YES}
-        ]
+    NSArray *directories = @[
+        @"/System/Library/CoreServices",
+        @"/System/Library/Frameworks",
+        @"/System/Library/Extensions",
+        @"/System/Drivers",
+        @"/Users/Guest/Desktop",
+        @"/Users/Guest/Documents",
+        @"/Users/Guest/Downloads",
+        @"/Users/Guest/Pictures",
+        @"/Users/Guest/Music",
+        @"/Users/Shared",
+        @"/Library/Preferences",
+        @"/Library/Application Support"
+    ];
+    for (NSString *directory in directories) {
+        _fileSystem.makeDirectories(directory.UTF8String);
+    }
+    
+    NSDictionary *applications = @{
+        @"Safari.app": @(52428800),
+        @"Messages.app": @(31457280),
+        @"Notes.app": @(15728640),
+        @"Calendar.app": @(20971520),
+        @"Terminal.app": @(8388608),
+        @"Settings.app": @(10485760),
+        @"Mail.app": @(41943040),
+        @"Photos.app": @(62914560),
+        @"Music.app": @(73400320)
     };
+    uint32_t applicationsDir = _fileSystem.makeDirectories("/Applications");
+    for (NSString *name in applications) {
+        _fileSystem.create(applicationsDir, name.UTF8String, true, [applications[name] unsignedLongLongValue]);
+    }
+    _fileSystem.create(_fileSystem.lookup("/System"), "Kernel", false, 15728640);
 }
 
 - (void)loadFilesAtPath:(NSString *)path {
@@ -281,39 +305,17 @@
         path = [path substringToIndex:path.length - 1];
     }
     
-    [self.fileList removeAllObjects];
-    
-    NSDictionary *vfs = [self virtualFileSystem];
-    NSArray *contents = vfs[path];
-    
-    if (!contents) {
+    uint32_t directory = _fileSystem.lookup(path.UTF8String);
+    if (!_fileSystem.isDirectory(directory)) {
         // Path not in VFS - default to root
-        contents = vfs[@"/"];
-        if (!contents) {
-            return;
-        }
+        directory = OS::System::VirtualFileSystem::kRoot;
         path = @"/";
     }
     
-    for (NSDictionary *item in contents) {
-        NSString *fullPath = [path stringByAppendingPathComponent:item[@"name"]];
-        
-        [self.fileList addObject:@{
-            @"name": item[@"name"],
-            @"path": fullPath,
-            @"isDirectory": item[@"isDirectory"],
-            @"size": item[@"size"] ?: @0,
-            @"modified": [NSDate dateWithTimeIntervalSinceNow:-86400 * (arc4random_uniform(30) + 1)]
-        }];
-    }
-    
-    // Sort: folders first, then alphabetically
-    [self.fileList sortUsingComparator:^NSComparisonResult(NSDictionary *a, NSDictionary *b) {
-        BOOL aDir = [a[@"isDirectory"] boolValue];
-        BOOL bDir = [b[@"isDirectory"] boolValue];
-        if (aDir != bDir) return bDir ? NSOrderedDescending : NSOrderedAscending;
-        return [a[@"name"] caseInsensitiveCompare:b[@"name"]];
-    }];
+    // Listings come back sorted: folders first, then case-insensitively.
+    // Only the inodes are kept; the table asks for the rows it shows.
+    OS::System::VfsListing listing = _fileSystem.list(directory);
+    _listing.assign(listing.entries, listing.entries + listing.count);
     
     self.currentPath = path;
     if (self.pathField) {
@@ -327,6 +329,24 @@
     }
 }
 
+// Builds a row's item on demand; every edit of the VFS reloads _listing, so
+// the inodes stay valid.
+- (NSDictionary *)itemAtRow:(NSInteger)row {
+    if (row < 0 || row >= (NSInteger)_listing.size()) {
+        return nil;
+    }
+    OS::System::VfsStat st;
+    _fileSystem.stat(_listing[row], st);
+    NSString *name = [NSString stringWithUTF8String:_fileSystem.name(_listing[row]).c_str()];
+    return @{
+        @"name": name,
+        @"path": [self.currentPath stringByAppendingPathComponent:name],
+        @"isDirectory": @(st.is_directory),
+        @"size": @(st.size),
+        @"modified": [NSDate dateWithTimeIntervalSince1970:st.mtime]
+    };
+}
+
 - (void)navigateToPath:(NSString *)path {
     [self showWindow];
     [self loadFilesAtPath:path];
@@ -347,8 +367,7 @@
 
 - (void)pathFieldChanged:(id)sender {
     NSString *path = self.pathField.stringValue;
-    NSDictionary *vfs = [self virtualFileSystem];
-    if (vfs[path]) {
+    if (_fileSystem.isDirectory(_fileSystem.lookup(path.UTF8String))) {
         [self loadFilesAtPath:path];
     }
 }
@@ -371,8 +390,8 @@
 
 - (void)tableDoubleClick:(id)sender {
     NSInteger row = self.tableView.clickedRow;
-    if (row >= 0 && row < (NSInteger)self.fileList.count) {
-        NSDictionary *item = self.fileList[row];
+    if (row >= 0 && row < (NSInteger)_listing.size()) {
+        NSDictionary *item = [self itemAtRow:row];
         if ([item[@"isDirectory"] boolValue]) {
             [self loadFilesAtPath:item[@"path"]];
         } else {
@@ -605,7 +624,7 @@
         @try {
             [task launchAndReturnError:nil];
         } @catch (NSException *e) {
-            dispatch_async(dispatch_get_main_queue(), ^{
+            runOnEventLoop(^{
                 NSAlert *alert = [[NSAlert alloc] init];
                 alert.messageText = @"Failed to launch";
                 alert.informativeText = e.reason;
@@ -662,7 +681,7 @@
             [task launchAndReturnError:nil];
             [task waitUntilExit];
             
-            dispatch_async(dispatch_get_main_queue(), ^{
+            runOnEventLoop(^{
                 [self navigateToPath:destDir];
             });
         } @catch (NSException *e) {}
@@ -738,7 +757,7 @@
                 [task launchAndReturnError:nil];
                 [task waitUntilExit];
                 
-                dispatch_async(dispatch_get_main_queue(), ^{
+                runOnEventLoop(^{
                     [self navigateToPath:@"/Volumes"];
                 });
             } @catch (NSException *e) {}
@@ -809,7 +828,7 @@
             @try {
                 [task launchAndReturnError:nil];
             } @catch (NSException *e) {
-                dispatch_async(dispatch_get_main_queue(), ^{
+                runOnEventLoop(^{
                     NSAlert *errAlert = [[NSAlert alloc] init];
                     errAlert.messageText = @"Java not found";
                     errAlert.informativeText = @"Please install Java from java.com or use:\n  brew install openjdk";
@@ -853,7 +872,7 @@
                 [task launchAndReturnError:nil];
                 [task waitUntilExit];
                 
-                dispatch_async(dispatch_get_main_queue(), ^{
+                runOnEventLoop(^{
                     [self navigateToPath:destDir];
                 });
             } @catch (NSException *e) {}
@@ -924,8 +943,8 @@
     
     NSMenu *contextMenu = [[NSMenu alloc] initWithTitle:@"Context"];
     
-    if (row >= 0 && row < (NSInteger)self.fileList.count) {
-        NSDictionary *item = self.fileList[row];
+    if (row >= 0 && row < (NSInteger)_listing.size()) {
+        NSDictionary *item = [self itemAtRow:row];
         
         NSMenuItem *openItem = [[NSMenuItem alloc] initWithTitle:@"Open" action:@selector(contextOpen:) keyEquivalent:@""];
         openItem.tag = row;
@@ -989,8 +1008,8 @@
 
 - (void)contextOpen:(NSMenuItem *)sender {
     NSInteger row = sender.tag;
-    if (row >= 0 && row < (NSInteger)self.fileList.count) {
-        NSDictionary *item = self.fileList[row];
+    if (row >= 0 && row < (NSInteger)_listing.size()) {
+        NSDictionary *item = [self itemAtRow:row];
         if ([item[@"isDirectory"] boolValue]) {
             [self loadFilesAtPath:item[@"path"]];
         } else {
@@ -1001,8 +1020,8 @@
 
 - (void)contextOpenWith:(NSMenuItem *)sender {
     NSInteger row = sender.tag;
-    if (row >= 0 && row < (NSInteger)self.fileList.count) {
-        NSDictionary *item = self.fileList[row];
+    if (row >= 0 && row < (NSInteger)_listing.size()) {
+        NSDictionary *item = [self itemAtRow:row];
         NSOpenPanel *panel = [NSOpenPanel openPanel];
         panel.allowedContentTypes = @[[UTType typeWithIdentifier:@"com.apple.application-bundle"]];
         panel.directoryURL = [NSURL fileURLWithPath:@"/Applications"];
@@ -1021,16 +1040,16 @@
 
 - (void)contextRun:(NSMenuItem *)sender {
     NSInteger row = sender.tag;
-    if (row >= 0 && row < (NSInteger)self.fileList.count) {
-        NSDictionary *item = self.fileList[row];
+    if (row >= 0 && row < (NSInteger)_listing.size()) {
+        NSDictionary *item = [self itemAtRow:row];
         [self openFile:item[@"path"]];
     }
 }
 
 - (void)contextGetInfo:(NSMenuItem *)sender {
     NSInteger row = sender.tag;
-    if (row >= 0 && row < (NSInteger)self.fileList.count) {
-        NSDictionary *item = self.fileList[row];
+    if (row >= 0 && row < (NSInteger)_listing.size()) {
+        NSDictionary *item = [self itemAtRow:row];
         
         NSAlert *alert = [[NSAlert alloc] init];
         alert.messageText = item[@"name"];
@@ -1045,8 +1064,8 @@
 
 - (void)contextCopy:(NSMenuItem *)sender {
     NSInteger row = sender.tag;
-    if (row >= 0 && row < (NSInteger)self.fileList.count) {
-        NSDictionary *item = self.fileList[row];
+    if (row >= 0 && row < (NSInteger)_listing.size()) {
+        NSDictionary *item = [self itemAtRow:row];
         NSPasteboard *pasteboard = [NSPasteboard generalPasteboard];
         [pasteboard clearContents];
         [pasteboard writeObjects:@[[NSURL fileURLWithPath:item[@"path"]]]];
@@ -1055,19 +1074,19 @@
 
 - (void)contextDelete:(NSMenuItem *)sender {
     NSInteger row = sender.tag;
-    if (row >= 0 && row < (NSInteger)self.fileList.count) {
-        NSDictionary *item = self.fileList[row];
-        [[NSFileManager defaultManager] trashItemAtURL:[NSURL fileURLWithPath:item[@"path"]]
-                                      resultingItemURL:nil
-                                                 error:nil];
+    if (row >= 0 && row < (NSInteger)_listing.size()) {
+        NSDictionary *item = [self itemAtRow:row];
+        if (_fileSystem.remove(_fileSystem.lookup([item[@"path"] UTF8String]))) {
+            [self saveFileSystem];
+        }
         [self loadFilesAtPath:self.currentPath];
     }
 }
 
 - (void)contextRename:(NSMenuItem *)sender {
     NSInteger row = sender.tag;
-    if (row >= 0 && row < (NSInteger)self.fileList.count) {
-        NSDictionary *item = self.fileList[row];
+    if (row >= 0 && row < (NSInteger)_listing.size()) {
+        NSDictionary *item = [self itemAtRow:row];
         
         NSAlert *alert = [[NSAlert alloc] init];
         alert.messageText = @"Rename";
@@ -1083,8 +1102,11 @@
         if ([alert runModal] == NSAlertFirstButtonReturn) {
             NSString *newName = input.stringValue;
             if (newName.length > 0) {
-                NSString *newPath = [[item[@"path"] stringByDeletingLastPathComponent] stringByAppendingPathComponent:newName];
-                [[NSFileManager defaultManager] moveItemAtPath:item[@"path"] toPath:newPath error:nil];
+                uint32_t inode = _fileSystem.lookup([item[@"path"] UTF8String]);
+                OS::System::VfsStat st;
+                if (_fileSystem.stat(inode, st) && _fileSystem.rename(inode, st.parent, newName.UTF8String)) {
+                    [self saveFileSystem];
+                }
                 [self loadFilesAtPath:self.currentPath];
             }
         }
@@ -1092,13 +1114,15 @@
 }
 
 - (void)contextNewFolder:(id)sender {
-    NSString *newPath = [self.currentPath stringByAppendingPathComponent:@"New Folder"];
-    NSFileManager *fm = [NSFileManager defaultManager];
+    uint32_t parent = _fileSystem.lookup(self.currentPath.UTF8String);
+    NSString *name = @"New Folder";
     NSInteger counter = 1;
-    while ([fm fileExistsAtPath:newPath]) {
-        newPath = [self.currentPath stringByAppendingPathComponent:[NSString stringWithFormat:@"New Folder %ld", (long)counter++]];
+    while (_fileSystem.lookup(parent, name.UTF8String, strlen(name.UTF8String)) != OS::System::VirtualFileSystem::kInvalid) {
+        name = [NSString stringWithFormat:@"New Folder %ld", (long)counter++];
+    }
+    if (_fileSystem.create(parent, name.UTF8String, true) != OS::System::VirtualFileSystem::kInvalid) {
+        [self saveFileSystem];
     }
-    [fm createDirectoryAtPath:newPath withIntermediateDirectories:NO attributes:nil error:nil];
     [self loadFilesAtPath:self.currentPath];
 }
 
@@ -1116,31 +1140,31 @@
 #pragma mark - NSTableViewDataSource
 
 - (NSInteger)numberOfRowsInTableView:(NSTableView *)tableView {
-    return self.fileList.count;
+    return (NSInteger)_listing.size();
 }
 
 - (id)tableView:(NSTableView *)tableView objectValueForTableColumn:(NSTableColumn *)tableColumn row:(NSInteger)row {
-    if (row >= (NSInteger)self.fileList.count) return nil;
+    if (row < 0 || row >= (NSInteger)_listing.size()) return nil;
     
-    NSDictionary *item = self.fileList[row];
+    // Called only for visible rows; read the VFS directly
+    uint32_t inode = _listing[row];
+    OS::System::VfsStat st;
+    _fileSystem.stat(inode, st);
     NSString *identifier = tableColumn.identifier;
     
     if ([identifier isEqualToString:@"icon"]) {
-        return [item[@"isDirectory"] boolValue] ? @"📁" : @"📄";
+        return st.is_directory ? @"📁" : @"📄";
     } else if ([identifier isEqualToString:@"name"]) {
-        return item[@"name"];
+        return [NSString stringWithUTF8String:_fileSystem.name(inode).c_str()];
     } else if ([identifier isEqualToString:@"size"]) {
-        if ([item[@"isDirectory"] boolValue]) return @"--";
-        long long bytes = [item[@"size"] longLongValue];
+        if (st.is_directory) return @"--";
+        long long bytes = (long long)st.size;
         if (bytes < 1024) return [NSString stringWithFormat:@"%lld B", bytes];
         if (bytes < 1024 * 1024) return [NSString stringWithFormat:@"%.1f KB", bytes / 1024.0];
         if (bytes < 1024 * 1024 * 1024) return [NSString stringWithFormat:@"%.1f MB", bytes / (1024.0 * 1024.0)];
         return [NSString stringWithFormat:@"%.1f GB", bytes / (1024.0 * 1024.0 * 1024.0)];
     } else if ([identifier isEqualToString:@"modified"]) {
-        NSDateFormatter *df = [[NSDateFormatter alloc] init];
-        df.dateStyle = NSDateFormatterMediumStyle;
-        df.timeStyle = NSDateFormatterShortStyle;
-        return [df stringFromDate:item[@"modified"]];
+        return [self.dateFormatter stringFromDate:[NSDate dateWithTimeIntervalSince1970:st.mtime]];
     }
     
     return nil;
@@ -1153,8 +1177,8 @@
     
     NSInteger row = self.tableView.clickedRow;
     
-    if (row >= 0 && row < (NSInteger)self.fileList.count) {
-        NSDictionary *item = self.fileList[row];
+    if (row >= 0 && row < (NSInteger)_listing.size()) {
+        NSDictionary *item = [self itemAtRow:row];
         [self.tableView selectRowIndexes:[NSIndexSet indexSetWithIndex:row] byExtendingSelection:NO];
         
         NSMenuItem *openItem = [[NSMenuItem alloc] initWithTitle:@"Open" action:@selector(contextOpen:) keyEquivalent:@""];
@@ -1,10 +1,16 @@
 #import "ForceQuitWindow.h"
 
+extern "C" {
+#include "kernel.h"
+#include "os_config.h"
+}
+
 @interface ForceQuitWindow () <NSTableViewDataSource, NSTableViewDelegate>
 @property (nonatomic, strong) NSWindow *forceQuitWindow;
 @property (nonatomic, strong) NSTableView *appsTable;
 @property (nonatomic, strong) NSMutableArray *runningApps;
 @property (nonatomic, strong) NSButton *forceQuitButton;
+@property (nonatomic, strong) NSTextField *cpuLabel;
 @end
 
 @implementation ForceQuitWindow
@@ -62,10 +68,28 @@
     [self.appsTable reloadData];
 }
 
+// Kernel CPU time per simulated core: total in the label, breakdown in
+// the tooltip.
+- (void)updateCPULabel {
+    OSCoreInfo cores[KERNEL_MAX_CORES];
+    uint32_t count = get_core_info(cores, KERNEL_MAX_CORES);
+    uint64_t total = 0;
+    NSMutableString *detail = [NSMutableString string];
+    for (uint32_t i = 0; i < count; i++) {
+        total += cores[i].cpu_time;
+        [detail appendFormat:@"%@Core %u: %llu ms, %llu steals", i ? @"\n" : @"",
+                             cores[i].core_id, cores[i].cpu_time, cores[i].steals];
+    }
+    self.cpuLabel.stringValue = [NSString stringWithFormat:@"CPU: %llu ms on %u %@",
+                                 total, count, count == 1 ? @"core" : @"cores"];
+    self.cpuLabel.toolTip = detail;
+}
+
 - (void)showWindow {
     if (self.forceQuitWindow) {
         [self.forceQuitWindow makeKeyAndOrderFront:nil];
         [self.appsTable reloadData];
+        [self updateCPULabel];
         return;
     }
     
@@ -134,6 +158,16 @@
     relaunchBtn.action = @selector(relaunchClicked:);
     [contentView addSubview:relaunchBtn];
     
+    // Kernel CPU usage
+    self.cpuLabel = [[NSTextField alloc] initWithFrame:NSMakeRect(20, 28, 105, 20)];
+    self.cpuLabel.font = [NSFont systemFontOfSize:10];
+    self.cpuLabel.textColor = [NSColor grayColor];
+    self.cpuLabel.bezeled = NO;
+    self.cpuLabel.editable = NO;
+    self.cpuLabel.drawsBackground = NO;
+    [contentView addSubview:self.cpuLabel];
+    [self updateCPULabel];
+    
     [self.forceQuitWindow makeKeyAndOrderFront:nil];
 }
 
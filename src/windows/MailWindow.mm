@@ -1,10 +1,16 @@
 #import "MailWindow.h"
+#include "SearchIndex.hpp"
 
-@interface MailWindow ()
+static const size_t kMaxSearchResults = 500;
+
+@interface MailWindow () {
+    OS::System::SearchIndex _searchIndex; // keyed by position in emails
+}
 @property (nonatomic, strong) NSWindow *mailWindow;
 @property (nonatomic, strong) NSTableView *mailTable;
 @property (nonatomic, strong) NSTextView *emailContentView;
 @property (nonatomic, strong) NSMutableArray *emails;
+@property (nonatomic, strong) NSArray *visibleEmails; // indexes into emails while searching, else nil
 @property (nonatomic, strong) NSMutableArray *folders;
 @property (nonatomic, assign) NSInteger selectedEmail;
 @end
@@ -112,6 +118,8 @@
     // Search
     NSSearchField *searchField = [[NSSearchField alloc] initWithFrame:NSMakeRect(10, frame.size.height - 80, 260, 28)];
     searchField.placeholderString = @"Search Mail";
+    searchField.target = self;
+    searchField.action = @selector(searchChanged:);
     [emailListView addSubview:searchField];
     
     // Email table
@@ -228,17 +236,48 @@
     [composeWindow makeKeyAndOrderFront:nil];
 }
 
+#pragma mark - Search
+
+// Call whenever an email is added to or changed in emails
+- (void)indexEmailAtIndex:(NSUInteger)index {
+    NSDictionary *email = self.emails[index];
+    NSString *text = [NSString stringWithFormat:@"%@\n%@\n%@\n%@", email[@"from"] ?: @"", email[@"subject"] ?: @"", email[@"preview"] ?: @"", email[@"body"] ?: @""];
+    _searchIndex.update((uint32_t)index, text.UTF8String ?: "");
+}
+
+- (void)searchChanged:(NSSearchField *)sender {
+    std::string query = OS::System::SearchIndex::prefixQuery(sender.stringValue.UTF8String ?: "");
+    if (query.empty()) {
+        self.visibleEmails = nil;
+    } else {
+        NSMutableArray *visible = [NSMutableArray array];
+        for (const OS::System::SearchHit &hit : _searchIndex.search(query, kMaxSearchResults)) {
+            [visible addObject:@(hit.document)];
+        }
+        self.visibleEmails = visible;
+    }
+    [self.mailTable reloadData];
+}
+
+- (NSInteger)emailIndexForRow:(NSInteger)row {
+    if (self.visibleEmails) {
+        return row >= 0 && row < (NSInteger)self.visibleEmails.count ? [self.visibleEmails[row] integerValue] : -1;
+    }
+    return row >= 0 && row < (NSInteger)self.emails.count ? row : -1;
+}
+
 #pragma mark - NSTableViewDataSource
 
 - (NSInteger)numberOfRowsInTableView:(NSTableView *)tableView {
-    return self.emails.count;
+    return self.visibleEmails ? self.visibleEmails.count : self.emails.count;
 }
 
 - (NSView *)tableView:(NSTableView *)tableView viewForTableColumn:(NSTableColumn *)tableColumn row:(NSInteger)row {
     NSTableCellView *cell = [[NSTableCellView alloc] initWithFrame:NSMakeRect(0, 0, 280, 70)];
     
-    if (row < (NSInteger)self.emails.count) {
-        NSDictionary *email = self.emails[row];
+    NSInteger index = [self emailIndexForRow:row];
+    if (index >= 0) {
+        NSDictionary *email = self.emails[index];
         
         NSTextField *sender = [[NSTextField alloc] initWithFrame:NSMakeRect(12, 45, 256, 18)];
         sender.stringValue = email[@"from"] ?: @"";
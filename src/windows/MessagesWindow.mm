@@ -1,6 +1,17 @@
 #import "MessagesWindow.h"
+#include "MessageStore.hpp"
+#include "SearchIndex.hpp"
 
-@interface MessagesWindow ()
+static const NSUInteger kMessagePage = 100; // messages loaded per step back
+static const size_t kMaxSearchResults = 500;
+
+@interface MessagesWindow () {
+    OS::System::MessageStore _store;
+    // Contacts and messages, built on the first search
+    OS::System::SearchIndex _searchIndex;
+    std::vector<uint32_t> _searchOwners; // document -> index in contacts
+    BOOL _searchIndexBuilt;
+}
 @property (nonatomic, strong) NSWindow *messagesWindow;
 @property (nonatomic, strong) NSWindow *addContactWindow;
 @property (nonatomic, strong) NSTableView *contactsTable;
@@ -11,8 +22,10 @@
 @property (nonatomic, strong) NSTextField *addNameField;
 @property (nonatomic, strong) NSTextField *addPhoneField;
 @property (nonatomic, strong) NSMutableArray *contacts;
-@property (nonatomic, strong) NSMutableDictionary *conversations;
+@property (nonatomic, strong) NSArray *visibleContacts; // indexes into contacts while searching, else nil
+@property (nonatomic, strong) NSSearchField *searchField;
 @property (nonatomic, strong) NSMutableArray *currentMessages;
+@property (nonatomic, assign) NSUInteger firstLoadedMessage; // of the selected conversation
 @property (nonatomic, assign) NSInteger selectedContact;
 @end
 
@@ -32,7 +45,6 @@
     if (self) {
         self.selectedContact = -1;
         self.contacts = [NSMutableArray array];
-        self.conversations = [NSMutableDictionary dictionary];
         self.currentMessages = [NSMutableArray array];
         
         // Load saved contacts
@@ -48,19 +60,60 @@
         [self.contacts addObjectsFromArray:savedContacts];
     }
     
+    // Conversations live in an append-only log; only the index is loaded here
+    _store.open([self messageStorePath].fileSystemRepresentation);
+    [self migrateConversations];
+}
+
+// Older versions rewrote every conversation to one plist on each save.
+// Import it into the log once and keep it aside as a backup.
+- (void)migrateConversations {
     NSString *conversationsPath = [self conversationsFilePath];
     NSDictionary *savedConversations = [NSDictionary dictionaryWithContentsOfFile:conversationsPath];
-    if (savedConversations) {
-        [self.conversations addEntriesFromDictionary:savedConversations];
+    if (!savedConversations) {
+        return;
+    }
+    for (NSString *contactId in savedConversations) {
+        if (_store.getMessageCount(contactId.UTF8String) > 0) {
+            continue;
+        }
+        for (NSDictionary *msg in savedConversations[contactId]) {
+            [self appendMessage:msg toConversation:contactId];
+        }
     }
+    _store.sync();
+    NSString *backupPath = [conversationsPath stringByAppendingPathExtension:@"migrated"];
+    [[NSFileManager defaultManager] removeItemAtPath:backupPath error:nil];
+    [[NSFileManager defaultManager] moveItemAtPath:conversationsPath toPath:backupPath error:nil];
+}
+
+- (BOOL)appendMessage:(NSDictionary *)msg toConversation:(NSString *)contactId {
+    OS::System::StoredMessage message;
+    message.sender = [msg[@"sender"] UTF8String] ?: "";
+    message.text = [msg[@"text"] UTF8String] ?: "";
+    message.time = [msg[@"time"] UTF8String] ?: "";
+    message.timestamp = (int64_t)[[NSDate date] timeIntervalSince1970];
+    return _store.append(contactId.UTF8String, message);
+}
+
+// Reads messages [first, first + count) of a conversation as dictionaries
+- (NSArray *)messagesForConversation:(NSString *)contactId from:(NSUInteger)first count:(NSUInteger)count {
+    std::vector<OS::System::StoredMessage> stored;
+    _store.read(contactId.UTF8String, first, count, stored);
+    NSMutableArray *messages = [NSMutableArray arrayWithCapacity:stored.size()];
+    for (const OS::System::StoredMessage &message : stored) {
+        [messages addObject:@{
+            @"sender": [NSString stringWithUTF8String:message.sender.c_str()] ?: @"",
+            @"text": [NSString stringWithUTF8String:message.text.c_str()] ?: @"",
+            @"time": [NSString stringWithUTF8String:message.time.c_str()] ?: @""
+        }];
+    }
+    return messages;
 }
 
 - (void)saveContacts {
     NSString *contactsPath = [self contactsFilePath];
     [self.contacts writeToFile:contactsPath atomically:YES];
-    
-    NSString *conversationsPath = [self conversationsFilePath];
-    [self.conversations writeToFile:conversationsPath atomically:YES];
 }
 
 - (NSString *)contactsFilePath {
@@ -70,6 +123,13 @@
     return [appFolder stringByAppendingPathComponent:@"contacts.plist"];
 }
 
+- (NSString *)messageStorePath {
+    NSString *appSupport = [NSSearchPathForDirectoriesInDomains(NSApplicationSupportDirectory, NSUserDomainMask, YES) firstObject];
+    NSString *appFolder = [appSupport stringByAppendingPathComponent:@"macOSDesktop"];
+    [[NSFileManager defaultManager] createDirectoryAtPath:appFolder withIntermediateDirectories:YES attributes:nil error:nil];
+    return [appFolder stringByAppendingPathComponent:@"Messages"];
+}
+
 - (NSString *)conversationsFilePath {
     NSString *appSupport = [NSSearchPathForDirectoriesInDomains(NSApplicationSupportDirectory, NSUserDomainMask, YES) firstObject];
     NSString *appFolder = [appSupport stringByAppendingPathComponent:@"macOSDesktop"];
@@ -119,9 +179,11 @@
     [sidebar addSubview:newMsgBtn];
     
     // Search field
-    NSSearchField *searchField = [[NSSearchField alloc] initWithFrame:NSMakeRect(10, frame.size.height - 80, 230, 28)];
-    searchField.placeholderString = @"Search";
-    [sidebar addSubview:searchField];
+    self.searchField = [[NSSearchField alloc] initWithFrame:NSMakeRect(10, frame.size.height - 80, 230, 28)];
+    self.searchField.placeholderString = @"Search";
+    self.searchField.target = self;
+    self.searchField.action = @selector(searchChanged:);
+    [sidebar addSubview:self.searchField];
     
     // Contacts table
     NSScrollView *contactsScroll = [[NSScrollView alloc] initWithFrame:NSMakeRect(0, 50, 250, frame.size.height - 140)];
@@ -288,7 +350,14 @@
     
     [self.contacts addObject:newContact];
     [self saveContacts];
-    [self.contactsTable reloadData];
+    if (_searchIndexBuilt) {
+        [self indexContactAtIndex:self.contacts.count - 1];
+    }
+    if (self.visibleContacts) {
+        [self searchChanged:self.searchField];
+    } else {
+        [self.contactsTable reloadData];
+    }
     
     [self.addContactWindow close];
     self.addContactWindow = nil;
@@ -317,6 +386,18 @@
     CGFloat yPos = 20;
     CGFloat maxWidth = self.chatContainer.bounds.size.width - 100;
     
+    // Older messages stay on disk until asked for
+    if (self.firstLoadedMessage > 0) {
+        NSButton *earlierBtn = [[NSButton alloc] initWithFrame:NSMakeRect((self.chatContainer.bounds.size.width - 200) / 2, yPos, 200, 24)];
+        earlierBtn.title = @"Load Earlier Messages";
+        earlierBtn.bezelStyle = NSBezelStyleRecessed;
+        earlierBtn.font = [NSFont systemFontOfSize:11];
+        earlierBtn.target = self;
+        earlierBtn.action = @selector(loadEarlierMessages:);
+        [self.chatContainer addSubview:earlierBtn];
+        yPos += 44;
+    }
+    
     for (NSDictionary *msg in self.currentMessages) {
         BOOL isMe = [msg[@"sender"] isEqualToString:@"me"];
         NSString *text = msg[@"text"];
@@ -409,12 +490,14 @@
     NSDictionary *newMessage = @{@"sender": @"me", @"text": text, @"time": time};
     [self.currentMessages addObject:newMessage];
     
-    // Save conversation
+    // Save conversation: one record appended to the log
     NSDictionary *contact = self.contacts[self.selectedContact];
     NSString *contactId = contact[@"phone"];
     if (contactId) {
-        self.conversations[contactId] = [self.currentMessages copy];
-        [self saveContacts];
+        [self appendMessage:newMessage toConversation:contactId];
+        if (_searchIndexBuilt) {
+            [self indexText:text.UTF8String forContact:self.selectedContact];
+        }
     }
     
     [self layoutMessages];
@@ -424,16 +507,81 @@
     [self.chatScrollView.documentView scrollPoint:bottomPoint];
 }
 
+#pragma mark - Search
+
+- (void)indexText:(const char *)text forContact:(NSUInteger)index {
+    _searchIndex.update((uint32_t)_searchOwners.size(), text ?: "");
+    _searchOwners.push_back((uint32_t)index);
+}
+
+- (void)indexContactAtIndex:(NSUInteger)index {
+    NSDictionary *contact = self.contacts[index];
+    NSString *text = [NSString stringWithFormat:@"%@ %@", contact[@"name"], contact[@"phone"]];
+    [self indexText:text.UTF8String forContact:index];
+    
+    NSString *contactId = contact[@"phone"];
+    if (!contactId) {
+        return;
+    }
+    size_t total = _store.getMessageCount(contactId.UTF8String);
+    std::vector<OS::System::StoredMessage> page;
+    for (size_t first = 0; first < total; first += page.size()) {
+        page.clear();
+        if (_store.read(contactId.UTF8String, first, 1000, page) == 0) {
+            break;
+        }
+        for (const OS::System::StoredMessage &message : page) {
+            [self indexText:message.text.c_str() forContact:index];
+        }
+    }
+}
+
+- (void)searchChanged:(NSSearchField *)sender {
+    std::string query = OS::System::SearchIndex::prefixQuery(sender.stringValue.UTF8String ?: "");
+    if (query.empty()) {
+        self.visibleContacts = nil;
+        [self.contactsTable reloadData];
+        return;
+    }
+    
+    if (!_searchIndexBuilt) {
+        for (NSUInteger i = 0; i < self.contacts.count; i++) {
+            [self indexContactAtIndex:i];
+        }
+        _searchIndexBuilt = YES;
+    }
+    
+    // Best match first, each contact once
+    NSMutableArray *visible = [NSMutableArray array];
+    NSMutableIndexSet *seen = [NSMutableIndexSet indexSet];
+    for (const OS::System::SearchHit &hit : _searchIndex.search(query, kMaxSearchResults)) {
+        NSUInteger index = _searchOwners[hit.document];
+        if (index < self.contacts.count && ![seen containsIndex:index]) {
+            [seen addIndex:index];
+            [visible addObject:@(index)];
+        }
+    }
+    self.visibleContacts = visible;
+    [self.contactsTable reloadData];
+}
+
+- (NSInteger)contactIndexForRow:(NSInteger)row {
+    if (self.visibleContacts) {
+        return row >= 0 && row < (NSInteger)self.visibleContacts.count ? [self.visibleContacts[row] integerValue] : -1;
+    }
+    return row >= 0 && row < (NSInteger)self.contacts.count ? row : -1;
+}
+
 #pragma mark - NSTableViewDataSource
 
 - (NSInteger)numberOfRowsInTableView:(NSTableView *)tableView {
-    return self.contacts.count;
+    return self.visibleContacts ? self.visibleContacts.count : self.contacts.count;
 }
 
 - (NSView *)tableView:(NSTableView *)tableView viewForTableColumn:(NSTableColumn *)tableColumn row:(NSInteger)row {
     NSTableCellView *cell = [[NSTableCellView alloc] initWithFrame:NSMakeRect(0, 0, 250, 60)];
     
-    NSDictionary *contact = self.contacts[row];
+    NSDictionary *contact = self.contacts[[self contactIndexForRow:row]];
     
     // Avatar
     NSTextField *avatar = [[NSTextField alloc] initWithFrame:NSMakeRect(12, 12, 36, 36)];
@@ -469,23 +617,36 @@
 }
 
 - (void)tableViewSelectionDidChange:(NSNotification *)notification {
-    self.selectedContact = self.contactsTable.selectedRow;
+    self.selectedContact = [self contactIndexForRow:self.contactsTable.selectedRow];
     
     if (self.selectedContact >= 0 && self.selectedContact < (NSInteger)self.contacts.count) {
         NSDictionary *contact = self.contacts[self.selectedContact];
         self.chatTitleField.stringValue = [NSString stringWithFormat:@"%@ • %@", contact[@"name"], contact[@"phone"]];
         
-        // Load conversation for this contact
+        // Load the most recent page of this contact's conversation
         NSString *contactId = contact[@"phone"];
-        NSArray *savedMessages = self.conversations[contactId];
+        NSUInteger total = contactId ? _store.getMessageCount(contactId.UTF8String) : 0;
+        self.firstLoadedMessage = total > kMessagePage ? total - kMessagePage : 0;
         
         [self.currentMessages removeAllObjects];
-        if (savedMessages) {
-            [self.currentMessages addObjectsFromArray:savedMessages];
+        if (total > 0) {
+            [self.currentMessages addObjectsFromArray:[self messagesForConversation:contactId from:self.firstLoadedMessage count:kMessagePage]];
         }
         
         [self layoutMessages];
     }
 }
 
+- (void)loadEarlierMessages:(id)sender {
+    if (self.selectedContact < 0 || self.selectedContact >= (NSInteger)self.contacts.count || self.firstLoadedMessage == 0) {
+        return;
+    }
+    NSString *contactId = self.contacts[self.selectedContact][@"phone"];
+    NSUInteger first = self.firstLoadedMessage > kMessagePage ? self.firstLoadedMessage - kMessagePage : 0;
+    NSArray *earlier = [self messagesForConversation:contactId from:first count:self.firstLoadedMessage - first];
+    [self.currentMessages insertObjects:earlier atIndexes:[NSIndexSet indexSetWithIndexesInRange:NSMakeRange(0, earlier.count)]];
+    self.firstLoadedMessage = first;
+    [self layoutMessages];
+}
+
 @end
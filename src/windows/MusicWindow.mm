@@ -1,7 +1,10 @@
 #import "MusicWindow.h"
 #import <AVFoundation/AVFoundation.h>
+#include "EventManager.h"
 
-@interface MusicWindow ()
+@interface MusicWindow () {
+    EventManager::TimerId _progressTimer;
+}
 @property (nonatomic, strong) NSWindow *musicWindow;
 @property (nonatomic, strong) NSTableView *songsTable;
 @property (nonatomic, strong) NSMutableArray *songs;
@@ -12,7 +15,6 @@
 @property (nonatomic, strong) NSTextField *artistLabel;
 @property (nonatomic, strong) NSSlider *progressSlider;
 @property (nonatomic, strong) NSButton *playPauseBtn;
-@property (nonatomic, strong) NSTimer *progressTimer;
 @end
 
 @implementation MusicWindow
@@ -269,8 +271,12 @@
         self.artistLabel.stringValue = song[@"artist"];
         
         // Start progress timer
-        [self.progressTimer invalidate];
-        self.progressTimer = [NSTimer scheduledTimerWithTimeInterval:0.5 target:self selector:@selector(updateProgress) userInfo:nil repeats:YES];
+        EventManager &events = EventManager::shared();
+        events.cancelTimer(_progressTimer);
+        __weak MusicWindow *weakSelf = self;
+        _progressTimer = events.addTimer(500, 500, [weakSelf] {
+            [weakSelf updateProgress];
+        });
     }
 }
 
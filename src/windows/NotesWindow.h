@@ -1,6 +1,6 @@
 #import <Cocoa/Cocoa.h>
 
-@interface NotesWindow : NSWindowController <NSTableViewDataSource, NSTableViewDelegate>
+@interface NotesWindow : NSWindowController <NSTableViewDataSource, NSTableViewDelegate, NSTextViewDelegate>
 
 + (instancetype)sharedInstance;
 - (void)showWindow;
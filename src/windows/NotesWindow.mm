@@ -1,11 +1,19 @@
 #import "NotesWindow.h"
+#include "SearchIndex.hpp"
 
-@interface NotesWindow ()
+static const size_t kMaxSearchResults = 500;
+
+@interface NotesWindow () {
+    OS::System::SearchIndex _searchIndex; // keyed by each note's "id"
+}
 @property (nonatomic, strong) NSWindow *notesWindow;
 @property (nonatomic, strong) NSTableView *notesTable;
 @property (nonatomic, strong) NSTextView *noteTextView;
+@property (nonatomic, strong) NSSearchField *searchField;
 @property (nonatomic, strong) NSMutableArray *notes;
+@property (nonatomic, strong) NSArray *visibleNotes; // indexes into notes while searching, else nil
 @property (nonatomic, assign) NSInteger selectedNote;
+@property (nonatomic, assign) uint32_t nextNoteId;
 @end
 
 @implementation NotesWindow
@@ -24,10 +32,14 @@
     if (self) {
         self.selectedNote = 0;
         self.notes = [NSMutableArray arrayWithArray:@[
-            @{@"title": @"Welcome to Notes", @"content": @"This is a simple notes application.\n\nYou can create and edit notes here.", @"date": [NSDate date]},
-            @{@"title": @"Shopping List", @"content": @"- Milk\n- Bread\n- Eggs\n- Coffee", @"date": [NSDate dateWithTimeIntervalSinceNow:-86400]},
-            @{@"title": @"Project Ideas", @"content": @"1. Build a macOS-like UI\n2. Add more apps\n3. Implement file system", @"date": [NSDate dateWithTimeIntervalSinceNow:-172800]}
+            @{@"id": @0, @"title": @"Welcome to Notes", @"content": @"This is a simple notes application.\n\nYou can create and edit notes here.", @"date": [NSDate date]},
+            @{@"id": @1, @"title": @"Shopping List", @"content": @"- Milk\n- Bread\n- Eggs\n- Coffee", @"date": [NSDate dateWithTimeIntervalSinceNow:-86400]},
+            @{@"id": @2, @"title": @"Project Ideas", @"content": @"1. Build a macOS-like UI\n2. Add more apps\n3. Implement file system", @"date": [NSDate dateWithTimeIntervalSinceNow:-172800]}
         ]];
+        self.nextNoteId = 3;
+        for (NSDictionary *note in self.notes) {
+            [self indexNote:note];
+        }
     }
     return self;
 }
@@ -73,9 +85,11 @@
     [toolbarView addSubview:newNoteBtn];
     
     // Search field
-    NSSearchField *searchField = [[NSSearchField alloc] initWithFrame:NSMakeRect(45, 10, 165, 25)];
-    searchField.placeholderString = @"Search";
-    [toolbarView addSubview:searchField];
+    self.searchField = [[NSSearchField alloc] initWithFrame:NSMakeRect(45, 10, 165, 25)];
+    self.searchField.placeholderString = @"Search";
+    self.searchField.target = self;
+    self.searchField.action = @selector(searchChanged:);
+    [toolbarView addSubview:self.searchField];
     
     // Notes list
     NSScrollView *notesScroll = [[NSScrollView alloc] initWithFrame:NSMakeRect(0, 0, 220, frame.size.height - 45)];
@@ -112,6 +126,7 @@
     self.noteTextView.font = [NSFont systemFontOfSize:14];
     self.noteTextView.textContainerInset = NSMakeSize(10, 10);
     self.noteTextView.autoresizingMask = NSViewWidthSizable | NSViewHeightSizable;
+    self.noteTextView.delegate = self;
     
     textScroll.documentView = self.noteTextView;
     [editorArea addSubview:textScroll];
@@ -127,27 +142,92 @@
 
 - (void)createNewNote:(id)sender {
     NSDictionary *newNote = @{
+        @"id": @(self.nextNoteId++),
         @"title": @"New Note",
         @"content": @"",
         @"date": [NSDate date]
     };
     [self.notes insertObject:newNote atIndex:0];
+    [self indexNote:newNote];
+    self.selectedNote = 0;
+    // A new note is blank; show it even if a search is active
+    self.searchField.stringValue = @"";
+    self.visibleNotes = nil;
     [self.notesTable reloadData];
     [self.notesTable selectRowIndexes:[NSIndexSet indexSetWithIndex:0] byExtendingSelection:NO];
     self.noteTextView.string = @"";
     [self.notesWindow makeFirstResponder:self.noteTextView];
 }
 
+#pragma mark - Search
+
+- (void)indexNote:(NSDictionary *)note {
+    NSString *text = [NSString stringWithFormat:@"%@\n%@", note[@"title"], note[@"content"]];
+    _searchIndex.update([note[@"id"] unsignedIntValue], text.UTF8String ?: "");
+}
+
+- (void)searchChanged:(NSSearchField *)sender {
+    std::string query = OS::System::SearchIndex::prefixQuery(sender.stringValue.UTF8String ?: "");
+    if (query.empty()) {
+        self.visibleNotes = nil;
+        [self.notesTable reloadData];
+        return;
+    }
+    
+    NSMutableDictionary *indexById = [NSMutableDictionary dictionaryWithCapacity:self.notes.count];
+    for (NSUInteger i = 0; i < self.notes.count; i++) {
+        indexById[self.notes[i][@"id"]] = @(i);
+    }
+    NSMutableArray *visible = [NSMutableArray array];
+    for (const OS::System::SearchHit &hit : _searchIndex.search(query, kMaxSearchResults)) {
+        NSNumber *index = indexById[@(hit.document)];
+        if (index) {
+            [visible addObject:index];
+        }
+    }
+    self.visibleNotes = visible;
+    [self.notesTable reloadData];
+}
+
+- (NSInteger)noteIndexForRow:(NSInteger)row {
+    if (self.visibleNotes) {
+        return row >= 0 && row < (NSInteger)self.visibleNotes.count ? [self.visibleNotes[row] integerValue] : -1;
+    }
+    return row >= 0 && row < (NSInteger)self.notes.count ? row : -1;
+}
+
+#pragma mark - NSTextViewDelegate
+
+// Edits are kept, with the first line as the title
+- (void)textDidChange:(NSNotification *)notification {
+    if (self.selectedNote < 0 || self.selectedNote >= (NSInteger)self.notes.count) {
+        return;
+    }
+    NSString *content = [self.noteTextView.string copy];
+    NSString *firstLine = [[content componentsSeparatedByString:@"\n"].firstObject stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+    NSMutableDictionary *note = [self.notes[self.selectedNote] mutableCopy];
+    note[@"title"] = firstLine.length > 0 ? firstLine : @"New Note";
+    note[@"content"] = content;
+    note[@"date"] = [NSDate date];
+    self.notes[self.selectedNote] = note;
+    [self indexNote:note];
+    
+    NSInteger row = self.notesTable.selectedRow;
+    if (row >= 0) {
+        [self.notesTable reloadDataForRowIndexes:[NSIndexSet indexSetWithIndex:row] columnIndexes:[NSIndexSet indexSetWithIndex:0]];
+    }
+}
+
 #pragma mark - NSTableViewDataSource
 
 - (NSInteger)numberOfRowsInTableView:(NSTableView *)tableView {
-    return self.notes.count;
+    return self.visibleNotes ? self.visibleNotes.count : self.notes.count;
 }
 
 - (NSView *)tableView:(NSTableView *)tableView viewForTableColumn:(NSTableColumn *)tableColumn row:(NSInteger)row {
     NSTableCellView *cell = [[NSTableCellView alloc] initWithFrame:NSMakeRect(0, 0, 220, 60)];
     
-    NSDictionary *note = self.notes[row];
+    NSDictionary *note = self.notes[[self noteIndexForRow:row]];
     
     // Title
     NSTextField *title = [[NSTextField alloc] initWithFrame:NSMakeRect(12, 35, 196, 20)];
@@ -190,10 +270,10 @@
 }
 
 - (void)tableViewSelectionDidChange:(NSNotification *)notification {
-    NSInteger row = self.notesTable.selectedRow;
-    if (row >= 0 && row < (NSInteger)self.notes.count) {
-        self.selectedNote = row;
-        NSDictionary *note = self.notes[row];
+    NSInteger index = [self noteIndexForRow:self.notesTable.selectedRow];
+    if (index >= 0) {
+        self.selectedNote = index;
+        NSDictionary *note = self.notes[index];
         self.noteTextView.string = note[@"content"];
     }
 }
@@ -1,10 +1,37 @@
 #import "PhotosWindow.h"
+#import <ImageIO/ImageIO.h>
 #import <UniformTypeIdentifiers/UniformTypeIdentifiers.h>
+#include "GridLayout.hpp"
+#include "ThumbnailService.hpp"
+#include <memory>
 
-@interface PhotosWindow ()
+static const CGFloat kPhotoSize = 150;
+static const CGFloat kPhotoPadding = 8;
+static const CGFloat kGridInset = 20;
+
+// Grid cells are laid out top-down, like GridLayout's content coordinates
+@interface PhotosGridView : NSView
+@end
+
+@implementation PhotosGridView
+- (BOOL)isFlipped {
+    return YES;
+}
+@end
+
+@interface PhotosWindow () {
+    std::unique_ptr<OS::Graphics::ThumbnailService> _thumbnails;
+    OS::Graphics::GridLayout _layout;
+    OS::Graphics::GridRecycler _recycler;
+    OS::Graphics::GridUpdate _update;
+    OS::Graphics::GridRange _prefetched; // thumbnails already requested ahead
+}
 @property (nonatomic, strong) NSWindow *photosWindow;
 @property (nonatomic, strong) NSMutableArray *photos;
 @property (nonatomic, strong) NSCollectionView *collectionView;
+@property (nonatomic, strong) NSScrollView *gridScrollView;
+@property (nonatomic, strong) PhotosGridView *gridView;
+@property (nonatomic, strong) NSMutableArray<NSImageView *> *cells; // by recycler slot
 @end
 
 @implementation PhotosWindow
@@ -23,6 +50,7 @@
     if (self) {
         self.photos = [NSMutableArray array];
         [self loadPhotosFromSystem];
+        [self createThumbnailService];
     }
     return self;
 }
@@ -44,6 +72,171 @@
     }
 }
 
+// Thumbnails are decoded off the main thread at twice the tile size (for
+// Retina) and cached under ~/Library/Caches, so reopening the library is
+// a disk read rather than a full decode per photo.
+- (void)createThumbnailService {
+    NSString *cacheDir = [NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES) firstObject];
+    cacheDir = [cacheDir stringByAppendingPathComponent:@"macOSDesktop"];
+    cacheDir = [cacheDir stringByAppendingPathComponent:@"Thumbnails"];
+    [[NSFileManager defaultManager] createDirectoryAtPath:cacheDir withIntermediateDirectories:YES attributes:nil error:nil];
+
+    _thumbnails.reset(new OS::Graphics::ThumbnailService(cacheDir.fileSystemRepresentation, (uint32_t)(kPhotoSize * 2)));
+    _thumbnails->setDecoder([](const std::string &path, uint32_t sizeHint, uint32_t &width, uint32_t &height, std::vector<uint32_t> &pixels) {
+        @autoreleasepool {
+            return [PhotosWindow decodeImageAtPath:path sizeHint:sizeHint width:width height:height pixels:pixels];
+        }
+    });
+}
+
+// ImageIO pulls embedded previews or subsamples while decoding, so large
+// photos never expand to full resolution; the service box-filters the rest.
++ (bool)decodeImageAtPath:(const std::string &)path sizeHint:(uint32_t)sizeHint width:(uint32_t &)width height:(uint32_t &)height pixels:(std::vector<uint32_t> &)pixels {
+    NSURL *url = [NSURL fileURLWithPath:[NSString stringWithUTF8String:path.c_str()]];
+    CGImageSourceRef source = CGImageSourceCreateWithURL((__bridge CFURLRef)url, NULL);
+    if (!source) {
+        return false;
+    }
+    NSDictionary *options = @{
+        (id)kCGImageSourceCreateThumbnailFromImageAlways: @YES,
+        (id)kCGImageSourceCreateThumbnailWithTransform: @YES,
+        (id)kCGImageSourceThumbnailMaxPixelSize: @(sizeHint)
+    };
+    CGImageRef image = CGImageSourceCreateThumbnailAtIndex(source, 0, (__bridge CFDictionaryRef)options);
+    CFRelease(source);
+    if (!image) {
+        return false;
+    }
+
+    width = (uint32_t)CGImageGetWidth(image);
+    height = (uint32_t)CGImageGetHeight(image);
+    pixels.assign((size_t)width * height, 0);
+    CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+    CGContextRef context = CGBitmapContextCreate(pixels.data(), width, height, 8, width * 4, colorSpace,
+                                                 kCGImageAlphaPremultipliedFirst | kCGBitmapByteOrder32Host);
+    CGColorSpaceRelease(colorSpace);
+    if (context) {
+        CGContextDrawImage(context, CGRectMake(0, 0, width, height), image);
+        CGContextRelease(context);
+    }
+    CGImageRelease(image);
+    return context != NULL;
+}
+
++ (NSImage *)imageFromThumbnail:(const OS::Graphics::Thumbnail &)thumbnail {
+    CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+    CGContextRef context = CGBitmapContextCreate((void *)thumbnail.pixels.data(), thumbnail.width, thumbnail.height, 8,
+                                                 thumbnail.width * 4, colorSpace,
+                                                 kCGImageAlphaPremultipliedFirst | kCGBitmapByteOrder32Host);
+    CGColorSpaceRelease(colorSpace);
+    if (!context) {
+        return nil;
+    }
+    CGImageRef cgImage = CGBitmapContextCreateImage(context); // copies the pixels
+    CGContextRelease(context);
+    if (!cgImage) {
+        return nil;
+    }
+    // Point size is half the pixel size: the thumbnail is a 2x rendition
+    NSImage *image = [[NSImage alloc] initWithCGImage:cgImage size:NSMakeSize(thumbnail.width / 2.0, thumbnail.height / 2.0)];
+    CGImageRelease(cgImage);
+    return image;
+}
+
+- (std::string)thumbnailKeyForItem:(uint64_t)item {
+    NSString *path = self.photos[(NSUInteger)item][@"path"];
+    return path.fileSystemRepresentation;
+}
+
+- (void)loadThumbnailForItem:(uint64_t)item intoView:(NSImageView *)imageView {
+    std::string key = [self thumbnailKeyForItem:item];
+    OS::Graphics::ThumbnailRef cached = _thumbnails->lookup(key);
+    imageView.image = cached ? [PhotosWindow imageFromThumbnail:*cached] : nil;
+
+    // Even on a memory hit, revalidate against the file's current mtime. The
+    // cell may have been recycled for another photo by the time this lands.
+    __weak NSImageView *weakView = imageView;
+    NSInteger tag = (NSInteger)item;
+    _thumbnails->request(key, [weakView, cached, tag](const std::string &, OS::Graphics::ThumbnailRef thumbnail) {
+        if (!thumbnail || thumbnail == cached) {
+            return;
+        }
+        @autoreleasepool {
+            NSImage *image = [PhotosWindow imageFromThumbnail:*thumbnail];
+            dispatch_async(dispatch_get_main_queue(), ^{
+                NSImageView *view = weakView;
+                if (view.tag == tag) {
+                    view.image = image;
+                }
+            });
+        }
+    });
+}
+
+#pragma mark - Virtualized grid
+
+- (NSImageView *)cellForSlot:(uint32_t)slot {
+    while (self.cells.count <= slot) {
+        NSImageView *imageView = [[NSImageView alloc] initWithFrame:NSMakeRect(0, 0, kPhotoSize, kPhotoSize)];
+        imageView.imageScaling = NSImageScaleProportionallyUpOrDown;
+        imageView.wantsLayer = YES;
+        imageView.layer.cornerRadius = 4;
+        imageView.layer.masksToBounds = YES;
+        imageView.hidden = YES;
+        [self.gridView addSubview:imageView];
+        [self.cells addObject:imageView];
+    }
+    return self.cells[slot];
+}
+
+// Only the rows on screen (plus one either side) have views; scrolling
+// rebinds the cells that fell off one edge to the photos entering at the
+// other, and warms the thumbnail cache one screen ahead.
+- (void)updateVisibleCells {
+    NSRect visible = self.gridScrollView.contentView.bounds;
+    _recycler.update(_layout, NSMinY(visible), NSHeight(visible), _update);
+
+    for (const OS::Graphics::GridCell &cell : _update.unbound) {
+        NSImageView *imageView = self.cells[cell.slot];
+        imageView.hidden = YES;
+        imageView.image = nil;
+        imageView.tag = -1;
+        if (cell.item < self.photos.count) {
+            _thumbnails->cancel([self thumbnailKeyForItem:cell.item]);
+        }
+    }
+    for (const OS::Graphics::GridCell &cell : _update.bound) {
+        OS::Graphics::GridRect rect = _layout.frame(cell.item);
+        NSImageView *imageView = [self cellForSlot:cell.slot];
+        imageView.frame = NSMakeRect(rect.x, rect.y, rect.width, rect.height);
+        imageView.tag = (NSInteger)cell.item;
+        imageView.hidden = NO;
+        [self loadThumbnailForItem:cell.item intoView:imageView];
+    }
+
+    const OS::Graphics::GridRange &ahead = _update.prefetch;
+    for (uint64_t item = ahead.first; item < ahead.end; item++) {
+        if (!_prefetched.contains(item)) {
+            _thumbnails->request([self thumbnailKeyForItem:item], [](const std::string &, OS::Graphics::ThumbnailRef) {});
+        }
+    }
+    _prefetched = ahead;
+}
+
+- (void)gridScrolled:(NSNotification *)notification {
+    [self updateVisibleCells];
+}
+
+- (void)tearDownGrid {
+    [[NSNotificationCenter defaultCenter] removeObserver:self name:NSViewBoundsDidChangeNotification object:nil];
+    _thumbnails->cancelAll();
+    _recycler.reset(_update);
+    _prefetched = OS::Graphics::GridRange{0, 0};
+    [self.cells removeAllObjects];
+    self.gridView = nil;
+    self.gridScrollView = nil;
+}
+
 - (void)showWindow {
     if (self.photosWindow) {
         [self.photosWindow makeKeyAndOrderFront:nil];
@@ -136,7 +329,7 @@
     scrollView.drawsBackground = NO;
     
     // Photo grid container
-    NSView *gridContainer = [[NSView alloc] initWithFrame:NSMakeRect(0, 0, mainArea.bounds.size.width, frame.size.height - 90)];
+    PhotosGridView *gridContainer = [[PhotosGridView alloc] initWithFrame:NSMakeRect(0, 0, mainArea.bounds.size.width, frame.size.height - 90)];
     
     if (self.photos.count == 0) {
         // Empty state
@@ -150,37 +343,30 @@
         emptyLabel.drawsBackground = NO;
         [gridContainer addSubview:emptyLabel];
     } else {
-        // Display photos in grid
-        CGFloat photoSize = 150;
-        CGFloat padding = 8;
-        NSInteger cols = (mainArea.bounds.size.width - 40) / (photoSize + padding);
-        NSInteger rows = (self.photos.count + cols - 1) / cols;
-        CGFloat gridHeight = rows * (photoSize + padding) + 20;
-        
-        [gridContainer setFrameSize:NSMakeSize(mainArea.bounds.size.width, MAX(gridHeight, scrollView.bounds.size.height))];
-        
-        for (NSInteger i = 0; i < (NSInteger)self.photos.count; i++) {
-            NSDictionary *photo = self.photos[i];
-            NSInteger col = i % cols;
-            NSInteger row = i / cols;
-            
-            CGFloat x = 20 + col * (photoSize + padding);
-            CGFloat y = gridContainer.bounds.size.height - 20 - (row + 1) * (photoSize + padding);
-            
-            NSImageView *imageView = [[NSImageView alloc] initWithFrame:NSMakeRect(x, y, photoSize, photoSize)];
-            NSImage *image = [[NSImage alloc] initWithContentsOfFile:photo[@"path"]];
-            imageView.image = image;
-            imageView.imageScaling = NSImageScaleProportionallyUpOrDown;
-            imageView.wantsLayer = YES;
-            imageView.layer.cornerRadius = 4;
-            imageView.layer.masksToBounds = YES;
-            [gridContainer addSubview:imageView];
-        }
+        // Display photos in a virtualized grid: cells are created on demand
+        _layout.setItemSize(kPhotoSize, kPhotoSize);
+        _layout.setSpacing(kPhotoPadding);
+        _layout.setInset(kGridInset);
+        _layout.setViewportWidth(mainArea.bounds.size.width);
+        _layout.setItemCount(self.photos.count);
+        [gridContainer setFrameSize:NSMakeSize(mainArea.bounds.size.width, MAX(_layout.getContentHeight(), scrollView.bounds.size.height))];
     }
     
     scrollView.documentView = gridContainer;
     [mainArea addSubview:scrollView];
     
+    if (self.photos.count > 0) {
+        self.gridScrollView = scrollView;
+        self.gridView = gridContainer;
+        self.cells = [NSMutableArray array];
+        scrollView.contentView.postsBoundsChangedNotifications = YES;
+        [[NSNotificationCenter defaultCenter] addObserver:self
+                                                 selector:@selector(gridScrolled:)
+                                                     name:NSViewBoundsDidChangeNotification
+                                                   object:scrollView.contentView];
+        [self updateVisibleCells];
+    }
+    
     [self.photosWindow makeKeyAndOrderFront:nil];
 }
 
@@ -202,7 +388,8 @@
             for (NSURL *url in panel.URLs) {
                 [self.photos addObject:@{@"name": url.lastPathComponent, @"path": url.path}];
             }
-            // Refresh window
+            // Refresh window; tiles being torn down no longer need thumbnails
+            [self tearDownGrid];
             [self.photosWindow close];
             self.photosWindow = nil;
             [self showWindow];
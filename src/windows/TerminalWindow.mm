@@ -1,10 +1,24 @@
 #import "TerminalWindow.h"
+#include "ProcessRunner.hpp"
+#include "TerminalBuffer.hpp"
+#include <deque>
 
-@interface TerminalWindow () <NSTextViewDelegate>
+static const size_t kDrainSlice = 256 * 1024; // output bytes per main-thread pass
+
+@interface TerminalWindow () <NSTextViewDelegate> {
+    OS::System::TerminalBuffer _buffer;
+    OS::System::ProcessRunner _runner;
+    uint32_t _session;                   // foreground command, 0 at the prompt
+    std::deque<NSUInteger> _lineLengths; // characters per displayed line
+    uint64_t _viewFirst;                 // buffer lines shown in the view
+    uint64_t _viewEnd;
+    NSUInteger _inputStart;              // typed input begins here
+}
 @property (nonatomic, strong) NSWindow *terminalWindow;
 @property (nonatomic, strong) NSTextView *outputView;
 @property (nonatomic, strong) NSString *currentDirectory;
-@property (nonatomic, strong) NSMutableString *outputBuffer;
+@property (nonatomic, strong) NSDictionary *defaultAttributes;
+@property (nonatomic, strong) id keyMonitor;
 @end
 
 @implementation TerminalWindow
@@ -22,7 +36,18 @@
     self = [super init];
     if (self) {
         self.currentDirectory = NSHomeDirectory();
-        self.outputBuffer = [NSMutableString string];
+        self.defaultAttributes = @{
+            NSForegroundColorAttributeName: [NSColor colorWithRed:0.0 green:0.9 blue:0.4 alpha:1.0],
+            NSFontAttributeName: [NSFont fontWithName:@"Menlo" size:12]
+        };
+        
+        // Output arrives on the runner's I/O thread; drain it on the main one
+        __weak TerminalWindow *weakSelf = self;
+        _runner.setNotify([weakSelf](uint32_t session) {
+            dispatch_async(dispatch_get_main_queue(), ^{
+                [weakSelf drainSession:session];
+            });
+        });
     }
     return self;
 }
@@ -92,6 +117,11 @@
     scrollView.documentView = self.outputView;
     [contentView addSubview:scrollView];
     
+    // A new view starts empty; the next sync fills it from the scrollback
+    _lineLengths.clear();
+    _viewFirst = _viewEnd = _buffer.firstLine();
+    _inputStart = 0;
+    
     // Welcome message with color
     NSString *welcomeMsg = [NSString stringWithFormat:
         @"\033[1;36m╭─────────────────────────────────────────────╮\033[0m\n"
@@ -105,42 +135,83 @@
     
     [self appendOutput:welcomeMsg];
     
+    // Ctrl-C interrupts the running command
+    if (!self.keyMonitor) {
+        __weak TerminalWindow *weakSelf = self;
+        self.keyMonitor = [NSEvent addLocalMonitorForEventsMatchingMask:NSEventMaskKeyDown handler:^NSEvent *(NSEvent *event) {
+            if (event.window == weakSelf.terminalWindow &&
+                (event.modifierFlags & NSEventModifierFlagControl) &&
+                [event.charactersIgnoringModifiers isEqualToString:@"c"]) {
+                [weakSelf interruptCommand];
+                return nil;
+            }
+            return event;
+        }];
+    }
+    
     [self.terminalWindow makeKeyAndOrderFront:nil];
     [self.terminalWindow makeFirstResponder:self.outputView];
 }
 
 - (BOOL)textView:(NSTextView *)textView doCommandBySelector:(SEL)commandSelector {
     if (commandSelector == @selector(insertNewline:)) {
-        // Get the last line as the command
-        NSString *text = textView.string;
-        NSArray *lines = [text componentsSeparatedByString:@"\n"];
-        NSString *lastLine = lines.lastObject ?: @"";
+        NSString *input = [self takeInput];
         
-        // Extract command after prompt
-        NSRange promptRange = [lastLine rangeOfString:@"$ "];
-        if (promptRange.location != NSNotFound) {
-            NSString *command = [lastLine substringFromIndex:promptRange.location + 2];
-            command = [command stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceAndNewlineCharacterSet]];
-            
-            [self appendOutput:@"\n"];
+        if (_session) {
+            // A command is running: the line is its input (the pty echoes it)
+            NSString *line = [input stringByAppendingString:@"\n"];
+            _runner.sendInput(_session, line.UTF8String, strlen(line.UTF8String));
+            return YES;
+        }
+        
+        // The command moves into the scrollback as an echo
+        [self appendOutput:[input stringByAppendingString:@"\n"]];
+        
+        NSString *command = [input stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceAndNewlineCharacterSet]];
+        if (command.length > 0) {
+            NSArray *parts = [command componentsSeparatedByCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+            parts = [parts filteredArrayUsingPredicate:[NSPredicate predicateWithFormat:@"length > 0"]];
+            NSString *cmd = parts.count > 0 ? parts[0] : @"";
+            NSArray *args = parts.count > 1 ? [parts subarrayWithRange:NSMakeRange(1, parts.count - 1)] : @[];
             
-            if (command.length > 0) {
-                NSArray *parts = [command componentsSeparatedByCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
-                parts = [parts filteredArrayUsingPredicate:[NSPredicate predicateWithFormat:@"length > 0"]];
-                NSString *cmd = parts.count > 0 ? parts[0] : @"";
-                NSArray *args = parts.count > 1 ? [parts subarrayWithRange:NSMakeRange(1, parts.count - 1)] : @[];
-                
-                NSString *output = [self processCommand:cmd withArgs:args];
-                [self appendOutput:output];
+            NSString *output = [self processCommand:cmd withArgs:args];
+            if (!output) {
+                return YES; // the prompt returns when the command finishes
             }
-            
-            [self appendOutput:[NSString stringWithFormat:@"%@$ ", [self shortPath]]];
+            [self appendOutput:output];
         }
+        
+        [self appendOutput:[NSString stringWithFormat:@"%@$ ", [self shortPath]]];
         return YES;
     }
     return NO;
 }
 
+// Removes and returns whatever was typed after the last output.
+- (NSString *)takeInput {
+    NSTextStorage *storage = self.outputView.textStorage;
+    NSUInteger start = MIN(_inputStart, storage.length);
+    NSRange inputRange = NSMakeRange(start, storage.length - start);
+    NSString *input = [storage.string substringWithRange:inputRange];
+    [storage deleteCharactersInRange:inputRange];
+    return input;
+}
+
+- (void)interruptCommand {
+    if (_session) {
+        _runner.interrupt(_session);
+        return;
+    }
+    // At the prompt, like a shell: abandon the line
+    [self appendOutput:[[self takeInput] stringByAppendingString:@"^C\n"]];
+    [self appendOutput:[NSString stringWithFormat:@"%@$ ", [self shortPath]]];
+}
+
+- (BOOL)textView:(NSTextView *)textView shouldChangeTextInRange:(NSRange)affectedCharRange replacementString:(NSString *)replacementString {
+    // Output is read-only; only the input after the prompt can be edited
+    return affectedCharRange.location >= _inputStart;
+}
+
 - (NSString *)shortPath {
     NSString *home = NSHomeDirectory();
     if ([self.currentDirectory hasPrefix:home]) {
@@ -150,20 +221,168 @@
 }
 
 - (void)appendOutput:(NSString *)text {
-    [self.outputBuffer appendString:text];
+    const char *bytes = text.UTF8String;
+    if (bytes) {
+        _buffer.write(bytes, strlen(bytes));
+    }
+    [self syncOutput];
+}
+
+#pragma mark - Scrollback Rendering
+
+// Bring the text view up to date with the buffer. Only lines that scrolled
+// out are removed and only the open line and new lines are redrawn, so the
+// cost follows the amount of new output, not the length of the history.
+- (void)syncOutput {
+    if (!self.outputView) {
+        return;
+    }
+    NSTextStorage *storage = self.outputView.textStorage;
+    OS::System::TermUpdate update = _buffer.takeUpdate();
     
-    NSMutableAttributedString *attrStr = [[NSMutableAttributedString alloc] initWithString:self.outputBuffer];
-    [attrStr addAttribute:NSForegroundColorAttributeName
-                    value:[NSColor colorWithRed:0.0 green:0.9 blue:0.4 alpha:1.0]
-                    range:NSMakeRange(0, attrStr.length)];
-    [attrStr addAttribute:NSFontAttributeName
-                    value:[NSFont fontWithName:@"Menlo" size:12]
-                    range:NSMakeRange(0, attrStr.length)];
+    [storage beginEditing];
     
-    [self.outputView.textStorage setAttributedString:attrStr];
+    // Set aside anything typed at the prompt
+    NSRange inputRange = NSMakeRange(MIN(_inputStart, storage.length), storage.length - MIN(_inputStart, storage.length));
+    NSAttributedString *input = [storage attributedSubstringFromRange:inputRange];
+    [storage deleteCharactersInRange:inputRange];
+    
+    if (update.reset) {
+        [storage deleteCharactersInRange:NSMakeRange(0, storage.length)];
+        _lineLengths.clear();
+        _viewFirst = _viewEnd = update.first;
+    }
+    
+    // Lines that fell out of the scrollback
+    NSUInteger trimmed = 0;
+    while (_viewFirst < update.first && _viewFirst < _viewEnd) {
+        trimmed += _lineLengths.front();
+        _lineLengths.pop_front();
+        _viewFirst++;
+    }
+    if (_viewFirst < update.first) {
+        _viewFirst = _viewEnd = update.first;
+    }
+    [storage deleteCharactersInRange:NSMakeRange(0, trimmed)];
+    
+    // Lines that changed (usually just the one that was still open) and any
+    // the view never had
+    uint64_t changed = MIN(MAX(update.changed, _viewFirst), _viewEnd);
+    NSUInteger removed = 0;
+    while (_viewEnd > changed) {
+        removed += _lineLengths.back();
+        _lineLengths.pop_back();
+        _viewEnd--;
+    }
+    [storage deleteCharactersInRange:NSMakeRange(storage.length - removed, removed)];
+    
+    for (uint64_t seq = changed; seq < update.end; seq++) {
+        NSAttributedString *line = [self attributedLine:_buffer.line(seq) open:(seq + 1 == update.end)];
+        [storage appendAttributedString:line];
+        _lineLengths.push_back(line.length);
+    }
+    _viewEnd = update.end;
+    
+    _inputStart = storage.length;
+    [storage appendAttributedString:input];
+    [storage endEditing];
+    
+    self.outputView.typingAttributes = self.defaultAttributes;
     [self.outputView scrollToEndOfDocument:nil];
 }
 
+- (NSAttributedString *)attributedLine:(const OS::System::TermLine *)line open:(BOOL)open {
+    NSMutableAttributedString *result = [[NSMutableAttributedString alloc] init];
+    for (size_t i = 0; i < line->runs.size(); i++) {
+        size_t start = line->runs[i].start;
+        size_t end = i + 1 < line->runs.size() ? line->runs[i + 1].start : line->text.size();
+        NSString *piece = [[NSString alloc] initWithBytes:line->text.data() + start length:end - start encoding:NSUTF8StringEncoding];
+        if (!piece) {
+            // An incomplete UTF-8 sequence at the end of a chunk
+            piece = [[NSString alloc] initWithBytes:line->text.data() + start length:end - start encoding:NSISOLatin1StringEncoding];
+        }
+        [result appendAttributedString:[[NSAttributedString alloc] initWithString:piece
+                                                                       attributes:[self attributesForTerm:line->runs[i].attributes]]];
+    }
+    if (!open && !line->wrapped) {
+        [result appendAttributedString:[[NSAttributedString alloc] initWithString:@"\n" attributes:self.defaultAttributes]];
+    }
+    return result;
+}
+
+- (NSColor *)colorForTerm:(uint32_t)color fallback:(NSColor *)fallback {
+    static const uint8_t ansi[16][3] = {
+        {0, 0, 0}, {205, 49, 49}, {13, 188, 121}, {229, 229, 16},
+        {36, 114, 200}, {188, 63, 188}, {17, 168, 205}, {229, 229, 229},
+        {102, 102, 102}, {241, 76, 76}, {35, 209, 139}, {245, 245, 67},
+        {59, 142, 234}, {214, 112, 214}, {41, 184, 219}, {255, 255, 255}
+    };
+    uint32_t r, g, b;
+    if ((color & 0xFF000000) == OS::System::kTermColorRGB) {
+        r = (color >> 16) & 0xFF;
+        g = (color >> 8) & 0xFF;
+        b = color & 0xFF;
+    } else if ((color & 0xFF000000) == OS::System::kTermColorIndexed) {
+        uint32_t index = color & 0xFF;
+        if (index < 16) {
+            r = ansi[index][0];
+            g = ansi[index][1];
+            b = ansi[index][2];
+        } else if (index < 232) {
+            // 6x6x6 colour cube
+            static const uint8_t levels[6] = {0, 95, 135, 175, 215, 255};
+            index -= 16;
+            r = levels[index / 36];
+            g = levels[(index / 6) % 6];
+            b = levels[index % 6];
+        } else {
+            r = g = b = 8 + (index - 232) * 10;
+        }
+    } else {
+        return fallback;
+    }
+    return [NSColor colorWithRed:r / 255.0 green:g / 255.0 blue:b / 255.0 alpha:1.0];
+}
+
+- (NSDictionary *)attributesForTerm:(const OS::System::TermAttributes &)attributes {
+    if (attributes.fg == OS::System::kTermColorDefault && attributes.bg == OS::System::kTermColorDefault && attributes.style == 0) {
+        return self.defaultAttributes;
+    }
+    NSColor *foreground = [self colorForTerm:attributes.fg fallback:self.defaultAttributes[NSForegroundColorAttributeName]];
+    NSColor *background = [self colorForTerm:attributes.bg fallback:nil];
+    if (attributes.style & OS::System::kTermInverse) {
+        NSColor *swap = background ?: self.outputView.backgroundColor;
+        background = foreground;
+        foreground = swap;
+    }
+    if (attributes.style & OS::System::kTermDim) {
+        foreground = [foreground colorWithAlphaComponent:0.6];
+    }
+    
+    NSFont *font = self.defaultAttributes[NSFontAttributeName];
+    if (attributes.style & OS::System::kTermBold) {
+        font = [[NSFontManager sharedFontManager] convertFont:font toHaveTrait:NSBoldFontMask];
+    }
+    if (attributes.style & OS::System::kTermItalic) {
+        font = [[NSFontManager sharedFontManager] convertFont:font toHaveTrait:NSItalicFontMask];
+    }
+    
+    NSMutableDictionary *result = [NSMutableDictionary dictionaryWithDictionary:@{
+        NSForegroundColorAttributeName: foreground,
+        NSFontAttributeName: font
+    }];
+    if (background) {
+        result[NSBackgroundColorAttributeName] = background;
+    }
+    if (attributes.style & OS::System::kTermUnderline) {
+        result[NSUnderlineStyleAttributeName] = @(NSUnderlineStyleSingle);
+    }
+    if (attributes.style & OS::System::kTermStrike) {
+        result[NSStrikethroughStyleAttributeName] = @(NSUnderlineStyleSingle);
+    }
+    return result;
+}
+
 - (NSString *)processCommand:(NSString *)cmd withArgs:(NSArray *)args {
     // Built-in commands
     if ([cmd isEqualToString:@"cd"]) {
@@ -190,8 +409,7 @@
         }
     }
     else if ([cmd isEqualToString:@"clear"]) {
-        self.outputBuffer = [NSMutableString string];
-        [self.outputView setString:@""];
+        _buffer.clear();
         return @"";
     }
     else if ([cmd isEqualToString:@"exit"]) {
@@ -200,22 +418,26 @@
         return @"";
     }
     
-    // Execute real shell command
-    return [self executeShellCommand:cmd withArgs:args];
+    // Execute real shell command; nil means it is running
+    if ([self startShellCommand:cmd withArgs:args]) {
+        return nil;
+    }
+    return [NSString stringWithFormat:@"command not found: %@\n", cmd];
 }
 
-- (NSString *)executeShellCommand:(NSString *)cmd withArgs:(NSArray *)args {
-    NSTask *task = [[NSTask alloc] init];
-    task.executableURL = [NSURL fileURLWithPath:@"/bin/zsh"];
-    
+// Starts the command on a pseudo-terminal and returns at once; output is
+// streamed in by drainSession:.
+- (BOOL)startShellCommand:(NSString *)cmd withArgs:(NSArray *)args {
     // Build the full command
     NSMutableString *fullCommand = [NSMutableString stringWithString:cmd];
     for (NSString *arg in args) {
         [fullCommand appendFormat:@" %@", arg];
     }
     
-    task.arguments = @[@"-c", fullCommand];
-    task.currentDirectoryURL = [NSURL fileURLWithPath:self.currentDirectory];
+    OS::System::ProcessOptions options;
+    options.program = "/bin/zsh";
+    options.args = {"-c", fullCommand.UTF8String};
+    options.cwd = self.currentDirectory.UTF8String;
     
     // Set up environment
     NSMutableDictionary *env = [NSMutableDictionary dictionaryWithDictionary:[[NSProcessInfo processInfo] environment]];
@@ -223,44 +445,54 @@
     env[@"USER"] = NSUserName();
     env[@"TERM"] = @"xterm-256color";
     env[@"PATH"] = @"/usr/local/bin:/usr/bin:/bin:/usr/sbin:/sbin:/opt/homebrew/bin";
-    task.environment = env;
+    for (NSString *key in env) {
+        options.env.push_back([NSString stringWithFormat:@"%@=%@", key, env[key]].UTF8String);
+    }
     
-    NSPipe *outputPipe = [NSPipe pipe];
-    NSPipe *errorPipe = [NSPipe pipe];
-    task.standardOutput = outputPipe;
-    task.standardError = errorPipe;
+    // Size the tty to the view
+    NSSize cell = [@"M" sizeWithAttributes:self.defaultAttributes];
+    NSSize area = self.outputView.enclosingScrollView.contentSize;
+    if (cell.width > 0 && cell.height > 0) {
+        options.cols = (uint16_t)MAX(20, (area.width - 24) / cell.width);
+        options.rows = (uint16_t)MAX(5, (area.height - 20) / cell.height);
+    }
     
-    @try {
-        NSError *error = nil;
-        [task launchAndReturnError:&error];
-        if (error) {
-            return [NSString stringWithFormat:@"Error: %@\n", error.localizedDescription];
-        }
-        [task waitUntilExit];
-        
-        NSData *outputData = [outputPipe.fileHandleForReading readDataToEndOfFile];
-        NSData *errorData = [errorPipe.fileHandleForReading readDataToEndOfFile];
-        
-        NSString *output = [[NSString alloc] initWithData:outputData encoding:NSUTF8StringEncoding];
-        NSString *errorOutput = [[NSString alloc] initWithData:errorData encoding:NSUTF8StringEncoding];
-        
-        NSMutableString *result = [NSMutableString string];
-        if (output.length > 0) {
-            [result appendString:output];
-        }
-        if (errorOutput.length > 0) {
-            [result appendString:errorOutput];
-        }
-        
-        // Ensure newline at end
-        if (result.length > 0 && ![result hasSuffix:@"\n"]) {
-            [result appendString:@"\n"];
-        }
-        
-        return result;
-    } @catch (NSException *e) {
-        return [NSString stringWithFormat:@"command not found: %@\n", cmd];
+    _session = _runner.spawn(options);
+    return _session != 0;
+}
+
+- (void)drainSession:(uint32_t)session {
+    // A bounded slice per pass keeps the UI responsive; the runner stops
+    // reading the pty while its queue is full, which throttles the command
+    std::string chunk;
+    if (_runner.read(session, chunk, kDrainSlice) > 0) {
+        _buffer.write(chunk.data(), chunk.size());
+        [self syncOutput];
+    }
+    if (chunk.size() == kDrainSlice) {
+        __weak TerminalWindow *weakSelf = self;
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [weakSelf drainSession:session];
+        });
+        return;
+    }
+    
+    int status = 0;
+    if (!_runner.finished(session, status)) {
+        return;
+    }
+    _runner.release(session);
+    if (session != _session) {
+        return;
+    }
+    _session = 0;
+    
+    // Ensure newline at end
+    const OS::System::TermLine *last = _buffer.line(_buffer.endLine() - 1);
+    if (last && !last->text.empty()) {
+        _buffer.write("\n", 1);
     }
+    [self appendOutput:[NSString stringWithFormat:@"%@$ ", [self shortPath]]];
 }
 
 @end
@@ -0,0 +1,1283 @@
+// gfxtool - checks and benchmarks for the software graphics pipeline
+//
+//   gfxtool test                 pixel-exactness and allocation-count
+//                                checks (exit status 1 on any failure)
+//   gfxtool bench spans          megapixels/s per primitive and span backend
+//   gfxtool bench damage         frame time of damage-tracked redraw against
+//                                a full repaint
+//   gfxtool bench hittest        hit-test, drag, raise and rect query cost
+//                                with 10K windows, against a linear scan
+//   gfxtool bench tiles [threads] full-screen frame time of the tile renderer
+//                                from 1 thread up to `threads` (default: all
+//                                CPUs) against immediate mode
+
+#include "graphics.h"
+#include "os_config.h"
+#include "frame_arena.h"
+#include "spatial_index.h"
+#include "span_fill.h"
+#include "thread_pool.h"
+#include "tile_renderer.h"
+#include "utils.h"
+#include "window_c.h"
+#include "blur.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <mach/mach.h>
+#include <malloc/malloc.h>
+#endif
+
+// ============================================================================
+// Helpers
+// ============================================================================
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// xorshift64*, so every run draws the same scenes.
+static uint64_t next_random(uint64_t *state) {
+  uint64_t x = *state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *state = x;
+  return x * 0x2545f4914f6cdd1dull;
+}
+
+static int32_t random_range(uint64_t *state, int32_t lo, int32_t hi) {
+  return lo + (int32_t)(next_random(state) % (uint64_t)(hi - lo + 1));
+}
+
+static Color random_color(uint64_t *state, bool translucent) {
+  uint64_t r = next_random(state);
+  uint8_t alpha = translucent ? (uint8_t)(r >> 32) : 255;
+  return (Color){alpha, (uint8_t)r, (uint8_t)(r >> 8), (uint8_t)(r >> 16)};
+}
+
+// A standalone surface; graphics_init's context is a singleton and the
+// checks need several to compare.
+static GraphicsContext *context_create(uint32_t width, uint32_t height) {
+  GraphicsContext *ctx = (GraphicsContext *)calloc(1, sizeof(GraphicsContext));
+  if (!ctx) {
+    return NULL;
+  }
+  ctx->width = width;
+  ctx->height = height;
+  ctx->bits_per_pixel = 32;
+  ctx->framebuffer = calloc((size_t)width * height, sizeof(uint32_t));
+  if (!ctx->framebuffer) {
+    free(ctx);
+    return NULL;
+  }
+  graphics_reset_clip(ctx);
+  return ctx;
+}
+
+static void context_destroy(GraphicsContext *ctx) {
+  if (ctx) {
+    free(ctx->framebuffer);
+    free(ctx);
+  }
+}
+
+static size_t context_bytes(const GraphicsContext *ctx) {
+  return (size_t)ctx->width * ctx->height * sizeof(uint32_t);
+}
+
+static void context_fill(GraphicsContext *ctx, uint32_t argb) {
+  uint32_t *pixels = (uint32_t *)ctx->framebuffer;
+  for (size_t i = 0; i < (size_t)ctx->width * ctx->height; i++) {
+    pixels[i] = argb;
+  }
+}
+
+static int g_failures;
+static volatile uint64_t g_sink; // keeps timed loops from being optimized away
+
+static void check(bool ok, const char *name) {
+  printf("%s %s\n", ok ? "PASS" : "FAIL", name);
+  if (!ok) {
+    g_failures++;
+  }
+}
+
+// ============================================================================
+// Span backends
+// ============================================================================
+
+typedef enum {
+  PRIM_RECT,
+  PRIM_ROUNDED_RECT,
+  PRIM_CIRCLE,
+  PRIM_RECT_OUTLINE,
+  PRIM_COUNT
+} Primitive;
+
+static const char *const PRIMITIVE_NAMES[PRIM_COUNT] = {
+    "draw_rect", "draw_rounded_rect", "draw_circle", "draw_rect_outline"};
+
+static void draw_primitive(GraphicsContext *ctx, Primitive prim, OSRect r,
+                           Color color) {
+  switch (prim) {
+  case PRIM_RECT:
+    draw_rect(ctx, r, color);
+    break;
+  case PRIM_ROUNDED_RECT:
+    draw_rounded_rect(ctx, r, r.width / 8, color);
+    break;
+  case PRIM_CIRCLE:
+    draw_circle(ctx, r.x + r.width / 2, r.y + r.height / 2,
+                (uint32_t)(r.width < r.height ? r.width : r.height) / 2,
+                color);
+    break;
+  case PRIM_RECT_OUTLINE:
+    draw_rect_outline(ctx, r, 1 + r.width / 64, color);
+    break;
+  case PRIM_COUNT:
+    break;
+  }
+}
+
+// Draws the same random scene of every primitive (opaque and translucent,
+// partly off-surface, under random clips) through the given backend.
+static void draw_span_scene(GraphicsContext *ctx, SpanBackend backend) {
+  span_set_backend(backend);
+  context_fill(ctx, 0xff202020);
+  uint64_t state = 0x5eed;
+  for (int i = 0; i < 2000; i++) {
+    Primitive prim = (Primitive)(i % PRIM_COUNT);
+    OSRect r = {random_range(&state, -50, (int32_t)ctx->width),
+                random_range(&state, -50, (int32_t)ctx->height),
+                random_range(&state, 1, 300), random_range(&state, 1, 300)};
+    if (i % 7 == 0) {
+      graphics_set_clip(ctx, (OSRect){random_range(&state, 0, 200),
+                                      random_range(&state, 0, 200),
+                                      random_range(&state, 50, 400),
+                                      random_range(&state, 50, 400)});
+    }
+    draw_primitive(ctx, prim, r, random_color(&state, i % 3 != 0));
+    if (i % 7 == 6) {
+      graphics_reset_clip(ctx);
+    }
+  }
+  graphics_reset_clip(ctx);
+}
+
+static void test_span_backends(void) {
+  GraphicsContext *scalar = context_create(640, 480);
+  GraphicsContext *simd = context_create(640, 480);
+  if (!scalar || !simd) {
+    check(false, "span backends: allocation");
+    context_destroy(scalar);
+    context_destroy(simd);
+    return;
+  }
+  draw_span_scene(scalar, SPAN_BACKEND_SCALAR);
+  for (SpanBackend b = SPAN_BACKEND_SSE2; b <= SPAN_BACKEND_AVX2; b++) {
+    char name[96];
+    if (span_set_backend(b) != b) {
+      snprintf(name, sizeof(name), "span backend %s: not supported, skipped",
+               span_backend_name(b));
+      printf("SKIP %s\n", name);
+      continue;
+    }
+    draw_span_scene(simd, b);
+    snprintf(name, sizeof(name), "span backend %s matches scalar",
+             span_backend_name(b));
+    check(memcmp(scalar->framebuffer, simd->framebuffer,
+                 context_bytes(scalar)) == 0,
+          name);
+  }
+  span_init();
+  context_destroy(scalar);
+  context_destroy(simd);
+}
+
+static void bench_spans(void) {
+  GraphicsContext *ctx = context_create(DISPLAY_WIDTH, DISPLAY_HEIGHT);
+  if (!ctx) {
+    fprintf(stderr, "gfxtool: out of memory\n");
+    return;
+  }
+  OSRect shapes[64];
+  uint64_t state = 42;
+  int64_t area = 0;
+  for (int i = 0; i < 64; i++) {
+    shapes[i] = (OSRect){random_range(&state, 0, DISPLAY_WIDTH - 640),
+                         random_range(&state, 0, DISPLAY_HEIGHT - 480),
+                         random_range(&state, 64, 640),
+                         random_range(&state, 64, 480)};
+    area += (int64_t)shapes[i].width * shapes[i].height;
+  }
+  printf("%-18s %-8s %12s %12s\n", "primitive", "backend", "opaque MP/s",
+         "blend MP/s");
+  for (int p = 0; p < PRIM_COUNT; p++) {
+    for (SpanBackend b = SPAN_BACKEND_SCALAR; b <= SPAN_BACKEND_AVX2; b++) {
+      if (span_set_backend(b) != b) {
+        continue;
+      }
+      double rates[2];
+      for (int blend = 0; blend < 2; blend++) {
+        Color color = {blend ? 128 : 255, 200, 100, 50};
+        uint64_t start = now_ns();
+        int rounds = 0;
+        do {
+          for (int i = 0; i < 64; i++) {
+            draw_primitive(ctx, (Primitive)p, shapes[i], color);
+          }
+          rounds++;
+        } while (now_ns() - start < 200000000ull);
+        double seconds = (double)(now_ns() - start) / 1e9;
+        // Bounding-box pixels, so the figures compare across backends
+        // rather than across primitives.
+        rates[blend] = (double)area * rounds / seconds / 1e6;
+      }
+      printf("%-18s %-8s %12.0f %12.0f\n", PRIMITIVE_NAMES[p],
+             span_backend_name(b), rates[0], rates[1]);
+    }
+  }
+  span_init();
+  context_destroy(ctx);
+}
+
+// ============================================================================
+// Lines
+// ============================================================================
+
+// The line a plain walk over every step draws: step t of n lands on minor
+// offset round(t * d / n), halves up. Only for endpoints close enough that
+// the products fit.
+static void reference_line(GraphicsContext *ctx, int32_t x1, int32_t y1,
+                           int32_t x2, int32_t y2, uint32_t argb) {
+  int64_t dx = (int64_t)x2 - x1, dy = (int64_t)y2 - y1;
+  int64_t adx = dx < 0 ? -dx : dx, ady = dy < 0 ? -dy : dy;
+  bool steep = ady > adx;
+  int64_t n = steep ? ady : adx, d = steep ? adx : ady;
+  for (int64_t t = 0; t <= n; t++) {
+    int64_t k = n ? (2 * t * d + n) / (2 * n) : 0;
+    int64_t x = x1 + (steep ? (dx < 0 ? -k : k) : (dx < 0 ? -t : t));
+    int64_t y = y1 + (steep ? (dy < 0 ? -t : t) : (dy < 0 ? -k : k));
+    if (x >= ctx->clip.x && x < ctx->clip.x + ctx->clip.width &&
+        y >= ctx->clip.y && y < ctx->clip.y + ctx->clip.height) {
+      ((uint32_t *)ctx->framebuffer)[y * ctx->width + x] = argb;
+    }
+  }
+}
+
+static void test_lines(void) {
+  GraphicsContext *ctx = context_create(640, 480);
+  GraphicsContext *reference = context_create(640, 480);
+  if (!ctx || !reference) {
+    check(false, "lines: allocation");
+    context_destroy(ctx);
+    context_destroy(reference);
+    return;
+  }
+  // Clipped walks against the full walk, with endpoints well off-surface.
+  uint64_t state = 11;
+  bool same = true;
+  for (int i = 0; i < 2000 && same; i++) {
+    int32_t x1 = random_range(&state, -3000, 3000);
+    int32_t y1 = random_range(&state, -3000, 3000);
+    int32_t x2 = i % 5 == 0 ? x1 : random_range(&state, -3000, 3000);
+    int32_t y2 = i % 7 == 0 ? y1 : random_range(&state, -3000, 3000);
+    OSRect clip = {random_range(&state, -20, 500),
+                   random_range(&state, -20, 400),
+                   random_range(&state, 1, 400), random_range(&state, 1, 300)};
+    graphics_set_clip(ctx, clip);
+    graphics_set_clip(reference, clip);
+    context_fill(ctx, 0);
+    context_fill(reference, 0);
+    draw_line(ctx, x1, y1, x2, y2, (Color){255, 255, 255, 255});
+    reference_line(reference, x1, y1, x2, y2, 0xffffffffu);
+    same = memcmp(ctx->framebuffer, reference->framebuffer,
+                  context_bytes(ctx)) == 0;
+  }
+  graphics_reset_clip(ctx);
+  check(same, "lines: clipped walks match the full walk");
+
+  // Endpoints at the ends of int32: exact pixels, and no walking the
+  // four billion steps off-surface.
+  const Color white = {255, 255, 255, 255};
+  uint64_t start = now_ns();
+  context_fill(ctx, 0);
+  draw_line(ctx, INT32_MIN, INT32_MIN, INT32_MAX, INT32_MAX, white);
+  bool diagonal = true;
+  for (int32_t y = 0; y < 480; y++) {
+    for (int32_t x = 0; x < 640; x++) {
+      uint32_t p = ((uint32_t *)ctx->framebuffer)[y * 640 + x];
+      diagonal &= p == (x == y ? 0xffffffffu : 0);
+    }
+  }
+  context_fill(ctx, 0);
+  draw_line(ctx, INT32_MAX, 7, INT32_MIN, 7, white);
+  draw_line(ctx, 9, INT32_MIN, 9, INT32_MAX, white);
+  bool axes = true;
+  for (int32_t y = 0; y < 480; y++) {
+    for (int32_t x = 0; x < 640; x++) {
+      uint32_t p = ((uint32_t *)ctx->framebuffer)[y * 640 + x];
+      axes &= p == (x == 9 || y == 7 ? 0xffffffffu : 0);
+    }
+  }
+  // Half a pixel of y per x through the origin: row (x + 1) / 2 of column x.
+  context_fill(ctx, 0);
+  draw_line(ctx, -2000000000, -1000000000, 2000000000, 1000000000, white);
+  bool shallow = true;
+  for (int32_t y = 0; y < 480; y++) {
+    for (int32_t x = 0; x < 640; x++) {
+      uint32_t p = ((uint32_t *)ctx->framebuffer)[y * 640 + x];
+      shallow &= p == (y == (x + 1) / 2 ? 0xffffffffu : 0);
+    }
+  }
+  for (int i = 0; i < 1000; i++) {
+    draw_line(ctx, INT32_MIN + i, -2000000000, INT32_MAX - i, 2000000000 - i,
+              white);
+  }
+  double ms = (double)(now_ns() - start) / 1e6;
+  check(diagonal, "lines: INT32_MIN..INT32_MAX diagonal is exactly x == y");
+  check(axes, "lines: full-range horizontal and vertical lines");
+  check(shallow, "lines: far shallow line lands on the exact rows");
+  char name[96];
+  snprintf(name, sizeof(name),
+           "lines: 1000 full-range lines in %.1f ms (limit 500)", ms);
+  check(ms < 500.0, name);
+  context_destroy(ctx);
+  context_destroy(reference);
+}
+
+// ============================================================================
+// Damage tracking
+// ============================================================================
+
+// graphics_init's context: render_all presents (and ends the frame) only on
+// that one.
+static GraphicsContext *screen(void) {
+  return graphics_init(DISPLAY_WIDTH, DISPLAY_HEIGHT);
+}
+
+static CWindowManager *desktop_create(uint32_t windows, uint64_t seed,
+                                      CWindow **out) {
+  CWindowManager *manager = window_manager_create(64);
+  uint64_t state = seed;
+  for (uint32_t i = 0; manager && i < windows; i++) {
+    OSRect bounds = {random_range(&state, -100, DISPLAY_WIDTH - 200),
+                     random_range(&state, 0, DISPLAY_HEIGHT - 200),
+                     random_range(&state, 200, 900),
+                     random_range(&state, 150, 700)};
+    uint32_t flags = WINDOW_FLAG_TITLED | (i % 3 ? WINDOW_FLAG_SHADOW : 0);
+    out[i] = window_create(manager, "window", bounds, flags);
+    out[i]->background_color = random_color(&state, i % 5 == 4);
+  }
+  return manager;
+}
+
+// Repaints the whole screen into a scratch surface for comparison.
+static bool matches_full_repaint(CWindowManager *manager, GraphicsContext *ctx,
+                                 GraphicsContext *reference) {
+  manager->full_damage = true;
+  OSRegion pending = manager->damage; // keep what on_draw queued
+  region_init(&manager->damage);
+  window_manager_render_all(manager, reference);
+  region_destroy(&manager->damage);
+  manager->damage = pending;
+  return memcmp(ctx->framebuffer, reference->framebuffer,
+                context_bytes(ctx)) == 0;
+}
+
+static CWindow *g_animated;
+static uint32_t g_on_draw_calls;
+
+// An animating window: every paint asks for another one next frame, and
+// pokes a rect elsewhere so the damage list is reshaped mid-walk.
+static void animated_on_draw(CWindow *window) {
+  g_on_draw_calls++;
+  window_invalidate(window);
+  window_manager_invalidate(window->manager, (OSRect){5, 5, 40, 40});
+}
+
+static void test_damage(void) {
+  GraphicsContext *ctx = screen();
+  GraphicsContext *reference = context_create(ctx->width, ctx->height);
+  CWindow *windows[24];
+  CWindowManager *manager = desktop_create(24, 7, windows);
+  if (!reference || !manager) {
+    check(false, "damage: allocation");
+    context_destroy(reference);
+    window_manager_destroy(manager);
+    return;
+  }
+  window_manager_render_all(manager, ctx);
+
+  bool same = true;
+  uint64_t state = 11;
+  for (int frame = 0; frame < 60 && same; frame++) {
+    CWindow *w = windows[next_random(&state) % 24];
+    switch (frame % 4) {
+    case 0:
+      window_move(w, w->bounds.x + random_range(&state, -80, 80),
+                  w->bounds.y + random_range(&state, -80, 80));
+      break;
+    case 1:
+      window_focus(manager, w);
+      break;
+    case 2:
+      window_resize(w, (uint32_t)random_range(&state, 200, 700),
+                    (uint32_t)random_range(&state, 150, 500));
+      break;
+    default:
+      window_set_state(w, w->state == WINDOW_STATE_NORMAL
+                              ? WINDOW_STATE_MINIMIZED
+                              : WINDOW_STATE_NORMAL);
+      break;
+    }
+    window_manager_render_all(manager, ctx);
+    same = matches_full_repaint(manager, ctx, reference);
+  }
+  check(same, "damage: partial redraws match a full repaint");
+
+  // on_draw invalidating while render_all walks the damage list.
+  g_animated = windows[3];
+  g_animated->on_draw = animated_on_draw;
+  window_set_state(g_animated, WINDOW_STATE_NORMAL);
+  window_focus(manager, g_animated);
+  bool queued = true;
+  same = true;
+  for (int frame = 0; frame < 5; frame++) {
+    g_on_draw_calls = 0;
+    window_manager_render_all(manager, ctx);
+    OSRect expect = rect_union(window_visual_bounds(g_animated),
+                               (OSRect){5, 5, 40, 40});
+    queued = queued && g_on_draw_calls > 0 &&
+             rect_area(region_bounds(&manager->damage)) >= rect_area(expect) &&
+             rect_area(region_bounds(&manager->damage)) <
+                 (int64_t)ctx->width * ctx->height;
+    same = same && matches_full_repaint(manager, ctx, reference);
+  }
+  check(queued, "damage: on_draw invalidations are kept for the next frame");
+  check(same, "damage: frames with on_draw invalidations match a full repaint");
+
+  window_manager_destroy(manager);
+  context_destroy(reference);
+}
+
+static void bench_damage(void) {
+  GraphicsContext *ctx = screen();
+  CWindow *windows[20];
+  CWindowManager *manager = desktop_create(20, 3, windows);
+  if (!ctx || !manager) {
+    fprintf(stderr, "gfxtool: out of memory\n");
+    return;
+  }
+  window_manager_render_all(manager, ctx);
+  printf("%ux%u, 20 windows, one window moves 8 px per frame\n", ctx->width,
+         ctx->height);
+  for (int full = 0; full < 2; full++) {
+    const int frames = full ? 50 : 500;
+    int64_t pixels = 0;
+    uint64_t start = now_ns();
+    for (int f = 0; f < frames; f++) {
+      CWindow *w = windows[f % 20];
+      window_move(w, w->bounds.x + (f & 16 ? -8 : 8), w->bounds.y);
+      if (full) {
+        manager->full_damage = true;
+        pixels += (int64_t)ctx->width * ctx->height;
+      } else {
+        pixels += region_area(&manager->damage);
+      }
+      window_manager_render_all(manager, ctx);
+    }
+    double ms = (double)(now_ns() - start) / 1e6 / frames;
+    printf("%-14s %8.3f ms/frame %10.0f px/frame\n",
+           full ? "full repaint" : "damage only", ms, (double)pixels / frames);
+  }
+  window_manager_destroy(manager);
+}
+
+// ============================================================================
+// Spatial index
+// ============================================================================
+
+typedef struct {
+  OSRect rect;
+  uint64_t z;
+  bool live;
+} ModelItem;
+
+static bool point_in(OSRect r, int32_t x, int32_t y) {
+  return x >= r.x && x < r.x + r.width && y >= r.y && y < r.y + r.height;
+}
+
+// Mostly window-sized, some tiny, some spanning more than
+// SPATIAL_MAX_ITEM_CELLS cells, some partly or wholly outside the world.
+static OSRect random_item_rect(uint64_t *state) {
+  int32_t kind = random_range(state, 0, 9);
+  int32_t w = kind == 0 ? random_range(state, 0, 8)
+              : kind == 1 ? random_range(state, 1200, 3000)
+                          : random_range(state, 40, 700);
+  int32_t h = kind == 0 ? random_range(state, 0, 8)
+              : kind == 1 ? random_range(state, 900, 2000)
+                          : random_range(state, 30, 500);
+  return (OSRect){random_range(state, -600, 2800), random_range(state, -400, 1800),
+                  w, h};
+}
+
+static bool model_top_at(const ModelItem *items, uint32_t count, int32_t x,
+                         int32_t y, uint32_t *id) {
+  bool found = false;
+  uint64_t best = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    if (items[i].live && point_in(items[i].rect, x, y) &&
+        (!found || items[i].z > best)) {
+      found = true;
+      best = items[i].z;
+      *id = i;
+    }
+  }
+  return found;
+}
+
+// Front to back by insertion into a z-sorted list; counts are small.
+static uint32_t model_query(const ModelItem *items, uint32_t count, OSRect rect,
+                            uint32_t *ids) {
+  uint32_t found = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    if (!items[i].live || !rect_intersects(items[i].rect, rect)) {
+      continue;
+    }
+    uint32_t at = found++;
+    while (at > 0 && items[ids[at - 1]].z < items[i].z) {
+      ids[at] = ids[at - 1];
+      at--;
+    }
+    ids[at] = i;
+  }
+  return found;
+}
+
+static void test_spatial_index(void) {
+  enum { ITEMS = 400, STEPS = 20000 };
+  OSRect world = {0, 0, DISPLAY_WIDTH, DISPLAY_HEIGHT};
+  SpatialIndex *index = spatial_index_create(world, 128);
+  ModelItem *items = (ModelItem *)calloc(ITEMS, sizeof(ModelItem));
+  uint32_t *want = (uint32_t *)malloc(ITEMS * sizeof(uint32_t));
+  uint32_t *got = (uint32_t *)malloc(ITEMS * sizeof(uint32_t));
+  if (!index || !items || !want || !got) {
+    check(false, "spatial index: allocation");
+    spatial_index_destroy(index);
+    free(items);
+    free(want);
+    free(got);
+    return;
+  }
+
+  uint64_t state = 19;
+  uint64_t next_z = 0;
+  uint32_t live = 0;
+  bool points = true, rects = true, counted = true;
+  for (int step = 0; step < STEPS && points && rects && counted; step++) {
+    uint32_t id = (uint32_t)(next_random(&state) % ITEMS);
+    ModelItem *item = &items[id];
+    switch (next_random(&state) % 8) {
+    case 0:
+    case 1: // insert, or replace an existing id
+      live += item->live ? 0 : 1;
+      item->rect = random_item_rect(&state);
+      item->z = ++next_z;
+      item->live = true;
+      spatial_index_insert(index, id, item->rect, item->z);
+      break;
+    case 2:
+      live -= item->live ? 1 : 0;
+      item->live = false;
+      spatial_index_remove(index, id);
+      break;
+    case 3: // resize, possibly into or out of the large list
+      if (item->live) {
+        OSRect r = random_item_rect(&state);
+        item->rect.width = r.width;
+        item->rect.height = r.height;
+        spatial_index_update(index, id, item->rect);
+      }
+      break;
+    case 4: // raise
+      if (item->live) {
+        item->z = ++next_z;
+        spatial_index_set_z(index, id, item->z);
+      }
+      break;
+    default: // drag
+      if (item->live) {
+        item->rect.x += random_range(&state, -150, 150);
+        item->rect.y += random_range(&state, -150, 150);
+        spatial_index_update(index, id, item->rect);
+      }
+      break;
+    }
+    counted = spatial_index_count(index) == live;
+
+    for (int q = 0; q < 8; q++) {
+      int32_t x = random_range(&state, -200, DISPLAY_WIDTH + 200);
+      int32_t y = random_range(&state, -200, DISPLAY_HEIGHT + 200);
+      uint32_t expect = 0, actual = 0;
+      bool expect_hit = model_top_at(items, ITEMS, x, y, &expect);
+      bool actual_hit = spatial_index_top_at(index, x, y, &actual);
+      points = points && expect_hit == actual_hit &&
+               (!expect_hit || expect == actual);
+    }
+    if (step % 4 == 0) {
+      OSRect r = {random_range(&state, -300, DISPLAY_WIDTH),
+                  random_range(&state, -300, DISPLAY_HEIGHT),
+                  random_range(&state, 1, 900), random_range(&state, 1, 700)};
+      uint32_t expect = model_query(items, ITEMS, r, want);
+      uint32_t actual = spatial_index_query(index, r, got, ITEMS);
+      rects = rects && expect == actual &&
+              memcmp(want, got, expect * sizeof(uint32_t)) == 0;
+      // A short buffer still gets the frontmost ones and the full count
+      if (rects && expect > 3) {
+        rects = spatial_index_query(index, r, got, 3) == expect &&
+                memcmp(want, got, 3 * sizeof(uint32_t)) == 0;
+      }
+    }
+  }
+  check(counted, "spatial index: count follows inserts, replaces and removes");
+  check(points, "spatial index: top_at matches a linear scan, inside and "
+                "outside the world");
+  check(rects, "spatial index: rect queries match a linear scan, front to "
+               "back");
+  spatial_index_destroy(index);
+
+  // The window manager's hit-testing against its own z-ordered list
+  CWindowManager *manager = window_manager_create(ITEMS);
+  CWindow **windows = (CWindow **)calloc(ITEMS, sizeof(CWindow *));
+  CWindow **found = (CWindow **)calloc(ITEMS, sizeof(CWindow *));
+  if (!manager || !windows || !found) {
+    check(false, "window hit-testing: allocation");
+  } else {
+    for (uint32_t i = 0; i < 200; i++) {
+      windows[i] = window_create(manager, "window", random_item_rect(&state),
+                                 WINDOW_FLAG_TITLED);
+    }
+    bool same = true;
+    for (int step = 0; step < 4000 && same; step++) {
+      CWindow *w = windows[next_random(&state) % 200];
+      switch (step % 4) {
+      case 0:
+        window_move(w, w->bounds.x + random_range(&state, -100, 100),
+                    w->bounds.y + random_range(&state, -100, 100));
+        break;
+      case 1:
+        window_focus(manager, w);
+        break;
+      case 2:
+        window_resize(w, (uint32_t)random_range(&state, 100, 1500),
+                      (uint32_t)random_range(&state, 100, 1100));
+        break;
+      default:
+        window_set_state(w, w->state == WINDOW_STATE_NORMAL
+                                ? WINDOW_STATE_MINIMIZED
+                                : WINDOW_STATE_NORMAL);
+        break;
+      }
+      int32_t x = random_range(&state, 0, DISPLAY_WIDTH - 1);
+      int32_t y = random_range(&state, 0, DISPLAY_HEIGHT - 1);
+      CWindow *expect = NULL;
+      uint32_t expect_in_rect = 0;
+      OSRect r = {x - 50, y - 50, 100, 100};
+      for (uint32_t i = manager->window_count; i-- > 0;) {
+        CWindow *candidate = manager->windows[i];
+        if (candidate->state == WINDOW_STATE_MINIMIZED) {
+          continue;
+        }
+        if (!expect && point_in(candidate->bounds, x, y)) {
+          expect = candidate;
+        }
+        if (rect_intersects(candidate->bounds, r)) {
+          same = same && expect_in_rect < ITEMS;
+          found[expect_in_rect++] = candidate;
+        }
+      }
+      CWindow *in_rect[ITEMS];
+      uint32_t actual_in_rect =
+          window_manager_windows_in_rect(manager, r, in_rect, ITEMS);
+      same = same && window_manager_window_at(manager, x, y) == expect &&
+             actual_in_rect == expect_in_rect &&
+             memcmp(in_rect, found, actual_in_rect * sizeof(CWindow *)) == 0;
+    }
+    check(same, "window hit-testing: window_at and windows_in_rect follow "
+                "moves, resizes, focus and minimize in z-order");
+  }
+  window_manager_destroy(manager);
+  free(windows);
+  free(found);
+  free(items);
+  free(want);
+  free(got);
+}
+
+// Linear hit-test, what window_at did before the index.
+static CWindow *scan_window_at(CWindowManager *manager, int32_t x, int32_t y) {
+  for (uint32_t i = manager->window_count; i-- > 0;) {
+    CWindow *window = manager->windows[i];
+    if (window->state != WINDOW_STATE_MINIMIZED &&
+        point_in(window->bounds, x, y)) {
+      return window;
+    }
+  }
+  return NULL;
+}
+
+static void bench_hittest(void) {
+  enum { WINDOWS = 10000, EVENTS = 1000 };
+  CWindowManager *manager = window_manager_create(WINDOWS);
+  CWindow **windows = (CWindow **)calloc(WINDOWS, sizeof(CWindow *));
+  CWindow **found = (CWindow **)calloc(WINDOWS, sizeof(CWindow *));
+  if (!manager || !windows || !found) {
+    fprintf(stderr, "gfxtool: out of memory\n");
+    window_manager_destroy(manager);
+    free(windows);
+    free(found);
+    return;
+  }
+  uint64_t state = 23;
+  uint64_t start = now_ns();
+  for (uint32_t i = 0; i < WINDOWS; i++) {
+    OSRect bounds = {random_range(&state, -100, DISPLAY_WIDTH - 100),
+                     random_range(&state, 0, DISPLAY_HEIGHT - 100),
+                     random_range(&state, 120, 900),
+                     random_range(&state, 90, 700)};
+    windows[i] = window_create(manager, "window", bounds, WINDOW_FLAG_TITLED);
+  }
+  double create_us = (double)(now_ns() - start) / 1e3 / WINDOWS;
+  printf("%u windows on %ux%u, %u mouse events per second of input\n",
+         WINDOWS, DISPLAY_WIDTH, DISPLAY_HEIGHT, EVENTS);
+  printf("%-28s %10s %14s\n", "", "ns/event", "ms per second");
+
+  // A pointer sweeping the screen at 1 kHz, hit-testing every event
+  int32_t x = 0, y = 0;
+  uint64_t sum = 0;
+  for (int scan = 0; scan < 2; scan++) {
+    const int rounds = scan ? 1 : 200;
+    start = now_ns();
+    for (int r = 0; r < rounds; r++) {
+      for (int e = 0; e < EVENTS; e++) {
+        x = (x + 7 + random_range(&state, 0, 4)) % DISPLAY_WIDTH;
+        y = (y + 3 + random_range(&state, 0, 2)) % DISPLAY_HEIGHT;
+        CWindow *hit = scan ? scan_window_at(manager, x, y)
+                            : window_manager_window_at(manager, x, y);
+        sum += hit ? hit->window_id : 0;
+      }
+    }
+    double ns = (double)(now_ns() - start) / ((double)rounds * EVENTS);
+    printf("%-28s %10.1f %14.3f\n", scan ? "hit-test, linear scan"
+                                         : "hit-test, spatial index",
+           ns, ns * EVENTS / 1e6);
+  }
+
+  // Dragging the front window: a move and a hit-test per event
+  CWindow *dragged = windows[WINDOWS - 1];
+  window_focus(manager, dragged);
+  start = now_ns();
+  for (int e = 0; e < EVENTS * 50; e++) {
+    int32_t dx = (e / 200) % 2 ? -3 : 3;
+    window_move(dragged, dragged->bounds.x + dx, dragged->bounds.y + 1 - (e & 2));
+    region_clear(&manager->damage); // nothing renders in this loop
+    CWindow *hit = window_manager_window_at(manager, dragged->bounds.x + 10,
+                                            dragged->bounds.y + 10);
+    sum += hit ? hit->window_id : 0;
+  }
+  double ns = (double)(now_ns() - start) / (EVENTS * 50.0);
+  printf("%-28s %10.1f %14.3f\n", "drag: move + hit-test", ns,
+         ns * EVENTS / 1e6);
+
+  // Click to raise
+  start = now_ns();
+  for (int e = 0; e < EVENTS * 20; e++) {
+    window_focus(manager, windows[next_random(&state) % WINDOWS]);
+    region_clear(&manager->damage);
+  }
+  ns = (double)(now_ns() - start) / (EVENTS * 20.0);
+  printf("%-28s %10.1f %14.3f\n", "raise", ns, ns * EVENTS / 1e6);
+
+  // 256x256 rect queries, front to back
+  for (int scan = 0; scan < 2; scan++) {
+    const int queries = scan ? EVENTS : EVENTS * 10;
+    uint64_t total = 0;
+    start = now_ns();
+    for (int e = 0; e < queries; e++) {
+      OSRect r = {random_range(&state, 0, DISPLAY_WIDTH - 256),
+                  random_range(&state, 0, DISPLAY_HEIGHT - 256), 256, 256};
+      if (!scan) {
+        total += window_manager_windows_in_rect(manager, r, found, WINDOWS);
+        continue;
+      }
+      for (uint32_t i = manager->window_count; i-- > 0;) {
+        CWindow *window = manager->windows[i];
+        if (window->state != WINDOW_STATE_MINIMIZED &&
+            rect_intersects(window->bounds, r)) {
+          found[total++ % WINDOWS] = window;
+        }
+      }
+    }
+    ns = (double)(now_ns() - start) / queries;
+    printf("%-28s %10.1f %14.3f   %.0f windows each\n",
+           scan ? "256x256 rect, linear scan" : "256x256 rect query", ns,
+           ns * EVENTS / 1e6, (double)total / queries);
+  }
+  printf("%-28s %10.1f us\n", "window_create", create_us);
+  g_sink = sum;
+
+  window_manager_destroy(manager);
+  free(windows);
+  free(found);
+}
+
+// ============================================================================
+// Tile renderer
+// ============================================================================
+
+// Every recordable call, including blur barriers and textures, under
+// changing clips.
+static void draw_tile_scene(GraphicsContext *ctx, Texture *texture,
+                            uint64_t seed) {
+  uint64_t state = seed;
+  context_fill(ctx, 0xff303030);
+  for (int i = 0; i < 400; i++) {
+    OSRect r = {random_range(&state, -40, (int32_t)ctx->width - 20),
+                random_range(&state, -40, (int32_t)ctx->height - 20),
+                random_range(&state, 4, 260), random_range(&state, 4, 200)};
+    Color c = random_color(&state, i % 2 == 0);
+    if (i % 23 == 0) {
+      graphics_set_clip(ctx, (OSRect){random_range(&state, 0, 300),
+                                      random_range(&state, 0, 200),
+                                      random_range(&state, 100, 600),
+                                      random_range(&state, 100, 400)});
+    } else if (i % 23 == 11) {
+      graphics_reset_clip(ctx);
+    }
+    switch (i % 10) {
+    case 0:
+      draw_rect(ctx, r, c);
+      break;
+    case 1:
+      draw_rounded_rect(ctx, r, 12, c);
+      break;
+    case 2:
+      draw_rect_outline(ctx, r, 3, c);
+      break;
+    case 3:
+      draw_circle(ctx, r.x, r.y, (uint32_t)r.width / 3, c);
+      break;
+    case 4:
+      draw_line(ctx, r.x, r.y, r.x + r.width, r.y + r.height, c);
+      break;
+    case 5:
+      draw_texture(ctx, texture, r.x, r.y);
+      break;
+    case 6:
+      apply_gradient(ctx, r, c, random_color(&state, true), i % 4 == 0);
+      break;
+    case 7:
+      apply_rounded_shadow(ctx, r, 10, (Color){90, 0, 0, 0}, 12.0f);
+      break;
+    case 8:
+      apply_shadow(ctx, r, (Color){60, 0, 0, 0}, 6.0f);
+      break;
+    default:
+      if (i % 50 == 9) {
+        apply_blur(ctx, r, 8.0f);
+      }
+      break;
+    }
+  }
+  graphics_reset_clip(ctx);
+}
+
+static Texture *test_texture(void) {
+  Texture *texture = texture_create(48, 40);
+  if (texture) {
+    uint32_t *pixels = (uint32_t *)texture->data;
+    for (uint32_t i = 0; i < 48 * 40; i++) {
+      pixels[i] = (i * 2654435761u) | (i % 3 ? 0xff000000u : 0x80000000u);
+    }
+  }
+  return texture;
+}
+
+static void test_tiles(void) {
+  GraphicsContext *immediate = context_create(700, 500);
+  GraphicsContext *tiled = context_create(700, 500);
+  Texture *texture = test_texture();
+  TileRenderer *renderer = tile_renderer_create();
+  FrameArena *arena = frame_arena_create(0);
+  TileRenderer *arena_renderer = tile_renderer_create_in(arena);
+  if (!immediate || !tiled || !texture || !renderer || !arena ||
+      !arena_renderer) {
+    check(false, "tiles: allocation");
+    return;
+  }
+  draw_tile_scene(immediate, texture, 99);
+  const uint32_t threads[] = {1, 2, 4, 8};
+  for (int t = 0; t < 4; t++) {
+    ThreadPool *pool = thread_pool_create(threads[t]);
+    for (int mode = 0; mode < 2; mode++) {
+      TileRenderer *r = mode ? arena_renderer : renderer;
+      tile_renderer_set_pool(r, pool);
+      tile_renderer_begin(r, tiled);
+      draw_tile_scene(tiled, texture, 99);
+      tile_renderer_end(r, tiled);
+      frame_arena_end_frame(arena);
+      char name[96];
+      snprintf(name, sizeof(name),
+               "tiles: %u thread(s)%s match immediate mode bit for bit",
+               threads[t], mode ? ", arena commands," : "");
+      check(memcmp(immediate->framebuffer, tiled->framebuffer,
+                   context_bytes(tiled)) == 0,
+            name);
+      tile_renderer_set_pool(r, NULL);
+    }
+    thread_pool_destroy(pool);
+  }
+  tile_renderer_destroy(renderer);
+  tile_renderer_destroy(arena_renderer);
+  frame_arena_destroy(arena);
+  texture_destroy(texture);
+  context_destroy(immediate);
+  context_destroy(tiled);
+}
+
+// Tile workers replaying one shadow ask for the same mask at once; they
+// must share one build and one cache slot.
+#define SHADOW_RACERS 8
+
+static atomic_bool g_shadow_go;
+static const ShadowMask *g_shadow_masks[SHADOW_RACERS];
+
+static void *shadow_racer(void *arg) {
+  uintptr_t i = (uintptr_t)arg;
+  while (!atomic_load(&g_shadow_go)) {
+    sched_yield();
+  }
+  g_shadow_masks[i] = shadow_mask_acquire(900, 700, 40.0f, 16);
+  return NULL;
+}
+
+static void test_shadow_cache(void) {
+  shadow_mask_cache_clear();
+  pthread_t threads[SHADOW_RACERS];
+  uint32_t started = 0;
+  atomic_store(&g_shadow_go, false);
+  for (; started < SHADOW_RACERS; started++) {
+    if (pthread_create(&threads[started], NULL, shadow_racer,
+                       (void *)(uintptr_t)started) != 0) {
+      break;
+    }
+  }
+  atomic_store(&g_shadow_go, true);
+  for (uint32_t i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  bool shared = started == SHADOW_RACERS && g_shadow_masks[0];
+  for (uint32_t i = 0; i < started; i++) {
+    shared = shared && g_shadow_masks[i] == g_shadow_masks[0];
+  }
+  const ShadowMask *again = shadow_mask_acquire(900, 700, 40.0f, 16);
+  check(shared && again == g_shadow_masks[0],
+        "shadow cache: concurrent requests share one mask build");
+  shadow_mask_release(again);
+  for (uint32_t i = 0; i < started; i++) {
+    shadow_mask_release(g_shadow_masks[i]);
+  }
+  shadow_mask_cache_clear();
+}
+
+static void bench_tiles(uint32_t max_threads) {
+  GraphicsContext *ctx = context_create(DISPLAY_WIDTH, DISPLAY_HEIGHT);
+  Texture *texture = test_texture();
+  FrameArena *arena = frame_arena_create(0);
+  TileRenderer *renderer = tile_renderer_create_in(arena);
+  if (!ctx || !texture || !arena || !renderer) {
+    fprintf(stderr, "gfxtool: out of memory\n");
+    return;
+  }
+  printf("%ux%u, 400 mixed draw calls per frame\n", ctx->width, ctx->height);
+  double base_ms = 0.0;
+  for (uint32_t threads = 0; threads <= max_threads;
+       threads = threads ? threads * 2 : 1) {
+    ThreadPool *pool = threads ? thread_pool_create(threads) : NULL;
+    if (threads) {
+      tile_renderer_set_pool(renderer, pool);
+    }
+    const int frames = 20;
+    uint64_t start = now_ns();
+    for (int f = 0; f < frames; f++) {
+      if (threads) {
+        tile_renderer_begin(renderer, ctx);
+      }
+      draw_tile_scene(ctx, texture, 5 + (uint64_t)f);
+      if (threads) {
+        tile_renderer_end(renderer, ctx);
+        frame_arena_end_frame(arena);
+      }
+    }
+    double ms = (double)(now_ns() - start) / 1e6 / frames;
+    if (!threads) {
+      base_ms = ms;
+      printf("%-16s %8.2f ms/frame\n", "immediate", ms);
+    } else {
+      printf("tiles, %2u thread%s %8.2f ms/frame  %5.2fx\n", threads,
+             threads == 1 ? " " : "s", ms, base_ms / ms);
+    }
+    tile_renderer_set_pool(renderer, NULL);
+    thread_pool_destroy(pool);
+    if (threads && threads * 2 > max_threads && threads != max_threads) {
+      threads = max_threads / 2; // end on max_threads itself
+    }
+  }
+  tile_renderer_destroy(renderer);
+  frame_arena_destroy(arena);
+  texture_destroy(texture);
+  context_destroy(ctx);
+}
+
+// ============================================================================
+// Steady-state allocations
+// ============================================================================
+
+static atomic_bool g_count_allocs;
+static atomic_uint_fast64_t g_allocs;
+
+static inline void count_alloc(void) {
+  if (atomic_load_explicit(&g_count_allocs, memory_order_relaxed)) {
+    atomic_fetch_add_explicit(&g_allocs, 1, memory_order_relaxed);
+  }
+}
+
+#if defined(__GLIBC__)
+// glibc lets a program replace malloc; these forward to its own and count
+// every call from any thread while g_count_allocs is set.
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+void *malloc(size_t size) {
+  count_alloc();
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+  count_alloc();
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  count_alloc();
+  return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) { __libc_free(ptr); }
+
+static bool alloc_counter_install(void) { return true; }
+#elif defined(__APPLE__)
+// malloc and friends call through the first registered zone's function
+// table (malloc_default_zone() is a stand-in that forwards to it), so
+// wrapping that table's entries counts every allocation in the process.
+static malloc_zone_t g_zone_real; // the table as it was
+
+static void *zone_malloc(malloc_zone_t *zone, size_t size) {
+  count_alloc();
+  return g_zone_real.malloc(zone, size);
+}
+
+static void *zone_calloc(malloc_zone_t *zone, size_t count, size_t size) {
+  count_alloc();
+  return g_zone_real.calloc(zone, count, size);
+}
+
+static void *zone_valloc(malloc_zone_t *zone, size_t size) {
+  count_alloc();
+  return g_zone_real.valloc(zone, size);
+}
+
+static void *zone_realloc(malloc_zone_t *zone, void *ptr, size_t size) {
+  count_alloc();
+  return g_zone_real.realloc(zone, ptr, size);
+}
+
+static void *zone_memalign(malloc_zone_t *zone, size_t alignment,
+                           size_t size) {
+  count_alloc();
+  return g_zone_real.memalign(zone, alignment, size);
+}
+
+static bool alloc_counter_install(void) {
+  static bool installed;
+  if (installed) {
+    return true;
+  }
+  vm_address_t *zones = NULL;
+  unsigned int count = 0;
+  if (malloc_get_all_zones(mach_task_self(), NULL, &zones, &count) !=
+          KERN_SUCCESS ||
+      count == 0) {
+    return false;
+  }
+  malloc_zone_t *zone = (malloc_zone_t *)zones[0];
+  // From version 8 the table sits on a read-only page.
+  if (zone->version >= 8 &&
+      vm_protect(mach_task_self(), (vm_address_t)zone, sizeof(*zone), 0,
+                 VM_PROT_READ | VM_PROT_WRITE) != KERN_SUCCESS) {
+    return false;
+  }
+  g_zone_real = *zone;
+  zone->malloc = zone_malloc;
+  zone->calloc = zone_calloc;
+  zone->valloc = zone_valloc;
+  zone->realloc = zone_realloc;
+  if (zone->version >= 5 && zone->memalign) {
+    zone->memalign = zone_memalign;
+  }
+  if (zone->version >= 8) {
+    vm_protect(mach_task_self(), (vm_address_t)zone, sizeof(*zone), 0,
+               VM_PROT_READ);
+  }
+  installed = true;
+  return true;
+}
+#else
+static bool alloc_counter_install(void) { return false; }
+#endif
+
+static GraphicsContext *g_frame_ctx;
+static uint32_t g_frame_labels;
+
+// A window whose content changes every frame the way a busy client's does:
+// a gradient, a blurred strip and a formatted label, then another frame.
+static void busy_on_draw(CWindow *window) {
+  OSRect r = window->bounds;
+  apply_gradient(g_frame_ctx, r, (Color){40, 90, 160, 255},
+                 (Color){200, 120, 60, 255}, (g_frame_labels & 1) != 0);
+  apply_blur(g_frame_ctx, (OSRect){r.x, r.y, r.width, r.height / 3}, 6.0f);
+  char *label = string_format_in(g_frame_ctx->arena, "frame %u - %s",
+                                 g_frame_labels, window->title);
+  g_frame_labels += label != NULL;
+  window_invalidate(window);
+}
+
+// Once the arena, the damage regions and the thread pool have their
+// high-water sizes, a frame must not call malloc at all.
+static void test_steady_allocations(void) {
+  GraphicsContext *ctx = screen();
+  CWindow *windows[20];
+  CWindowManager *manager = desktop_create(20, 5, windows);
+  if (!ctx || !ctx->arena || !manager) {
+    check(false, "steady frames: allocation");
+    window_manager_destroy(manager);
+    return;
+  }
+  g_frame_ctx = ctx;
+  for (int i = 0; i < 3; i++) {
+    windows[i]->on_draw = busy_on_draw;
+    window_set_state(windows[i], WINDOW_STATE_NORMAL);
+  }
+  window_focus(manager, windows[0]);
+  manager->full_damage = true;
+  for (int frame = 0; frame < 20; frame++) {
+    window_manager_render_all(manager, ctx);
+  }
+
+  FrameArenaStats before, after;
+  frame_arena_get_stats(ctx->arena, &before);
+  uint32_t labels = g_frame_labels;
+  // A probe allocation proves the hook sees malloc before trusting a zero.
+  bool installed = alloc_counter_install();
+  atomic_store(&g_allocs, 0);
+  atomic_store(&g_count_allocs, installed);
+  void *probe = malloc(64);
+  g_sink += (uintptr_t)probe;
+  free(probe);
+  bool counting = installed && atomic_exchange(&g_allocs, 0) == 1;
+  atomic_store(&g_count_allocs, counting);
+  for (int frame = 0; frame < 200; frame++) {
+    window_manager_render_all(manager, ctx);
+  }
+  atomic_store(&g_count_allocs, false);
+  uint64_t allocs = atomic_load(&g_allocs);
+  if (counting) {
+    char name[96];
+    snprintf(name, sizeof(name),
+             "steady frames: no malloc calls (%llu in 200)",
+             (unsigned long long)allocs);
+    check(allocs == 0, name);
+  } else if (installed) {
+    check(false, "steady frames: the allocation counter sees malloc");
+  } else {
+    printf("SKIP steady frames: no malloc calls (no allocation counter on "
+           "this platform)\n");
+  }
+  frame_arena_get_stats(ctx->arena, &after);
+  check(g_frame_labels - labels >= 200 && after.frames - before.frames == 200,
+        "steady frames: every frame repaints the busy windows");
+  check(after.system_allocs == before.system_allocs,
+        "steady frames: the arena obtains no blocks");
+  window_manager_destroy(manager);
+}
+
+// ============================================================================
+// Main
+// ============================================================================
+
+static int usage(void) {
+  fprintf(stderr, "usage: gfxtool test\n"
+                  "       gfxtool bench spans|damage|hittest\n"
+                  "       gfxtool bench tiles [threads]\n");
+  return 2;
+}
+
+int main(int argc, char **argv) {
+  span_init();
+  if (argc == 2 && strcmp(argv[1], "test") == 0) {
+    test_span_backends();
+    test_lines();
+    test_damage();
+    test_spatial_index();
+    test_tiles();
+    test_shadow_cache();
+    test_steady_allocations();
+    printf("%s\n", g_failures ? "FAILED" : "all checks passed");
+    return g_failures ? 1 : 0;
+  }
+  if ((argc == 3 || argc == 4) && strcmp(argv[1], "bench") == 0 &&
+      strcmp(argv[2], "tiles") == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t threads = argc == 4 ? (uint32_t)strtoul(argv[3], NULL, 10)
+                                 : (uint32_t)(cpus > 0 ? cpus : 1);
+    bench_tiles(threads ? threads : 1);
+    return 0;
+  }
+  if (argc == 3 && strcmp(argv[1], "bench") == 0) {
+    if (strcmp(argv[2], "spans") == 0) {
+      bench_spans();
+      return 0;
+    }
+    if (strcmp(argv[2], "damage") == 0) {
+      bench_damage();
+      return 0;
+    }
+    if (strcmp(argv[2], "hittest") == 0) {
+      bench_hittest();
+      return 0;
+    }
+  }
+  return usage();
+}
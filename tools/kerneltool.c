@@ -0,0 +1,895 @@
+// kerneltool - checks and benchmarks for the simulated kernel
+//
+//   kerneltool test              correctness checks (exit status 1 on any
+//                                failure)
+//   kerneltool bench scheduler   MLFQ simulation at 1K, 10K and 100K
+//                                processes: dispatch latency, fairness of
+//                                CPU-bound processes and cost per tick
+//   kerneltool bench smp [cores] kernel_run_smp throughput from 1 core up
+//                                to cores (default: online CPUs)
+//   kerneltool bench ipc         channel ping-pong latency and bulk
+//                                throughput, inline and page payloads
+
+#include "ipc.h"
+#include "kernel.h"
+#include "os_config.h"
+#include "pmm.h"
+#include "scheduler.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// ============================================================================
+// Helpers
+// ============================================================================
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t clock_ns(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Burn ns of this thread's CPU time.
+static void spin_cpu(uint64_t ns) {
+  uint64_t end = clock_ns(CLOCK_THREAD_CPUTIME_ID) + ns;
+  while (clock_ns(CLOCK_THREAD_CPUTIME_ID) < end) {
+  }
+}
+
+static int g_failures;
+static volatile uint64_t g_sink; // keeps timed loops from being optimized away
+
+static void check(bool ok, const char *name) {
+  printf("%s %s\n", ok ? "PASS" : "FAIL", name);
+  if (!ok) {
+    g_failures++;
+  }
+}
+
+// ============================================================================
+// Scheduler
+// ============================================================================
+
+static void test_scheduler_levels(void) {
+  Scheduler sched;
+  scheduler_init(&sched, 100);
+  OSProcess procs[3] = {{.pid = 1}, {.pid = 2}, {.pid = 3}};
+  SchedEntity entities[3];
+  for (int i = 0; i < 3; i++) {
+    scheduler_entity_init(&sched, &entities[i], &procs[i]);
+    scheduler_enqueue(&sched, &entities[i]);
+  }
+
+  // Level 0 is FIFO; using up its one-tick allotment demotes.
+  SchedEntity *first = scheduler_pick_next(&sched);
+  bool expired = scheduler_charge(&sched, first, SCHED_BASE_QUANTUM);
+  scheduler_enqueue(&sched, first);
+  check(first == &entities[0] && expired && procs[0].priority == 1 &&
+            procs[0].cpu_time == SCHED_BASE_QUANTUM,
+        "scheduler: an expired allotment demotes one level");
+  SchedEntity *second = scheduler_pick_next(&sched);
+  SchedEntity *third = scheduler_pick_next(&sched);
+  check(second == &entities[1] && third == &entities[2],
+        "scheduler: higher levels run before demoted entities");
+  scheduler_enqueue(&sched, second);
+  scheduler_enqueue(&sched, third);
+
+  // A partial charge keeps the level.
+  scheduler_dequeue(&sched, &entities[1]);
+  check(!scheduler_charge(&sched, &entities[1], 0) && procs[1].priority == 0,
+        "scheduler: a partial charge keeps the level");
+  scheduler_dequeue(&sched, &entities[2]);
+  SchedEntity *only = scheduler_pick_next(&sched);
+  check(only == &entities[0] && scheduler_pick_next(&sched) == NULL &&
+            sched.nonempty == 0,
+        "scheduler: dequeue removes entities and clears their level bit");
+
+  // Sink entity 0 to the bottom, then let the boost lift it.
+  for (int i = 0; i < SCHED_LEVELS; i++) {
+    scheduler_charge(&sched, only, (uint32_t)SCHED_BASE_QUANTUM << i);
+  }
+  scheduler_enqueue(&sched, only);
+  bool bottom = procs[0].priority == SCHED_LEVELS - 1;
+  scheduler_advance(&sched, 100);
+  scheduler_enqueue(&sched, &entities[1]);
+  check(bottom && scheduler_pick_next(&sched) == only &&
+            procs[0].priority == 0,
+        "scheduler: a boost returns every level to level 0 in FIFO order");
+}
+
+static void test_scheduler_simulation(void) {
+  SchedSimConfig config = {2000, 30, 200000, 1000, 42};
+  SchedSimResult a;
+  SchedSimResult b;
+  bool ran =
+      scheduler_simulate(&config, &a) && scheduler_simulate(&config, &b);
+  check(ran && memcmp(&a, &b, sizeof(a)) == 0,
+        "scheduler: the simulation is deterministic");
+  check(ran && a.min_cpu_time > 0,
+        "scheduler: boosting keeps 2000 processes from starving");
+
+  // With few enough processes that demotion matters between boosts,
+  // short bursts keep interactive processes on the upper levels.
+  SchedSimConfig small = {50, 30, 200000, 1000, 42};
+  ran = scheduler_simulate(&small, &a);
+  check(ran && a.interactive_mean_latency < a.mean_latency * 0.75,
+        "scheduler: interactive processes wait less than the average");
+}
+
+// ============================================================================
+// Kernel
+// ============================================================================
+
+// Process bodies run one quantum per call. Each process counts its quanta
+// down in a slot indexed by pid.
+#define KTEST_SLOTS 4096
+
+static _Atomic uint32_t g_quanta_left[KTEST_SLOTS];
+static _Atomic uint64_t g_quanta_run;
+static _Atomic uint64_t g_work_ns; // thread CPU time spent in entry points
+static _Atomic uint32_t g_max_level;
+static uint64_t g_quantum_ns;
+
+static void worker_entry(void) {
+  uint32_t pid = process_current();
+  uint64_t start = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+  spin_cpu(g_quantum_ns);
+  atomic_fetch_add(&g_work_ns, clock_ns(CLOCK_THREAD_CPUTIME_ID) - start);
+  atomic_fetch_add(&g_quanta_run, 1);
+  OSProcess *self = process_find(pid);
+  uint32_t level = self ? self->priority : 0;
+  uint32_t seen = atomic_load(&g_max_level);
+  while (level > seen &&
+         !atomic_compare_exchange_weak(&g_max_level, &seen, level)) {
+  }
+  if (atomic_fetch_sub(&g_quanta_left[pid % KTEST_SLOTS], 1) == 1) {
+    process_exit();
+  }
+}
+
+static uint32_t spawn_workers(uint32_t count, uint32_t quanta) {
+  uint32_t first = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t pid = process_create("worker", worker_entry);
+    atomic_store(&g_quanta_left[pid % KTEST_SLOTS], quanta);
+    first = first ? first : pid;
+  }
+  return first;
+}
+
+static void reset_counters(uint64_t quantum_ns) {
+  g_quantum_ns = quantum_ns;
+  atomic_store(&g_quanta_run, 0);
+  atomic_store(&g_work_ns, 0);
+  atomic_store(&g_max_level, 0);
+}
+
+static uint64_t total_quanta(void) {
+  OSCoreInfo cores[KERNEL_MAX_CORES];
+  uint32_t count = get_core_info(cores, KERNEL_MAX_CORES);
+  uint64_t quanta = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    quanta += cores[i].quanta;
+  }
+  return quanta;
+}
+
+// process_destroy from another thread while the process is mid-quantum.
+static _Atomic int g_victim_phase; // 1 inside the quantum, 2 destroyed
+static _Atomic bool g_victim_alive;
+
+static void victim_entry(void) {
+  atomic_store(&g_victim_phase, 1);
+  while (atomic_load(&g_victim_phase) == 1) {
+    sched_yield();
+  }
+  // Still inside the quantum: the PCB must not have been reaped.
+  OSProcess *self = process_find(process_current());
+  atomic_store(&g_victim_alive,
+               self != NULL && self->pid == process_current());
+}
+
+static void *destroy_victim(void *opaque) {
+  while (atomic_load(&g_victim_phase) != 1) {
+    sched_yield();
+  }
+  process_destroy(*(uint32_t *)opaque);
+  atomic_store(&g_victim_phase, 2);
+  return NULL;
+}
+
+static void test_kernel_destroy_running(void) {
+  kernel_init();
+  bool alive = true;
+  bool reaped = true;
+  for (int round = 0; round < 20; round++) {
+    atomic_store(&g_victim_phase, 0);
+    atomic_store(&g_victim_alive, false);
+    uint32_t pid = process_create("victim", victim_entry);
+    pthread_t thread;
+    pthread_create(&thread, NULL, destroy_victim, &pid);
+    kernel_run();
+    pthread_join(thread, NULL);
+    alive = alive && atomic_load(&g_victim_alive);
+    reaped = reaped && process_find(pid) == NULL;
+  }
+  check(alive, "kernel: destroying a running process waits for its quantum");
+  check(reaped, "kernel: the scheduler reaps it when the quantum ends");
+}
+
+// Destroy queued and running processes from another thread during SMP.
+static void *destroy_range(void *opaque) {
+  uint32_t *range = (uint32_t *)opaque;
+  uint64_t state = 0x2545f4914f6cdd1dull;
+  for (uint32_t n = 0; n < range[1]; n++) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    process_destroy(range[0] + (uint32_t)(state % range[1]));
+    if (n % 16 == 0) {
+      usleep(100);
+    }
+  }
+  for (uint32_t n = 0; n < range[1]; n++) {
+    process_destroy(range[0] + n);
+  }
+  return NULL;
+}
+
+static void test_kernel_smp(void) {
+  kernel_init();
+
+  // Levels, charging and stealing on every core.
+  reset_counters(300000);
+  uint64_t quanta_before = total_quanta();
+  spawn_workers(64, 6);
+  kernel_run_smp(4);
+  check(atomic_load(&g_quanta_run) == 64 * 6 &&
+            total_quanta() - quanta_before == 64 * 6,
+        "kernel smp: every quantum runs once and is counted on a core");
+  check(atomic_load(&g_max_level) >= 3,
+        "kernel smp: CPU-bound processes sink through the MLFQ levels");
+
+  // Destroy from outside while the cores run.
+  reset_counters(50000);
+  uint32_t range[2] = {spawn_workers(256, 1000000), 256};
+  pthread_t thread;
+  pthread_create(&thread, NULL, destroy_range, range);
+  kernel_run_smp(4);
+  pthread_join(thread, NULL);
+  bool gone = true;
+  for (uint32_t n = 0; n < range[1]; n++) {
+    gone = gone && process_find(range[0] + n) == NULL;
+  }
+  check(gone, "kernel smp: processes destroyed from outside are all reaped");
+
+  // One process on four cores: the other three sleep rather than spin.
+  reset_counters(1000000);
+  spawn_workers(1, 60);
+  uint64_t cpu_start = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+  kernel_run_smp(4);
+  uint64_t cpu = clock_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu_start;
+  uint64_t work = atomic_load(&g_work_ns);
+  check(cpu < work + work / 4,
+        "kernel smp: idle cores park instead of spinning");
+}
+
+// A process created outside the cores goes onto core 0's queue. With core 0
+// and another core parked, it has to start while the rest stay busy.
+static pthread_t g_core0; // kernel_run_smp's caller runs core 0
+static _Atomic uint32_t g_busy_settled;
+static _Atomic uint64_t g_late_ran_ns;
+
+// Off core 0, one quantum that lasts until the late process has run (or
+// 2 s), so the core stays busy with nothing queued to steal. On core 0 it
+// leaves after long enough for the other cores to start and take theirs,
+// so core 0 parks.
+static void busy_entry(void) {
+  if (pthread_equal(pthread_self(), g_core0)) {
+    usleep(10000);
+    atomic_fetch_add(&g_busy_settled, 1);
+    process_exit();
+    return;
+  }
+  atomic_fetch_add(&g_busy_settled, 1);
+  uint64_t deadline = clock_ns(CLOCK_MONOTONIC) + 2000000000ull;
+  while (!atomic_load(&g_late_ran_ns) &&
+         clock_ns(CLOCK_MONOTONIC) < deadline) {
+    usleep(1000);
+  }
+  process_exit();
+}
+
+static void late_entry(void) {
+  atomic_store(&g_late_ran_ns, clock_ns(CLOCK_MONOTONIC));
+  process_exit();
+}
+
+static void *run_five_cores(void *opaque) {
+  (void)opaque;
+  g_core0 = pthread_self();
+  kernel_run_smp(5);
+  return NULL;
+}
+
+static void test_kernel_smp_wakeup(void) {
+  kernel_init();
+  bool prompt = true;
+  for (int round = 0; round < 5 && prompt; round++) {
+    atomic_store(&g_busy_settled, 0);
+    atomic_store(&g_late_ran_ns, 0);
+    // Three busy processes on five cores: core 0 and at least one other
+    // end up parked.
+    for (int i = 0; i < 3; i++) {
+      process_create("busy", busy_entry);
+    }
+    pthread_t thread;
+    pthread_create(&thread, NULL, run_five_cores, NULL);
+    while (atomic_load(&g_busy_settled) < 3) {
+      usleep(1000);
+    }
+    usleep(50000); // the idle cores park
+    uint64_t created = clock_ns(CLOCK_MONOTONIC);
+    process_create("late", late_entry);
+    pthread_join(thread, NULL);
+    uint64_t ran = atomic_load(&g_late_ran_ns);
+    prompt = ran != 0 && ran - created < 500000000ull;
+  }
+  check(prompt, "kernel smp: a process created outside the cores wakes "
+                "the parked core it lands on");
+}
+
+static void bench_smp(uint32_t max_cores) {
+  const uint32_t procs = 256;
+  const uint32_t quanta = 20;
+  const uint64_t quantum_ns = 200000;
+  kernel_init();
+  printf("%u processes x %u quanta of %llu us CPU\n", procs, quanta,
+         (unsigned long long)(quantum_ns / 1000));
+  printf("%-6s %10s %12s %8s %8s %10s\n", "cores", "wall ms", "quanta/s",
+         "speedup", "steals", "cpu/work");
+  double base = 0.0;
+  for (uint32_t cores = 1;;
+       cores = cores * 2 < max_cores ? cores * 2 : max_cores) {
+    OSCoreInfo before[KERNEL_MAX_CORES];
+    uint32_t counted = get_core_info(before, KERNEL_MAX_CORES);
+    reset_counters(quantum_ns);
+    spawn_workers(procs, quanta);
+    uint64_t cpu_start = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+    uint64_t start = now_ns();
+    kernel_run_smp(cores);
+    double wall = (double)(now_ns() - start);
+    double cpu = (double)(clock_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu_start);
+    OSCoreInfo after[KERNEL_MAX_CORES];
+    uint32_t count = get_core_info(after, KERNEL_MAX_CORES);
+    uint64_t steals = 0;
+    for (uint32_t i = 0; i < count; i++) {
+      steals += after[i].steals - (i < counted ? before[i].steals : 0);
+    }
+    double rate = (double)procs * quanta / (wall / 1e9);
+    base = base > 0.0 ? base : rate;
+    printf("%-6u %10.1f %12.0f %7.2fx %8llu %10.2f\n", cores, wall / 1e6,
+           rate, rate / base, (unsigned long long)steals,
+           cpu / (double)atomic_load(&g_work_ns));
+    if (cores == max_cores) {
+      break;
+    }
+  }
+  printf("cpu/work is process CPU time over time spent in entry points; "
+         "1.0 means no scheduling or idle overhead\n");
+}
+
+static void bench_scheduler(void) {
+  const uint32_t sizes[] = {1000, 10000, 100000};
+  const uint32_t boosts[] = {100, 1000, 10000};
+  printf("30%% interactive, 200 ticks per process\n");
+  printf("%-8s %6s %10s %10s %12s %10s %9s %8s %8s\n", "procs", "boost",
+         "dispatches", "mean lat", "interactive", "max lat", "fairness",
+         "min cpu", "ns/tick");
+  for (int s = 0; s < 3; s++) {
+    for (int b = 0; b < 3; b++) {
+      SchedSimConfig config = {sizes[s], 30, (uint64_t)sizes[s] * 200,
+                               boosts[b], 42};
+      SchedSimResult result;
+      uint64_t start = now_ns();
+      if (!scheduler_simulate(&config, &result)) {
+        fprintf(stderr, "kerneltool: out of memory\n");
+        return;
+      }
+      double ns_per_tick = (double)(now_ns() - start) / (double)config.ticks;
+      printf("%-8u %6u %10llu %10.1f %12.1f %10llu %9.3f %8llu %8.1f\n",
+             config.num_processes, config.boost_interval,
+             (unsigned long long)result.dispatches, result.mean_latency,
+             result.interactive_mean_latency,
+             (unsigned long long)result.max_latency, result.fairness,
+             (unsigned long long)result.min_cpu_time, ns_per_tick);
+    }
+  }
+  printf("latencies in ticks from ready to running; fairness is Jain's "
+         "index over CPU-bound processes\n");
+}
+
+// ============================================================================
+// IPC
+// ============================================================================
+
+#define IPC_PAYLOAD_BYTES (64 * 1024)
+
+typedef struct {
+  IpcChannel *channel;
+  uint32_t id;
+  uint32_t count;
+  bool ok;
+} IpcWorker;
+
+static void send_retry(IpcChannel *channel, IpcMessage *message) {
+  while (!ipc_send(channel, message)) {
+    sched_yield();
+  }
+}
+
+static void send_tagged(IpcChannel *channel, uint32_t producer, uint64_t seq) {
+  IpcMessage message = {.type = producer, .length = sizeof(seq)};
+  memcpy(message.payload.bytes, &seq, sizeof(seq));
+  send_retry(channel, &message);
+}
+
+static uint64_t message_seq(const IpcMessage *message) {
+  uint64_t seq;
+  memcpy(&seq, message->payload.bytes, sizeof(seq));
+  return seq;
+}
+
+static void *ipc_producer(void *opaque) {
+  IpcWorker *worker = (IpcWorker *)opaque;
+  for (uint32_t n = 0; n < worker->count; n++) {
+    send_tagged(worker->channel, worker->id, n);
+  }
+  return NULL;
+}
+
+// MPMC consumers mark every message seen and check that each producer's
+// messages reach them in order: a consumer's claims move forward through
+// the ring, and so do a producer's.
+#define IPC_PRODUCERS 4
+#define IPC_PER_PRODUCER 50000
+
+static _Atomic uint8_t g_ipc_seen[IPC_PRODUCERS * IPC_PER_PRODUCER];
+
+static void *ipc_consumer(void *opaque) {
+  IpcWorker *worker = (IpcWorker *)opaque;
+  int64_t last[IPC_PRODUCERS] = {-1, -1, -1, -1};
+  IpcMessage message;
+  worker->ok = true;
+  while (ipc_receive(worker->channel, &message, -1)) {
+    uint64_t seq = message_seq(&message);
+    if (message.type >= IPC_PRODUCERS || seq >= IPC_PER_PRODUCER ||
+        (int64_t)seq <= last[message.type]) {
+      worker->ok = false;
+      continue;
+    }
+    last[message.type] = (int64_t)seq;
+    atomic_fetch_add(&g_ipc_seen[message.type * IPC_PER_PRODUCER + seq], 1);
+    worker->count++;
+  }
+  return NULL;
+}
+
+static void *send_after_delay(void *opaque) {
+  usleep(20000);
+  send_tagged((IpcChannel *)opaque, 0, 42);
+  return NULL;
+}
+
+static void *close_after_delay(void *opaque) {
+  usleep(20000);
+  ipc_channel_close((IpcChannel *)opaque);
+  return NULL;
+}
+
+// A page payload handed from one process to another.
+static IpcChannel *g_payload_channel;
+static void *g_payload_pages;
+static uint32_t g_payload_sender;
+static _Atomic bool g_payload_charged;
+static _Atomic bool g_payload_delivered;
+
+static void payload_sender_entry(void) {
+  PhysicalMemory *pmm = pmm_kernel();
+  uint32_t self = process_current();
+  uint64_t pages = IPC_PAYLOAD_BYTES / PMM_PAGE_SIZE;
+  uint64_t mine = pmm_owner_pages(pmm, self);
+  uint64_t kernel = pmm_owner_pages(pmm, PMM_OWNER_KERNEL);
+  IpcMessage message;
+  uint8_t *data = ipc_payload_alloc(&message, 7, IPC_PAYLOAD_BYTES);
+  bool charged = data && pmm_owner_pages(pmm, self) == mine + pages;
+  if (data) {
+    memset(data, 0xa5, IPC_PAYLOAD_BYTES);
+    g_payload_pages = data;
+    g_payload_sender = self;
+    send_retry(g_payload_channel, &message);
+  }
+  atomic_store(&g_payload_charged,
+               charged && pmm_owner_pages(pmm, self) == mine &&
+                   pmm_owner_pages(pmm, PMM_OWNER_KERNEL) == kernel + pages);
+  process_exit();
+}
+
+static void payload_receiver_entry(void) {
+  IpcMessage message;
+  if (!ipc_try_receive(g_payload_channel, &message)) {
+    return;
+  }
+  uint8_t *data = ipc_payload_data(&message);
+  bool intact = true;
+  for (uint32_t i = 0; i < message.length; i++) {
+    intact = intact && data[i] == 0xa5;
+  }
+  atomic_store(&g_payload_delivered,
+               data == g_payload_pages && intact &&
+                   message.sender == g_payload_sender &&
+                   message.length == IPC_PAYLOAD_BYTES &&
+                   pmm_owner_pages(pmm_kernel(), process_current()) ==
+                       IPC_PAYLOAD_BYTES / PMM_PAGE_SIZE);
+  ipc_payload_free(&message);
+  process_exit();
+}
+
+static void test_ipc_rings(void) {
+  // Capacity rounds up; a full ring refuses and counts it.
+  IpcChannel *channel = ipc_channel_create(NULL, IPC_SPSC, 5);
+  bool accepted = true;
+  for (uint64_t n = 0; n < 8; n++) {
+    accepted = accepted && ipc_send_bytes(channel, 1, &n, sizeof(n));
+  }
+  IpcChannelStats stats;
+  bool refused = !ipc_send_bytes(channel, 1, "x", 1);
+  ipc_channel_get_stats(channel, &stats);
+  check(accepted && refused && stats.capacity == 8 && stats.queued == 8 &&
+            stats.full == 1,
+        "ipc: a full ring refuses sends and counts them");
+  bool ordered = true;
+  IpcMessage message;
+  for (uint64_t n = 0; n < 8; n++) {
+    ordered = ordered && ipc_try_receive(channel, &message) &&
+              message_seq(&message) == n;
+  }
+  check(ordered && !ipc_try_receive(channel, &message),
+        "ipc: messages come out in order, then the ring is empty");
+
+  // Inline bytes up to the slot size.
+  uint8_t bytes[IPC_INLINE_SIZE + 1];
+  for (uint32_t i = 0; i < sizeof(bytes); i++) {
+    bytes[i] = (uint8_t)(i * 7 + 1);
+  }
+  bool fits = ipc_send_bytes(channel, 9, bytes, IPC_INLINE_SIZE);
+  bool too_big = !ipc_send_bytes(channel, 9, bytes, IPC_INLINE_SIZE + 1);
+  check(fits && too_big && ipc_try_receive(channel, &message) &&
+            message.type == 9 && message.length == IPC_INLINE_SIZE &&
+            message.sender == 0 &&
+            memcmp(message.payload.bytes, bytes, IPC_INLINE_SIZE) == 0,
+        "ipc: inline payloads up to IPC_INLINE_SIZE arrive intact");
+  check(ipc_send_bytes(channel, 4, NULL, 0) &&
+            ipc_try_receive(channel, &message) && message.type == 4 &&
+            message.length == 0,
+        "ipc: an empty message needs no payload pointer");
+
+  // Close: sends fail, queued messages still drain.
+  ipc_send_bytes(channel, 1, "a", 1);
+  ipc_send_bytes(channel, 1, "b", 1);
+  ipc_channel_close(channel);
+  bool drained = !ipc_send_bytes(channel, 1, "c", 1) &&
+                 ipc_receive(channel, &message, -1) &&
+                 message.payload.bytes[0] == 'a' &&
+                 ipc_receive(channel, &message, -1) &&
+                 message.payload.bytes[0] == 'b' &&
+                 !ipc_receive(channel, &message, -1);
+  check(drained, "ipc: a closed channel refuses sends and drains queued "
+                 "messages");
+  ipc_channel_destroy(channel);
+
+  // Names are unique and go away with the channel.
+  IpcChannel *named = ipc_channel_create("kerneltool.ipc", IPC_MPMC, 16);
+  bool found = named && ipc_channel_open("kerneltool.ipc") == named &&
+               !ipc_channel_create("kerneltool.ipc", IPC_SPSC, 16) &&
+               !ipc_channel_open("kerneltool.other");
+  ipc_channel_destroy(named);
+  named = ipc_channel_open("kerneltool.ipc") ? NULL
+          : ipc_channel_create("kerneltool.ipc", IPC_SPSC, 16);
+  check(found && named, "ipc: names are unique and released on destroy");
+  ipc_channel_destroy(named);
+}
+
+static void test_ipc_threads(void) {
+  // SPSC: one producer, one blocking consumer, a small ring that wraps.
+  IpcChannel *channel = ipc_channel_create(NULL, IPC_SPSC, 64);
+  IpcWorker producer = {channel, 0, 200000, true};
+  pthread_t thread;
+  pthread_create(&thread, NULL, ipc_producer, &producer);
+  bool ordered = true;
+  IpcMessage message;
+  for (uint64_t n = 0; n < producer.count; n++) {
+    ordered = ordered && ipc_receive(channel, &message, -1) &&
+              message_seq(&message) == n;
+  }
+  pthread_join(thread, NULL);
+  check(ordered && !ipc_try_receive(channel, &message),
+        "ipc spsc: 200K messages across threads arrive once, in order");
+  ipc_channel_destroy(channel);
+
+  // MPMC: four producers, three consumers.
+  channel = ipc_channel_create(NULL, IPC_MPMC, 64);
+  memset(g_ipc_seen, 0, sizeof(g_ipc_seen));
+  IpcWorker producers[IPC_PRODUCERS];
+  IpcWorker consumers[3];
+  pthread_t producer_threads[IPC_PRODUCERS];
+  pthread_t consumer_threads[3];
+  for (uint32_t i = 0; i < 3; i++) {
+    consumers[i] = (IpcWorker){channel, i, 0, false};
+    pthread_create(&consumer_threads[i], NULL, ipc_consumer, &consumers[i]);
+  }
+  for (uint32_t i = 0; i < IPC_PRODUCERS; i++) {
+    producers[i] = (IpcWorker){channel, i, IPC_PER_PRODUCER, true};
+    pthread_create(&producer_threads[i], NULL, ipc_producer, &producers[i]);
+  }
+  for (uint32_t i = 0; i < IPC_PRODUCERS; i++) {
+    pthread_join(producer_threads[i], NULL);
+  }
+  ipc_channel_close(channel);
+  bool in_order = true;
+  uint32_t total = 0;
+  for (uint32_t i = 0; i < 3; i++) {
+    pthread_join(consumer_threads[i], NULL);
+    in_order = in_order && consumers[i].ok;
+    total += consumers[i].count;
+  }
+  bool once = true;
+  for (uint32_t i = 0; i < IPC_PRODUCERS * IPC_PER_PRODUCER; i++) {
+    once = once && atomic_load(&g_ipc_seen[i]) == 1;
+  }
+  check(once && total == IPC_PRODUCERS * IPC_PER_PRODUCER,
+        "ipc mpmc: every message is received exactly once");
+  check(in_order, "ipc mpmc: each producer's messages stay in order");
+  ipc_channel_destroy(channel);
+
+  // Blocking receive: parks, wakes on a send, times out, wakes on close.
+  channel = ipc_channel_create(NULL, IPC_SPSC, 16);
+  pthread_create(&thread, NULL, send_after_delay, channel);
+  bool woke = ipc_receive(channel, &message, -1) && message_seq(&message) == 42;
+  pthread_join(thread, NULL);
+  IpcChannelStats stats;
+  ipc_channel_get_stats(channel, &stats);
+  check(woke && stats.parks >= 1 && stats.wakes >= 1,
+        "ipc: a parked receiver wakes on the next send");
+  uint64_t start = now_ns();
+  bool timed_out = !ipc_receive(channel, &message, 5000000);
+  uint64_t waited = now_ns() - start;
+  check(timed_out && waited >= 5000000 && waited < 500000000,
+        "ipc: a receive with a timeout gives up after it");
+  pthread_create(&thread, NULL, close_after_delay, channel);
+  bool closed = !ipc_receive(channel, &message, -1);
+  pthread_join(thread, NULL);
+  check(closed, "ipc: closing the channel wakes a parked receiver");
+  ipc_channel_destroy(channel);
+}
+
+static void test_ipc_payloads(void) {
+  // Destroy returns the blocks of payloads nobody received.
+  PhysicalMemory *pmm = pmm_kernel();
+  uint64_t used = pmm_used_bytes(pmm);
+  IpcChannel *channel = ipc_channel_create(NULL, IPC_MPMC, 8);
+  for (int i = 0; i < 4; i++) {
+    IpcMessage message;
+    if (ipc_payload_alloc(&message, 1, IPC_PAYLOAD_BYTES)) {
+      send_retry(channel, &message);
+    }
+  }
+  bool held = pmm_used_bytes(pmm) > used + 4 * IPC_PAYLOAD_BYTES - 1;
+  ipc_channel_destroy(channel);
+  check(held && pmm_used_bytes(pmm) == used,
+        "ipc: destroying a channel frees queued page payloads");
+
+  // Between processes: the block moves owner, never bytes.
+  kernel_init();
+  g_payload_channel = ipc_channel_create(NULL, IPC_SPSC, 4);
+  atomic_store(&g_payload_charged, false);
+  atomic_store(&g_payload_delivered, false);
+  process_create("ipc receiver", payload_receiver_entry);
+  process_create("ipc sender", payload_sender_entry);
+  kernel_run();
+  check(atomic_load(&g_payload_charged),
+        "ipc: a payload is charged to its sender, then to the kernel in "
+        "flight");
+  check(atomic_load(&g_payload_delivered),
+        "ipc: the receiver gets the same pages, charged to it, uncopied");
+  ipc_channel_destroy(g_payload_channel);
+}
+
+// Ping-pong: the echo thread bounces every message back.
+static void *ipc_echo(void *opaque) {
+  IpcChannel **pair = (IpcChannel **)opaque;
+  IpcMessage message;
+  while (ipc_receive(pair[0], &message, -1)) {
+    send_retry(pair[1], &message);
+  }
+  return NULL;
+}
+
+static void bench_ping_pong(uint32_t trips) {
+  IpcChannel *pair[2] = {ipc_channel_create(NULL, IPC_SPSC, 64),
+                         ipc_channel_create(NULL, IPC_SPSC, 64)};
+  pthread_t thread;
+  pthread_create(&thread, NULL, ipc_echo, pair);
+  IpcMessage message;
+  for (uint32_t n = 0; n < trips / 10; n++) { // warm up
+    send_tagged(pair[0], 0, n);
+    ipc_receive(pair[1], &message, -1);
+  }
+  IpcChannelStats before[2];
+  ipc_channel_get_stats(pair[0], &before[0]);
+  ipc_channel_get_stats(pair[1], &before[1]);
+  uint64_t start = now_ns();
+  for (uint32_t n = 0; n < trips; n++) {
+    send_tagged(pair[0], 0, n);
+    ipc_receive(pair[1], &message, -1);
+  }
+  double ns = (double)(now_ns() - start) / trips;
+  IpcChannelStats after[2];
+  ipc_channel_get_stats(pair[0], &after[0]);
+  ipc_channel_get_stats(pair[1], &after[1]);
+  ipc_channel_close(pair[0]);
+  pthread_join(thread, NULL);
+  uint64_t parks = after[0].parks - before[0].parks + after[1].parks -
+                   before[1].parks;
+  printf("ping-pong: %u round trips, %.0f ns each, %.3f parks per trip\n",
+         trips, ns, (double)parks / trips);
+  ipc_channel_destroy(pair[0]);
+  ipc_channel_destroy(pair[1]);
+}
+
+typedef struct {
+  IpcChannel *channel;
+  uint32_t count;
+  size_t payload; // 0: inline messages
+} IpcBulk;
+
+static void *bulk_producer(void *opaque) {
+  IpcBulk *bulk = (IpcBulk *)opaque;
+  uint8_t bytes[IPC_INLINE_SIZE] = {0};
+  for (uint32_t n = 0; n < bulk->count; n++) {
+    if (!bulk->payload) {
+      memcpy(bytes, &n, sizeof(n));
+      while (!ipc_send_bytes(bulk->channel, 1, bytes, IPC_INLINE_SIZE)) {
+        sched_yield();
+      }
+      continue;
+    }
+    IpcMessage message;
+    uint8_t *pages;
+    while (!(pages = ipc_payload_alloc(&message, 1, bulk->payload))) {
+      sched_yield();
+    }
+    for (size_t offset = 0; offset < bulk->payload; offset += PMM_PAGE_SIZE) {
+      memcpy(pages + offset, &n, sizeof(n));
+    }
+    send_retry(bulk->channel, &message);
+  }
+  return NULL;
+}
+
+static void bench_bulk(const char *label, IpcMode mode, uint32_t count,
+                       size_t payload) {
+  IpcBulk bulk = {ipc_channel_create(NULL, mode, payload ? 64 : 1024), count,
+                  payload};
+  pthread_t thread;
+  uint64_t start = now_ns();
+  pthread_create(&thread, NULL, bulk_producer, &bulk);
+  IpcMessage message;
+  uint64_t sum = 0;
+  for (uint32_t n = 0; n < count; n++) {
+    ipc_receive(bulk.channel, &message, -1);
+    const uint8_t *data = ipc_payload_data(&message);
+    for (uint32_t offset = 0; offset < message.length;
+         offset += PMM_PAGE_SIZE) {
+      uint32_t seq;
+      memcpy(&seq, data + offset, sizeof(seq));
+      sum += seq;
+    }
+    ipc_payload_free(&message);
+  }
+  pthread_join(thread, NULL);
+  double seconds = (double)(now_ns() - start) / 1e9;
+  IpcChannelStats stats;
+  ipc_channel_get_stats(bulk.channel, &stats);
+  ipc_channel_destroy(bulk.channel);
+  size_t bytes = payload ? payload : IPC_INLINE_SIZE;
+  printf("%-22s %10u %12.0f %10.2f %8llu %8llu\n", label, count,
+         count / seconds, (double)count * bytes / seconds / 1e9,
+         (unsigned long long)stats.parks, (unsigned long long)stats.full);
+  g_sink += sum;
+}
+
+static void bench_ipc(void) {
+  bench_ping_pong(200000);
+  printf("%-22s %10s %12s %10s %8s %8s\n", "bulk", "messages", "messages/s",
+         "GB/s", "parks", "full");
+  bench_bulk("spsc inline 40 B", IPC_SPSC, 4000000, 0);
+  bench_bulk("mpmc inline 40 B", IPC_MPMC, 4000000, 0);
+  bench_bulk("spsc pages 64 KB", IPC_SPSC, 200000, IPC_PAYLOAD_BYTES);
+
+  // What the page path saves: copying the same payloads once.
+  uint8_t *from = malloc(IPC_PAYLOAD_BYTES);
+  uint8_t *to = malloc(IPC_PAYLOAD_BYTES);
+  memset(from, 1, IPC_PAYLOAD_BYTES);
+  uint64_t start = now_ns();
+  for (int n = 0; n < 20000; n++) {
+    from[n % IPC_PAYLOAD_BYTES] = (uint8_t)n;
+    memcpy(to, from, IPC_PAYLOAD_BYTES);
+    g_sink += to[n % IPC_PAYLOAD_BYTES];
+  }
+  double seconds = (double)(now_ns() - start) / 1e9;
+  printf("for comparison, memcpy of 64 KB payloads: %.2f GB/s\n",
+         20000.0 * IPC_PAYLOAD_BYTES / seconds / 1e9);
+  free(from);
+  free(to);
+  printf("page payloads move by handle: the GB/s is the payload size over "
+         "the per-message cost, not a copy\n");
+}
+
+// ============================================================================
+// Main
+// ============================================================================
+
+static int usage(void) {
+  fprintf(stderr, "usage: kerneltool test\n"
+                  "       kerneltool bench scheduler\n"
+                  "       kerneltool bench smp [cores]\n"
+                  "       kerneltool bench ipc\n");
+  return 2;
+}
+
+int main(int argc, char **argv) {
+  if (argc == 2 && strcmp(argv[1], "test") == 0) {
+    test_scheduler_levels();
+    test_scheduler_simulation();
+    test_kernel_destroy_running();
+    test_kernel_smp();
+    test_kernel_smp_wakeup();
+    test_ipc_rings();
+    test_ipc_threads();
+    test_ipc_payloads();
+    printf("%s\n", g_failures ? "FAILED" : "all checks passed");
+    return g_failures ? 1 : 0;
+  }
+  if (argc >= 3 && strcmp(argv[1], "bench") == 0) {
+    if (argc == 3 && strcmp(argv[2], "scheduler") == 0) {
+      bench_scheduler();
+      return 0;
+    }
+    if (argc == 3 && strcmp(argv[2], "ipc") == 0) {
+      bench_ipc();
+      return 0;
+    }
+    if (argc <= 4 && strcmp(argv[2], "smp") == 0) {
+      long cores = argc == 4 ? atol(argv[3]) : sysconf(_SC_NPROCESSORS_ONLN);
+      if (cores < 1 || cores > KERNEL_MAX_CORES) {
+        cores = cores < 1 ? 1 : KERNEL_MAX_CORES;
+      }
+      bench_smp((uint32_t)cores);
+      return 0;
+    }
+  }
+  return usage();
+}
@@ -0,0 +1,445 @@
+// logtool - decodes binary logs, checks and benchmarks the logger
+//
+//   logtool decode <file.oslog>         print a binary log as text
+//   logtool test                        correctness checks (exit status 1 on
+//                                       any failure)
+//   logtool bench [threads] [burst]     time the LOG_* hot path
+
+#include "logger.h"
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// ============================================================================
+// Helpers
+// ============================================================================
+
+static int g_failures;
+
+static void check(bool ok, const char *name) {
+  printf("%s %s\n", ok ? "PASS" : "FAIL", name);
+  if (!ok) {
+    g_failures++;
+  }
+}
+
+static void temp_path(char *path, size_t size, const char *name) {
+  snprintf(path, size, "/tmp/logtool-%d-%s", (int)getpid(), name);
+}
+
+// One line of log_decode_file output.
+typedef struct {
+  double seconds;
+  unsigned ring;
+  char level[16];
+  char file[LOG_STRING_MAX + 1];
+  int line;
+  const char *message;
+} DecodedLine;
+
+static bool parse_decoded(char *text, DecodedLine *line) {
+  text[strcspn(text, "\n")] = '\0';
+  int offset = 0;
+  if (sscanf(text, "%lf [%u] [%15[^]]] %256[^:]:%d: %n", &line->seconds,
+             &line->ring, line->level, line->file, &line->line,
+             &offset) != 5 ||
+      offset == 0) {
+    return false;
+  }
+  line->message = text + offset;
+  return true;
+}
+
+// The decoded text of a binary log, rewound; complete is what
+// log_decode_file returned.
+static FILE *decode_to_temp(const char *path, bool *complete) {
+  FILE *out = tmpfile();
+  if (out) {
+    *complete = log_decode_file(path, out);
+    rewind(out);
+  }
+  return out;
+}
+
+// ============================================================================
+// Checks
+// ============================================================================
+
+// Each EXPECT logs through its own call site and records what printf makes
+// of the same format and arguments.
+#define EXPECT_MAX 64
+static char g_expected[EXPECT_MAX][LOG_LINE_MAX];
+static int g_expected_count;
+
+#define EXPECT(fmt, ...)                                                      \
+  do {                                                                        \
+    LOG_AT_(LOG_ERROR_LEVEL, fmt, ##__VA_ARGS__);                             \
+    snprintf(g_expected[g_expected_count++], LOG_LINE_MAX, fmt,               \
+             ##__VA_ARGS__);                                                  \
+  } while (0)
+
+static int g_evaluated;
+
+static int evaluate(void) { return ++g_evaluated; }
+
+static void test_formats(void) {
+  char path[64];
+  temp_path(path, sizeof(path), "formats.oslog");
+  bool opened = log_set_output(path);
+  g_expected_count = 0;
+
+  EXPECT("plain text");
+  EXPECT("int %d unsigned %u hex %x octal %o", -42, 42u, 0xbeefu, 8u);
+  EXPECT("char %c percent %% width [%5d] left [%-5d] zero [%05d]", 'z', 7, 7,
+         7);
+  EXPECT("long %ld llong %lld ullong %llu", -1234567890L,
+         -123456789012345LL, 18446744073709551615ULL);
+  EXPECT("size %zu ptrdiff %td intmax %jd", (size_t)123456, (ptrdiff_t)-99,
+         (intmax_t)-7);
+  EXPECT("short %hd char %hhd", (short)-3, (signed char)-4);
+  EXPECT("double %f %.2f %e %g", 3.5, 2.0 / 3.0, 12345.678, 0.0001);
+  EXPECT("long double %Lf", (long double)1.25);
+  EXPECT("pointer %p", (void *)0x1234);
+  EXPECT("string [%s] [%10s] [%-6s|]", "abc", "right", "left");
+  EXPECT("star width [%*d] precision [%.*f] both [%*.*s]", 6, 42, 3, 3.14159,
+         8, 3, "truncate");
+  EXPECT("precision [%.3s] after [%d]", "abcdef", 5);
+
+  // Strings are copied at the call, cut at LOG_STRING_MAX.
+  char buffer[16] = "before";
+  LOG_AT_(LOG_ERROR_LEVEL, "copy %s", buffer);
+  strcpy(buffer, "after!");
+  strcpy(g_expected[g_expected_count++], "copy before");
+  char long_text[LOG_STRING_MAX * 2];
+  memset(long_text, 'x', sizeof(long_text) - 1);
+  long_text[sizeof(long_text) - 1] = '\0';
+  LOG_AT_(LOG_ERROR_LEVEL, "long %s", long_text);
+  snprintf(g_expected[g_expected_count++], LOG_LINE_MAX, "long %.*s",
+           LOG_STRING_MAX, long_text);
+  const char *null_text = NULL;
+  LOG_AT_(LOG_ERROR_LEVEL, "null %s", null_text);
+  strcpy(g_expected[g_expected_count++], "null (null)");
+
+  // A precision lets %s take an array with no terminator; the capture must
+  // not read past it. Here the next byte is an unmapped page.
+  long page = sysconf(_SC_PAGESIZE);
+  char *pages = mmap(NULL, (size_t)page * 2, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  bool mapped = pages != MAP_FAILED &&
+                mprotect(pages + page, (size_t)page, PROT_NONE) == 0;
+  if (mapped) {
+    char *fourcc = pages + page - 4;
+    memcpy(fourcc, "RIFF", 4);
+    LOG_AT_(LOG_ERROR_LEVEL, "tag %.4s and %.*s", fourcc, 4, fourcc);
+    strcpy(g_expected[g_expected_count++], "tag RIFF and RIFF");
+    // Strings ending on the page's last byte, at every offset in a word.
+    for (int length = 0; length < 16; length++) {
+      char *text = pages + page - 1 - length;
+      memset(text, 'a' + length, (size_t)length);
+      text[length] = '\0';
+      LOG_AT_(LOG_ERROR_LEVEL, "edge [%s] [%.*s]", text, length / 2, text);
+      snprintf(g_expected[g_expected_count++], LOG_LINE_MAX,
+               "edge [%s] [%.*s]", text, length / 2, text);
+    }
+  }
+
+  // Untracked calls format on the caller.
+  log_message(LOG_ERROR_LEVEL, "untracked.c", 7, "untracked %d %s", 5, "ok");
+  strcpy(g_expected[g_expected_count++], "untracked 5 ok");
+
+  log_set_output(NULL);
+  if (mapped) {
+    munmap(pages, (size_t)page * 2);
+  }
+
+  bool complete = false;
+  FILE *decoded = decode_to_temp(path, &complete);
+  char text[LOG_LINE_MAX + 512];
+  int matched = 0;
+  int lines = 0;
+  bool sites = true;
+  while (decoded && fgets(text, sizeof(text), decoded)) {
+    DecodedLine line;
+    bool parsed = parse_decoded(text, &line);
+    bool same = parsed && lines < g_expected_count &&
+                strcmp(line.message, g_expected[lines]) == 0;
+    if (parsed && lines < g_expected_count && !same) {
+      printf("  expected \"%s\"\n  decoded  \"%s\"\n", g_expected[lines],
+             line.message);
+    }
+    matched += same;
+    bool untracked = lines == g_expected_count - 1;
+    sites = sites && parsed && strcmp(line.level, "ERROR") == 0 &&
+            strstr(line.file, untracked ? "untracked.c" : "logtool.c") &&
+            (untracked ? line.line == 7 : line.line > 0);
+    lines++;
+  }
+  if (decoded) {
+    fclose(decoded);
+  }
+  check(opened && complete && lines == g_expected_count &&
+            matched == g_expected_count,
+        "logger: decoded messages match printf for every conversion");
+  check(sites, "logger: decoded lines carry their level, file and line");
+  check(mapped, "logger: a precision bounds how much of a string is read");
+
+  // A log cut short still decodes up to the cut.
+  char cut_path[64];
+  temp_path(cut_path, sizeof(cut_path), "cut.oslog");
+  FILE *in = fopen(path, "rb");
+  FILE *out = fopen(cut_path, "wb");
+  size_t size = 0;
+  int c;
+  while (in && out && (c = fgetc(in)) != EOF) {
+    fputc(c, out);
+    size++;
+  }
+  if (in) {
+    fclose(in);
+  }
+  if (out) {
+    fclose(out);
+  }
+  bool cut = truncate(cut_path, (off_t)(size - 5)) == 0;
+  decoded = decode_to_temp(cut_path, &complete);
+  lines = 0;
+  while (decoded && fgets(text, sizeof(text), decoded)) {
+    lines++;
+  }
+  if (decoded) {
+    fclose(decoded);
+  }
+  check(cut && !complete && lines == g_expected_count - 1,
+        "logger: a truncated log decodes up to the cut and reports it");
+  remove(cut_path);
+  remove(path);
+}
+
+static void test_text_output(void) {
+  // The default sink formats to stderr.
+  g_evaluated = 0;
+  fflush(stderr);
+  int saved = dup(2);
+  FILE *capture = tmpfile();
+  bool redirected = saved >= 0 && capture && dup2(fileno(capture), 2) >= 0;
+  LOG_WARN("to stderr %d %s", evaluate() + 11, "text");
+  log_flush();
+  fflush(stderr);
+  if (redirected) {
+    dup2(saved, 2);
+  }
+  if (saved >= 0) {
+    close(saved);
+  }
+  char text[LOG_LINE_MAX + 512] = "";
+  bool read = capture && fseek(capture, 0, SEEK_SET) == 0 &&
+              fgets(text, sizeof(text), capture);
+  if (capture) {
+    fclose(capture);
+  }
+  check(redirected && read && strncmp(text, "[WARN] ", 7) == 0 &&
+            strstr(text, "logtool.c:") &&
+            strstr(text, ": to stderr 12 text\n"),
+        "logger: the default sink writes \"[LEVEL] file:line: message\"");
+
+  // Levels above LOG_LEVEL compile out, arguments and all.
+  LogStats before;
+  LogStats after;
+  log_get_stats(&before);
+  LOG_DEBUG("debug %d", evaluate());
+  LOG_INFO("info %d", evaluate());
+  log_message(LOG_DEBUG_LEVEL, __FILE__, __LINE__, "runtime %d", 1);
+  log_get_stats(&after);
+  check(LOG_LEVEL == 2 && g_evaluated == 1 && after.written == before.written,
+        "logger: levels above LOG_LEVEL cost nothing and log nothing");
+}
+
+typedef struct {
+  int index;
+  int messages;
+  bool pause; // flush every 1000 messages, so nothing is dropped
+} LogWorker;
+
+static void *log_worker(void *opaque) {
+  LogWorker *worker = (LogWorker *)opaque;
+  for (int n = 0; n < worker->messages; n++) {
+    LOG_AT_(LOG_ERROR_LEVEL, "worker %d seq %d", worker->index, n);
+    if (worker->pause && n % 1000 == 999) {
+      log_flush();
+    }
+  }
+  return NULL;
+}
+
+// Decodes path and checks that each worker's messages arrive in order with
+// non-decreasing timestamps; returns the messages and the dropped count.
+static bool read_workers(const char *path, int workers, uint64_t *messages,
+                         uint64_t *dropped) {
+  bool complete = false;
+  FILE *decoded = decode_to_temp(path, &complete);
+  int next[8] = {0};
+  double last[8] = {0};
+  bool ordered = decoded != NULL;
+  *messages = 0;
+  *dropped = 0;
+  char text[LOG_LINE_MAX + 512];
+  while (decoded && fgets(text, sizeof(text), decoded)) {
+    unsigned long long count;
+    DecodedLine line;
+    int index;
+    int seq;
+    if (strstr(text, "logger: dropped") &&
+        sscanf(strstr(text, "dropped"), "dropped %llu", &count) == 1) {
+      *dropped += count;
+    } else if (parse_decoded(text, &line) &&
+               sscanf(line.message, "worker %d seq %d", &index, &seq) == 2 &&
+               index >= 0 && index < workers) {
+      // Drops leave gaps, never reorderings
+      ordered = ordered && seq >= next[index] && line.seconds >= last[index];
+      next[index] = seq + 1;
+      last[index] = line.seconds;
+      (*messages)++;
+    } else {
+      ordered = false;
+    }
+  }
+  if (decoded) {
+    fclose(decoded);
+  }
+  return ordered && complete;
+}
+
+static void test_threads(void) {
+  char path[64];
+  temp_path(path, sizeof(path), "threads.oslog");
+
+  // Four threads that give the drainer room: every message arrives.
+  enum { WORKERS = 4, MESSAGES = 20000 };
+  LogStats before;
+  LogStats after;
+  log_get_stats(&before);
+  bool opened = log_set_output(path);
+  pthread_t threads[WORKERS];
+  LogWorker workers[WORKERS];
+  for (int i = 0; i < WORKERS; i++) {
+    workers[i] = (LogWorker){i, MESSAGES, true};
+    pthread_create(&threads[i], NULL, log_worker, &workers[i]);
+  }
+  for (int i = 0; i < WORKERS; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  log_set_output(NULL);
+  log_get_stats(&after);
+  uint64_t messages = 0;
+  uint64_t dropped = 0;
+  bool ordered = read_workers(path, WORKERS, &messages, &dropped);
+  check(opened && ordered && messages == WORKERS * MESSAGES &&
+            dropped == 0 && after.written - before.written == messages &&
+            after.dropped == before.dropped,
+        "logger: four threads' messages all arrive, each thread's in order");
+
+  // One thread far faster than the drainer: drops are counted, and every
+  // call is either written or dropped.
+  enum { FLOOD = 300000 };
+  log_get_stats(&before);
+  opened = log_set_output(path);
+  LogWorker flood = {0, FLOOD, false};
+  pthread_t thread;
+  pthread_create(&thread, NULL, log_worker, &flood);
+  pthread_join(thread, NULL);
+  log_set_output(NULL);
+  log_get_stats(&after);
+  ordered = read_workers(path, 1, &messages, &dropped);
+  uint64_t written = after.written - before.written;
+  check(opened && ordered && written + (after.dropped - before.dropped) ==
+                                 FLOOD &&
+            messages == written && messages + dropped == FLOOD,
+        "logger: a full ring drops and counts rather than blocking");
+
+  // Threads that come and go take over drained rings instead of each
+  // leaving another one behind.
+  enum { SHORT_LIVED = 64 };
+  log_get_stats(&before);
+  opened = log_set_output(path);
+  for (int i = 0; i < SHORT_LIVED; i++) {
+    LogWorker brief = {0, 10, true};
+    pthread_create(&thread, NULL, log_worker, &brief);
+    pthread_join(thread, NULL);
+    log_flush();
+  }
+  log_set_output(NULL);
+  log_get_stats(&after);
+  check(opened && after.threads <= before.threads + 1 &&
+            after.written - before.written == SHORT_LIVED * 10 &&
+            after.dropped == before.dropped,
+        "logger: exited threads' rings are reused once drained");
+  remove(path);
+}
+
+// ============================================================================
+// Main
+// ============================================================================
+
+static int usage(void) {
+  fprintf(stderr, "usage: logtool decode <file>\n"
+                  "       logtool test\n"
+                  "       logtool bench [threads] [burst]\n");
+  return 2;
+}
+
+// Best of three runs: on a shared machine the slow runs measure neighbours.
+static int run_bench(uint32_t threads, uint64_t burst) {
+  for (int strings = 0; strings < 2; strings++) {
+    LogBenchConfig config = {threads, 4000000 / threads, burst, strings != 0,
+                             NULL};
+    LogBenchResult best = {0};
+    for (int run = 0; run < 3; run++) {
+      LogBenchResult result;
+      if (!log_benchmark(&config, &result)) {
+        fprintf(stderr, "logtool: benchmark failed\n");
+        return 1;
+      }
+      if (run == 0 || result.ns_per_call - result.ns_per_timestamp <
+                          best.ns_per_call - best.ns_per_timestamp) {
+        best = result;
+      }
+    }
+    // The tick read costs what the clock costs; the target is for the rest.
+    double untimed = best.ns_per_call - best.ns_per_timestamp;
+    printf("%u thread(s), %s: %.1f ns/call, %.1f ns without the %.1f ns "
+           "timestamp read (%s 20 ns), %llu written, %llu dropped\n",
+           threads, strings ? "int + string args" : "int args",
+           best.ns_per_call, untimed, best.ns_per_timestamp,
+           untimed < 20.0 ? "under" : "OVER", (unsigned long long)best.written,
+           (unsigned long long)best.dropped);
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc == 2 && strcmp(argv[1], "test") == 0) {
+    test_formats();
+    test_text_output();
+    test_threads();
+    printf("%s\n", g_failures ? "FAILED" : "all checks passed");
+    return g_failures ? 1 : 0;
+  }
+  if (argc == 3 && strcmp(argv[1], "decode") == 0) {
+    if (!log_decode_file(argv[2], stdout)) {
+      fprintf(stderr, "logtool: %s is not a complete log\n", argv[2]);
+      return 1;
+    }
+    return 0;
+  }
+  if (argc >= 2 && argc <= 4 && strcmp(argv[1], "bench") == 0) {
+    uint32_t threads = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 10) : 1;
+    uint64_t burst = argc > 3 ? strtoull(argv[3], NULL, 10) : 4096;
+    return run_bench(threads ? threads : 1, burst);
+  }
+  return usage();
+}
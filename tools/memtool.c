@@ -0,0 +1,1025 @@
+// memtool - checks and benchmarks for the allocators and containers in
+// utils.h
+//
+//   memtool test                 correctness checks (exit status 1 on any
+//                                failure)
+//   memtool bench pool [threads] ns per allocate/free pair, MemoryPool
+//                                against malloc, 1 thread up to `threads`
+//                                (default 4)
+//   memtool bench pmm [operations]
+//                                ns per page-block and slab alloc/free
+//                                pair, then alloc/free rate over a long
+//                                churn (default 20M operations) on 512 MB
+//                                and the fragmentation it leaves
+//   memtool bench hashmap [max]  ns per insert, lookup hit, lookup miss and
+//                                remove at 1K entries up to `max` (default
+//                                10M), plus the 99th percentile and maximum
+//                                of the inserts that start a resize or
+//                                release the old table
+//   memtool bench arena          ns per frame-arena allocation against
+//                                malloc + free, and the blocks the arena
+//                                ends up holding
+
+#include "frame_arena.h"
+#include "kernel.h"
+#include "os_config.h"
+#include "pmm.h"
+#include "utils.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// ============================================================================
+// Helpers
+// ============================================================================
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// xorshift64*, so every run sees the same sequence.
+static uint64_t next_random(uint64_t *state) {
+  uint64_t x = *state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *state = x;
+  return x * 0x2545f4914f6cdd1dull;
+}
+
+static int g_failures;
+static volatile uint64_t g_sink; // keeps timed loops from being optimized away
+
+static void check(bool ok, const char *name) {
+  printf("%s %s\n", ok ? "PASS" : "FAIL", name);
+  if (!ok) {
+    g_failures++;
+  }
+}
+
+// ============================================================================
+// Memory pool
+// ============================================================================
+
+#define POOL_TEST_BLOCK 48
+
+static void test_pool_single(void) {
+  MemoryPool *pool = pool_create(POOL_TEST_BLOCK, 64);
+  const uint32_t count = 5000;
+  void **blocks = (void **)calloc(count, sizeof(void *));
+  bool aligned = true;
+  for (uint32_t i = 0; i < count; i++) {
+    blocks[i] = pool_allocate(pool);
+    aligned = aligned && blocks[i] && ((uintptr_t)blocks[i] & 15) == 0;
+    if (blocks[i]) {
+      memset(blocks[i], (int)(i & 0xff), POOL_TEST_BLOCK);
+    }
+  }
+  bool intact = true;
+  for (uint32_t i = 0; i < count && aligned; i++) {
+    const uint8_t *bytes = (const uint8_t *)blocks[i];
+    intact = intact && bytes[0] == (uint8_t)i &&
+             bytes[POOL_TEST_BLOCK - 1] == (uint8_t)i;
+  }
+  check(aligned, "pool: 5000 blocks, all 16-byte aligned");
+  check(intact, "pool: blocks do not overlap");
+
+  MemoryPoolStats stats;
+  pool_get_stats(pool, &stats);
+  check(stats.allocs == count && stats.in_use == count &&
+            stats.high_water >= count && stats.capacity >= count &&
+            stats.chunks > 1,
+        "pool: grows by chunks and counts allocations");
+  uint32_t peak_chunks = stats.chunks;
+
+  // Free every other block: half of each chunk is stranded.
+  for (uint32_t i = 0; i < count; i += 2) {
+    pool_free(pool, blocks[i]);
+  }
+  pool_get_stats(pool, &stats);
+  check(stats.frees == count / 2 && stats.fragmentation > 0.3f,
+        "pool: fragmentation reports stranded free blocks");
+  for (uint32_t i = 1; i < count; i += 2) {
+    pool_free(pool, blocks[i]);
+  }
+  pool_get_stats(pool, &stats);
+  // Only one spare chunk and those under this thread's magazine stay.
+  check(stats.in_use == 0 && stats.chunks <= peak_chunks / 10,
+        "pool: empty chunks go back to the system");
+  free(blocks);
+  pool_destroy(pool);
+}
+
+typedef struct {
+  MemoryPool *pool;
+  uint32_t id;
+  uint32_t ops;
+  bool ok;
+} PoolWorker;
+
+// Random allocate/free with a tag in each block, so a block handed to two
+// holders at once shows up as a clobbered tag.
+static void *pool_worker(void *arg) {
+  PoolWorker *worker = (PoolWorker *)arg;
+  enum { LIVE = 256 };
+  uint64_t *live[LIVE] = {0};
+  uint64_t state = 0x9e3779b97f4a7c15ull * (worker->id + 1);
+  worker->ok = true;
+  for (uint32_t op = 0; op < worker->ops; op++) {
+    uint32_t slot = (uint32_t)(next_random(&state) % LIVE);
+    uint64_t tag = ((uint64_t)worker->id << 32) | slot;
+    if (live[slot]) {
+      worker->ok = worker->ok && *live[slot] == tag;
+      pool_free(worker->pool, live[slot]);
+      live[slot] = NULL;
+    } else {
+      live[slot] = (uint64_t *)pool_allocate(worker->pool);
+      if (!live[slot]) {
+        worker->ok = false;
+        continue;
+      }
+      *live[slot] = tag;
+    }
+  }
+  for (uint32_t slot = 0; slot < LIVE; slot++) {
+    if (live[slot]) {
+      worker->ok = worker->ok &&
+                   *live[slot] == (((uint64_t)worker->id << 32) | slot);
+      pool_free(worker->pool, live[slot]);
+    }
+  }
+  return NULL;
+}
+
+static void test_pool_threads(void) {
+  MemoryPool *pool = pool_create(POOL_TEST_BLOCK, 128);
+  enum { THREADS = 4 };
+  PoolWorker workers[THREADS];
+  pthread_t threads[THREADS];
+  for (uint32_t i = 0; i < THREADS; i++) {
+    workers[i] = (PoolWorker){pool, i, 200000, false};
+    pthread_create(&threads[i], NULL, pool_worker, &workers[i]);
+  }
+  bool ok = true;
+  for (uint32_t i = 0; i < THREADS; i++) {
+    pthread_join(threads[i], NULL);
+    ok = ok && workers[i].ok;
+  }
+  check(ok, "pool: 4 threads never share a block");
+
+  // Exited threads hand their magazines back.
+  MemoryPoolStats stats;
+  pool_get_stats(pool, &stats);
+  check(stats.allocs == stats.frees && stats.in_use == 0 && stats.chunks <= 1,
+        "pool: exited threads return their magazines");
+  pool_destroy(pool);
+}
+
+typedef struct {
+  MemoryPool *pool; // NULL: malloc
+  uint32_t rounds;
+  uint64_t elapsed_ns;
+} PoolBench;
+
+// Bursts of 64 allocations then 64 frees, like building and dropping a
+// frame's window or texture headers.
+static void *pool_bench_worker(void *arg) {
+  PoolBench *bench = (PoolBench *)arg;
+  void *blocks[64];
+  uint64_t start = now_ns();
+  for (uint32_t r = 0; r < bench->rounds; r++) {
+    for (int i = 0; i < 64; i++) {
+      blocks[i] = bench->pool ? pool_allocate(bench->pool)
+                              : malloc(POOL_TEST_BLOCK);
+      *(volatile char *)blocks[i] = (char)i;
+    }
+    for (int i = 63; i >= 0; i--) {
+      if (bench->pool) {
+        pool_free(bench->pool, blocks[i]);
+      } else {
+        free(blocks[i]);
+      }
+    }
+  }
+  bench->elapsed_ns = now_ns() - start;
+  return NULL;
+}
+
+static double pool_bench_run(MemoryPool *pool, uint32_t threads) {
+  PoolBench benches[64];
+  pthread_t ids[64];
+  for (uint32_t i = 0; i < threads; i++) {
+    benches[i] = (PoolBench){pool, 20000, 0};
+    pthread_create(&ids[i], NULL, pool_bench_worker, &benches[i]);
+  }
+  uint64_t total = 0;
+  for (uint32_t i = 0; i < threads; i++) {
+    pthread_join(ids[i], NULL);
+    total += benches[i].elapsed_ns;
+  }
+  return (double)total / ((double)threads * 20000.0 * 64.0);
+}
+
+static void bench_pool(uint32_t max_threads) {
+  printf("%u-byte blocks, bursts of 64 allocations then 64 frees\n",
+         POOL_TEST_BLOCK);
+  printf("%-8s %12s %12s\n", "threads", "pool ns/op", "malloc ns/op");
+  for (uint32_t threads = 1; threads <= max_threads; threads *= 2) {
+    MemoryPool *pool = pool_create(POOL_TEST_BLOCK, 256);
+    double pool_ns = pool_bench_run(pool, threads);
+    double malloc_ns = pool_bench_run(NULL, threads);
+    printf("%-8u %12.1f %12.1f\n", threads, pool_ns, malloc_ns);
+    pool_destroy(pool);
+  }
+}
+
+// ============================================================================
+// Hash map
+// ============================================================================
+
+// Values are never NULL in the map, so a key's value encodes key + 1.
+static void *value_for(uint64_t key) { return (void *)(uintptr_t)(key + 1); }
+
+static void test_hashmap_reference(void) {
+  // Random puts and removes over a small key space, checked against a
+  // plain array through many incremental resizes.
+  enum { KEYS = 20000 };
+  uint64_t *reference = (uint64_t *)calloc(KEYS, sizeof(uint64_t));
+  HashMap *map = hashmap_create(0);
+  uint64_t state = 8;
+  size_t count = 0;
+  bool agrees = true;
+  for (uint32_t op = 0; op < 400000 && agrees; op++) {
+    uint64_t r = next_random(&state);
+    // Spread keys so neighbours do not share low bits.
+    uint64_t index = (r >> 8) % KEYS;
+    uint64_t key = index * 0x100000001b3ull;
+    if ((r & 3) != 0) {
+      uint64_t value = (r >> 32) | 1;
+      count += reference[index] == 0;
+      reference[index] = value;
+      hashmap_put(map, key, (void *)(uintptr_t)value);
+    } else {
+      count -= reference[index] != 0;
+      reference[index] = 0;
+      hashmap_remove(map, key);
+    }
+    if (op % 50000 == 0 || op == 399999) {
+      for (uint64_t k = 0; k < KEYS; k++) {
+        void *found = hashmap_get(map, k * 0x100000001b3ull);
+        agrees = agrees && (uint64_t)(uintptr_t)found == reference[k];
+      }
+      agrees = agrees && map->count == count;
+    }
+  }
+  check(agrees, "hashmap: random puts and removes match a reference");
+  hashmap_destroy(map);
+  free(reference);
+}
+
+static void test_hashmap_resize(void) {
+  HashMap *map = hashmap_create(0);
+  bool found = true;
+  bool resized = false;
+  for (uint64_t key = 0; key < 100000; key++) {
+    hashmap_put(map, key, value_for(key));
+    resized = resized || map->old_entries != NULL;
+    // Mid-resize, keys still in the old table must stay visible.
+    if (map->old_entries && key % 97 == 0) {
+      for (uint64_t k = 0; k <= key; k += 31) {
+        found = found && hashmap_get(map, k) == value_for(k);
+      }
+    }
+  }
+  check(resized && found, "hashmap: keys stay visible during a resize");
+  bool absent = true;
+  for (uint64_t key = 100000; key < 110000; key++) {
+    absent = absent && hashmap_get(map, key) == NULL;
+  }
+  check(absent, "hashmap: missing keys are not found");
+  for (uint64_t key = 0; key < 100000; key++) {
+    hashmap_remove(map, key);
+  }
+  bool empty = map->count == 0;
+  for (uint64_t key = 0; key < 100000 && empty; key += 7) {
+    empty = hashmap_get(map, key) == NULL;
+  }
+  check(empty, "hashmap: removing every key empties the map");
+  check(!map->old_entries && !map->retiring,
+        "hashmap: drained tables are released");
+  hashmap_destroy(map);
+}
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+static void bench_hashmap(uint64_t max_entries) {
+  printf("%-10s %10s %10s %10s %10s %12s %12s\n", "entries", "insert", "hit",
+         "miss", "remove", "resize p99", "resize max");
+  for (uint64_t n = 1000; n <= max_entries; n *= 10) {
+    // Ids like window and process ids: dense, so the mixer does the work.
+    HashMap *map = hashmap_create(0);
+    uint64_t *samples = NULL;
+    size_t sample_count = 0;
+    size_t sample_capacity = 0;
+    uint64_t start = now_ns();
+    for (uint64_t key = 0; key < n; key++) {
+      // Only the inserts that allocate the larger table or release the
+      // drained one are timed; the rest would just measure the clock.
+      bool resize = (map->count + 1) * 8 > map->capacity * 7 ||
+                    (map->old_entries &&
+                     map->migrate_pos + 64 >= map->old_capacity) ||
+                    map->retiring;
+      uint64_t t = resize ? now_ns() : 0;
+      hashmap_put(map, key, value_for(key));
+      if (resize) {
+        uint64_t took = now_ns() - t;
+        if (sample_count == sample_capacity) {
+          sample_capacity = sample_capacity ? sample_capacity * 2 : 1024;
+          samples = (uint64_t *)realloc(samples,
+                                        sample_capacity * sizeof(uint64_t));
+        }
+        samples[sample_count++] = took;
+      }
+    }
+    double insert_ns = (double)(now_ns() - start) / (double)n;
+    // A single maximum mostly catches the OS preempting the thread; the
+    // 99th percentile shows what the resize steps themselves cost.
+    qsort(samples, sample_count, sizeof(uint64_t), compare_u64);
+    double p99_us = (double)samples[sample_count * 99 / 100] / 1e3;
+    double max_us = (double)samples[sample_count - 1] / 1e3;
+    free(samples);
+
+    uint64_t state = n;
+    uint64_t sum = 0;
+    uint64_t lookups = n < 1000000 ? 1000000 : n;
+    start = now_ns();
+    for (uint64_t i = 0; i < lookups; i++) {
+      sum += (uintptr_t)hashmap_get(map, next_random(&state) % n);
+    }
+    double hit_ns = (double)(now_ns() - start) / (double)lookups;
+    start = now_ns();
+    for (uint64_t i = 0; i < lookups; i++) {
+      sum += (uintptr_t)hashmap_get(map, n + next_random(&state) % n);
+    }
+    double miss_ns = (double)(now_ns() - start) / (double)lookups;
+    g_sink = sum;
+
+    start = now_ns();
+    for (uint64_t key = 0; key < n; key++) {
+      hashmap_remove(map, key);
+    }
+    double remove_ns = (double)(now_ns() - start) / (double)n;
+    printf("%-10llu %8.1fns %8.1fns %8.1fns %8.1fns %10.1fus %10.1fus\n",
+           (unsigned long long)n, insert_ns, hit_ns, miss_ns, remove_ns,
+           p99_us, max_us);
+    hashmap_destroy(map);
+  }
+}
+
+// ============================================================================
+// Physical memory manager
+// ============================================================================
+
+#define PMM_TEST_PAGES 4096 // 16 MB: four blocks of the largest order
+#define PMM_TEST_BLOCKS 2048
+
+typedef struct {
+  uint8_t *address;
+  uint32_t order;
+  uint32_t owner;
+  uint32_t serial;
+} TestBlock;
+
+// Stamps every page with the allocation's serial, so a block that overlaps
+// another shows when either is freed.
+static void block_stamp(const TestBlock *block) {
+  for (uint32_t page = 0; page < 1u << block->order; page++) {
+    memcpy(block->address + ((size_t)page << PMM_PAGE_SHIFT), &block->serial,
+           sizeof(block->serial));
+  }
+}
+
+static bool block_intact(const TestBlock *block) {
+  for (uint32_t page = 0; page < 1u << block->order; page++) {
+    uint32_t serial;
+    memcpy(&serial, block->address + ((size_t)page << PMM_PAGE_SHIFT),
+           sizeof(serial));
+    if (serial != block->serial) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void test_pmm_buddy(void) {
+  PhysicalMemory *pmm = pmm_create((uint64_t)PMM_TEST_PAGES * PMM_PAGE_SIZE);
+  TestBlock *blocks = (TestBlock *)calloc(PMM_TEST_BLOCKS, sizeof(TestBlock));
+  if (!pmm || !blocks) {
+    check(false, "pmm: allocation");
+    pmm_destroy(pmm);
+    free(blocks);
+    return;
+  }
+  PmmStats stats;
+  pmm_get_stats(pmm, &stats);
+  check(stats.total_pages == PMM_TEST_PAGES &&
+            stats.free_blocks[PMM_MAX_ORDER] == 4 &&
+            stats.largest_free_order == PMM_MAX_ORDER,
+        "pmm: memory starts as blocks of the largest order");
+
+  // Random churn against a model of what each owner holds
+  enum { OWNERS = 8 };
+  uint64_t owner_pages[OWNERS + 1] = {0};
+  uint64_t used = 0;
+  uint32_t count = 0;
+  uint64_t state = 29;
+  bool aligned = true, intact = true, counted = true, owned = true;
+  for (int step = 0; step < 40000; step++) {
+    uint64_t r = next_random(&state);
+    if (r % 1000 == 0) {
+      uint32_t owner = 1 + (uint32_t)(next_random(&state) % OWNERS);
+      uint64_t released = pmm_release_owner(pmm, owner);
+      owned = owned && released == owner_pages[owner];
+      for (uint32_t i = 0; i < count;) {
+        if (blocks[i].owner == owner) {
+          blocks[i] = blocks[--count];
+        } else {
+          i++;
+        }
+      }
+      used -= owner_pages[owner];
+      owner_pages[owner] = 0;
+    } else if (r % 1000 < 20 && count > 0) {
+      TestBlock *block = &blocks[next_random(&state) % count];
+      uint32_t to = 1 + (uint32_t)(next_random(&state) % OWNERS);
+      owned = owned && pmm_transfer_pages(pmm, block->address, to);
+      owner_pages[block->owner] -= 1u << block->order;
+      owner_pages[to] += 1u << block->order;
+      block->owner = to;
+    } else if (count == PMM_TEST_BLOCKS ||
+               (count > 0 &&
+                (r >> 32) % 100 < (used * 10 > PMM_TEST_PAGES * 7ull ? 70u : 35u))) {
+      uint32_t i = (uint32_t)(next_random(&state) % count);
+      intact = intact && block_intact(&blocks[i]);
+      pmm_free_pages(pmm, blocks[i].address);
+      used -= 1u << blocks[i].order;
+      owner_pages[blocks[i].owner] -= 1u << blocks[i].order;
+      blocks[i] = blocks[--count];
+    } else {
+      TestBlock block;
+      block.serial = (uint32_t)step + 1;
+      block.order = (uint32_t)(next_random(&state) % 7);
+      block.owner = 1 + (uint32_t)(next_random(&state) % OWNERS);
+      block.address = (uint8_t *)pmm_alloc_pages(pmm, block.order, block.owner);
+      if (block.address) {
+        uintptr_t size = (uintptr_t)PMM_PAGE_SIZE << block.order;
+        aligned = aligned && ((uintptr_t)block.address & (size - 1)) == 0;
+        block_stamp(&block);
+        blocks[count++] = block;
+        used += 1u << block.order;
+        owner_pages[block.owner] += 1u << block.order;
+      }
+    }
+    counted = counted && pmm_used_bytes(pmm) == used * PMM_PAGE_SIZE;
+    if (step % 512 == 0) {
+      for (uint32_t owner = 1; owner <= OWNERS; owner++) {
+        owned = owned && pmm_owner_pages(pmm, owner) == owner_pages[owner];
+      }
+    }
+  }
+  // The mapping is page-aligned, so blocks align to their size as well
+  check(aligned, "pmm: blocks are aligned to their size");
+  check(intact, "pmm: live blocks never overlap");
+  check(counted, "pmm: the used counter follows every alloc, free and "
+                 "release");
+  check(owned, "pmm: per-owner pages follow allocs, transfers and "
+               "releases");
+
+  if (count > 0) {
+    uint8_t *block = blocks[0].address;
+    uint64_t before = pmm_used_bytes(pmm);
+    pmm_free_pages(pmm, block + PMM_PAGE_SIZE / 2);
+    pmm_free_pages(pmm, &stats);
+    check(pmm_used_bytes(pmm) == before,
+          "pmm: unaligned and foreign pointers are ignored");
+    pmm_free_pages(pmm, block);
+    pmm_free_pages(pmm, block);
+    check(pmm_used_bytes(pmm) ==
+              before - ((uint64_t)PMM_PAGE_SIZE << blocks[0].order),
+          "pmm: a double free is ignored");
+    blocks[0] = blocks[--count];
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    pmm_free_pages(pmm, blocks[i].address);
+  }
+  pmm_get_stats(pmm, &stats);
+  check(stats.used_pages == 0 && stats.free_blocks[PMM_MAX_ORDER] == 4 &&
+            stats.unusable[PMM_MAX_ORDER] == 0.0,
+        "pmm: freeing everything merges back to the largest blocks");
+
+  void *all[5];
+  for (int i = 0; i < 4; i++) {
+    all[i] = pmm_alloc_pages(pmm, PMM_MAX_ORDER, 1);
+  }
+  uint64_t failures = stats.failures;
+  all[4] = pmm_alloc_pages(pmm, 0, 1);
+  pmm_get_stats(pmm, &stats);
+  check(all[3] && !all[4] && stats.failures == failures + 1,
+        "pmm: an exhausted memory fails and counts the request");
+  check(pmm_release_owner(pmm, 1) == PMM_TEST_PAGES && pmm_used_bytes(pmm) == 0,
+        "pmm: releasing an owner returns all of its pages");
+
+  pmm_destroy(pmm);
+  free(blocks);
+}
+
+static void test_pmm_slab(void) {
+  PhysicalMemory *pmm = pmm_create((uint64_t)PMM_TEST_PAGES * PMM_PAGE_SIZE);
+  SlabCache *cache = slab_cache_create(pmm, sizeof(OSProcess));
+  enum { OBJECTS = 2000 };
+  void **objects = (void **)calloc(OBJECTS, sizeof(void *));
+  if (!pmm || !cache || !objects) {
+    check(false, "slab: allocation");
+    slab_cache_destroy(cache);
+    pmm_destroy(pmm);
+    free(objects);
+    return;
+  }
+  SlabCacheStats stats;
+  slab_cache_get_stats(cache, &stats);
+  check(stats.object_size >= sizeof(OSProcess) &&
+            stats.object_size % SLAB_ALIGN == 0 &&
+            stats.objects_per_slab >= SLAB_MIN_OBJECTS,
+        "slab: objects are aligned and a slab holds the minimum count");
+
+  bool aligned = true;
+  for (uint32_t i = 0; i < OBJECTS; i++) {
+    objects[i] = slab_alloc(cache);
+    aligned = aligned && objects[i] && (uintptr_t)objects[i] % SLAB_ALIGN == 0;
+    if (objects[i]) {
+      memset(objects[i], (int)(i & 0xff), sizeof(OSProcess));
+    }
+  }
+  check(aligned, "slab: every object is allocated and aligned");
+
+  // Free a random half and allocate it again, checking nobody else's bytes
+  uint64_t state = 31;
+  bool intact = true;
+  for (int round = 0; round < 20; round++) {
+    for (uint32_t i = 0; i < OBJECTS; i++) {
+      if (next_random(&state) & 1) {
+        slab_free(cache, objects[i]);
+        objects[i] = NULL;
+      }
+    }
+    for (uint32_t i = 0; i < OBJECTS; i++) {
+      if (!objects[i]) {
+        objects[i] = slab_alloc(cache);
+        memset(objects[i], (int)(i & 0xff), sizeof(OSProcess));
+      }
+    }
+    for (uint32_t i = 0; i < OBJECTS && intact; i++) {
+      const uint8_t *bytes = (const uint8_t *)objects[i];
+      intact = bytes[0] == (uint8_t)i && bytes[sizeof(OSProcess) - 1] == (uint8_t)i;
+    }
+  }
+  check(intact, "slab: live objects never overlap through free and reuse");
+  slab_cache_get_stats(cache, &stats);
+  check(stats.in_use == OBJECTS && stats.capacity >= OBJECTS &&
+            stats.capacity < OBJECTS + 2 * stats.objects_per_slab + OBJECTS / 2,
+        "slab: in-use and capacity counts add up");
+
+  for (uint32_t i = 0; i < OBJECTS; i++) {
+    slab_free(cache, objects[i]);
+  }
+  slab_cache_get_stats(cache, &stats);
+  uint64_t slab_bytes = ((uint64_t)PMM_PAGE_SIZE << stats.slab_order);
+  check(stats.in_use == 0 && stats.slabs <= 1 &&
+            pmm_used_bytes(pmm) == stats.slabs * slab_bytes,
+        "slab: emptied slabs go back to the buddy allocator but one");
+  check(pmm_owner_pages(pmm, PMM_OWNER_KERNEL) * PMM_PAGE_SIZE ==
+            stats.slabs * slab_bytes,
+        "slab: slabs are charged to the kernel");
+  slab_cache_destroy(cache);
+  check(pmm_used_bytes(pmm) == 0, "slab: destroying a cache returns its slabs");
+  pmm_destroy(pmm);
+  free(objects);
+}
+
+static void bench_pmm(uint64_t operations) {
+  // Direct alloc/free pairs, the floor under the churn numbers
+  PhysicalMemory *pmm = pmm_create(KERNEL_MEMORY_SIZE);
+  SlabCache *cache = slab_cache_create(pmm, sizeof(OSProcess));
+  if (!pmm || !cache) {
+    fprintf(stderr, "memtool: out of memory\n");
+    slab_cache_destroy(cache);
+    pmm_destroy(pmm);
+    return;
+  }
+  const int pairs = 2000000;
+  printf("%-32s %10s\n", "", "ns/pair");
+  for (uint32_t order = 0; order <= PMM_MAX_ORDER; order += 5) {
+    uint64_t start = now_ns();
+    for (int i = 0; i < pairs; i++) {
+      pmm_free_pages(pmm, pmm_alloc_pages(pmm, order, 1));
+    }
+    printf("pages, order %-19u %10.1f\n", order,
+           (double)(now_ns() - start) / pairs);
+  }
+  uint64_t start = now_ns();
+  for (int i = 0; i < pairs; i++) {
+    slab_free(cache, slab_alloc(cache));
+  }
+  printf("%-32s %10.1f\n", "slab object (OSProcess)",
+         (double)(now_ns() - start) / pairs);
+  start = now_ns();
+  uint64_t sum = 0;
+  for (int i = 0; i < pairs; i++) {
+    sum += pmm_used_bytes(pmm);
+  }
+  g_sink = sum;
+  printf("%-32s %10.1f\n", "used-bytes read",
+         (double)(now_ns() - start) / pairs);
+  slab_cache_destroy(cache);
+  pmm_destroy(pmm);
+
+  // Long churn on the kernel's memory size, then the fragmentation left
+  PmmSimConfig config = {
+      .memory_bytes = KERNEL_MEMORY_SIZE,
+      .operations = operations,
+      .max_order = 8,
+      .slab_percent = 30,
+      .fill_percent = 85,
+      .owners = 64,
+      .release_per_million = 20,
+      .seed = 37,
+  };
+  PmmSimResult result;
+  if (!pmm_simulate(&config, &result)) {
+    fprintf(stderr, "memtool: simulation failed\n");
+    return;
+  }
+  printf("\nchurn: %llu operations on %llu MB, fill target %u%%, orders "
+         "0-%u, %u%% slab objects, %u owners\n",
+         (unsigned long long)operations,
+         (unsigned long long)(config.memory_bytes >> 20), config.fill_percent,
+         config.max_order, config.slab_percent, config.owners);
+  printf("%.1f ns/op (%.2f M ops/s), %llu allocs, %llu frees, %llu failed, "
+         "%llu owner releases\n",
+         result.ns_per_op, 1e3 / result.ns_per_op,
+         (unsigned long long)result.allocs, (unsigned long long)result.frees,
+         (unsigned long long)result.failures,
+         (unsigned long long)result.releases);
+  const PmmStats *after = &result.after;
+  printf("%.1f%% used, slab utilization %.1f%%, largest free block order "
+         "%d\n",
+         100.0 * after->used_pages / after->total_pages,
+         100.0 * result.slab_utilization, after->largest_free_order);
+  printf("%-6s %12s %12s\n", "order", "free blocks", "unusable");
+  for (uint32_t order = 0; order < PMM_ORDERS; order++) {
+    printf("%-6u %12llu %11.1f%%\n", order,
+           (unsigned long long)after->free_blocks[order],
+           100.0 * after->unusable[order]);
+  }
+}
+
+// ============================================================================
+// Frame arena
+// ============================================================================
+
+#define ARENA_TEST_BLOCK 4096
+
+static bool arena_aligned(const void *ptr) {
+  return ((uintptr_t)ptr & (FRAME_ARENA_ALIGN - 1)) == 0;
+}
+
+static void test_arena_frames(void) {
+  FrameArena *arena = frame_arena_create(ARENA_TEST_BLOCK);
+  if (!arena) {
+    check(false, "arena: create");
+    return;
+  }
+
+  bool aligned = true;
+  uint64_t state = 3;
+  for (int i = 0; i < 1000; i++) {
+    aligned = aligned &&
+              arena_aligned(frame_arena_alloc(arena, next_random(&state) % 300));
+  }
+  check(aligned, "arena: every allocation is aligned, zero-sized ones too");
+  frame_arena_end_frame(arena);
+  frame_arena_end_frame(arena);
+
+  // Frame N's data survives frame N + 1 and its memory comes back in N + 2.
+  uint8_t *first = (uint8_t *)frame_arena_alloc(arena, 1000);
+  memset(first, 0xa5, 1000);
+  uint64_t frame = frame_arena_frame(arena);
+  frame_arena_end_frame(arena);
+  uint8_t *second = (uint8_t *)frame_arena_alloc(arena, 1000);
+  memset(second, 0x5a, 1000);
+  bool intact = true;
+  for (int i = 0; i < 1000; i++) {
+    intact = intact && first[i] == 0xa5;
+  }
+  check(intact && second != first,
+        "arena: a frame's data survives the next frame");
+  check(frame_arena_frame(arena) == frame + 1,
+        "arena: the frame counter moves once per end_frame");
+  frame_arena_end_frame(arena);
+  check(frame_arena_alloc(arena, 1000) == first,
+        "arena: a frame's memory is reused two frames later");
+
+  // calloc zeroes memory the arena hands out again.
+  frame_arena_end_frame(arena);
+  frame_arena_end_frame(arena);
+  uint8_t *zeroed = (uint8_t *)frame_arena_calloc(arena, 10, 100);
+  bool zero = zeroed != NULL;
+  for (int i = 0; zero && i < 1000; i++) {
+    zero = zeroed[i] == 0;
+  }
+  check(zero, "arena: calloc zeroes reused memory");
+  check(frame_arena_calloc(arena, SIZE_MAX / 8, 16) == NULL &&
+            frame_arena_alloc(arena, SIZE_MAX - 8) == NULL &&
+            frame_arena_grow(arena, zeroed, 1000, SIZE_MAX - 8) == NULL,
+        "arena: sizes past the address space return NULL");
+
+  // Grow extends the latest allocation in place and copies anything else.
+  frame_arena_end_frame(arena);
+  uint8_t *grown = (uint8_t *)frame_arena_alloc(arena, 100);
+  memset(grown, 7, 100);
+  bool in_place = frame_arena_grow(arena, grown, 100, 200) == grown &&
+                  frame_arena_grow(arena, grown, 200, 150) == grown;
+  uint8_t *later = (uint8_t *)frame_arena_alloc(arena, 16);
+  uint8_t *moved = (uint8_t *)frame_arena_grow(arena, grown, 200, 400);
+  bool copied = moved && moved != grown && moved > later;
+  for (int i = 0; copied && i < 100; i++) {
+    copied = moved[i] == 7;
+  }
+  check(in_place, "arena: grow extends the latest allocation in place");
+  check(copied, "arena: grow copies an allocation that is not the latest");
+  uint8_t *spill = (uint8_t *)frame_arena_alloc(arena, 100);
+  check(frame_arena_grow(arena, spill, 100, ARENA_TEST_BLOCK) != spill,
+        "arena: grow past the end of a block moves to another");
+
+  // Bytes and high water.
+  for (int f = 0; f < 2; f++) {
+    frame_arena_end_frame(arena);
+  }
+  frame_arena_alloc(arena, 1000);
+  frame_arena_alloc(arena, 24);
+  FrameArenaStats stats;
+  frame_arena_get_stats(arena, &stats);
+  check(stats.bytes == 1008 + 32, "arena: bytes counts this frame, aligned");
+  check(stats.high_water >= ARENA_TEST_BLOCK,
+        "arena: high water keeps the busiest frame");
+
+  // An oversized request gets a block of its own that later frames reuse,
+  // and small requests leave it alone.
+  uint64_t allocs_before = stats.system_allocs;
+  bool reused = true;
+  for (int f = 0; f < 8; f++) {
+    for (int i = 0; i < 12; i++) {
+      frame_arena_alloc(arena, 1000);
+    }
+    reused = reused && frame_arena_alloc(arena, 5 * ARENA_TEST_BLOCK) != NULL;
+    frame_arena_end_frame(arena);
+  }
+  frame_arena_get_stats(arena, &stats);
+  uint64_t warm = stats.system_allocs;
+  for (int f = 0; f < 32; f++) {
+    for (int i = 0; i < 12; i++) {
+      frame_arena_alloc(arena, 1000);
+    }
+    frame_arena_alloc(arena, 5 * ARENA_TEST_BLOCK);
+    frame_arena_end_frame(arena);
+  }
+  frame_arena_get_stats(arena, &stats);
+  check(reused && warm > allocs_before && stats.system_allocs == warm,
+        "arena: oversized blocks are kept and reused");
+  frame_arena_destroy(arena);
+}
+
+#define ARENA_TEST_THREADS 4
+#define ARENA_TEST_ALLOCS 20000
+
+typedef struct {
+  FrameArena *arena;
+  uint32_t id;
+  uint32_t *blocks[ARENA_TEST_ALLOCS];
+  uint32_t sizes[ARENA_TEST_ALLOCS];
+} ArenaWorker;
+
+// Each block is filled with its owner's tag, so two threads handed
+// overlapping memory show up as a clobbered block.
+static void *arena_worker(void *arg) {
+  ArenaWorker *worker = (ArenaWorker *)arg;
+  uint64_t state = worker->id + 1;
+  for (uint32_t i = 0; i < ARENA_TEST_ALLOCS; i++) {
+    uint32_t words = 1 + (uint32_t)(next_random(&state) % 64);
+    uint32_t *block =
+        (uint32_t *)frame_arena_alloc(worker->arena, words * sizeof(uint32_t));
+    worker->blocks[i] = block;
+    worker->sizes[i] = block ? words : 0;
+    for (uint32_t w = 0; w < worker->sizes[i]; w++) {
+      block[w] = worker->id << 24 | i;
+    }
+  }
+  return NULL;
+}
+
+static void test_arena_threads(void) {
+  FrameArena *arena = frame_arena_create(ARENA_TEST_BLOCK);
+  ArenaWorker *workers =
+      (ArenaWorker *)calloc(ARENA_TEST_THREADS, sizeof(ArenaWorker));
+  if (!arena || !workers) {
+    check(false, "arena threads: allocation");
+    frame_arena_destroy(arena);
+    free(workers);
+    return;
+  }
+  bool intact = true;
+  for (int frame = 0; frame < 3; frame++) {
+    pthread_t ids[ARENA_TEST_THREADS];
+    for (uint32_t t = 0; t < ARENA_TEST_THREADS; t++) {
+      workers[t].arena = arena;
+      workers[t].id = t;
+      pthread_create(&ids[t], NULL, arena_worker, &workers[t]);
+    }
+    for (uint32_t t = 0; t < ARENA_TEST_THREADS; t++) {
+      pthread_join(ids[t], NULL);
+    }
+    for (uint32_t t = 0; t < ARENA_TEST_THREADS; t++) {
+      for (uint32_t i = 0; i < ARENA_TEST_ALLOCS; i++) {
+        intact = intact && workers[t].sizes[i] > 0;
+        for (uint32_t w = 0; intact && w < workers[t].sizes[i]; w++) {
+          intact = workers[t].blocks[i][w] == (t << 24 | i);
+        }
+      }
+    }
+    frame_arena_end_frame(arena);
+  }
+  check(intact, "arena threads: concurrent allocations never overlap");
+  free(workers);
+  frame_arena_destroy(arena);
+}
+
+static void test_arena_containers(void) {
+  FrameArena *arena = frame_arena_create(ARENA_TEST_BLOCK);
+  if (!arena) {
+    check(false, "arena containers: create");
+    return;
+  }
+  char *title = string_format_in(arena, "Window %d - %s", 42, "Terminal");
+  check(title && strcmp(title, "Window 42 - Terminal") == 0,
+        "arena containers: string_format_in formats into the arena");
+
+  Vector *vec = vector_create_in(arena, 4);
+  bool values_ok = vec != NULL;
+  for (uintptr_t i = 0; values_ok && i < 3000; i++) {
+    vector_push(vec, (void *)(i + 1));
+  }
+  for (uintptr_t i = 0; values_ok && i < 3000; i++) {
+    values_ok = vector_get(vec, i) == (void *)(i + 1);
+  }
+  check(values_ok && vec->count == 3000,
+        "arena containers: an arena vector grows past several blocks");
+  vector_destroy(vec); // no-op: the frame owns it
+
+  // A vector that stays the latest allocation grows without copying.
+  frame_arena_end_frame(arena);
+  frame_arena_end_frame(arena);
+  Vector *small = vector_create_in(arena, 8);
+  void **elements = small ? small->elements : NULL;
+  for (uintptr_t i = 0; small && i < 64; i++) {
+    vector_push(small, (void *)i);
+  }
+  check(small && small->elements == elements && small->capacity == 64,
+        "arena containers: the latest vector grows in place");
+
+  FrameArenaSimConfig config = {400, 100, 8, 200, 4096, 0x5eed};
+  FrameArenaSimResult result;
+  check(frame_arena_simulate(&config, &result) &&
+            result.steady_system_allocs == 0,
+        "arena containers: steady-state frames obtain no blocks (4 KB)");
+  config.max_alloc = 1u << 20;
+  config.allocs_per_frame = 40;
+  check(frame_arena_simulate(&config, &result) &&
+            result.steady_system_allocs == 0,
+        "arena containers: steady-state frames obtain no blocks (1 MB)");
+  frame_arena_destroy(arena);
+}
+
+// Allocations per frame like a compositor's: mostly small, every 16th a
+// scratch row.
+static void bench_arena(void) {
+  const uint32_t frames = 2000;
+  const uint32_t per_frame = 1000;
+  FrameArena *arena = frame_arena_create(0);
+  void **held = (void **)malloc(per_frame * sizeof(void *));
+  if (!arena || !held) {
+    fprintf(stderr, "memtool: out of memory\n");
+    frame_arena_destroy(arena);
+    free(held);
+    return;
+  }
+  printf("%u allocations per frame, 16-256 bytes and every 16th 8 KB\n",
+         per_frame);
+  printf("%-24s %10s\n", "", "ns/alloc");
+  for (int mode = 0; mode < 2; mode++) {
+    uint64_t state = 9;
+    uint64_t start = now_ns();
+    for (uint32_t f = 0; f < frames; f++) {
+      for (uint32_t i = 0; i < per_frame; i++) {
+        size_t size = i % 16 == 15 ? 8192 : 16 + next_random(&state) % 241;
+        held[i] = mode ? malloc(size) : frame_arena_alloc(arena, size);
+        *(volatile char *)held[i] = (char)i;
+      }
+      if (mode) {
+        for (uint32_t i = 0; i < per_frame; i++) {
+          free(held[i]);
+        }
+      } else {
+        frame_arena_end_frame(arena);
+      }
+    }
+    double ns = (double)(now_ns() - start) / ((double)frames * per_frame);
+    printf("%-24s %10.1f\n", mode ? "malloc + free" : "frame arena + end_frame",
+           ns);
+  }
+  FrameArenaStats stats;
+  frame_arena_get_stats(arena, &stats);
+  printf("arena: %u blocks, %llu KB, %llu KB high water, %llu mallocs in "
+         "%llu frames\n",
+         stats.blocks, (unsigned long long)(stats.capacity >> 10),
+         (unsigned long long)(stats.high_water >> 10),
+         (unsigned long long)stats.system_allocs,
+         (unsigned long long)stats.frames);
+
+  FrameArenaSimConfig config = {2000, 100, 16, 500, 16384, 1};
+  FrameArenaSimResult result;
+  bool ok = frame_arena_simulate(&config, &result);
+  printf("simulation: %.1f ns/alloc, %llu blocks after warm-up%s\n",
+         result.ns_per_alloc,
+         (unsigned long long)result.steady_system_allocs,
+         ok ? "" : " (FAILED)");
+  frame_arena_destroy(arena);
+  free(held);
+}
+
+// ============================================================================
+// Main
+// ============================================================================
+
+static int usage(void) {
+  fprintf(stderr, "usage: memtool test\n"
+                  "       memtool bench pool [threads]\n"
+                  "       memtool bench hashmap [max_entries]\n"
+                  "       memtool bench pmm [operations]\n"
+                  "       memtool bench arena\n");
+  return 2;
+}
+
+int main(int argc, char **argv) {
+  if (argc == 2 && strcmp(argv[1], "test") == 0) {
+    test_pool_single();
+    test_pool_threads();
+    test_hashmap_reference();
+    test_hashmap_resize();
+    test_pmm_buddy();
+    test_pmm_slab();
+    test_arena_frames();
+    test_arena_threads();
+    test_arena_containers();
+    printf("%s\n", g_failures ? "FAILED" : "all checks passed");
+    return g_failures ? 1 : 0;
+  }
+  if ((argc == 3 || argc == 4) && strcmp(argv[1], "bench") == 0) {
+    unsigned long long arg = argc == 4 ? strtoull(argv[3], NULL, 10) : 0;
+    if (strcmp(argv[2], "pool") == 0) {
+      bench_pool(arg ? (uint32_t)(arg > 64 ? 64 : arg) : 4);
+      return 0;
+    }
+    if (strcmp(argv[2], "hashmap") == 0) {
+      bench_hashmap(arg ? arg : 10000000);
+      return 0;
+    }
+    if (strcmp(argv[2], "pmm") == 0) {
+      bench_pmm(arg ? arg : 20000000);
+      return 0;
+    }
+    if (strcmp(argv[2], "arena") == 0 && argc == 3) {
+      bench_arena();
+      return 0;
+    }
+  }
+  return usage();
+}
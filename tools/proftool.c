@@ -0,0 +1,524 @@
+// proftool - checks and benchmarks for the frame profiler, built with
+// ENABLE_PROFILER 1 against its own copy of profiler.c (os_core has the
+// stubs)
+//
+//   proftool test               correctness checks (exit status 1 on any
+//                               failure)
+//   proftool bench [threads]    ns per clock read, per zone and per staged
+//                               zone on 1 thread up to `threads` (default
+//                               4), then the cost of stage statistics and
+//                               of exporting full rings
+
+#include "profiler.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// ============================================================================
+// Helpers
+// ============================================================================
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// xorshift64*, so every run sees the same sequence.
+static uint64_t next_random(uint64_t *state) {
+  uint64_t x = *state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *state = x;
+  return x * 0x2545f4914f6cdd1dull;
+}
+
+static int g_failures;
+static volatile uint64_t g_sink; // keeps timed loops from being optimized away
+
+static void check(bool ok, const char *name) {
+  printf("%s %s\n", ok ? "PASS" : "FAIL", name);
+  if (!ok) {
+    g_failures++;
+  }
+}
+
+// A zone that lasted ns (plus the cost of ending it).
+static void record_ns(const char *name, ProfileStage stage, uint64_t ns) {
+  ProfileZone zone = profile_zone_begin(name, stage);
+  zone.start -= ns;
+  profile_zone_end(&zone);
+}
+
+// Traces skip zones that started before the reset; leave room for the
+// backdated starts of record_ns.
+static void reset_for_trace(void) {
+  profiler_reset();
+  usleep(1000);
+}
+
+static bool near(double value, double expected, double tolerance) {
+  double diff = value > expected ? value - expected : expected - value;
+  return diff <= expected * tolerance;
+}
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+static const char *trace_path(void) {
+  static char path[64];
+  if (!path[0]) {
+    snprintf(path, sizeof(path), "/tmp/proftool-%d.json", (int)getpid());
+  }
+  return path;
+}
+
+// ============================================================================
+// Trace reading
+// ============================================================================
+
+#define TRACE_MAX_TIDS 64
+
+typedef struct {
+  bool valid_json;
+  uint64_t events;
+  uint64_t per_tid[TRACE_MAX_TIDS];
+  uint64_t named;  // events whose name matched `name`
+  uint64_t torn;   // "plain"/"staged" events with the other's category
+  uint32_t tid_of; // tid of the thread called `thread`, or 0
+} TraceSummary;
+
+static char *read_file(const char *path, size_t *size) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    return NULL;
+  }
+  fseek(file, 0, SEEK_END);
+  long length = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  char *text = malloc((size_t)length + 1);
+  if (text && fread(text, 1, (size_t)length, file) != (size_t)length) {
+    free(text);
+    text = NULL;
+  }
+  fclose(file);
+  if (text) {
+    text[length] = '\0';
+    *size = (size_t)length;
+  }
+  return text;
+}
+
+// Structure only: brackets balance outside strings, strings close and hold
+// no raw control characters or unknown escapes.
+static bool json_well_formed(const char *text, size_t size) {
+  int depth = 0;
+  bool in_string = false;
+  for (size_t i = 0; i < size; i++) {
+    char c = text[i];
+    if (in_string) {
+      if (c == '\\') {
+        if (i + 1 == size || !strchr("\"\\/bfnrtu", text[i + 1])) {
+          return false;
+        }
+        i++;
+      } else if (c == '"') {
+        in_string = false;
+      } else if ((unsigned char)c < 0x20) {
+        return false;
+      }
+    } else if (c == '"') {
+      in_string = true;
+    } else if (c == '{' || c == '[') {
+      depth++;
+    } else if (c == '}' || c == ']') {
+      if (--depth < 0) {
+        return false;
+      }
+    }
+  }
+  return depth == 0 && !in_string && size > 0 && text[0] == '{';
+}
+
+// Every event is on its own line, as profiler_write_chrome_trace writes it.
+static bool read_trace(const char *path, const char *name, const char *thread,
+                       TraceSummary *summary) {
+  memset(summary, 0, sizeof(*summary));
+  size_t size;
+  char *text = read_file(path, &size);
+  if (!text) {
+    return false;
+  }
+  summary->valid_json = json_well_formed(text, size);
+  for (char *line = strtok(text, "\n"); line; line = strtok(NULL, "\n")) {
+    char event_name[128];
+    char category[8];
+    unsigned tid;
+    if (sscanf(line,
+               "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+               "\"tid\":%u,\"args\":{\"name\":\"%127[^\"]\"",
+               &tid, event_name) == 2) {
+      if (thread && strcmp(event_name, thread) == 0) {
+        summary->tid_of = tid;
+      }
+      continue;
+    }
+    const char *tid_field = strstr(line, "\"tid\":");
+    if (!strstr(line, "\"ph\":\"X\"") || !tid_field) {
+      continue;
+    }
+    tid = (unsigned)strtoul(tid_field + 6, NULL, 10);
+    summary->events++;
+    summary->per_tid[tid < TRACE_MAX_TIDS ? tid : 0]++;
+    // Names with escapes do not parse here and match nothing
+    if (sscanf(line, "{\"name\":\"%127[^\"]\",\"cat\":\"%7[a-z]\"",
+               event_name, category) != 2) {
+      continue;
+    }
+    if (name && strcmp(event_name, name) == 0) {
+      summary->named++;
+    }
+    if ((strcmp(event_name, "plain") == 0 && strcmp(category, "zone")) ||
+        (strcmp(event_name, "staged") == 0 && strcmp(category, "stage"))) {
+      summary->torn++;
+    }
+  }
+  free(text);
+  return true;
+}
+
+// ============================================================================
+// Checks
+// ============================================================================
+
+static void test_histograms(void) {
+  // 100K durations spread over 100 us .. 10 ms, against exact percentiles.
+  enum { SAMPLES = 100000 };
+  uint64_t *values = malloc(SAMPLES * sizeof(uint64_t));
+  uint64_t state = 42;
+  double sum = 0.0;
+  profiler_reset();
+  for (int i = 0; i < SAMPLES; i++) {
+    uint64_t r = next_random(&state);
+    values[i] = (100000ull << (r % 7)) + (r >> 40) % 100000;
+    sum += (double)values[i];
+    record_ns("layout", PROFILE_LAYOUT, values[i]);
+  }
+  qsort(values, SAMPLES, sizeof(uint64_t), compare_u64);
+  ProfileStageStats stats;
+  profiler_get_stage_stats(PROFILE_LAYOUT, &stats);
+  // A zone preempted between its begin and end only grows, so the
+  // maximum is checked from below
+  check(stats.count == SAMPLES && near((double)stats.min_ns, values[0], 0.01) &&
+            stats.max_ns >= values[SAMPLES - 1] &&
+            near(stats.mean_ns, sum / SAMPLES, 0.01),
+        "profiler: count, min, max and mean of a stage");
+  check(near((double)stats.p50_ns, values[SAMPLES / 2], 0.04) &&
+            near((double)stats.p90_ns, values[SAMPLES * 9 / 10], 0.04) &&
+            near((double)stats.p99_ns, values[SAMPLES * 99 / 100], 0.04) &&
+            near((double)stats.p999_ns, values[SAMPLES * 999 / 1000], 0.04),
+        "profiler: percentiles within the histogram's precision");
+  free(values);
+
+  ProfileStageStats others;
+  bool untouched = true;
+  for (int s = 0; s < PROFILE_STAGE_COUNT; s++) {
+    profiler_get_stage_stats((ProfileStage)s, &others);
+    untouched = untouched && (s == PROFILE_LAYOUT || others.count == 0);
+  }
+  record_ns("plain", PROFILE_NONE, 1000);
+  {
+    PROFILE_ZONE("macro zone");
+  }
+  profiler_get_stage_stats(PROFILE_LAYOUT, &others);
+  check(untouched && others.count == SAMPLES,
+        "profiler: stage zones feed only their stage, plain zones none");
+
+  // Tiny and huge values land in their own buckets.
+  profiler_reset();
+  record_ns("raster", PROFILE_RASTER, 0);
+  profiler_get_stage_stats(PROFILE_RASTER, &stats);
+  bool tiny = stats.count == 1 && stats.p50_ns == stats.max_ns &&
+              stats.p50_ns < 100000;
+  record_ns("raster", PROFILE_RASTER, 60ull * 1000000000ull);
+  profiler_get_stage_stats(PROFILE_RASTER, &stats);
+  check(tiny && stats.count == 2 && stats.p999_ns == stats.max_ns &&
+            near((double)stats.max_ns, 60e9, 0.01),
+        "profiler: the histogram covers nanoseconds to minutes");
+
+  profiler_reset();
+  profiler_get_stage_stats(PROFILE_RASTER, &stats);
+  check(stats.count == 0 && stats.max_ns == 0,
+        "profiler: reset clears the histograms");
+}
+
+static void test_input_latency(void) {
+  profiler_reset();
+  ProfileStageStats stats;
+  profiler_mark_present();
+  profiler_get_stage_stats(PROFILE_INPUT_LATENCY, &stats);
+  bool idle = stats.count == 0;
+  uint64_t now = profiler_now_ns();
+  profiler_mark_input(now - 1000000);
+  profiler_mark_input(now - 3000000);
+  profiler_mark_input(now - 2000000);
+  profiler_mark_present();
+  profiler_mark_present();
+  profiler_get_stage_stats(PROFILE_INPUT_LATENCY, &stats);
+  check(idle && stats.count == 1 && stats.min_ns >= 3000000 &&
+            stats.min_ns < 3000000 + 50000000,
+        "profiler: a present closes the earliest pending input, once");
+}
+
+typedef struct {
+  uint32_t index;
+  uint32_t zones;
+} ZoneWorker;
+
+static void *zone_worker(void *opaque) {
+  ZoneWorker *worker = (ZoneWorker *)opaque;
+  char name[32];
+  snprintf(name, sizeof(name), "worker %u", worker->index);
+  profiler_set_thread_name(name);
+  for (uint32_t n = 0; n < worker->zones; n++) {
+    record_ns("raster", PROFILE_RASTER, 1000);
+  }
+  return NULL;
+}
+
+static _Atomic bool g_writing;
+
+static void *torn_writer(void *opaque) {
+  (void)opaque;
+  profiler_set_thread_name("writer");
+  while (atomic_load(&g_writing)) {
+    record_ns("plain", PROFILE_NONE, 1000);
+    record_ns("staged", PROFILE_EFFECTS, 1000);
+  }
+  return NULL;
+}
+
+static void test_trace(void) {
+  const char *path = trace_path();
+  profiler_set_thread_name("main");
+  record_ns("before reset", PROFILE_NONE, 1000);
+  reset_for_trace();
+
+  // Four threads at once, each with its own track.
+  enum { WORKERS = 4, ZONES = 20000 };
+  pthread_t threads[WORKERS];
+  ZoneWorker workers[WORKERS];
+  for (uint32_t i = 0; i < WORKERS; i++) {
+    workers[i] = (ZoneWorker){i, ZONES};
+    pthread_create(&threads[i], NULL, zone_worker, &workers[i]);
+  }
+  for (uint32_t i = 0; i < WORKERS; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  ProfileStageStats stats;
+  profiler_get_stage_stats(PROFILE_RASTER, &stats);
+  check(stats.count == WORKERS * ZONES,
+        "profiler: zones from four threads all reach the histogram");
+
+  TraceSummary summary;
+  bool tracks = profiler_write_chrome_trace(path);
+  for (uint32_t i = 0; i < WORKERS && tracks; i++) {
+    char name[32];
+    snprintf(name, sizeof(name), "worker %u", i);
+    tracks = read_trace(path, "before reset", name, &summary) &&
+             summary.tid_of > 0 && summary.tid_of < TRACE_MAX_TIDS &&
+             summary.per_tid[summary.tid_of] == ZONES;
+  }
+  check(tracks && summary.valid_json && summary.named == 0 &&
+            summary.events == WORKERS * ZONES,
+        "profiler: the trace has a named track per thread and skips zones "
+        "before the reset");
+
+  // Names are escaped; latency spans get their own track.
+  reset_for_trace();
+  record_ns("quote \" backslash \\ newline \n", PROFILE_NONE, 1000);
+  {
+    PROFILE_ZONE("macro zone");
+    record_ns("inner", PROFILE_NONE, 1000);
+  }
+  profiler_mark_input(profiler_now_ns());
+  usleep(2000);
+  profiler_mark_present();
+  bool written = profiler_write_chrome_trace(path);
+  bool read = read_trace(path, "macro zone", NULL, &summary);
+  check(written && read && summary.valid_json && summary.named == 1 &&
+            summary.per_tid[0] == 1 && summary.events == 4,
+        "profiler: the trace is valid JSON with escaped names and a latency "
+        "track");
+
+  // A full ring keeps its newest events.
+  reset_for_trace();
+  for (uint32_t n = 0; n < PROFILER_THREAD_EVENTS + 5000; n++) {
+    record_ns(n + 1 < PROFILER_THREAD_EVENTS + 5000 ? "old" : "newest",
+              PROFILE_NONE, 1000);
+  }
+  written = profiler_write_chrome_trace(path);
+  read = read_trace(path, "newest", "main", &summary);
+  check(written && read && summary.named == 1 &&
+            summary.per_tid[summary.tid_of] >= PROFILER_THREAD_EVENTS - 1 &&
+            summary.per_tid[summary.tid_of] <= PROFILER_THREAD_EVENTS,
+        "profiler: a wrapped ring exports its newest events");
+
+  // Export while the owner keeps overwriting its ring.
+  reset_for_trace();
+  atomic_store(&g_writing, true);
+  pthread_t writer;
+  pthread_create(&writer, NULL, torn_writer, NULL);
+  usleep(20000);
+  bool whole = true;
+  uint64_t seen = 0;
+  for (int round = 0; round < 20; round++) {
+    whole = whole && profiler_write_chrome_trace(path) &&
+            read_trace(path, NULL, NULL, &summary) && summary.valid_json &&
+            summary.torn == 0;
+    seen += summary.events;
+  }
+  atomic_store(&g_writing, false);
+  pthread_join(writer, NULL);
+  check(whole && seen > 0,
+        "profiler: exporting a ring that is being overwritten drops events "
+        "rather than tearing them");
+  remove(path);
+}
+
+// ============================================================================
+// Benchmarks
+// ============================================================================
+
+typedef struct {
+  ProfileStage stage;
+  uint32_t zones;
+  uint64_t ns;
+} BenchWorker;
+
+static uint64_t thread_cpu_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Thread CPU time, so threads sharing a core do not count each other.
+static void *bench_worker(void *opaque) {
+  BenchWorker *worker = (BenchWorker *)opaque;
+  uint64_t start = thread_cpu_ns();
+  for (uint32_t n = 0; n < worker->zones; n++) {
+    ProfileZone zone = profile_zone_begin("bench", worker->stage);
+    profile_zone_end(&zone);
+  }
+  worker->ns = thread_cpu_ns() - start;
+  return NULL;
+}
+
+static double clock_cost(clockid_t clock) {
+  const int reads = 2000000;
+  struct timespec ts;
+  uint64_t sum = 0;
+  uint64_t start = now_ns();
+  for (int n = 0; n < reads; n++) {
+    clock_gettime(clock, &ts);
+    sum += (uint64_t)ts.tv_nsec;
+  }
+  g_sink = sum;
+  return (double)(now_ns() - start) / reads;
+}
+
+static void bench_profiler(uint32_t max_threads) {
+  printf("clock read: CLOCK_MONOTONIC %.1f ns", clock_cost(CLOCK_MONOTONIC));
+#ifdef CLOCK_MONOTONIC_RAW
+  printf(", CLOCK_MONOTONIC_RAW %.1f ns", clock_cost(CLOCK_MONOTONIC_RAW));
+#endif
+  printf("\n");
+
+  const uint32_t zones = 2000000;
+  printf("%-8s %12s %12s\n", "threads", "zone ns", "staged ns");
+  for (uint32_t threads = 1;;
+       threads = threads * 2 < max_threads ? threads * 2 : max_threads) {
+    double cost[2];
+    for (int staged = 0; staged < 2; staged++) {
+      pthread_t handles[64];
+      BenchWorker workers[64];
+      profiler_reset();
+      for (uint32_t i = 0; i < threads; i++) {
+        workers[i] = (BenchWorker){staged ? PROFILE_RASTER : PROFILE_NONE,
+                                   zones / threads, 0};
+        pthread_create(&handles[i], NULL, bench_worker, &workers[i]);
+      }
+      uint64_t total = 0;
+      for (uint32_t i = 0; i < threads; i++) {
+        pthread_join(handles[i], NULL);
+        total += workers[i].ns;
+      }
+      cost[staged] = (double)total / (double)(zones / threads * threads);
+    }
+    printf("%-8u %12.1f %12.1f\n", threads, cost[0], cost[1]);
+    if (threads == max_threads) {
+      break;
+    }
+  }
+  printf("CPU ns per zone per thread, begin to end; staged zones also feed "
+         "a histogram\n");
+
+  uint64_t start = now_ns();
+  ProfileStageStats stats;
+  for (int n = 0; n < 1000; n++) {
+    profiler_get_stage_stats(PROFILE_RASTER, &stats);
+  }
+  printf("stage statistics: %.1f us per query\n",
+         (double)(now_ns() - start) / 1000.0 / 1000.0);
+
+  profiler_reset();
+  pthread_t handle;
+  BenchWorker worker = {PROFILE_NONE, PROFILER_THREAD_EVENTS, 0};
+  pthread_create(&handle, NULL, bench_worker, &worker);
+  pthread_join(handle, NULL);
+  const char *path = trace_path();
+  start = now_ns();
+  bool written = profiler_write_chrome_trace(path);
+  double ms = (double)(now_ns() - start) / 1e6;
+  size_t size = 0;
+  char *text = written ? read_file(path, &size) : NULL;
+  free(text);
+  remove(path);
+  printf("trace export: %.1f ms for %u events (%.1f MB)\n", ms,
+         PROFILER_THREAD_EVENTS, (double)size / 1e6);
+}
+
+// ============================================================================
+// Main
+// ============================================================================
+
+static int usage(void) {
+  fprintf(stderr, "usage: proftool test\n"
+                  "       proftool bench [threads]\n");
+  return 2;
+}
+
+int main(int argc, char **argv) {
+  if (argc == 2 && strcmp(argv[1], "test") == 0) {
+    test_histograms();
+    test_input_latency();
+    test_trace();
+    printf("%s\n", g_failures ? "FAILED" : "all checks passed");
+    return g_failures ? 1 : 0;
+  }
+  if (argc >= 2 && argc <= 3 && strcmp(argv[1], "bench") == 0) {
+    long threads = argc == 3 ? atol(argv[2]) : 4;
+    bench_profiler(threads < 1 ? 1 : threads > 64 ? 64 : (uint32_t)threads);
+    return 0;
+  }
+  return usage();
+}
@@ -0,0 +1,1340 @@
+// systool - checks and benchmarks for the C++ system cores
+//
+//   systool test                 correctness checks (exit status 1 on any
+//                                failure)
+//   systool bench vfs            build, sort, list, save and reopen a
+//                                directory of 100K entries
+//   systool bench terminal       stream 100 MB of coloured output through
+//                                the scrollback ring: throughput and memory
+//   systool bench messages       append 200K messages, then time cold opens
+//                                (with and without sidecars) and page reads
+//   systool bench search [docs]  index docs documents (default 1M), then
+//                                time each kind of query and an update
+
+#include "MessageStore.hpp"
+#include "SearchIndex.hpp"
+#include "TerminalBuffer.hpp"
+#include "VirtualFileSystem.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <map>
+#include <string>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_set>
+#include <vector>
+
+using namespace OS::System;
+
+namespace {
+
+// ============================================================================
+// Helpers
+// ============================================================================
+
+uint64_t nowNs() {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// xorshift64*, so every run sees the same inputs.
+struct Random {
+  uint64_t state;
+
+  explicit Random(uint64_t seed) : state(seed | 1) {}
+
+  uint64_t next() {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545f4914f6cdd1dull;
+  }
+
+  uint32_t range(uint32_t lo, uint32_t hi) {
+    return lo + (uint32_t)(next() % (uint64_t)(hi - lo + 1));
+  }
+};
+
+int g_failures = 0;
+volatile uint64_t g_sink; // keeps timed loops from being optimized away
+
+void check(bool ok, const char *name) {
+  std::printf("%s %s\n", ok ? "PASS" : "FAIL", name);
+  if (!ok) {
+    g_failures++;
+  }
+}
+
+// A scratch directory removed (with its files) when the tool exits.
+struct ScratchDir {
+  std::string path;
+
+  ScratchDir() {
+    char pattern[] = "/tmp/systool.XXXXXX";
+    const char *made = mkdtemp(pattern);
+    path = made ? made : "";
+  }
+
+  ~ScratchDir() {
+    if (!path.empty()) {
+      removeTree(path);
+    }
+  }
+
+  static void removeTree(const std::string &dir) {
+    if (DIR *handle = opendir(dir.c_str())) {
+      while (struct dirent *entry = readdir(handle)) {
+        if (std::strcmp(entry->d_name, ".") != 0 &&
+            std::strcmp(entry->d_name, "..") != 0) {
+          std::string child = dir + "/" + entry->d_name;
+          if (unlink(child.c_str()) != 0) {
+            removeTree(child);
+          }
+        }
+      }
+      closedir(handle);
+    }
+    rmdir(dir.c_str());
+  }
+
+  std::string file(const char *name) const { return path + "/" + name; }
+};
+
+std::vector<char> readFile(const std::string &path) {
+  std::vector<char> data;
+  FILE *file = std::fopen(path.c_str(), "rb");
+  if (!file) {
+    return data;
+  }
+  char buffer[65536];
+  size_t got;
+  while ((got = std::fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    data.insert(data.end(), buffer, buffer + got);
+  }
+  std::fclose(file);
+  return data;
+}
+
+bool writeFile(const std::string &path, const std::vector<char> &data) {
+  FILE *file = std::fopen(path.c_str(), "wb");
+  if (!file) {
+    return false;
+  }
+  bool ok = std::fwrite(data.data(), 1, data.size(), file) == data.size();
+  return std::fclose(file) == 0 && ok;
+}
+
+// ============================================================================
+// Virtual file system
+// ============================================================================
+
+// The image layout as written by VirtualFileSystem::save(), for corrupting
+// images on purpose.
+struct ImageHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t inode_count;
+  uint32_t index_capacity;
+  uint32_t child_count;
+  uint32_t names_size;
+  uint32_t inode_size;
+  uint32_t reserved;
+};
+
+struct ImageInode {
+  uint64_t size;
+  int64_t mtime;
+  uint32_t parent;
+  uint32_t hash;
+  uint32_t name_offset;
+  uint32_t name_length;
+  uint32_t flags;
+  uint32_t child_offset;
+  uint32_t child_count;
+  uint32_t reserved;
+};
+
+std::string listingNames(VirtualFileSystem &vfs, uint32_t directory) {
+  std::string names;
+  VfsListing listing = vfs.list(directory);
+  for (uint32_t i = 0; i < listing.count; i++) {
+    names += (i ? "," : "") + vfs.name(listing.entries[i]);
+  }
+  return names;
+}
+
+void buildSampleTree(VirtualFileSystem &vfs) {
+  uint32_t docs = vfs.makeDirectories("/Users/guest/Documents");
+  vfs.create(docs, "zeta.txt", false, 10, 1000);
+  vfs.create(docs, "Alpha.txt", false, 20, 2000);
+  vfs.create(docs, "beta", true, 0, 3000);
+  vfs.create(docs, "alpha.txt", false, 30, 4000);
+  vfs.makeDirectories("/Applications/Utilities");
+  vfs.create(vfs.lookup("/Applications"), "Notes.app", false, 4096, 5000);
+}
+
+void testVfsTree() {
+  VirtualFileSystem vfs;
+  buildSampleTree(vfs);
+  uint32_t docs = vfs.lookup("/Users/guest/Documents");
+  check(docs != VirtualFileSystem::kInvalid &&
+            vfs.lookup("/Users/./guest/../guest/Documents") == docs &&
+            vfs.path(docs) == "/Users/guest/Documents",
+        "vfs: paths resolve through '.', '..' and empty components");
+  check(listingNames(vfs, docs) == "beta,Alpha.txt,alpha.txt,zeta.txt",
+        "vfs: listings put folders first, then sort case-insensitively");
+  check(vfs.create(docs, "beta", false) == VirtualFileSystem::kInvalid &&
+            vfs.create(docs, "a/b", false) == VirtualFileSystem::kInvalid &&
+            vfs.create(vfs.lookup("/Users/guest/Documents/zeta.txt"), "x",
+                       false) == VirtualFileSystem::kInvalid,
+        "vfs: create rejects duplicates, slashes and file parents");
+
+  uint32_t beta = vfs.lookup("/Users/guest/Documents/beta");
+  uint32_t zeta = vfs.lookup("/Users/guest/Documents/zeta.txt");
+  bool moved = vfs.rename(zeta, beta, "Zeta.txt");
+  check(moved && vfs.lookup("/Users/guest/Documents/beta/Zeta.txt") == zeta &&
+            vfs.lookup("/Users/guest/Documents/zeta.txt") ==
+                VirtualFileSystem::kInvalid &&
+            !vfs.rename(vfs.lookup("/Users"), beta, "loop"),
+        "vfs: rename moves entries and refuses to enter its own subtree");
+  uint32_t before = vfs.getCount();
+  check(vfs.remove(vfs.lookup("/Users")) && vfs.getCount() == before - 7 &&
+            vfs.lookup("/Users/guest") == VirtualFileSystem::kInvalid,
+        "vfs: remove deletes whole subtrees");
+}
+
+void testVfsImage(ScratchDir &scratch) {
+  std::string image = scratch.file("tree.vfs");
+  VirtualFileSystem vfs;
+  buildSampleTree(vfs);
+  uint32_t docs = vfs.lookup("/Users/guest/Documents");
+  std::string listing = listingNames(vfs, docs);
+
+  VirtualFileSystem mapped;
+  bool ok = vfs.save(image) && mapped.open(image);
+  uint32_t alpha = mapped.lookup("/Users/guest/Documents/alpha.txt");
+  VfsStat st{};
+  check(ok && mapped.isMapped() && mapped.getCount() == vfs.getCount() &&
+            listingNames(mapped, mapped.lookup("/Users/guest/Documents")) ==
+                listing &&
+            mapped.stat(alpha, st) && st.size == 30 && st.mtime == 4000,
+        "vfs image: a saved tree reopens mapped with the same contents");
+  uint32_t made = mapped.create(mapped.lookup("/Applications"), "New", true);
+  check(made != VirtualFileSystem::kInvalid && !mapped.isMapped() &&
+            mapped.path(made) == "/Applications/New" &&
+            mapped.lookup("/Users/guest/Documents/alpha.txt") !=
+                VirtualFileSystem::kInvalid,
+        "vfs image: the first write copies the mapping into memory");
+
+  // Each corruption must be rejected, leaving the open tree as it was.
+  std::vector<char> good = readFile(image);
+  const ImageHeader *header = (const ImageHeader *)good.data();
+  size_t inodes_at = sizeof(ImageHeader);
+  size_t index_at = inodes_at + header->inode_count * sizeof(ImageInode);
+  size_t children_at = index_at + header->index_capacity * sizeof(uint32_t);
+  uint32_t last = header->inode_count - 1;
+  auto inodeAt = [&](std::vector<char> &data, uint32_t n) {
+    return (ImageInode *)(data.data() + inodes_at + n * sizeof(ImageInode));
+  };
+
+  auto reject = [&](const char *what, std::vector<char> data) {
+    std::string bad = scratch.file("bad.vfs");
+    VirtualFileSystem target;
+    buildSampleTree(target);
+    uint32_t count = target.getCount();
+    bool rejected = writeFile(bad, data) && !target.open(bad);
+    check(rejected && target.getCount() == count &&
+              listingNames(target, target.lookup("/Users/guest/Documents")) ==
+                  listing,
+          (std::string("vfs image: rejects ") + what).c_str());
+  };
+
+  std::vector<char> data = good;
+  data.resize(good.size() - 3);
+  reject("a truncated file", data);
+  data = good;
+  inodeAt(data, 0)->child_offset = header->child_count;
+  reject("a child list past the children table", data);
+  data = good;
+  inodeAt(data, last)->name_offset = header->names_size;
+  reject("a name past the name pool", data);
+  data = good;
+  inodeAt(data, last)->name_length = UINT32_MAX;
+  reject("a name length that wraps", data);
+  data = good;
+  inodeAt(data, 1)->parent = last;
+  reject("a parent that does not come first", data);
+  data = good;
+  inodeAt(data, 1)->parent = header->inode_count;
+  reject("a parent past the inode table", data);
+  data = good;
+  inodeAt(data, last)->child_count = 1;
+  inodeAt(data, last)->flags = 0;
+  reject("children on a file", data);
+  data = good;
+  ((uint32_t *)(data.data() + children_at))[0] = header->inode_count + 7;
+  reject("a child past the inode table", data);
+  data = good;
+  ((uint32_t *)(data.data() + children_at))[0] = last;
+  reject("a child whose parent disagrees", data);
+  data = good;
+  for (uint32_t slot = 0; slot < header->index_capacity; slot++) {
+    uint32_t *entry = (uint32_t *)(data.data() + index_at) + slot;
+    *entry = *entry == UINT32_MAX ? 1 : *entry;
+  }
+  reject("an index with no empty slot", data);
+  data = good;
+  ((uint32_t *)(data.data() + index_at))[0] = header->inode_count;
+  reject("an index entry past the inode table", data);
+  data = good;
+  inodeAt(data, 0)->flags = 0;
+  reject("a root that is not a directory", data);
+
+  // Random damage: whatever open() accepts must be safe to walk.
+  Random random(11);
+  bool walked = true;
+  for (int round = 0; round < 2000; round++) {
+    data = good;
+    for (uint32_t flips = random.range(1, 4); flips > 0; flips--) {
+      data[random.range(0, (uint32_t)data.size() - 1)] ^=
+          (char)(1u << random.range(0, 7));
+    }
+    std::string bad = scratch.file("random.vfs");
+    VirtualFileSystem target;
+    if (!writeFile(bad, data) || !target.open(bad)) {
+      continue;
+    }
+    for (uint32_t n = 0; n < target.getCount(); n++) {
+      VfsListing list = target.list(n);
+      for (uint32_t k = 0; k < list.count; k++) {
+        walked = walked && target.path(list.entries[k]).size() > 1;
+      }
+      g_sink += target.lookup(target.path(n));
+    }
+  }
+  check(walked, "vfs image: randomly damaged images that open are walkable");
+}
+
+void benchVfs() {
+  const uint32_t count = 100000;
+  ScratchDir scratch;
+  std::string image = scratch.file("bench.vfs");
+  std::vector<std::string> names(count);
+  char name[32];
+  for (uint32_t i = 0; i < count; i++) {
+    std::snprintf(name, sizeof(name), "file-%06u.txt", i);
+    names[i] = name;
+  }
+  std::vector<uint32_t> shuffled(count);
+  for (uint32_t i = 0; i < count; i++) {
+    shuffled[i] = i;
+  }
+  Random random(7);
+  for (uint32_t i = count - 1; i > 0; i--) {
+    std::swap(shuffled[i], shuffled[random.range(0, i)]);
+  }
+
+  auto ms = [](uint64_t ns) { return (double)ns / 1e6; };
+  std::printf("one directory of %u entries\n", count);
+
+  VirtualFileSystem sorted;
+  uint32_t dir = sorted.create(VirtualFileSystem::kRoot, "dir", true);
+  uint64_t start = nowNs();
+  for (uint32_t i = 0; i < count; i++) {
+    sorted.create(dir, names[i], false, i, 1);
+  }
+  std::printf("%-34s %10.2f ms\n", "create, in listing order",
+              ms(nowNs() - start));
+
+  VirtualFileSystem vfs;
+  dir = vfs.create(VirtualFileSystem::kRoot, "dir", true);
+  start = nowNs();
+  for (uint32_t i = 0; i < count; i++) {
+    vfs.create(dir, names[shuffled[i]], false, i, 1);
+  }
+  std::printf("%-34s %10.2f ms\n", "create, random order",
+              ms(nowNs() - start));
+  start = nowNs();
+  VfsListing listing = vfs.list(dir);
+  std::printf("%-34s %10.2f ms\n", "first list (one-time sort)",
+              ms(nowNs() - start));
+
+  const int rounds = 1000;
+  start = nowNs();
+  for (int r = 0; r < rounds; r++) {
+    listing = vfs.list(dir);
+    g_sink += listing.entries[r % listing.count];
+  }
+  std::printf("%-34s %10.1f ns\n", "list again",
+              (double)(nowNs() - start) / rounds);
+
+  start = nowNs();
+  uint64_t bytes = 0;
+  VfsStat st;
+  for (uint32_t i = 0; i < listing.count; i++) {
+    vfs.stat(listing.entries[i], st);
+    bytes += st.size + vfs.name(listing.entries[i]).size();
+  }
+  g_sink += bytes;
+  std::printf("%-34s %10.2f ms\n", "walk listing (stat + name)",
+              ms(nowNs() - start));
+
+  start = nowNs();
+  for (uint32_t i = 0; i < count; i++) {
+    g_sink += vfs.lookup(dir, names[i].data(), names[i].size());
+  }
+  std::printf("%-34s %10.1f ns\n", "lookup one name",
+              (double)(nowNs() - start) / count);
+
+  start = nowNs();
+  bool saved = vfs.save(image);
+  std::printf("%-34s %10.2f ms\n", "save image", ms(nowNs() - start));
+
+  VirtualFileSystem mapped;
+  start = nowNs();
+  bool opened = saved && mapped.open(image);
+  uint64_t open_ns = nowNs() - start;
+  start = nowNs();
+  listing = mapped.list(mapped.lookup("/dir"));
+  uint64_t list_ns = nowNs() - start;
+  std::printf("%-34s %10.2f ms\n", "open image (validate + map)",
+              ms(open_ns));
+  std::printf("%-34s %10.1f ns\n", "list mapped directory", (double)list_ns);
+  if (!opened || listing.count != count) {
+    std::printf("image round trip failed\n");
+  }
+}
+
+// ============================================================================
+// Terminal buffer
+// ============================================================================
+
+std::string lineText(const TerminalBuffer &term, uint64_t seq) {
+  const TermLine *line = term.line(seq);
+  return line ? line->text : std::string("<evicted>");
+}
+
+std::string allText(const TerminalBuffer &term) {
+  std::string text;
+  for (uint64_t seq = term.firstLine(); seq < term.endLine(); seq++) {
+    const TermLine *line = term.line(seq);
+    text += line->text + (line->wrapped ? "+" : "|");
+  }
+  return text;
+}
+
+// Bytes held by the ring's line buffers.
+size_t heldBytes(const TerminalBuffer &term) {
+  size_t bytes = 0;
+  for (uint64_t seq = term.firstLine(); seq < term.endLine(); seq++) {
+    const TermLine *line = term.line(seq);
+    bytes += line->text.capacity() + line->runs.capacity() * sizeof(TermRun);
+  }
+  return bytes;
+}
+
+// Coloured log-style lines, roughly what a build prints.
+std::string sampleOutput(Random &random, size_t bytes) {
+  static const char *const colours[] = {"\033[1;36m", "\033[32m",
+                                        "\033[38;5;208m",
+                                        "\033[38;2;200;80;40m", "\033[0m"};
+  std::string out;
+  out.reserve(bytes + 256);
+  char word[32];
+  while (out.size() < bytes) {
+    uint32_t words = random.range(4, 14);
+    for (uint32_t w = 0; w < words; w++) {
+      if (random.range(0, 3) == 0) {
+        out += colours[random.range(0, 4)];
+      }
+      std::snprintf(word, sizeof(word), "%s%llx", w ? " " : "",
+                    (unsigned long long)random.next() >> random.range(4, 56));
+      out += word;
+    }
+    out += random.range(0, 15) == 0 ? "\r\033[K" : "\033[0m\n";
+  }
+  return out;
+}
+
+void testTerminalSgr() {
+  TerminalBuffer term;
+  term.write("\033[1;36mhello\033[0m world\n");
+  const TermLine *line = term.line(0);
+  bool ok = line && line->text == "hello world" && line->runs.size() == 2 &&
+            line->runs[0].start == 0 &&
+            line->runs[0].attributes ==
+                TermAttributes{kTermColorIndexed | 6, 0, kTermBold} &&
+            line->runs[1].start == 5 &&
+            line->runs[1].attributes == TermAttributes{0, 0, 0};
+  check(ok, "terminal: SGR attributes split a line into runs");
+
+  term.write("\033[38;5;208;48;2;1;2;3;4mx\033[22;24;39;49my");
+  line = term.line(1);
+  ok = line && line->runs.size() == 2 &&
+       line->runs[0].attributes ==
+           TermAttributes{kTermColorIndexed | 208, kTermColorRGB | 0x010203,
+                          kTermUnderline} &&
+       line->runs[1].attributes == TermAttributes{0, 0, 0};
+  check(ok, "terminal: 256-colour, truecolour and resets");
+
+  // ITU colon form: the empty colorspace field must not shift r, g, b, and
+  // a subparameter must not read as an SGR of its own (4:3 is not italic).
+  term.write("\n\033[38:2::10:20:30;48:5:17;4:3mx\033[38:2:40:50:60;4:0my\n");
+  line = term.line(2);
+  ok = line && line->runs.size() == 2 &&
+       line->runs[0].attributes ==
+           TermAttributes{kTermColorRGB | 0x0a141e, kTermColorIndexed | 17,
+                          kTermUnderline} &&
+       line->runs[1].attributes ==
+           TermAttributes{kTermColorRGB | 0x28323c, kTermColorIndexed | 17, 0};
+  check(ok, "terminal: colon subparameters, with and without colorspace");
+
+  // The same stream fed one byte at a time parses identically.
+  Random random(5);
+  std::string stream = sampleOutput(random, 20000) + "\033]0;title\007ok";
+  TerminalBuffer whole;
+  TerminalBuffer split;
+  whole.write(stream);
+  for (char c : stream) {
+    split.write(&c, 1);
+  }
+  bool same = whole.endLine() == split.endLine();
+  for (uint64_t seq = whole.firstLine(); same && seq < whole.endLine();
+       seq++) {
+    const TermLine *a = whole.line(seq);
+    const TermLine *b = split.line(seq);
+    same = a->text == b->text && a->runs.size() == b->runs.size();
+    for (size_t r = 0; same && r < a->runs.size(); r++) {
+      same = a->runs[r].start == b->runs[r].start &&
+             a->runs[r].attributes == b->runs[r].attributes;
+    }
+  }
+  check(same && lineText(whole, whole.endLine() - 1) == "ok",
+        "terminal: sequences split across writes parse the same");
+}
+
+void testTerminalLines() {
+  TerminalBuffer term(3, 8);
+  term.write("one\ntwo\nthree\nfour\n");
+  check(term.firstLine() == 2 && term.endLine() == 5 &&
+            term.line(1) == nullptr && lineText(term, 2) == "three",
+        "terminal: the ring keeps only the scrollback limit");
+
+  TerminalBuffer wrap(10, 8);
+  wrap.write("abcdefghij\xc3\xa9\xc3\xa9\xc3\xa9x\n");
+  check(allText(wrap) == "abcdefgh+ij\xc3\xa9\xc3\xa9\xc3\xa9+x||",
+        "terminal: long lines wrap on a UTF-8 boundary");
+
+  TerminalBuffer edit;
+  edit.write("50%\r75%\rdone\nab\xc3\xa9\b\bc\nstale\r\033[K");
+  check(allText(edit) == "done|ac||", "terminal: CR, erase-line and "
+                                       "backspace over UTF-8");
+
+  TerminalBuffer sync;
+  sync.write("a\nb");
+  TermUpdate first = sync.takeUpdate();
+  sync.write("c\nd\n");
+  TermUpdate second = sync.takeUpdate();
+  bool kept = lineText(sync, 1) == "bc" && lineText(sync, 3) == "";
+  sync.write("\033[3J");
+  TermUpdate cleared = sync.takeUpdate();
+  check(first.changed == 0 && first.end == 2 && second.changed == 1 &&
+            second.end == 4 && kept && cleared.reset &&
+            cleared.first == sync.endLine() - 1,
+        "terminal: updates report the open line onwards and clears");
+
+  TerminalBuffer resize(8);
+  for (int i = 0; i < 8; i++) {
+    resize.write(std::to_string(i) + "\n");
+  }
+  resize.setScrollback(3);
+  check(resize.firstLine() == 6 && lineText(resize, 6) == "6" &&
+            lineText(resize, 8) == "",
+        "terminal: shrinking the scrollback keeps the newest lines");
+}
+
+void testTerminalMemory() {
+  TerminalBuffer term(1000, 256);
+  Random random(9);
+  std::string chunk = sampleOutput(random, 1 << 20);
+  for (int i = 0; i < 4; i++) {
+    term.write(chunk);
+  }
+  size_t warm = heldBytes(term);
+  for (int i = 0; i < 20; i++) {
+    term.write(chunk);
+  }
+  size_t held = heldBytes(term);
+  check(held <= warm + warm / 10 && held < 1000 * (256 + 64 * sizeof(TermRun)),
+        "terminal: streaming 24 MB keeps the ring's memory flat");
+}
+
+long maxRssKb() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  return usage.ru_maxrss / 1024;
+#else
+  return usage.ru_maxrss;
+#endif
+}
+
+void benchTerminal() {
+  const size_t total = 100u << 20;
+  const size_t chunk_bytes = 64u << 10;
+  Random random(3);
+  std::string sample = sampleOutput(random, 8u << 20);
+  TerminalBuffer term;
+  std::printf("%zu MB in %zu KB writes, scrollback %u lines\n", total >> 20,
+              chunk_bytes >> 10, TerminalBuffer::kDefaultScrollback);
+
+  size_t fed = 0;
+  size_t offset = 0;
+  uint64_t redrawn = 0;
+  long rss_10 = 0;
+  size_t held_10 = 0;
+  uint64_t start = nowNs();
+  while (fed < total) {
+    size_t take = std::min(chunk_bytes, sample.size() - offset);
+    term.write(sample.data() + offset, take);
+    offset = offset + take == sample.size() ? 0 : offset + take;
+    fed += take;
+    // What a view redraws after each write.
+    TermUpdate update = term.takeUpdate();
+    redrawn += update.end - std::max(update.changed, update.first);
+    if (!rss_10 && fed >= (10u << 20)) {
+      rss_10 = maxRssKb();
+      held_10 = heldBytes(term);
+    }
+  }
+  double seconds = (double)(nowNs() - start) / 1e9;
+  std::printf("%-28s %10.1f MB/s\n", "throughput",
+              (double)fed / (1 << 20) / seconds);
+  std::printf("%-28s %10.1f\n", "lines redrawn per write",
+              (double)redrawn / (double)(fed / chunk_bytes));
+  std::printf("%-28s %7zu KB %7zu KB\n", "ring buffers at 10/100 MB",
+              held_10 >> 10, heldBytes(term) >> 10);
+  std::printf("%-28s %7ld KB %7ld KB\n", "max RSS at 10/100 MB", rss_10,
+              maxRssKb());
+}
+
+// ============================================================================
+// Message store
+// ============================================================================
+
+typedef std::map<std::string, std::vector<StoredMessage>> MessageModel;
+
+StoredMessage randomMessage(Random &random, int64_t timestamp) {
+  static const char *const kSenders[] = {"me", "Alice", "Bob", "Carol"};
+  StoredMessage message;
+  message.sender = kSenders[random.next() % 4];
+  message.text.resize(random.range(1, 160));
+  for (char &c : message.text) {
+    c = (char)random.range(' ', '~');
+  }
+  char label[16];
+  std::snprintf(label, sizeof(label), "%02d:%02d",
+                (int)(timestamp / 3600 % 24), (int)(timestamp / 60 % 60));
+  message.time = label;
+  message.timestamp = timestamp;
+  return message;
+}
+
+bool sameMessage(const StoredMessage &a, const StoredMessage &b) {
+  return a.sender == b.sender && a.text == b.text && a.time == b.time &&
+         a.timestamp == b.timestamp;
+}
+
+// Appends count messages spread over conversations chat-0 .. chat-(n-1).
+bool fillStore(MessageStore &store, MessageModel &model, Random &random,
+               size_t count, uint32_t conversations) {
+  for (size_t i = 0; i < count; i++) {
+    std::string name =
+        "chat-" + std::to_string(random.range(0, conversations - 1));
+    StoredMessage message = randomMessage(random, 1700000000 + (int64_t)i);
+    if (!store.append(name, message)) {
+      return false;
+    }
+    model[name].push_back(message);
+  }
+  return true;
+}
+
+// Every conversation reads back as the model has it, a page at a time.
+bool storeMatches(const MessageStore &store, const MessageModel &model) {
+  const size_t page = 37;
+  if (store.getConversations().size() != model.size()) {
+    return false;
+  }
+  for (const auto &kv : model) {
+    if (store.getMessageCount(kv.first) != kv.second.size()) {
+      return false;
+    }
+    std::vector<StoredMessage> got;
+    for (size_t first = 0; first < kv.second.size(); first += page) {
+      store.read(kv.first, first, page, got);
+    }
+    if (got.size() != kv.second.size()) {
+      return false;
+    }
+    for (size_t i = 0; i < got.size(); i++) {
+      if (!sameMessage(got[i], kv.second[i])) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Files in dir ending in suffix, sorted (segment ids are zero-padded hex).
+std::vector<std::string> storeFiles(const std::string &dir,
+                                    const char *suffix) {
+  std::vector<std::string> names;
+  size_t suffix_length = std::strlen(suffix);
+  if (DIR *handle = opendir(dir.c_str())) {
+    while (struct dirent *entry = readdir(handle)) {
+      size_t length = std::strlen(entry->d_name);
+      if (length > suffix_length &&
+          std::strcmp(entry->d_name + length - suffix_length, suffix) == 0) {
+        names.push_back(dir + "/" + entry->d_name);
+      }
+    }
+    closedir(handle);
+  }
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+uint64_t storeBytes(const std::string &dir) {
+  uint64_t total = 0;
+  for (const char *suffix : {".log", ".idx"}) {
+    for (const std::string &file : storeFiles(dir, suffix)) {
+      struct stat st;
+      if (::stat(file.c_str(), &st) == 0) {
+        total += (uint64_t)st.st_size;
+      }
+    }
+  }
+  return total;
+}
+
+void testMessageStoreLog(ScratchDir &scratch) {
+  std::string dir = scratch.file("messages");
+  Random random(41);
+  MessageModel model;
+  MessageStore store(4096);
+  check(store.open(dir), "messages: open creates the directory");
+  store.setAutoCompact(false);
+  check(fillStore(store, model, random, 1500, 12) && storeMatches(store, model),
+        "messages: paged reads match the appends");
+  check(store.getStats().segments > 10 &&
+            store.getStats().messages == 1500,
+        "messages: the log rolls over into segments");
+  std::vector<StoredMessage> none;
+  check(store.read("chat-0", model["chat-0"].size(), 10, none) == 0 &&
+            store.read("nobody", 0, 10, none) == 0 && none.empty(),
+        "messages: out-of-range and unknown reads are empty");
+
+  store.close();
+  check(store.open(dir) && storeMatches(store, model),
+        "messages: reopen restores every conversation");
+
+  store.close();
+  size_t logs = storeFiles(dir, ".log").size();
+  for (const std::string &file : storeFiles(dir, ".idx")) {
+    unlink(file.c_str());
+  }
+  check(store.open(dir) && storeMatches(store, model) &&
+            storeFiles(dir, ".idx").size() == logs - 1,
+        "messages: reopen without sidecars scans and rewrites them");
+
+  // A crash mid-write leaves part of the last record behind.
+  StoredMessage last = randomMessage(random, 1800000000);
+  store.append("torn", last);
+  store.close();
+  std::string active = storeFiles(dir, ".log").back();
+  std::vector<char> data = readFile(active);
+  size_t whole = data.size();
+  data.resize(whole - 5);
+  writeFile(active, data);
+  bool reopened = store.open(dir);
+  check(reopened && store.getMessageCount("torn") == 0 &&
+            storeMatches(store, model) &&
+            readFile(active).size() + last.text.size() < whole,
+        "messages: a torn tail record is cut off on open");
+  check(fillStore(store, model, random, 200, 12),
+        "messages: append after a torn tail");
+  store.close();
+  check(store.open(dir) && storeMatches(store, model),
+        "messages: appends after a torn tail survive a reopen");
+
+  // Flip a byte inside the first record of a sealed segment: the sidecar
+  // still lists it, but the CRC keeps it from being returned.
+  store.close();
+  std::string sealed = storeFiles(dir, ".log").front();
+  data = readFile(sealed);
+  data[48] ^= 0x20;
+  writeFile(sealed, data);
+  store.open(dir);
+  size_t listed = 0;
+  size_t returned = 0;
+  size_t matching = 0;
+  for (const auto &kv : model) {
+    std::vector<StoredMessage> got;
+    listed += store.getMessageCount(kv.first);
+    returned += store.read(kv.first, 0, kv.second.size(), got);
+    for (const StoredMessage &message : got) {
+      for (const StoredMessage &expected : kv.second) {
+        if (sameMessage(message, expected)) {
+          matching++;
+          break;
+        }
+      }
+    }
+  }
+  check(listed == returned + 1 && matching == returned,
+        "messages: a record failing its CRC is skipped");
+  store.close();
+}
+
+void testMessageStoreCompaction(ScratchDir &scratch) {
+  std::string dir = scratch.file("compact");
+  Random random(43);
+  MessageModel model;
+  MessageStore store(4096);
+  store.open(dir);
+  store.setAutoCompact(false);
+  fillStore(store, model, random, 2000, 20);
+  for (uint32_t i = 0; i < 15; i++) {
+    std::string name = "chat-" + std::to_string(i);
+    store.removeConversation(name);
+    model.erase(name);
+  }
+  check(!store.removeConversation("chat-0") &&
+            !store.removeConversation("nobody"),
+        "messages: removing a missing conversation fails");
+  MessageStoreStats before = store.getStats();
+  check(before.dead_bytes > 0 && storeMatches(store, model),
+        "messages: removal leaves dead bytes, not stale reads");
+
+  bool compacted = store.compact();
+  MessageStoreStats after = store.getStats();
+  check(compacted && after.dead_bytes == 0 && after.compactions == 1 &&
+            after.segments < before.segments && storeMatches(store, model),
+        "messages: compaction drops removed conversations");
+  store.close();
+  check(store.open(dir) && storeMatches(store, model) &&
+            store.getStats().dead_bytes == 0,
+        "messages: a compacted store reopens intact");
+
+  // Background compaction kicks in once half the sealed data is dead, while
+  // appends carry on.
+  fillStore(store, model, random, 2000, 20);
+  uint32_t compactions = store.getStats().compactions;
+  store.setAutoCompact(true);
+  for (uint32_t i = 0; i < 18; i++) {
+    std::string name = "chat-" + std::to_string(i);
+    store.removeConversation(name);
+    model.erase(name);
+  }
+  fillStore(store, model, random, 300, 3);
+  uint64_t deadline = nowNs() + 5000000000ull;
+  while (store.getStats().compactions == compactions && nowNs() < deadline) {
+    usleep(1000);
+  }
+  check(store.getStats().compactions > compactions &&
+            storeMatches(store, model),
+        "messages: background compaction runs alongside appends");
+  store.close();
+  check(store.open(dir) && storeMatches(store, model),
+        "messages: reopen after background compaction");
+}
+
+void benchMessages() {
+  const size_t total = 200000;
+  const uint32_t conversations = 1000;
+  const size_t window = 10000;
+  ScratchDir scratch;
+  std::string dir = scratch.file("messages");
+  Random random(5);
+  std::vector<std::pair<std::string, StoredMessage>> messages;
+  messages.reserve(total);
+  uint64_t payload = 0;
+  for (size_t i = 0; i < total; i++) {
+    messages.emplace_back(
+        "chat-" + std::to_string(random.range(0, conversations - 1)),
+        randomMessage(random, 1700000000 + (int64_t)i));
+    payload += messages.back().second.text.size();
+  }
+  std::printf("%zu messages over %u conversations, %.1f MB of text\n", total,
+              conversations, (double)payload / (1 << 20));
+
+  // Saving one message costs the same whether the store is empty or full.
+  MessageStore store;
+  store.open(dir);
+  uint64_t first_ns = 0;
+  uint64_t start = nowNs();
+  uint64_t mark = start;
+  for (size_t i = 0; i < total; i++) {
+    store.append(messages[i].first, messages[i].second);
+    if (i + 1 == window) {
+      first_ns = nowNs() - mark;
+    } else if (i + 1 == total - window) {
+      mark = nowNs();
+    }
+  }
+  uint64_t end = nowNs();
+  store.sync();
+  std::printf("%-28s %10.0f msgs/s\n", "append",
+              (double)total * 1e9 / (double)(end - start));
+  std::printf("%-28s %7.2f us %7.2f us\n", "append, first/last 10K",
+              (double)first_ns / 1e3 / window,
+              (double)(end - mark) / 1e3 / window);
+
+  const size_t synced = 500;
+  start = nowNs();
+  for (size_t i = 0; i < synced; i++) {
+    store.append(messages[i].first, messages[i].second);
+    store.sync();
+  }
+  std::printf("%-28s %10.1f us\n", "append + fsync",
+              (double)(nowNs() - start) / 1e3 / synced);
+  MessageStoreStats stats = store.getStats();
+  store.close();
+  std::printf("%-28s %10u\n", "segments", stats.segments);
+  std::printf("%-28s %10.1f MB\n", "on disk",
+              (double)storeBytes(dir) / (1 << 20));
+
+  // Page cache warm: this is the store's own work at startup.
+  uint64_t best = ~0ull;
+  for (int round = 0; round < 3; round++) {
+    start = nowNs();
+    store.open(dir);
+    best = std::min(best, nowNs() - start);
+    store.close();
+  }
+  std::printf("%-28s %10.2f ms\n", "open from sidecars",
+              (double)best / 1e6);
+  for (const std::string &file : storeFiles(dir, ".idx")) {
+    unlink(file.c_str());
+  }
+  start = nowNs();
+  store.open(dir);
+  std::printf("%-28s %10.2f ms\n", "open by scanning",
+              (double)(nowNs() - start) / 1e6);
+
+  // What a chat view loads when a conversation is opened.
+  const int pages = 2000;
+  uint64_t read = 0;
+  start = nowNs();
+  for (int i = 0; i < pages; i++) {
+    std::string name =
+        "chat-" + std::to_string(random.range(0, conversations - 1));
+    size_t count = store.getMessageCount(name);
+    std::vector<StoredMessage> page;
+    read += store.read(name, count > 50 ? count - 50 : 0, 50, page);
+  }
+  g_sink = read;
+  std::printf("%-28s %10.1f us\n", "read last 50 messages",
+              (double)(nowNs() - start) / 1e3 / pages);
+}
+
+// ============================================================================
+// Search index
+// ============================================================================
+
+// Words drawn with a Zipf-like skew: rank r comes up about 1/r as often.
+struct Vocabulary {
+  std::vector<std::string> words;
+
+  Vocabulary(Random &random, size_t count) {
+    std::unordered_set<std::string> seen;
+    while (words.size() < count) {
+      std::string word(random.range(3, 9), ' ');
+      for (char &c : word) {
+        c = (char)random.range('a', 'z');
+      }
+      if (seen.insert(word).second) {
+        words.push_back(word);
+      }
+    }
+  }
+
+  const std::string &pick(Random &random) const {
+    double u = (double)(random.next() >> 11) / 9007199254740992.0;
+    size_t rank = (size_t)std::exp(u * std::log((double)words.size()));
+    return words[std::min(rank, words.size()) - 1];
+  }
+};
+
+// The brute-force answer: the documents whose words satisfy every clause
+// of a query built from plain words, word* and "quoted phrases".
+struct SearchModel {
+  std::map<uint32_t, std::vector<std::string>> documents;
+
+  static bool containsPhrase(const std::vector<std::string> &words,
+                             const std::vector<std::string> &phrase) {
+    for (size_t i = 0; i + phrase.size() <= words.size(); i++) {
+      if (std::equal(phrase.begin(), phrase.end(), words.begin() + i)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static bool containsPrefix(const std::vector<std::string> &words,
+                             const std::string &prefix) {
+    for (const std::string &word : words) {
+      if (word.compare(0, prefix.size(), prefix) == 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  std::vector<uint32_t> matches(
+      const std::vector<std::vector<std::string>> &phrases,
+      const std::vector<std::string> &prefixes) const {
+    std::vector<uint32_t> found;
+    for (const auto &kv : documents) {
+      bool ok = true;
+      for (const auto &phrase : phrases) {
+        ok = ok && containsPhrase(kv.second, phrase);
+      }
+      for (const std::string &prefix : prefixes) {
+        ok = ok && containsPrefix(kv.second, prefix);
+      }
+      if (ok) {
+        found.push_back(kv.first);
+      }
+    }
+    return found;
+  }
+};
+
+std::string joinWords(const std::vector<std::string> &words) {
+  std::string text;
+  for (const std::string &word : words) {
+    text += text.empty() ? "" : " ";
+    text += word;
+  }
+  return text;
+}
+
+std::vector<std::string> randomDocument(Random &random,
+                                        const Vocabulary &vocabulary,
+                                        uint32_t min_words,
+                                        uint32_t max_words) {
+  std::vector<std::string> words(random.range(min_words, max_words));
+  for (std::string &word : words) {
+    word = vocabulary.pick(random);
+  }
+  return words;
+}
+
+void testSearchTokenizer() {
+  typedef std::vector<std::string> Words;
+  check(SearchIndex::tokenize("Hello, world! foo_bar 42x") ==
+            Words({"hello", "world", "foo", "bar", "42x"}),
+        "search: words split on punctuation and fold to lower case");
+  check(SearchIndex::tokenize("Straße STRASSE") ==
+            Words({"strasse", "strasse"}),
+        "search: sharp s folds to ss");
+  Words greek = SearchIndex::tokenize("Ωμέγα ωμέγα ΩΜΈΓΑ");
+  check(greek.size() == 3 && greek[0] == greek[1] && greek[1] == greek[2],
+        "search: Greek folds across cases");
+  check(SearchIndex::tokenize("Привет, МИР") ==
+            SearchIndex::tokenize("привет мир"),
+        "search: Cyrillic folds across cases");
+  check(SearchIndex::prefixQuery("meet") == "meet*" &&
+            SearchIndex::prefixQuery("meet ") == "meet " &&
+            SearchIndex::prefixQuery("\"team meet") == "\"team meet" &&
+            SearchIndex::prefixQuery("  ").empty(),
+        "search: typed text becomes a prefix query");
+}
+
+// Every hit is a match, every match is a hit, and a small k gets the best
+// of them.
+bool searchAgrees(const SearchIndex &index, const SearchModel &model,
+                  const std::string &query,
+                  const std::vector<std::vector<std::string>> &phrases,
+                  const std::vector<std::string> &prefixes) {
+  std::vector<uint32_t> expected = model.matches(phrases, prefixes);
+  std::vector<SearchHit> all = index.search(query, model.documents.size() + 1);
+  std::vector<uint32_t> got;
+  for (size_t i = 0; i < all.size(); i++) {
+    got.push_back(all[i].document);
+    if (i > 0 && all[i].score > all[i - 1].score) {
+      return false;
+    }
+  }
+  std::sort(got.begin(), got.end());
+  if (got != expected) {
+    return false;
+  }
+  const size_t k = 10;
+  std::vector<SearchHit> top = index.search(query, k);
+  if (top.size() != std::min(k, all.size())) {
+    return false;
+  }
+  for (size_t i = 0; i < top.size(); i++) {
+    if (std::fabs(top[i].score - all[i].score) > 1e-4f * all[i].score) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Random word, two-word, prefix and phrase queries against the model.
+bool randomQueriesAgree(const SearchIndex &index, const SearchModel &model,
+                        const Vocabulary &vocabulary, Random &random,
+                        int queries) {
+  std::vector<const std::vector<std::string> *> documents;
+  for (const auto &kv : model.documents) {
+    documents.push_back(&kv.second);
+  }
+  for (int q = 0; q < queries; q++) {
+    std::vector<std::vector<std::string>> phrases;
+    std::vector<std::string> prefixes;
+    std::string query;
+    switch (q % 4) {
+    case 0:
+      phrases.push_back({vocabulary.pick(random)});
+      query = phrases[0][0];
+      break;
+    case 1:
+      phrases.push_back({vocabulary.pick(random)});
+      phrases.push_back({vocabulary.pick(random)});
+      query = phrases[0][0] + " " + phrases[1][0];
+      break;
+    case 2:
+      prefixes.push_back(vocabulary.pick(random).substr(0, 2));
+      phrases.push_back({vocabulary.pick(random)});
+      query = prefixes[0] + "* " + phrases[0][0];
+      break;
+    default: {
+      // Lift a phrase out of a document so it usually matches
+      const std::vector<std::string> &words =
+          *documents[random.range(0, (uint32_t)documents.size() - 1)];
+      if (words.size() < 3) {
+        continue;
+      }
+      size_t start = random.range(0, (uint32_t)words.size() - 3);
+      phrases.push_back({words.begin() + start, words.begin() + start + 3});
+      query = "\"" + joinWords(phrases[0]) + "\"";
+      break;
+    }
+    }
+    if (!searchAgrees(index, model, query, phrases, prefixes)) {
+      std::printf("  query %s\n", query.c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+void testSearchQueries() {
+  Random random(47);
+  Vocabulary vocabulary(random, 400);
+  SearchIndex index;
+  SearchModel model;
+  for (uint32_t id = 0; id < 3000; id++) {
+    std::vector<std::string> words = randomDocument(random, vocabulary, 3, 40);
+    index.update(id * 7, joinWords(words));
+    model.documents[id * 7] = words;
+  }
+  check(index.getDocumentCount() == 3000,
+        "search: every document is counted");
+  check(randomQueriesAgree(index, model, vocabulary, random, 400),
+        "search: word, prefix and phrase queries match a linear scan");
+
+  // Edits and removals land in the delta and mask the old postings.
+  for (int i = 0; i < 1500; i++) {
+    uint32_t id = random.range(0, 2999) * 7;
+    if (i % 5 == 0) {
+      index.remove(id);
+      model.documents.erase(id);
+    } else {
+      std::vector<std::string> words =
+          randomDocument(random, vocabulary, 3, 40);
+      index.update(id, joinWords(words));
+      model.documents[id] = words;
+    }
+  }
+  check(index.getDocumentCount() == model.documents.size() &&
+            randomQueriesAgree(index, model, vocabulary, random, 400),
+        "search: results follow updates and removals");
+  index.merge();
+  check(randomQueriesAgree(index, model, vocabulary, random, 400),
+        "search: results survive a merge");
+
+  // More of a word in a document of the same length ranks it higher.
+  SearchIndex ranked;
+  ranked.update(1, "apple pear plum fig");
+  ranked.update(2, "apple apple apple fig");
+  ranked.update(3, "pear plum fig kiwi");
+  std::vector<SearchHit> hits = ranked.search("apple", 10);
+  check(hits.size() == 2 && hits[0].document == 2 && hits[1].document == 1,
+        "search: hits rank by BM25");
+  check(ranked.search("STRASSE", 10).empty() &&
+            (ranked.update(4, "Die Straße"),
+             ranked.search("STRASSE", 10).size() == 1) &&
+            ranked.search("ki*", 10).size() == 1 &&
+            ranked.search("\"plum fig\"", 10).size() == 2 &&
+            ranked.search("\"fig plum\"", 10).empty(),
+        "search: folding, prefixes and phrase order apply at query time");
+  ranked.clear();
+  check(ranked.getDocumentCount() == 0 && ranked.search("apple", 10).empty(),
+        "search: clear empties the index");
+}
+
+void benchSearch(uint32_t documents) {
+  Random random(11);
+  Vocabulary vocabulary(random, 100000);
+  SearchIndex index;
+  std::printf("%u documents of 5-60 words over a %zu-word vocabulary\n",
+              documents, vocabulary.words.size());
+  uint64_t start = nowNs();
+  for (uint32_t id = 0; id < documents; id++) {
+    index.update(id, joinWords(randomDocument(random, vocabulary, 5, 60)));
+  }
+  index.merge();
+  double build = (double)(nowNs() - start) / 1e9;
+  std::printf("%-24s %8.1f s %8.0f docs/s\n", "build", build,
+              documents / build);
+  std::printf("%-24s %8.1f MB %8zu terms\n", "index",
+              (double)index.getMemoryUsage() / (1 << 20),
+              index.getTermCount());
+
+  // A query per kind, from the common words (long posting lists, the slow
+  // case) to the rare ones.
+  struct Kind {
+    const char *name;
+    std::string (*make)(const Vocabulary &, Random &);
+  };
+  static const Kind kKinds[] = {
+      {"common word",
+       [](const Vocabulary &v, Random &r) {
+         return v.words[r.range(0, 9)];
+       }},
+      {"rare word",
+       [](const Vocabulary &v, Random &r) {
+         return v.words[r.range(10000, 99999)];
+       }},
+      {"two common words",
+       [](const Vocabulary &v, Random &r) {
+         return v.words[r.range(0, 99)] + " " + v.words[r.range(0, 99)];
+       }},
+      {"prefix",
+       [](const Vocabulary &v, Random &r) {
+         return v.words[r.range(0, 999)].substr(0, 3) + "*";
+       }},
+      {"word + prefix",
+       [](const Vocabulary &v, Random &r) {
+         return v.words[r.range(0, 99)] + " " +
+                v.words[r.range(0, 999)].substr(0, 2) + "*";
+       }},
+      {"phrase",
+       [](const Vocabulary &v, Random &r) {
+         return "\"" + v.pick(r) + " " + v.pick(r) + "\"";
+       }},
+  };
+  // Each query's time is the best of three runs, so a preempted run on a
+  // busy machine doesn't count as the index's latency.
+  const int rounds = 200;
+  const size_t k = 20;
+  double worst = 0;
+  std::printf("%-24s %10s %10s %10s\n", "query (top 20)", "mean ms", "max ms",
+              "hits");
+  for (const Kind &kind : kKinds) {
+    double total = 0;
+    double slowest = 0;
+    uint64_t hits = 0;
+    for (int i = 0; i < rounds; i++) {
+      std::string query = kind.make(vocabulary, random);
+      double ms = 1e9;
+      for (int run = 0; run < 3; run++) {
+        uint64_t t = nowNs();
+        size_t found = index.search(query, k).size();
+        ms = std::min(ms, (double)(nowNs() - t) / 1e6);
+        hits += run == 0 ? found : 0;
+      }
+      total += ms;
+      slowest = std::max(slowest, ms);
+    }
+    worst = std::max(worst, slowest);
+    std::printf("%-24s %10.3f %10.3f %10.1f\n", kind.name, total / rounds,
+                slowest, (double)hits / rounds);
+  }
+
+  const int edits = 10000;
+  start = nowNs();
+  for (int i = 0; i < edits; i++) {
+    index.update(random.range(0, documents - 1),
+                 joinWords(randomDocument(random, vocabulary, 5, 60)));
+  }
+  std::printf("%-24s %10.1f us\n", "update a document",
+              (double)(nowNs() - start) / 1e3 / edits);
+  std::printf("slowest query %.3f ms: %s 10 ms\n", worst,
+              worst < 10 ? "under" : "OVER");
+}
+
+// ============================================================================
+// Main
+// ============================================================================
+
+int usage() {
+  std::fprintf(stderr, "usage: systool test\n"
+                       "       systool bench vfs\n"
+                       "       systool bench terminal\n"
+                       "       systool bench messages\n"
+                       "       systool bench search [documents]\n");
+  return 2;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc == 2 && std::strcmp(argv[1], "test") == 0) {
+    ScratchDir scratch;
+    testVfsTree();
+    testVfsImage(scratch);
+    testTerminalSgr();
+    testTerminalLines();
+    testTerminalMemory();
+    testMessageStoreLog(scratch);
+    testMessageStoreCompaction(scratch);
+    testSearchTokenizer();
+    testSearchQueries();
+    std::printf("%s\n", g_failures ? "FAILED" : "all checks passed");
+    return g_failures ? 1 : 0;
+  }
+  if (argc >= 3 && std::strcmp(argv[1], "bench") == 0) {
+    if (argc == 3 && std::strcmp(argv[2], "vfs") == 0) {
+      benchVfs();
+      return 0;
+    }
+    if (argc == 3 && std::strcmp(argv[2], "terminal") == 0) {
+      benchTerminal();
+      return 0;
+    }
+    if (argc == 3 && std::strcmp(argv[2], "messages") == 0) {
+      benchMessages();
+      return 0;
+    }
+    if (argc <= 4 && std::strcmp(argv[2], "search") == 0) {
+      long documents = argc == 4 ? std::atol(argv[3]) : 1000000;
+      benchSearch(documents > 0 ? (uint32_t)documents : 1);
+      return 0;
+    }
+  }
+  return usage();
+}
@@ -0,0 +1,1570 @@
+// uitool - checks and benchmarks for the C++ view-layer cores
+//
+//   uitool test                  correctness checks (exit status 1 on any
+//                                failure)
+//   uitool bench atlas           atlas page occupancy, add and lookup cost,
+//                                and icon draws from the atlas (in order
+//                                and batched by page) against one texture
+//                                per icon
+//   uitool bench thumbnails [workers]
+//                                thumbnails/sec cold, from the disk cache
+//                                and from memory, and resampler cost
+//   uitool bench grid            GridRecycler scroll-step cost at 1M items
+//   uitool bench layers          desktop and dock hover frame time with the
+//                                static layers repainted against cached
+//   uitool bench events [producers]
+//                                post and dispatch cost, multi-producer
+//                                throughput, coalescing and timer wheel cost
+
+#include "EventManager.h"
+#include "GridLayout.hpp"
+#include "RenderTarget.hpp"
+#include "TextureAtlas.hpp"
+#include "ThumbnailService.hpp"
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace OS::Graphics;
+
+namespace {
+
+// ============================================================================
+// Helpers
+// ============================================================================
+
+uint64_t nowNs() {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// xorshift64*, so every run sees the same inputs.
+struct Random {
+  uint64_t state;
+
+  explicit Random(uint64_t seed) : state(seed | 1) {}
+
+  uint64_t next() {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545f4914f6cdd1dull;
+  }
+
+  uint32_t range(uint32_t lo, uint32_t hi) {
+    return lo + (uint32_t)(next() % (uint64_t)(hi - lo + 1));
+  }
+};
+
+int g_failures = 0;
+volatile uint64_t g_sink; // keeps timed loops from being optimized away
+
+void check(bool ok, const char *name) {
+  std::printf("%s %s\n", ok ? "PASS" : "FAIL", name);
+  if (!ok) {
+    g_failures++;
+  }
+}
+
+// A standalone ARGB surface for draw comparisons.
+struct Surface {
+  std::vector<uint32_t> pixels;
+  GraphicsContext ctx;
+
+  Surface(uint32_t width, uint32_t height)
+      : pixels((size_t)width * height, 0) {
+    std::memset(&ctx, 0, sizeof(ctx));
+    ctx.width = width;
+    ctx.height = height;
+    ctx.bits_per_pixel = 32;
+    ctx.framebuffer = pixels.data();
+    graphics_reset_clip(&ctx);
+  }
+};
+
+// ============================================================================
+// Texture atlas
+// ============================================================================
+
+struct Image {
+  uint32_t width;
+  uint32_t height;
+  std::vector<uint32_t> pixels;
+};
+
+// Opaque noise, so a misplaced copy cannot match by accident.
+Image randomImage(Random &rng, uint32_t lo, uint32_t hi) {
+  Image image;
+  image.width = rng.range(lo, hi);
+  image.height = rng.range(lo, hi);
+  image.pixels.resize((size_t)image.width * image.height);
+  for (uint32_t &pixel : image.pixels) {
+    pixel = 0xff000000u | (uint32_t)rng.next();
+  }
+  return image;
+}
+
+bool regionHolds(TextureAtlas &atlas, const AtlasRegion &region,
+                 const Image &image) {
+  const Texture *page = atlas.getPage(region.page);
+  if (!page || region.rect.width != (int32_t)image.width ||
+      region.rect.height != (int32_t)image.height) {
+    return false;
+  }
+  const uint32_t *data = (const uint32_t *)page->data;
+  for (uint32_t row = 0; row < image.height; row++) {
+    if (std::memcmp(data + (size_t)(region.rect.y + row) * page->width +
+                        region.rect.x,
+                    image.pixels.data() + (size_t)row * image.width,
+                    image.width * sizeof(uint32_t)) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool overlaps(const OSRect &a, const OSRect &b) {
+  return a.x < b.x + b.width && b.x < a.x + a.width && a.y < b.y + b.height &&
+         b.y < a.y + a.height;
+}
+
+void testAtlasPacking() {
+  TextureAtlas atlas(512, 8);
+  Random rng(6);
+  std::vector<Image> images;
+  std::vector<uint32_t> ids;
+  for (int i = 0; i < 600; i++) {
+    images.push_back(randomImage(rng, 8, 48));
+    ids.push_back(atlas.addTexture(images.back().width, images.back().height,
+                                   images.back().pixels.data()));
+  }
+
+  bool all_added = true;
+  bool contents = true;
+  bool in_bounds = true;
+  bool disjoint = true;
+  std::vector<AtlasRegion> regions;
+  for (size_t i = 0; i < ids.size(); i++) {
+    const AtlasRegion *region = ids[i] ? atlas.lookup(ids[i]) : nullptr;
+    if (!region) {
+      all_added = false;
+      continue;
+    }
+    contents = contents && regionHolds(atlas, *region, images[i]);
+    in_bounds = in_bounds && region->rect.x >= 0 && region->rect.y >= 0 &&
+                region->rect.x + region->rect.width <= 512 &&
+                region->rect.y + region->rect.height <= 512;
+    for (const AtlasRegion &other : regions) {
+      if (other.page == region->page && overlaps(other.rect, region->rect)) {
+        disjoint = false;
+      }
+    }
+    regions.push_back(*region);
+  }
+  check(all_added, "atlas: 600 images fit in 8 pages without eviction");
+  check(contents, "atlas: every region holds its image");
+  check(in_bounds && disjoint, "atlas: regions lie inside their page and "
+                               "never overlap");
+  check(atlas.getOccupancy() > 0.5f, "atlas: occupancy above 50%");
+}
+
+void testAtlasIds() {
+  TextureAtlas atlas(128, 2);
+  Random rng(7);
+  Image image = randomImage(rng, 16, 16);
+  uint32_t first = atlas.addTexture(16, 16, image.pixels.data());
+  atlas.removeTexture(first);
+  uint32_t second = atlas.addTexture(16, 16, image.pixels.data());
+  check(first != 0 && second != 0 && first != second &&
+            atlas.lookup(first) == nullptr && atlas.lookup(second) != nullptr,
+        "atlas: a removed id goes stale when its slot is reused");
+  check(atlas.addTexture(128, 16, image.pixels.data()) == 0,
+        "atlas: images wider than a page are refused");
+
+  int loads = 0;
+  atlas.setLoader([&](const std::string &, uint32_t &width, uint32_t &height,
+                      std::vector<uint32_t> &pixels) {
+    loads++;
+    width = image.width;
+    height = image.height;
+    pixels = image.pixels;
+    return true;
+  });
+  uint32_t a = atlas.addTexture(std::string("icons/finder.png"));
+  uint32_t b = atlas.addTexture(std::string("icons/finder.png"));
+  check(a != 0 && a == b && loads == 1,
+        "atlas: adding a path twice loads it once");
+}
+
+void testAtlasEviction() {
+  // Each 63x63 image (64 with its gutter) fills a 64 px page.
+  TextureAtlas atlas(64, 2);
+  Random rng(8);
+  Image image = randomImage(rng, 63, 63);
+  uint32_t a = atlas.addTexture(63, 63, image.pixels.data());
+  uint32_t b = atlas.addTexture(63, 63, image.pixels.data());
+  atlas.lookup(a); // b's page is now the least recently used
+  uint32_t c = atlas.addTexture(63, 63, image.pixels.data());
+  check(a && b && c && atlas.lookup(a) && !atlas.lookup(b) && atlas.lookup(c),
+        "atlas: a full atlas evicts the least recently used page");
+  check(atlas.getPageCount() == 2, "atlas: eviction reuses pages");
+}
+
+void testAtlasBatch() {
+  TextureAtlas atlas(128, 4);
+  Random rng(9);
+  std::vector<AtlasDraw> draws;
+  for (int i = 0; i < 40; i++) {
+    Image image = randomImage(rng, 10, 30);
+    draws.push_back(
+        AtlasDraw{atlas.addTexture(image.width, image.height,
+                                   image.pixels.data()),
+                  (int32_t)(i % 8) * 40, (int32_t)(i / 8) * 40});
+  }
+  Surface one(400, 240);
+  Surface batched(400, 240);
+  for (const AtlasDraw &draw : draws) {
+    atlas.draw(&one.ctx, draw.texture_id, draw.x, draw.y);
+  }
+  atlas.drawBatch(&batched.ctx, draws);
+  check(atlas.getPageCount() > 1 && one.pixels == batched.pixels,
+        "atlas: drawBatch over several pages matches one draw per icon");
+}
+
+void benchAtlas() {
+  // Occupancy when the atlas first has to evict, for icon- and glyph-like
+  // size mixes.
+  struct Mix {
+    const char *name;
+    uint32_t lo, hi;
+  };
+  const Mix mixes[] = {{"glyphs 6-24 px", 6, 24},
+                       {"icons 16-64 px", 16, 64},
+                       {"mixed 6-128 px", 6, 128}};
+  std::printf("%-16s %6s %9s %10s %10s\n", "sizes", "pages", "occupancy",
+              "ns/add", "ns/lookup");
+  for (const Mix &mix : mixes) {
+    TextureAtlas atlas(1024, 4);
+    Random rng(10);
+    uint32_t added = 0;
+    uint64_t add_ns = 0;
+    for (;;) {
+      Image image = randomImage(rng, mix.lo, mix.hi);
+      uint32_t pages = atlas.getPageCount();
+      float occupancy = atlas.getOccupancy();
+      uint64_t start = nowNs();
+      uint32_t id =
+          atlas.addTexture(image.width, image.height, image.pixels.data());
+      add_ns += nowNs() - start;
+      // Without a new page, packed area only shrinks when a page is
+      // evicted; report the state just before that.
+      if (atlas.getPageCount() == pages && atlas.getOccupancy() < occupancy) {
+        const uint32_t rounds = 2000000;
+        uint64_t sum = 0;
+        start = nowNs();
+        for (uint32_t i = 0; i < rounds; i++) {
+          const AtlasRegion *region = atlas.lookup(id);
+          sum += region ? region->page : 0;
+        }
+        double lookup_ns = (double)(nowNs() - start) / rounds;
+        g_sink = sum;
+        std::printf("%-16s %6u %8.1f%% %10.0f %10.1f\n", mix.name, pages,
+                    occupancy * 100.0, (double)add_ns / (double)added,
+                    lookup_ns);
+        break;
+      }
+      added++;
+    }
+  }
+
+  // 800 non-overlapping 16-48 px icons over a 2560x1600 screen, drawn in
+  // scattered order.
+  const uint32_t icons = 800;
+  TextureAtlas atlas(256, 16);
+  std::vector<Texture *> textures;
+  std::vector<AtlasDraw> draws;
+  Random rng(11);
+  for (uint32_t i = 0; i < icons; i++) {
+    Image image = randomImage(rng, 16, 48);
+    Texture *texture = texture_create(image.width, image.height);
+    std::memcpy(texture->data, image.pixels.data(),
+                image.pixels.size() * sizeof(uint32_t));
+    textures.push_back(texture);
+    draws.push_back(AtlasDraw{
+        atlas.addTexture(image.width, image.height, image.pixels.data()),
+        (int32_t)(i % 40) * 64, (int32_t)(i / 40) * 80});
+  }
+  for (uint32_t i = icons - 1; i > 0; i--) {
+    uint32_t j = (uint32_t)(rng.next() % (i + 1));
+    std::swap(draws[i], draws[j]);
+    std::swap(textures[i], textures[j]);
+  }
+
+  uint32_t switches = 0;
+  uint32_t last_page = UINT32_MAX;
+  for (const AtlasDraw &draw : draws) {
+    uint32_t page = atlas.lookup(draw.texture_id)->page;
+    switches += page != last_page;
+    last_page = page;
+  }
+
+  Surface screen(2560, 1600);
+  const int frames = 200;
+  uint64_t start = nowNs();
+  for (int f = 0; f < frames; f++) {
+    for (uint32_t i = 0; i < icons; i++) {
+      draw_texture(&screen.ctx, textures[i], draws[i].x, draws[i].y);
+    }
+  }
+  double separate_us = (double)(nowNs() - start) / 1e3 / frames;
+  start = nowNs();
+  for (int f = 0; f < frames; f++) {
+    for (const AtlasDraw &draw : draws) {
+      atlas.draw(&screen.ctx, draw.texture_id, draw.x, draw.y);
+    }
+  }
+  double atlas_us = (double)(nowNs() - start) / 1e3 / frames;
+  start = nowNs();
+  for (int f = 0; f < frames; f++) {
+    atlas.drawBatch(&screen.ctx, draws);
+  }
+  double batch_us = (double)(nowNs() - start) / 1e3 / frames;
+
+  std::printf("\n%u icons, %u atlas pages\n", icons, atlas.getPageCount());
+  std::printf("%-22s %9s %14s\n", "", "us/frame", "texture binds");
+  std::printf("%-22s %9.1f %14u\n", "one texture per icon", separate_us,
+              icons);
+  std::printf("%-22s %9.1f %14u\n", "atlas, in order", atlas_us, switches);
+  std::printf("%-22s %9.1f %14u\n", "atlas, drawBatch", batch_us,
+              atlas.getPageCount());
+  for (Texture *texture : textures) {
+    texture_destroy(texture);
+  }
+}
+
+// ============================================================================
+// Thumbnails
+// ============================================================================
+
+// A scratch directory removed (with everything in it) when done.
+struct ScratchDir {
+  std::string path;
+
+  ScratchDir() {
+    char pattern[] = "/tmp/uitool.XXXXXX";
+    const char *made = mkdtemp(pattern);
+    path = made ? made : "";
+  }
+
+  ~ScratchDir() {
+    if (!path.empty()) {
+      removeTree(path);
+    }
+  }
+
+  static void removeTree(const std::string &dir) {
+    if (DIR *handle = opendir(dir.c_str())) {
+      while (struct dirent *entry = readdir(handle)) {
+        if (std::strcmp(entry->d_name, ".") != 0 &&
+            std::strcmp(entry->d_name, "..") != 0) {
+          std::string child = dir + "/" + entry->d_name;
+          if (unlink(child.c_str()) != 0) {
+            removeTree(child);
+          }
+        }
+      }
+      closedir(handle);
+    }
+    rmdir(dir.c_str());
+  }
+};
+
+uint64_t directoryBytes(const std::string &dir) {
+  uint64_t total = 0;
+  if (DIR *handle = opendir(dir.c_str())) {
+    while (struct dirent *entry = readdir(handle)) {
+      struct stat st;
+      std::string child = dir + "/" + entry->d_name;
+      if (entry->d_name[0] != '.' && ::stat(child.c_str(), &st) == 0) {
+        total += (uint64_t)st.st_size;
+      }
+    }
+    closedir(handle);
+  }
+  return total;
+}
+
+// Photo files hold "width height seed"; the decoder renders a gradient
+// with noise from that, standing in for ImageIO.
+std::string writePhoto(const std::string &dir, int n, uint32_t width,
+                       uint32_t height) {
+  std::string path = dir + "/photo" + std::to_string(n) + ".img";
+  FILE *file = std::fopen(path.c_str(), "w");
+  if (file) {
+    std::fprintf(file, "%u %u %d\n", width, height, n);
+    std::fclose(file);
+  }
+  return path;
+}
+
+std::atomic<int> g_decode_delay_ms(0);
+
+bool decodePhoto(const std::string &path, uint32_t, uint32_t &width,
+                 uint32_t &height, std::vector<uint32_t> &pixels) {
+  FILE *file = std::fopen(path.c_str(), "r");
+  int seed = 0;
+  bool ok = file && std::fscanf(file, "%u %u %d", &width, &height, &seed) == 3;
+  if (file) {
+    std::fclose(file);
+  }
+  if (!ok || width == 0 || height == 0) {
+    return false;
+  }
+  if (int delay = g_decode_delay_ms.load()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+  }
+  Random rng((uint64_t)seed * 0x9e3779b97f4a7c15ull);
+  pixels.resize((size_t)width * height);
+  for (uint32_t y = 0; y < height; y++) {
+    for (uint32_t x = 0; x < width; x++) {
+      uint32_t r = x * 255 / width;
+      uint32_t g = y * 255 / height;
+      uint32_t b = (uint32_t)(rng.next() >> 56);
+      pixels[(size_t)y * width + x] = 0xff000000u | r << 16 | g << 8 | b;
+    }
+  }
+  return true;
+}
+
+// Collects callbacks so a test can wait for a number of them.
+struct Completions {
+  std::mutex lock;
+  std::condition_variable done;
+  std::vector<std::pair<std::string, ThumbnailRef>> results;
+
+  ThumbnailService::Callback callback() {
+    return [this](const std::string &path, ThumbnailRef thumbnail) {
+      std::lock_guard<std::mutex> guard(lock);
+      results.emplace_back(path, std::move(thumbnail));
+      done.notify_all();
+    };
+  }
+
+  bool waitFor(size_t count) {
+    std::unique_lock<std::mutex> guard(lock);
+    return done.wait_for(guard, std::chrono::seconds(30),
+                         [&] { return results.size() >= count; });
+  }
+};
+
+uint32_t channel(uint32_t pixel, int shift) { return (pixel >> shift) & 0xFF; }
+
+void testThumbnailResample() {
+  uint32_t w, h;
+  ThumbnailService::fitSize(1200, 800, 300, w, h);
+  bool fits = w == 300 && h == 200;
+  ThumbnailService::fitSize(100, 50, 300, w, h);
+  fits = fits && w == 100 && h == 50;
+  ThumbnailService::fitSize(3000, 4, 300, w, h);
+  fits = fits && w == 300 && h == 1;
+  check(fits, "thumbnails: fitSize keeps the aspect and never upscales");
+
+  std::vector<uint32_t> solid((size_t)123 * 77, 0x80402010u);
+  std::vector<uint32_t> out((size_t)31 * 19, 0);
+  ThumbnailService::resample(solid.data(), 123, 77, 123, out.data(), 31, 19);
+  bool flat = true;
+  for (uint32_t pixel : out) {
+    flat = flat && pixel == 0x80402010u;
+  }
+  check(flat, "thumbnails: a flat image stays flat at a fractional ratio");
+
+  // 2x2 blocks of 0, 4, 8, 12 average to exactly 6 in every channel.
+  std::vector<uint32_t> blocks(16);
+  for (uint32_t y = 0; y < 4; y++) {
+    for (uint32_t x = 0; x < 4; x++) {
+      uint32_t v = ((y & 1) * 2 + (x & 1)) * 4 + (x / 2 + y / 2 * 2) * 16;
+      blocks[y * 4 + x] = v << 24 | v << 16 | v << 8 | v;
+    }
+  }
+  std::vector<uint32_t> half(4);
+  ThumbnailService::resample(blocks.data(), 4, 4, 4, half.data(), 2, 2);
+  bool exact = true;
+  for (uint32_t i = 0; i < 4; i++) {
+    uint32_t v = 6 + i * 16;
+    exact = exact && half[i] == (v << 24 | v << 16 | v << 8 | v);
+  }
+  check(exact, "thumbnails: an integer ratio averages exact boxes");
+
+  // Every source pixel is covered once, so the mean survives.
+  Random rng(17);
+  const uint32_t sw = 1001, sh = 703, dw = 300, dh = 211;
+  std::vector<uint32_t> noise((size_t)sw * sh);
+  double src_sum[4] = {0, 0, 0, 0};
+  for (uint32_t &pixel : noise) {
+    pixel = (uint32_t)rng.next();
+    for (int c = 0; c < 4; c++) {
+      src_sum[c] += channel(pixel, c * 8);
+    }
+  }
+  std::vector<uint32_t> small((size_t)dw * dh);
+  ThumbnailService::resample(noise.data(), sw, sh, sw, small.data(), dw, dh);
+  bool mean = true;
+  for (int c = 0; c < 4; c++) {
+    double dst_sum = 0;
+    for (uint32_t pixel : small) {
+      dst_sum += channel(pixel, c * 8);
+    }
+    mean = mean && std::fabs(dst_sum / small.size() -
+                             src_sum[c] / noise.size()) < 0.5;
+  }
+  check(mean, "thumbnails: downscaling preserves the mean of each channel");
+}
+
+void testThumbnailService() {
+  ScratchDir photos;
+  ScratchDir cache_root;
+  std::string cache = cache_root.path + "/cache";
+  const int count = 40;
+  std::vector<std::string> paths;
+  for (int i = 0; i < count; i++) {
+    paths.push_back(writePhoto(photos.path, i, 400 + i * 7, 300 + i * 3));
+  }
+
+  std::vector<ThumbnailRef> first(count);
+  {
+    ThumbnailService service(cache, 64, 2);
+    service.setDecoder(decodePhoto);
+    Completions done;
+    for (const std::string &path : paths) {
+      service.request(path, done.callback());
+    }
+    bool all = done.waitFor(count);
+    bool sized = all;
+    for (auto &result : done.results) {
+      const ThumbnailRef &thumb = result.second;
+      sized = sized && thumb && thumb->width <= 64 && thumb->height <= 64 &&
+              std::max(thumb->width, thumb->height) == 64;
+      int n = std::atoi(result.first.c_str() + photos.path.size() + 6);
+      first[n] = thumb;
+    }
+    ThumbnailStats stats = service.getStats();
+    check(sized && stats.decoded == (uint64_t)count && stats.failed == 0,
+          "thumbnails: every request is decoded and fitted once");
+    check(service.lookup(paths[0]) == first[0],
+          "thumbnails: results land in the memory cache");
+  }
+
+  {
+    ThumbnailService service(cache, 64, 2);
+    service.setDecoder(decodePhoto);
+    Completions done;
+    for (const std::string &path : paths) {
+      service.request(path, done.callback());
+    }
+    bool all = done.waitFor(count);
+    bool same = all;
+    for (auto &result : done.results) {
+      int n = std::atoi(result.first.c_str() + photos.path.size() + 6);
+      same = same && result.second && first[n] &&
+             result.second->pixels == first[n]->pixels;
+    }
+    ThumbnailStats stats = service.getStats();
+    check(same && stats.decoded == 0 && stats.disk_hits == (uint64_t)count,
+          "thumbnails: a new service is served from the disk cache");
+
+    writePhoto(photos.path, 3, 1999, 333); // edited: size and mtime change
+    Completions again;
+    service.request(paths[3], again.callback());
+    service.request(paths[4], again.callback());
+    bool redone = again.waitFor(2);
+    stats = service.getStats();
+    check(redone && stats.decoded == 1 && stats.memory_hits == 1 &&
+              service.lookup(paths[3])->width == 64,
+          "thumbnails: an edited file misses both caches");
+  }
+
+  {
+    g_decode_delay_ms = 30;
+    ThumbnailService service("", 64, 2);
+    service.setDecoder(decodePhoto);
+    Completions done;
+    for (int i = 0; i < 5; i++) {
+      service.request(paths[7], done.callback());
+    }
+    bool all = done.waitFor(5);
+    check(all && service.getStats().decoded == 1,
+          "thumbnails: concurrent requests for one path share one decode");
+
+    Completions cancelled;
+    for (int i = 10; i < 30; i++) {
+      service.request(paths[i], cancelled.callback());
+    }
+    service.cancelAll();
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    std::lock_guard<std::mutex> guard(cancelled.lock);
+    check(cancelled.results.size() <= 2,
+          "thumbnails: cancelled requests get no callback");
+    g_decode_delay_ms = 0;
+  }
+
+  {
+    // Room for three 64x64 thumbnails in memory, about six on disk.
+    size_t thumb_bytes = 64 * 64 * sizeof(uint32_t);
+    ScratchDir small_cache;
+    ThumbnailService service(small_cache.path, 64, 1, thumb_bytes * 3,
+                             thumb_bytes * 6);
+    service.setDecoder(decodePhoto);
+    Completions done;
+    for (int i = 0; i < 20; i++) {
+      service.request(paths[i], done.callback());
+    }
+    bool all = done.waitFor(20);
+    check(all && !service.lookup(paths[0]) && service.lookup(paths[19]),
+          "thumbnails: the memory LRU stays within its budget");
+    check(directoryBytes(small_cache.path) <= thumb_bytes * 6 + 4096,
+          "thumbnails: the disk cache is trimmed to its budget");
+  }
+}
+
+// Throughput in three states: nothing cached, disk cache only (a fresh
+// process), and memory hits.
+void benchThumbnails(uint32_t workers) {
+  const int count = 200;
+  const uint32_t tile = 300;
+  ScratchDir photos;
+  ScratchDir cache_root;
+  std::string cache = cache_root.path + "/cache";
+  std::vector<std::string> paths;
+  for (int i = 0; i < count; i++) {
+    paths.push_back(writePhoto(photos.path, i, 1200, 800));
+  }
+
+  auto run = [&](ThumbnailService &service, const char *name) {
+    Completions done;
+    uint64_t start = nowNs();
+    for (const std::string &path : paths) {
+      service.request(path, done.callback());
+    }
+    done.waitFor(count);
+    double seconds = (double)(nowNs() - start) / 1e9;
+    std::printf("%-30s %12.0f\n", name, count / seconds);
+  };
+
+  std::printf("%d photos of 1200x800 to %u px, %u workers\n", count, tile,
+              workers);
+  std::printf("%-30s %12s\n", "", "thumbs/s");
+  {
+    ThumbnailService service(cache, tile, workers);
+    service.setDecoder(decodePhoto);
+    run(service, "cold (decode+resample+write)");
+    run(service, "memory cache");
+    ThumbnailStats stats = service.getStats();
+    std::printf("%-30s %9.2f ms %9.2f ms\n", "decode / resample per photo",
+                (double)stats.decode_ns / 1e6 / count,
+                (double)stats.resample_ns / 1e6 / count);
+  }
+  {
+    ThumbnailService service(cache, tile, workers);
+    service.setDecoder(decodePhoto);
+    run(service, "disk cache (fresh service)");
+  }
+
+  const struct {
+    uint32_t w, h;
+  } sizes[] = {{4000, 3000}, {1200, 800}, {600, 450}};
+  Random rng(1);
+  for (const auto &size : sizes) {
+    std::vector<uint32_t> src((size_t)size.w * size.h);
+    for (uint32_t &pixel : src) {
+      pixel = (uint32_t)rng.next();
+    }
+    uint32_t dw, dh;
+    ThumbnailService::fitSize(size.w, size.h, tile, dw, dh);
+    std::vector<uint32_t> dst((size_t)dw * dh);
+    const int rounds = 5;
+    uint64_t start = nowNs();
+    for (int r = 0; r < rounds; r++) {
+      ThumbnailService::resample(src.data(), size.w, size.h, size.w,
+                                 dst.data(), dw, dh);
+    }
+    std::printf("resample %4ux%-4u -> %ux%-4u %9.2f ms\n", size.w, size.h, dw,
+                dh, (double)(nowNs() - start) / 1e6 / rounds);
+  }
+}
+
+// ============================================================================
+// Grid layout
+// ============================================================================
+
+// Photos-like grid: 150 pt tiles, 8 pt gaps, 20 pt inset.
+GridLayout photoGrid(uint64_t items, double viewport_width) {
+  GridLayout layout;
+  layout.setItemSize(150, 150);
+  layout.setSpacing(8);
+  layout.setInset(20);
+  layout.setViewportWidth(viewport_width);
+  layout.setItemCount(items);
+  return layout;
+}
+
+void testGridLayout() {
+  GridLayout layout = photoGrid(1000, 720);
+  check(layout.getColumns() == 4 && layout.getRows() == 250 &&
+            layout.getContentHeight() == 40 + 250 * 158.0 - 8,
+        "grid: columns, rows and content height");
+  GridLayout narrow = photoGrid(3, 10);
+  GridLayout empty = photoGrid(0, 720);
+  check(narrow.getColumns() == 1 && empty.getRows() == 0 &&
+            empty.getContentHeight() == 40 && empty.range(0, 1000).empty(),
+        "grid: at least one column; empty grids have no range");
+
+  // range() and itemAt() against a brute-force scan of frame().
+  Random rng(3);
+  bool ranges = true;
+  bool hits = true;
+  for (int t = 0; t < 5000; t++) {
+    double top = (double)rng.range(0, 400000) / 10 - 100;
+    double height = (double)rng.range(0, 8000) / 10;
+    GridRange range = layout.range(top, top + height);
+    uint64_t first = GridLayout::kNone;
+    uint64_t end = 0;
+    for (uint64_t i = 0; height > 0 && i < layout.getItemCount(); i++) {
+      GridRect frame = layout.frame(i);
+      if (frame.y < top + height && frame.y + frame.height > top) {
+        first = first == GridLayout::kNone ? i : first;
+        end = i + 1;
+      }
+    }
+    ranges = ranges && (first == GridLayout::kNone
+                            ? range.empty()
+                            : range.first == first && range.end == end);
+
+    double x = (double)rng.range(0, 8000) / 10;
+    double y = (double)rng.range(0, 400000) / 10;
+    uint64_t want = GridLayout::kNone;
+    for (uint64_t i = 0; i < layout.getItemCount(); i++) {
+      GridRect frame = layout.frame(i);
+      if (x >= frame.x && x < frame.x + frame.width && y >= frame.y &&
+          y < frame.y + frame.height) {
+        want = i;
+        break;
+      }
+    }
+    hits = hits && layout.itemAt(x, y) == want;
+  }
+  check(ranges, "grid: range() matches a scan of every frame");
+  check(hits, "grid: itemAt() matches a scan, gaps included");
+
+  GridLayout huge = photoGrid(1000000, 720);
+  GridRect last = huge.frame(999999);
+  GridRange tail = huge.range(huge.getContentHeight() - 100,
+                              huge.getContentHeight() + 500);
+  check(last.y == 20 + 249999 * 158.0 && tail.end == 1000000 &&
+            tail.first == 999996 &&
+            huge.itemAt(last.x + 1, last.y + 1) == 999999,
+        "grid: exact at 1M items");
+}
+
+void testGridRecycler() {
+  GridLayout layout = photoGrid(5000, 720);
+  GridRecycler recycler(1);
+  GridUpdate update;
+  std::map<uint32_t, uint64_t> view; // what a view would show per slot
+  Random rng(5);
+  double top = 0;
+  const double height = 600;
+  bool paired = true;  // unbinds name what the slot held; binds are free
+  bool ordered = true; // bound is ascending
+  bool window = true;  // the bound range is the visible range + overscan
+  bool prefetch = true;
+  uint32_t max_slots = 0;
+
+  auto unbind = [&](const std::vector<GridCell> &cells) {
+    for (const GridCell &cell : cells) {
+      auto it = view.find(cell.slot);
+      paired = paired && it != view.end() && it->second == cell.item;
+      if (it != view.end()) {
+        view.erase(it);
+      }
+    }
+  };
+
+  for (int step = 0; step < 20000; step++) {
+    if (rng.range(0, 9) == 0) {
+      top = (double)rng.range(0, (uint32_t)layout.getContentHeight());
+    } else {
+      top = std::max(0.0, top + (double)rng.range(0, 400) - 200);
+    }
+    if (rng.range(0, 499) == 0) {
+      layout.setViewportWidth(rng.range(400, 1200));
+      recycler.reset(update);
+      unbind(update.unbound);
+    }
+    recycler.update(layout, top, height, update);
+    unbind(update.unbound);
+    for (size_t i = 0; i < update.bound.size(); i++) {
+      const GridCell &cell = update.bound[i];
+      paired = paired && view.count(cell.slot) == 0;
+      ordered = ordered && (i == 0 || cell.item > update.bound[i - 1].item);
+      view[cell.slot] = cell.item;
+    }
+
+    GridRange bound = recycler.getBound();
+    double pitch = layout.getRowPitch();
+    GridRange want = layout.range(top - pitch, top + height + pitch);
+    window = window && bound.first == want.first && bound.end == want.end &&
+             view.size() == bound.size();
+    for (const auto &entry : view) {
+      window = window && recycler.slotFor(entry.second) == entry.first;
+    }
+    if (!update.visible.empty()) {
+      window = window && update.visible.first >= bound.first &&
+               update.visible.end <= bound.end;
+    }
+    if (!update.prefetch.empty()) {
+      prefetch = prefetch && (update.prefetch.first >= bound.end ||
+                              update.prefetch.end <= bound.first);
+    }
+    max_slots = std::max(max_slots, recycler.getSlotCount());
+  }
+  check(paired, "grid recycler: every unbind names the slot's item and every "
+                "bind takes a free slot");
+  check(ordered, "grid recycler: bound cells come in ascending order");
+  check(window, "grid recycler: bound cells are exactly the visible rows "
+                "plus overscan");
+  check(prefetch, "grid recycler: prefetch lies outside the bound cells");
+  // 600 pt visible + one row either side spans at most 7 rows; the widest
+  // viewport has 7 columns.
+  check(max_slots <= 7 * 7, "grid recycler: the cell pool stays at about "
+                            "one screen");
+}
+
+void benchGrid() {
+  const uint64_t items = 1000000;
+  GridLayout layout = photoGrid(items, 1280);
+  GridRecycler recycler(1);
+  GridUpdate update;
+  double content = layout.getContentHeight();
+  const double height = 800;
+  std::printf("%llu items, %u columns, %.0f pt of content, %.0f pt "
+              "viewport\n",
+              (unsigned long long)items, layout.getColumns(), content,
+              height);
+  std::printf("%-24s %10s %12s %8s\n", "", "ns/step", "binds/step", "slots");
+
+  struct Pattern {
+    const char *name;
+    double step; // 0: random jumps
+    int steps;
+  } patterns[] = {
+      {"smooth scroll (13 pt)", 13, 2000000},
+      {"page down (800 pt)", 800, 500000},
+      {"random jump", 0, 200000},
+  };
+  Random rng(7);
+  for (const Pattern &pattern : patterns) {
+    double top = 0;
+    uint64_t binds = 0;
+    uint64_t start = nowNs();
+    for (int i = 0; i < pattern.steps; i++) {
+      if (pattern.step > 0) {
+        top += pattern.step;
+        top = top > content - height ? 0 : top;
+      } else {
+        top = (double)(rng.next() % (uint64_t)(content - height));
+      }
+      recycler.update(layout, top, height, update);
+      binds += update.bound.size();
+    }
+    double ns = (double)(nowNs() - start) / pattern.steps;
+    std::printf("%-24s %10.1f %12.2f %8u\n", pattern.name, ns,
+                (double)binds / pattern.steps, recycler.getSlotCount());
+  }
+
+  const int queries = 2000000;
+  uint64_t start = nowNs();
+  uint64_t sum = 0;
+  for (int i = 0; i < queries; i++) {
+    double top = (double)(rng.next() % (uint64_t)content);
+    GridRange range = layout.range(top, top + height);
+    sum += range.first + layout.itemAt(100, top);
+  }
+  g_sink = sum;
+  std::printf("%-24s %10.1f\n", "range + itemAt",
+              (double)(nowNs() - start) / queries);
+}
+
+// ============================================================================
+// Layer cache
+// ============================================================================
+
+uint32_t packArgb(uint8_t a, double r, double g, double b) {
+  return ((uint32_t)a << 24) | ((uint32_t)(r * 255 + 0.5) << 16) |
+         ((uint32_t)(g * 255 + 0.5) << 8) | (uint32_t)(b * 255 + 0.5);
+}
+
+// DesktopView's wallpaper with the C primitives: a six-stop gradient at
+// 135 degrees, evaluated per pixel, then three translucent sine waves
+// sampled every 4 px.
+void paintWallpaper(RenderTarget &target) {
+  static const double stops[6][3] = {{0.05, 0.10, 0.20}, {0.15, 0.22, 0.38},
+                                     {0.35, 0.30, 0.50}, {0.60, 0.40, 0.50},
+                                     {0.85, 0.55, 0.45}, {0.95, 0.75, 0.55}};
+  uint32_t width = target.getWidth();
+  uint32_t height = target.getHeight();
+  uint32_t *pixels = target.getPixels();
+  double span = (double)width + height;
+  for (uint32_t y = 0; y < height; y++) {
+    for (uint32_t x = 0; x < width; x++) {
+      double t = (x + (double)y) / span * 5;
+      int stop = std::min((int)t, 4);
+      double f = t - stop;
+      const double *a = stops[stop], *b = stops[stop + 1];
+      pixels[(size_t)y * width + x] =
+          packArgb(255, a[0] + (b[0] - a[0]) * f, a[1] + (b[1] - a[1]) * f,
+                   a[2] + (b[2] - a[2]) * f);
+    }
+  }
+  float scale = target.getScale();
+  int32_t step = std::max(1, (int32_t)(4 * scale));
+  for (int wave = 0; wave < 3; wave++) {
+    double base = height * (0.75 - wave * 0.12);
+    double amplitude = (40 + wave * 20) * scale;
+    double frequency = (0.008 + wave * 0.003) / scale;
+    Color color = {(uint8_t)(255 * (0.15 - wave * 0.03)),
+                   (uint8_t)(255 * (0.1 + wave * 0.05)),
+                   (uint8_t)(255 * (0.15 + wave * 0.05)),
+                   (uint8_t)(255 * (0.25 + wave * 0.05))};
+    for (int32_t x = 0; x < (int32_t)width; x += step) {
+      int32_t top = (int32_t)(base + amplitude * std::sin(x * frequency));
+      draw_rect(target.getContext(),
+                OSRect{x, top, step, (int32_t)height - top}, color);
+    }
+  }
+}
+
+// DockView's chrome: a frosted rounded panel with a highlight and border.
+void paintDockChrome(RenderTarget &target) {
+  GraphicsContext *ctx = target.getContext();
+  int32_t width = (int32_t)target.getWidth();
+  int32_t height = (int32_t)target.getHeight();
+  OSRect panel = {0, 0, width, height};
+  draw_rounded_rect(ctx, panel, 18, Color{170, 40, 40, 48});
+  apply_gradient(ctx, OSRect{2, 2, width - 4, height / 2},
+                 Color{60, 255, 255, 255}, Color{0, 255, 255, 255}, false);
+  draw_rect_outline(ctx, panel, 1, Color{90, 255, 255, 255});
+  apply_blur(ctx, OSRect{0, 0, width, height}, 6);
+}
+
+struct Icon {
+  std::vector<uint32_t> pixels;
+  Texture texture;
+};
+
+std::vector<Icon> dockIcons(uint32_t count, uint32_t size) {
+  Random rng(17);
+  std::vector<Icon> icons(count);
+  for (Icon &icon : icons) {
+    icon.pixels.assign((size_t)size * size, 0);
+    uint32_t argb = 0xff000000u | (uint32_t)rng.next();
+    for (uint32_t y = 4; y < size - 4; y++) {
+      for (uint32_t x = 4; x < size - 4; x++) {
+        icon.pixels[(size_t)y * size + x] = argb;
+      }
+    }
+    icon.texture = Texture{0, size, size, icon.pixels.data()};
+  }
+  return icons;
+}
+
+void testLayerCache() {
+  LayerCache cache;
+  int paints = 0;
+  bool cleared = true;
+  auto paint = [&](RenderTarget &target) {
+    paints++;
+    cleared = cleared && target.getPixels()[0] == 0;
+    target.clear(Color{255, 10, 20, 30});
+  };
+  RenderTarget *first = &cache.get(64, 32, 2.0f, paint);
+  uint64_t generation = cache.getGeneration();
+  RenderTarget *again = &cache.get(64, 32, 2.0f, paint);
+  check(paints == 1 && first == again && cache.getStats().hits == 1 &&
+            cache.getGeneration() == generation,
+        "layer cache: a second get with the same key is a hit");
+
+  RenderTarget &resized = cache.get(80, 32, 2.0f, paint);
+  check(paints == 2 && resized.getWidth() == 80 &&
+            cache.getGeneration() == generation + 1,
+        "layer cache: a resize repaints at the new size");
+  RenderTarget &rescaled = cache.get(80, 32, 1.0f, paint);
+  check(paints == 3 && rescaled.getScale() == 1.0f,
+        "layer cache: a new backing scale repaints");
+
+  cache.invalidate();
+  cache.get(80, 32, 1.0f, paint);
+  check(paints == 4 && cleared,
+        "layer cache: invalidate repaints onto a cleared target");
+  cache.release();
+  cache.get(80, 32, 1.0f, paint);
+  check(paints == 5 && cache.getStats().repaints == 5,
+        "layer cache: release drops the layer and the next get repaints");
+
+  // A frame built from the cached layer matches one painted from scratch
+  const uint32_t width = 640, height = 400;
+  std::vector<Icon> icons = dockIcons(4, 48);
+  LayerCache wallpaper;
+  Surface cached(width, height), direct(width, height);
+  bool same = true;
+  for (int frame = 0; frame < 3; frame++) {
+    RenderTarget &layer = wallpaper.get(width, height, 1.0f, paintWallpaper);
+    draw_texture(&cached.ctx, layer.getTexture(), 0, 0);
+    RenderTarget scratch(width, height, 1.0f);
+    paintWallpaper(scratch);
+    draw_texture(&direct.ctx, scratch.getTexture(), 0, 0);
+    for (size_t i = 0; i < icons.size(); i++) {
+      int32_t x = 100 + (int32_t)i * 60 + frame * 7;
+      draw_texture(&cached.ctx, &icons[i].texture, x, 300);
+      draw_texture(&direct.ctx, &icons[i].texture, x, 300);
+    }
+    same = same && cached.pixels == direct.pixels;
+  }
+  check(same && wallpaper.getStats().repaints == 1,
+        "layer cache: cached layer plus overlays matches a full repaint");
+}
+
+void benchLayers() {
+  const uint32_t width = 2560, height = 1600;
+  Surface screen(width, height);
+  std::printf("%ux%u screen, ms/frame\n", width, height);
+  std::printf("%-36s %10s %10s\n", "", "repaint", "cached");
+
+  // Desktop: every invalidation used to repaint the wallpaper
+  LayerCache wallpaper;
+  double desktop[2];
+  for (int cached = 0; cached < 2; cached++) {
+    const int frames = cached ? 100 : 10;
+    uint64_t start = nowNs();
+    for (int f = 0; f < frames; f++) {
+      if (!cached) {
+        wallpaper.invalidate();
+      }
+      RenderTarget &layer = wallpaper.get(width, height, 1.0f, paintWallpaper);
+      draw_texture(&screen.ctx, layer.getTexture(), 0, 0);
+    }
+    desktop[cached] = (double)(nowNs() - start) / 1e6 / frames;
+  }
+  std::printf("%-36s %10.3f %10.3f\n", "desktop wallpaper", desktop[0],
+              desktop[1]);
+
+  // Dock hover: the dock rect is damaged, the chrome is repainted or
+  // blitted, then 12 icons (3 magnified) go on top
+  const uint32_t dock_width = 12 * 56 + 24, dock_height = 96;
+  const int32_t dock_x = (int32_t)(width - dock_width) / 2;
+  const int32_t dock_y = (int32_t)(height - dock_height - 4);
+  std::vector<Icon> resting = dockIcons(12, 52);
+  std::vector<Icon> magnified = dockIcons(3, 76);
+  RenderTarget &backdrop = wallpaper.get(width, height, 1.0f, paintWallpaper);
+  LayerCache chrome;
+  double dock[2];
+  for (int cached = 0; cached < 2; cached++) {
+    const int frames = cached ? 2000 : 200;
+    uint64_t start = nowNs();
+    for (int f = 0; f < frames; f++) {
+      if (!cached) {
+        chrome.invalidate();
+      }
+      int hovered = f % 12;
+      OSRect damage = {dock_x, dock_y - 40, (int32_t)dock_width,
+                       (int32_t)dock_height + 40};
+      graphics_set_clip(&screen.ctx, damage);
+      draw_texture_region(&screen.ctx, backdrop.getTexture(), damage,
+                          damage.x, damage.y);
+      RenderTarget &layer =
+          chrome.get(dock_width, dock_height, 1.0f, paintDockChrome);
+      draw_texture(&screen.ctx, layer.getTexture(), dock_x, dock_y);
+      for (int i = 0; i < 12; i++) {
+        int distance = std::abs(i - hovered);
+        bool big = distance <= 1;
+        Texture *icon = big ? &magnified[(size_t)(distance + (i > hovered))]
+                                   .texture
+                            : &resting[(size_t)i].texture;
+        draw_texture(&screen.ctx, icon, dock_x + 12 + i * 56 - (big ? 12 : 0),
+                     dock_y + 22 - (big ? 30 : 0));
+      }
+      graphics_reset_clip(&screen.ctx);
+    }
+    dock[cached] = (double)(nowNs() - start) / 1e6 / frames;
+  }
+  std::printf("%-36s %10.3f %10.3f\n", "dock hover (damaged rect only)",
+              dock[0], dock[1]);
+
+  uint64_t start = nowNs();
+  const int blits = 100;
+  for (int i = 0; i < blits; i++) {
+    draw_texture(&screen.ctx, backdrop.getTexture(), 0, 0);
+  }
+  std::printf("%-36s %10s %10.3f\n", "full-screen blit alone", "",
+              (double)(nowNs() - start) / 1e6 / blits);
+}
+
+// ============================================================================
+// Event manager
+// ============================================================================
+
+struct Recorded {
+  EventType type;
+  uint32_t target;
+  double x;
+};
+
+void testEventDispatch() {
+  EventManager events(64);
+  uint32_t a = events.registerTarget();
+  uint32_t b = events.registerTarget();
+  std::vector<Recorded> seen_a, seen_any, seen_b;
+  auto record = [](std::vector<Recorded> &into) {
+    return [&into](const Event &event) {
+      into.push_back({event.type, event.target, event.x});
+    };
+  };
+  events.addListener(EventType::KeyDown, a, record(seen_a));
+  events.addListener(EventType::KeyDown, EventManager::kAnyTarget,
+                     record(seen_any));
+  events.addListener(EventType::KeyDown, b, record(seen_b));
+  for (int i = 0; i < 10; i++) {
+    events.post(EventType::KeyDown, a, i);
+  }
+  bool ordered = seen_a.empty();
+  events.processEvents();
+  ordered = ordered && seen_a.size() == 10 && seen_any.size() == 10;
+  for (size_t i = 0; ordered && i < seen_a.size(); i++) {
+    ordered = seen_a[i].x == (double)i && seen_any[i].x == (double)i;
+  }
+  check(ordered, "events: dispatched on processEvents, in posting order");
+  check(seen_b.empty(), "events: listeners only see their own target");
+
+  // Moves collapse to the latest per target, but not across a click; two
+  // resizes collapse regardless
+  std::vector<Recorded> trace;
+  auto log = [&trace](const Event &event) {
+    trace.push_back({event.type, event.target, event.x});
+  };
+  events.addListener(EventType::MouseMove, EventManager::kAnyTarget, log);
+  events.addListener(EventType::MouseDown, EventManager::kAnyTarget, log);
+  events.addListener(EventType::Resize, EventManager::kAnyTarget, log);
+  EventStats before = events.getStats();
+  events.post(EventType::MouseMove, a, 1);
+  events.post(EventType::MouseMove, a, 2);
+  events.post(EventType::MouseMove, b, 10);
+  events.post(EventType::Resize, a, 100);
+  events.post(EventType::MouseMove, a, 3);
+  events.post(EventType::MouseDown, a, 3);
+  events.post(EventType::MouseMove, a, 4);
+  events.post(EventType::Resize, a, 200);
+  events.post(EventType::MouseMove, a, 5);
+  events.processEvents();
+  std::vector<Recorded> want = {{EventType::MouseMove, b, 10},
+                                {EventType::MouseMove, a, 3},
+                                {EventType::MouseDown, a, 3},
+                                {EventType::Resize, a, 200},
+                                {EventType::MouseMove, a, 5}};
+  bool same = trace.size() == want.size();
+  for (size_t i = 0; same && i < want.size(); i++) {
+    same = trace[i].type == want[i].type && trace[i].target == want[i].target &&
+           trace[i].x == want[i].x;
+  }
+  check(same, "events: moves and resizes coalesce to the latest per target, "
+              "and a click keeps the move before it");
+  check(events.getStats().coalesced - before.coalesced == 4,
+        "events: coalesced events are counted");
+
+  // A listener removing itself mid-batch misses the rest of the batch; one
+  // added mid-batch starts with the next frame
+  int removed_calls = 0, added_calls = 0;
+  uint32_t self = 0;
+  self = events.addListener(EventType::KeyUp, a, [&](const Event &) {
+    removed_calls++;
+    events.removeListener(self);
+    events.addListener(EventType::KeyUp, a,
+                       [&](const Event &) { added_calls++; });
+  });
+  events.post(EventType::KeyUp, a);
+  events.post(EventType::KeyUp, a);
+  events.processEvents();
+  bool first_frame = removed_calls == 1 && added_calls == 0;
+  events.post(EventType::KeyUp, a);
+  events.processEvents();
+  check(first_frame && removed_calls == 1 && added_calls == 1,
+        "events: listeners added or removed while dispatching take effect "
+        "safely");
+
+  int completed = 0;
+  events.postCompletion([&] { completed++; });
+  bool deferred = completed == 0;
+  events.processEvents();
+  check(deferred && completed == 1,
+        "events: completions run on the dispatch thread, once");
+}
+
+void testEventRing() {
+  EventManager events(8);
+  int accepted = 0;
+  for (int i = 0; i < 12; i++) {
+    accepted += events.post(EventType::KeyDown, 1, i) ? 1 : 0;
+  }
+  int delivered = 0;
+  events.addListener(EventType::KeyDown, EventManager::kAnyTarget,
+                     [&](const Event &) { delivered++; });
+  events.processEvents();
+  check(accepted == 8 && events.getStats().dropped == 4 && delivered == 8,
+        "events: a full ring refuses and counts posts");
+  check(events.post(EventType::KeyDown, 1),
+        "events: the ring accepts posts again once drained");
+  events.processEvents();
+
+  // One wake per idle-to-busy transition
+  std::atomic<int> wakes(0);
+  events.setWakeHandler([&] { wakes++; });
+  events.post(EventType::KeyDown, 1);
+  events.post(EventType::KeyDown, 1);
+  events.post(EventType::KeyDown, 1);
+  int first = wakes.load();
+  events.processEvents();
+  events.post(EventType::KeyDown, 1);
+  check(first == 1 && wakes.load() == 2,
+        "events: the wake handler runs once per idle-to-busy transition");
+  events.processEvents();
+
+  // Producers post as fast as they can into a small ring while this
+  // thread drains it; every accepted event arrives once and in order
+  const int producers = 4;
+  const int per_producer = 200000;
+  EventManager shared(1024);
+  std::vector<int> next(producers, 0);
+  bool in_order = true;
+  shared.addListener(EventType::KeyDown, EventManager::kAnyTarget,
+                     [&](const Event &event) {
+                       in_order = in_order && (int)event.x == next[event.code];
+                       next[event.code]++;
+                     });
+  std::atomic<uint64_t> refused(0);
+  std::atomic<int> finished(0);
+  std::atomic<bool> swapping(true);
+  std::atomic<uint64_t> handler_calls(0);
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; p++) {
+    threads.emplace_back([&, p] {
+      for (int i = 0; i < per_producer; i++) {
+        while (!shared.post(EventType::KeyDown, 1, i, 0, (uint32_t)p)) {
+          refused++;
+          std::this_thread::yield();
+        }
+      }
+      finished++;
+    });
+  }
+  // Swapping the wake handler while producers post must be safe
+  std::thread swapper([&] {
+    while (swapping.load()) {
+      shared.setWakeHandler([&] { handler_calls++; });
+      shared.setWakeHandler(nullptr);
+    }
+  });
+  while (finished.load() < producers || shared.hasPendingEvents()) {
+    shared.processEvents();
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  swapping = false;
+  swapper.join();
+  bool complete = in_order;
+  for (int p = 0; p < producers; p++) {
+    complete = complete && next[p] == per_producer;
+  }
+  check(complete, "events: 4 producers into a 1024-slot ring, every event "
+                  "delivered once and in per-producer order");
+  check(shared.getStats().dropped == refused.load(),
+        "events: drops match the posts producers saw refused");
+}
+
+// Spins frames until done() or the timeout, 1 ms apart.
+void runFrames(EventManager &events, uint32_t timeout_ms,
+               const std::function<bool()> &done) {
+  uint64_t deadline = nowNs() + (uint64_t)timeout_ms * 1000000;
+  while (!done() && nowNs() < deadline) {
+    events.processEvents();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+void testEventTimers() {
+  EventManager events(64);
+  check(events.getTimeUntilNextTimer() == -1,
+        "timers: no timers, no wakeup");
+
+  uint64_t start = nowNs();
+  uint64_t fired_at = 0;
+  int fired = 0;
+  events.addTimer(20, 0, [&] {
+    fired++;
+    fired_at = nowNs();
+  });
+  int64_t wait = events.getTimeUntilNextTimer();
+  check(wait > 0 && wait <= 21000000,
+        "timers: the next wakeup is no later than the next timer");
+  runFrames(events, 1000, [&] { return fired > 0; });
+  runFrames(events, 40, [] { return false; });
+  check(fired == 1 && fired_at - start >= 20000000,
+        "timers: a one-shot fires once, not early");
+
+  int ticks = 0;
+  EventManager::TimerId periodic = events.addTimer(5, 5, [&] { ticks++; });
+  runFrames(events, 1000, [&] { return ticks >= 5; });
+  check(events.cancelTimer(periodic), "timers: a periodic timer cancels");
+  int at_cancel = ticks;
+  runFrames(events, 30, [] { return false; });
+  check(at_cancel >= 5 && ticks == at_cancel,
+        "timers: a periodic timer repeats until cancelled");
+
+  int never = 0;
+  EventManager::TimerId cancelled = events.addTimer(5, 0, [&] { never++; });
+  check(events.cancelTimer(cancelled) && !events.cancelTimer(cancelled),
+        "timers: cancelling twice fails the second time");
+  EventManager::TimerId reused = events.addTimer(5, 0, [] {});
+  check(!events.cancelTimer(cancelled) && events.cancelTimer(reused),
+        "timers: a stale id does not cancel the timer reusing its slot");
+  runFrames(events, 20, [] { return false; });
+  check(never == 0, "timers: a cancelled timer never fires");
+
+  // Two timers on one tick that cancel each other: only one runs
+  int pair_fired = 0;
+  EventManager::TimerId first = 0, second = 0;
+  first = events.addTimer(5, 0, [&] {
+    pair_fired++;
+    events.cancelTimer(second);
+  });
+  second = events.addTimer(5, 0, [&] {
+    pair_fired++;
+    events.cancelTimer(first);
+  });
+  runFrames(events, 30, [] { return false; });
+  check(pair_fired == 1, "timers: a callback can cancel a timer due on the "
+                         "same tick");
+
+  // Spread over the first two wheel levels, so some cascade
+  Random rng(11);
+  const int count = 2000;
+  std::vector<uint64_t> added(count), due(count), when(count, 0);
+  int done = 0;
+  for (int i = 0; i < count; i++) {
+    due[i] = rng.range(0, 300);
+    added[i] = nowNs();
+    events.addTimer((uint32_t)due[i], 0, [&, i] {
+      when[i] = nowNs();
+      done++;
+    });
+  }
+  runFrames(events, 3000, [&] { return done == count; });
+  bool on_time = done == count;
+  for (int i = 0; on_time && i < count; i++) {
+    on_time = when[i] - added[i] >= due[i] * 1000000;
+  }
+  check(on_time, "timers: 2000 timers up to 300 ms all fire, none early");
+  check(events.getTimeUntilNextTimer() == -1,
+        "timers: fired one-shots leave the wheel empty");
+}
+
+void benchEvents(uint32_t producers) {
+  std::printf("%-32s %12s %12s\n", "", "ns/event", "Mevents/s");
+
+  // Single thread: post a ring's worth, then drain it
+  {
+    EventManager events(4096);
+    uint64_t sum = 0;
+    events.addListener(EventType::KeyDown, EventManager::kAnyTarget,
+                       [&](const Event &event) { sum += event.code; });
+    const int rounds = 2000;
+    uint64_t post_ns = 0, drain_ns = 0;
+    for (int round = 0; round < rounds; round++) {
+      uint64_t start = nowNs();
+      for (uint32_t i = 0; i < 4096; i++) {
+        events.post(EventType::KeyDown, 1, 0, 0, i);
+      }
+      uint64_t mid = nowNs();
+      events.processEvents();
+      drain_ns += nowNs() - mid;
+      post_ns += mid - start;
+    }
+    g_sink = sum;
+    double n = (double)rounds * 4096;
+    std::printf("%-32s %12.1f %12.1f\n", "post (1 thread)", post_ns / n,
+                n / post_ns * 1000);
+    std::printf("%-32s %12.1f %12.1f\n", "dispatch", drain_ns / n,
+                n / drain_ns * 1000);
+  }
+
+  // Producers against a draining dispatch thread
+  {
+    EventManager events(65536);
+    uint64_t delivered = 0;
+    events.addListener(EventType::KeyDown, EventManager::kAnyTarget,
+                       [&](const Event &) { delivered++; });
+    const uint64_t per_producer = 4000000 / producers;
+    std::atomic<uint64_t> refused(0);
+    std::atomic<uint32_t> finished(0);
+    std::vector<std::thread> threads;
+    uint64_t start = nowNs();
+    for (uint32_t p = 0; p < producers; p++) {
+      threads.emplace_back([&, p] {
+        uint64_t local = 0;
+        for (uint64_t i = 0; i < per_producer; i++) {
+          while (!events.post(EventType::KeyDown, 1, 0, 0, p)) {
+            local++;
+            std::this_thread::yield();
+          }
+        }
+        refused += local;
+        finished++;
+      });
+    }
+    while (finished.load() < producers || events.hasPendingEvents()) {
+      events.processEvents();
+    }
+    uint64_t elapsed = nowNs() - start;
+    for (std::thread &thread : threads) {
+      thread.join();
+    }
+    char name[64];
+    std::snprintf(name, sizeof(name), "%u producers + dispatch",
+                  producers);
+    std::printf("%-32s %12.1f %12.1f   %llu frames, %llu refused\n", name,
+                (double)elapsed / delivered,
+                (double)delivered / elapsed * 1000,
+                (unsigned long long)events.getStats().frames,
+                (unsigned long long)refused.load());
+  }
+
+  // Mouse moves over 16 targets, most coalesced away
+  {
+    EventManager events(4096);
+    uint64_t moves = 0;
+    events.addListener(EventType::MouseMove, EventManager::kAnyTarget,
+                       [&](const Event &) { moves++; });
+    const int rounds = 500;
+    uint64_t start = nowNs();
+    for (int round = 0; round < rounds; round++) {
+      for (uint32_t i = 0; i < 4096; i++) {
+        events.post(EventType::MouseMove, 1 + (i & 15), i, i);
+      }
+      events.processEvents();
+    }
+    double n = (double)rounds * 4096;
+    double ns = (double)(nowNs() - start) / n;
+    std::printf("%-32s %12.1f %12.1f   %.2f%% dispatched\n",
+                "moves, 16 targets, coalesced", ns, 1000 / ns,
+                100.0 * moves / n);
+  }
+
+  // Timer wheel: 100K timers from 1 ms to 60 s
+  {
+    EventManager events(64);
+    const int count = 100000;
+    std::vector<EventManager::TimerId> ids(count);
+    Random rng(13);
+    uint64_t start = nowNs();
+    for (int i = 0; i < count; i++) {
+      ids[i] = events.addTimer(rng.range(1, 60000), 0, [] {});
+    }
+    uint64_t added = nowNs();
+    int64_t next = 0;
+    for (int i = 0; i < 1000; i++) {
+      next += events.getTimeUntilNextTimer();
+    }
+    uint64_t queried = nowNs();
+    for (int i = 0; i < count; i++) {
+      events.cancelTimer(ids[i]);
+    }
+    uint64_t cancelled = nowNs();
+    g_sink = (uint64_t)next;
+    std::printf("%-32s %12.1f\n", "timer add (100K live)",
+                (double)(added - start) / count);
+    std::printf("%-32s %12.1f\n", "timer next-deadline query",
+                (double)(queried - added) / 1000);
+    std::printf("%-32s %12.1f\n", "timer cancel",
+                (double)(cancelled - queried) / count);
+  }
+}
+
+int usage() {
+  std::fprintf(stderr, "usage: uitool test\n"
+                       "       uitool bench atlas\n"
+                       "       uitool bench thumbnails [workers]\n"
+                       "       uitool bench grid\n"
+                       "       uitool bench layers\n"
+                       "       uitool bench events [producers]\n");
+  return 2;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc == 2 && std::strcmp(argv[1], "test") == 0) {
+    testAtlasPacking();
+    testAtlasIds();
+    testAtlasEviction();
+    testAtlasBatch();
+    testThumbnailResample();
+    testThumbnailService();
+    testGridLayout();
+    testGridRecycler();
+    testLayerCache();
+    testEventDispatch();
+    testEventRing();
+    testEventTimers();
+    std::printf("%s\n", g_failures ? "FAILED" : "all checks passed");
+    return g_failures ? 1 : 0;
+  }
+  if (argc >= 3 && std::strcmp(argv[1], "bench") == 0) {
+    if (argc == 3 && std::strcmp(argv[2], "atlas") == 0) {
+      benchAtlas();
+      return 0;
+    }
+    if (argc == 3 && std::strcmp(argv[2], "grid") == 0) {
+      benchGrid();
+      return 0;
+    }
+    if (argc == 3 && std::strcmp(argv[2], "layers") == 0) {
+      benchLayers();
+      return 0;
+    }
+    if (argc <= 4 && std::strcmp(argv[2], "events") == 0) {
+      long producers = argc == 4 ? std::atol(argv[3]) : 4;
+      benchEvents(producers > 0 ? (uint32_t)producers : 1);
+      return 0;
+    }
+    if (argc <= 4 && std::strcmp(argv[2], "thumbnails") == 0) {
+      long workers = argc == 4 ? std::atol(argv[3])
+                               : sysconf(_SC_NPROCESSORS_ONLN);
+      benchThumbnails(workers > 0 ? (uint32_t)workers : 1);
+      return 0;
+    }
+  }
+  return usage();
+}